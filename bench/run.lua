@@ -0,0 +1,418 @@
+--[[
+  Lunet benchmark suite
+
+  Runs each scenario in-process on loopback and prints one JSON object per
+  scenario to stdout (human-readable lines go to stderr), so results can be
+  diffed between builds:
+
+    lunet-run bench/run.lua > before.jsonl
+
+  Fields: scenario, ops, seconds, ops_per_sec, p50_ms, p99_ms,
+  lua_bytes_per_op (Lua heap growth with the GC stopped), allocs_per_op
+  (C allocations; null unless built with --lunet_trace=y or
+  --easy_memory=y), plus mb_per_sec where throughput in bytes matters.
+  A scenario whose module is not built reports {"skipped": "..."}.
+
+  Environment:
+    BENCH_ONLY   comma-separated scenario names (default: all)
+    BENCH_SCALE  multiplies every op count (default 1)
+    BENCH_PORT   first loopback port to use (default 19700)
+    BENCH_OUT    also write the results as a JSON array to this file
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+local udp = require("lunet.udp")
+local fs = require("lunet.fs")
+
+local SCALE = tonumber(os.getenv("BENCH_SCALE")) or 1
+local PORT = tonumber(os.getenv("BENCH_PORT")) or 19700
+local HOST = "127.0.0.1"
+
+local ok_new, table_new = pcall(require, "table.new")
+if not ok_new then
+    table_new = function() return {} end
+end
+
+local function count(n)
+    return math.max(1, math.floor(n * SCALE))
+end
+
+-- ---------------------------------------------------------------------------
+-- Measurement
+-- ---------------------------------------------------------------------------
+
+local function c_allocs()
+    local mem = lunet.metrics().mem
+    return mem and mem.allocs or nil
+end
+
+-- A run records one latency sample per op into a preallocated array, so the
+-- samples themselves do not show up as Lua allocations.
+local function new_run(nsamples)
+    local samples = table_new(nsamples, 0)
+    for i = 1, nsamples do samples[i] = 0 end
+    return {samples = samples, n = 0}
+end
+
+local function sample(run, ns)
+    local n = run.n + 1
+    run.n = n
+    run.samples[n] = ns
+end
+
+local function start(run)
+    collectgarbage("collect")
+    collectgarbage("stop")
+    run.kb0 = collectgarbage("count")
+    run.allocs0 = c_allocs()
+    run.t0 = lunet.hrtime()
+end
+
+local function percentile(sorted, n, q)
+    if n == 0 then return 0 end
+    local idx = math.max(1, math.ceil(q * n))
+    return sorted[idx] / 1e6
+end
+
+local function finish(run, ops, extra)
+    local elapsed = (lunet.hrtime() - run.t0) / 1e9
+    local kb = collectgarbage("count") - run.kb0
+    local allocs1 = c_allocs()
+    collectgarbage("restart")
+
+    local n = run.n
+    local sorted = table_new(n, 0)
+    for i = 1, n do sorted[i] = run.samples[i] end
+    table.sort(sorted)
+
+    local r = {
+        ops = ops,
+        seconds = elapsed,
+        ops_per_sec = elapsed > 0 and ops / elapsed or 0,
+        p50_ms = percentile(sorted, n, 0.50),
+        p99_ms = percentile(sorted, n, 0.99),
+        lua_bytes_per_op = kb * 1024 / ops,
+        allocs_per_op = (run.allocs0 and allocs1) and (allocs1 - run.allocs0) / ops or nil,
+    }
+    for k, v in pairs(extra or {}) do r[k] = v end
+    return r
+end
+
+-- ---------------------------------------------------------------------------
+-- Helpers
+-- ---------------------------------------------------------------------------
+
+-- Runs fn(i) in `conc` coroutines and yields until all of them returned
+local function parallel(conc, fn)
+    local left = conc
+    local failure
+    for i = 1, conc do
+        lunet.spawn(function()
+            local ok, err = pcall(fn, i)
+            if not ok and not failure then failure = err end
+            left = left - 1
+        end)
+    end
+    while left > 0 do lunet.sleep(1) end
+    if failure then error(failure, 0) end
+end
+
+local function serve(port, handler)
+    local listener, err = socket.listen("tcp", HOST, port)
+    if not listener then error("listen: " .. tostring(err), 0) end
+    local state = {listener = listener, closed = false}
+    lunet.spawn(function()
+        while not state.closed do
+            local client = socket.accept(listener)
+            if not client then break end
+            lunet.spawn(function()
+                handler(client)
+                socket.close(client)
+            end)
+        end
+    end)
+    return function()
+        state.closed = true
+        socket.close(listener)
+    end
+end
+
+-- ---------------------------------------------------------------------------
+-- Scenarios
+-- ---------------------------------------------------------------------------
+
+local scenarios = {}
+local order = {}
+
+local function scenario(name, fn)
+    scenarios[name] = fn
+    order[#order + 1] = name
+end
+
+scenario("tcp_echo", function()
+    local conns, per_conn, size = 16, count(2000), 64
+    local port = PORT
+    local stop = serve(port, function(client)
+        while true do
+            local data = socket.read(client)
+            if not data then break end
+            if socket.write(client, data) then break end
+        end
+    end)
+
+    local msg = string.rep("x", size)
+    local ops = conns * per_conn
+    local run = new_run(ops)
+    start(run)
+    parallel(conns, function()
+        local c = assert(socket.connect(HOST, port))
+        for _ = 1, per_conn do
+            local t0 = lunet.hrtime()
+            assert(not socket.write(c, msg))
+            assert(socket.read_exact(c, size))
+            sample(run, lunet.hrtime() - t0)
+        end
+        socket.close(c)
+    end)
+    local r = finish(run, ops, {conns = conns, msg_bytes = size})
+    r.mb_per_sec = ops * size * 2 / r.seconds / 1e6
+    stop()
+    return r
+end)
+
+scenario("http_keepalive", function()
+    local conns, per_conn = 16, count(2000)
+    local port = PORT + 1
+    local response = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+        .. "Content-Length: 2\r\nConnection: keep-alive\r\n\r\nok"
+    local stop = serve(port, function(client)
+        while true do
+            local head = socket.read_until(client, "\r\n\r\n", 16384)
+            if not head then break end
+            if socket.write(client, response) then break end
+        end
+    end)
+
+    local request = "GET /bench HTTP/1.1\r\nHost: localhost\r\nConnection: keep-alive\r\n\r\n"
+    local ops = conns * per_conn
+    local run = new_run(ops)
+    start(run)
+    parallel(conns, function()
+        local c = assert(socket.connect(HOST, port))
+        for _ = 1, per_conn do
+            local t0 = lunet.hrtime()
+            assert(not socket.write(c, request))
+            local head = assert(socket.read_until(c, "\r\n\r\n", 16384))
+            local len = tonumber(head:match("[Cc]ontent%-[Ll]ength:%s*(%d+)"))
+            assert(socket.read_exact(c, len))
+            sample(run, lunet.hrtime() - t0)
+        end
+        socket.close(c)
+    end)
+    local r = finish(run, ops, {conns = conns})
+    stop()
+    return r
+end)
+
+scenario("udp_pps", function()
+    local batch, rounds, size = 32, count(2000), 64
+    local port_rx, port_tx = PORT + 2, PORT + 3
+    local rx = assert(udp.bind(HOST, port_rx, {batch = batch}))
+    local tx = assert(udp.bind(HOST, port_tx))
+    local payload = string.rep("u", size)
+    local msgs = {}
+    for i = 1, batch do msgs[i] = {payload, HOST, port_rx} end
+
+    -- One sample per burst: send `batch` datagrams, wait until all arrived
+    local run = new_run(rounds)
+    local received, lost = 0, 0
+    start(run)
+    for _ = 1, rounds do
+        local t0 = lunet.hrtime()
+        assert(udp.send_batch(tx, msgs))
+        local got = 0
+        while got < batch do
+            local list = udp.recv_batch(rx, batch, 100)
+            if not list then break end
+            got = got + #list
+        end
+        received = received + got
+        lost = lost + (batch - got)
+        sample(run, lunet.hrtime() - t0)
+    end
+    local r = finish(run, rounds * batch, {batch = batch, lost = lost})
+    r.ops_per_sec = received / r.seconds
+    r.mb_per_sec = received * size / r.seconds / 1e6
+    udp.close(rx)
+    udp.close(tx)
+    return r
+end)
+
+scenario("paxe", function()
+    local ok, paxe = pcall(require, "lunet.paxe")
+    if not ok then return {skipped = "lunet.paxe not built"} end
+    assert(paxe.init())
+    assert(paxe.keystore_set(1, string.rep("k", 32)))
+    paxe.set_enabled(true)
+
+    local size, ops = 1200, count(100000)
+    local plain = string.rep("p", size)
+    local run = new_run(ops)
+    start(run)
+    for _ = 1, ops do
+        local t0 = lunet.hrtime()
+        local sealed = assert(paxe.encrypt(plain, 1))
+        assert(paxe.try_decrypt(sealed))
+        sample(run, lunet.hrtime() - t0)
+    end
+    local r = finish(run, ops, {msg_bytes = size})
+    r.mb_per_sec = ops * size / r.seconds / 1e6
+    paxe.keystore_clear()
+    paxe.set_enabled(false)
+    return r
+end)
+
+scenario("sqlite", function()
+    local ok, db = pcall(require, "lunet.sqlite3")
+    if not ok then return {skipped = "lunet.sqlite3 not built"} end
+    local conn = assert(db.open({path = ":memory:"}))
+    assert(db.exec(conn, "CREATE TABLE kv (id INTEGER PRIMARY KEY, v TEXT)"))
+    local rows = {}
+    for i = 1, 1000 do rows[i] = {i, "value-" .. i} end
+    assert(db.exec_batch(conn, "INSERT INTO kv (id, v) VALUES (?, ?)", rows))
+
+    local ops = count(20000)
+    local run = new_run(ops)
+    start(run)
+    for i = 1, ops do
+        local t0 = lunet.hrtime()
+        local res = assert(db.query_params(conn, "SELECT v FROM kv WHERE id = ?", i % 1000 + 1))
+        assert(#res == 1)
+        sample(run, lunet.hrtime() - t0)
+    end
+    local r = finish(run, ops)
+    db.close(conn)
+    return r
+end)
+
+scenario("fs_read", function()
+    local chunk, nchunks = 64 * 1024, 64
+    local path = os.tmpname()
+    assert(fs.writefile(path, string.rep("f", chunk * nchunks)))
+    local fd = assert(fs.open(path, "r"))
+
+    local ops = count(20000)
+    local run = new_run(ops)
+    start(run)
+    for i = 1, ops do
+        local t0 = lunet.hrtime()
+        local data = assert(fs.pread(fd, chunk, ((i - 1) % nchunks) * chunk))
+        assert(#data == chunk)
+        sample(run, lunet.hrtime() - t0)
+    end
+    local r = finish(run, ops, {chunk_bytes = chunk})
+    r.mb_per_sec = ops * chunk / r.seconds / 1e6
+    fs.close(fd)
+    os.remove(path)
+    return r
+end)
+
+scenario("spawn_sleep", function()
+    local conc, ops = 1000, count(200000)
+    local run = new_run(ops)
+    start(run)
+    local issued, done = 0, 0
+    while issued < ops do
+        local wave = math.min(conc, ops - issued)
+        local target = done + wave
+        for _ = 1, wave do
+            local t0 = lunet.hrtime()
+            lunet.spawn(function()
+                lunet.sleep(0)
+                sample(run, lunet.hrtime() - t0)
+                done = done + 1
+            end)
+        end
+        issued = issued + wave
+        while done < target do lunet.sleep(0) end
+    end
+    return finish(run, ops, {concurrency = conc})
+end)
+
+-- ---------------------------------------------------------------------------
+-- Output
+-- ---------------------------------------------------------------------------
+
+local function json(v)
+    local t = type(v)
+    if t == "nil" then return "null" end
+    if t == "boolean" then return tostring(v) end
+    if t == "number" then
+        if v ~= v or v == math.huge or v == -math.huge then return "null" end
+        if v == math.floor(v) and math.abs(v) < 2 ^ 53 then return string.format("%d", v) end
+        return string.format("%.6g", v)
+    end
+    if t == "string" then
+        return '"' .. v:gsub('[%c"\\]', function(c)
+            return string.format("\\u%04x", c:byte())
+        end) .. '"'
+    end
+    local keys = {}
+    for k in pairs(v) do keys[#keys + 1] = k end
+    table.sort(keys)
+    local parts = {}
+    for _, k in ipairs(keys) do
+        parts[#parts + 1] = json(tostring(k)) .. ":" .. json(v[k])
+    end
+    return "{" .. table.concat(parts, ",") .. "}"
+end
+
+local selected = {}
+local only = os.getenv("BENCH_ONLY")
+if only and only ~= "" then
+    for name in only:gmatch("[^,%s]+") do
+        if not scenarios[name] then
+            io.stderr:write("unknown scenario: " .. name .. "\n")
+            os.exit(2)
+        end
+        selected[#selected + 1] = name
+    end
+else
+    selected = order
+end
+
+lunet.spawn(function()
+    local results = {}
+    local failed = false
+    for _, name in ipairs(selected) do
+        local ok, r = pcall(scenarios[name])
+        if not ok then
+            -- a scenario that failed mid-run left the GC stopped
+            collectgarbage("restart")
+            r = {error = tostring(r)}
+            failed = true
+        end
+        r.scenario = name
+        results[#results + 1] = r
+        io.stdout:write(json(r), "\n")
+        io.stdout:flush()
+        if r.ops_per_sec then
+            io.stderr:write(string.format("%-16s %12.0f ops/s  p50 %8.3fms  p99 %8.3fms  %s allocs/op\n",
+                name, r.ops_per_sec, r.p50_ms, r.p99_ms,
+                r.allocs_per_op and string.format("%.2f", r.allocs_per_op) or "-"))
+        else
+            io.stderr:write(string.format("%-16s %s\n", name, r.skipped or r.error))
+        end
+    end
+
+    local out = os.getenv("BENCH_OUT")
+    if out and out ~= "" then
+        local parts = {}
+        for i, r in ipairs(results) do parts[i] = json(r) end
+        local f = assert(io.open(out, "w"))
+        f:write("[", table.concat(parts, ",\n"), "]\n")
+        f:close()
+    end
+    _G.__lunet_exit_code = failed and 1 or 0
+end)
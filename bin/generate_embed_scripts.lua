@@ -1,12 +1,16 @@
 import("lib.detect.find_tool")
 
-local MAGIC = "LUNETPK1"
+local MAGIC = "LUNETPK2"
+local FLAG_BYTECODE = 1
+local FLAG_GZIP = 2
 
 local function parse_args(argv)
     local args = {
         source = os.getenv("LUNET_EMBED_SOURCE") or "lua",
         output = os.getenv("LUNET_EMBED_OUTPUT"),
-        project_root = os.getenv("LUNET_EMBED_PROJECT_ROOT") or "."
+        project_root = os.getenv("LUNET_EMBED_PROJECT_ROOT") or ".",
+        bytecode = os.getenv("LUNET_EMBED_BYTECODE") == "y",
+        luajit = os.getenv("LUNET_EMBED_LUAJIT")
     }
     local i = 1
     if argv[i] == "--" then
@@ -27,6 +31,10 @@ local function parse_args(argv)
                 args.output = val
             elseif key == "--project-root" then
                 args.project_root = val
+            elseif key == "--bytecode" then
+                args.bytecode = (val == "y" or val == "true")
+            elseif key == "--luajit" then
+                args.luajit = val
             else
                 raise("unknown argument: %s", tostring(key))
             end
@@ -63,43 +71,77 @@ local function normalize_relpath(p)
     return (p or ""):gsub("\\", "/")
 end
 
-local function build_manifest(source_dir, payload_path)
-    local files = os.files(path.join(source_dir, "**"))
-    table.sort(files)
+-- Compiled with debug info so tracebacks keep file names and line numbers
+local function compile_bytecode(luajit, source_dir, rel, out_path)
+    os.vrunv(luajit, {"-bg", rel, out_path}, {curdir = source_dir})
+    return assert(io.readfile(out_path, {encoding = "binary"}))
+end
 
-    local payload = assert(io.open(payload_path, "wb"))
-    payload:write(MAGIC)
-    payload:write(u32le(#files))
+local function gzip_data(gzip, data, tmp_path)
+    local raw_path = tmp_path .. ".raw"
+    local out = assert(io.open(raw_path, "wb"))
+    out:write(data)
+    out:close()
+    os.vrunv(gzip, {"-n", "-9", "-c", path.filename(raw_path)},
+             {curdir = path.directory(raw_path), stdout = tmp_path})
+    os.tryrm(raw_path)
+    return assert(io.readfile(tmp_path, {encoding = "binary"}))
+end
 
+-- Every entry is its own gzip member so the runtime inflates modules lazily
+local function build_pack(source_dir, pack_path, opts)
+    local files = os.files(path.join(source_dir, "**"))
+    local entries = {}
     for _, abs in ipairs(files) do
-        local rel = normalize_relpath(path.relative(abs, source_dir))
-        local data = assert(io.readfile(abs, {encoding = "binary"}))
-        payload:write(u32le(#rel))
-        payload:write(u64le(#data))
-        payload:write(rel)
-        payload:write(data)
+        table.insert(entries, {abs = abs, rel = normalize_relpath(path.relative(abs, source_dir))})
     end
+    table.sort(entries, function (a, b) return a.rel < b.rel end)
 
-    payload:close()
-end
-
-local function gzip_manifest(payload_path, gzip_path)
     local gzip = assert(find_tool("gzip"), "gzip not found in PATH")
-    os.vrunv(gzip.program,
-             {"-n", "-c", path.filename(payload_path)},
-             {curdir = path.directory(payload_path), stdout = gzip_path})
+    local tmp_path = pack_path .. ".entry"
+    local pack = assert(io.open(pack_path, "wb"))
+    pack:write(MAGIC)
+    pack:write(u32le(#entries))
+
+    for _, entry in ipairs(entries) do
+        local flags = 0
+        local data
+        if opts.luajit and entry.rel:match("%.lua$") then
+            data = compile_bytecode(opts.luajit, source_dir, entry.rel, tmp_path)
+            flags = flags + FLAG_BYTECODE
+        else
+            data = assert(io.readfile(entry.abs, {encoding = "binary"}))
+        end
+        local stored = data
+        if #data > 0 then
+            local packed = gzip_data(gzip.program, data, tmp_path)
+            if #packed < #data then
+                stored = packed
+                flags = flags + FLAG_GZIP
+            end
+        end
+        pack:write(u32le(#entry.rel))
+        pack:write(u32le(flags))
+        pack:write(u64le(#data))
+        pack:write(u64le(#stored))
+        pack:write(entry.rel)
+        pack:write(stored)
+    end
+
+    pack:close()
+    os.tryrm(tmp_path)
 end
 
-local function emit_header(gzip_path, output_path)
-    local blob = assert(io.readfile(gzip_path, {encoding = "binary"}))
-    assert(#blob > 0, "gzip output is empty")
+local function emit_header(pack_path, output_path)
+    local blob = assert(io.readfile(pack_path, {encoding = "binary"}))
+    assert(#blob > 0, "embedded pack is empty")
 
     local out = assert(io.open(output_path, "wb"))
     out:write("/* Auto-generated by bin/generate_embed_scripts.lua. */\n")
     out:write("#ifndef LUNET_EMBED_SCRIPTS_BLOB_GENERATED_H\n")
     out:write("#define LUNET_EMBED_SCRIPTS_BLOB_GENERATED_H\n\n")
     out:write("#include <stddef.h>\n\n")
-    out:write("const unsigned char lunet_embedded_scripts_gzip[] = {\n")
+    out:write("const unsigned char lunet_embedded_scripts_pack[] = {\n")
     for i = 1, #blob do
         if (i - 1) % 12 == 0 then
             out:write("  ")
@@ -116,7 +158,7 @@ local function emit_header(gzip_path, output_path)
         out:write("\n")
     end
     out:write("};\n")
-    out:write(string.format("const size_t lunet_embedded_scripts_gzip_len = %d;\n\n", #blob))
+    out:write(string.format("const size_t lunet_embedded_scripts_pack_len = %d;\n\n", #blob))
     out:write("#endif\n")
     out:close()
 end
@@ -129,15 +171,21 @@ local function main()
     assert(os.isdir(source_dir), "embed source directory not found: " .. source_dir)
     os.mkdir(path.directory(output_path))
 
-    local payload_path = output_path .. ".payload.bin"
-    local gzip_path = output_path .. ".payload.bin.gz"
-
-    build_manifest(source_dir, payload_path)
-    gzip_manifest(payload_path, gzip_path)
-    emit_header(gzip_path, output_path)
+    -- Bytecode only loads in the VM that produced it, so never fall back to
+    -- whichever luajit happens to be in PATH
+    local luajit
+    if args.bytecode then
+        luajit = args.luajit
+        if not luajit or not os.isfile(luajit) then
+            raise("--bytecode y needs --luajit (or LUNET_EMBED_LUAJIT) pointing at the luajit " ..
+                  "the binary links against, got: %s", tostring(luajit))
+        end
+    end
 
-    os.tryrm(payload_path)
-    os.tryrm(gzip_path)
+    local pack_path = output_path .. ".pack.bin"
+    build_pack(source_dir, pack_path, {luajit = luajit})
+    emit_header(pack_path, output_path)
+    os.tryrm(pack_path)
 end
 
 main()
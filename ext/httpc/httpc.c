@@ -6,6 +6,9 @@
 
 #include "lunet_lua.h"
 #include "co.h"
+#include "lunet_mem.h"
+#include "metrics.h"
+#include "rt.h"
 #include "trace.h"
 
 #include "httpc.h"
@@ -57,10 +60,26 @@ static void httpc_strlist_free(httpc_strlist_t *l) {
   l->cap = 0;
 }
 
-typedef struct {
-  uv_work_t req;
+// httpc.stream buffers at most this much per direction before pausing curl
+#define HTTPC_STREAM_BUFFER (64 * 1024)
+
+#define LUNET_HTTPC_STREAM_MT "lunet.httpc.stream"
+
+typedef enum {
+  HTTPC_UPLOAD_NONE = 0,
+  HTTPC_UPLOAD_FD,
+  HTTPC_UPLOAD_PRODUCER,
+} httpc_upload_t;
+
+typedef struct httpc_engine httpc_engine_t;
+typedef struct httpc_req httpc_req_t;
+
+struct httpc_req {
+  CURL *easy;
+  httpc_engine_t *eng;
   lua_State *L;
   int co_ref;
+  uint64_t start_ns;
 
   char *url;
   char *method;
@@ -81,7 +100,72 @@ typedef struct {
 
   char err[256];
   int too_large;
-} httpc_req_t;
+
+  /*
+   * httpc.stream: resp_body holds body bytes not read yet and up_buf the
+   * upload bytes curl has not taken. Curl callbacks never run Lua; they
+   * queue the request on the ready list and the engine wakes the parked
+   * coroutine (co_ref waits for headers, reader_ref in :read(), writer_ref in
+   * the producer's write()) once curl has returned.
+   */
+  int stream;
+  int done;
+  int paused;
+  int ready;
+  httpc_req_t *ready_prev;
+  httpc_req_t *ready_next;
+  int self_ref;
+  int reader_ref;
+  int writer_ref;
+
+  httpc_upload_t upload;
+  uv_file up_fd;
+  curl_off_t upload_size;
+  uv_fs_t up_req;
+  char *up_buf;
+  size_t up_len;
+  size_t up_off;
+  size_t up_cap;
+  int up_paused;
+  int up_reading;
+  int up_eof;
+  int up_failed;
+  int orphaned;
+};
+
+typedef struct {
+  httpc_req_t *ctx;
+} httpc_stream_t;
+
+static LUNET_THREAD_LOCAL httpc_req_t *t_ready;
+
+static void httpc_ready_add(httpc_req_t *ctx) {
+  if (ctx->ready) return;
+  ctx->ready = 1;
+  ctx->ready_prev = NULL;
+  ctx->ready_next = t_ready;
+  if (t_ready) t_ready->ready_prev = ctx;
+  t_ready = ctx;
+}
+
+static void httpc_ready_remove(httpc_req_t *ctx) {
+  if (!ctx->ready) return;
+  if (ctx->ready_prev) ctx->ready_prev->ready_next = ctx->ready_next;
+  else t_ready = ctx->ready_next;
+  if (ctx->ready_next) ctx->ready_next->ready_prev = ctx->ready_prev;
+  ctx->ready = 0;
+}
+
+// Whether a coroutine parked on this stream can be resumed
+static int httpc_stream_due(const httpc_req_t *ctx) {
+  int data = ctx->resp_len > 0 || ctx->done;
+  if (ctx->co_ref != LUA_NOREF) return data;
+  if (ctx->reader_ref != LUA_NOREF && data) return 1;
+  if (ctx->writer_ref != LUA_NOREF) {
+    return ctx->done || ctx->up_len - ctx->up_off < HTTPC_STREAM_BUFFER;
+  }
+  return 0;
+}
 
 static int httpc_env_truthy(const char *name) {
   const char *v = getenv(name);
@@ -96,12 +180,29 @@ static int httpc_env_truthy(const char *name) {
   return 0;
 }
 
+static long httpc_env_long(const char *name, long def, long lo, long hi) {
+  const char *v = getenv(name);
+  if (!v || !*v) return def;
+  char *end = NULL;
+  long n = strtol(v, &end, 10);
+  if (*end != '\0') return def;
+  if (n < lo) return lo;
+  if (n > hi) return hi;
+  return n;
+}
+
 static size_t httpc_write_cb(char *ptr, size_t size, size_t nmemb, void *userdata) {
   httpc_req_t *ctx = (httpc_req_t *)userdata;
   size_t n = size * nmemb;
   if (n == 0) return 0;
 
-  if (ctx->resp_len + n > ctx->max_body_bytes) {
+  if (ctx->stream) {
+    // Curl hands the same bytes back once the reader unpauses us
+    if (ctx->resp_len >= HTTPC_STREAM_BUFFER) {
+      ctx->paused = 1;
+      return CURL_WRITEFUNC_PAUSE;
+    }
+  } else if (ctx->resp_len + n > ctx->max_body_bytes) {
     ctx->too_large = 1;
     return 0; // abort
   }
@@ -121,6 +222,7 @@ static size_t httpc_write_cb(char *ptr, size_t size, size_t nmemb, void *userdat
   memcpy(ctx->resp_body + ctx->resp_len, ptr, n);
   ctx->resp_len += n;
   ctx->resp_body[ctx->resp_len] = '\0';
+  if (ctx->stream && httpc_stream_due(ctx)) httpc_ready_add(ctx);
   return n;
 }
 
@@ -149,20 +251,275 @@ static size_t httpc_header_cb(char *buffer, size_t size, size_t nitems, void *us
   return size * nitems;
 }
 
-static void httpc_work_cb(uv_work_t *req) {
-  httpc_req_t *ctx = (httpc_req_t *)req->data;
-  ctx->err[0] = '\0';
-  ctx->too_large = 0;
+static void httpc_upload_read_cb(uv_fs_t *req);
 
-  CURL *curl = curl_easy_init();
-  if (!curl) {
-    snprintf(ctx->err, sizeof(ctx->err), "curl init failed");
-    return;
+static int httpc_upload_fill(httpc_req_t *ctx) {
+  if (!ctx->up_buf) {
+    ctx->up_buf = (char *)malloc(HTTPC_STREAM_BUFFER);
+    if (!ctx->up_buf) {
+      snprintf(ctx->err, sizeof(ctx->err), "out of memory");
+      return -1;
+    }
+    ctx->up_cap = HTTPC_STREAM_BUFFER;
+  }
+  uv_buf_t buf = uv_buf_init(ctx->up_buf, (unsigned int)ctx->up_cap);
+  ctx->up_req.data = ctx;
+  int rc = uv_fs_read(lunet_loop(), &ctx->up_req, ctx->up_fd, &buf, 1, -1, httpc_upload_read_cb);
+  if (rc < 0) {
+    snprintf(ctx->err, sizeof(ctx->err), "upload read failed: %s", uv_strerror(rc));
+    return -1;
+  }
+  ctx->up_reading = 1;
+  return 0;
+}
+
+static size_t httpc_read_cb(char *dst, size_t size, size_t nitems, void *userdata) {
+  httpc_req_t *ctx = (httpc_req_t *)userdata;
+  size_t cap = size * nitems;
+  size_t avail = ctx->up_len - ctx->up_off;
+
+  if (avail > 0) {
+    size_t n = avail < cap ? avail : cap;
+    memcpy(dst, ctx->up_buf + ctx->up_off, n);
+    ctx->up_off += n;
+    if (ctx->up_off == ctx->up_len) ctx->up_off = ctx->up_len = 0;
+    if (httpc_stream_due(ctx)) httpc_ready_add(ctx);
+    return n;
+  }
+  if (ctx->up_failed) return CURL_READFUNC_ABORT;
+  if (ctx->up_eof) return 0;
+
+  // Nothing buffered: pause until the file read or the producer refills us
+  if (ctx->upload == HTTPC_UPLOAD_FD && !ctx->up_reading && httpc_upload_fill(ctx) != 0) {
+    return CURL_READFUNC_ABORT;
+  }
+  ctx->up_paused = 1;
+  return CURL_READFUNC_PAUSE;
+}
+
+/*
+ * Transfer engine, one per loop thread.
+ *
+ * Every request is an easy handle on one CURLM driven by
+ * curl_multi_socket_action: curl tells us which sockets to watch (uv_poll_t)
+ * and when to wake it (uv_timer_t), so any number of transfers share the loop
+ * thread. The engine is created by the first request and closed when the last
+ * one finishes, so an idle httpc never keeps the loop alive or leaves handles
+ * open at uv_loop_close.
+ *
+ * Connections, TLS sessions and DNS answers live in a per-thread CURLSH
+ * instead, so they outlive the engine and are reused by the next burst of
+ * requests. libcurl closes cached connections idle for LUNET_HTTPC_IDLE_MS.
+ */
+typedef struct httpc_sock httpc_sock_t;
+
+struct httpc_engine {
+  uv_loop_t *loop;
+  CURLM *multi;
+  uv_timer_t timer;
+  httpc_sock_t *socks;
+  int inflight;
+};
+
+struct httpc_sock {
+  uv_poll_t poll;
+  curl_socket_t fd;
+  httpc_engine_t *eng;
+  httpc_sock_t *prev;
+  httpc_sock_t *next;
+};
+
+typedef struct {
+  uint64_t requests;
+  uint64_t completed;
+  uint64_t failed;
+  uint64_t connects;
+  uint64_t reused;
+  int sockets;
+} httpc_stats_t;
+
+/*
+ * Read once from the environment:
+ *   LUNET_HTTPC_MAX_HOST_CONNECTIONS  per-host connection cap (0 = unlimited)
+ *   LUNET_HTTPC_MAX_CONNECTIONS       total connection cap (0 = unlimited)
+ *   LUNET_HTTPC_IDLE_MS               idle connection expiry (default 60000)
+ * Requests over a cap wait inside curl for a free connection.
+ */
+typedef struct {
+  long max_host_conns;
+  long max_total_conns;
+  long idle_ms;
+} httpc_config_t;
+
+static httpc_config_t g_config;
+static uv_once_t g_config_once = UV_ONCE_INIT;
+
+static LUNET_THREAD_LOCAL httpc_engine_t *t_engine;
+static LUNET_THREAD_LOCAL CURLSH *t_share;
+static LUNET_THREAD_LOCAL httpc_stats_t t_stats;
+
+static void httpc_config_init(void) {
+  g_config.max_host_conns = httpc_env_long("LUNET_HTTPC_MAX_HOST_CONNECTIONS", 0, 0, 1L << 20);
+  g_config.max_total_conns = httpc_env_long("LUNET_HTTPC_MAX_CONNECTIONS", 0, 0, 1L << 20);
+  g_config.idle_ms = httpc_env_long("LUNET_HTTPC_IDLE_MS", 60000, 1, 24L * 3600 * 1000);
+}
+
+// Unlocked: every loop thread has its own share
+static CURLSH *httpc_share_get(void) {
+  if (t_share) return t_share;
+  CURLSH *sh = curl_share_init();
+  if (!sh) return NULL;
+  curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+  curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+  t_share = sh;
+  return sh;
+}
+
+static void httpc_engine_run(httpc_engine_t *eng);
+
+static void httpc_sock_close_cb(uv_handle_t *handle) {
+  lunet_free_nonnull(handle->data);
+}
+
+static void httpc_sock_close(httpc_sock_t *sock) {
+  httpc_engine_t *eng = sock->eng;
+  if (sock->prev) sock->prev->next = sock->next;
+  else eng->socks = sock->next;
+  if (sock->next) sock->next->prev = sock->prev;
+  t_stats.sockets--;
+  uv_poll_stop(&sock->poll);
+  uv_close((uv_handle_t *)&sock->poll, httpc_sock_close_cb);
+}
+
+static void httpc_poll_cb(uv_poll_t *handle, int status, int events) {
+  httpc_sock_t *sock = (httpc_sock_t *)handle->data;
+  httpc_engine_t *eng = sock->eng;
+  int flags = 0;
+  if (status < 0) {
+    flags = CURL_CSELECT_ERR;
+  } else {
+    if (events & UV_READABLE) flags |= CURL_CSELECT_IN;
+    if (events & UV_WRITABLE) flags |= CURL_CSELECT_OUT;
+  }
+  int running = 0;
+  // May drop this socket; the struct stays valid until its close callback
+  curl_multi_socket_action(eng->multi, sock->fd, flags, &running);
+  httpc_engine_run(eng);
+}
+
+static int httpc_socket_cb(CURL *easy, curl_socket_t s, int what, void *userp, void *socketp) {
+  (void)easy;
+  httpc_engine_t *eng = (httpc_engine_t *)userp;
+  httpc_sock_t *sock = (httpc_sock_t *)socketp;
+
+  if (what == CURL_POLL_REMOVE) {
+    if (sock) httpc_sock_close(sock);
+    return 0;
+  }
+
+  if (!sock) {
+    sock = lunet_calloc(1, sizeof(*sock));
+    if (!sock) return -1;
+    if (uv_poll_init_socket(eng->loop, &sock->poll, s) < 0) {
+      lunet_free(sock);
+      return -1;
+    }
+    sock->poll.data = sock;
+    sock->fd = s;
+    sock->eng = eng;
+    sock->next = eng->socks;
+    if (eng->socks) eng->socks->prev = sock;
+    eng->socks = sock;
+    t_stats.sockets++;
+    curl_multi_assign(eng->multi, s, sock);
+  }
+
+  int events = 0;
+  if (what & CURL_POLL_IN) events |= UV_READABLE;
+  if (what & CURL_POLL_OUT) events |= UV_WRITABLE;
+  return uv_poll_start(&sock->poll, events, httpc_poll_cb) < 0 ? -1 : 0;
+}
+
+static void httpc_timer_cb(uv_timer_t *handle) {
+  httpc_engine_t *eng = (httpc_engine_t *)handle->data;
+  int running = 0;
+  curl_multi_socket_action(eng->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+  httpc_engine_run(eng);
+}
+
+static int httpc_timer_fn(CURLM *multi, long timeout_ms, void *userp) {
+  (void)multi;
+  httpc_engine_t *eng = (httpc_engine_t *)userp;
+  if (timeout_ms < 0) {
+    uv_timer_stop(&eng->timer);
+  } else {
+    // A zero timeout still waits for the next loop turn: curl must not be
+    // re-entered from its own callback
+    uv_timer_start(&eng->timer, httpc_timer_cb, (uint64_t)timeout_ms, 0);
   }
+  return 0;
+}
+
+static void httpc_engine_close_cb(uv_handle_t *handle) {
+  lunet_free_nonnull(handle->data);
+}
+
+static void httpc_engine_close(httpc_engine_t *eng) {
+  if (t_engine == eng) t_engine = NULL;
+  // Closes cached connections, which may still report CURL_POLL_REMOVE
+  curl_multi_cleanup(eng->multi);
+  eng->multi = NULL;
+  while (eng->socks) httpc_sock_close(eng->socks);
+  uv_timer_stop(&eng->timer);
+  uv_close((uv_handle_t *)&eng->timer, httpc_engine_close_cb);
+}
+
+// Runs the engine on the next loop turn, which also closes it when idle
+static void httpc_engine_kick(httpc_engine_t *eng) {
+  uv_timer_start(&eng->timer, httpc_timer_cb, 0, 0);
+}
 
+static httpc_engine_t *httpc_engine_get(void) {
+  httpc_engine_t *eng = t_engine;
+  if (eng) return eng;
+  eng = lunet_calloc(1, sizeof(*eng));
+  if (!eng) return NULL;
+  eng->multi = curl_multi_init();
+  if (!eng->multi) {
+    lunet_free(eng);
+    return NULL;
+  }
+  uv_once(&g_config_once, httpc_config_init);
+  eng->loop = lunet_loop();
+  uv_timer_init(eng->loop, &eng->timer);
+  eng->timer.data = eng;
+  curl_multi_setopt(eng->multi, CURLMOPT_MAX_HOST_CONNECTIONS, g_config.max_host_conns);
+  curl_multi_setopt(eng->multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, g_config.max_total_conns);
+  curl_multi_setopt(eng->multi, CURLMOPT_SOCKETFUNCTION, httpc_socket_cb);
+  curl_multi_setopt(eng->multi, CURLMOPT_SOCKETDATA, eng);
+  curl_multi_setopt(eng->multi, CURLMOPT_TIMERFUNCTION, httpc_timer_fn);
+  curl_multi_setopt(eng->multi, CURLMOPT_TIMERDATA, eng);
+  t_engine = eng;
+  return eng;
+}
+
+static CURL *httpc_easy_new(httpc_req_t *ctx) {
+  CURL *curl = curl_easy_init();
+  if (!curl) return NULL;
+
+  curl_easy_setopt(curl, CURLOPT_PRIVATE, ctx);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  CURLSH *share = httpc_share_get();
+  if (share) curl_easy_setopt(curl, CURLOPT_SHARE, share);
+#if LIBCURL_VERSION_NUM >= 0x074100
+  curl_easy_setopt(curl, CURLOPT_MAXAGE_CONN, (g_config.idle_ms + 999) / 1000);
+#endif
   curl_easy_setopt(curl, CURLOPT_URL, ctx->url);
   curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, ctx->timeout_ms);
+  if (ctx->timeout_ms > 0) curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, ctx->timeout_ms);
   curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
   curl_easy_setopt(curl, CURLOPT_USERAGENT, "lunet-httpc/0.1");
 
@@ -171,7 +528,7 @@ static void httpc_work_cb(uv_work_t *req) {
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
   }
 
-  if (ctx->method && strcmp(ctx->method, "GET") == 0 && ctx->body == NULL) {
+  if (ctx->method && strcmp(ctx->method, "GET") == 0 && ctx->body == NULL && !ctx->upload) {
     curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
   } else {
     curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, ctx->method ? ctx->method : "GET");
@@ -182,6 +539,14 @@ static void httpc_work_cb(uv_work_t *req) {
     curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)ctx->body_len);
   }
 
+  if (ctx->upload) {
+    // Size -1 sends the body chunked
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, ctx->upload_size);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, httpc_read_cb);
+    curl_easy_setopt(curl, CURLOPT_READDATA, ctx);
+  }
+
   if (ctx->req_headers) {
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, ctx->req_headers);
   }
@@ -190,9 +555,24 @@ static void httpc_work_cb(uv_work_t *req) {
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, ctx);
   curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, httpc_header_cb);
   curl_easy_setopt(curl, CURLOPT_HEADERDATA, ctx);
+  return curl;
+}
 
-  CURLcode rc = curl_easy_perform(curl);
+static void httpc_capture_info(httpc_req_t *ctx) {
+  long status = 0;
+  curl_easy_getinfo(ctx->easy, CURLINFO_RESPONSE_CODE, &status);
+  ctx->status = status;
+  if (ctx->effective_url) return;
 
+  char *eff = NULL;
+  if (curl_easy_getinfo(ctx->easy, CURLINFO_EFFECTIVE_URL, &eff) == CURLE_OK && eff) {
+    ctx->effective_url = lunet_strdup_local(eff);
+  }
+}
+
+static void httpc_finish(httpc_req_t *ctx, CURLcode rc) {
+  CURL *curl = ctx->easy;
+  lunet_metrics_since(LUNET_METRIC_HTTPC, ctx->start_ns);
   if (ctx->too_large) {
     snprintf(ctx->err, sizeof(ctx->err), "response too large");
   } else if (ctx->err[0] != '\0') {
@@ -200,53 +580,36 @@ static void httpc_work_cb(uv_work_t *req) {
   } else if (rc != CURLE_OK) {
     snprintf(ctx->err, sizeof(ctx->err), "%s", curl_easy_strerror(rc));
   } else {
-    long status = 0;
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
-    ctx->status = status;
-
-    char *eff = NULL;
-    if (curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &eff) == CURLE_OK && eff) {
-      size_t n = strlen(eff);
-      ctx->effective_url = (char *)malloc(n + 1);
-      if (ctx->effective_url) {
-        memcpy(ctx->effective_url, eff, n + 1);
-      }
-    }
-  }
-
-  curl_easy_cleanup(curl);
-}
+    httpc_capture_info(ctx);
 
-static void httpc_after_cb(uv_work_t *req, int status) {
-  (void)status;
-  httpc_req_t *ctx = (httpc_req_t *)req->data;
-  lua_State *L = ctx->L;
-
-  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
-  lunet_coref_release(L, ctx->co_ref);
-  if (!lua_isthread(L, -1)) {
-    lua_pop(L, 1);
-    fprintf(stderr, "invalid coroutine in httpc.request\n");
-    goto cleanup;
+    // New connections made for this transfer, redirects included
+    long connects = 0;
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+    t_stats.connects += (uint64_t)connects;
+    if (connects == 0) t_stats.reused++;
   }
-  lua_State *co = lua_tothread(L, -1);
-  lua_pop(L, 1);
+}
 
-  if (ctx->err[0] != '\0') {
-    lua_pushnil(co);
-    lua_pushstring(co, ctx->err);
-    lunet_co_resume(co, 2);
-    goto cleanup;
-  }
+static void httpc_req_free(httpc_req_t *ctx) {
+  if (ctx->easy) curl_easy_cleanup(ctx->easy);
+  free(ctx->url);
+  free(ctx->method);
+  free(ctx->body);
+  if (ctx->req_headers) curl_slist_free_all(ctx->req_headers);
+  free(ctx->resp_body);
+  httpc_strlist_free(&ctx->resp_headers);
+  free(ctx->effective_url);
+  free(ctx->up_buf);
+  free(ctx);
+}
 
-  lua_newtable(co);
+// Pushes {status, headers, effective_url}; the caller adds the body
+static void httpc_push_response(lua_State *co, httpc_req_t *ctx) {
+  lua_createtable(co, 0, 4);
 
   lua_pushinteger(co, (lua_Integer)ctx->status);
   lua_setfield(co, -2, "status");
 
-  lua_pushlstring(co, ctx->resp_body ? ctx->resp_body : "", ctx->resp_len);
-  lua_setfield(co, -2, "body");
-
   lua_newtable(co);
   lua_Integer out_i = 0;
   for (size_t i = 0; i < ctx->resp_headers.len; i++) {
@@ -270,19 +633,180 @@ static void httpc_after_cb(uv_work_t *req, int status) {
     lua_pushstring(co, ctx->effective_url);
     lua_setfield(co, -2, "effective_url");
   }
+}
+
+static lua_State *httpc_take_co(lua_State *L, int *ref) {
+  lua_rawgeti(L, LUA_REGISTRYINDEX, *ref);
+  lunet_coref_release(L, *ref);
+  *ref = LUA_NOREF;
+  lua_State *co = lua_isthread(L, -1) ? lua_tothread(L, -1) : NULL;
+  lua_pop(L, 1);
+  if (!co) fprintf(stderr, "invalid coroutine in httpc\n");
+  return co;
+}
+
+static void httpc_complete(httpc_req_t *ctx) {
+  lua_State *co = httpc_take_co(ctx->L, &ctx->co_ref);
+  if (!co) goto cleanup;
+
+  if (ctx->err[0] != '\0') {
+    lua_pushnil(co);
+    lua_pushstring(co, ctx->err);
+    lunet_co_resume(co, 2);
+    goto cleanup;
+  }
+
+  httpc_push_response(co, ctx);
+  lua_pushlstring(co, ctx->resp_body ? ctx->resp_body : "", ctx->resp_len);
+  lua_setfield(co, -2, "body");
 
   lua_pushnil(co);
   lunet_co_resume(co, 2);
 
 cleanup:
-  free(ctx->url);
-  free(ctx->method);
-  free(ctx->body);
-  if (ctx->req_headers) curl_slist_free_all(ctx->req_headers);
-  free(ctx->resp_body);
-  httpc_strlist_free(&ctx->resp_headers);
-  free(ctx->effective_url);
-  free(ctx);
+  httpc_req_free(ctx);
+}
+
+static void httpc_unpause(httpc_req_t *ctx, int which) {
+  if (which & CURLPAUSE_RECV) ctx->paused = 0;
+  if (which & CURLPAUSE_SEND) ctx->up_paused = 0;
+  if (ctx->done) return;
+  // May call the write callback with the bytes it refused
+  curl_easy_pause(ctx->easy, (ctx->paused ? CURLPAUSE_RECV : 0) | (ctx->up_paused ? CURLPAUSE_SEND : 0));
+}
+
+// Pushes the next chunk, or nil at the end, or nil, err
+static int httpc_stream_push_chunk(lua_State *co, httpc_req_t *ctx) {
+  if (ctx->resp_len > 0) {
+    lua_pushlstring(co, ctx->resp_body, ctx->resp_len);
+    ctx->resp_len = 0;
+    if (ctx->paused) httpc_unpause(ctx, CURLPAUSE_RECV);
+    return 1;
+  }
+  lua_pushnil(co);
+  if (ctx->done && ctx->err[0] != '\0') {
+    lua_pushstring(co, ctx->err);
+    return 2;
+  }
+  return 1;
+}
+
+/*
+ * Resumes one coroutine parked on ctx. If another is still due, ctx is queued
+ * again first: the resumed code may collect the stream and free ctx.
+ */
+static void httpc_stream_wake(httpc_req_t *ctx) {
+  lua_State *L = ctx->L;
+  int data = ctx->resp_len > 0 || ctx->done;
+
+  if (ctx->co_ref != LUA_NOREF) {
+    if (!data) return;
+    lua_State *co = httpc_take_co(L, &ctx->co_ref);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->self_ref);
+    lunet_coref_release(L, ctx->self_ref);
+    ctx->self_ref = LUA_NOREF;
+    if (!co) {
+      lua_pop(L, 1);
+      return;
+    }
+    if (ctx->done && ctx->err[0] != '\0') {
+      lua_pushnil(co);
+      lua_pushstring(co, ctx->err);
+      lua_pop(L, 1);
+      if (httpc_stream_due(ctx)) httpc_ready_add(ctx);
+      lunet_co_resume(co, 2);
+      return;
+    }
+    if (!ctx->done) httpc_capture_info(ctx);
+    httpc_push_response(co, ctx);
+    lua_xmove(L, co, 1);
+    lua_setfield(co, -2, "body");
+    lua_pushnil(co);
+    if (httpc_stream_due(ctx)) httpc_ready_add(ctx);
+    lunet_co_resume(co, 2);
+    return;
+  }
+
+  if (ctx->reader_ref != LUA_NOREF && data) {
+    lua_State *co = httpc_take_co(L, &ctx->reader_ref);
+    int nret = co ? httpc_stream_push_chunk(co, ctx) : 0;
+    if (httpc_stream_due(ctx)) httpc_ready_add(ctx);
+    if (co) lunet_co_resume(co, nret);
+    return;
+  }
+
+  if (ctx->writer_ref != LUA_NOREF && httpc_stream_due(ctx)) {
+    lua_State *co = httpc_take_co(L, &ctx->writer_ref);
+    if (!co) return;
+    if (ctx->done) {
+      lua_pushnil(co);
+      lua_pushstring(co, ctx->err[0] ? ctx->err : "request finished");
+      lunet_co_resume(co, 2);
+    } else {
+      lua_pushboolean(co, 1);
+      lunet_co_resume(co, 1);
+    }
+  }
+}
+
+static void httpc_flush(void) {
+  httpc_req_t *ctx;
+  while ((ctx = t_ready) != NULL) {
+    httpc_ready_remove(ctx);
+    httpc_stream_wake(ctx);
+  }
+}
+
+static void httpc_upload_read_cb(uv_fs_t *req) {
+  httpc_req_t *ctx = (httpc_req_t *)req->data;
+  ssize_t n = req->result;
+  uv_fs_req_cleanup(req);
+  ctx->up_reading = 0;
+  if (ctx->orphaned) {
+    httpc_req_free(ctx);
+    return;
+  }
+  if (ctx->done) return;
+
+  if (n < 0) {
+    snprintf(ctx->err, sizeof(ctx->err), "upload read failed: %s", uv_strerror((int)n));
+    ctx->up_failed = 1;
+  } else if (n == 0) {
+    ctx->up_eof = 1;
+  } else {
+    ctx->up_len = (size_t)n;
+    ctx->up_off = 0;
+  }
+  httpc_engine_t *eng = ctx->eng;
+  if (ctx->up_paused) httpc_unpause(ctx, CURLPAUSE_SEND);
+  httpc_engine_run(eng);
+}
+
+static void httpc_engine_run(httpc_engine_t *eng) {
+  CURLMsg *msg;
+  int pending = 0;
+  while ((msg = curl_multi_info_read(eng->multi, &pending)) != NULL) {
+    if (msg->msg != CURLMSG_DONE) continue;
+    // msg does not survive curl_multi_remove_handle
+    CURL *easy = msg->easy_handle;
+    CURLcode rc = msg->data.result;
+    httpc_req_t *ctx = NULL;
+    curl_easy_getinfo(easy, CURLINFO_PRIVATE, (char **)&ctx);
+    curl_multi_remove_handle(eng->multi, easy);
+    eng->inflight--;
+    httpc_finish(ctx, rc);
+    t_stats.completed++;
+    if (ctx->err[0] != '\0') t_stats.failed++;
+    if (ctx->stream) {
+      ctx->done = 1;
+      if (httpc_stream_due(ctx)) httpc_ready_add(ctx);
+    } else {
+      // The resumed coroutine may add requests to this engine
+      httpc_complete(ctx);
+    }
+  }
+  httpc_flush();
+  if (eng->inflight == 0 && t_engine == eng) httpc_engine_close(eng);
 }
 
 static int httpc_parse_headers(lua_State *L, int idx, struct curl_slist **out, char *err, size_t errsz) {
@@ -373,43 +897,68 @@ static int httpc_parse_headers(lua_State *L, int idx, struct curl_slist **out, c
   return 0;
 }
 
-static int httpc_request(lua_State *L) {
-  if (lunet_ensure_coroutine(L, "httpc.request")) {
-    return lua_error(L);
-  }
+static int httpc_fail(lua_State *L, const char *msg) {
+  lua_pushnil(L);
+  lua_pushstring(L, msg);
+  return 2;
+}
 
+/*
+ * Parses the options table at index 1 into a new request. Returns 0, or the
+ * number of values (nil, err) pushed on failure.
+ */
+static int httpc_req_new(lua_State *L, int stream, httpc_req_t **out) {
+  const char *fname = stream ? "httpc.stream" : "httpc.request";
   if (lua_gettop(L) < 1 || !lua_istable(L, 1)) {
     lua_pushnil(L);
-    lua_pushstring(L, "httpc.request requires options table");
+    lua_pushfstring(L, "%s requires options table", fname);
     return 2;
   }
 
   lua_getfield(L, 1, "url");
   const char *url = lua_tostring(L, -1);
   lua_pop(L, 1);
-  if (!url) {
-    lua_pushnil(L);
-    lua_pushstring(L, "url is required");
-    return 2;
+  if (!url) return httpc_fail(L, "url is required");
+
+  httpc_upload_t upload = HTTPC_UPLOAD_NONE;
+  uv_file up_fd = -1;
+  lua_getfield(L, 1, "upload");
+  if (lua_isnumber(L, -1)) {
+    upload = HTTPC_UPLOAD_FD;
+    up_fd = (uv_file)lua_tointeger(L, -1);
+  } else if (lua_isfunction(L, -1)) {
+    upload = HTTPC_UPLOAD_PRODUCER;
+  } else if (!lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    return httpc_fail(L, "upload must be an fs fd or a function");
   }
+  lua_pop(L, 1);
+  if (upload && !stream) return httpc_fail(L, "upload requires httpc.stream");
+
+  curl_off_t upload_size = -1;
+  lua_getfield(L, 1, "upload_size");
+  if (lua_isnumber(L, -1)) upload_size = (curl_off_t)lua_tonumber(L, -1);
+  lua_pop(L, 1);
 
   const char *method = NULL;
   lua_getfield(L, 1, "method");
   if (!lua_isnil(L, -1)) method = lua_tostring(L, -1);
   lua_pop(L, 1);
-  if (!method) method = "GET";
+  if (!method) method = upload ? "PUT" : "GET";
 
   const char *body = NULL;
   size_t body_len = 0;
   lua_getfield(L, 1, "body");
   if (!lua_isnil(L, -1)) body = lua_tolstring(L, -1, &body_len);
   lua_pop(L, 1);
+  if (body && upload) return httpc_fail(L, "body and upload cannot be combined");
 
-  long timeout_ms = 30000;
+  // A stream has no overall deadline unless one is asked for
+  long timeout_ms = stream ? 0 : 30000;
   lua_getfield(L, 1, "timeout_ms");
   if (lua_isnumber(L, -1)) timeout_ms = (long)lua_tointeger(L, -1);
   lua_pop(L, 1);
-  if (timeout_ms <= 0) timeout_ms = 30000;
+  if (timeout_ms <= 0) timeout_ms = stream ? 0 : 30000;
 
   size_t max_body_bytes = 10 * 1024 * 1024;
   lua_getfield(L, 1, "max_body_bytes");
@@ -429,15 +978,18 @@ static int httpc_request(lua_State *L) {
   lua_pop(L, 1);
 
   httpc_req_t *ctx = (httpc_req_t *)malloc(sizeof(httpc_req_t));
-  if (!ctx) {
-    lua_pushnil(L);
-    lua_pushstring(L, "out of memory");
-    return 2;
-  }
+  if (!ctx) return httpc_fail(L, "out of memory");
   memset(ctx, 0, sizeof(*ctx));
 
   ctx->L = L;
-  ctx->req.data = ctx;
+  ctx->co_ref = LUA_NOREF;
+  ctx->self_ref = LUA_NOREF;
+  ctx->reader_ref = LUA_NOREF;
+  ctx->writer_ref = LUA_NOREF;
+  ctx->stream = stream;
+  ctx->upload = upload;
+  ctx->up_fd = up_fd;
+  ctx->upload_size = upload_size;
   ctx->timeout_ms = timeout_ms;
   ctx->max_body_bytes = max_body_bytes;
   ctx->insecure = insecure;
@@ -445,64 +997,296 @@ static int httpc_request(lua_State *L) {
   ctx->url = lunet_strdup_local(url);
   ctx->method = lunet_strdup_local(method);
   if (!ctx->url || !ctx->method) {
-    free(ctx->url);
-    free(ctx->method);
-    free(ctx);
-    lua_pushnil(L);
-    lua_pushstring(L, "out of memory");
-    return 2;
+    httpc_req_free(ctx);
+    return httpc_fail(L, "out of memory");
   }
 
   if (body) {
     ctx->body = (char *)malloc(body_len + 1);
     if (!ctx->body) {
-      free(ctx->url);
-      free(ctx->method);
-      free(ctx);
-      lua_pushnil(L);
-      lua_pushstring(L, "out of memory");
-      return 2;
+      httpc_req_free(ctx);
+      return httpc_fail(L, "out of memory");
     }
     memcpy(ctx->body, body, body_len);
     ctx->body[body_len] = '\0';
     ctx->body_len = body_len;
   }
 
-  ctx->req_headers = NULL;
   lua_getfield(L, 1, "headers");
   if (!lua_isnil(L, -1)) {
     if (httpc_parse_headers(L, lua_gettop(L), &ctx->req_headers, ctx->err, sizeof(ctx->err)) != 0) {
       lua_pop(L, 1);
       lua_pushnil(L);
       lua_pushstring(L, ctx->err[0] ? ctx->err : "invalid headers");
-      free(ctx->url);
-      free(ctx->method);
-      free(ctx->body);
-      if (ctx->req_headers) curl_slist_free_all(ctx->req_headers);
-      free(ctx);
+      httpc_req_free(ctx);
       return 2;
     }
   }
   lua_pop(L, 1);
 
+  *out = ctx;
+  return 0;
+}
+
+// Adds ctx to the engine. On failure frees ctx and pushes nil, err.
+static int httpc_start(lua_State *L, httpc_req_t *ctx) {
+  httpc_engine_t *eng = httpc_engine_get();
+  ctx->easy = eng ? httpc_easy_new(ctx) : NULL;
+  if (!ctx->easy) {
+    // Let an engine created for nothing close on its own turn
+    if (eng && eng->inflight == 0) httpc_engine_kick(eng);
+    httpc_req_free(ctx);
+    return httpc_fail(L, "curl init failed");
+  }
+
+  CURLMcode mc = curl_multi_add_handle(eng->multi, ctx->easy);
+  if (mc != CURLM_OK) {
+    if (eng->inflight == 0) httpc_engine_kick(eng);
+    httpc_req_free(ctx);
+    return httpc_fail(L, curl_multi_strerror(mc));
+  }
+  ctx->eng = eng;
+  ctx->start_ns = uv_hrtime();
+  eng->inflight++;
+  t_stats.requests++;
+  return 0;
+}
+
+static int httpc_request(lua_State *L) {
+  if (lunet_ensure_coroutine(L, "httpc.request")) {
+    return lua_error(L);
+  }
+
+  httpc_req_t *ctx = NULL;
+  int nret = httpc_req_new(L, 0, &ctx);
+  if (nret) return nret;
+  nret = httpc_start(L, ctx);
+  if (nret) return nret;
+
   lunet_coref_create(L, ctx->co_ref);
+  return lua_yield(L, 0);
+}
 
-  int rc = uv_queue_work(uv_default_loop(), &ctx->req, httpc_work_cb, httpc_after_cb);
-  if (rc < 0) {
-    lunet_coref_release(L, ctx->co_ref);
-    lua_pushnil(L);
-    lua_pushstring(L, uv_strerror(rc));
-    free(ctx->url);
-    free(ctx->method);
-    free(ctx->body);
-    if (ctx->req_headers) curl_slist_free_all(ctx->req_headers);
-    free(ctx);
-    return 2;
+// Stops a running stream transfer; parked readers and writers see why
+static void httpc_stream_abort(httpc_req_t *ctx, const char *why) {
+  if (ctx->done) return;
+  httpc_engine_t *eng = ctx->eng;
+  curl_multi_remove_handle(eng->multi, ctx->easy);
+  eng->inflight--;
+  ctx->done = 1;
+  if (ctx->err[0] == '\0') snprintf(ctx->err, sizeof(ctx->err), "%s", why);
+  t_stats.completed++;
+  t_stats.failed++;
+  if (httpc_stream_due(ctx)) httpc_ready_add(ctx);
+  httpc_engine_kick(eng);
+}
+
+// stream:read() -> chunk | nil (end of body) | nil, err
+static int httpc_stream_read(lua_State *L) {
+  httpc_stream_t *s = (httpc_stream_t *)luaL_checkudata(L, 1, LUNET_HTTPC_STREAM_MT);
+  httpc_req_t *ctx = s->ctx;
+  if (!ctx) return httpc_fail(L, "stream is closed");
+  if (ctx->reader_ref != LUA_NOREF) return httpc_fail(L, "stream:read: stream is busy");
+  if (ctx->resp_len > 0 || ctx->done) return httpc_stream_push_chunk(L, ctx);
+
+  if (lunet_ensure_coroutine(L, "stream:read")) {
+    return lua_error(L);
   }
+  lunet_coref_create(L, ctx->reader_ref);
+  return lua_yield(L, 0);
+}
+
+// stream:close() drops the rest of the body and cancels the transfer
+static int httpc_stream_close(lua_State *L) {
+  httpc_stream_t *s = (httpc_stream_t *)luaL_checkudata(L, 1, LUNET_HTTPC_STREAM_MT);
+  httpc_req_t *ctx = s->ctx;
+  if (!ctx) return 0;
+  httpc_stream_abort(ctx, "stream closed");
+  ctx->resp_len = 0;
+  if (ctx->err[0] == '\0') snprintf(ctx->err, sizeof(ctx->err), "stream closed");
+  return 0;
+}
 
+static int httpc_stream_gc(lua_State *L) {
+  httpc_stream_t *s = (httpc_stream_t *)luaL_checkudata(L, 1, LUNET_HTTPC_STREAM_MT);
+  httpc_req_t *ctx = s->ctx;
+  if (!ctx) return 0;
+  s->ctx = NULL;
+  httpc_stream_abort(ctx, "stream closed");
+  httpc_ready_remove(ctx);
+  // A pending upload read still owns up_req; its callback frees ctx
+  if (ctx->up_reading) {
+    ctx->orphaned = 1;
+  } else {
+    httpc_req_free(ctx);
+  }
+  return 0;
+}
+
+/*
+ * write(chunk) -> true | nil, err, handed to an upload producer. Yields while
+ * HTTPC_STREAM_BUFFER bytes are waiting for curl. write(nil) ends the body
+ * and write(nil, err) aborts the request with err.
+ */
+static int httpc_stream_write(lua_State *L) {
+  httpc_stream_t *s = (httpc_stream_t *)lua_touserdata(L, lua_upvalueindex(1));
+  httpc_req_t *ctx = s->ctx;
+  if (!ctx) return httpc_fail(L, "stream is closed");
+  if (ctx->done) return httpc_fail(L, ctx->err[0] ? ctx->err : "request finished");
+  if (ctx->up_eof || ctx->up_failed) return httpc_fail(L, "upload already finished");
+  if (ctx->writer_ref != LUA_NOREF) return httpc_fail(L, "write: upload is busy");
+
+  if (lua_isnoneornil(L, 1)) {
+    if (lua_isstring(L, 2)) {
+      snprintf(ctx->err, sizeof(ctx->err), "%s", lua_tostring(L, 2));
+      ctx->up_failed = 1;
+    } else {
+      ctx->up_eof = 1;
+    }
+    if (ctx->up_paused) httpc_unpause(ctx, CURLPAUSE_SEND);
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+
+  size_t len = 0;
+  const char *data = luaL_checklstring(L, 1, &len);
+  if (ctx->up_off > 0) {
+    memmove(ctx->up_buf, ctx->up_buf + ctx->up_off, ctx->up_len - ctx->up_off);
+    ctx->up_len -= ctx->up_off;
+    ctx->up_off = 0;
+  }
+  if (ctx->up_len + len > ctx->up_cap) {
+    size_t next = ctx->up_cap ? ctx->up_cap : HTTPC_STREAM_BUFFER;
+    while (next < ctx->up_len + len) next *= 2;
+    char *p = (char *)realloc(ctx->up_buf, next);
+    if (!p) return httpc_fail(L, "out of memory");
+    ctx->up_buf = p;
+    ctx->up_cap = next;
+  }
+  memcpy(ctx->up_buf + ctx->up_len, data, len);
+  ctx->up_len += len;
+  if (ctx->up_paused) httpc_unpause(ctx, CURLPAUSE_SEND);
+
+  if (!ctx->done && ctx->up_len - ctx->up_off >= HTTPC_STREAM_BUFFER) {
+    if (lunet_ensure_coroutine(L, "write")) {
+      return lua_error(L);
+    }
+    lunet_coref_create(L, ctx->writer_ref);
+    return lua_yield(L, 0);
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+// Runs producer(write) in its own coroutine and ends the body when it returns
+static const char httpc_pump_src[] =
+    "local producer, write = ...\n"
+    "return function()\n"
+    "  local ok, err = pcall(producer, write)\n"
+    "  write(nil, (not ok) and tostring(err) or nil)\n"
+    "end\n";
+
+static char httpc_pump_key;
+
+// Spawns the upload producer from opts.upload, feeding the stream at box
+static int httpc_spawn_producer(lua_State *L, int box) {
+  lua_pushcfunction(L, lunet_spawn);
+  lua_pushlightuserdata(L, &httpc_pump_key);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  if (!lua_isfunction(L, -1)) {
+    lua_pop(L, 1);
+    if (luaL_loadbuffer(L, httpc_pump_src, sizeof(httpc_pump_src) - 1, "=httpc.upload") != 0) {
+      lua_pop(L, 2);
+      return -1;
+    }
+    lua_pushlightuserdata(L, &httpc_pump_key);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, LUA_REGISTRYINDEX);
+  }
+  lua_getfield(L, 1, "upload");
+  lua_pushvalue(L, box);
+  lua_pushcclosure(L, httpc_stream_write, 1);
+  lua_call(L, 2, 1);
+  lua_call(L, 1, 0);
+  return 0;
+}
+
+static void httpc_register_stream_metatable(lua_State *L) {
+  if (luaL_newmetatable(L, LUNET_HTTPC_STREAM_MT)) {
+    lua_pushcfunction(L, httpc_stream_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_createtable(L, 0, 2);
+    lua_pushcfunction(L, httpc_stream_read);
+    lua_setfield(L, -2, "read");
+    lua_pushcfunction(L, httpc_stream_close);
+    lua_setfield(L, -2, "close");
+    lua_setfield(L, -2, "__index");
+  }
+  lua_pop(L, 1);
+}
+
+// httpc.stream(opts) -> {status, headers, effective_url, body = stream} | nil, err
+// Yields until the first body bytes arrive or the transfer ends.
+static int httpc_stream(lua_State *L) {
+  if (lunet_ensure_coroutine(L, "httpc.stream")) {
+    return lua_error(L);
+  }
+
+  httpc_req_t *ctx = NULL;
+  int nret = httpc_req_new(L, 1, &ctx);
+  if (nret) return nret;
+
+  httpc_register_stream_metatable(L);
+  httpc_stream_t *s = (httpc_stream_t *)lua_newuserdata(L, sizeof(*s));
+  s->ctx = NULL;
+  int box = lua_gettop(L);
+  luaL_getmetatable(L, LUNET_HTTPC_STREAM_MT);
+  lua_setmetatable(L, box);
+  // The stream may outlive this coroutine, so it wakes readers from a thread
+  // of its own
+  lua_createtable(L, 1, 0);
+  ctx->L = lua_newthread(L);
+  lua_rawseti(L, -2, 1);
+  lua_setfenv(L, box);
+
+  nret = httpc_start(L, ctx);
+  if (nret) return nret;
+  s->ctx = ctx;
+
+  if (ctx->upload == HTTPC_UPLOAD_PRODUCER && httpc_spawn_producer(L, box) != 0) {
+    httpc_stream_abort(ctx, "upload producer failed to start");
+    return httpc_fail(L, ctx->err);
+  }
+  if (ctx->done) return httpc_fail(L, ctx->err);
+
+  lua_pushvalue(L, box);
+  lunet_coref_create_raw(L, ctx->self_ref);
+  lunet_coref_create(L, ctx->co_ref);
   return lua_yield(L, 0);
 }
 
+static int httpc_stats(lua_State *L) {
+  lua_createtable(L, 0, 8);
+  lua_pushinteger(L, t_engine ? t_engine->inflight : 0);
+  lua_setfield(L, -2, "in_flight");
+  lua_pushinteger(L, t_stats.sockets);
+  lua_setfield(L, -2, "sockets");
+  lua_pushnumber(L, (lua_Number)t_stats.requests);
+  lua_setfield(L, -2, "requests");
+  lua_pushnumber(L, (lua_Number)t_stats.completed);
+  lua_setfield(L, -2, "completed");
+  lua_pushnumber(L, (lua_Number)t_stats.failed);
+  lua_setfield(L, -2, "failed");
+  lua_pushnumber(L, (lua_Number)t_stats.connects);
+  lua_setfield(L, -2, "connects");
+  lua_pushnumber(L, (lua_Number)t_stats.reused);
+  lua_setfield(L, -2, "reused");
+  uint64_t ok = t_stats.completed - t_stats.failed;
+  lua_pushnumber(L, ok ? (lua_Number)t_stats.reused / (lua_Number)ok : 0);
+  lua_setfield(L, -2, "reuse_rate");
+  return 1;
+}
+
 int lunet_open_httpc(lua_State *L) {
   static int curl_inited = 0;
   if (!curl_inited) {
@@ -512,7 +1296,10 @@ int lunet_open_httpc(lua_State *L) {
     }
     curl_inited = 1;
   }
-  luaL_Reg funcs[] = {{"request", httpc_request}, {NULL, NULL}};
+  luaL_Reg funcs[] = {{"request", httpc_request},
+                      {"stream", httpc_stream},
+                      {"stats", httpc_stats},
+                      {NULL, NULL}};
   luaL_newlib(L, funcs);
   return 1;
 }
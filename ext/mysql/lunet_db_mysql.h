@@ -7,6 +7,10 @@
 int lunet_db_open(lua_State* L);
 int lunet_db_close(lua_State* L);
 
+// Connection pool (db.pool)
+int lunet_db_pool(lua_State* L);
+int lunet_db_pool_stats(lua_State* L);
+
 // Legacy functions (will be refactored to use prepared statements internally)
 int lunet_db_query(lua_State* L);
 int lunet_db_exec(lua_State* L);
@@ -16,4 +20,10 @@ int lunet_db_escape(lua_State* L);
 int lunet_db_query_params(lua_State* L);  // query with parameters
 int lunet_db_exec_params(lua_State* L);   // exec with parameters
 
+// Prepared statement cache counters
+int lunet_db_stmt_cache_stats(lua_State* L);
+int lunet_db_cursor(lua_State* L);
+int lunet_db_exec_batch(lua_State* L);
+int lunet_db_executor_stats(lua_State* L);
+
 #endif
\ No newline at end of file
@@ -6,11 +6,18 @@
 #include <string.h>
 
 #include "co.h"
+#include "db_pool.h"
+#include "db_result.h"
+#include "executor.h"
 #include "trace.h"
 #include "lunet_mem.h"
+#include "rt.h"
+#include "stmt_cache.h"
 #include "uv.h"
 
+#define LUNET_MYSQL_POOL_MT "lunet.mysql.pool"
 #define LUNET_MYSQL_CONN_MT "lunet.mysql.conn"
+#define LUNET_MYSQL_CURSOR_MT "lunet.mysql.cursor"
 
 static int g_mysql_library_initialized = 0;
 static int g_mysql_library_refcount = 0;
@@ -46,21 +53,77 @@ static char* lunet_strdup_local(const char* s) {
   return out;
 }
 
+typedef struct lunet_mysql_cursor lunet_mysql_cursor_t;
+
 typedef struct {
   MYSQL* conn;
   uv_mutex_t mutex;
   int closed;
   int library_ref_held;
+  stmt_cache_t stmts;
+  lunet_mysql_cursor_t* cursor;     // open db.cursor streaming on this connection
+  lunet_mysql_cursor_t* abandoned;  // collected cursor, drained by the next job
 } lunet_mysql_conn_t;
 
+static void stmt_cache_close(void* stmt, void* ud) {
+  (void)ud;
+  mysql_stmt_close((MYSQL_STMT*)stmt);
+}
+
+// Fetch the prepared statement for sql from the connection cache or prepare it.
+// Caller holds wrapper->mutex and hands the statement back via stmt_release().
+static MYSQL_STMT* stmt_acquire(lunet_mysql_conn_t* wrapper, const char* sql, int* cached, char* err, size_t errsize) {
+  size_t len = strlen(sql);
+  MYSQL_STMT* stmt = (MYSQL_STMT*)stmt_cache_get(&wrapper->stmts, sql, len);
+  if (stmt) {
+    *cached = 1;
+    return stmt;
+  }
+  *cached = 0;
+  stmt = mysql_stmt_init(wrapper->conn);
+  if (!stmt) {
+    snprintf(err, errsize, "mysql_stmt_init failed: %s", mysql_error(wrapper->conn));
+    return NULL;
+  }
+  if (mysql_stmt_prepare(stmt, sql, len)) {
+    snprintf(err, errsize, "mysql_stmt_prepare failed: %s", mysql_stmt_error(stmt));
+    mysql_stmt_close(stmt);
+    return NULL;
+  }
+  return stmt;
+}
+
+// Keep a statement that finished cleanly for reuse. A statement that failed on
+// the server is dropped instead: the handle may have been invalidated (server
+// restart, schema change) and the next call re-prepares it.
+static void stmt_release(lunet_mysql_conn_t* wrapper, const char* sql, MYSQL_STMT* stmt, int cached, int ok) {
+  if (!ok) {
+    if (cached) stmt_cache_evict(&wrapper->stmts, sql, strlen(sql));
+    else mysql_stmt_close(stmt);
+    return;
+  }
+  mysql_stmt_free_result(stmt);
+  if (cached) return;
+  if (stmt_cache_put(&wrapper->stmts, sql, strlen(sql), stmt) != 0) {
+    mysql_stmt_close(stmt);
+  }
+}
+
+static void cursor_detach(lunet_mysql_conn_t* wrapper);
+static int cursor_owns_conn(lunet_mysql_conn_t* wrapper);
+
 // Close connection but keep mutex intact (for explicit db.close())
 static void lunet_mysql_conn_close(lunet_mysql_conn_t* wrapper) {
   if (!wrapper || wrapper->closed) return;
   wrapper->closed = 1;
+  // mysql_close detaches every statement first, so closing a cursor's
+  // statement afterwards only frees it instead of draining unread rows
   if (wrapper->conn) {
     mysql_close(wrapper->conn);
     wrapper->conn = NULL;
   }
+  cursor_detach(wrapper);
+  stmt_cache_clear(&wrapper->stmts);
   if (wrapper->library_ref_held) {
     lunet_mysql_library_release();
     wrapper->library_ref_held = 0;
@@ -88,6 +151,10 @@ typedef struct {
   char password[256];
   char database[256];
   char charset[256];
+  int stmt_cache;
+
+  db_pool_t* pool;  // set when opening a connection on behalf of db.pool
+  int pool_slot;
 } db_open_ctx_t;
 
 static void db_open_work_cb(uv_work_t* req) {
@@ -112,8 +179,45 @@ static void db_open_work_cb(uv_work_t* req) {
   mysql_thread_end();
 }
 
+// Takes over the library reference acquired for this open
+static lunet_mysql_conn_t* push_conn(lua_State* L, db_open_ctx_t* ctx) {
+  lunet_mysql_conn_t* wrapper = (lunet_mysql_conn_t*)lua_newuserdata(L, sizeof(lunet_mysql_conn_t));
+  wrapper->conn = ctx->conn;
+  wrapper->closed = 0;
+  wrapper->library_ref_held = 1;
+  wrapper->cursor = NULL;
+  wrapper->abandoned = NULL;
+  stmt_cache_init(&wrapper->stmts, (size_t)ctx->stmt_cache, stmt_cache_close, NULL);
+  uv_mutex_init(&wrapper->mutex);
+
+  luaL_getmetatable(L, LUNET_MYSQL_CONN_MT);
+  lua_setmetatable(L, -2);
+  return wrapper;
+}
+
+// Pool opens have no coroutine: the connection is pinned in the registry of
+// the pool's main state and handed to the next waiter
+static void pool_open_done(db_open_ctx_t* ctx) {
+  db_pool_t* pool = ctx->pool;
+  if (!ctx->conn) {
+    lunet_mysql_library_release();
+    db_pool_opened(pool, ctx->pool_slot, NULL, LUA_NOREF, ctx->err);
+    lunet_free_nonnull(ctx);
+    return;
+  }
+  lunet_mysql_conn_t* wrapper = push_conn(pool->L, ctx);
+  int ref;
+  lunet_coref_create_raw(pool->L, ref);
+  db_pool_opened(pool, ctx->pool_slot, wrapper, ref, NULL);
+  lunet_free_nonnull(ctx);
+}
+
 static void db_open_after_cb(uv_work_t* req, int status) {
   db_open_ctx_t* ctx = (db_open_ctx_t*)req->data;
+  if (ctx->pool) {
+    pool_open_done(ctx);
+    return;
+  }
   lua_State* L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -130,15 +234,7 @@ static void db_open_after_cb(uv_work_t* req, int status) {
   lua_pop(L, 1);
 
   if (ctx->conn) {
-    lunet_mysql_conn_t* wrapper = (lunet_mysql_conn_t*)lua_newuserdata(co, sizeof(lunet_mysql_conn_t));
-    wrapper->conn = ctx->conn;
-    wrapper->closed = 0;
-    wrapper->library_ref_held = 1;
-    uv_mutex_init(&wrapper->mutex);
-
-    luaL_getmetatable(co, LUNET_MYSQL_CONN_MT);
-    lua_setmetatable(co, -2);
-
+    push_conn(co, ctx);
     lua_pushnil(co);
   } else {
     lua_pushnil(co);
@@ -180,92 +276,76 @@ typedef struct {
     union {
         long long i;
         double d;
+        // Borrowed from the Lua string; see collect_params()
         struct {
-            char* data;
+            const char* data;
             size_t len;
         } s;
     } value;
 } param_t;
 
-static void free_params(param_t* params, int nparams) {
-    if (!params) return;
-    for (int i = 0; i < nparams; i++) {
-        if (params[i].type == PARAM_TYPE_TEXT) {
-            lunet_free_nonnull(params[i].value.s.data);
-        }
-    }
-    lunet_free_nonnull(params);
+// Requests with at most this many parameters keep them inside the ctx
+#define DB_INLINE_PARAMS 8
+
+static void free_params(param_t* params, const param_t* inline_buf) {
+    if (params && params != inline_buf) lunet_free_nonnull(params);
 }
 
-static param_t* collect_params(lua_State* L, int start, int* nparams) {
-    int top = lua_gettop(L);
-    *nparams = top - start + 1;
-    if (*nparams <= 0) {
-        *nparams = 0;
-        return NULL;
-    }
-    param_t* params = lunet_alloc(sizeof(param_t) * (*nparams));
-    if (!params) {
-        *nparams = -1;
-        return NULL;
-    }
-    for (int i = 0; i < *nparams; i++) {
+// Convert stack values [start, start + n) into out. Strings are not copied:
+// the caller keeps them reachable until the worker is done with them.
+static void fill_params(lua_State* L, int start, int n, param_t* out) {
+    for (int i = 0; i < n; i++) {
         int idx = start + i;
-        int type = lua_type(L, idx);
-        switch (type) {
-            case LUA_TNIL:
-                params[i].type = PARAM_TYPE_NIL;
-                break;
+        switch (lua_type(L, idx)) {
             case LUA_TNUMBER: {
-                lua_Number n = lua_tonumber(L, idx);
-                long long val = (long long)n;
-                if ((lua_Number)val == n) {
-                    params[i].type = PARAM_TYPE_INT;
-                    params[i].value.i = val;
+                lua_Number num = lua_tonumber(L, idx);
+                long long val = (long long)num;
+                if ((lua_Number)val == num) {
+                    out[i].type = PARAM_TYPE_INT;
+                    out[i].value.i = val;
                 } else {
-                    params[i].type = PARAM_TYPE_DOUBLE;
-                    params[i].value.d = n;
+                    out[i].type = PARAM_TYPE_DOUBLE;
+                    out[i].value.d = num;
                 }
                 break;
             }
             case LUA_TBOOLEAN:
-                params[i].type = PARAM_TYPE_INT;
-                params[i].value.i = lua_toboolean(L, idx);
+                out[i].type = PARAM_TYPE_INT;
+                out[i].value.i = lua_toboolean(L, idx);
                 break;
-            case LUA_TSTRING: {
-                size_t len;
-                const char* s = lua_tolstring(L, idx, &len);
-                params[i].type = PARAM_TYPE_TEXT;
-                params[i].value.s.data = lunet_alloc(len + 1);
-                if (!params[i].value.s.data) {
-                    free_params(params, i);
-                    *nparams = -1;
-                    return NULL;
-                }
-                memcpy(params[i].value.s.data, s, len);
-                params[i].value.s.data[len] = '\0';
-                params[i].value.s.len = len;
+            case LUA_TSTRING:
+                out[i].type = PARAM_TYPE_TEXT;
+                out[i].value.s.data = lua_tolstring(L, idx, &out[i].value.s.len);
                 break;
-            }
-            default: {
-                const char* s = lua_tostring(L, idx);
-                if (s) {
-                    size_t len = strlen(s);
-                    params[i].type = PARAM_TYPE_TEXT;
-                    params[i].value.s.data = lunet_strdup_local(s);
-                    if (!params[i].value.s.data) {
-                        free_params(params, i);
-                        *nparams = -1;
-                        return NULL;
-                    }
-                    params[i].value.s.len = len;
-                } else {
-                    params[i].type = PARAM_TYPE_NIL;
-                }
+            default:
+                out[i].type = PARAM_TYPE_NIL;
                 break;
-            }
         }
     }
+}
+
+/*
+ * Collect the call's arguments from start on. Up to DB_INLINE_PARAMS land in
+ * inline_buf, so the common case allocates nothing. String arguments stay on
+ * the calling coroutine's suspended frame, which co_ref keeps alive until the
+ * after callback, so their bytes are bound in place instead of copied.
+ */
+static param_t* collect_params(lua_State* L, int start, int* nparams, param_t* inline_buf) {
+    int top = lua_gettop(L);
+    *nparams = top - start + 1;
+    if (*nparams <= 0) {
+        *nparams = 0;
+        return NULL;
+    }
+    param_t* params = inline_buf;
+    if (!params || *nparams > DB_INLINE_PARAMS) {
+        params = lunet_alloc(sizeof(param_t) * (*nparams));
+        if (!params) {
+            *nparams = -1;
+            return NULL;
+        }
+    }
+    fill_params(L, start, *nparams, params);
     return params;
 }
 
@@ -308,6 +388,58 @@ static int bind_params(MYSQL_STMT* stmt, MYSQL_BIND* bind, param_t* params, int
     return 0;
 }
 
+static void parse_open_params(lua_State* L, int idx, db_open_ctx_t* ctx) {
+  lua_getfield(L, idx, "host");
+  snprintf(ctx->host, sizeof(ctx->host), "%s", luaL_optstring(L, -1, "localhost"));
+  lua_getfield(L, idx, "port");
+  ctx->port = (int)luaL_optinteger(L, -1, 3306);
+  if (ctx->port < 1 || ctx->port > 65535) ctx->port = 3306;
+  lua_getfield(L, idx, "user");
+  snprintf(ctx->user, sizeof(ctx->user), "%s", luaL_optstring(L, -1, "root"));
+  lua_getfield(L, idx, "password");
+  snprintf(ctx->password, sizeof(ctx->password), "%s", luaL_optstring(L, -1, ""));
+  lua_getfield(L, idx, "database");
+  snprintf(ctx->database, sizeof(ctx->database), "%s", luaL_optstring(L, -1, ""));
+  lua_getfield(L, idx, "charset");
+  snprintf(ctx->charset, sizeof(ctx->charset), "%s", luaL_optstring(L, -1, "utf8mb4"));
+  lua_getfield(L, idx, "stmt_cache");
+  ctx->stmt_cache = (int)luaL_optinteger(L, -1, STMT_CACHE_DEFAULT_CAP);
+  if (ctx->stmt_cache < 0) ctx->stmt_cache = 0;
+  lua_pop(L, 7);
+}
+
+static int pool_open(db_pool_t* pool, int slot) {
+  if (lunet_mysql_library_acquire() != 0) return UV_EINVAL;
+  db_open_ctx_t* ctx = lunet_alloc(sizeof(db_open_ctx_t));
+  if (!ctx) {
+    lunet_mysql_library_release();
+    return UV_ENOMEM;
+  }
+  memcpy(ctx, pool->ud, sizeof(*ctx));
+  ctx->req.data = ctx;
+  ctx->pool = pool;
+  ctx->pool_slot = slot;
+  int ret = lunet_exec_queue(LUNET_EXEC_DB, &ctx->req, db_open_work_cb, db_open_after_cb);
+  if (ret < 0) {
+    lunet_free_nonnull(ctx);
+    lunet_mysql_library_release();
+  }
+  return ret;
+}
+
+// Only idle or returned connections are discarded, so no request holds the
+// mutex; skip it because lua_close() may already have collected the wrapper
+static void pool_discard(db_pool_t* pool, void* conn, int ref) {
+  lunet_mysql_conn_close((lunet_mysql_conn_t*)conn);
+  lunet_coref_release(pool->L, ref);
+}
+
+static void pool_destroy(db_pool_t* pool) {
+  lunet_free(pool->ud);
+}
+
+static const db_pool_ops_t g_pool_ops = {pool_open, pool_discard, pool_destroy};
+
 int lunet_db_open(lua_State* L) {
   if (lunet_ensure_coroutine(L, "db.open")) {
     return lua_error(L);
@@ -330,34 +462,20 @@ int lunet_db_open(lua_State* L) {
     lua_pushstring(L, "db.open: out of memory");
     return lua_error(L);
   }
-  memset(ctx->err, 0, sizeof(ctx->err));
+  memset(ctx, 0, sizeof(*ctx));
   ctx->L = L;
   ctx->req.data = ctx;
-
-  lua_getfield(L, 1, "host");
-  snprintf(ctx->host, sizeof(ctx->host), "%s", luaL_optstring(L, -1, "localhost"));
-  lua_getfield(L, 1, "port");
-  ctx->port = (int)luaL_optinteger(L, -1, 3306);
-  if (ctx->port < 1 || ctx->port > 65535) ctx->port = 3306;
-  lua_getfield(L, 1, "user");
-  snprintf(ctx->user, sizeof(ctx->user), "%s", luaL_optstring(L, -1, "root"));
-  lua_getfield(L, 1, "password");
-  snprintf(ctx->password, sizeof(ctx->password), "%s", luaL_optstring(L, -1, ""));
-  lua_getfield(L, 1, "database");
-  snprintf(ctx->database, sizeof(ctx->database), "%s", luaL_optstring(L, -1, ""));
-  lua_getfield(L, 1, "charset");
-  snprintf(ctx->charset, sizeof(ctx->charset), "%s", luaL_optstring(L, -1, "utf8mb4"));
-  lua_pop(L, 6);
+  parse_open_params(L, 1, ctx);
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_open_work_cb, db_open_after_cb);
+  int ret = lunet_exec_queue(LUNET_EXEC_DB, &ctx->req, db_open_work_cb, db_open_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx);
     lunet_mysql_library_release();
     lua_pushnil(L);
-    lua_pushfstring(L, "db.open: uv_queue_work failed: %s", uv_strerror(ret));
+    lua_pushfstring(L, "db.open: %s", lunet_exec_strerror(LUNET_EXEC_DB, ret));
     return lua_error(L);
   }
 
@@ -373,6 +491,12 @@ int lunet_db_close(lua_State* L) {
     return 1;
   }
 
+  db_pool_t* pool = db_pool_test(L, 1, LUNET_MYSQL_POOL_MT);
+  if (pool) {
+    db_pool_close(pool);
+    lua_pushnil(L);
+    return 1;
+  }
   lunet_mysql_conn_t* wrapper = (lunet_mysql_conn_t*)luaL_testudata(L, 1, LUNET_MYSQL_CONN_MT);
   if (!wrapper) {
     lua_pushstring(L, "db.close requires a valid connection");
@@ -387,26 +511,126 @@ int lunet_db_close(lua_State* L) {
   return 1;
 }
 
+int lunet_db_pool(lua_State* L) {
+  if (lua_gettop(L) < 1 || !lua_istable(L, 1)) {
+    lua_pushstring(L, "db.pool requires params table");
+    return lua_error(L);
+  }
+  register_conn_metatable(L);
+
+  int min, max, check_ms;
+  db_pool_parse_opts(L, 2, &min, &max, &check_ms);
+
+  db_open_ctx_t* tmpl = lunet_alloc(sizeof(db_open_ctx_t));
+  if (!tmpl) {
+    lua_pushstring(L, "db.pool: out of memory");
+    return lua_error(L);
+  }
+  memset(tmpl, 0, sizeof(*tmpl));
+  parse_open_params(L, 1, tmpl);
+
+  lua_State* mainL = default_luaL();
+  db_pool_t* pool = db_pool_create(mainL ? mainL : L, min, max, check_ms, &g_pool_ops, tmpl);
+  if (!pool) {
+    lunet_free_nonnull(tmpl);
+    lua_pushstring(L, "db.pool: out of memory");
+    return lua_error(L);
+  }
+  db_pool_push(L, pool, LUNET_MYSQL_POOL_MT);
+  db_pool_fill(pool);
+  return 1;
+}
+
+int lunet_db_pool_stats(lua_State* L) {
+  db_pool_t* pool = db_pool_test(L, 1, LUNET_MYSQL_POOL_MT);
+  if (!pool) {
+    lua_pushnil(L);
+    lua_pushstring(L, "db.pool_stats requires a pool");
+    return 2;
+  }
+  db_pool_push_stats(L, pool);
+  return 1;
+}
+
+// Accept either a connection or a db.pool handle as the first argument.
+// Pushes (nil, err) and returns 2 when neither is usable.
+static int resolve_target(lua_State* L, const char* fname, lunet_mysql_conn_t** wrapper, db_pool_t** pool) {
+  *wrapper = (lunet_mysql_conn_t*)luaL_testudata(L, 1, LUNET_MYSQL_CONN_MT);
+  *pool = NULL;
+  if (!*wrapper) {
+    *pool = db_pool_test(L, 1, LUNET_MYSQL_POOL_MT);
+    if (!*pool) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "%s requires a valid connection", fname);
+      return 2;
+    }
+    if ((*pool)->closed) {
+      lua_pushnil(L);
+      lua_pushstring(L, "pool is closed");
+      return 2;
+    }
+    return 0;
+  }
+  if ((*wrapper)->closed || !(*wrapper)->conn) {
+    lua_pushnil(L);
+    lua_pushstring(L, "connection is closed");
+    return 2;
+  }
+  return 0;
+}
+
+// Ping connections that sat idle past check_ms before handing them a query;
+// a dead one is dropped and the request retried on a fresh connection
+static int pool_checkout(db_pool_waiter_t* w, char* err, size_t errsize) {
+  if (w->idle_ns < w->pool->check_ns) return 0;
+  lunet_mysql_conn_t* wrapper = (lunet_mysql_conn_t*)w->conn;
+  uv_mutex_lock(&wrapper->mutex);
+  mysql_thread_init();
+  int bad = wrapper->closed || !wrapper->conn || mysql_ping(wrapper->conn) != 0;
+  mysql_thread_end();
+  uv_mutex_unlock(&wrapper->mutex);
+  if (!bad) return 0;
+  snprintf(err, errsize, "connection lost");
+  w->status = DB_POOL_STALE;
+  return 1;
+}
+
+// After a failed request, tell a server error from a dead connection
+static void pool_checkin(db_pool_waiter_t* w, const char* err) {
+  if (!err[0]) return;
+  lunet_mysql_conn_t* wrapper = (lunet_mysql_conn_t*)w->conn;
+  uv_mutex_lock(&wrapper->mutex);
+  mysql_thread_init();
+  if (wrapper->closed || !wrapper->conn || mysql_ping(wrapper->conn) != 0) {
+    w->status = DB_POOL_LOST;
+  }
+  mysql_thread_end();
+  uv_mutex_unlock(&wrapper->mutex);
+}
+
 typedef struct {
   uv_work_t req;
   lua_State* L;
   int co_ref;
 
+  db_pool_waiter_t pw;
   lunet_mysql_conn_t* wrapper;
   char* query;
 
   param_t* params;
   int nparams;
+  param_t inline_params[DB_INLINE_PARAMS];
 
   char** col_names;
   int* col_types;
   char*** rows;
   int nrows;
   int ncols;
+  db_result_opts_t shape;
   char err[256];
 } db_query_ctx_t;
 
-static void db_query_work_cb(uv_work_t* req) {
+static void db_query_run(uv_work_t* req) {
   db_query_ctx_t* ctx = (db_query_ctx_t*)req->data;
 
   uv_mutex_lock(&ctx->wrapper->mutex);
@@ -418,19 +642,18 @@ static void db_query_work_cb(uv_work_t* req) {
     uv_mutex_unlock(&ctx->wrapper->mutex);
     return;
   }
-
-  // Use prepared statement
-  MYSQL_STMT* stmt = mysql_stmt_init(ctx->wrapper->conn);
-  if (!stmt) {
-    snprintf(ctx->err, sizeof(ctx->err), "mysql_stmt_init failed: %s", mysql_error(ctx->wrapper->conn));
+  // An unbuffered cursor result owns the wire until it is drained or closed
+  if (cursor_owns_conn(ctx->wrapper)) {
+    snprintf(ctx->err, sizeof(ctx->err), "connection has an open cursor");
     mysql_thread_end();
     uv_mutex_unlock(&ctx->wrapper->mutex);
     return;
   }
 
-  if (mysql_stmt_prepare(stmt, ctx->query, strlen(ctx->query))) {
-    snprintf(ctx->err, sizeof(ctx->err), "mysql_stmt_prepare failed: %s", mysql_stmt_error(stmt));
-    mysql_stmt_close(stmt);
+  // Use prepared statement, reusing the connection's cached handle when possible
+  int cached = 0;
+  MYSQL_STMT* stmt = stmt_acquire(ctx->wrapper, ctx->query, &cached, ctx->err, sizeof(ctx->err));
+  if (!stmt) {
     mysql_thread_end();
     uv_mutex_unlock(&ctx->wrapper->mutex);
     return;
@@ -439,7 +662,7 @@ static void db_query_work_cb(uv_work_t* req) {
   unsigned long param_count = mysql_stmt_param_count(stmt);
   if (param_count != (unsigned long)ctx->nparams) {
     snprintf(ctx->err, sizeof(ctx->err), "parameter count mismatch: expected %lu, got %d", param_count, ctx->nparams);
-    mysql_stmt_close(stmt);
+    stmt_release(ctx->wrapper, ctx->query, stmt, cached, 1);
     mysql_thread_end();
     uv_mutex_unlock(&ctx->wrapper->mutex);
     return;
@@ -449,7 +672,7 @@ static void db_query_work_cb(uv_work_t* req) {
     MYSQL_BIND* bind = lunet_alloc(sizeof(MYSQL_BIND) * ctx->nparams);
     if (!bind) {
       snprintf(ctx->err, sizeof(ctx->err), "out of memory");
-      mysql_stmt_close(stmt);
+      stmt_release(ctx->wrapper, ctx->query, stmt, cached, 0);
       mysql_thread_end();
       uv_mutex_unlock(&ctx->wrapper->mutex);
       return;
@@ -457,7 +680,7 @@ static void db_query_work_cb(uv_work_t* req) {
     
     if (bind_params(stmt, bind, ctx->params, ctx->nparams, ctx->err, sizeof(ctx->err))) {
        lunet_free_nonnull(bind);
-       mysql_stmt_close(stmt);
+       stmt_release(ctx->wrapper, ctx->query, stmt, cached, 0);
        mysql_thread_end();
        uv_mutex_unlock(&ctx->wrapper->mutex);
        return;
@@ -478,14 +701,14 @@ static void db_query_work_cb(uv_work_t* req) {
       bind = lunet_alloc(sizeof(MYSQL_BIND) * ctx->nparams);
       if (!bind) {
           snprintf(ctx->err, sizeof(ctx->err), "out of memory");
-          mysql_stmt_close(stmt);
+          stmt_release(ctx->wrapper, ctx->query, stmt, cached, 0);
           mysql_thread_end();
           uv_mutex_unlock(&ctx->wrapper->mutex);
           return;
       }
       if (bind_params(stmt, bind, ctx->params, ctx->nparams, ctx->err, sizeof(ctx->err))) {
           lunet_free_nonnull(bind);
-          mysql_stmt_close(stmt);
+          stmt_release(ctx->wrapper, ctx->query, stmt, cached, 0);
           mysql_thread_end();
           uv_mutex_unlock(&ctx->wrapper->mutex);
           return;
@@ -495,7 +718,7 @@ static void db_query_work_cb(uv_work_t* req) {
   if (mysql_stmt_execute(stmt)) {
     snprintf(ctx->err, sizeof(ctx->err), "mysql_stmt_execute failed: %s", mysql_stmt_error(stmt));
     if (bind) lunet_free_nonnull(bind);
-    mysql_stmt_close(stmt);
+    stmt_release(ctx->wrapper, ctx->query, stmt, cached, 0);
     mysql_thread_end();
     uv_mutex_unlock(&ctx->wrapper->mutex);
     return;
@@ -506,7 +729,7 @@ static void db_query_work_cb(uv_work_t* req) {
   // Store result to get metadata about fields and buffer everything
   if (mysql_stmt_store_result(stmt)) {
       snprintf(ctx->err, sizeof(ctx->err), "mysql_stmt_store_result failed: %s", mysql_stmt_error(stmt));
-      mysql_stmt_close(stmt);
+      stmt_release(ctx->wrapper, ctx->query, stmt, cached, 0);
       mysql_thread_end();
       uv_mutex_unlock(&ctx->wrapper->mutex);
       return;
@@ -519,10 +742,11 @@ static void db_query_work_cb(uv_work_t* req) {
       ctx->nrows = 0;
       // Should we check if it was supposed to return result? 
       // mysql_stmt_field_count(stmt) would tell us.
-      if (mysql_stmt_field_count(stmt) > 0) {
+      int ok = mysql_stmt_field_count(stmt) == 0;
+      if (!ok) {
           snprintf(ctx->err, sizeof(ctx->err), "mysql_stmt_result_metadata failed: %s", mysql_stmt_error(stmt));
       }
-      mysql_stmt_close(stmt);
+      stmt_release(ctx->wrapper, ctx->query, stmt, cached, ok);
       mysql_thread_end();
       uv_mutex_unlock(&ctx->wrapper->mutex);
       return;
@@ -546,7 +770,7 @@ static void db_query_work_cb(uv_work_t* req) {
       if (is_null) lunet_free_nonnull(is_null);
       if (length) lunet_free_nonnull(length);
       mysql_free_result(metadata);
-      mysql_stmt_close(stmt);
+      stmt_release(ctx->wrapper, ctx->query, stmt, cached, 0);
       mysql_thread_end();
       uv_mutex_unlock(&ctx->wrapper->mutex);
       return;
@@ -585,7 +809,7 @@ static void db_query_work_cb(uv_work_t* req) {
           lunet_free_nonnull(is_null);
           lunet_free_nonnull(length);
           mysql_free_result(metadata);
-          mysql_stmt_close(stmt);
+          stmt_release(ctx->wrapper, ctx->query, stmt, cached, 0);
           mysql_thread_end();
           uv_mutex_unlock(&ctx->wrapper->mutex);
           return;
@@ -604,7 +828,7 @@ static void db_query_work_cb(uv_work_t* req) {
       lunet_free_nonnull(is_null);
       lunet_free_nonnull(length);
       mysql_free_result(metadata);
-      mysql_stmt_close(stmt);
+      stmt_release(ctx->wrapper, ctx->query, stmt, cached, 0);
       mysql_thread_end();
       uv_mutex_unlock(&ctx->wrapper->mutex);
       return;
@@ -656,13 +880,75 @@ static void db_query_work_cb(uv_work_t* req) {
   lunet_free_nonnull(length);
   
   mysql_free_result(metadata);
-  mysql_stmt_close(stmt);
+  stmt_release(ctx->wrapper, ctx->query, stmt, cached, 1);
   mysql_thread_end();
   uv_mutex_unlock(&ctx->wrapper->mutex);
 }
 
+// Materialized rows as seen by db_result_push()
+typedef struct {
+  char** col_names;
+  const int* types;
+  char*** rows;
+} rows_view_t;
+
+static const char* rows_name(void* ud, int col) {
+  return ((rows_view_t*)ud)->col_names[col];
+}
+
+static db_col_kind_t rows_kind(void* ud, int col) {
+  switch (((rows_view_t*)ud)->types[col]) {
+    case MYSQL_TYPE_TINY:
+    case MYSQL_TYPE_SHORT:
+    case MYSQL_TYPE_LONG:
+    case MYSQL_TYPE_INT24:
+    case MYSQL_TYPE_LONGLONG:
+      return DB_COL_INT;
+    case MYSQL_TYPE_FLOAT:
+    case MYSQL_TYPE_DOUBLE:
+    case MYSQL_TYPE_DECIMAL:
+      return DB_COL_FLOAT;
+    default:
+      return DB_COL_TEXT;
+  }
+}
+
+static const char* rows_value(void* ud, int row, int col) {
+  return ((rows_view_t*)ud)->rows[row][col];
+}
+
+// Push the result of db.query or cursor:next() in the requested shape
+static void push_rows(lua_State* co, char** col_names, const int* types, int ncols, char*** rows, int nrows,
+                      const db_result_opts_t* opts) {
+  rows_view_t view = {col_names, types, rows};
+  db_result_t r = {nrows, ncols, &view, rows_name, rows_kind, rows_value};
+  db_result_push(co, &r, opts);
+}
+
+static void free_rows(char*** rows, int nrows, int ncols) {
+  if (!rows) return;
+  for (int i = 0; i < nrows; i++) {
+    for (int j = 0; j < ncols; j++) {
+      lunet_free_nonnull(rows[i][j]);
+    }
+    lunet_free_nonnull(rows[i]);
+  }
+  lunet_free_nonnull(rows);
+}
+
+static void db_query_work_cb(uv_work_t* req) {
+  db_query_ctx_t* ctx = (db_query_ctx_t*)req->data;
+  if (ctx->pw.pool) {
+    ctx->wrapper = (lunet_mysql_conn_t*)ctx->pw.conn;
+    if (pool_checkout(&ctx->pw, ctx->err, sizeof(ctx->err))) return;
+  }
+  db_query_run(req);
+  if (ctx->pw.pool) pool_checkin(&ctx->pw, ctx->err);
+}
+
 static void db_query_after_cb(uv_work_t* req, int status) {
   db_query_ctx_t* ctx = (db_query_ctx_t*)req->data;
+  if (db_pool_release(&ctx->pw)) return;  // re-queued on a fresh pooled connection
   lua_State* L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -685,40 +971,7 @@ static void db_query_after_cb(uv_work_t* req, int status) {
       lua_pop(co, 1);
     }
   } else {
-      lua_newtable(co);
-      int row_idx = 1;
-      
-      for (int i = 0; i < ctx->nrows; i++) {
-          lua_newtable(co);
-          for (int j = 0; j < ctx->ncols; j++) {
-              lua_pushstring(co, ctx->col_names[j]);
-              if (ctx->rows[i][j] == NULL) {
-                  lua_pushnil(co);
-              } else {
-                  int type = ctx->col_types[j];
-                  switch (type) {
-                      case MYSQL_TYPE_TINY:
-                      case MYSQL_TYPE_SHORT:
-                      case MYSQL_TYPE_LONG:
-                      case MYSQL_TYPE_INT24:
-                      case MYSQL_TYPE_LONGLONG:
-                          lua_pushinteger(co, strtoll(ctx->rows[i][j], NULL, 10));
-                          break;
-                      case MYSQL_TYPE_FLOAT:
-                      case MYSQL_TYPE_DOUBLE:
-                      case MYSQL_TYPE_DECIMAL:
-                          lua_pushnumber(co, strtod(ctx->rows[i][j], NULL));
-                          break;
-                      default:
-                          lua_pushstring(co, ctx->rows[i][j]);
-                          break;
-                  }
-              }
-              lua_settable(co, -3);
-          }
-          lua_rawseti(co, -2, row_idx++);
-      }
-      
+      push_rows(co, ctx->col_names, ctx->col_types, ctx->ncols, ctx->rows, ctx->nrows, &ctx->shape);
       lua_pushnil(co);
       int rc = lunet_co_resume(co, 2);
       if (rc != 0 && rc != LUA_YIELD) {
@@ -729,15 +982,7 @@ static void db_query_after_cb(uv_work_t* req, int status) {
   }
 
 cleanup:
-  if (ctx->rows) {
-      for (int i = 0; i < ctx->nrows; i++) {
-          for (int j = 0; j < ctx->ncols; j++) {
-              lunet_free_nonnull(ctx->rows[i][j]);
-          }
-          lunet_free_nonnull(ctx->rows[i]);
-      }
-      lunet_free_nonnull(ctx->rows);
-  }
+  free_rows(ctx->rows, ctx->nrows, ctx->ncols);
   if (ctx->col_names) {
       for (int i = 0; i < ctx->ncols; i++) lunet_free_nonnull(ctx->col_names[i]);
       lunet_free_nonnull(ctx->col_names);
@@ -745,7 +990,7 @@ cleanup:
   if (ctx->col_types) lunet_free_nonnull(ctx->col_types);
   
   lunet_free_nonnull(ctx->query);
-  free_params(ctx->params, ctx->nparams);
+  free_params(ctx->params, ctx->inline_params);
   lunet_free_nonnull(ctx);
 }
 
@@ -761,27 +1006,28 @@ int lunet_db_query(lua_State* L) {
     return 2;
   }
 
-  lunet_mysql_conn_t* wrapper = (lunet_mysql_conn_t*)luaL_testudata(L, 1, LUNET_MYSQL_CONN_MT);
-  if (!wrapper) {
-    lua_pushnil(L);
-    lua_pushstring(L, "db.query requires a valid connection");
+  lunet_mysql_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.query", &wrapper, &pool)) {
     return 2;
   }
 
-  if (wrapper->closed || !wrapper->conn) {
+  const char* query = luaL_checkstring(L, 2);
+  db_result_opts_t shape;
+  const char* shape_err = db_result_parse_opts(L, 3, &shape);
+  if (shape_err) {
     lua_pushnil(L);
-    lua_pushstring(L, "connection is closed");
+    lua_pushfstring(L, "db.query: %s", shape_err);
     return 2;
   }
 
-  const char* query = luaL_checkstring(L, 2);
-
   db_query_ctx_t* ctx = lunet_alloc(sizeof(db_query_ctx_t));
   if (!ctx) {
     lua_pushstring(L, "out of memory");
     return lua_error(L);
   }
   memset(ctx, 0, sizeof(*ctx));
+  ctx->shape = shape;
   ctx->L = L;
   ctx->req.data = ctx;
   ctx->wrapper = wrapper;
@@ -793,7 +1039,7 @@ int lunet_db_query(lua_State* L) {
     return 2;
   }
   
-  ctx->params = collect_params(L, 3, &ctx->nparams);
+  ctx->params = collect_params(L, 3, &ctx->nparams, ctx->inline_params);
   if (ctx->nparams < 0) {
       lunet_free_nonnull(ctx->query);
       lunet_free_nonnull(ctx);
@@ -804,14 +1050,14 @@ int lunet_db_query(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_query_work_cb, db_query_after_cb);
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_query_work_cb, db_query_after_cb, ctx->err, sizeof(ctx->err));
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushstring(L, uv_strerror(ret));
+    lua_pushstring(L, db_pool_strerror(pool, ret));
     return 2;
   }
 
@@ -823,18 +1069,20 @@ typedef struct {
   lua_State* L;
   int co_ref;
 
+  db_pool_waiter_t pw;
   lunet_mysql_conn_t* wrapper;
   char* query;
   
   param_t* params;
   int nparams;
+  param_t inline_params[DB_INLINE_PARAMS];
 
   int affected_rows;
   unsigned long long insert_id;
   char err[256];
 } db_exec_ctx_t;
 
-static void db_exec_work_cb(uv_work_t* req) {
+static void db_exec_run(uv_work_t* req) {
   db_exec_ctx_t* ctx = (db_exec_ctx_t*)req->data;
 
   uv_mutex_lock(&ctx->wrapper->mutex);
@@ -846,19 +1094,18 @@ static void db_exec_work_cb(uv_work_t* req) {
     uv_mutex_unlock(&ctx->wrapper->mutex);
     return;
   }
-
-  // Use prepared statement
-  MYSQL_STMT* stmt = mysql_stmt_init(ctx->wrapper->conn);
-  if (!stmt) {
-    snprintf(ctx->err, sizeof(ctx->err), "mysql_stmt_init failed: %s", mysql_error(ctx->wrapper->conn));
+  // An unbuffered cursor result owns the wire until it is drained or closed
+  if (cursor_owns_conn(ctx->wrapper)) {
+    snprintf(ctx->err, sizeof(ctx->err), "connection has an open cursor");
     mysql_thread_end();
     uv_mutex_unlock(&ctx->wrapper->mutex);
     return;
   }
 
-  if (mysql_stmt_prepare(stmt, ctx->query, strlen(ctx->query))) {
-    snprintf(ctx->err, sizeof(ctx->err), "mysql_stmt_prepare failed: %s", mysql_stmt_error(stmt));
-    mysql_stmt_close(stmt);
+  // Use prepared statement, reusing the connection's cached handle when possible
+  int cached = 0;
+  MYSQL_STMT* stmt = stmt_acquire(ctx->wrapper, ctx->query, &cached, ctx->err, sizeof(ctx->err));
+  if (!stmt) {
     mysql_thread_end();
     uv_mutex_unlock(&ctx->wrapper->mutex);
     return;
@@ -867,7 +1114,7 @@ static void db_exec_work_cb(uv_work_t* req) {
   unsigned long param_count = mysql_stmt_param_count(stmt);
   if (param_count != (unsigned long)ctx->nparams) {
     snprintf(ctx->err, sizeof(ctx->err), "parameter count mismatch: expected %lu, got %d", param_count, ctx->nparams);
-    mysql_stmt_close(stmt);
+    stmt_release(ctx->wrapper, ctx->query, stmt, cached, 1);
     mysql_thread_end();
     uv_mutex_unlock(&ctx->wrapper->mutex);
     return;
@@ -878,7 +1125,7 @@ static void db_exec_work_cb(uv_work_t* req) {
       bind = lunet_alloc(sizeof(MYSQL_BIND) * ctx->nparams);
       if (!bind) {
           snprintf(ctx->err, sizeof(ctx->err), "out of memory");
-          mysql_stmt_close(stmt);
+          stmt_release(ctx->wrapper, ctx->query, stmt, cached, 0);
           mysql_thread_end();
           uv_mutex_unlock(&ctx->wrapper->mutex);
           return;
@@ -886,7 +1133,7 @@ static void db_exec_work_cb(uv_work_t* req) {
       
       if (bind_params(stmt, bind, ctx->params, ctx->nparams, ctx->err, sizeof(ctx->err))) {
           lunet_free_nonnull(bind);
-          mysql_stmt_close(stmt);
+          stmt_release(ctx->wrapper, ctx->query, stmt, cached, 0);
           mysql_thread_end();
           uv_mutex_unlock(&ctx->wrapper->mutex);
           return;
@@ -896,7 +1143,7 @@ static void db_exec_work_cb(uv_work_t* req) {
   if (mysql_stmt_execute(stmt)) {
     snprintf(ctx->err, sizeof(ctx->err), "mysql_stmt_execute failed: %s", mysql_stmt_error(stmt));
     if (bind) lunet_free_nonnull(bind);
-    mysql_stmt_close(stmt);
+    stmt_release(ctx->wrapper, ctx->query, stmt, cached, 0);
     mysql_thread_end();
     uv_mutex_unlock(&ctx->wrapper->mutex);
     return;
@@ -907,13 +1154,24 @@ static void db_exec_work_cb(uv_work_t* req) {
   ctx->affected_rows = mysql_stmt_affected_rows(stmt);
   ctx->insert_id = mysql_stmt_insert_id(stmt);
   
-  mysql_stmt_close(stmt);
+  stmt_release(ctx->wrapper, ctx->query, stmt, cached, 1);
   mysql_thread_end();
   uv_mutex_unlock(&ctx->wrapper->mutex);
 }
 
+static void db_exec_work_cb(uv_work_t* req) {
+  db_exec_ctx_t* ctx = (db_exec_ctx_t*)req->data;
+  if (ctx->pw.pool) {
+    ctx->wrapper = (lunet_mysql_conn_t*)ctx->pw.conn;
+    if (pool_checkout(&ctx->pw, ctx->err, sizeof(ctx->err))) return;
+  }
+  db_exec_run(req);
+  if (ctx->pw.pool) pool_checkin(&ctx->pw, ctx->err);
+}
+
 static void db_exec_after_cb(uv_work_t* req, int status) {
   db_exec_ctx_t* ctx = (db_exec_ctx_t*)req->data;
+  if (db_pool_release(&ctx->pw)) return;  // re-queued on a fresh pooled connection
   lua_State* L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -922,7 +1180,7 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
     lua_pop(L, 1);
     fprintf(stderr, "invalid coroutine in db.exec\n");
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     return;
   }
@@ -956,7 +1214,7 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
   }
 
   lunet_free_nonnull(ctx->query);
-  free_params(ctx->params, ctx->nparams);
+  free_params(ctx->params, ctx->inline_params);
   lunet_free_nonnull(ctx);
 }
 
@@ -972,16 +1230,9 @@ int lunet_db_exec(lua_State* L) {
     return 2;
   }
 
-  lunet_mysql_conn_t* wrapper = (lunet_mysql_conn_t*)luaL_testudata(L, 1, LUNET_MYSQL_CONN_MT);
-  if (!wrapper) {
-    lua_pushnil(L);
-    lua_pushstring(L, "db.exec requires a valid connection");
-    return 2;
-  }
-
-  if (wrapper->closed || !wrapper->conn) {
-    lua_pushnil(L);
-    lua_pushstring(L, "connection is closed");
+  lunet_mysql_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.exec", &wrapper, &pool)) {
     return 2;
   }
 
@@ -1005,7 +1256,7 @@ int lunet_db_exec(lua_State* L) {
     return 2;
   }
   
-  ctx->params = collect_params(L, 3, &ctx->nparams);
+  ctx->params = collect_params(L, 3, &ctx->nparams, ctx->inline_params);
   if (ctx->nparams < 0) {
       lunet_free_nonnull(ctx->query);
       lunet_free_nonnull(ctx);
@@ -1016,14 +1267,14 @@ int lunet_db_exec(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_exec_work_cb, db_exec_after_cb, ctx->err, sizeof(ctx->err));
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushstring(L, uv_strerror(ret));
+    lua_pushstring(L, db_pool_strerror(pool, ret));
     return 2;
   }
 
@@ -1050,6 +1301,24 @@ int lunet_db_escape(lua_State* L) {
   return 1;
 }
 
+int lunet_db_stmt_cache_stats(lua_State* L) {
+  lunet_mysql_conn_t* wrapper = (lunet_mysql_conn_t*)luaL_testudata(L, 1, LUNET_MYSQL_CONN_MT);
+  if (!wrapper) {
+    lua_pushnil(L);
+    lua_pushstring(L, "db.stmt_cache_stats requires a valid connection");
+    return 2;
+  }
+  uv_mutex_lock(&wrapper->mutex);
+  stmt_cache_push_stats(L, &wrapper->stmts);
+  uv_mutex_unlock(&wrapper->mutex);
+  return 1;
+}
+
+int lunet_db_executor_stats(lua_State* L) {
+  lunet_exec_push_stats(L, LUNET_EXEC_DB);
+  return 1;
+}
+
 // Helper function to count parameters in SQL string
 static int count_params(const char* sql) {
   int count = 0;
@@ -1072,27 +1341,28 @@ int lunet_db_query_params(lua_State* L) {
     return 2;
   }
   
-  lunet_mysql_conn_t* wrapper = (lunet_mysql_conn_t*)luaL_testudata(L, 1, LUNET_MYSQL_CONN_MT);
-  if (!wrapper) {
-    lua_pushnil(L);
-    lua_pushstring(L, "db.query requires a valid connection");
+  lunet_mysql_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.query", &wrapper, &pool)) {
     return 2;
   }
   
-  if (wrapper->closed || !wrapper->conn) {
+  const char* query = luaL_checkstring(L, 2);
+  db_result_opts_t shape;
+  const char* shape_err = db_result_parse_opts(L, 3, &shape);
+  if (shape_err) {
     lua_pushnil(L);
-    lua_pushstring(L, "connection is closed");
+    lua_pushfstring(L, "db.query_params: %s", shape_err);
     return 2;
   }
   
-  const char* query = luaL_checkstring(L, 2);
-  
   db_query_ctx_t* ctx = lunet_alloc(sizeof(db_query_ctx_t));
   if (!ctx) {
     lua_pushstring(L, "out of memory");
     return lua_error(L);
   }
   memset(ctx, 0, sizeof(*ctx));
+  ctx->shape = shape;
   ctx->L = L;
   ctx->req.data = ctx;
   ctx->wrapper = wrapper;
@@ -1104,7 +1374,7 @@ int lunet_db_query_params(lua_State* L) {
     return 2;
   }
 
-  ctx->params = collect_params(L, 3, &ctx->nparams);
+  ctx->params = collect_params(L, 3, &ctx->nparams, ctx->inline_params);
   if (ctx->nparams < 0) {
       lunet_free_nonnull(ctx->query);
       lunet_free_nonnull(ctx);
@@ -1115,14 +1385,14 @@ int lunet_db_query_params(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_query_work_cb, db_query_after_cb);
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_query_work_cb, db_query_after_cb, ctx->err, sizeof(ctx->err));
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushstring(L, uv_strerror(ret));
+    lua_pushstring(L, db_pool_strerror(pool, ret));
     return 2;
   }
 
@@ -1142,16 +1412,9 @@ int lunet_db_exec_params(lua_State* L) {
     return 2;
   }
   
-  lunet_mysql_conn_t* wrapper = (lunet_mysql_conn_t*)luaL_testudata(L, 1, LUNET_MYSQL_CONN_MT);
-  if (!wrapper) {
-    lua_pushnil(L);
-    lua_pushstring(L, "db.exec requires a valid connection");
-    return 2;
-  }
-  
-  if (wrapper->closed || !wrapper->conn) {
-    lua_pushnil(L);
-    lua_pushstring(L, "connection is closed");
+  lunet_mysql_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.exec", &wrapper, &pool)) {
     return 2;
   }
   
@@ -1174,7 +1437,7 @@ int lunet_db_exec_params(lua_State* L) {
     return 2;
   }
   
-  ctx->params = collect_params(L, 3, &ctx->nparams);
+  ctx->params = collect_params(L, 3, &ctx->nparams, ctx->inline_params);
   if (ctx->nparams < 0) {
       lunet_free_nonnull(ctx->query);
       lunet_free_nonnull(ctx);
@@ -1185,16 +1448,831 @@ int lunet_db_exec_params(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_exec_work_cb, db_exec_after_cb, ctx->err, sizeof(ctx->err));
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushstring(L, uv_strerror(ret));
+    lua_pushstring(L, db_pool_strerror(pool, ret));
     return 2;
   }
 
   return lua_yield(L, 0);
 }
+
+/*
+ * Batched execution (db.exec_batch)
+ *
+ * Every parameter tuple runs inside one executor job on one connection, with
+ * the statement prepared once: a bulk insert costs one hop and one mutex
+ * acquire instead of one per row.
+ *
+ * MySQL wraps the batch in one transaction when the session is in autocommit
+ * mode and rolls it back if any tuple fails. The C API has no portable array
+ * binding, so tuples share the prepared statement and its bind buffers and
+ * are executed back to back.
+ */
+
+typedef struct {
+  uv_work_t req;
+  lua_State* L;
+  int co_ref;
+
+  db_pool_waiter_t pw;
+  lunet_mysql_conn_t* wrapper;
+  char* query;
+
+  param_t* params;     // nrows tuples of width params, row-major
+  int nrows;
+  int width;
+  int pin_ref;         // table holding the borrowed strings, or LUA_NOREF
+  long long* counts;   // affected rows per tuple
+  long long affected_rows;
+  unsigned long long insert_id;
+  char err[256];
+} db_batch_ctx_t;
+
+static void free_batch(db_batch_ctx_t* ctx) {
+  free_params(ctx->params, NULL);
+  if (ctx->pin_ref != LUA_NOREF) lunet_coref_release(ctx->L, ctx->pin_ref);
+  if (ctx->counts) lunet_free_nonnull(ctx->counts);
+  lunet_free_nonnull(ctx->query);
+  lunet_free_nonnull(ctx);
+}
+
+// Copy the rows table at idx into ctx. Tuples shorter than the widest one
+// are padded with NULLs. Returns NULL or an error message.
+static const char* collect_batch(lua_State* L, int idx, db_batch_ctx_t* ctx) {
+  int nrows = (int)lua_objlen(L, idx);
+  int width = 0;
+  for (int i = 1; i <= nrows; i++) {
+    lua_rawgeti(L, idx, i);
+    if (!lua_istable(L, -1)) {
+      lua_pop(L, 1);
+      return "rows must be an array of parameter arrays";
+    }
+    int n = (int)lua_objlen(L, -1);
+    if (n > width) width = n;
+    lua_pop(L, 1);
+  }
+  if (nrows == 0) return NULL;
+  if (!lua_checkstack(L, width + 3)) return "too many parameters per row";
+
+  ctx->counts = lunet_calloc((size_t)nrows, sizeof(long long));
+  if (width > 0) ctx->params = lunet_alloc(sizeof(param_t) * (size_t)nrows * (size_t)width);
+  if (!ctx->counts || (width > 0 && !ctx->params)) return "out of memory";
+  ctx->width = width;
+  // Other coroutines may rewrite the tuples while the batch runs, so the
+  // strings are pinned on their own rather than through the rows table
+  lua_newtable(L);
+  int pin = lua_gettop(L);
+  int npinned = 0;
+  for (int i = 0; i < nrows; i++) {
+    lua_rawgeti(L, idx, i + 1);
+    int base = lua_gettop(L);
+    for (int j = 1; j <= width; j++) {
+      lua_rawgeti(L, base, j);
+      if (lua_type(L, -1) == LUA_TSTRING) {
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, pin, ++npinned);
+      }
+    }
+    fill_params(L, base + 1, width, ctx->params + (size_t)i * width);
+    lua_settop(L, base - 1);
+  }
+  if (npinned > 0) {
+    lunet_coref_create_raw(L, ctx->pin_ref);
+  } else {
+    lua_pop(L, 1);
+  }
+  ctx->nrows = nrows;
+  return NULL;
+}
+
+// Prefix the row number to the error so a failing tuple can be located
+static void batch_fail(db_batch_ctx_t* ctx, int row, const char* msg) {
+  char tmp[sizeof(ctx->err)];
+  snprintf(tmp, sizeof(tmp), "%s", msg);
+  snprintf(ctx->err, sizeof(ctx->err), "row %d: %s", row + 1, tmp);
+}
+
+static void db_batch_run(uv_work_t* req) {
+  db_batch_ctx_t* ctx = (db_batch_ctx_t*)req->data;
+
+  uv_mutex_lock(&ctx->wrapper->mutex);
+
+  mysql_thread_init();
+  if (ctx->wrapper->closed || !ctx->wrapper->conn) {
+    snprintf(ctx->err, sizeof(ctx->err), "connection is closed");
+    mysql_thread_end();
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+  if (cursor_owns_conn(ctx->wrapper)) {
+    snprintf(ctx->err, sizeof(ctx->err), "connection has an open cursor");
+    mysql_thread_end();
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+  MYSQL* conn = ctx->wrapper->conn;
+
+  int cached = 0;
+  MYSQL_STMT* stmt = stmt_acquire(ctx->wrapper, ctx->query, &cached, ctx->err, sizeof(ctx->err));
+  if (!stmt) {
+    mysql_thread_end();
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+  unsigned long param_count = mysql_stmt_param_count(stmt);
+  if (ctx->nrows > 0 && param_count != (unsigned long)ctx->width) {
+    snprintf(ctx->err, sizeof(ctx->err), "parameter count mismatch: expected %lu, got %d", param_count, ctx->width);
+    stmt_release(ctx->wrapper, ctx->query, stmt, cached, 1);
+    mysql_thread_end();
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+  MYSQL_BIND* bind = NULL;
+  if (ctx->width > 0) {
+    bind = lunet_alloc(sizeof(MYSQL_BIND) * ctx->width);
+    if (!bind) {
+      snprintf(ctx->err, sizeof(ctx->err), "out of memory");
+      stmt_release(ctx->wrapper, ctx->query, stmt, cached, 1);
+      mysql_thread_end();
+      uv_mutex_unlock(&ctx->wrapper->mutex);
+      return;
+    }
+  }
+
+  // Commit once for the whole batch unless the caller already has a
+  // transaction open (or runs with autocommit off and commits itself)
+  int own_txn = (conn->server_status & SERVER_STATUS_AUTOCOMMIT) && !(conn->server_status & SERVER_STATUS_IN_TRANS);
+  if (own_txn && mysql_query(conn, "START TRANSACTION")) {
+    snprintf(ctx->err, sizeof(ctx->err), "%s", mysql_error(conn));
+    if (bind) lunet_free_nonnull(bind);
+    stmt_release(ctx->wrapper, ctx->query, stmt, cached, 1);
+    mysql_thread_end();
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+
+  int stmt_ok = 1;
+  for (int i = 0; i < ctx->nrows; i++) {
+    char err[256] = {0};
+    if (bind_params(stmt, bind, ctx->params + (size_t)i * ctx->width, ctx->width, err, sizeof(err))) {
+      batch_fail(ctx, i, err);
+      break;
+    }
+    if (mysql_stmt_execute(stmt)) {
+      snprintf(err, sizeof(err), "mysql_stmt_execute failed: %s", mysql_stmt_error(stmt));
+      batch_fail(ctx, i, err);
+      stmt_ok = 0;
+      break;
+    }
+    ctx->counts[i] = (long long)mysql_stmt_affected_rows(stmt);
+    ctx->affected_rows += ctx->counts[i];
+    unsigned long long id = mysql_stmt_insert_id(stmt);
+    if (id) ctx->insert_id = id;
+  }
+
+  if (ctx->err[0] != '\0') {
+    if (own_txn) mysql_rollback(conn);
+  } else if (own_txn && mysql_commit(conn)) {
+    snprintf(ctx->err, sizeof(ctx->err), "%s", mysql_error(conn));
+    mysql_rollback(conn);
+  }
+  if (bind) lunet_free_nonnull(bind);
+  stmt_release(ctx->wrapper, ctx->query, stmt, cached, stmt_ok);
+  mysql_thread_end();
+  uv_mutex_unlock(&ctx->wrapper->mutex);
+}
+
+static void db_batch_work_cb(uv_work_t* req) {
+  db_batch_ctx_t* ctx = (db_batch_ctx_t*)req->data;
+  if (ctx->pw.pool) {
+    ctx->wrapper = (lunet_mysql_conn_t*)ctx->pw.conn;
+    if (pool_checkout(&ctx->pw, ctx->err, sizeof(ctx->err))) return;
+  }
+  db_batch_run(req);
+  if (ctx->pw.pool) pool_checkin(&ctx->pw, ctx->err);
+}
+
+static void db_batch_after_cb(uv_work_t* req, int status) {
+  db_batch_ctx_t* ctx = (db_batch_ctx_t*)req->data;
+  if (db_pool_release(&ctx->pw)) return;  // re-queued on a fresh pooled connection
+  lua_State* L = ctx->L;
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
+  lunet_coref_release(L, ctx->co_ref);
+  if (!lua_isthread(L, -1)) {
+    lua_pop(L, 1);
+    fprintf(stderr, "invalid coroutine in db.exec_batch\n");
+    free_batch(ctx);
+    return;
+  }
+  lua_State* co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+
+  if (ctx->err[0] != '\0') {
+    lua_pushnil(co);
+    lua_pushstring(co, ctx->err);
+  } else {
+    lua_createtable(co, 0, 3);
+    lua_pushinteger(co, ctx->affected_rows);
+    lua_setfield(co, -2, "affected_rows");
+    lua_pushinteger(co, ctx->insert_id);
+    lua_setfield(co, -2, "last_insert_id");
+    lua_createtable(co, ctx->nrows, 0);
+    for (int i = 0; i < ctx->nrows; i++) {
+      lua_pushinteger(co, ctx->counts[i]);
+      lua_rawseti(co, -2, i + 1);
+    }
+    lua_setfield(co, -2, "counts");
+    lua_pushnil(co);
+  }
+  int rc = lunet_co_resume(co, 2);
+  if (rc != 0 && rc != LUA_YIELD) {
+    const char* err = lua_tostring(co, -1);
+    if (err) fprintf(stderr, "lua_resume error in db.exec_batch: %s\n", err);
+    lua_pop(co, 1);
+  }
+
+  free_batch(ctx);
+}
+
+// db.exec_batch(conn, sql, {{...}, {...}}) -> {affected_rows, last_insert_id, counts} | nil, err
+int lunet_db_exec_batch(lua_State* L) {
+  if (lunet_ensure_coroutine(L, "db.exec_batch")) {
+    return lua_error(L);
+  }
+  if (lua_gettop(L) < 3 || !lua_istable(L, 3)) {
+    lua_pushnil(L);
+    lua_pushstring(L, "db.exec_batch requires connection, sql string and rows table");
+    return 2;
+  }
+
+  lunet_mysql_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.exec_batch", &wrapper, &pool)) {
+    return 2;
+  }
+
+  const char* query = luaL_checkstring(L, 2);
+
+  db_batch_ctx_t* ctx = lunet_alloc(sizeof(db_batch_ctx_t));
+  if (!ctx) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->L = L;
+  ctx->req.data = ctx;
+  ctx->wrapper = wrapper;
+  ctx->pin_ref = LUA_NOREF;
+  ctx->query = lunet_strdup_local(query);
+  if (!ctx->query) {
+    lunet_free_nonnull(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+
+  const char* err = collect_batch(L, 3, ctx);
+  if (err) {
+    free_batch(ctx);
+    lua_pushnil(L);
+    lua_pushfstring(L, "db.exec_batch: %s", err);
+    return 2;
+  }
+
+  lunet_coref_create(L, ctx->co_ref);
+
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_batch_work_cb, db_batch_after_cb, ctx->err, sizeof(ctx->err));
+  if (ret < 0) {
+    lunet_coref_release(L, ctx->co_ref);
+    free_batch(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, db_pool_strerror(pool, ret));
+    return 2;
+  }
+
+  return lua_yield(L, 0);
+}
+
+/*
+ * Cursors (db.cursor)
+ *
+ * The statement is executed without mysql_stmt_store_result(), the prepared
+ * statement equivalent of mysql_use_result(): rows stay on the socket until
+ * cursor:next() fetches them, at most batch_size per hop. Such a result owns
+ * the connection, so other queries on it fail until the cursor is drained or
+ * closed. Values longer than the bound buffer are re-read whole with
+ * mysql_stmt_fetch_column.
+ */
+
+#define DB_CURSOR_DEFAULT_BATCH 100
+#define DB_CURSOR_MAX_BATCH 10000
+
+struct lunet_mysql_cursor {
+  lunet_mysql_conn_t* wrapper;  // NULL once exhausted, closed or detached
+  MYSQL_STMT* stmt;             // executed on the first fetch
+  MYSQL_RES* metadata;
+  MYSQL_BIND* result_bind;
+  char* is_null;
+  unsigned long* length;
+  char* query;
+  param_t* params;
+  int nparams;
+  char** col_names;
+  int* col_types;
+  int ncols;
+  int done;
+  int busy;                     // a fetch or close is in flight (loop thread only)
+};
+
+// Caller holds wrapper->mutex. Closing the statement reads and discards any
+// rows still pending, which leaves the connection usable again; outside the
+// executor that only happens once mysql_close has detached the statement.
+static void cursor_finish(lunet_mysql_cursor_t* cur) {
+  if (!cur->wrapper) return;
+  if (cur->result_bind) {
+    for (int i = 0; i < cur->ncols; i++) lunet_free_nonnull(cur->result_bind[i].buffer);
+    lunet_free(cur->result_bind);
+  }
+  if (cur->is_null) lunet_free(cur->is_null);
+  if (cur->length) lunet_free(cur->length);
+  if (cur->metadata) {
+    mysql_free_result(cur->metadata);
+    cur->metadata = NULL;
+  }
+  if (cur->stmt) {
+    mysql_stmt_close(cur->stmt);
+    cur->stmt = NULL;
+  }
+  if (cur->wrapper->cursor == cur) cur->wrapper->cursor = NULL;
+  if (cur->wrapper->abandoned == cur) cur->wrapper->abandoned = NULL;
+  cur->wrapper = NULL;
+}
+
+// Caller holds wrapper->mutex on the executor. Drains a cursor left behind by
+// __gc before the connection is reused, then reports whether a live cursor
+// still owns the wire.
+static int cursor_owns_conn(lunet_mysql_conn_t* wrapper) {
+  lunet_mysql_cursor_t* orphan = wrapper->abandoned;
+  if (orphan) {
+    cursor_finish(orphan);
+    lunet_free(orphan);
+  }
+  return wrapper->cursor != NULL;
+}
+
+static void cursor_detach(lunet_mysql_conn_t* wrapper) {
+  if (wrapper->cursor) cursor_finish(wrapper->cursor);
+  if (wrapper->abandoned) {
+    lunet_mysql_cursor_t* orphan = wrapper->abandoned;
+    cursor_finish(orphan);
+    lunet_free(orphan);
+  }
+}
+
+static void cursor_free_fields(lunet_mysql_cursor_t* cur) {
+  for (int i = 0; i < cur->ncols; i++) lunet_free_nonnull(cur->col_names[i]);
+  if (cur->col_names) lunet_free(cur->col_names);
+  if (cur->col_types) lunet_free(cur->col_types);
+  cur->ncols = 0;
+  if (cur->query) lunet_free(cur->query);
+  free_params(cur->params, NULL);
+  cur->params = NULL;
+  cur->nparams = 0;
+}
+
+// Only reached once no fetch is in flight: a busy cursor is on its coroutine's
+// stack. Unread rows are not drained here, which would block the loop: the
+// statement moves to wrapper->abandoned and the next job on the connection
+// (or its close) finishes it on the executor.
+static int cursor_gc(lua_State* L) {
+  lunet_mysql_cursor_t* cur = (lunet_mysql_cursor_t*)luaL_checkudata(L, 1, LUNET_MYSQL_CURSOR_MT);
+  if (cur->wrapper) {
+    lunet_mysql_conn_t* wrapper = cur->wrapper;
+    uv_mutex_lock(&wrapper->mutex);
+    lunet_mysql_cursor_t* orphan = cur->stmt ? lunet_alloc(sizeof(*orphan)) : NULL;
+    if (orphan) {
+      // The copy owns the statement and binds; names and params stay with cur
+      *orphan = *cur;
+      orphan->query = NULL;
+      orphan->params = NULL;
+      orphan->nparams = 0;
+      orphan->col_names = NULL;
+      orphan->col_types = NULL;
+      wrapper->cursor = NULL;
+      wrapper->abandoned = orphan;
+      cur->wrapper = NULL;
+    } else {
+      // Never started (nothing on the wire), or out of memory
+      cursor_finish(cur);
+    }
+    uv_mutex_unlock(&wrapper->mutex);
+  }
+  cursor_free_fields(cur);
+  return 0;
+}
+
+typedef struct {
+  uv_work_t req;
+  lua_State* L;
+  int co_ref;
+
+  lunet_mysql_cursor_t* cursor;
+  lunet_mysql_conn_t* wrapper;
+  int limit;  // 0 closes the cursor
+  char*** rows;
+  int nrows;
+  char err[256];
+} db_cursor_ctx_t;
+
+// Caller holds wrapper->mutex
+static int cursor_start(lunet_mysql_cursor_t* cur, char* err, size_t errsize) {
+  MYSQL* conn = cur->wrapper->conn;
+  cur->stmt = mysql_stmt_init(conn);
+  if (!cur->stmt) {
+    snprintf(err, errsize, "mysql_stmt_init failed: %s", mysql_error(conn));
+    return -1;
+  }
+  if (mysql_stmt_prepare(cur->stmt, cur->query, strlen(cur->query))) {
+    snprintf(err, errsize, "mysql_stmt_prepare failed: %s", mysql_stmt_error(cur->stmt));
+    return -1;
+  }
+  unsigned long param_count = mysql_stmt_param_count(cur->stmt);
+  if (param_count != (unsigned long)cur->nparams) {
+    snprintf(err, errsize, "parameter count mismatch: expected %lu, got %d", param_count, cur->nparams);
+    return -1;
+  }
+
+  MYSQL_BIND* bind = NULL;
+  if (cur->nparams > 0) {
+    bind = lunet_alloc(sizeof(MYSQL_BIND) * cur->nparams);
+    if (!bind) {
+      snprintf(err, errsize, "out of memory");
+      return -1;
+    }
+    if (bind_params(cur->stmt, bind, cur->params, cur->nparams, err, errsize)) {
+      lunet_free_nonnull(bind);
+      return -1;
+    }
+  }
+  int failed = mysql_stmt_execute(cur->stmt);
+  if (bind) lunet_free_nonnull(bind);
+  free_params(cur->params, NULL);
+  cur->params = NULL;
+  cur->nparams = 0;
+  if (failed) {
+    snprintf(err, errsize, "mysql_stmt_execute failed: %s", mysql_stmt_error(cur->stmt));
+    return -1;
+  }
+
+  cur->metadata = mysql_stmt_result_metadata(cur->stmt);
+  if (!cur->metadata) {
+    if (mysql_stmt_field_count(cur->stmt) != 0) {
+      snprintf(err, errsize, "mysql_stmt_result_metadata failed: %s", mysql_stmt_error(cur->stmt));
+      return -1;
+    }
+    cur->done = 1;  // statement without a result set
+    return 0;
+  }
+
+  int ncols = (int)mysql_num_fields(cur->metadata);
+  MYSQL_FIELD* fields = mysql_fetch_fields(cur->metadata);
+  cur->col_names = lunet_calloc((size_t)ncols, sizeof(char*));
+  cur->col_types = lunet_calloc((size_t)ncols, sizeof(int));
+  cur->result_bind = lunet_calloc((size_t)ncols, sizeof(MYSQL_BIND));
+  // Use char for is_null to match my_bool on older MySQL/MariaDB (char vs bool)
+  cur->is_null = lunet_calloc((size_t)ncols, sizeof(char));
+  cur->length = lunet_calloc((size_t)ncols, sizeof(unsigned long));
+  if (!cur->col_names || !cur->col_types || !cur->result_bind || !cur->is_null || !cur->length) {
+    snprintf(err, errsize, "out of memory");
+    return -1;
+  }
+  cur->ncols = ncols;
+  for (int i = 0; i < ncols; i++) {
+    cur->col_names[i] = lunet_strdup_local(fields[i].name);
+    cur->col_types[i] = fields[i].type;
+    unsigned long len = fields[i].length;
+    if (len == 0 || len > 65535) len = 255;  // long values are re-read in full
+    cur->result_bind[i].buffer_type = MYSQL_TYPE_STRING;
+    cur->result_bind[i].buffer_length = len + 1;
+    cur->result_bind[i].buffer = lunet_alloc(len + 1);
+    cur->result_bind[i].is_null = &cur->is_null[i];
+    cur->result_bind[i].length = &cur->length[i];
+    if (!cur->col_names[i] || !cur->result_bind[i].buffer) {
+      snprintf(err, errsize, "out of memory");
+      return -1;
+    }
+  }
+  if (mysql_stmt_bind_result(cur->stmt, cur->result_bind)) {
+    snprintf(err, errsize, "mysql_stmt_bind_result failed: %s", mysql_stmt_error(cur->stmt));
+    return -1;
+  }
+  return 0;
+}
+
+// Copy column i of the current row, fetching values that did not fit the buffer
+static char* cursor_column(lunet_mysql_cursor_t* cur, int i) {
+  MYSQL_BIND* b = &cur->result_bind[i];
+  unsigned long len = cur->length[i];
+  char* out = lunet_alloc(len + 1);
+  if (!out) return NULL;
+  if (len < b->buffer_length) {
+    memcpy(out, b->buffer, len);
+  } else {
+    MYSQL_BIND full;
+    unsigned long got = 0;
+    memset(&full, 0, sizeof(full));
+    full.buffer_type = MYSQL_TYPE_STRING;
+    full.buffer = out;
+    full.buffer_length = len + 1;
+    full.length = &got;
+    if (mysql_stmt_fetch_column(cur->stmt, &full, (unsigned int)i, 0)) {
+      lunet_free_nonnull(out);
+      return NULL;
+    }
+  }
+  out[len] = '\0';
+  return out;
+}
+
+static void db_cursor_work_cb(uv_work_t* req) {
+  db_cursor_ctx_t* ctx = (db_cursor_ctx_t*)req->data;
+  lunet_mysql_cursor_t* cur = ctx->cursor;
+
+  uv_mutex_lock(&ctx->wrapper->mutex);
+  mysql_thread_init();
+  if (!cur->wrapper || ctx->wrapper->closed || !ctx->wrapper->conn) {
+    if (ctx->limit > 0) snprintf(ctx->err, sizeof(ctx->err), "connection is closed");
+    goto out;
+  }
+  if (ctx->limit == 0) {
+    cursor_finish(cur);
+    goto out;
+  }
+  if (!cur->stmt) {
+    cursor_owns_conn(ctx->wrapper);  // drain an earlier abandoned cursor first
+    if (cursor_start(cur, ctx->err, sizeof(ctx->err)) != 0) {
+      cursor_finish(cur);
+      goto out;
+    }
+  }
+
+  if (!cur->done) {
+    int capacity = ctx->limit < 16 ? ctx->limit : 16;
+    ctx->rows = lunet_alloc(sizeof(char**) * capacity);
+    if (!ctx->rows) {
+      snprintf(ctx->err, sizeof(ctx->err), "out of memory");
+      goto out;
+    }
+    while (ctx->nrows < ctx->limit) {
+      int rc = mysql_stmt_fetch(cur->stmt);
+      if (rc == MYSQL_NO_DATA) {
+        cur->done = 1;
+        break;
+      }
+      if (rc != 0 && rc != MYSQL_DATA_TRUNCATED) {
+        snprintf(ctx->err, sizeof(ctx->err), "mysql_stmt_fetch failed: %s", mysql_stmt_error(cur->stmt));
+        break;
+      }
+      if (ctx->nrows >= capacity) {
+        capacity = capacity * 2 < ctx->limit ? capacity * 2 : ctx->limit;
+        char*** new_rows = lunet_realloc(ctx->rows, sizeof(char**) * capacity);
+        if (!new_rows) {
+          snprintf(ctx->err, sizeof(ctx->err), "out of memory");
+          break;
+        }
+        ctx->rows = new_rows;
+      }
+      char** row = lunet_calloc((size_t)cur->ncols, sizeof(char*));
+      if (!row) {
+        snprintf(ctx->err, sizeof(ctx->err), "out of memory");
+        break;
+      }
+      int failed = 0;
+      for (int i = 0; i < cur->ncols && !failed; i++) {
+        if (cur->is_null[i]) continue;
+        row[i] = cursor_column(cur, i);
+        failed = row[i] == NULL;
+      }
+      if (failed) {
+        snprintf(ctx->err, sizeof(ctx->err), "out of memory");
+        for (int i = 0; i < cur->ncols; i++) lunet_free_nonnull(row[i]);
+        lunet_free_nonnull(row);
+        break;
+      }
+      ctx->rows[ctx->nrows++] = row;
+    }
+  }
+  // An exhausted or failed cursor hands the connection back right away
+  if (cur->done || ctx->err[0] != '\0') cursor_finish(cur);
+
+out:
+  mysql_thread_end();
+  uv_mutex_unlock(&ctx->wrapper->mutex);
+}
+
+static void db_cursor_after_cb(uv_work_t* req, int status) {
+  db_cursor_ctx_t* ctx = (db_cursor_ctx_t*)req->data;
+  lunet_mysql_cursor_t* cur = ctx->cursor;
+  lua_State* L = ctx->L;
+  const char* fname = ctx->limit > 0 ? "cursor:next" : "cursor:close";
+  cur->busy = 0;
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
+  lunet_coref_release(L, ctx->co_ref);
+  if (!lua_isthread(L, -1)) {
+    lua_pop(L, 1);
+    fprintf(stderr, "invalid coroutine in %s\n", fname);
+    goto cleanup;
+  }
+  lua_State* co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+
+  if (ctx->err[0] != '\0') {
+    lua_pushnil(co);
+    lua_pushstring(co, ctx->err);
+  } else if (ctx->limit > 0) {
+    push_rows(co, cur->col_names, cur->col_types, cur->ncols, ctx->rows, ctx->nrows, NULL);
+    lua_pushnil(co);
+  } else {
+    lua_pushnil(co);
+    lua_pushnil(co);
+  }
+  {
+    int rc = lunet_co_resume(co, 2);
+    if (rc != 0 && rc != LUA_YIELD) {
+      const char* err = lua_tostring(co, -1);
+      if (err) fprintf(stderr, "lua_resume error in %s: %s\n", fname, err);
+      lua_pop(co, 1);
+    }
+  }
+
+cleanup:
+  free_rows(ctx->rows, ctx->nrows, cur->ncols);
+  lunet_free_nonnull(ctx);
+}
+
+// Queue a fetch of up to limit rows, or a close when limit is 0
+static int cursor_queue(lua_State* L, lunet_mysql_cursor_t* cur, int limit) {
+  db_cursor_ctx_t* ctx = lunet_alloc(sizeof(db_cursor_ctx_t));
+  if (!ctx) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->L = L;
+  ctx->req.data = ctx;
+  ctx->cursor = cur;
+  ctx->wrapper = cur->wrapper;
+  ctx->limit = limit;
+
+  lunet_coref_create(L, ctx->co_ref);
+  int ret = lunet_exec_queue(LUNET_EXEC_DB, &ctx->req, db_cursor_work_cb, db_cursor_after_cb);
+  if (ret < 0) {
+    lunet_coref_release(L, ctx->co_ref);
+    lunet_free_nonnull(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, lunet_exec_strerror(LUNET_EXEC_DB, ret));
+    return 2;
+  }
+  cur->busy = 1;
+  return lua_yield(L, 0);
+}
+
+// cursor:next([batch_size]) -> rows (empty once exhausted) | nil, err
+static int cursor_next(lua_State* L) {
+  if (lunet_ensure_coroutine(L, "cursor:next")) {
+    return lua_error(L);
+  }
+  lunet_mysql_cursor_t* cur = (lunet_mysql_cursor_t*)luaL_checkudata(L, 1, LUNET_MYSQL_CURSOR_MT);
+  lua_Integer n = luaL_optinteger(L, 2, DB_CURSOR_DEFAULT_BATCH);
+  if (n < 1) n = 1;
+  if (n > DB_CURSOR_MAX_BATCH) n = DB_CURSOR_MAX_BATCH;
+  // The worker owns the cursor state while a request is in flight
+  if (cur->busy) {
+    lua_pushnil(L);
+    lua_pushstring(L, "cursor:next: cursor is busy");
+    return 2;
+  }
+  if (cur->done) {
+    lua_newtable(L);
+    return 1;
+  }
+  if (!cur->wrapper) {
+    lua_pushnil(L);
+    lua_pushstring(L, "cursor is closed");
+    return 2;
+  }
+  return cursor_queue(L, cur, (int)n);
+}
+
+// cursor:close() -> nil | err. Discards unread rows on the executor.
+static int cursor_close(lua_State* L) {
+  if (lunet_ensure_coroutine(L, "cursor:close")) {
+    return lua_error(L);
+  }
+  lunet_mysql_cursor_t* cur = (lunet_mysql_cursor_t*)luaL_checkudata(L, 1, LUNET_MYSQL_CURSOR_MT);
+  if (cur->busy) {
+    lua_pushstring(L, "cursor:close: cursor is busy");
+    return 1;
+  }
+  if (!cur->wrapper) {
+    lua_pushnil(L);
+    return 1;
+  }
+  int n = cursor_queue(L, cur, 0);
+  if (n == 2) {
+    lua_remove(L, -2);  // (nil, err) -> err
+    return 1;
+  }
+  return n;
+}
+
+static void register_cursor_metatable(lua_State* L) {
+  if (luaL_newmetatable(L, LUNET_MYSQL_CURSOR_MT)) {
+    lua_pushcfunction(L, cursor_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_createtable(L, 0, 2);
+    lua_pushcfunction(L, cursor_next);
+    lua_setfield(L, -2, "next");
+    lua_pushcfunction(L, cursor_close);
+    lua_setfield(L, -2, "close");
+    lua_setfield(L, -2, "__index");
+  }
+  lua_pop(L, 1);
+}
+
+// db.cursor(conn, sql, ...) -> cursor | nil, err
+// The query runs on the first cursor:next(); pools are not accepted because a
+// cursor has to stay on one connection across many fetches.
+int lunet_db_cursor(lua_State* L) {
+  lunet_mysql_conn_t* wrapper = (lunet_mysql_conn_t*)luaL_testudata(L, 1, LUNET_MYSQL_CONN_MT);
+  if (!wrapper) {
+    lua_pushnil(L);
+    lua_pushstring(L, "db.cursor requires a connection (not a pool)");
+    return 2;
+  }
+  if (wrapper->closed || !wrapper->conn) {
+    lua_pushnil(L);
+    lua_pushstring(L, "connection is closed");
+    return 2;
+  }
+  const char* query = luaL_checkstring(L, 2);
+  register_cursor_metatable(L);
+
+  int nparams = 0;
+  param_t* params = collect_params(L, 3, &nparams, NULL);
+  if (nparams < 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  char* copy = lunet_strdup_local(query);
+  if (!copy) {
+    free_params(params, NULL);
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+
+  lunet_mysql_cursor_t* cur = (lunet_mysql_cursor_t*)lua_newuserdata(L, sizeof(lunet_mysql_cursor_t));
+  memset(cur, 0, sizeof(*cur));
+  cur->query = copy;
+  cur->params = params;
+  cur->nparams = nparams;
+  luaL_getmetatable(L, LUNET_MYSQL_CURSOR_MT);
+  lua_setmetatable(L, -2);
+  // The environment table keeps the connection and the borrowed string
+  // parameters alive for as long as the cursor
+  lua_createtable(L, 1 + nparams, 0);
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, -2, 1);
+  for (int i = 0; i < nparams; i++) {
+    lua_pushvalue(L, 3 + i);
+    lua_rawseti(L, -2, 2 + i);
+  }
+  lua_setfenv(L, -2);
+
+  uv_mutex_lock(&wrapper->mutex);
+  int taken = wrapper->cursor != NULL;
+  if (!taken) {
+    cur->wrapper = wrapper;
+    wrapper->cursor = cur;
+  }
+  uv_mutex_unlock(&wrapper->mutex);
+  if (taken) {
+    // The unattached cursor frees its copies when collected
+    lua_pushnil(L);
+    lua_pushstring(L, "connection has an open cursor");
+    return 2;
+  }
+  return 1;
+}
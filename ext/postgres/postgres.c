@@ -5,11 +5,18 @@
 #include <string.h>
 
 #include "co.h"
+#include "db_pool.h"
+#include "db_result.h"
+#include "executor.h"
 #include "trace.h"
 #include "lunet_mem.h"
+#include "rt.h"
+#include "stmt_cache.h"
 #include "uv.h"
 
+#define LUNET_PG_POOL_MT "lunet.pg.pool"
 #define LUNET_PG_CONN_MT "lunet.pg.conn"
+#define LUNET_PG_CURSOR_MT "lunet.pg.cursor"
 
 static char* lunet_strdup_local(const char* s) {
   if (!s) return NULL;
@@ -20,20 +27,89 @@ static char* lunet_strdup_local(const char* s) {
   return out;
 }
 
+typedef struct lunet_pg_cursor lunet_pg_cursor_t;
+
 typedef struct {
   PGconn* conn;
   uv_mutex_t mutex;
   int closed;
+  stmt_cache_t stmts;  // values are server-side statement names
+  unsigned long next_stmt_id;
+  lunet_pg_cursor_t* cursor;  // open db.cursor streaming on this connection
 } lunet_pg_conn_t;
 
+static void stmt_cache_deallocate(void* stmt, void* ud) {
+  lunet_pg_conn_t* wrapper = (lunet_pg_conn_t*)ud;
+  char* name = (char*)stmt;
+  if (wrapper->conn) {
+    char sql[64];
+    snprintf(sql, sizeof(sql), "DEALLOCATE %s", name);
+    PGresult* res = PQexec(wrapper->conn, sql);
+    if (res) PQclear(res);
+  }
+  lunet_free_nonnull(name);
+}
+
+// SQLSTATEs after which a named statement must be re-prepared:
+// 26000 invalid_sql_statement_name (e.g. DISCARD ALL), 0A000 "cached plan
+// must not change result type" after ALTER TABLE.
+static int stmt_is_stale(const PGresult* res) {
+  const char* state = res ? PQresultErrorField(res, PG_DIAG_SQLSTATE) : NULL;
+  return state && (strcmp(state, "26000") == 0 || strcmp(state, "0A000") == 0);
+}
+
+// Run a parameterised statement through the connection cache: the first call
+// PQprepare()s it under a per-connection name, later calls only PQexecPrepared()
+// so the server skips parse/plan. Caller holds wrapper->mutex.
+static PGresult* pg_exec_cached(lunet_pg_conn_t* wrapper, const char* sql, int nparams, const char* const* values) {
+  if (wrapper->stmts.cap == 0) {
+    return PQexecParams(wrapper->conn, sql, nparams, NULL, values, NULL, NULL, 0);
+  }
+  size_t len = strlen(sql);
+  for (int attempt = 0;; attempt++) {
+    const char* name = (const char*)stmt_cache_get(&wrapper->stmts, sql, len);
+    if (!name) {
+      char* fresh = lunet_alloc(32);
+      if (!fresh) {
+        return PQexecParams(wrapper->conn, sql, nparams, NULL, values, NULL, NULL, 0);
+      }
+      snprintf(fresh, 32, "lunet_s%lu", ++wrapper->next_stmt_id);
+      PGresult* prep = PQprepare(wrapper->conn, fresh, sql, 0, NULL);
+      if (PQresultStatus(prep) != PGRES_COMMAND_OK) {
+        lunet_free_nonnull(fresh);
+        return prep;
+      }
+      PQclear(prep);
+      if (stmt_cache_put(&wrapper->stmts, sql, len, fresh) != 0) {
+        PGresult* res = PQexecPrepared(wrapper->conn, fresh, nparams, values, NULL, NULL, 0);
+        stmt_cache_deallocate(fresh, wrapper);
+        return res;
+      }
+      name = fresh;
+    }
+    PGresult* res = PQexecPrepared(wrapper->conn, name, nparams, values, NULL, NULL, 0);
+    if (!stmt_is_stale(res)) return res;
+    stmt_cache_evict(&wrapper->stmts, sql, len);
+    // Re-prepare once. Inside a transaction the error has already aborted it,
+    // so a retry could only fail again; report the original error instead.
+    if (attempt > 0 || PQtransactionStatus(wrapper->conn) == PQTRANS_INERROR) return res;
+    PQclear(res);
+  }
+}
+
+static void cursor_detach(lunet_pg_conn_t* wrapper);
+
 // Close the PG connection but don't destroy the mutex (caller may still hold it)
 static void lunet_pg_conn_close(lunet_pg_conn_t* wrapper) {
   if (!wrapper || wrapper->closed) return;
   wrapper->closed = 1;
+  cursor_detach(wrapper);
   if (wrapper->conn) {
     PQfinish(wrapper->conn);
     wrapper->conn = NULL;
   }
+  // Server-side statements died with the session; this only frees the names
+  stmt_cache_clear(&wrapper->stmts);
 }
 
 // Full cleanup including mutex - only call when mutex is NOT held (e.g., from GC)
@@ -71,92 +147,76 @@ typedef struct {
     union {
         long long i;
         double d;
+        // Borrowed from the Lua string; see collect_params()
         struct {
-            char* data;
+            const char* data;
             size_t len;
         } s;
     } value;
 } param_t;
 
-static void free_params(param_t* params, int nparams) {
-    if (!params) return;
-    for (int i = 0; i < nparams; i++) {
-        if (params[i].type == PARAM_TYPE_TEXT) {
-            lunet_free_nonnull(params[i].value.s.data);
-        }
-    }
-    lunet_free_nonnull(params);
+// Requests with at most this many parameters keep them inside the ctx
+#define DB_INLINE_PARAMS 8
+
+static void free_params(param_t* params, const param_t* inline_buf) {
+    if (params && params != inline_buf) lunet_free_nonnull(params);
 }
 
-static param_t* collect_params(lua_State* L, int start, int* nparams) {
-    int top = lua_gettop(L);
-    *nparams = top - start + 1;
-    if (*nparams <= 0) {
-        *nparams = 0;
-        return NULL;
-    }
-    param_t* params = lunet_alloc(sizeof(param_t) * (*nparams));
-    if (!params) {
-        *nparams = -1;
-        return NULL;
-    }
-    for (int i = 0; i < *nparams; i++) {
+// Convert stack values [start, start + n) into out. Strings are not copied:
+// the caller keeps them reachable until the worker is done with them.
+static void fill_params(lua_State* L, int start, int n, param_t* out) {
+    for (int i = 0; i < n; i++) {
         int idx = start + i;
-        int type = lua_type(L, idx);
-        switch (type) {
-            case LUA_TNIL:
-                params[i].type = PARAM_TYPE_NIL;
-                break;
+        switch (lua_type(L, idx)) {
             case LUA_TNUMBER: {
-                lua_Number n = lua_tonumber(L, idx);
-                long long val = (long long)n;
-                if ((lua_Number)val == n) {
-                    params[i].type = PARAM_TYPE_INT;
-                    params[i].value.i = val;
+                lua_Number num = lua_tonumber(L, idx);
+                long long val = (long long)num;
+                if ((lua_Number)val == num) {
+                    out[i].type = PARAM_TYPE_INT;
+                    out[i].value.i = val;
                 } else {
-                    params[i].type = PARAM_TYPE_DOUBLE;
-                    params[i].value.d = n;
+                    out[i].type = PARAM_TYPE_DOUBLE;
+                    out[i].value.d = num;
                 }
                 break;
             }
             case LUA_TBOOLEAN:
-                params[i].type = PARAM_TYPE_INT;
-                params[i].value.i = lua_toboolean(L, idx);
+                out[i].type = PARAM_TYPE_INT;
+                out[i].value.i = lua_toboolean(L, idx);
                 break;
-            case LUA_TSTRING: {
-                size_t len;
-                const char* s = lua_tolstring(L, idx, &len);
-                params[i].type = PARAM_TYPE_TEXT;
-                params[i].value.s.data = lunet_alloc(len + 1);
-                if (!params[i].value.s.data) {
-                    free_params(params, i);
-                    *nparams = -1;
-                    return NULL;
-                }
-                memcpy(params[i].value.s.data, s, len);
-                params[i].value.s.data[len] = '\0';
-                params[i].value.s.len = len;
+            case LUA_TSTRING:
+                out[i].type = PARAM_TYPE_TEXT;
+                out[i].value.s.data = lua_tolstring(L, idx, &out[i].value.s.len);
                 break;
-            }
-            default: {
-                const char* s = lua_tostring(L, idx);
-                if (s) {
-                    size_t len = strlen(s);
-                    params[i].type = PARAM_TYPE_TEXT;
-                    params[i].value.s.data = lunet_strdup_local(s);
-                    if (!params[i].value.s.data) {
-                        free_params(params, i);
-                        *nparams = -1;
-                        return NULL;
-                    }
-                    params[i].value.s.len = len;
-                } else {
-                    params[i].type = PARAM_TYPE_NIL;
-                }
+            default:
+                out[i].type = PARAM_TYPE_NIL;
                 break;
-            }
         }
     }
+}
+
+/*
+ * Collect the call's arguments from start on. Up to DB_INLINE_PARAMS land in
+ * inline_buf, so the common case allocates nothing. String arguments stay on
+ * the calling coroutine's suspended frame, which co_ref keeps alive until the
+ * after callback, so their bytes are bound in place instead of copied.
+ */
+static param_t* collect_params(lua_State* L, int start, int* nparams, param_t* inline_buf) {
+    int top = lua_gettop(L);
+    *nparams = top - start + 1;
+    if (*nparams <= 0) {
+        *nparams = 0;
+        return NULL;
+    }
+    param_t* params = inline_buf;
+    if (!params || *nparams > DB_INLINE_PARAMS) {
+        params = lunet_alloc(sizeof(param_t) * (*nparams));
+        if (!params) {
+            *nparams = -1;
+            return NULL;
+        }
+    }
+    fill_params(L, start, *nparams, params);
     return params;
 }
 
@@ -169,6 +229,10 @@ typedef struct {
   char err[256];
 
   char conninfo[1024];
+  int stmt_cache;
+
+  db_pool_t* pool;  // set when opening a connection on behalf of db.pool
+  int pool_slot;
 } db_open_ctx_t;
 
 static void db_open_work_cb(uv_work_t* req) {
@@ -183,8 +247,40 @@ static void db_open_work_cb(uv_work_t* req) {
   }
 }
 
+static lunet_pg_conn_t* push_conn(lua_State* L, db_open_ctx_t* ctx) {
+  lunet_pg_conn_t* wrapper = (lunet_pg_conn_t*)lua_newuserdata(L, sizeof(lunet_pg_conn_t));
+  wrapper->conn = ctx->conn;
+  wrapper->closed = 0;
+  wrapper->next_stmt_id = 0;
+  stmt_cache_init(&wrapper->stmts, (size_t)ctx->stmt_cache, stmt_cache_deallocate, wrapper);
+  uv_mutex_init(&wrapper->mutex);
+  luaL_getmetatable(L, LUNET_PG_CONN_MT);
+  lua_setmetatable(L, -2);
+  return wrapper;
+}
+
+// Pool opens have no coroutine: the connection is pinned in the registry of
+// the pool's main state and handed to the next waiter
+static void pool_open_done(db_open_ctx_t* ctx) {
+  db_pool_t* pool = ctx->pool;
+  if (!ctx->conn) {
+    db_pool_opened(pool, ctx->pool_slot, NULL, LUA_NOREF, ctx->err);
+    lunet_free_nonnull(ctx);
+    return;
+  }
+  lunet_pg_conn_t* wrapper = push_conn(pool->L, ctx);
+  int ref;
+  lunet_coref_create_raw(pool->L, ref);
+  db_pool_opened(pool, ctx->pool_slot, wrapper, ref, NULL);
+  lunet_free_nonnull(ctx);
+}
+
 static void db_open_after_cb(uv_work_t* req, int status) {
   db_open_ctx_t* ctx = (db_open_ctx_t*)req->data;
+  if (ctx->pool) {
+    pool_open_done(ctx);
+    return;
+  }
   lua_State* L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -201,12 +297,7 @@ static void db_open_after_cb(uv_work_t* req, int status) {
   lua_pop(L, 1);
 
   if (ctx->conn) {
-    lunet_pg_conn_t* wrapper = (lunet_pg_conn_t*)lua_newuserdata(co, sizeof(lunet_pg_conn_t));
-    wrapper->conn = ctx->conn;
-    wrapper->closed = 0;
-    uv_mutex_init(&wrapper->mutex);
-    luaL_getmetatable(co, LUNET_PG_CONN_MT);
-    lua_setmetatable(co, -2);
+    push_conn(co, ctx);
     lua_pushnil(co);
   } else {
     lua_pushnil(co);
@@ -221,6 +312,58 @@ static void db_open_after_cb(uv_work_t* req, int status) {
   lunet_free_nonnull(ctx);
 }
 
+static void parse_open_params(lua_State* L, int idx, db_open_ctx_t* ctx) {
+  char host[256] = "localhost";
+  int port = 5432;
+  char user[256] = "";
+  char password[256] = "";
+  char database[256] = "";
+
+  lua_getfield(L, idx, "host");
+  if (lua_isstring(L, -1)) snprintf(host, sizeof(host), "%s", lua_tostring(L, -1));
+  lua_getfield(L, idx, "port");
+  if (lua_isnumber(L, -1)) port = lua_tointeger(L, -1);
+  lua_getfield(L, idx, "user");
+  if (lua_isstring(L, -1)) snprintf(user, sizeof(user), "%s", lua_tostring(L, -1));
+  lua_getfield(L, idx, "password");
+  if (lua_isstring(L, -1)) snprintf(password, sizeof(password), "%s", lua_tostring(L, -1));
+  lua_getfield(L, idx, "database");
+  if (lua_isstring(L, -1)) snprintf(database, sizeof(database), "%s", lua_tostring(L, -1));
+  lua_getfield(L, idx, "stmt_cache");
+  ctx->stmt_cache = (int)luaL_optinteger(L, -1, STMT_CACHE_DEFAULT_CAP);
+  if (ctx->stmt_cache < 0) ctx->stmt_cache = 0;
+  lua_pop(L, 6);
+
+  snprintf(ctx->conninfo, sizeof(ctx->conninfo),
+           "host='%s' port='%d' user='%s' password='%s' dbname='%s'",
+           host, port, user, password, database);
+}
+
+static int pool_open(db_pool_t* pool, int slot) {
+  db_open_ctx_t* ctx = lunet_alloc(sizeof(db_open_ctx_t));
+  if (!ctx) return UV_ENOMEM;
+  memcpy(ctx, pool->ud, sizeof(*ctx));
+  ctx->req.data = ctx;
+  ctx->pool = pool;
+  ctx->pool_slot = slot;
+  int ret = lunet_exec_queue(LUNET_EXEC_DB, &ctx->req, db_open_work_cb, db_open_after_cb);
+  if (ret < 0) lunet_free_nonnull(ctx);
+  return ret;
+}
+
+// Only idle or returned connections are discarded, so no request holds the
+// mutex; skip it because lua_close() may already have collected the wrapper
+static void pool_discard(db_pool_t* pool, void* conn, int ref) {
+  lunet_pg_conn_close((lunet_pg_conn_t*)conn);
+  lunet_coref_release(pool->L, ref);
+}
+
+static void pool_destroy(db_pool_t* pool) {
+  lunet_free(pool->ud);
+}
+
+static const db_pool_ops_t g_pool_ops = {pool_open, pool_discard, pool_destroy};
+
 int lunet_db_open(lua_State* L) {
   if (lunet_ensure_coroutine(L, "db.open")) {
     return lua_error(L);
@@ -238,42 +381,19 @@ int lunet_db_open(lua_State* L) {
     lua_pushstring(L, "db.open: out of memory");
     return lua_error(L);
   }
-  memset(ctx->err, 0, sizeof(ctx->err));
+  memset(ctx, 0, sizeof(*ctx));
   ctx->L = L;
   ctx->req.data = ctx;
-
-  char host[256] = "localhost";
-  int port = 5432;
-  char user[256] = "";
-  char password[256] = "";
-  char database[256] = "";
-
-  lua_getfield(L, 1, "host");
-  if (lua_isstring(L, -1)) snprintf(host, sizeof(host), "%s", lua_tostring(L, -1));
-  lua_getfield(L, 1, "port");
-  if (lua_isnumber(L, -1)) port = lua_tointeger(L, -1);
-  lua_getfield(L, 1, "user");
-  if (lua_isstring(L, -1)) snprintf(user, sizeof(user), "%s", lua_tostring(L, -1));
-  lua_getfield(L, 1, "password");
-  if (lua_isstring(L, -1)) snprintf(password, sizeof(password), "%s", lua_tostring(L, -1));
-  lua_getfield(L, 1, "database");
-  if (lua_isstring(L, -1)) snprintf(database, sizeof(database), "%s", lua_tostring(L, -1));
-  lua_pop(L, 5);
-
-  snprintf(ctx->conninfo, sizeof(ctx->conninfo),
-           "host='%s' port='%d' user='%s' password='%s' dbname='%s'",
-           host, port, user, password, database);
-  
-  /* printf("DEBUG: conninfo='%s'\n", ctx->conninfo); */
+  parse_open_params(L, 1, ctx);
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_open_work_cb, db_open_after_cb);
+  int ret = lunet_exec_queue(LUNET_EXEC_DB, &ctx->req, db_open_work_cb, db_open_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushfstring(L, "db.open: uv_queue_work failed: %s", uv_strerror(ret));
+    lua_pushfstring(L, "db.open: %s", lunet_exec_strerror(LUNET_EXEC_DB, ret));
     return lua_error(L);
   }
 
@@ -288,6 +408,12 @@ int lunet_db_close(lua_State* L) {
     lua_pushstring(L, "db.close requires a connection");
     return 1;
   }
+  db_pool_t* pool = db_pool_test(L, 1, LUNET_PG_POOL_MT);
+  if (pool) {
+    db_pool_close(pool);
+    lua_pushnil(L);
+    return 1;
+  }
   lunet_pg_conn_t* wrapper = (lunet_pg_conn_t*)luaL_testudata(L, 1, LUNET_PG_CONN_MT);
   if (!wrapper) {
     lua_pushstring(L, "db.close requires a valid connection");
@@ -302,22 +428,122 @@ int lunet_db_close(lua_State* L) {
   return 1;
 }
 
+int lunet_db_pool(lua_State* L) {
+  if (lua_gettop(L) < 1 || !lua_istable(L, 1)) {
+    lua_pushstring(L, "db.pool requires params table");
+    return lua_error(L);
+  }
+  register_conn_metatable(L);
+
+  int min, max, check_ms;
+  db_pool_parse_opts(L, 2, &min, &max, &check_ms);
+
+  db_open_ctx_t* tmpl = lunet_alloc(sizeof(db_open_ctx_t));
+  if (!tmpl) {
+    lua_pushstring(L, "db.pool: out of memory");
+    return lua_error(L);
+  }
+  memset(tmpl, 0, sizeof(*tmpl));
+  parse_open_params(L, 1, tmpl);
+
+  lua_State* mainL = default_luaL();
+  db_pool_t* pool = db_pool_create(mainL ? mainL : L, min, max, check_ms, &g_pool_ops, tmpl);
+  if (!pool) {
+    lunet_free_nonnull(tmpl);
+    lua_pushstring(L, "db.pool: out of memory");
+    return lua_error(L);
+  }
+  db_pool_push(L, pool, LUNET_PG_POOL_MT);
+  db_pool_fill(pool);
+  return 1;
+}
+
+int lunet_db_pool_stats(lua_State* L) {
+  db_pool_t* pool = db_pool_test(L, 1, LUNET_PG_POOL_MT);
+  if (!pool) {
+    lua_pushnil(L);
+    lua_pushstring(L, "db.pool_stats requires a pool");
+    return 2;
+  }
+  db_pool_push_stats(L, pool);
+  return 1;
+}
+
+// Accept either a connection or a db.pool handle as the first argument.
+// Pushes (nil, err) and returns 2 when neither is usable.
+static int resolve_target(lua_State* L, const char* fname, lunet_pg_conn_t** wrapper, db_pool_t** pool) {
+  *wrapper = (lunet_pg_conn_t*)luaL_testudata(L, 1, LUNET_PG_CONN_MT);
+  *pool = NULL;
+  if (!*wrapper) {
+    *pool = db_pool_test(L, 1, LUNET_PG_POOL_MT);
+    if (!*pool) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "%s requires a valid connection", fname);
+      return 2;
+    }
+    if ((*pool)->closed) {
+      lua_pushnil(L);
+      lua_pushstring(L, "pool is closed");
+      return 2;
+    }
+    return 0;
+  }
+  if ((*wrapper)->closed || !(*wrapper)->conn) {
+    lua_pushnil(L);
+    lua_pushstring(L, "connection is closed");
+    return 2;
+  }
+  return 0;
+}
+
+// A connection the client already knows is broken, or one idle past check_ms
+// that fails an empty-query round trip, is dropped and the request retried
+static int pool_checkout(db_pool_waiter_t* w, char* err, size_t errsize) {
+  lunet_pg_conn_t* wrapper = (lunet_pg_conn_t*)w->conn;
+  uv_mutex_lock(&wrapper->mutex);
+  int bad = wrapper->closed || !wrapper->conn || PQstatus(wrapper->conn) != CONNECTION_OK;
+  if (!bad && w->idle_ns >= w->pool->check_ns) {
+    PGresult* res = PQexec(wrapper->conn, "");
+    bad = PQresultStatus(res) != PGRES_EMPTY_QUERY;
+    if (res) PQclear(res);
+  }
+  uv_mutex_unlock(&wrapper->mutex);
+  if (!bad) return 0;
+  snprintf(err, errsize, "connection lost");
+  w->status = DB_POOL_STALE;
+  return 1;
+}
+
+// After a failed request, tell a server error from a dead connection
+static void pool_checkin(db_pool_waiter_t* w, const char* err) {
+  if (!err[0]) return;
+  lunet_pg_conn_t* wrapper = (lunet_pg_conn_t*)w->conn;
+  uv_mutex_lock(&wrapper->mutex);
+  if (wrapper->closed || !wrapper->conn || PQstatus(wrapper->conn) == CONNECTION_BAD) {
+    w->status = DB_POOL_LOST;
+  }
+  uv_mutex_unlock(&wrapper->mutex);
+}
+
 typedef struct {
   uv_work_t req;
   lua_State* L;
   int co_ref;
 
+  db_pool_waiter_t pw;
   lunet_pg_conn_t* wrapper;
   char* query;
   
   param_t* params;
   int nparams;
+  param_t inline_params[DB_INLINE_PARAMS];
 
   PGresult* result;
+  db_result_opts_t shape;
   char err[256];
 } db_query_ctx_t;
 
-static void db_query_work_cb(uv_work_t* req) {
+static void db_query_run(uv_work_t* req) {
   db_query_ctx_t* ctx = (db_query_ctx_t*)req->data;
 
   uv_mutex_lock(&ctx->wrapper->mutex);
@@ -327,6 +553,12 @@ static void db_query_work_cb(uv_work_t* req) {
     uv_mutex_unlock(&ctx->wrapper->mutex);
     return;
   }
+  // A single-row-mode cursor owns the connection until it is drained or closed
+  if (ctx->wrapper->cursor) {
+    snprintf(ctx->err, sizeof(ctx->err), "connection has an open cursor");
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
 
   if (ctx->nparams > 0) {
       const char **paramValues = lunet_calloc(ctx->nparams, sizeof(char*));
@@ -359,7 +591,7 @@ static void db_query_work_cb(uv_work_t* req) {
           }
       }
 
-      ctx->result = PQexecParams(ctx->wrapper->conn, ctx->query, ctx->nparams, NULL, (const char * const *)paramValues, NULL, NULL, 0);
+      ctx->result = pg_exec_cached(ctx->wrapper, ctx->query, ctx->nparams, (const char * const *)paramValues);
 
       for(int i=0; i<ctx->nparams; i++) if(should_free[i]) lunet_free_nonnull((void*)paramValues[i]);
       lunet_free_nonnull(paramValues);
@@ -380,8 +612,64 @@ static void db_query_work_cb(uv_work_t* req) {
   uv_mutex_unlock(&ctx->wrapper->mutex);
 }
 
+static void db_query_work_cb(uv_work_t* req) {
+  db_query_ctx_t* ctx = (db_query_ctx_t*)req->data;
+  if (ctx->pw.pool) {
+    ctx->wrapper = (lunet_pg_conn_t*)ctx->pw.conn;
+    if (pool_checkout(&ctx->pw, ctx->err, sizeof(ctx->err))) return;
+  }
+  db_query_run(req);
+  if (ctx->pw.pool) pool_checkin(&ctx->pw, ctx->err);
+}
+
+static db_col_kind_t pg_kind(const PGresult* res, int col) {
+  switch (PQftype(res, col)) {
+    case 21:   // INT2OID
+    case 23:   // INT4OID
+    case 20:   // INT8OID
+      return DB_COL_INT;
+    case 700:  // FLOAT4OID
+    case 701:  // FLOAT8OID
+    case 1700: // NUMERICOID
+      return DB_COL_FLOAT;
+    case 16:   // BOOLOID
+      return DB_COL_BOOL;
+    default:
+      return DB_COL_TEXT;
+  }
+}
+
+// db_result_push() view over one PGresult (db.query) ...
+static const char* res_name(void* ud, int col) {
+  return PQfname((const PGresult*)ud, col);
+}
+
+static db_col_kind_t res_kind(void* ud, int col) {
+  return pg_kind((const PGresult*)ud, col);
+}
+
+static const char* res_value(void* ud, int row, int col) {
+  const PGresult* res = (const PGresult*)ud;
+  return PQgetisnull(res, row, col) ? NULL : PQgetvalue(res, row, col);
+}
+
+// ... and over an array of single-row results (cursor:next)
+static const char* tuples_name(void* ud, int col) {
+  return PQfname(((PGresult**)ud)[0], col);
+}
+
+static db_col_kind_t tuples_kind(void* ud, int col) {
+  return pg_kind(((PGresult**)ud)[0], col);
+}
+
+static const char* tuples_value(void* ud, int row, int col) {
+  const PGresult* res = ((PGresult**)ud)[row];
+  return PQgetisnull(res, 0, col) ? NULL : PQgetvalue(res, 0, col);
+}
+
 static void db_query_after_cb(uv_work_t* req, int status) {
   db_query_ctx_t* ctx = (db_query_ctx_t*)req->data;
+  if (db_pool_release(&ctx->pw)) return;  // re-queued on a fresh pooled connection
   lua_State* L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -391,7 +679,7 @@ static void db_query_after_cb(uv_work_t* req, int status) {
     fprintf(stderr, "invalid coroutine in db.query\n");
     if (ctx->result) PQclear(ctx->result);
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     return;
   }
@@ -399,45 +687,8 @@ static void db_query_after_cb(uv_work_t* req, int status) {
   lua_pop(L, 1);
 
   if (ctx->result) {
-    lua_newtable(co);
-    int nrows = PQntuples(ctx->result);
-    int ncols = PQnfields(ctx->result);
-
-    for (int i = 0; i < nrows; i++) {
-      lua_newtable(co);
-      for (int j = 0; j < ncols; j++) {
-        const char* fname = PQfname(ctx->result, j);
-        lua_pushstring(co, fname);
-
-        if (PQgetisnull(ctx->result, i, j)) {
-          lua_pushnil(co);
-        } else {
-          const char* val = PQgetvalue(ctx->result, i, j);
-          Oid ftype = PQftype(ctx->result, j);
-
-          switch (ftype) {
-            case 21:   // INT2OID
-            case 23:   // INT4OID
-            case 20:   // INT8OID
-              lua_pushinteger(co, strtoll(val, NULL, 10));
-              break;
-            case 700:  // FLOAT4OID
-            case 701:  // FLOAT8OID
-            case 1700: // NUMERICOID
-              lua_pushnumber(co, strtod(val, NULL));
-              break;
-            case 16:   // BOOLOID
-              lua_pushboolean(co, val[0] == 't' || val[0] == 'T');
-              break;
-            default:
-              lua_pushstring(co, val);
-              break;
-          }
-        }
-        lua_settable(co, -3);
-      }
-      lua_rawseti(co, -2, i + 1);
-    }
+    db_result_t r = {PQntuples(ctx->result), PQnfields(ctx->result), ctx->result, res_name, res_kind, res_value};
+    db_result_push(co, &r, &ctx->shape);
 
     PQclear(ctx->result);
     ctx->result = NULL;
@@ -461,7 +712,7 @@ static void db_query_after_cb(uv_work_t* req, int status) {
   }
 
   lunet_free_nonnull(ctx->query);
-  free_params(ctx->params, ctx->nparams);
+  free_params(ctx->params, ctx->inline_params);
   lunet_free_nonnull(ctx);
 }
 
@@ -475,27 +726,28 @@ int lunet_db_query(lua_State* L) {
     return 2;
   }
 
-  lunet_pg_conn_t* wrapper = (lunet_pg_conn_t*)luaL_testudata(L, 1, LUNET_PG_CONN_MT);
-  if (!wrapper) {
-    lua_pushnil(L);
-    lua_pushstring(L, "db.query requires a valid connection");
+  lunet_pg_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.query", &wrapper, &pool)) {
     return 2;
   }
 
-  if (wrapper->closed || !wrapper->conn) {
+  const char* query = luaL_checkstring(L, 2);
+  db_result_opts_t shape;
+  const char* shape_err = db_result_parse_opts(L, 3, &shape);
+  if (shape_err) {
     lua_pushnil(L);
-    lua_pushstring(L, "connection is closed");
+    lua_pushfstring(L, "db.query: %s", shape_err);
     return 2;
   }
 
-  const char* query = luaL_checkstring(L, 2);
-
   db_query_ctx_t* ctx = lunet_alloc(sizeof(db_query_ctx_t));
   if (!ctx) {
     lua_pushstring(L, "out of memory");
     return lua_error(L);
   }
   memset(ctx, 0, sizeof(*ctx));
+  ctx->shape = shape;
   ctx->L = L;
   ctx->req.data = ctx;
   ctx->wrapper = wrapper;
@@ -507,7 +759,7 @@ int lunet_db_query(lua_State* L) {
     return 2;
   }
 
-  ctx->params = collect_params(L, 3, &ctx->nparams);
+  ctx->params = collect_params(L, 3, &ctx->nparams, ctx->inline_params);
   if (ctx->nparams < 0) {
     lunet_free_nonnull(ctx->query);
     lunet_free_nonnull(ctx);
@@ -518,14 +770,14 @@ int lunet_db_query(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_query_work_cb, db_query_after_cb);
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_query_work_cb, db_query_after_cb, ctx->err, sizeof(ctx->err));
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushstring(L, uv_strerror(ret));
+    lua_pushstring(L, db_pool_strerror(pool, ret));
     return 2;
   }
 
@@ -537,18 +789,20 @@ typedef struct {
   lua_State* L;
   int co_ref;
 
+  db_pool_waiter_t pw;
   lunet_pg_conn_t* wrapper;
   char* query;
   
   param_t* params;
   int nparams;
+  param_t inline_params[DB_INLINE_PARAMS];
 
   long long affected_rows;
   unsigned long long insert_id;
   char err[256];
 } db_exec_ctx_t;
 
-static void db_exec_work_cb(uv_work_t* req) {
+static void db_exec_run(uv_work_t* req) {
   db_exec_ctx_t* ctx = (db_exec_ctx_t*)req->data;
 
   uv_mutex_lock(&ctx->wrapper->mutex);
@@ -557,6 +811,11 @@ static void db_exec_work_cb(uv_work_t* req) {
     uv_mutex_unlock(&ctx->wrapper->mutex);
     return;
   }
+  if (ctx->wrapper->cursor) {
+    snprintf(ctx->err, sizeof(ctx->err), "connection has an open cursor");
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
 
   PGresult* result;
   if (ctx->nparams > 0) {
@@ -590,7 +849,7 @@ static void db_exec_work_cb(uv_work_t* req) {
           }
       }
 
-      result = PQexecParams(ctx->wrapper->conn, ctx->query, ctx->nparams, NULL, (const char * const *)paramValues, NULL, NULL, 0);
+      result = pg_exec_cached(ctx->wrapper, ctx->query, ctx->nparams, (const char * const *)paramValues);
 
       for(int i=0; i<ctx->nparams; i++) if(should_free[i]) lunet_free_nonnull((void*)paramValues[i]);
       lunet_free_nonnull(paramValues);
@@ -616,8 +875,19 @@ static void db_exec_work_cb(uv_work_t* req) {
   uv_mutex_unlock(&ctx->wrapper->mutex);
 }
 
+static void db_exec_work_cb(uv_work_t* req) {
+  db_exec_ctx_t* ctx = (db_exec_ctx_t*)req->data;
+  if (ctx->pw.pool) {
+    ctx->wrapper = (lunet_pg_conn_t*)ctx->pw.conn;
+    if (pool_checkout(&ctx->pw, ctx->err, sizeof(ctx->err))) return;
+  }
+  db_exec_run(req);
+  if (ctx->pw.pool) pool_checkin(&ctx->pw, ctx->err);
+}
+
 static void db_exec_after_cb(uv_work_t* req, int status) {
   db_exec_ctx_t* ctx = (db_exec_ctx_t*)req->data;
+  if (db_pool_release(&ctx->pw)) return;  // re-queued on a fresh pooled connection
   lua_State* L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -626,7 +896,7 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
     lua_pop(L, 1);
     fprintf(stderr, "invalid coroutine in db.exec\n");
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     return;
   }
@@ -660,7 +930,7 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
   }
 
   lunet_free_nonnull(ctx->query);
-  free_params(ctx->params, ctx->nparams);
+  free_params(ctx->params, ctx->inline_params);
   lunet_free_nonnull(ctx);
 }
 
@@ -673,16 +943,9 @@ int lunet_db_exec(lua_State* L) {
     lua_pushstring(L, "db.exec requires connection and sql string");
     return 2;
   }
-  lunet_pg_conn_t* wrapper = (lunet_pg_conn_t*)luaL_testudata(L, 1, LUNET_PG_CONN_MT);
-  if (!wrapper) {
-    lua_pushnil(L);
-    lua_pushstring(L, "db.exec requires a valid connection");
-    return 2;
-  }
-
-  if (wrapper->closed || !wrapper->conn) {
-    lua_pushnil(L);
-    lua_pushstring(L, "connection is closed");
+  lunet_pg_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.exec", &wrapper, &pool)) {
     return 2;
   }
 
@@ -706,7 +969,7 @@ int lunet_db_exec(lua_State* L) {
     return 2;
   }
 
-  ctx->params = collect_params(L, 3, &ctx->nparams);
+  ctx->params = collect_params(L, 3, &ctx->nparams, ctx->inline_params);
   if (ctx->nparams < 0) {
     lunet_free_nonnull(ctx->query);
     lunet_free_nonnull(ctx);
@@ -717,14 +980,14 @@ int lunet_db_exec(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_exec_work_cb, db_exec_after_cb, ctx->err, sizeof(ctx->err));
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushstring(L, uv_strerror(ret));
+    lua_pushstring(L, db_pool_strerror(pool, ret));
     return 2;
   }
 
@@ -758,6 +1021,24 @@ int lunet_db_escape(lua_State* L) {
   return 1;
 }
 
+int lunet_db_stmt_cache_stats(lua_State* L) {
+  lunet_pg_conn_t* wrapper = (lunet_pg_conn_t*)luaL_testudata(L, 1, LUNET_PG_CONN_MT);
+  if (!wrapper) {
+    lua_pushnil(L);
+    lua_pushstring(L, "db.stmt_cache_stats requires a valid connection");
+    return 2;
+  }
+  uv_mutex_lock(&wrapper->mutex);
+  stmt_cache_push_stats(L, &wrapper->stmts);
+  uv_mutex_unlock(&wrapper->mutex);
+  return 1;
+}
+
+int lunet_db_executor_stats(lua_State* L) {
+  lunet_exec_push_stats(L, LUNET_EXEC_DB);
+  return 1;
+}
+
 int lunet_db_query_params(lua_State* L) {
   if (lunet_ensure_coroutine(L, "db.query_params")) {
     return lua_error(L);
@@ -768,27 +1049,28 @@ int lunet_db_query_params(lua_State* L) {
     return 2;
   }
 
-  lunet_pg_conn_t* wrapper = (lunet_pg_conn_t*)luaL_testudata(L, 1, LUNET_PG_CONN_MT);
-  if (!wrapper) {
-    lua_pushnil(L);
-    lua_pushstring(L, "db.query_params requires a valid connection");
+  lunet_pg_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.query_params", &wrapper, &pool)) {
     return 2;
   }
 
-  if (wrapper->closed || !wrapper->conn) {
+  const char* query = luaL_checkstring(L, 2);
+  db_result_opts_t shape;
+  const char* shape_err = db_result_parse_opts(L, 3, &shape);
+  if (shape_err) {
     lua_pushnil(L);
-    lua_pushstring(L, "connection is closed");
+    lua_pushfstring(L, "db.query_params: %s", shape_err);
     return 2;
   }
 
-  const char* query = luaL_checkstring(L, 2);
-
   db_query_ctx_t* ctx = lunet_alloc(sizeof(db_query_ctx_t));
   if (!ctx) {
     lua_pushstring(L, "out of memory");
     return lua_error(L);
   }
   memset(ctx, 0, sizeof(*ctx));
+  ctx->shape = shape;
   ctx->L = L;
   ctx->req.data = ctx;
   ctx->wrapper = wrapper;
@@ -800,7 +1082,7 @@ int lunet_db_query_params(lua_State* L) {
     return 2;
   }
 
-  ctx->params = collect_params(L, 3, &ctx->nparams);
+  ctx->params = collect_params(L, 3, &ctx->nparams, ctx->inline_params);
   if (ctx->nparams < 0) {
     lunet_free_nonnull(ctx->query);
     lunet_free_nonnull(ctx);
@@ -811,14 +1093,14 @@ int lunet_db_query_params(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_query_work_cb, db_query_after_cb);
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_query_work_cb, db_query_after_cb, ctx->err, sizeof(ctx->err));
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushstring(L, uv_strerror(ret));
+    lua_pushstring(L, db_pool_strerror(pool, ret));
     return 2;
   }
 
@@ -835,16 +1117,9 @@ int lunet_db_exec_params(lua_State* L) {
     return 2;
   }
 
-  lunet_pg_conn_t* wrapper = (lunet_pg_conn_t*)luaL_testudata(L, 1, LUNET_PG_CONN_MT);
-  if (!wrapper) {
-    lua_pushnil(L);
-    lua_pushstring(L, "db.exec_params requires a valid connection");
-    return 2;
-  }
-
-  if (wrapper->closed || !wrapper->conn) {
-    lua_pushnil(L);
-    lua_pushstring(L, "connection is closed");
+  lunet_pg_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.exec_params", &wrapper, &pool)) {
     return 2;
   }
 
@@ -868,7 +1143,7 @@ int lunet_db_exec_params(lua_State* L) {
     return 2;
   }
 
-  ctx->params = collect_params(L, 3, &ctx->nparams);
+  ctx->params = collect_params(L, 3, &ctx->nparams, ctx->inline_params);
   if (ctx->nparams < 0) {
     lunet_free_nonnull(ctx->query);
     lunet_free_nonnull(ctx);
@@ -879,16 +1154,765 @@ int lunet_db_exec_params(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_exec_work_cb, db_exec_after_cb, ctx->err, sizeof(ctx->err));
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushstring(L, uv_strerror(ret));
+    lua_pushstring(L, db_pool_strerror(pool, ret));
     return 2;
   }
 
   return lua_yield(L, 0);
 }
+
+/*
+ * Batched execution (db.exec_batch)
+ *
+ * Every parameter tuple runs inside one executor job on one connection, with
+ * the statement prepared once: a bulk insert costs one hop and one mutex
+ * acquire instead of one per row.
+ *
+ * PostgreSQL sends the tuples in pipeline mode, a few hundred per sync, so
+ * the whole batch costs a handful of round trips. It runs in one transaction
+ * unless one is already open; the first failing tuple rolls it back.
+ */
+
+typedef struct {
+  uv_work_t req;
+  lua_State* L;
+  int co_ref;
+
+  db_pool_waiter_t pw;
+  lunet_pg_conn_t* wrapper;
+  char* query;
+
+  param_t* params;     // nrows tuples of width params, row-major
+  int nrows;
+  int width;
+  int pin_ref;         // table holding the borrowed strings, or LUA_NOREF
+  long long* counts;   // affected rows per tuple
+  long long affected_rows;
+  unsigned long long insert_id;
+  char err[256];
+} db_batch_ctx_t;
+
+static void free_batch(db_batch_ctx_t* ctx) {
+  free_params(ctx->params, NULL);
+  if (ctx->pin_ref != LUA_NOREF) lunet_coref_release(ctx->L, ctx->pin_ref);
+  if (ctx->counts) lunet_free_nonnull(ctx->counts);
+  lunet_free_nonnull(ctx->query);
+  lunet_free_nonnull(ctx);
+}
+
+// Copy the rows table at idx into ctx. Tuples shorter than the widest one
+// are padded with NULLs. Returns NULL or an error message.
+static const char* collect_batch(lua_State* L, int idx, db_batch_ctx_t* ctx) {
+  int nrows = (int)lua_objlen(L, idx);
+  int width = 0;
+  for (int i = 1; i <= nrows; i++) {
+    lua_rawgeti(L, idx, i);
+    if (!lua_istable(L, -1)) {
+      lua_pop(L, 1);
+      return "rows must be an array of parameter arrays";
+    }
+    int n = (int)lua_objlen(L, -1);
+    if (n > width) width = n;
+    lua_pop(L, 1);
+  }
+  if (nrows == 0) return NULL;
+  if (!lua_checkstack(L, width + 3)) return "too many parameters per row";
+
+  ctx->counts = lunet_calloc((size_t)nrows, sizeof(long long));
+  if (width > 0) ctx->params = lunet_alloc(sizeof(param_t) * (size_t)nrows * (size_t)width);
+  if (!ctx->counts || (width > 0 && !ctx->params)) return "out of memory";
+  ctx->width = width;
+  // Other coroutines may rewrite the tuples while the batch runs, so the
+  // strings are pinned on their own rather than through the rows table
+  lua_newtable(L);
+  int pin = lua_gettop(L);
+  int npinned = 0;
+  for (int i = 0; i < nrows; i++) {
+    lua_rawgeti(L, idx, i + 1);
+    int base = lua_gettop(L);
+    for (int j = 1; j <= width; j++) {
+      lua_rawgeti(L, base, j);
+      if (lua_type(L, -1) == LUA_TSTRING) {
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, pin, ++npinned);
+      }
+    }
+    fill_params(L, base + 1, width, ctx->params + (size_t)i * width);
+    lua_settop(L, base - 1);
+  }
+  if (npinned > 0) {
+    lunet_coref_create_raw(L, ctx->pin_ref);
+  } else {
+    lua_pop(L, 1);
+  }
+  ctx->nrows = nrows;
+  return NULL;
+}
+
+#define DB_BATCH_PIPELINE_CHUNK 256
+
+// Prefix the row number to the error so a failing tuple can be located
+static void batch_fail(db_batch_ctx_t* ctx, int row, const char* msg) {
+  if (ctx->err[0] != '\0') return;  // keep the first failure
+  char tmp[sizeof(ctx->err)];
+  snprintf(tmp, sizeof(tmp), "%s", msg);
+  snprintf(ctx->err, sizeof(ctx->err), "row %d: %s", row + 1, tmp);
+}
+
+// Text form of one tuple; bufs holds the int/double renderings
+static void batch_values(const param_t* params, int n, const char** values, char (*bufs)[64]) {
+  for (int i = 0; i < n; i++) {
+    const param_t* p = &params[i];
+    if (p->type == PARAM_TYPE_INT) {
+      snprintf(bufs[i], sizeof(bufs[i]), "%lld", p->value.i);
+      values[i] = bufs[i];
+    } else if (p->type == PARAM_TYPE_DOUBLE) {
+      snprintf(bufs[i], sizeof(bufs[i]), "%g", p->value.d);
+      values[i] = bufs[i];
+    } else if (p->type == PARAM_TYPE_TEXT) {
+      values[i] = p->value.s.data;
+    } else {
+      values[i] = NULL;
+    }
+  }
+}
+
+static void batch_result(db_batch_ctx_t* ctx, int row, PGresult* res) {
+  ExecStatusType st = PQresultStatus(res);
+  if (st == PGRES_COMMAND_OK || st == PGRES_TUPLES_OK) {
+    const char* affected = PQcmdTuples(res);
+    ctx->counts[row] = affected[0] ? strtoll(affected, NULL, 10) : 0;
+    ctx->affected_rows += ctx->counts[row];
+    if (PQoidValue(res) != InvalidOid) ctx->insert_id = (unsigned long long)PQoidValue(res);
+  } else if (st != PGRES_PIPELINE_ABORTED) {
+    batch_fail(ctx, row, PQresultErrorMessage(res));
+  }
+}
+
+#ifdef LIBPQ_HAS_PIPELINING
+// Send tuples [first, last) and a sync, then read their results. Chunking
+// bounds how much either side buffers before the other reads.
+static void batch_pipeline_chunk(db_batch_ctx_t* ctx, PGconn* conn, int first, int last,
+                                 const char** values, char (*bufs)[64]) {
+  int sent = first;
+  for (; sent < last; sent++) {
+    batch_values(ctx->params + (size_t)sent * ctx->width, ctx->width, values, bufs);
+    if (!PQsendQueryPrepared(conn, "", ctx->width, values, NULL, NULL, 0)) {
+      batch_fail(ctx, sent, PQerrorMessage(conn));
+      break;
+    }
+  }
+  if (!PQpipelineSync(conn)) {
+    batch_fail(ctx, sent, PQerrorMessage(conn));
+    return;
+  }
+  for (int i = first; i < sent; i++) {
+    PGresult* res = PQgetResult(conn);
+    if (!res) {
+      batch_fail(ctx, i, PQerrorMessage(conn));
+      return;
+    }
+    batch_result(ctx, i, res);
+    PQclear(res);
+    while ((res = PQgetResult(conn)) != NULL) PQclear(res);  // end of this query
+  }
+  PGresult* res = PQgetResult(conn);  // PGRES_PIPELINE_SYNC
+  if (res) PQclear(res);
+}
+#endif
+
+static void db_batch_run(uv_work_t* req) {
+  db_batch_ctx_t* ctx = (db_batch_ctx_t*)req->data;
+
+  uv_mutex_lock(&ctx->wrapper->mutex);
+  if (ctx->wrapper->closed || !ctx->wrapper->conn) {
+    snprintf(ctx->err, sizeof(ctx->err), "connection is closed");
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+  if (ctx->wrapper->cursor) {
+    snprintf(ctx->err, sizeof(ctx->err), "connection has an open cursor");
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+  PGconn* conn = ctx->wrapper->conn;
+
+  const char** values = NULL;
+  char (*bufs)[64] = NULL;
+  if (ctx->width > 0) {
+    values = lunet_calloc((size_t)ctx->width, sizeof(char*));
+    bufs = lunet_calloc((size_t)ctx->width, sizeof(*bufs));
+    if (!values || !bufs) {
+      snprintf(ctx->err, sizeof(ctx->err), "out of memory");
+      if (values) lunet_free(values);
+      if (bufs) lunet_free(bufs);
+      uv_mutex_unlock(&ctx->wrapper->mutex);
+      return;
+    }
+  }
+
+  // One transaction for the whole batch unless the caller already opened one
+  int own_txn = PQtransactionStatus(conn) == PQTRANS_IDLE;
+  PGresult* res = NULL;
+  if (own_txn) {
+    res = PQexec(conn, "BEGIN");
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+      snprintf(ctx->err, sizeof(ctx->err), "%s", PQerrorMessage(conn));
+      own_txn = 0;
+    }
+    PQclear(res);
+  }
+  if (ctx->err[0] == '\0') {
+    // The unnamed statement is replaced by the next one and never cached
+    res = PQprepare(conn, "", ctx->query, 0, NULL);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+      snprintf(ctx->err, sizeof(ctx->err), "%s", PQerrorMessage(conn));
+    }
+    PQclear(res);
+  }
+
+  if (ctx->err[0] == '\0') {
+#ifdef LIBPQ_HAS_PIPELINING
+    if (PQenterPipelineMode(conn)) {
+      for (int first = 0; first < ctx->nrows && ctx->err[0] == '\0'; first += DB_BATCH_PIPELINE_CHUNK) {
+        int last = first + DB_BATCH_PIPELINE_CHUNK;
+        if (last > ctx->nrows) last = ctx->nrows;
+        batch_pipeline_chunk(ctx, conn, first, last, values, bufs);
+      }
+      PQexitPipelineMode(conn);
+    } else
+#endif
+    {
+      for (int i = 0; i < ctx->nrows && ctx->err[0] == '\0'; i++) {
+        batch_values(ctx->params + (size_t)i * ctx->width, ctx->width, values, bufs);
+        res = PQexecPrepared(conn, "", ctx->width, values, NULL, NULL, 0);
+        batch_result(ctx, i, res);
+        PQclear(res);
+      }
+    }
+  }
+
+  if (own_txn) {
+    int failed = ctx->err[0] != '\0';
+    res = PQexec(conn, failed ? "ROLLBACK" : "COMMIT");
+    if (!failed && PQresultStatus(res) != PGRES_COMMAND_OK) {
+      snprintf(ctx->err, sizeof(ctx->err), "%s", PQerrorMessage(conn));
+    }
+    PQclear(res);
+  }
+  if (values) lunet_free(values);
+  if (bufs) lunet_free(bufs);
+  uv_mutex_unlock(&ctx->wrapper->mutex);
+}
+
+static void db_batch_work_cb(uv_work_t* req) {
+  db_batch_ctx_t* ctx = (db_batch_ctx_t*)req->data;
+  if (ctx->pw.pool) {
+    ctx->wrapper = (lunet_pg_conn_t*)ctx->pw.conn;
+    if (pool_checkout(&ctx->pw, ctx->err, sizeof(ctx->err))) return;
+  }
+  db_batch_run(req);
+  if (ctx->pw.pool) pool_checkin(&ctx->pw, ctx->err);
+}
+
+static void db_batch_after_cb(uv_work_t* req, int status) {
+  db_batch_ctx_t* ctx = (db_batch_ctx_t*)req->data;
+  if (db_pool_release(&ctx->pw)) return;  // re-queued on a fresh pooled connection
+  lua_State* L = ctx->L;
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
+  lunet_coref_release(L, ctx->co_ref);
+  if (!lua_isthread(L, -1)) {
+    lua_pop(L, 1);
+    fprintf(stderr, "invalid coroutine in db.exec_batch\n");
+    free_batch(ctx);
+    return;
+  }
+  lua_State* co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+
+  if (ctx->err[0] != '\0') {
+    lua_pushnil(co);
+    lua_pushstring(co, ctx->err);
+  } else {
+    lua_createtable(co, 0, 3);
+    lua_pushinteger(co, ctx->affected_rows);
+    lua_setfield(co, -2, "affected_rows");
+    lua_pushinteger(co, ctx->insert_id);
+    lua_setfield(co, -2, "last_insert_id");
+    lua_createtable(co, ctx->nrows, 0);
+    for (int i = 0; i < ctx->nrows; i++) {
+      lua_pushinteger(co, ctx->counts[i]);
+      lua_rawseti(co, -2, i + 1);
+    }
+    lua_setfield(co, -2, "counts");
+    lua_pushnil(co);
+  }
+  int rc = lunet_co_resume(co, 2);
+  if (rc != 0 && rc != LUA_YIELD) {
+    const char* err = lua_tostring(co, -1);
+    if (err) fprintf(stderr, "lua_resume error in db.exec_batch: %s\n", err);
+    lua_pop(co, 1);
+  }
+
+  free_batch(ctx);
+}
+
+// db.exec_batch(conn, sql, {{...}, {...}}) -> {affected_rows, last_insert_id, counts} | nil, err
+int lunet_db_exec_batch(lua_State* L) {
+  if (lunet_ensure_coroutine(L, "db.exec_batch")) {
+    return lua_error(L);
+  }
+  if (lua_gettop(L) < 3 || !lua_istable(L, 3)) {
+    lua_pushnil(L);
+    lua_pushstring(L, "db.exec_batch requires connection, sql string and rows table");
+    return 2;
+  }
+
+  lunet_pg_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.exec_batch", &wrapper, &pool)) {
+    return 2;
+  }
+
+  const char* query = luaL_checkstring(L, 2);
+
+  db_batch_ctx_t* ctx = lunet_alloc(sizeof(db_batch_ctx_t));
+  if (!ctx) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->L = L;
+  ctx->req.data = ctx;
+  ctx->wrapper = wrapper;
+  ctx->pin_ref = LUA_NOREF;
+  ctx->query = lunet_strdup_local(query);
+  if (!ctx->query) {
+    lunet_free_nonnull(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+
+  const char* err = collect_batch(L, 3, ctx);
+  if (err) {
+    free_batch(ctx);
+    lua_pushnil(L);
+    lua_pushfstring(L, "db.exec_batch: %s", err);
+    return 2;
+  }
+
+  lunet_coref_create(L, ctx->co_ref);
+
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_batch_work_cb, db_batch_after_cb, ctx->err, sizeof(ctx->err));
+  if (ret < 0) {
+    lunet_coref_release(L, ctx->co_ref);
+    free_batch(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, db_pool_strerror(pool, ret));
+    return 2;
+  }
+
+  return lua_yield(L, 0);
+}
+
+/*
+ * Cursors (db.cursor)
+ *
+ * The query is sent with PQsendQueryParams() in single-row mode, so libpq
+ * hands back one PGresult per row instead of buffering the whole set, and
+ * cursor:next() collects at most batch_size of them per hop. The connection
+ * is busy until the result is drained; other queries on it fail meanwhile.
+ * Closing early cancels the query on the server and discards what is left.
+ */
+
+#define DB_CURSOR_DEFAULT_BATCH 100
+#define DB_CURSOR_MAX_BATCH 10000
+
+struct lunet_pg_cursor {
+  lunet_pg_conn_t* wrapper;  // NULL once exhausted, closed or detached
+  char* query;
+  param_t* params;
+  int nparams;
+  int started;
+  int done;
+  int busy;                  // a fetch or close is in flight (loop thread only)
+};
+
+static void cursor_drain(PGconn* conn) {
+  PGresult* res;
+  while ((res = PQgetResult(conn)) != NULL) PQclear(res);
+}
+
+// Caller holds wrapper->mutex
+static void cursor_finish(lunet_pg_cursor_t* cur) {
+  lunet_pg_conn_t* wrapper = cur->wrapper;
+  if (!wrapper) return;
+  if (cur->started && !cur->done && wrapper->conn) {
+    PGcancel* cancel = PQgetCancel(wrapper->conn);
+    if (cancel) {
+      char errbuf[256];
+      PQcancel(cancel, errbuf, sizeof(errbuf));
+      PQfreeCancel(cancel);
+    }
+    cursor_drain(wrapper->conn);
+  }
+  wrapper->cursor = NULL;
+  cur->wrapper = NULL;
+}
+
+// PQfinish() follows and drops whatever is still in flight
+static void cursor_detach(lunet_pg_conn_t* wrapper) {
+  if (!wrapper->cursor) return;
+  wrapper->cursor->wrapper = NULL;
+  wrapper->cursor = NULL;
+}
+
+static void cursor_free_fields(lunet_pg_cursor_t* cur) {
+  if (cur->query) lunet_free(cur->query);
+  free_params(cur->params, NULL);
+  cur->params = NULL;
+  cur->nparams = 0;
+}
+
+// Only reached once no fetch is in flight: a busy cursor is on its coroutine's
+// stack. Cancelling an abandoned query blocks, so close cursors explicitly.
+static int cursor_gc(lua_State* L) {
+  lunet_pg_cursor_t* cur = (lunet_pg_cursor_t*)luaL_checkudata(L, 1, LUNET_PG_CURSOR_MT);
+  if (cur->wrapper) {
+    lunet_pg_conn_t* wrapper = cur->wrapper;
+    uv_mutex_lock(&wrapper->mutex);
+    cursor_finish(cur);
+    uv_mutex_unlock(&wrapper->mutex);
+  }
+  cursor_free_fields(cur);
+  return 0;
+}
+
+typedef struct {
+  uv_work_t req;
+  lua_State* L;
+  int co_ref;
+
+  lunet_pg_cursor_t* cursor;
+  lunet_pg_conn_t* wrapper;
+  int limit;           // 0 closes the cursor
+  PGresult** results;  // one PGRES_SINGLE_TUPLE result per row
+  int nresults;
+  char err[256];
+} db_cursor_ctx_t;
+
+// Caller holds wrapper->mutex
+static int cursor_start(lunet_pg_cursor_t* cur, char* err, size_t errsize) {
+  PGconn* conn = cur->wrapper->conn;
+  const char** values = NULL;
+  char (*bufs)[64] = NULL;
+  if (cur->nparams > 0) {
+    values = lunet_calloc((size_t)cur->nparams, sizeof(char*));
+    bufs = lunet_calloc((size_t)cur->nparams, sizeof(*bufs));
+    if (!values || !bufs) {
+      if (values) lunet_free(values);
+      if (bufs) lunet_free(bufs);
+      snprintf(err, errsize, "out of memory");
+      return -1;
+    }
+    for (int i = 0; i < cur->nparams; i++) {
+      param_t* p = &cur->params[i];
+      if (p->type == PARAM_TYPE_INT) {
+        snprintf(bufs[i], sizeof(bufs[i]), "%lld", p->value.i);
+        values[i] = bufs[i];
+      } else if (p->type == PARAM_TYPE_DOUBLE) {
+        snprintf(bufs[i], sizeof(bufs[i]), "%g", p->value.d);
+        values[i] = bufs[i];
+      } else if (p->type == PARAM_TYPE_TEXT) {
+        values[i] = p->value.s.data;
+      }
+    }
+  }
+  int sent = PQsendQueryParams(conn, cur->query, cur->nparams, NULL, values, NULL, NULL, 0);
+  if (values) lunet_free(values);
+  if (bufs) lunet_free(bufs);
+  free_params(cur->params, NULL);
+  cur->params = NULL;
+  cur->nparams = 0;
+  if (!sent) {
+    snprintf(err, errsize, "%s", PQerrorMessage(conn));
+    return -1;
+  }
+  cur->started = 1;
+  if (!PQsetSingleRowMode(conn)) {
+    snprintf(err, errsize, "PQsetSingleRowMode failed");
+    return -1;
+  }
+  return 0;
+}
+
+static void db_cursor_work_cb(uv_work_t* req) {
+  db_cursor_ctx_t* ctx = (db_cursor_ctx_t*)req->data;
+  lunet_pg_cursor_t* cur = ctx->cursor;
+
+  uv_mutex_lock(&ctx->wrapper->mutex);
+  if (!cur->wrapper || ctx->wrapper->closed || !ctx->wrapper->conn) {
+    if (ctx->limit > 0) snprintf(ctx->err, sizeof(ctx->err), "connection is closed");
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+  if (ctx->limit == 0) {
+    cursor_finish(cur);
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+  if (!cur->started && cursor_start(cur, ctx->err, sizeof(ctx->err)) != 0) {
+    cursor_finish(cur);
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+
+  PGconn* conn = ctx->wrapper->conn;
+  ctx->results = lunet_alloc(sizeof(PGresult*) * (size_t)ctx->limit);
+  if (!ctx->results) {
+    snprintf(ctx->err, sizeof(ctx->err), "out of memory");
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+  while (ctx->nresults < ctx->limit) {
+    PGresult* res = PQgetResult(conn);
+    if (!res) {
+      cur->done = 1;
+      break;
+    }
+    ExecStatusType st = PQresultStatus(res);
+    if (st == PGRES_SINGLE_TUPLE) {
+      ctx->results[ctx->nresults++] = res;
+      continue;
+    }
+    if (st == PGRES_TUPLES_OK || st == PGRES_COMMAND_OK) {
+      // End of the set: what remains is only the terminating NULL
+      PQclear(res);
+      cursor_drain(conn);
+      cur->done = 1;
+      break;
+    }
+    snprintf(ctx->err, sizeof(ctx->err), "%s", PQresultErrorMessage(res));
+    PQclear(res);
+    cursor_drain(conn);
+    cur->done = 1;
+    break;
+  }
+  // An exhausted or failed cursor hands the connection back right away
+  if (cur->done) cursor_finish(cur);
+  uv_mutex_unlock(&ctx->wrapper->mutex);
+}
+
+static void db_cursor_after_cb(uv_work_t* req, int status) {
+  db_cursor_ctx_t* ctx = (db_cursor_ctx_t*)req->data;
+  lua_State* L = ctx->L;
+  const char* fname = ctx->limit > 0 ? "cursor:next" : "cursor:close";
+  ctx->cursor->busy = 0;
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
+  lunet_coref_release(L, ctx->co_ref);
+  if (!lua_isthread(L, -1)) {
+    lua_pop(L, 1);
+    fprintf(stderr, "invalid coroutine in %s\n", fname);
+    goto cleanup;
+  }
+  lua_State* co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+
+  if (ctx->err[0] != '\0') {
+    lua_pushnil(co);
+    lua_pushstring(co, ctx->err);
+  } else if (ctx->limit > 0) {
+    if (ctx->nresults > 0) {
+      db_result_t r = {ctx->nresults, PQnfields(ctx->results[0]), ctx->results, tuples_name, tuples_kind, tuples_value};
+      db_result_push(co, &r, NULL);
+    } else {
+      lua_newtable(co);
+    }
+    lua_pushnil(co);
+  } else {
+    lua_pushnil(co);
+    lua_pushnil(co);
+  }
+  {
+    int rc = lunet_co_resume(co, 2);
+    if (rc != 0 && rc != LUA_YIELD) {
+      const char* err = lua_tostring(co, -1);
+      if (err) fprintf(stderr, "lua_resume error in %s: %s\n", fname, err);
+      lua_pop(co, 1);
+    }
+  }
+
+cleanup:
+  for (int i = 0; i < ctx->nresults; i++) PQclear(ctx->results[i]);
+  if (ctx->results) lunet_free(ctx->results);
+  lunet_free_nonnull(ctx);
+}
+
+// Queue a fetch of up to limit rows, or a close when limit is 0
+static int cursor_queue(lua_State* L, lunet_pg_cursor_t* cur, int limit) {
+  db_cursor_ctx_t* ctx = lunet_alloc(sizeof(db_cursor_ctx_t));
+  if (!ctx) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->L = L;
+  ctx->req.data = ctx;
+  ctx->cursor = cur;
+  ctx->wrapper = cur->wrapper;
+  ctx->limit = limit;
+
+  lunet_coref_create(L, ctx->co_ref);
+  int ret = lunet_exec_queue(LUNET_EXEC_DB, &ctx->req, db_cursor_work_cb, db_cursor_after_cb);
+  if (ret < 0) {
+    lunet_coref_release(L, ctx->co_ref);
+    lunet_free_nonnull(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, lunet_exec_strerror(LUNET_EXEC_DB, ret));
+    return 2;
+  }
+  cur->busy = 1;
+  return lua_yield(L, 0);
+}
+
+// cursor:next([batch_size]) -> rows (empty once exhausted) | nil, err
+static int cursor_next(lua_State* L) {
+  if (lunet_ensure_coroutine(L, "cursor:next")) {
+    return lua_error(L);
+  }
+  lunet_pg_cursor_t* cur = (lunet_pg_cursor_t*)luaL_checkudata(L, 1, LUNET_PG_CURSOR_MT);
+  lua_Integer n = luaL_optinteger(L, 2, DB_CURSOR_DEFAULT_BATCH);
+  if (n < 1) n = 1;
+  if (n > DB_CURSOR_MAX_BATCH) n = DB_CURSOR_MAX_BATCH;
+  // The worker owns the cursor state while a request is in flight
+  if (cur->busy) {
+    lua_pushnil(L);
+    lua_pushstring(L, "cursor:next: cursor is busy");
+    return 2;
+  }
+  if (cur->done) {
+    lua_newtable(L);
+    return 1;
+  }
+  if (!cur->wrapper) {
+    lua_pushnil(L);
+    lua_pushstring(L, "cursor is closed");
+    return 2;
+  }
+  return cursor_queue(L, cur, (int)n);
+}
+
+// cursor:close() -> nil | err. Cancels the query and discards unread rows.
+static int cursor_close(lua_State* L) {
+  if (lunet_ensure_coroutine(L, "cursor:close")) {
+    return lua_error(L);
+  }
+  lunet_pg_cursor_t* cur = (lunet_pg_cursor_t*)luaL_checkudata(L, 1, LUNET_PG_CURSOR_MT);
+  if (cur->busy) {
+    lua_pushstring(L, "cursor:close: cursor is busy");
+    return 1;
+  }
+  if (!cur->wrapper) {
+    lua_pushnil(L);
+    return 1;
+  }
+  int n = cursor_queue(L, cur, 0);
+  if (n == 2) {
+    lua_remove(L, -2);  // (nil, err) -> err
+    return 1;
+  }
+  return n;
+}
+
+static void register_cursor_metatable(lua_State* L) {
+  if (luaL_newmetatable(L, LUNET_PG_CURSOR_MT)) {
+    lua_pushcfunction(L, cursor_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_createtable(L, 0, 2);
+    lua_pushcfunction(L, cursor_next);
+    lua_setfield(L, -2, "next");
+    lua_pushcfunction(L, cursor_close);
+    lua_setfield(L, -2, "close");
+    lua_setfield(L, -2, "__index");
+  }
+  lua_pop(L, 1);
+}
+
+// db.cursor(conn, sql, ...) -> cursor | nil, err
+// The query runs on the first cursor:next(); pools are not accepted because a
+// cursor has to stay on one connection across many fetches.
+int lunet_db_cursor(lua_State* L) {
+  lunet_pg_conn_t* wrapper = (lunet_pg_conn_t*)luaL_testudata(L, 1, LUNET_PG_CONN_MT);
+  if (!wrapper) {
+    lua_pushnil(L);
+    lua_pushstring(L, "db.cursor requires a connection (not a pool)");
+    return 2;
+  }
+  if (wrapper->closed || !wrapper->conn) {
+    lua_pushnil(L);
+    lua_pushstring(L, "connection is closed");
+    return 2;
+  }
+  const char* query = luaL_checkstring(L, 2);
+  register_cursor_metatable(L);
+
+  int nparams = 0;
+  param_t* params = collect_params(L, 3, &nparams, NULL);
+  if (nparams < 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  char* copy = lunet_strdup_local(query);
+  if (!copy) {
+    free_params(params, NULL);
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+
+  lunet_pg_cursor_t* cur = (lunet_pg_cursor_t*)lua_newuserdata(L, sizeof(lunet_pg_cursor_t));
+  memset(cur, 0, sizeof(*cur));
+  cur->query = copy;
+  cur->params = params;
+  cur->nparams = nparams;
+  luaL_getmetatable(L, LUNET_PG_CURSOR_MT);
+  lua_setmetatable(L, -2);
+  // The environment table keeps the connection and the borrowed string
+  // parameters alive for as long as the cursor
+  lua_createtable(L, 1 + nparams, 0);
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, -2, 1);
+  for (int i = 0; i < nparams; i++) {
+    lua_pushvalue(L, 3 + i);
+    lua_rawseti(L, -2, 2 + i);
+  }
+  lua_setfenv(L, -2);
+
+  uv_mutex_lock(&wrapper->mutex);
+  int taken = wrapper->cursor != NULL;
+  if (!taken) {
+    cur->wrapper = wrapper;
+    wrapper->cursor = cur;
+  }
+  uv_mutex_unlock(&wrapper->mutex);
+  if (taken) {
+    // The unattached cursor frees its copies when collected
+    lua_pushnil(L);
+    lua_pushstring(L, "connection has an open cursor");
+    return 2;
+  }
+  return 1;
+}
@@ -5,8 +5,14 @@
 
 int lunet_db_open(lua_State* L);
 int lunet_db_close(lua_State* L);
+int lunet_db_pool(lua_State* L);
+int lunet_db_pool_stats(lua_State* L);
 int lunet_db_query(lua_State* L);
 int lunet_db_exec(lua_State* L);
 int lunet_db_escape(lua_State* L);
+int lunet_db_stmt_cache_stats(lua_State* L);
+int lunet_db_cursor(lua_State* L);
+int lunet_db_exec_batch(lua_State* L);
+int lunet_db_executor_stats(lua_State* L);
 
 #endif
\ No newline at end of file
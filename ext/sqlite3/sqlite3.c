@@ -5,11 +5,18 @@
 #include <string.h>
 
 #include "co.h"
+#include "db_pool.h"
+#include "db_result.h"
+#include "executor.h"
 #include "trace.h"
 #include "lunet_mem.h"
+#include "rt.h"
+#include "stmt_cache.h"
 #include "uv.h"
 
+#define LUNET_SQLITE_POOL_MT "lunet.sqlite.pool"
 #define LUNET_SQLITE_CONN_MT "lunet.sqlite.conn"
+#define LUNET_SQLITE_CURSOR_MT "lunet.sqlite.cursor"
 
 static char* lunet_strdup_local(const char* s) {
   if (!s) return NULL;
@@ -20,16 +27,55 @@ static char* lunet_strdup_local(const char* s) {
   return out;
 }
 
+typedef struct lunet_sqlite_cursor lunet_sqlite_cursor_t;
+
 typedef struct {
   sqlite3* conn;
   uv_mutex_t mutex;
   int closed;
+  stmt_cache_t stmts;
+  lunet_sqlite_cursor_t* cursors;  // open db.cursor statements, guarded by mutex
 } lunet_sqlite_conn_t;
 
+static void stmt_cache_finalize(void* stmt, void* ud) {
+  (void)ud;
+  sqlite3_finalize((sqlite3_stmt*)stmt);
+}
+
+// Fetch the prepared statement for sql from the connection cache or compile it.
+// Caller holds wrapper->mutex and hands the statement back via stmt_release().
+static sqlite3_stmt* stmt_acquire(lunet_sqlite_conn_t* wrapper, const char* sql, int* cached) {
+  size_t len = strlen(sql);
+  sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_cache_get(&wrapper->stmts, sql, len);
+  if (stmt) {
+    *cached = 1;
+    return stmt;
+  }
+  *cached = 0;
+  if (sqlite3_prepare_v2(wrapper->conn, sql, (int)len, &stmt, NULL) != SQLITE_OK) return NULL;
+  return stmt;
+}
+
+// Reset the statement for its next use and keep it cached, or finalize it
+static void stmt_release(lunet_sqlite_conn_t* wrapper, const char* sql, sqlite3_stmt* stmt, int cached) {
+  if (!stmt) return;
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  if (cached) return;
+  if (stmt_cache_put(&wrapper->stmts, sql, strlen(sql), stmt) != 0) {
+    sqlite3_finalize(stmt);
+  }
+}
+
+static void cursors_detach(lunet_sqlite_conn_t* wrapper);
+
 // Close the SQLite connection but don't destroy the mutex (caller may still hold it)
 static void lunet_sqlite_conn_close(lunet_sqlite_conn_t* wrapper) {
   if (!wrapper || wrapper->closed) return;
   wrapper->closed = 1;
+  // Cached and cursor statements must be finalized before sqlite3_close() or it fails with SQLITE_BUSY
+  cursors_detach(wrapper);
+  stmt_cache_clear(&wrapper->stmts);
   if (wrapper->conn) {
     sqlite3_close(wrapper->conn);
     wrapper->conn = NULL;
@@ -70,92 +116,78 @@ typedef struct {
     union {
         long long i;
         double d;
+        // Borrowed from the Lua string; see collect_params()
         struct {
-            char* data;
+            const char* data;
             size_t len;
         } s;
     } value;
 } param_t;
 
-static void free_params(param_t* params, int nparams) {
-    if (!params) return;
-    for (int i = 0; i < nparams; i++) {
-        if (params[i].type == PARAM_TYPE_TEXT) {
-            lunet_free_nonnull(params[i].value.s.data);
-        }
-    }
-    lunet_free_nonnull(params);
+// Requests with at most this many parameters keep them inside the ctx
+#define DB_INLINE_PARAMS 8
+// Result rows are built in a per-request arena; this much lives in the ctx
+#define DB_ARENA_INLINE 1024
+
+static void free_params(param_t* params, const param_t* inline_buf) {
+    if (params && params != inline_buf) lunet_free_nonnull(params);
 }
 
-static param_t* collect_params(lua_State* L, int start, int* nparams) {
-    int top = lua_gettop(L);
-    *nparams = top - start + 1;
-    if (*nparams <= 0) {
-        *nparams = 0;
-        return NULL;
-    }
-    param_t* params = lunet_alloc(sizeof(param_t) * (*nparams));
-    if (!params) {
-        *nparams = -1;
-        return NULL;
-    }
-    for (int i = 0; i < *nparams; i++) {
+// Convert stack values [start, start + n) into out. Strings are not copied:
+// the caller keeps them reachable until the worker is done with them.
+static void fill_params(lua_State* L, int start, int n, param_t* out) {
+    for (int i = 0; i < n; i++) {
         int idx = start + i;
-        int type = lua_type(L, idx);
-        switch (type) {
-            case LUA_TNIL:
-                params[i].type = PARAM_TYPE_NIL;
-                break;
+        switch (lua_type(L, idx)) {
             case LUA_TNUMBER: {
-                lua_Number n = lua_tonumber(L, idx);
-                long long val = (long long)n;
-                if ((lua_Number)val == n) {
-                    params[i].type = PARAM_TYPE_INT;
-                    params[i].value.i = val;
+                lua_Number num = lua_tonumber(L, idx);
+                long long val = (long long)num;
+                if ((lua_Number)val == num) {
+                    out[i].type = PARAM_TYPE_INT;
+                    out[i].value.i = val;
                 } else {
-                    params[i].type = PARAM_TYPE_DOUBLE;
-                    params[i].value.d = n;
+                    out[i].type = PARAM_TYPE_DOUBLE;
+                    out[i].value.d = num;
                 }
                 break;
             }
             case LUA_TBOOLEAN:
-                params[i].type = PARAM_TYPE_INT;
-                params[i].value.i = lua_toboolean(L, idx);
+                out[i].type = PARAM_TYPE_INT;
+                out[i].value.i = lua_toboolean(L, idx);
                 break;
-            case LUA_TSTRING: {
-                size_t len;
-                const char* s = lua_tolstring(L, idx, &len);
-                params[i].type = PARAM_TYPE_TEXT;
-                params[i].value.s.data = lunet_alloc(len + 1);
-                if (!params[i].value.s.data) {
-                    free_params(params, i);
-                    *nparams = -1;
-                    return NULL;
-                }
-                memcpy(params[i].value.s.data, s, len);
-                params[i].value.s.data[len] = '\0';
-                params[i].value.s.len = len;
+            case LUA_TSTRING:
+                out[i].type = PARAM_TYPE_TEXT;
+                out[i].value.s.data = lua_tolstring(L, idx, &out[i].value.s.len);
                 break;
-            }
-            default: {
-                const char* s = lua_tostring(L, idx);
-                if (s) {
-                    size_t len = strlen(s);
-                    params[i].type = PARAM_TYPE_TEXT;
-                    params[i].value.s.data = lunet_strdup_local(s);
-                    if (!params[i].value.s.data) {
-                        free_params(params, i);
-                        *nparams = -1;
-                        return NULL;
-                    }
-                    params[i].value.s.len = len;
-                } else {
-                    params[i].type = PARAM_TYPE_NIL;
-                }
+            default:
+                out[i].type = PARAM_TYPE_NIL;
                 break;
-            }
         }
     }
+}
+
+/*
+ * Collect the call's arguments from start on. Up to DB_INLINE_PARAMS land in
+ * inline_buf, so the common case allocates nothing. String arguments stay on
+ * the calling coroutine's suspended frame, which co_ref keeps alive until the
+ * after callback, so their bytes are bound in place instead of copied.
+ */
+static param_t* collect_params(lua_State* L, int start, int* nparams, param_t* inline_buf) {
+    int top = lua_gettop(L);
+    *nparams = top - start + 1;
+    if (*nparams <= 0) {
+        *nparams = 0;
+        return NULL;
+    }
+    param_t* params = inline_buf;
+    if (!params || *nparams > DB_INLINE_PARAMS) {
+        params = lunet_alloc(sizeof(param_t) * (*nparams));
+        if (!params) {
+            *nparams = -1;
+            return NULL;
+        }
+    }
+    fill_params(L, start, *nparams, params);
     return params;
 }
 
@@ -183,7 +215,7 @@ static int bind_params(sqlite3_stmt* stmt, param_t* params, int nparams, char* e
                 rc = sqlite3_bind_double(stmt, idx, params[i].value.d);
                 break;
             case PARAM_TYPE_TEXT:
-                rc = sqlite3_bind_text(stmt, idx, params[i].value.s.data, params[i].value.s.len, SQLITE_TRANSIENT);
+                rc = sqlite3_bind_text(stmt, idx, params[i].value.s.data, params[i].value.s.len, SQLITE_STATIC);
                 break;
             default:
                 rc = SQLITE_ERROR;
@@ -203,6 +235,10 @@ typedef struct {
   char err[256];
 
   char path[1024];
+  int stmt_cache;
+
+  db_pool_t* pool;  // set when opening a connection on behalf of db.pool
+  int pool_slot;
 } db_open_ctx_t;
 
 static void db_open_work_cb(uv_work_t* req) {
@@ -217,8 +253,39 @@ static void db_open_work_cb(uv_work_t* req) {
   }
 }
 
+static lunet_sqlite_conn_t* push_conn(lua_State* L, db_open_ctx_t* ctx) {
+  lunet_sqlite_conn_t* wrapper = (lunet_sqlite_conn_t*)lua_newuserdata(L, sizeof(lunet_sqlite_conn_t));
+  wrapper->conn = ctx->conn;
+  wrapper->closed = 0;
+  stmt_cache_init(&wrapper->stmts, (size_t)ctx->stmt_cache, stmt_cache_finalize, NULL);
+  uv_mutex_init(&wrapper->mutex);
+  luaL_getmetatable(L, LUNET_SQLITE_CONN_MT);
+  lua_setmetatable(L, -2);
+  return wrapper;
+}
+
+// Pool opens have no coroutine: the connection is pinned in the registry of
+// the pool's main state and handed to the next waiter
+static void pool_open_done(db_open_ctx_t* ctx) {
+  db_pool_t* pool = ctx->pool;
+  if (!ctx->conn) {
+    db_pool_opened(pool, ctx->pool_slot, NULL, LUA_NOREF, ctx->err);
+    lunet_free_nonnull(ctx);
+    return;
+  }
+  lunet_sqlite_conn_t* wrapper = push_conn(pool->L, ctx);
+  int ref;
+  lunet_coref_create_raw(pool->L, ref);
+  db_pool_opened(pool, ctx->pool_slot, wrapper, ref, NULL);
+  lunet_free_nonnull(ctx);
+}
+
 static void db_open_after_cb(uv_work_t* req, int status) {
   db_open_ctx_t* ctx = (db_open_ctx_t*)req->data;
+  if (ctx->pool) {
+    pool_open_done(ctx);
+    return;
+  }
   lua_State* L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -235,12 +302,7 @@ static void db_open_after_cb(uv_work_t* req, int status) {
   lua_pop(L, 1);
 
   if (ctx->conn) {
-    lunet_sqlite_conn_t* wrapper = (lunet_sqlite_conn_t*)lua_newuserdata(co, sizeof(lunet_sqlite_conn_t));
-    wrapper->conn = ctx->conn;
-    wrapper->closed = 0;
-    uv_mutex_init(&wrapper->mutex);
-    luaL_getmetatable(co, LUNET_SQLITE_CONN_MT);
-    lua_setmetatable(co, -2);
+    push_conn(co, ctx);
     lua_pushnil(co);
   } else {
     lua_pushnil(co);
@@ -255,6 +317,41 @@ static void db_open_after_cb(uv_work_t* req, int status) {
   lunet_free_nonnull(ctx);
 }
 
+static void parse_open_params(lua_State* L, int idx, db_open_ctx_t* ctx) {
+  lua_getfield(L, idx, "path");
+  const char* path = luaL_optstring(L, -1, ":memory:");
+  snprintf(ctx->path, sizeof(ctx->path), "%s", path);
+  lua_getfield(L, idx, "stmt_cache");
+  ctx->stmt_cache = (int)luaL_optinteger(L, -1, STMT_CACHE_DEFAULT_CAP);
+  if (ctx->stmt_cache < 0) ctx->stmt_cache = 0;
+  lua_pop(L, 2);
+}
+
+static int pool_open(db_pool_t* pool, int slot) {
+  db_open_ctx_t* ctx = lunet_alloc(sizeof(db_open_ctx_t));
+  if (!ctx) return UV_ENOMEM;
+  memcpy(ctx, pool->ud, sizeof(*ctx));
+  ctx->req.data = ctx;
+  ctx->pool = pool;
+  ctx->pool_slot = slot;
+  int ret = lunet_exec_queue(LUNET_EXEC_DB, &ctx->req, db_open_work_cb, db_open_after_cb);
+  if (ret < 0) lunet_free_nonnull(ctx);
+  return ret;
+}
+
+// Only idle or returned connections are discarded, so no request holds the
+// mutex; skip it because lua_close() may already have collected the wrapper
+static void pool_discard(db_pool_t* pool, void* conn, int ref) {
+  lunet_sqlite_conn_close((lunet_sqlite_conn_t*)conn);
+  lunet_coref_release(pool->L, ref);
+}
+
+static void pool_destroy(db_pool_t* pool) {
+  lunet_free(pool->ud);
+}
+
+static const db_pool_ops_t g_pool_ops = {pool_open, pool_discard, pool_destroy};
+
 int lunet_db_open(lua_State* L) {
   if (lunet_ensure_coroutine(L, "db.open")) {
     return lua_error(L);
@@ -272,23 +369,19 @@ int lunet_db_open(lua_State* L) {
     lua_pushstring(L, "db.open: out of memory");
     return lua_error(L);
   }
-  memset(ctx->err, 0, sizeof(ctx->err));
+  memset(ctx, 0, sizeof(*ctx));
   ctx->L = L;
   ctx->req.data = ctx;
-
-  lua_getfield(L, 1, "path");
-  const char* path = luaL_optstring(L, -1, ":memory:");
-  snprintf(ctx->path, sizeof(ctx->path), "%s", path);
-  lua_pop(L, 1);
+  parse_open_params(L, 1, ctx);
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_open_work_cb, db_open_after_cb);
+  int ret = lunet_exec_queue(LUNET_EXEC_DB, &ctx->req, db_open_work_cb, db_open_after_cb);
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushfstring(L, "db.open: uv_queue_work failed: %s", uv_strerror(ret));
+    lua_pushfstring(L, "db.open: %s", lunet_exec_strerror(LUNET_EXEC_DB, ret));
     return lua_error(L);
   }
 
@@ -303,6 +396,12 @@ int lunet_db_close(lua_State* L) {
     lua_pushstring(L, "db.close requires a connection");
     return 1;
   }
+  db_pool_t* pool = db_pool_test(L, 1, LUNET_SQLITE_POOL_MT);
+  if (pool) {
+    db_pool_close(pool);
+    lua_pushnil(L);
+    return 1;
+  }
   lunet_sqlite_conn_t* wrapper = (lunet_sqlite_conn_t*)luaL_testudata(L, 1, LUNET_SQLITE_CONN_MT);
   if (!wrapper) {
     lua_pushstring(L, "db.close requires a valid connection");
@@ -318,28 +417,128 @@ int lunet_db_close(lua_State* L) {
   return 1;
 }
 
+int lunet_db_pool(lua_State* L) {
+  if (lua_gettop(L) < 1 || !lua_istable(L, 1)) {
+    lua_pushstring(L, "db.pool requires params table");
+    return lua_error(L);
+  }
+  register_conn_metatable(L);
+
+  int min, max, check_ms;
+  db_pool_parse_opts(L, 2, &min, &max, &check_ms);
+
+  db_open_ctx_t* tmpl = lunet_alloc(sizeof(db_open_ctx_t));
+  if (!tmpl) {
+    lua_pushstring(L, "db.pool: out of memory");
+    return lua_error(L);
+  }
+  memset(tmpl, 0, sizeof(*tmpl));
+  parse_open_params(L, 1, tmpl);
+
+  lua_State* mainL = default_luaL();
+  db_pool_t* pool = db_pool_create(mainL ? mainL : L, min, max, check_ms, &g_pool_ops, tmpl);
+  if (!pool) {
+    lunet_free_nonnull(tmpl);
+    lua_pushstring(L, "db.pool: out of memory");
+    return lua_error(L);
+  }
+  db_pool_push(L, pool, LUNET_SQLITE_POOL_MT);
+  db_pool_fill(pool);
+  return 1;
+}
+
+int lunet_db_pool_stats(lua_State* L) {
+  db_pool_t* pool = db_pool_test(L, 1, LUNET_SQLITE_POOL_MT);
+  if (!pool) {
+    lua_pushnil(L);
+    lua_pushstring(L, "db.pool_stats requires a pool");
+    return 2;
+  }
+  db_pool_push_stats(L, pool);
+  return 1;
+}
+
+// Accept either a connection or a db.pool handle as the first argument.
+// Pushes (nil, err) and returns 2 when neither is usable.
+static int resolve_target(lua_State* L, const char* fname, lunet_sqlite_conn_t** wrapper, db_pool_t** pool) {
+  *wrapper = (lunet_sqlite_conn_t*)luaL_testudata(L, 1, LUNET_SQLITE_CONN_MT);
+  *pool = NULL;
+  if (!*wrapper) {
+    *pool = db_pool_test(L, 1, LUNET_SQLITE_POOL_MT);
+    if (!*pool) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "%s requires a valid connection", fname);
+      return 2;
+    }
+    if ((*pool)->closed) {
+      lua_pushnil(L);
+      lua_pushstring(L, "pool is closed");
+      return 2;
+    }
+    return 0;
+  }
+  if ((*wrapper)->closed || !(*wrapper)->conn) {
+    lua_pushnil(L);
+    lua_pushstring(L, "connection is closed");
+    return 2;
+  }
+  return 0;
+}
+
+// SQLite connections are local files: they never go stale and need no ping
+static int pool_checkout(db_pool_waiter_t* w, char* err, size_t errsize) {
+  (void)w;
+  (void)err;
+  (void)errsize;
+  return 0;
+}
+
+static void pool_checkin(db_pool_waiter_t* w, const char* err) {
+  (void)w;
+  (void)err;
+}
+
 typedef struct {
   uv_work_t req;
   lua_State* L;
   int co_ref;
 
+  db_pool_waiter_t pw;
   lunet_sqlite_conn_t* wrapper;
   char* query;
   
   param_t* params;
   int nparams;
+  param_t inline_params[DB_INLINE_PARAMS];
 
   char** col_names;
   int* col_types;
   char*** rows;
   int nrows;
   int ncols;
+  db_result_opts_t shape;
   char err[256];
+
+  // col_names, col_types, rows and every cell; freed in one go
+  int arena_live;
+  lunet_arena_t arena;
+  char arena_buf[DB_ARENA_INLINE];
 } db_query_ctx_t;
 
-static void db_query_work_cb(uv_work_t* req) {
+static void db_query_run(uv_work_t* req) {
   db_query_ctx_t* ctx = (db_query_ctx_t*)req->data;
   sqlite3_stmt* stmt = NULL;
+  int cached = 0;
+
+  // A pooled retry runs again on a fresh connection; start from scratch
+  if (ctx->arena_live) {
+    lunet_arena_reset(&ctx->arena);
+  } else {
+    lunet_arena_init_buf(&ctx->arena, ctx->arena_buf, sizeof(ctx->arena_buf), 0);
+    ctx->arena_live = 1;
+  }
+  ctx->rows = NULL;
+  ctx->nrows = 0;
 
   uv_mutex_lock(&ctx->wrapper->mutex);
   if (ctx->wrapper->closed || !ctx->wrapper->conn) {
@@ -348,134 +547,139 @@ static void db_query_work_cb(uv_work_t* req) {
     return;
   }
 
-  int rc = sqlite3_prepare_v2(ctx->wrapper->conn, ctx->query, -1, &stmt, NULL);
-  if (rc != SQLITE_OK) {
+  stmt = stmt_acquire(ctx->wrapper, ctx->query, &cached);
+  if (!stmt) {
     snprintf(ctx->err, sizeof(ctx->err), "%s", sqlite3_errmsg(ctx->wrapper->conn));
     uv_mutex_unlock(&ctx->wrapper->mutex);
     return;
   }
   
+  int rc;
   if (ctx->nparams > 0) {
       rc = bind_params(stmt, ctx->params, ctx->nparams, ctx->err, sizeof(ctx->err));
       if (rc != SQLITE_OK) {
           if (ctx->err[0] == '\0') {
               snprintf(ctx->err, sizeof(ctx->err), "bind failed: %s", sqlite3_errmsg(ctx->wrapper->conn));
           }
-          sqlite3_finalize(stmt);
+          stmt_release(ctx->wrapper, ctx->query, stmt, cached);
           uv_mutex_unlock(&ctx->wrapper->mutex);
           return;
       }
   }
 
+  lunet_arena_t* arena = &ctx->arena;
   ctx->ncols = sqlite3_column_count(stmt);
+  ctx->col_names = NULL;
+  ctx->col_types = NULL;
   if (ctx->ncols > 0) {
-    ctx->col_names = lunet_alloc(sizeof(char*) * ctx->ncols);
-    ctx->col_types = lunet_alloc(sizeof(int) * ctx->ncols);
-    if (!ctx->col_names || !ctx->col_types) {
+    ctx->col_names = lunet_arena_alloc(arena, sizeof(char*) * ctx->ncols);
+    // zeroed: an empty result never sets them, and 0 reads as text
+    ctx->col_types = lunet_arena_calloc(arena, (size_t)ctx->ncols, sizeof(int));
+    int ok = ctx->col_names && ctx->col_types;
+    for (int i = 0; ok && i < ctx->ncols; i++) {
+      const char* name = sqlite3_column_name(stmt, i);
+      ok = (ctx->col_names[i] = lunet_arena_strdup(arena, name ? name : "")) != NULL;
+    }
+    if (!ok) {
       snprintf(ctx->err, sizeof(ctx->err), "out of memory");
-      lunet_free_nonnull(ctx->col_names);
-      lunet_free_nonnull(ctx->col_types);
-      ctx->col_names = NULL;
-      ctx->col_types = NULL;
       ctx->ncols = 0;
-      sqlite3_finalize(stmt);
+      stmt_release(ctx->wrapper, ctx->query, stmt, cached);
       uv_mutex_unlock(&ctx->wrapper->mutex);
       return;
     }
-    memset(ctx->col_names, 0, sizeof(char*) * ctx->ncols);
-    for (int i = 0; i < ctx->ncols; i++) {
-      const char* name = sqlite3_column_name(stmt, i);
-      ctx->col_names[i] = lunet_strdup_local(name ? name : "");
-      if (!ctx->col_names[i]) {
-        snprintf(ctx->err, sizeof(ctx->err), "out of memory");
-        for (int j = 0; j < i; j++) lunet_free_nonnull(ctx->col_names[j]);
-        lunet_free_nonnull(ctx->col_names);
-        lunet_free_nonnull(ctx->col_types);
-        ctx->col_names = NULL;
-        ctx->col_types = NULL;
-        ctx->ncols = 0;
-        sqlite3_finalize(stmt);
-        uv_mutex_unlock(&ctx->wrapper->mutex);
-        return;
-      }
-    }
-  } else {
-    ctx->col_names = NULL;
-    ctx->col_types = NULL;
   }
 
   int capacity = 16;
-  ctx->rows = lunet_alloc(sizeof(char**) * capacity);
-  if (!ctx->rows) {
-    snprintf(ctx->err, sizeof(ctx->err), "out of memory");
-    for (int i = 0; i < ctx->ncols; i++) lunet_free_nonnull(ctx->col_names[i]);
-    lunet_free_nonnull(ctx->col_names);
-    lunet_free_nonnull(ctx->col_types);
-    ctx->col_names = NULL;
-    ctx->col_types = NULL;
-    ctx->ncols = 0;
-    sqlite3_finalize(stmt);
-    uv_mutex_unlock(&ctx->wrapper->mutex);
-    return;
-  }
+  ctx->rows = lunet_arena_alloc(arena, sizeof(char**) * capacity);
   ctx->nrows = 0;
+  rc = ctx->rows ? SQLITE_OK : SQLITE_NOMEM;
 
-  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+  while (ctx->rows && (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
     if (ctx->nrows >= capacity) {
-      capacity *= 2;
-      char*** new_rows = lunet_realloc(ctx->rows, sizeof(char**) * capacity);
+      char*** new_rows = lunet_arena_realloc(arena, ctx->rows, sizeof(char**) * capacity,
+                                             sizeof(char**) * capacity * 2);
       if (!new_rows) {
         snprintf(ctx->err, sizeof(ctx->err), "out of memory");
         break;
       }
+      capacity *= 2;
       ctx->rows = new_rows;
     }
 
-    char** row = lunet_alloc(sizeof(char*) * ctx->ncols);
-    if (!row) {
-      snprintf(ctx->err, sizeof(ctx->err), "out of memory");
-      break;
-    }
-    memset(row, 0, sizeof(char*) * ctx->ncols);
-    int alloc_failed = 0;
-    for (int i = 0; i < ctx->ncols; i++) {
+    char** row = lunet_arena_alloc(arena, sizeof(char*) * (ctx->ncols ? ctx->ncols : 1));
+    int alloc_failed = row == NULL;
+    for (int i = 0; !alloc_failed && i < ctx->ncols; i++) {
       int t = sqlite3_column_type(stmt, i);
       if (ctx->nrows == 0 && ctx->col_types) ctx->col_types[i] = t;
-      if (t == SQLITE_NULL) {
-        row[i] = NULL;
-      } else {
-        const char* val = (const char*)sqlite3_column_text(stmt, i);
-        if (val) {
-          row[i] = lunet_strdup_local(val);
-          if (!row[i]) {
-            alloc_failed = 1;
-            break;
-          }
-        } else {
-          row[i] = NULL;
-        }
-      }
+      const char* val = t == SQLITE_NULL ? NULL : (const char*)sqlite3_column_text(stmt, i);
+      row[i] = NULL;
+      if (val && !(row[i] = lunet_arena_strdup(arena, val))) alloc_failed = 1;
     }
     if (alloc_failed) {
       snprintf(ctx->err, sizeof(ctx->err), "out of memory");
-      for (int i = 0; i < ctx->ncols; i++) lunet_free_nonnull(row[i]);
-      lunet_free_nonnull(row);
       break;
     }
     ctx->rows[ctx->nrows] = row;
     ctx->nrows++;
   }
 
-  if (rc != SQLITE_DONE) {
-    snprintf(ctx->err, sizeof(ctx->err), "%s", sqlite3_errmsg(ctx->wrapper->conn));
+  if (ctx->err[0] == '\0' && rc != SQLITE_DONE) {
+    snprintf(ctx->err, sizeof(ctx->err), "%s",
+             rc == SQLITE_NOMEM ? "out of memory" : sqlite3_errmsg(ctx->wrapper->conn));
   }
 
-  sqlite3_finalize(stmt);
+  stmt_release(ctx->wrapper, ctx->query, stmt, cached);
   uv_mutex_unlock(&ctx->wrapper->mutex);
 }
 
+// Materialized rows as seen by db_result_push()
+typedef struct {
+  char** col_names;
+  const int* types;
+  char*** rows;
+} rows_view_t;
+
+static const char* rows_name(void* ud, int col) {
+  return ((rows_view_t*)ud)->col_names[col];
+}
+
+static db_col_kind_t rows_kind(void* ud, int col) {
+  const int* types = ((rows_view_t*)ud)->types;
+  switch (types ? types[col] : SQLITE_TEXT) {
+    case SQLITE_INTEGER:
+      return DB_COL_INT;
+    case SQLITE_FLOAT:
+      return DB_COL_FLOAT;
+    default:
+      return DB_COL_TEXT;
+  }
+}
+
+static const char* rows_value(void* ud, int row, int col) {
+  return ((rows_view_t*)ud)->rows[row][col];
+}
+
+// Push the result of db.query or cursor:next() in the requested shape
+static void push_rows(lua_State* co, char** col_names, const int* types, int ncols, char*** rows, int nrows,
+                      const db_result_opts_t* opts) {
+  rows_view_t view = {col_names, types, rows};
+  db_result_t r = {nrows, ncols, &view, rows_name, rows_kind, rows_value};
+  db_result_push(co, &r, opts);
+}
+
+static void db_query_work_cb(uv_work_t* req) {
+  db_query_ctx_t* ctx = (db_query_ctx_t*)req->data;
+  if (ctx->pw.pool) {
+    ctx->wrapper = (lunet_sqlite_conn_t*)ctx->pw.conn;
+    if (pool_checkout(&ctx->pw, ctx->err, sizeof(ctx->err))) return;
+  }
+  db_query_run(req);
+  if (ctx->pw.pool) pool_checkin(&ctx->pw, ctx->err);
+}
+
 static void db_query_after_cb(uv_work_t* req, int status) {
   db_query_ctx_t* ctx = (db_query_ctx_t*)req->data;
+  if (db_pool_release(&ctx->pw)) return;  // re-queued on a fresh pooled connection
   lua_State* L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -500,34 +704,7 @@ static void db_query_after_cb(uv_work_t* req, int status) {
     goto cleanup;
   }
 
-  lua_newtable(co);
-  int* types = ctx->col_types;
-
-  for (int i = 0; i < ctx->nrows; i++) {
-    lua_newtable(co);
-    for (int j = 0; j < ctx->ncols; j++) {
-      lua_pushstring(co, ctx->col_names[j]);
-      if (ctx->rows[i][j] == NULL) {
-        lua_pushnil(co);
-      } else {
-        int coltype = types ? types[j] : SQLITE_TEXT;
-        switch (coltype) {
-          case SQLITE_INTEGER:
-            lua_pushinteger(co, strtoll(ctx->rows[i][j], NULL, 10));
-            break;
-          case SQLITE_FLOAT:
-            lua_pushnumber(co, strtod(ctx->rows[i][j], NULL));
-            break;
-          default:
-            lua_pushstring(co, ctx->rows[i][j]);
-            break;
-        }
-      }
-      lua_settable(co, -3);
-    }
-    lua_rawseti(co, -2, i + 1);
-  }
-
+  push_rows(co, ctx->col_names, ctx->col_types, ctx->ncols, ctx->rows, ctx->nrows, &ctx->shape);
   lua_pushnil(co);
   {
     int rc = lunet_co_resume(co, 2);
@@ -539,20 +716,9 @@ static void db_query_after_cb(uv_work_t* req, int status) {
   }
 
 cleanup:
-  for (int i = 0; i < ctx->nrows; i++) {
-    for (int j = 0; j < ctx->ncols; j++) {
-      lunet_free_nonnull(ctx->rows[i][j]);
-    }
-    lunet_free_nonnull(ctx->rows[i]);
-  }
-  lunet_free_nonnull(ctx->rows);
-  for (int i = 0; i < ctx->ncols; i++) {
-    lunet_free_nonnull(ctx->col_names[i]);
-  }
-  lunet_free_nonnull(ctx->col_names);
-  lunet_free_nonnull(ctx->col_types);
+  if (ctx->arena_live) lunet_arena_destroy(&ctx->arena);
   lunet_free_nonnull(ctx->query);
-  free_params(ctx->params, ctx->nparams);
+  free_params(ctx->params, ctx->inline_params);
   lunet_free_nonnull(ctx);
 }
 
@@ -566,27 +732,28 @@ int lunet_db_query(lua_State* L) {
     return 2;
   }
 
-  lunet_sqlite_conn_t* wrapper = (lunet_sqlite_conn_t*)luaL_testudata(L, 1, LUNET_SQLITE_CONN_MT);
-  if (!wrapper) {
-    lua_pushnil(L);
-    lua_pushstring(L, "db.query requires a valid connection");
+  lunet_sqlite_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.query", &wrapper, &pool)) {
     return 2;
   }
 
-  if (wrapper->closed || !wrapper->conn) {
+  const char* query = luaL_checkstring(L, 2);
+  db_result_opts_t shape;
+  const char* shape_err = db_result_parse_opts(L, 3, &shape);
+  if (shape_err) {
     lua_pushnil(L);
-    lua_pushstring(L, "connection is closed");
+    lua_pushfstring(L, "db.query: %s", shape_err);
     return 2;
   }
 
-  const char* query = luaL_checkstring(L, 2);
-
   db_query_ctx_t* ctx = lunet_alloc(sizeof(db_query_ctx_t));
   if (!ctx) {
     lua_pushstring(L, "out of memory");
     return lua_error(L);
   }
   memset(ctx, 0, sizeof(*ctx));
+  ctx->shape = shape;
   ctx->L = L;
   ctx->req.data = ctx;
   ctx->wrapper = wrapper;
@@ -600,13 +767,13 @@ int lunet_db_query(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_query_work_cb, db_query_after_cb);
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_query_work_cb, db_query_after_cb, ctx->err, sizeof(ctx->err));
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->query);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushstring(L, uv_strerror(ret));
+    lua_pushstring(L, db_pool_strerror(pool, ret));
     return 2;
   }
 
@@ -618,18 +785,20 @@ typedef struct {
   lua_State* L;
   int co_ref;
 
+  db_pool_waiter_t pw;
   lunet_sqlite_conn_t* wrapper;
   char* query;
   
   param_t* params;
   int nparams;
+  param_t inline_params[DB_INLINE_PARAMS];
 
   long long affected_rows;
   long long insert_id;
   char err[256];
 } db_exec_ctx_t;
 
-static void db_exec_work_cb(uv_work_t* req) {
+static void db_exec_run(uv_work_t* req) {
   db_exec_ctx_t* ctx = (db_exec_ctx_t*)req->data;
 
   uv_mutex_lock(&ctx->wrapper->mutex);
@@ -640,19 +809,19 @@ static void db_exec_work_cb(uv_work_t* req) {
   }
 
   if (ctx->nparams > 0) {
-      sqlite3_stmt* stmt = NULL;
-      int rc = sqlite3_prepare_v2(ctx->wrapper->conn, ctx->query, -1, &stmt, NULL);
-      if (rc != SQLITE_OK) {
+      int cached = 0;
+      sqlite3_stmt* stmt = stmt_acquire(ctx->wrapper, ctx->query, &cached);
+      if (!stmt) {
           snprintf(ctx->err, sizeof(ctx->err), "%s", sqlite3_errmsg(ctx->wrapper->conn));
           uv_mutex_unlock(&ctx->wrapper->mutex);
           return;
       }
-      rc = bind_params(stmt, ctx->params, ctx->nparams, ctx->err, sizeof(ctx->err));
+      int rc = bind_params(stmt, ctx->params, ctx->nparams, ctx->err, sizeof(ctx->err));
       if (rc != SQLITE_OK) {
           if (ctx->err[0] == '\0') {
               snprintf(ctx->err, sizeof(ctx->err), "bind failed: %s", sqlite3_errmsg(ctx->wrapper->conn));
           }
-          sqlite3_finalize(stmt);
+          stmt_release(ctx->wrapper, ctx->query, stmt, cached);
           uv_mutex_unlock(&ctx->wrapper->mutex);
           return;
       }
@@ -660,7 +829,7 @@ static void db_exec_work_cb(uv_work_t* req) {
       if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
           snprintf(ctx->err, sizeof(ctx->err), "%s", sqlite3_errmsg(ctx->wrapper->conn));
       }
-      sqlite3_finalize(stmt);
+      stmt_release(ctx->wrapper, ctx->query, stmt, cached);
   } else {
       char* errmsg = NULL;
       int rc = sqlite3_exec(ctx->wrapper->conn, ctx->query, NULL, NULL, &errmsg);
@@ -677,8 +846,19 @@ static void db_exec_work_cb(uv_work_t* req) {
   uv_mutex_unlock(&ctx->wrapper->mutex);
 }
 
+static void db_exec_work_cb(uv_work_t* req) {
+  db_exec_ctx_t* ctx = (db_exec_ctx_t*)req->data;
+  if (ctx->pw.pool) {
+    ctx->wrapper = (lunet_sqlite_conn_t*)ctx->pw.conn;
+    if (pool_checkout(&ctx->pw, ctx->err, sizeof(ctx->err))) return;
+  }
+  db_exec_run(req);
+  if (ctx->pw.pool) pool_checkin(&ctx->pw, ctx->err);
+}
+
 static void db_exec_after_cb(uv_work_t* req, int status) {
   db_exec_ctx_t* ctx = (db_exec_ctx_t*)req->data;
+  if (db_pool_release(&ctx->pw)) return;  // re-queued on a fresh pooled connection
   lua_State* L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -687,7 +867,7 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
     lua_pop(L, 1);
     fprintf(stderr, "invalid coroutine in db.exec\n");
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     return;
   }
@@ -721,7 +901,7 @@ static void db_exec_after_cb(uv_work_t* req, int status) {
   }
 
   lunet_free_nonnull(ctx->query);
-  free_params(ctx->params, ctx->nparams);
+  free_params(ctx->params, ctx->inline_params);
   lunet_free_nonnull(ctx);
 }
 
@@ -735,16 +915,9 @@ int lunet_db_exec(lua_State* L) {
     return 2;
   }
 
-  lunet_sqlite_conn_t* wrapper = (lunet_sqlite_conn_t*)luaL_testudata(L, 1, LUNET_SQLITE_CONN_MT);
-  if (!wrapper) {
-    lua_pushnil(L);
-    lua_pushstring(L, "db.exec requires a valid connection");
-    return 2;
-  }
-
-  if (wrapper->closed || !wrapper->conn) {
-    lua_pushnil(L);
-    lua_pushstring(L, "connection is closed");
+  lunet_sqlite_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.exec", &wrapper, &pool)) {
     return 2;
   }
 
@@ -770,13 +943,13 @@ int lunet_db_exec(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_exec_work_cb, db_exec_after_cb, ctx->err, sizeof(ctx->err));
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->query);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushstring(L, uv_strerror(ret));
+    lua_pushstring(L, db_pool_strerror(pool, ret));
     return 2;
   }
 
@@ -803,6 +976,24 @@ int lunet_db_escape(lua_State* L) {
   return 1;
 }
 
+int lunet_db_stmt_cache_stats(lua_State* L) {
+  lunet_sqlite_conn_t* wrapper = (lunet_sqlite_conn_t*)luaL_testudata(L, 1, LUNET_SQLITE_CONN_MT);
+  if (!wrapper) {
+    lua_pushnil(L);
+    lua_pushstring(L, "db.stmt_cache_stats requires a valid connection");
+    return 2;
+  }
+  uv_mutex_lock(&wrapper->mutex);
+  stmt_cache_push_stats(L, &wrapper->stmts);
+  uv_mutex_unlock(&wrapper->mutex);
+  return 1;
+}
+
+int lunet_db_executor_stats(lua_State* L) {
+  lunet_exec_push_stats(L, LUNET_EXEC_DB);
+  return 1;
+}
+
 int lunet_db_query_params(lua_State* L) {
   if (lunet_ensure_coroutine(L, "db.query_params")) {
     return lua_error(L);
@@ -813,27 +1004,28 @@ int lunet_db_query_params(lua_State* L) {
     return 2;
   }
 
-  lunet_sqlite_conn_t* wrapper = (lunet_sqlite_conn_t*)luaL_testudata(L, 1, LUNET_SQLITE_CONN_MT);
-  if (!wrapper) {
-    lua_pushnil(L);
-    lua_pushstring(L, "db.query_params requires a valid connection");
+  lunet_sqlite_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.query_params", &wrapper, &pool)) {
     return 2;
   }
 
-  if (wrapper->closed || !wrapper->conn) {
+  const char* query = luaL_checkstring(L, 2);
+  db_result_opts_t shape;
+  const char* shape_err = db_result_parse_opts(L, 3, &shape);
+  if (shape_err) {
     lua_pushnil(L);
-    lua_pushstring(L, "connection is closed");
+    lua_pushfstring(L, "db.query_params: %s", shape_err);
     return 2;
   }
 
-  const char* query = luaL_checkstring(L, 2);
-
   db_query_ctx_t* ctx = lunet_alloc(sizeof(db_query_ctx_t));
   if (!ctx) {
     lua_pushstring(L, "out of memory");
     return lua_error(L);
   }
   memset(ctx, 0, sizeof(*ctx));
+  ctx->shape = shape;
   ctx->L = L;
   ctx->req.data = ctx;
   ctx->wrapper = wrapper;
@@ -845,7 +1037,7 @@ int lunet_db_query_params(lua_State* L) {
     return 2;
   }
 
-  ctx->params = collect_params(L, 3, &ctx->nparams);
+  ctx->params = collect_params(L, 3, &ctx->nparams, ctx->inline_params);
   if (ctx->nparams < 0) {
     lunet_free_nonnull(ctx->query);
     lunet_free_nonnull(ctx);
@@ -856,14 +1048,14 @@ int lunet_db_query_params(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_query_work_cb, db_query_after_cb);
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_query_work_cb, db_query_after_cb, ctx->err, sizeof(ctx->err));
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushstring(L, uv_strerror(ret));
+    lua_pushstring(L, db_pool_strerror(pool, ret));
     return 2;
   }
 
@@ -880,16 +1072,9 @@ int lunet_db_exec_params(lua_State* L) {
     return 2;
   }
 
-  lunet_sqlite_conn_t* wrapper = (lunet_sqlite_conn_t*)luaL_testudata(L, 1, LUNET_SQLITE_CONN_MT);
-  if (!wrapper) {
-    lua_pushnil(L);
-    lua_pushstring(L, "db.exec_params requires a valid connection");
-    return 2;
-  }
-
-  if (wrapper->closed || !wrapper->conn) {
-    lua_pushnil(L);
-    lua_pushstring(L, "connection is closed");
+  lunet_sqlite_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.exec_params", &wrapper, &pool)) {
     return 2;
   }
 
@@ -913,7 +1098,7 @@ int lunet_db_exec_params(lua_State* L) {
     return 2;
   }
 
-  ctx->params = collect_params(L, 3, &ctx->nparams);
+  ctx->params = collect_params(L, 3, &ctx->nparams, ctx->inline_params);
   if (ctx->nparams < 0) {
     lunet_free_nonnull(ctx->query);
     lunet_free_nonnull(ctx);
@@ -924,16 +1109,674 @@ int lunet_db_exec_params(lua_State* L) {
 
   lunet_coref_create(L, ctx->co_ref);
 
-  int ret = uv_queue_work(uv_default_loop(), &ctx->req, db_exec_work_cb, db_exec_after_cb);
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_exec_work_cb, db_exec_after_cb, ctx->err, sizeof(ctx->err));
   if (ret < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->query);
-    free_params(ctx->params, ctx->nparams);
+    free_params(ctx->params, ctx->inline_params);
     lunet_free_nonnull(ctx);
     lua_pushnil(L);
-    lua_pushstring(L, uv_strerror(ret));
+    lua_pushstring(L, db_pool_strerror(pool, ret));
     return 2;
   }
 
   return lua_yield(L, 0);
 }
+
+/*
+ * Batched execution (db.exec_batch)
+ *
+ * Every parameter tuple runs inside one executor job on one connection, with
+ * the statement prepared once: a bulk insert costs one hop and one mutex
+ * acquire instead of one per row.
+ *
+ * SQLite wraps the batch in a transaction unless one is already open, and
+ * rolls it back if any tuple fails.
+ */
+
+typedef struct {
+  uv_work_t req;
+  lua_State* L;
+  int co_ref;
+
+  db_pool_waiter_t pw;
+  lunet_sqlite_conn_t* wrapper;
+  char* query;
+
+  param_t* params;     // nrows tuples of width params, row-major
+  int nrows;
+  int width;
+  int pin_ref;         // table holding the borrowed strings, or LUA_NOREF
+  long long* counts;   // affected rows per tuple
+  long long affected_rows;
+  unsigned long long insert_id;
+  char err[256];
+} db_batch_ctx_t;
+
+static void free_batch(db_batch_ctx_t* ctx) {
+  free_params(ctx->params, NULL);
+  if (ctx->pin_ref != LUA_NOREF) lunet_coref_release(ctx->L, ctx->pin_ref);
+  if (ctx->counts) lunet_free_nonnull(ctx->counts);
+  lunet_free_nonnull(ctx->query);
+  lunet_free_nonnull(ctx);
+}
+
+// Copy the rows table at idx into ctx. Tuples shorter than the widest one
+// are padded with NULLs. Returns NULL or an error message.
+static const char* collect_batch(lua_State* L, int idx, db_batch_ctx_t* ctx) {
+  int nrows = (int)lua_objlen(L, idx);
+  int width = 0;
+  for (int i = 1; i <= nrows; i++) {
+    lua_rawgeti(L, idx, i);
+    if (!lua_istable(L, -1)) {
+      lua_pop(L, 1);
+      return "rows must be an array of parameter arrays";
+    }
+    int n = (int)lua_objlen(L, -1);
+    if (n > width) width = n;
+    lua_pop(L, 1);
+  }
+  if (nrows == 0) return NULL;
+  if (!lua_checkstack(L, width + 3)) return "too many parameters per row";
+
+  ctx->counts = lunet_calloc((size_t)nrows, sizeof(long long));
+  if (width > 0) ctx->params = lunet_alloc(sizeof(param_t) * (size_t)nrows * (size_t)width);
+  if (!ctx->counts || (width > 0 && !ctx->params)) return "out of memory";
+  ctx->width = width;
+  // Other coroutines may rewrite the tuples while the batch runs, so the
+  // strings are pinned on their own rather than through the rows table
+  lua_newtable(L);
+  int pin = lua_gettop(L);
+  int npinned = 0;
+  for (int i = 0; i < nrows; i++) {
+    lua_rawgeti(L, idx, i + 1);
+    int base = lua_gettop(L);
+    for (int j = 1; j <= width; j++) {
+      lua_rawgeti(L, base, j);
+      if (lua_type(L, -1) == LUA_TSTRING) {
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, pin, ++npinned);
+      }
+    }
+    fill_params(L, base + 1, width, ctx->params + (size_t)i * width);
+    lua_settop(L, base - 1);
+  }
+  if (npinned > 0) {
+    lunet_coref_create_raw(L, ctx->pin_ref);
+  } else {
+    lua_pop(L, 1);
+  }
+  ctx->nrows = nrows;
+  return NULL;
+}
+
+// Prefix the row number to the error so a failing tuple can be located
+static void batch_fail(db_batch_ctx_t* ctx, int row, const char* msg) {
+  char tmp[sizeof(ctx->err)];
+  snprintf(tmp, sizeof(tmp), "%s", msg);
+  snprintf(ctx->err, sizeof(ctx->err), "row %d: %s", row + 1, tmp);
+}
+
+static void db_batch_run(uv_work_t* req) {
+  db_batch_ctx_t* ctx = (db_batch_ctx_t*)req->data;
+
+  uv_mutex_lock(&ctx->wrapper->mutex);
+  if (ctx->wrapper->closed || !ctx->wrapper->conn) {
+    snprintf(ctx->err, sizeof(ctx->err), "connection is closed");
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+  sqlite3* db = ctx->wrapper->conn;
+
+  int cached = 0;
+  sqlite3_stmt* stmt = stmt_acquire(ctx->wrapper, ctx->query, &cached);
+  if (!stmt) {
+    snprintf(ctx->err, sizeof(ctx->err), "%s", sqlite3_errmsg(db));
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+
+  // One implicit transaction, so the batch is a single journal commit, unless
+  // the caller already has one open
+  int own_txn = sqlite3_get_autocommit(db);
+  if (own_txn && sqlite3_exec(db, "BEGIN", NULL, NULL, NULL) != SQLITE_OK) {
+    snprintf(ctx->err, sizeof(ctx->err), "%s", sqlite3_errmsg(db));
+    stmt_release(ctx->wrapper, ctx->query, stmt, cached);
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+
+  for (int i = 0; i < ctx->nrows; i++) {
+    char err[256] = {0};
+    int rc = bind_params(stmt, ctx->params + (size_t)i * ctx->width, ctx->width, err, sizeof(err));
+    if (rc == SQLITE_OK) {
+      rc = sqlite3_step(stmt);
+      if (rc == SQLITE_DONE || rc == SQLITE_ROW) rc = SQLITE_OK;
+    }
+    if (rc != SQLITE_OK) {
+      batch_fail(ctx, i, err[0] ? err : sqlite3_errmsg(db));
+      break;
+    }
+    ctx->counts[i] = sqlite3_changes(db);
+    ctx->affected_rows += ctx->counts[i];
+    sqlite3_reset(stmt);
+  }
+
+  if (ctx->err[0] != '\0') {
+    if (own_txn) sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+  } else if (own_txn && sqlite3_exec(db, "COMMIT", NULL, NULL, NULL) != SQLITE_OK) {
+    snprintf(ctx->err, sizeof(ctx->err), "%s", sqlite3_errmsg(db));
+    sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+  }
+  ctx->insert_id = sqlite3_last_insert_rowid(db);
+  stmt_release(ctx->wrapper, ctx->query, stmt, cached);
+  uv_mutex_unlock(&ctx->wrapper->mutex);
+}
+
+static void db_batch_work_cb(uv_work_t* req) {
+  db_batch_ctx_t* ctx = (db_batch_ctx_t*)req->data;
+  if (ctx->pw.pool) {
+    ctx->wrapper = (lunet_sqlite_conn_t*)ctx->pw.conn;
+    if (pool_checkout(&ctx->pw, ctx->err, sizeof(ctx->err))) return;
+  }
+  db_batch_run(req);
+  if (ctx->pw.pool) pool_checkin(&ctx->pw, ctx->err);
+}
+
+static void db_batch_after_cb(uv_work_t* req, int status) {
+  db_batch_ctx_t* ctx = (db_batch_ctx_t*)req->data;
+  if (db_pool_release(&ctx->pw)) return;  // re-queued on a fresh pooled connection
+  lua_State* L = ctx->L;
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
+  lunet_coref_release(L, ctx->co_ref);
+  if (!lua_isthread(L, -1)) {
+    lua_pop(L, 1);
+    fprintf(stderr, "invalid coroutine in db.exec_batch\n");
+    free_batch(ctx);
+    return;
+  }
+  lua_State* co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+
+  if (ctx->err[0] != '\0') {
+    lua_pushnil(co);
+    lua_pushstring(co, ctx->err);
+  } else {
+    lua_createtable(co, 0, 3);
+    lua_pushinteger(co, ctx->affected_rows);
+    lua_setfield(co, -2, "affected_rows");
+    lua_pushinteger(co, ctx->insert_id);
+    lua_setfield(co, -2, "last_insert_id");
+    lua_createtable(co, ctx->nrows, 0);
+    for (int i = 0; i < ctx->nrows; i++) {
+      lua_pushinteger(co, ctx->counts[i]);
+      lua_rawseti(co, -2, i + 1);
+    }
+    lua_setfield(co, -2, "counts");
+    lua_pushnil(co);
+  }
+  int rc = lunet_co_resume(co, 2);
+  if (rc != 0 && rc != LUA_YIELD) {
+    const char* err = lua_tostring(co, -1);
+    if (err) fprintf(stderr, "lua_resume error in db.exec_batch: %s\n", err);
+    lua_pop(co, 1);
+  }
+
+  free_batch(ctx);
+}
+
+// db.exec_batch(conn, sql, {{...}, {...}}) -> {affected_rows, last_insert_id, counts} | nil, err
+int lunet_db_exec_batch(lua_State* L) {
+  if (lunet_ensure_coroutine(L, "db.exec_batch")) {
+    return lua_error(L);
+  }
+  if (lua_gettop(L) < 3 || !lua_istable(L, 3)) {
+    lua_pushnil(L);
+    lua_pushstring(L, "db.exec_batch requires connection, sql string and rows table");
+    return 2;
+  }
+
+  lunet_sqlite_conn_t* wrapper = NULL;
+  db_pool_t* pool = NULL;
+  if (resolve_target(L, "db.exec_batch", &wrapper, &pool)) {
+    return 2;
+  }
+
+  const char* query = luaL_checkstring(L, 2);
+
+  db_batch_ctx_t* ctx = lunet_alloc(sizeof(db_batch_ctx_t));
+  if (!ctx) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->L = L;
+  ctx->req.data = ctx;
+  ctx->wrapper = wrapper;
+  ctx->pin_ref = LUA_NOREF;
+  ctx->query = lunet_strdup_local(query);
+  if (!ctx->query) {
+    lunet_free_nonnull(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+
+  const char* err = collect_batch(L, 3, ctx);
+  if (err) {
+    free_batch(ctx);
+    lua_pushnil(L);
+    lua_pushfstring(L, "db.exec_batch: %s", err);
+    return 2;
+  }
+
+  lunet_coref_create(L, ctx->co_ref);
+
+  int ret = db_pool_queue_work(pool, &ctx->pw, &ctx->req, db_batch_work_cb, db_batch_after_cb, ctx->err, sizeof(ctx->err));
+  if (ret < 0) {
+    lunet_coref_release(L, ctx->co_ref);
+    free_batch(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, db_pool_strerror(pool, ret));
+    return 2;
+  }
+
+  return lua_yield(L, 0);
+}
+
+/*
+ * Cursors (db.cursor)
+ *
+ * A cursor owns its own uncached statement and steps it at most batch_size
+ * rows per cursor:next(), so only one batch is ever held in C and in Lua.
+ * SQLite allows several live statements per connection, so cursors do not
+ * block other queries; db.close() finalizes any cursor still open.
+ */
+
+#define DB_CURSOR_DEFAULT_BATCH 100
+#define DB_CURSOR_MAX_BATCH 10000
+
+struct lunet_sqlite_cursor {
+  lunet_sqlite_cursor_t* prev;
+  lunet_sqlite_cursor_t* next;
+  lunet_sqlite_conn_t* wrapper;  // NULL once exhausted, closed or detached
+  sqlite3_stmt* stmt;            // prepared on the first fetch
+  char* query;
+  param_t* params;
+  int nparams;
+  char** col_names;
+  int* col_types;                // taken from the first row, like db.query
+  int ncols;
+  int typed;
+  int done;
+  int busy;                      // a fetch or close is in flight (loop thread only)
+};
+
+// Caller holds wrapper->mutex
+static void cursor_finish(lunet_sqlite_cursor_t* cur) {
+  lunet_sqlite_conn_t* wrapper = cur->wrapper;
+  if (!wrapper) return;
+  if (cur->stmt) {
+    sqlite3_finalize(cur->stmt);
+    cur->stmt = NULL;
+  }
+  if (cur->prev) cur->prev->next = cur->next;
+  else wrapper->cursors = cur->next;
+  if (cur->next) cur->next->prev = cur->prev;
+  cur->prev = cur->next = NULL;
+  cur->wrapper = NULL;
+}
+
+static void cursors_detach(lunet_sqlite_conn_t* wrapper) {
+  while (wrapper->cursors) cursor_finish(wrapper->cursors);
+}
+
+static void cursor_free_fields(lunet_sqlite_cursor_t* cur) {
+  for (int i = 0; i < cur->ncols; i++) lunet_free_nonnull(cur->col_names[i]);
+  if (cur->col_names) lunet_free(cur->col_names);
+  if (cur->col_types) lunet_free(cur->col_types);
+  cur->ncols = 0;
+  if (cur->query) lunet_free(cur->query);
+  free_params(cur->params, NULL);
+  cur->params = NULL;
+  cur->nparams = 0;
+}
+
+// Only reached once no fetch is in flight: a busy cursor is on its coroutine's stack
+static int cursor_gc(lua_State* L) {
+  lunet_sqlite_cursor_t* cur = (lunet_sqlite_cursor_t*)luaL_checkudata(L, 1, LUNET_SQLITE_CURSOR_MT);
+  if (cur->wrapper) {
+    lunet_sqlite_conn_t* wrapper = cur->wrapper;
+    uv_mutex_lock(&wrapper->mutex);
+    cursor_finish(cur);
+    uv_mutex_unlock(&wrapper->mutex);
+  }
+  cursor_free_fields(cur);
+  return 0;
+}
+
+typedef struct {
+  uv_work_t req;
+  lua_State* L;
+  int co_ref;
+
+  lunet_sqlite_cursor_t* cursor;
+  lunet_sqlite_conn_t* wrapper;
+  int limit;  // 0 closes the cursor
+  char*** rows;
+  int nrows;
+  char err[256];
+
+  int arena_live;
+  lunet_arena_t arena;  // rows and cells of this fetch
+  char arena_buf[DB_ARENA_INLINE];
+} db_cursor_ctx_t;
+
+// Caller holds wrapper->mutex
+static int cursor_start(lunet_sqlite_cursor_t* cur, char* err, size_t errsize) {
+  sqlite3* conn = cur->wrapper->conn;
+  if (sqlite3_prepare_v2(conn, cur->query, -1, &cur->stmt, NULL) != SQLITE_OK) {
+    snprintf(err, errsize, "%s", sqlite3_errmsg(conn));
+    return -1;
+  }
+  if (bind_params(cur->stmt, cur->params, cur->nparams, err, errsize) != SQLITE_OK) {
+    if (err[0] == '\0') snprintf(err, errsize, "bind failed: %s", sqlite3_errmsg(conn));
+    return -1;
+  }
+  // The strings stay pinned by the cursor's environment; only the array goes
+  free_params(cur->params, NULL);
+  cur->params = NULL;
+  cur->nparams = 0;
+
+  int ncols = sqlite3_column_count(cur->stmt);
+  if (ncols > 0) {
+    cur->col_names = lunet_calloc((size_t)ncols, sizeof(char*));
+    cur->col_types = lunet_calloc((size_t)ncols, sizeof(int));
+    if (!cur->col_names || !cur->col_types) {
+      snprintf(err, errsize, "out of memory");
+      return -1;
+    }
+    cur->ncols = ncols;
+    for (int i = 0; i < ncols; i++) {
+      const char* name = sqlite3_column_name(cur->stmt, i);
+      cur->col_names[i] = lunet_strdup_local(name ? name : "");
+      if (!cur->col_names[i]) {
+        snprintf(err, errsize, "out of memory");
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void db_cursor_work_cb(uv_work_t* req) {
+  db_cursor_ctx_t* ctx = (db_cursor_ctx_t*)req->data;
+  lunet_sqlite_cursor_t* cur = ctx->cursor;
+
+  uv_mutex_lock(&ctx->wrapper->mutex);
+  if (!cur->wrapper || ctx->wrapper->closed || !ctx->wrapper->conn) {
+    if (ctx->limit > 0) snprintf(ctx->err, sizeof(ctx->err), "connection is closed");
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+  if (ctx->limit == 0) {
+    cursor_finish(cur);
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+  if (!cur->stmt && cursor_start(cur, ctx->err, sizeof(ctx->err)) != 0) {
+    cursor_finish(cur);
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+
+  lunet_arena_t* arena = &ctx->arena;
+  lunet_arena_init_buf(arena, ctx->arena_buf, sizeof(ctx->arena_buf), 0);
+  ctx->arena_live = 1;
+  int capacity = ctx->limit < 16 ? ctx->limit : 16;
+  ctx->rows = lunet_arena_alloc(arena, sizeof(char**) * capacity);
+  if (!ctx->rows) {
+    snprintf(ctx->err, sizeof(ctx->err), "out of memory");
+    uv_mutex_unlock(&ctx->wrapper->mutex);
+    return;
+  }
+
+  int rc = SQLITE_ROW;
+  while (ctx->nrows < ctx->limit && (rc = sqlite3_step(cur->stmt)) == SQLITE_ROW) {
+    if (ctx->nrows >= capacity) {
+      int grown = capacity * 2 < ctx->limit ? capacity * 2 : ctx->limit;
+      char*** new_rows = lunet_arena_realloc(arena, ctx->rows, sizeof(char**) * capacity,
+                                             sizeof(char**) * grown);
+      if (!new_rows) {
+        snprintf(ctx->err, sizeof(ctx->err), "out of memory");
+        break;
+      }
+      capacity = grown;
+      ctx->rows = new_rows;
+    }
+    char** row = lunet_arena_calloc(arena, (size_t)(cur->ncols ? cur->ncols : 1), sizeof(char*));
+    if (!row) {
+      snprintf(ctx->err, sizeof(ctx->err), "out of memory");
+      break;
+    }
+    int alloc_failed = 0;
+    for (int i = 0; i < cur->ncols; i++) {
+      int t = sqlite3_column_type(cur->stmt, i);
+      if (!cur->typed) cur->col_types[i] = t;
+      if (t == SQLITE_NULL) continue;
+      const char* val = (const char*)sqlite3_column_text(cur->stmt, i);
+      if (val && !(row[i] = lunet_arena_strdup(arena, val))) {
+        alloc_failed = 1;
+        break;
+      }
+    }
+    cur->typed = 1;
+    if (alloc_failed) {
+      snprintf(ctx->err, sizeof(ctx->err), "out of memory");
+      break;
+    }
+    ctx->rows[ctx->nrows++] = row;
+  }
+
+  if (ctx->err[0] == '\0' && rc != SQLITE_ROW) {
+    if (rc == SQLITE_DONE) cur->done = 1;
+    else snprintf(ctx->err, sizeof(ctx->err), "%s", sqlite3_errmsg(ctx->wrapper->conn));
+  }
+  // An exhausted or failed cursor releases its statement right away
+  if (cur->done || ctx->err[0] != '\0') cursor_finish(cur);
+  uv_mutex_unlock(&ctx->wrapper->mutex);
+}
+
+static void db_cursor_after_cb(uv_work_t* req, int status) {
+  db_cursor_ctx_t* ctx = (db_cursor_ctx_t*)req->data;
+  lunet_sqlite_cursor_t* cur = ctx->cursor;
+  lua_State* L = ctx->L;
+  const char* fname = ctx->limit > 0 ? "cursor:next" : "cursor:close";
+  cur->busy = 0;
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
+  lunet_coref_release(L, ctx->co_ref);
+  if (!lua_isthread(L, -1)) {
+    lua_pop(L, 1);
+    fprintf(stderr, "invalid coroutine in %s\n", fname);
+    goto cleanup;
+  }
+  lua_State* co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+
+  if (ctx->err[0] != '\0') {
+    lua_pushnil(co);
+    lua_pushstring(co, ctx->err);
+  } else if (ctx->limit > 0) {
+    push_rows(co, cur->col_names, cur->col_types, cur->ncols, ctx->rows, ctx->nrows, NULL);
+    lua_pushnil(co);
+  } else {
+    lua_pushnil(co);
+    lua_pushnil(co);
+  }
+  {
+    int rc = lunet_co_resume(co, 2);
+    if (rc != 0 && rc != LUA_YIELD) {
+      const char* err = lua_tostring(co, -1);
+      if (err) fprintf(stderr, "lua_resume error in %s: %s\n", fname, err);
+      lua_pop(co, 1);
+    }
+  }
+
+cleanup:
+  if (ctx->arena_live) lunet_arena_destroy(&ctx->arena);
+  lunet_free_nonnull(ctx);
+}
+
+// Queue a fetch of up to limit rows, or a close when limit is 0
+static int cursor_queue(lua_State* L, lunet_sqlite_cursor_t* cur, int limit) {
+  db_cursor_ctx_t* ctx = lunet_alloc(sizeof(db_cursor_ctx_t));
+  if (!ctx) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->L = L;
+  ctx->req.data = ctx;
+  ctx->cursor = cur;
+  ctx->wrapper = cur->wrapper;
+  ctx->limit = limit;
+
+  lunet_coref_create(L, ctx->co_ref);
+  int ret = lunet_exec_queue(LUNET_EXEC_DB, &ctx->req, db_cursor_work_cb, db_cursor_after_cb);
+  if (ret < 0) {
+    lunet_coref_release(L, ctx->co_ref);
+    lunet_free_nonnull(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, lunet_exec_strerror(LUNET_EXEC_DB, ret));
+    return 2;
+  }
+  cur->busy = 1;
+  return lua_yield(L, 0);
+}
+
+// cursor:next([batch_size]) -> rows (empty once exhausted) | nil, err
+static int cursor_next(lua_State* L) {
+  if (lunet_ensure_coroutine(L, "cursor:next")) {
+    return lua_error(L);
+  }
+  lunet_sqlite_cursor_t* cur = (lunet_sqlite_cursor_t*)luaL_checkudata(L, 1, LUNET_SQLITE_CURSOR_MT);
+  lua_Integer n = luaL_optinteger(L, 2, DB_CURSOR_DEFAULT_BATCH);
+  if (n < 1) n = 1;
+  if (n > DB_CURSOR_MAX_BATCH) n = DB_CURSOR_MAX_BATCH;
+  // The worker owns the cursor state while a request is in flight
+  if (cur->busy) {
+    lua_pushnil(L);
+    lua_pushstring(L, "cursor:next: cursor is busy");
+    return 2;
+  }
+  if (cur->done) {
+    lua_newtable(L);
+    return 1;
+  }
+  if (!cur->wrapper) {
+    lua_pushnil(L);
+    lua_pushstring(L, "cursor is closed");
+    return 2;
+  }
+  return cursor_queue(L, cur, (int)n);
+}
+
+// cursor:close() -> nil | err. Releases the statement without reading the rest.
+static int cursor_close(lua_State* L) {
+  if (lunet_ensure_coroutine(L, "cursor:close")) {
+    return lua_error(L);
+  }
+  lunet_sqlite_cursor_t* cur = (lunet_sqlite_cursor_t*)luaL_checkudata(L, 1, LUNET_SQLITE_CURSOR_MT);
+  if (cur->busy) {
+    lua_pushstring(L, "cursor:close: cursor is busy");
+    return 1;
+  }
+  if (!cur->wrapper) {
+    lua_pushnil(L);
+    return 1;
+  }
+  int n = cursor_queue(L, cur, 0);
+  if (n == 2) {
+    lua_remove(L, -2);  // (nil, err) -> err
+    return 1;
+  }
+  return n;
+}
+
+static void register_cursor_metatable(lua_State* L) {
+  if (luaL_newmetatable(L, LUNET_SQLITE_CURSOR_MT)) {
+    lua_pushcfunction(L, cursor_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_createtable(L, 0, 2);
+    lua_pushcfunction(L, cursor_next);
+    lua_setfield(L, -2, "next");
+    lua_pushcfunction(L, cursor_close);
+    lua_setfield(L, -2, "close");
+    lua_setfield(L, -2, "__index");
+  }
+  lua_pop(L, 1);
+}
+
+// db.cursor(conn, sql, ...) -> cursor | nil, err
+// The query runs on the first cursor:next(); pools are not accepted because a
+// cursor has to stay on one connection across many fetches.
+int lunet_db_cursor(lua_State* L) {
+  lunet_sqlite_conn_t* wrapper = (lunet_sqlite_conn_t*)luaL_testudata(L, 1, LUNET_SQLITE_CONN_MT);
+  if (!wrapper) {
+    lua_pushnil(L);
+    lua_pushstring(L, "db.cursor requires a connection (not a pool)");
+    return 2;
+  }
+  if (wrapper->closed || !wrapper->conn) {
+    lua_pushnil(L);
+    lua_pushstring(L, "connection is closed");
+    return 2;
+  }
+  const char* query = luaL_checkstring(L, 2);
+  register_cursor_metatable(L);
+
+  int nparams = 0;
+  param_t* params = collect_params(L, 3, &nparams, NULL);
+  if (nparams < 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  char* copy = lunet_strdup_local(query);
+  if (!copy) {
+    free_params(params, NULL);
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+
+  lunet_sqlite_cursor_t* cur = (lunet_sqlite_cursor_t*)lua_newuserdata(L, sizeof(lunet_sqlite_cursor_t));
+  memset(cur, 0, sizeof(*cur));
+  cur->query = copy;
+  cur->params = params;
+  cur->nparams = nparams;
+  luaL_getmetatable(L, LUNET_SQLITE_CURSOR_MT);
+  lua_setmetatable(L, -2);
+  // The environment table keeps the connection and the borrowed string
+  // parameters alive for as long as the cursor
+  lua_createtable(L, 1 + nparams, 0);
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, -2, 1);
+  for (int i = 0; i < nparams; i++) {
+    lua_pushvalue(L, 3 + i);
+    lua_rawseti(L, -2, 2 + i);
+  }
+  lua_setfenv(L, -2);
+
+  uv_mutex_lock(&wrapper->mutex);
+  cur->wrapper = wrapper;
+  cur->next = wrapper->cursors;
+  if (wrapper->cursors) wrapper->cursors->prev = cur;
+  wrapper->cursors = cur;
+  uv_mutex_unlock(&wrapper->mutex);
+  return 1;
+}
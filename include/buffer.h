@@ -0,0 +1,63 @@
+#ifndef LUNET_BUFFER_H
+#define LUNET_BUFFER_H
+
+#include <stddef.h>
+
+#include "lunet_lua.h"
+
+/*
+ * lunet.buffer: mutable byte buffers that I/O reads into and writes from
+ * without a trip through Lua strings.
+ *
+ * The bytes live in a refcounted store. A buffer userdata is a view (pointer
+ * and length) onto one store, and buf:sub() makes another view of the same
+ * bytes. Driver modules link their own copy of this file, so views are
+ * recognised by metatable name and every store carries the function that
+ * frees it with the allocator that made it.
+ *
+ * Stores are owned by one Lua state; the counts are not atomic.
+ */
+
+#define LUNET_BUFFER_MT "lunet.buffer"
+
+typedef struct lunet_buffer_store_s lunet_buffer_store_t;
+struct lunet_buffer_store_s {
+  int refs;
+  size_t size;
+  void (*release)(lunet_buffer_store_t *store);
+  /* size bytes follow */
+};
+
+typedef struct {
+  lunet_buffer_store_t *store;
+  char *data;
+  size_t len;
+} lunet_buffer_t;
+
+/* New store of size uninitialised bytes with one reference, or NULL */
+lunet_buffer_store_t *lunet_buffer_store_new(size_t size);
+
+static inline char *lunet_buffer_store_data(lunet_buffer_store_t *store) {
+  return (char *)(store + 1);
+}
+
+static inline void lunet_buffer_store_release(lunet_buffer_store_t *store) {
+  if (--store->refs == 0) store->release(store);
+}
+
+/* Push a view of len bytes at data inside store; takes over one reference */
+lunet_buffer_t *lunet_buffer_push(lua_State *L, lunet_buffer_store_t *store, char *data,
+                                  size_t len);
+
+/* The buffer at idx, or NULL if it is something else */
+lunet_buffer_t *lunet_buffer_test(lua_State *L, int idx);
+
+/*
+ * Bytes of the buffer or string at idx (numbers convert as with
+ * lua_tolstring), or NULL for anything else. Valid while the value is.
+ */
+const char *lunet_buffer_tobytes(lua_State *L, int idx, size_t *len);
+
+int lunet_open_buffer(lua_State *L);
+
+#endif  // LUNET_BUFFER_H
@@ -3,6 +3,12 @@
 
 #include "lunet_lua.h"
 
+/*
+ * Spawn a coroutine running the function at index 1. Threads that finished
+ * with LUA_OK are recycled from a bounded per-state pool (LUNET_CO_POOL,
+ * default 256, 0 disables), so code must not keep resuming a spawned
+ * coroutine after it returned.
+ */
 int lunet_spawn(lua_State *L);
 
 /*
@@ -15,10 +21,17 @@ void lunet_co_unanchor(lua_State *co);
  * Resume a coroutine and automatically unanchor it if it finishes.
  * Returns the status from lua_resume (LUA_OK, LUA_YIELD, or error).
  * If the coroutine finishes (anything other than LUA_YIELD), it is
- * unanchored so GC can collect it.
+ * unanchored so GC can collect it, or returned to the spawn pool if it
+ * finished with LUA_OK and the pool has room.
  */
 int lunet_co_resume(lua_State *co, int nargs);
 
+#ifdef LUNET_TRACE
+void lunet_co_trace_summary(void);
+#else
+static inline void lunet_co_trace_summary(void) {}
+#endif
+
 /*
  * Internal: Do not call directly - use lunet_ensure_coroutine() instead.
  * 
@@ -0,0 +1,125 @@
+#ifndef DB_POOL_H
+#define DB_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <uv.h>
+
+#include "lunet_lua.h"
+
+/*
+ * Connection pool shared by the DB drivers (db.pool).
+ *
+ * All pool bookkeeping runs on the loop thread. A pooled request waits in the
+ * pool's FIFO until a connection is idle and only then goes to the thread
+ * pool, so no worker thread ever blocks on a connection mutex held by another
+ * query. Drivers plug in through db_pool_ops_t and embed a db_pool_waiter_t
+ * in each request context.
+ */
+
+#define DB_POOL_MAX_CONNS 256
+#define DB_POOL_DEFAULT_MAX 8
+#define DB_POOL_DEFAULT_CHECK_MS 30000
+
+typedef struct db_pool db_pool_t;
+
+typedef enum {
+  DB_POOL_OK = 0,
+  DB_POOL_STALE,   // health check failed before the request ran: retry once
+  DB_POOL_LOST,    // connection died while the request ran: drop it
+  DB_POOL_FAILED,  // request never got a connection (pool closed / open failed)
+} db_pool_status_t;
+
+typedef struct db_pool_waiter {
+  struct db_pool_waiter* next;
+  db_pool_t* pool;  // NULL when the request targets a plain connection
+  uv_work_t* req;
+  uv_work_cb work_cb;
+  uv_after_work_cb after_cb;
+  char* err;        // request error buffer, filled on DB_POOL_FAILED
+  size_t errsize;
+  void* conn;       // driver connection handed out by the pool
+  int slot;
+  int retried;
+  db_pool_status_t status;
+  uint64_t enqueued_ns;
+  uint64_t idle_ns;  // how long conn sat idle before this checkout
+} db_pool_waiter_t;
+
+typedef struct {
+  // Start opening a connection; the driver must call db_pool_opened(slot) later
+  int (*open)(db_pool_t* pool, int slot);
+  // Close a connection dropped from the pool and release its registry ref
+  void (*discard)(db_pool_t* pool, void* conn, int ref);
+  // Free the driver's connect parameters (pool->ud)
+  void (*destroy)(db_pool_t* pool);
+} db_pool_ops_t;
+
+typedef struct {
+  void* conn;
+  int ref;
+  int state;
+  uint64_t last_used_ns;
+} db_pool_slot_t;
+
+struct db_pool {
+  const db_pool_ops_t* ops;
+  void* ud;
+  lua_State* L;       // main state, owns the connection refs
+  int min;
+  int max;
+  int closed;
+  int orphaned;       // Lua handle collected; free once the last request drains
+  db_pool_slot_t* slots;
+  int* idle;          // LIFO so the warmest connection is reused first
+  int nidle;
+  int nopen;
+  int nopening;
+  int nbusy;
+  db_pool_waiter_t* wait_head;
+  db_pool_waiter_t* wait_tail;
+  int nwaiting;
+  uint64_t check_ns;  // ping connections idle for longer than this
+  char last_error[256];
+
+  uint64_t acquired;
+  uint64_t waited;
+  uint64_t wait_ns_total;
+  uint64_t wait_ns_max;
+  uint64_t opened;
+  uint64_t open_failures;
+  uint64_t dropped;
+};
+
+// Reads {min, max, check_ms} from the options table at idx (if any)
+void db_pool_parse_opts(lua_State* L, int idx, int* min, int* max, int* check_ms);
+
+db_pool_t* db_pool_create(lua_State* L, int min, int max, int check_ms, const db_pool_ops_t* ops, void* ud);
+
+// Pushes a userdata handle for pool with metatable mt (created on first use)
+void db_pool_push(lua_State* L, db_pool_t* pool, const char* mt);
+db_pool_t* db_pool_test(lua_State* L, int idx, const char* mt);
+
+// Open connections until min are open or opening
+void db_pool_fill(db_pool_t* pool);
+
+// Queue req on a pooled connection, or straight on the loop for pool == NULL
+int db_pool_queue_work(db_pool_t* pool, db_pool_waiter_t* w, uv_work_t* req,
+                       uv_work_cb work_cb, uv_after_work_cb after_cb, char* err, size_t errsize);
+
+// Error text for a failed db_pool_queue_work(), preferring the last connect error
+const char* db_pool_strerror(const db_pool_t* pool, int rc);
+
+// Call first thing in the after callback. Returns 1 if the request was
+// re-queued on a fresh connection and the callback must return immediately.
+int db_pool_release(db_pool_waiter_t* w);
+
+// Driver report for db_pool_ops_t.open; conn == NULL means the open failed
+void db_pool_opened(db_pool_t* pool, int slot, void* conn, int ref, const char* err);
+
+// Fail waiters, close idle connections; busy ones close as they come back
+void db_pool_close(db_pool_t* pool);
+
+void db_pool_push_stats(lua_State* L, const db_pool_t* pool);
+
+#endif  // DB_POOL_H
@@ -0,0 +1,54 @@
+#ifndef DB_RESULT_H
+#define DB_RESULT_H
+
+#include "lunet_lua.h"
+
+/*
+ * Result encoding shared by the DB drivers (db.query {shape = ...}).
+ *
+ *   "rows"    (default) {{id = 1, name = "a"}, ...}
+ *   "arrays"  {columns = {"id", "name"}, nrows = n, rows = {{1, "a"}, ...}}
+ *   "columns" {columns = {"id", "name"}, nrows = n, values = {{1, ...}, {"a", ...}}}
+ *
+ * The compact shapes allocate one table per row or per column instead of one
+ * hash per row, and never repeat the column names. With {ffi = true} the
+ * "columns" shape returns integer and float columns without NULLs as LuaJIT
+ * int64_t[?] / double[?] cdata (0-based) so numeric cells are not boxed.
+ */
+
+typedef enum {
+  DB_SHAPE_ROWS = 0,
+  DB_SHAPE_ARRAYS,
+  DB_SHAPE_COLUMNS,
+} db_shape_t;
+
+typedef struct {
+  db_shape_t shape;
+  int ffi;
+} db_result_opts_t;
+
+typedef enum {
+  DB_COL_TEXT = 0,
+  DB_COL_INT,
+  DB_COL_FLOAT,
+  DB_COL_BOOL,
+} db_col_kind_t;
+
+// Read-only view of a driver's materialized result
+typedef struct {
+  int nrows;
+  int ncols;
+  void* ud;
+  const char* (*name)(void* ud, int col);
+  db_col_kind_t (*kind)(void* ud, int col);
+  const char* (*value)(void* ud, int row, int col);  // NULL for SQL NULL
+} db_result_t;
+
+// Pops a trailing options table at or after index first, if there is one.
+// Returns NULL, or an error message for an unknown shape.
+const char* db_result_parse_opts(lua_State* L, int first, db_result_opts_t* opts);
+
+// Pushes r encoded as opts asks (opts == NULL means rows)
+void db_result_push(lua_State* co, const db_result_t* r, const db_result_opts_t* opts);
+
+#endif  // DB_RESULT_H
@@ -8,17 +8,36 @@
 #define LUNET_EMBED_PATH_MAX 4096
 #endif
 
+/*
+ * Embedded script pack (release builds with --lunet_embed_scripts=y).
+ *
+ * By default nothing touches the disk: prepare indexes the pack in place and
+ * installs a package.loaders entry that inflates and loads a module on its
+ * first require. A pack holding anything besides .lua files (native
+ * modules, data read next to the scripts) is instead extracted to a private
+ * temp dir (out_dir) and package.path/cpath point at it; LUNET_EMBED_EXTRACT=1
+ * or =0 forces either mode.
+ */
 int lunet_embed_scripts_prepare(lua_State *L,
                                 char *out_dir,
                                 size_t out_dir_len,
                                 char *err,
                                 size_t err_len);
 
-int lunet_embed_scripts_resolve_script(const char *embed_dir,
-                                       const char *script_arg,
-                                       char *out_script,
-                                       size_t out_script_len,
-                                       char *err,
-                                       size_t err_len);
+/* Set up another Lua state the same way; embed_dir is prepare's out_dir. */
+int lunet_embed_scripts_attach(lua_State *L,
+                               const char *embed_dir,
+                               char *err,
+                               size_t err_len);
+
+/*
+ * Load script_arg from the pack as a chunk. Returns 1 with the function
+ * pushed, 0 if the script is not embedded (run it from disk), -1 on error.
+ */
+int lunet_embed_scripts_load_script(lua_State *L,
+                                    const char *embed_dir,
+                                    const char *script_arg,
+                                    char *err,
+                                    size_t err_len);
 
 #endif /* LUNET_EMBED_SCRIPTS_H */
@@ -3,7 +3,7 @@
 
 #include <stddef.h>
 
-extern const unsigned char lunet_embedded_scripts_gzip[];
-extern const size_t lunet_embedded_scripts_gzip_len;
+extern const unsigned char lunet_embedded_scripts_pack[];
+extern const size_t lunet_embedded_scripts_pack_len;
 
 #endif /* LUNET_EMBED_SCRIPTS_BLOB_H */
@@ -0,0 +1,62 @@
+#ifndef LUNET_EXECUTOR_H
+#define LUNET_EXECUTOR_H
+
+#include <uv.h>
+
+#include "lunet_lua.h"
+
+/*
+ * Dedicated executors for blocking work.
+ *
+ * uv_queue_work shares one small thread pool with uv_fs_*, so a few slow SQL
+ * queries or CPU-bound jobs used to stall every fs.read in the process. Each
+ * subsystem now gets its own threads and a bounded FIFO; fs stays on the libuv
+ * pool. Completions come back to the submitting loop through a uv_async_t, so
+ * callers keep the uv_work_t / after_cb shape they had with uv_queue_work.
+ *
+ * Sizing is read once from the environment:
+ *   LUNET_DB_THREADS,  LUNET_DB_QUEUE   (default 4 threads, 1024 queued)
+ *   LUNET_CPU_THREADS, LUNET_CPU_QUEUE  (default: one per CPU, 1024 queued)
+ */
+
+#define LUNET_EXEC_MAX_THREADS 64
+#define LUNET_EXEC_DEFAULT_THREADS 4
+#define LUNET_EXEC_DEFAULT_QUEUE 1024
+
+typedef enum {
+  LUNET_EXEC_DB = 0,
+  LUNET_EXEC_CPU,
+  LUNET_EXEC_COUNT
+} lunet_exec_kind_t;
+
+/*
+ * Run work_cb(req) on the executor, then after_cb(req, 0) on the calling
+ * thread's loop. Returns 0, UV_EAGAIN when the queue is full, UV_ECANCELED
+ * after lunet_exec_shutdown(), or UV_ENOMEM. req->data is left to the caller.
+ */
+int lunet_exec_queue(lunet_exec_kind_t kind, uv_work_t *req, uv_work_cb work_cb,
+                     uv_after_work_cb after_cb);
+
+/* Error text for a failed lunet_exec_queue() */
+const char *lunet_exec_strerror(lunet_exec_kind_t kind, int rc);
+
+/*
+ * Stop and join the executor threads once no loop will run again. Queued jobs
+ * are dropped and jobs still running are not delivered: neither gets its
+ * after_cb. Idempotent; later lunet_exec_queue() calls fail.
+ */
+void lunet_exec_shutdown(void);
+
+/*
+ * Count L as a user of the executors; when the last attached state is closed
+ * they are shut down, before lua_close unloads the module that queued work.
+ */
+void lunet_exec_attach(lua_State *L);
+
+/*
+ * Pushes {name, threads, queue_max, queued, running, submitted, completed,
+ * rejected, wait_ms_total, wait_ms_max, run_ms_total}
+ */
+void lunet_exec_push_stats(lua_State *L, lunet_exec_kind_t kind);
+
+#endif  // LUNET_EXECUTOR_H
@@ -7,8 +7,16 @@ int lunet_fs_open(lua_State *L);
 int lunet_fs_close(lua_State *L);
 int lunet_fs_read(lua_State *L);
 int lunet_fs_write(lua_State *L);
+int lunet_fs_pread(lua_State *L);
+int lunet_fs_pwrite(lua_State *L);
+int lunet_fs_preadv(lua_State *L);
+int lunet_fs_pwritev(lua_State *L);
 int lunet_fs_stat(lua_State *L);
 int lunet_fs_scandir(lua_State *L);
+int lunet_fs_mmap(lua_State *L);
+int lunet_fs_readfile(lua_State *L);
+int lunet_fs_writefile(lua_State *L);
+int lunet_fs_walk(lua_State *L);
 
 #ifdef LUNET_TRACE
 void lunet_fs_trace_summary(void);
@@ -86,4 +86,73 @@ static inline void lunet_mem_assert_balanced(const char *context) { (void)contex
 
 #endif /* LUNET_TRACE || LUNET_EASY_MEMORY */
 
+/*
+ * Arena (bump) allocator for request-scoped memory.
+ *
+ * An arena hands out 16-byte aligned chunks from blocks obtained with
+ * lunet_alloc and releases everything at once with lunet_arena_destroy (or
+ * lunet_arena_reset to keep one block for reuse). Nothing is freed
+ * individually. Attach one to a connection or work request whose transient
+ * allocations all die together; an arena is owned by one thread at a time.
+ *
+ * lunet_arena_init_buf starts from caller storage (e.g. an array inside the
+ * request struct), so small requests never touch malloc.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#define LUNET_ARENA_ALIGN 16
+#define LUNET_ARENA_DEFAULT_BLOCK 4096
+
+typedef struct lunet_arena_block lunet_arena_block_t;
+
+typedef struct {
+    char *ptr;                  /* next free byte */
+    char *end;
+    void *last;                 /* most recent chunk, may grow in place */
+    lunet_arena_block_t *head;  /* owned blocks, newest first */
+    lunet_arena_block_t *spare; /* block kept by lunet_arena_reset */
+    char *buf;                  /* caller storage, not freed */
+    size_t buf_len;
+    size_t block_size;
+    size_t used;                /* bytes handed out since init/reset */
+    size_t capacity;            /* buf_len + bytes of owned blocks in use */
+} lunet_arena_t;
+
+/* Process-wide counters of the arenas of this module */
+typedef struct {
+    uint64_t arenas;            /* lunet_arena_init* calls */
+    uint64_t active;            /* arenas not destroyed yet */
+    uint64_t blocks;            /* blocks allocated */
+    uint64_t oversize;          /* of which dedicated to one large chunk */
+    uint64_t reserved_bytes;    /* block bytes currently allocated */
+    uint64_t peak_reserved_bytes;
+    uint64_t peak_arena_bytes;  /* most bytes one arena handed out */
+    uint64_t used_bytes;        /* handed out, summed over finished arenas */
+    uint64_t capacity_bytes;    /* space they had; used/capacity = fill ratio */
+} lunet_arena_stats_t;
+
+void lunet_arena_init(lunet_arena_t *a, size_t block_size);
+void lunet_arena_init_buf(lunet_arena_t *a, void *buf, size_t len, size_t block_size);
+void *lunet_arena_alloc_slow(lunet_arena_t *a, size_t size);
+void *lunet_arena_calloc(lunet_arena_t *a, size_t count, size_t size);
+/* Grows in place when ptr is the latest chunk; old_size bytes are kept */
+void *lunet_arena_realloc(lunet_arena_t *a, void *ptr, size_t old_size, size_t new_size);
+char *lunet_arena_strdup(lunet_arena_t *a, const char *s);
+void lunet_arena_reset(lunet_arena_t *a);
+void lunet_arena_destroy(lunet_arena_t *a);
+void lunet_arena_stats(lunet_arena_stats_t *out);
+
+static inline void *lunet_arena_alloc(lunet_arena_t *a, size_t size) {
+    size_t need = (size + (LUNET_ARENA_ALIGN - 1)) & ~(size_t)(LUNET_ARENA_ALIGN - 1);
+    if (need >= size && need > 0 && (size_t)(a->end - a->ptr) >= need) {
+        void *p = a->ptr;
+        a->ptr += need;
+        a->used += need;
+        a->last = p;
+        return p;
+    }
+    return lunet_arena_alloc_slow(a, size);
+}
+
 #endif /* LUNET_MEM_H */
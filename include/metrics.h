@@ -0,0 +1,61 @@
+#ifndef LUNET_METRICS_H
+#define LUNET_METRICS_H
+
+#include <stdint.h>
+#include <uv.h>
+
+#include "lunet_lua.h"
+
+/*
+ * Always-on runtime metrics behind lunet.metrics().
+ *
+ * Every latency is recorded into a log-linear histogram (HDR style: 8
+ * sub-buckets per power of two of microseconds, so any value is known to
+ * within 12.5%, up to ~70 minutes). Recording is a handful of integer ops on
+ * thread-local counters, with no locks and no allocation.
+ *
+ * Driver modules link their own copy of this file, so each copy registers
+ * its thread-local block with the Lua state (lunet_metrics_attach, next to
+ * lunet_rt_bind) and lunet.metrics() sums the blocks of the calling worker.
+ */
+
+typedef enum {
+  LUNET_METRIC_LOOP_LAG = 0,   /* busy time of one loop iteration */
+  LUNET_METRIC_SOCKET_READ,    /* time a socket.read* call waited */
+  LUNET_METRIC_SOCKET_WRITE,   /* time a socket.write* call waited */
+  LUNET_METRIC_FS,             /* submit to completion of an fs call */
+  LUNET_METRIC_DB_QUEUE,       /* DB job waiting for an executor thread */
+  LUNET_METRIC_DB_EXEC,        /* DB job running */
+  LUNET_METRIC_CPU_QUEUE,
+  LUNET_METRIC_CPU_EXEC,
+  LUNET_METRIC_HTTPC,          /* httpc request start to completion */
+  LUNET_METRIC_COUNT
+} lunet_metric_t;
+
+void lunet_metrics_record(lunet_metric_t metric, uint64_t ns);
+
+static inline void lunet_metrics_since(lunet_metric_t metric, uint64_t start_ns) {
+  lunet_metrics_record(metric, uv_hrtime() - start_ns);
+}
+
+/* Counts one lunet_co_resume / lunet_spawn outcome */
+void lunet_metrics_resume(int status);
+void lunet_metrics_spawn(void);
+
+/* Register this module's counters with L's worker (idempotent) */
+void lunet_metrics_attach(lua_State *L);
+
+/*
+ * Loop lag probes (uv_prepare/uv_check, unref'd). Start before uv_run; stop
+ * after it returns, which closes the handles so uv_loop_close succeeds.
+ */
+int lunet_metrics_loop_start(uv_loop_t *loop);
+void lunet_metrics_loop_stop(uv_loop_t *loop);
+
+/* lunet.metrics([{buckets = true}]) */
+int lunet_metrics(lua_State *L);
+
+/* lunet.hrtime(): monotonic clock in nanoseconds */
+int lunet_hrtime(lua_State *L);
+
+#endif  // LUNET_METRICS_H
@@ -19,7 +19,15 @@ int  paxe_is_enabled(void);
 void paxe_set_enabled(int enabled);
 
 /* Key management */
+/* The keystore is copy-on-write: every update publishes a new generation
+ * atomically, so decrypts on any thread never lock or see a torn key.
+ * Batch rotations through paxe_keystore_set_many to publish once. */
 int  paxe_keystore_set(uint32_t key_id, const uint8_t key[32]);
+int  paxe_keystore_set_many(const uint32_t *key_ids, const uint8_t (*keys)[32], size_t n);
+int  paxe_keystore_remove(uint32_t key_id);
+int  paxe_keystore_reserve(size_t capacity);
+int  paxe_keystore_has(uint32_t key_id);
+size_t paxe_keystore_count(void);
 int  paxe_keystore_clear(void);
 void paxe_set_fail_policy(paxe_fail_policy_t policy);
 
@@ -31,6 +39,27 @@ ssize_t paxe_try_decrypt(uint8_t *buf, size_t len,
                          uint32_t *out_key_id, 
                          uint8_t *out_flags);
 
+/* Standard-mode encryption into out.
+ * Returns: packet length (len + PAXE_OVERHEAD_STD) on success, -1 on failure
+ * (unknown key, payload above 65535 bytes, or out_cap too small).
+ */
+#define PAXE_OVERHEAD_STD 36
+ssize_t paxe_encrypt(uint32_t key_id, const uint8_t *in, size_t len,
+                     uint8_t *out, size_t out_cap);
+
+/* UDP integration
+ * The paxe module lives in its own shared library, so lunet.udp reaches it
+ * through function pointers that luaopen_lunet_paxe publishes as a light
+ * userdata under PAXE_UDP_HOOKS_KEY in the registry.
+ */
+#define PAXE_UDP_HOOKS_KEY "lunet.paxe.udp_hooks"
+typedef struct {
+    ssize_t (*decrypt)(uint8_t *buf, size_t len, uint32_t *out_key_id, uint8_t *out_flags);
+    ssize_t (*encrypt)(uint32_t key_id, const uint8_t *in, size_t len,
+                       uint8_t *out, size_t out_cap);
+    size_t overhead;
+} paxe_udp_hooks_t;
+
 /* Statistics */
 typedef struct {
     uint64_t rx_total;
@@ -42,8 +71,21 @@ typedef struct {
     uint64_t rx_reserved_nonzero;
 } paxe_stats_t;
 
+/* Counters are kept in per-thread shards and summed on read. */
 void paxe_stats_get(paxe_stats_t *out);
 
+/* Decrypt latency histogram: bucket i counts calls that took
+ * [2^i, 2^(i+1)) ns; the last bucket is open-ended. */
+#define PAXE_LAT_BUCKETS 24
+typedef struct {
+    paxe_stats_t counters;
+    uint64_t latency[PAXE_LAT_BUCKETS];
+    uint64_t timestamp_ns;   /* uv_hrtime() at snapshot */
+} paxe_stats_snapshot_t;
+
+void paxe_stats_snapshot(paxe_stats_snapshot_t *out);
+void paxe_stats_reset(void);
+
 /* Tracing macros (zero-cost in release) */
 #ifdef LUNET_TRACE
 #include <stdio.h>
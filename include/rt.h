@@ -1,7 +1,38 @@
 #ifndef RT_H
 #define RT_H
 
+#include <uv.h>
+
 #include "lunet_lua.h"
+
+#if defined(_MSC_VER)
+#define LUNET_THREAD_LOCAL __declspec(thread)
+#else
+#define LUNET_THREAD_LOCAL __thread
+#endif
+
+/*
+ * Per-thread runtime context.
+ *
+ * Every worker thread (lunet --workers N) owns one main lua_State and one
+ * uv loop. Modules must use lunet_loop() instead of uv_default_loop() so their
+ * handles and work requests land on the calling worker's loop. Without
+ * workers, lunet_loop() is uv_default_loop().
+ */
 void set_default_luaL(lua_State *L);
 lua_State *default_luaL(void);
+
+void lunet_rt_set_loop(uv_loop_t *loop);
+uv_loop_t *lunet_loop(void);
+
+void lunet_rt_set_worker_id(int id);
+int lunet_worker_id(void);
+
+/*
+ * Driver modules (lunet-sqlite3, lunet-paxe, ...) link their own copy of the
+ * runtime. lunet_rt_publish stores the worker's loop in the Lua registry and
+ * lunet_rt_bind, called from their luaopen_*, picks it up on that thread.
+ */
+void lunet_rt_publish(lua_State *L);
+void lunet_rt_bind(lua_State *L);
 #endif // RT_H
@@ -4,6 +4,7 @@
 // Global runtime configuration flags
 typedef struct {
     int dangerously_skip_loopback_restriction;
+    int workers;  /* --workers N (0 or 1 = single loop) */
 } lunet_runtime_config_t;
 
 extern lunet_runtime_config_t g_lunet_config;
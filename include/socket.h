@@ -5,12 +5,26 @@
 
 int lunet_socket_listen(lua_State* L);
 int lunet_socket_accept(lua_State* L);
+int lunet_socket_accept_many(lua_State* L);
 int lunet_socket_getpeername(lua_State* L);
 int lunet_socket_close(lua_State* L);
 int lunet_socket_read(lua_State* L);
+int lunet_socket_read_stream(lua_State* L);
+int lunet_socket_read_until(lua_State* L);
+int lunet_socket_read_exact(lua_State* L);
+int lunet_socket_read_into(lua_State* L);
 int lunet_socket_write(lua_State* L);
+int lunet_socket_writev(lua_State* L);
+int lunet_socket_sendfile(lua_State* L);
 int lunet_socket_connect(lua_State* L);
+int lunet_socket_setopt(lua_State* L);
 int lunet_socket_set_read_buffer_size(lua_State* L);
+int lunet_socket_set_write_high_water(lua_State* L);
+int lunet_socket_set_close_timeout(lua_State* L);
+int lunet_socket_read_pool_stats(lua_State* L);
+
+/* Release buffers held by the read buffer pool (call after the loop stops). */
+void lunet_socket_pool_shutdown(void);
 
 #ifdef LUNET_TRACE
 void lunet_socket_trace_summary(void);
@@ -4,22 +4,23 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-// Queue node
-typedef struct queue_node_s {
-  void* data;
-  struct queue_node_s* next;
-} queue_node_t;
-
-// FIFO queue
+// FIFO queue backed by a power-of-two ring that grows and shrinks geometrically
 typedef struct {
-  queue_node_t* head;  // queue head (dequeue end)
-  queue_node_t* tail;  // queue tail (enqueue end)
-  size_t size;         // queue size
+  void** items;    // ring storage
+  size_t cap;      // ring capacity (0 or a power of two)
+  size_t head;     // index of the head element (dequeue end)
+  size_t size;     // queue size
+  size_t limit;    // hard capacity, 0 = unbounded
+  size_t dropped;  // enqueues rejected because the queue was at its limit
 } queue_t;
 
 queue_t* queue_init(void);
 void queue_destroy(queue_t* queue);
 
+// Cap the queue at limit elements (0 = unbounded); enqueue past it fails
+void queue_set_limit(queue_t* queue, size_t limit);
+size_t queue_dropped(queue_t* queue);
+
 int queue_enqueue(queue_t* queue, void* data);
 void* queue_dequeue(queue_t* queue);
 
@@ -27,4 +28,4 @@ void* queue_peek(queue_t* queue);
 bool queue_is_empty(queue_t* queue);
 size_t queue_size(queue_t* queue);
 
-#endif  // STL_H
\ No newline at end of file
+#endif  // STL_H
@@ -0,0 +1,58 @@
+#ifndef STMT_CACHE_H
+#define STMT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lunet_lua.h"
+
+// Per-connection LRU of prepared statements keyed by SQL text.
+// The cache is not thread safe: drivers only touch it with the connection
+// mutex held, which already serialises every statement on the connection.
+
+#define STMT_CACHE_DEFAULT_CAP 64
+#define STMT_CACHE_MAX_CAP 4096
+
+// Releases a driver statement handle (sqlite3_stmt*, MYSQL_STMT*, pg name)
+typedef void (*stmt_cache_free_fn)(void* stmt, void* ud);
+
+typedef struct stmt_cache_entry {
+  struct stmt_cache_entry* prev;  // towards most recently used
+  struct stmt_cache_entry* next;  // towards least recently used
+  uint64_t hash;
+  size_t sql_len;
+  void* stmt;
+  char sql[];
+} stmt_cache_entry_t;
+
+typedef struct {
+  stmt_cache_entry_t* head;  // most recently used
+  stmt_cache_entry_t* tail;  // least recently used
+  size_t count;
+  size_t cap;                // 0 disables caching
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  stmt_cache_free_fn free_fn;
+  void* ud;
+} stmt_cache_t;
+
+void stmt_cache_init(stmt_cache_t* cache, size_t cap, stmt_cache_free_fn free_fn, void* ud);
+
+// Returns the cached statement and marks it most recently used, or NULL
+void* stmt_cache_get(stmt_cache_t* cache, const char* sql, size_t sql_len);
+
+// Takes ownership of stmt, evicting the least recently used entry when full.
+// Returns -1 (ownership stays with the caller) if caching is disabled or OOM.
+int stmt_cache_put(stmt_cache_t* cache, const char* sql, size_t sql_len, void* stmt);
+
+// Drops and releases the entry for sql, e.g. after the server invalidated it
+void stmt_cache_evict(stmt_cache_t* cache, const char* sql, size_t sql_len);
+
+// Releases every cached statement; counters are kept
+void stmt_cache_clear(stmt_cache_t* cache);
+
+// Pushes {size, capacity, hits, misses, evictions} for db.stmt_cache_stats()
+void stmt_cache_push_stats(lua_State* L, const stmt_cache_t* cache);
+
+#endif  // STMT_CACHE_H
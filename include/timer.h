@@ -1,7 +1,44 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+#include <stdint.h>
+
 #include "lunet_lua.h"
+
+/*
+ * Loop timer wheel. Each loop thread keeps one hierarchical wheel (1 ms
+ * ticks; 256 + 3 x 64 slots covering ~18.6 h, longer timeouts are re-placed
+ * when they cascade) driven by a single uv_timer_t. Timers are intrusive, so
+ * start and stop are O(1) list operations with no allocation and no handle
+ * to close. The backing handle is closed whenever the wheel is empty, so an
+ * idle wheel never keeps the loop alive.
+ *
+ * The callback runs on the loop thread with the timer already inactive; it
+ * may start or stop any timer, including its own.
+ */
+typedef struct lunet_timer lunet_timer_t;
+typedef void (*lunet_timer_cb)(lunet_timer_t *timer);
+
+typedef struct lunet_timer_link {
+  struct lunet_timer_link *next;
+  struct lunet_timer_link *prev;
+} lunet_timer_link_t;
+
+struct lunet_timer {
+  lunet_timer_link_t link;  /* must stay first */
+  uint64_t due;             /* uv_now() ms */
+  lunet_timer_cb cb;
+  void *data;
+  int slot;                 /* -1 while inactive */
+};
+
+void lunet_timer_init(lunet_timer_t *timer, lunet_timer_cb cb, void *data);
+/* (Re)arms timer to fire timeout_ms after the loop's current time */
+int lunet_timer_start(lunet_timer_t *timer, uint64_t timeout_ms);
+void lunet_timer_stop(lunet_timer_t *timer);
+
+static inline int lunet_timer_active(const lunet_timer_t *timer) { return timer->slot >= 0; }
+
 int lunet_sleep(lua_State *L);
 
 #ifdef LUNET_TRACE
@@ -5,8 +5,16 @@
 
 int lunet_udp_bind(lua_State *L);
 int lunet_udp_send(lua_State *L);
+int lunet_udp_send_batch(lua_State *L);
+int lunet_udp_send_fanout(lua_State *L);
 int lunet_udp_recv(lua_State *L);
+int lunet_udp_recv_batch(lua_State *L);
 int lunet_udp_close(lua_State *L);
+int lunet_udp_addr_string(lua_State *L);
+int lunet_udp_dropped(lua_State *L);
+
+/* Free the per-thread pool of send requests */
+void lunet_udp_pool_shutdown(void);
 
 #ifdef LUNET_TRACE
 void lunet_udp_trace_summary(void);
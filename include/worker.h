@@ -0,0 +1,31 @@
+#ifndef LUNET_WORKER_H
+#define LUNET_WORKER_H
+
+#include <uv.h>
+
+#include "lunet_lua.h"
+
+/*
+ * Worker mailboxes (lunet.worker).
+ *
+ * lunet --workers N runs the script in N threads, each with its own loop
+ * and Lua state. Every worker owns one mailbox: a mutex-protected message list
+ * plus a uv_async_t on that worker's loop. Messages are plain strings, copied
+ * once on send.
+ */
+
+/* Allocate n mailboxes; call before any worker thread starts. */
+int lunet_workers_init(int n);
+/* Bind mailbox id to the calling thread's loop and main Lua state. */
+int lunet_worker_attach(int id, uv_loop_t *loop, lua_State *L);
+/* Detach the calling worker before its loop is closed. */
+void lunet_worker_detach(int id);
+/* Free all mailboxes once every worker has stopped. */
+void lunet_workers_shutdown(void);
+
+int lunet_worker_lua_id(lua_State *L);
+int lunet_worker_lua_count(lua_State *L);
+int lunet_worker_send(lua_State *L);
+int lunet_worker_recv(lua_State *L);
+
+#endif
@@ -0,0 +1,246 @@
+#include "buffer.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lunet_mem.h"
+
+static void buffer_store_free(lunet_buffer_store_t *store) {
+  lunet_free_nonnull(store);
+}
+
+lunet_buffer_store_t *lunet_buffer_store_new(size_t size) {
+  if (size > (size_t)-1 - sizeof(lunet_buffer_store_t)) return NULL;
+  lunet_buffer_store_t *store = lunet_alloc(sizeof(lunet_buffer_store_t) + size);
+  if (!store) return NULL;
+  store->refs = 1;
+  store->size = size;
+  store->release = buffer_store_free;
+  return store;
+}
+
+static int buffer_gc(lua_State *L) {
+  lunet_buffer_t *b = (lunet_buffer_t *)lua_touserdata(L, 1);
+  if (b && b->store) {
+    lunet_buffer_store_release(b->store);
+    b->store = NULL;
+    b->data = NULL;
+    b->len = 0;
+  }
+  return 0;
+}
+
+static void buffer_register_metatable(lua_State *L);
+
+lunet_buffer_t *lunet_buffer_push(lua_State *L, lunet_buffer_store_t *store, char *data,
+                                  size_t len) {
+  lunet_buffer_t *b = (lunet_buffer_t *)lua_newuserdata(L, sizeof(lunet_buffer_t));
+  b->store = store;
+  b->data = data;
+  b->len = len;
+  luaL_getmetatable(L, LUNET_BUFFER_MT);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    buffer_register_metatable(L);
+    luaL_getmetatable(L, LUNET_BUFFER_MT);
+  }
+  lua_setmetatable(L, -2);
+  return b;
+}
+
+lunet_buffer_t *lunet_buffer_test(lua_State *L, int idx) {
+  lunet_buffer_t *b = (lunet_buffer_t *)lua_touserdata(L, idx);
+  if (!b || lua_type(L, idx) != LUA_TUSERDATA || !lua_getmetatable(L, idx)) return NULL;
+  luaL_getmetatable(L, LUNET_BUFFER_MT);
+  int same = lua_rawequal(L, -1, -2);
+  lua_pop(L, 2);
+  return same ? b : NULL;
+}
+
+const char *lunet_buffer_tobytes(lua_State *L, int idx, size_t *len) {
+  if (lua_type(L, idx) == LUA_TUSERDATA) {
+    lunet_buffer_t *b = lunet_buffer_test(L, idx);
+    if (!b) return NULL;
+    *len = b->len;
+    return b->data;
+  }
+  if (!lua_isstring(L, idx)) return NULL;
+  return lua_tolstring(L, idx, len);
+}
+
+static lunet_buffer_t *buffer_check(lua_State *L, int idx) {
+  lunet_buffer_t *b = lunet_buffer_test(L, idx);
+  if (!b) luaL_typerror(L, idx, LUNET_BUFFER_MT);
+  return b;
+}
+
+/* Clamp [offset, offset + len) to a buffer of size bytes; offsets are 0-based */
+static void buffer_range(lua_State *L, int idx, size_t size, size_t *start, size_t *count) {
+  lua_Number off = luaL_optnumber(L, idx, 0);
+  lua_Number n = luaL_optnumber(L, idx + 1, (lua_Number)size);
+  if (!(off >= 0)) off = 0;  /* NaN too */
+  if (!(n >= 0) || off >= (lua_Number)size) {
+    *start = size;
+    *count = 0;
+    return;
+  }
+  *start = (size_t)off;
+  *count = n > (lua_Number)(size - *start) ? size - *start : (size_t)n;
+}
+
+static int buffer_alloc(lua_State *L, size_t size) {
+  lunet_buffer_store_t *store = lunet_buffer_store_new(size);
+  if (!store) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  lunet_buffer_push(L, store, lunet_buffer_store_data(store), size);
+  return 1;
+}
+
+// buffer.new(size [, byte]) -> buf, zero-filled unless byte is given
+static int buffer_new(lua_State *L) {
+  lua_Number n = luaL_checknumber(L, 1);
+  int fill = (int)luaL_optinteger(L, 2, 0);
+  if (!(n >= 0)) return luaL_argerror(L, 1, "size must not be negative");
+  if (n > (lua_Number)(SIZE_MAX / 2)) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  if (buffer_alloc(L, (size_t)n) != 1) return 2;
+  lunet_buffer_t *b = (lunet_buffer_t *)lua_touserdata(L, -1);
+  memset(b->data, fill & 0xFF, b->len);
+  return 1;
+}
+
+// buffer.from(data) -> buf holding a copy of a string or buffer
+static int buffer_from(lua_State *L) {
+  size_t len;
+  const char *src = lunet_buffer_tobytes(L, 1, &len);
+  if (!src) luaL_typerror(L, 1, "string or " LUNET_BUFFER_MT);
+  if (buffer_alloc(L, len) != 1) return 2;
+  lunet_buffer_t *b = (lunet_buffer_t *)lua_touserdata(L, -1);
+  if (len) memcpy(b->data, src, len);
+  return 1;
+}
+
+// buffer.is(v) -> boolean
+static int buffer_is(lua_State *L) {
+  lua_pushboolean(L, lunet_buffer_test(L, 1) != NULL);
+  return 1;
+}
+
+// b:len() / #b
+static int buffer_len(lua_State *L) {
+  lunet_buffer_t *b = buffer_check(L, 1);
+  lua_pushinteger(L, (lua_Integer)b->len);
+  return 1;
+}
+
+// b:sub(offset [, len]) -> buf sharing b's bytes; clamped like fs mmap:sub
+static int buffer_sub(lua_State *L) {
+  lunet_buffer_t *b = buffer_check(L, 1);
+  luaL_checknumber(L, 2);
+  size_t start, count;
+  buffer_range(L, 2, b->len, &start, &count);
+  b->store->refs++;
+  lunet_buffer_push(L, b->store, b->data + start, count);
+  return 1;
+}
+
+// b:tostring([offset, len]) -> string copy
+static int buffer_tostring(lua_State *L) {
+  lunet_buffer_t *b = buffer_check(L, 1);
+  size_t start, count;
+  buffer_range(L, 2, b->len, &start, &count);
+  lua_pushlstring(L, b->data + start, count);
+  return 1;
+}
+
+// b:ptr() -> lightuserdata for ffi.cast("uint8_t *", b:ptr()). Valid while b is.
+static int buffer_ptr(lua_State *L) {
+  lunet_buffer_t *b = buffer_check(L, 1);
+  lua_pushlightuserdata(L, b->data);
+  return 1;
+}
+
+// b:set(offset, data) -> bytes copied from a string or buffer (as many as fit)
+static int buffer_set(lua_State *L) {
+  lunet_buffer_t *b = buffer_check(L, 1);
+  lua_Number off = luaL_checknumber(L, 2);
+  size_t len;
+  const char *src = lunet_buffer_tobytes(L, 3, &len);
+  if (!src) luaL_typerror(L, 3, "string or " LUNET_BUFFER_MT);
+  if (!(off >= 0) || off > (lua_Number)b->len) return luaL_argerror(L, 2, "offset out of range");
+  size_t start = (size_t)off;
+  if (len > b->len - start) len = b->len - start;
+  /* Views of one store may overlap */
+  if (len) memmove(b->data + start, src, len);
+  lua_pushinteger(L, (lua_Integer)len);
+  return 1;
+}
+
+// b:fill(byte [, offset, len]) -> b
+static int buffer_fill(lua_State *L) {
+  lunet_buffer_t *b = buffer_check(L, 1);
+  int byte = (int)luaL_checkinteger(L, 2);
+  size_t start, count;
+  buffer_range(L, 3, b->len, &start, &count);
+  memset(b->data + start, byte & 0xFF, count);
+  lua_settop(L, 1);
+  return 1;
+}
+
+// b:clone() -> buf with its own copy of the bytes
+static int buffer_clone(lua_State *L) {
+  lunet_buffer_t *b = buffer_check(L, 1);
+  if (buffer_alloc(L, b->len) != 1) return 2;
+  lunet_buffer_t *copy = (lunet_buffer_t *)lua_touserdata(L, -1);
+  if (b->len) memcpy(copy->data, b->data, b->len);
+  return 1;
+}
+
+static int buffer_tostring_mm(lua_State *L) {
+  lua_settop(L, 1);
+  return buffer_tostring(L);
+}
+
+static void buffer_register_metatable(lua_State *L) {
+  if (luaL_newmetatable(L, LUNET_BUFFER_MT)) {
+    lua_pushcfunction(L, buffer_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcfunction(L, buffer_len);
+    lua_setfield(L, -2, "__len");
+    lua_pushcfunction(L, buffer_tostring_mm);
+    lua_setfield(L, -2, "__tostring");
+    lua_createtable(L, 0, 7);
+    lua_pushcfunction(L, buffer_len);
+    lua_setfield(L, -2, "len");
+    lua_pushcfunction(L, buffer_sub);
+    lua_setfield(L, -2, "sub");
+    lua_pushcfunction(L, buffer_tostring);
+    lua_setfield(L, -2, "tostring");
+    lua_pushcfunction(L, buffer_ptr);
+    lua_setfield(L, -2, "ptr");
+    lua_pushcfunction(L, buffer_set);
+    lua_setfield(L, -2, "set");
+    lua_pushcfunction(L, buffer_fill);
+    lua_setfield(L, -2, "fill");
+    lua_pushcfunction(L, buffer_clone);
+    lua_setfield(L, -2, "clone");
+    lua_setfield(L, -2, "__index");
+  }
+  lua_pop(L, 1);
+}
+
+int lunet_open_buffer(lua_State *L) {
+  buffer_register_metatable(L);
+  luaL_Reg funcs[] = {{"new", buffer_new},
+                      {"from", buffer_from},
+                      {"is", buffer_is},
+                      {NULL, NULL}};
+  luaL_newlib(L, funcs);
+  return 1;
+}
@@ -1,71 +1,303 @@
 #include "co.h"
 
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
+#include "metrics.h"
+#include "rt.h"
+
 /*
- * Coroutine Anchor Table
- * ======================
- * Every spawned coroutine that yields is anchored in a registry table to prevent
- * GC from collecting it between async operations. The table maps thread -> true.
+ * Coroutine Anchor Set
+ * ====================
+ * Every spawned coroutine that yields is anchored to prevent GC from
+ * collecting it between async operations.
  *
  * Without this anchor, a coroutine that yields has no strong references after the
  * temporary coref (used to wake it from a callback) is released. Under load, GC
  * collects the thread and the next callback segfaults on lua_resume.
  *
+ * The set lives in C: threads sit in numbered slots whose strong references
+ * are the array part of the set's environment table, and an open-addressing
+ * map from lua_State* to slot finds a coroutine again when it finishes. No
+ * hash node is inserted or removed per spawn.
+ *
  * The anchor is released when:
  *   - lua_resume returns LUA_OK (coroutine finished normally)
  *   - lua_resume returns an error (coroutine died)
  *   - The coroutine never yields (synchronous completion in spawn)
  *
+ * Threads that finish with LUA_OK keep their slot and go to a bounded pool
+ * instead (LUNET_CO_POOL, default 256, 0 disables it); lunet_spawn reuses them
+ * with a reset stack, so a spawn per connection does not allocate a thread
+ * and the GC has none to sweep. Errored threads are never reused.
+ *
+ * A reused thread must look fresh: lunet_spawn gives it the spawner's globals
+ * again (setfenv(0, t) would otherwise leak into the next spawn), and a debug
+ * hook the coroutine installed is removed when it finishes. LuaJIT hooks are
+ * per VM rather than per thread, so a hook already set when spawn was called
+ * is left alone.
+ *
+ * The set is a userdata in the registry so that driver modules, which link
+ * their own copy of this file, anchor and release in the same set. Its
+ * storage is Lua-allocated and goes away with the state.
+ *
  * See: lunet_co_anchor(), lunet_co_resume()
  */
 
-/* Registry key for the anchor table (address used as light userdata key) */
-static char lunet_co_anchor_key;
+#define LUNET_CO_SET_KEY "lunet.co.anchors"
+#define LUNET_CO_POOL_DEFAULT 256
+#define LUNET_CO_POOL_LIMIT 4096
+#define LUNET_CO_MIN_CAP 64
+
+typedef struct {
+  lua_State *co;  /* NULL while free */
+  int next_free;
+} co_slot_t;
+
+typedef struct {
+  co_slot_t *slots;      /* cap entries; slot i is env[i + 1] */
+  int *map;              /* 2 * cap entries of slot + 1, 0 = empty */
+  int cap;
+  int free_head;         /* -1 when every slot is taken */
+  int next_unused;       /* slots below this were handed out once */
+  int anchored;
+  int pool_max;
+  int pool_count;
+  int *pool;             /* pool_max slot indices */
+} co_set_t;
+
+/* Cached per thread; the registry address identifies the owning state */
+static LUNET_THREAD_LOCAL co_set_t *t_co_set;
+static LUNET_THREAD_LOCAL const void *t_co_set_registry;
 
 #ifdef LUNET_TRACE
 static int co_trace_resume_seq = 0;
 static int co_trace_resume_yield = 0;
 static int co_trace_resume_ok = 0;
 static int co_trace_resume_err = 0;
+static int co_trace_spawn = 0;
+static int co_trace_reused = 0;
+static int co_trace_pooled = 0;
+static int co_trace_anchored_peak = 0;
+
+void lunet_co_trace_summary(void) {
+  fprintf(stderr, "[CO_TRACE] SUMMARY: resumes=%d yield=%d ok=%d err=%d "
+          "spawn=%d reused=%d pooled=%d anchored_peak=%d\n",
+          co_trace_resume_seq, co_trace_resume_yield, co_trace_resume_ok,
+          co_trace_resume_err, co_trace_spawn, co_trace_reused, co_trace_pooled,
+          co_trace_anchored_peak);
+}
 #endif
 
-/* Ensure the anchor table exists in the registry, push it onto the stack */
-static void lunet_co_get_anchor_table(lua_State *L) {
-  lua_pushlightuserdata(L, &lunet_co_anchor_key);
-  lua_rawget(L, LUA_REGISTRYINDEX);
-  if (lua_isnil(L, -1)) {
-    lua_pop(L, 1);
-    lua_newtable(L);
-    lua_pushlightuserdata(L, &lunet_co_anchor_key);
-    lua_pushvalue(L, -2);
-    lua_rawset(L, LUA_REGISTRYINDEX);
+static int co_pool_size(void) {
+  const char *v = getenv("LUNET_CO_POOL");
+  if (!v || !*v) return LUNET_CO_POOL_DEFAULT;
+  char *end = NULL;
+  long n = strtol(v, &end, 10);
+  if (*end != '\0' || n < 0) return LUNET_CO_POOL_DEFAULT;
+  return n > LUNET_CO_POOL_LIMIT ? LUNET_CO_POOL_LIMIT : (int)n;
+}
+
+static int co_set_gc(lua_State *L) {
+  co_set_t *set = (co_set_t *)lua_touserdata(L, 1);
+  if (t_co_set == set) {
+    t_co_set = NULL;
+    t_co_set_registry = NULL;
+  }
+  return 0;
+}
+
+/* Push the set's environment table (thread slots) */
+static void co_set_push_env(lua_State *L) {
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_CO_SET_KEY);
+  lua_getfenv(L, -1);
+  lua_remove(L, -2);
+}
+
+static inline unsigned co_hash(const co_set_t *set, const lua_State *co) {
+  return (unsigned)(((uintptr_t)co >> 4) * 2654435761u) & ((unsigned)set->cap * 2 - 1);
+}
+
+static void co_map_insert(co_set_t *set, int slot) {
+  unsigned mask = (unsigned)set->cap * 2 - 1;
+  unsigned h = co_hash(set, set->slots[slot].co);
+  while (set->map[h]) h = (h + 1) & mask;
+  set->map[h] = slot + 1;
+}
+
+/*
+ * Double the slots and map, kept as one userdata at env[0]; the previous
+ * block becomes garbage. Anchored threads are re-hashed, pooled ones are not
+ * in the map.
+ */
+static void co_set_grow(lua_State *L, co_set_t *set) {
+  int cap = set->cap ? set->cap * 2 : LUNET_CO_MIN_CAP;
+  size_t slots_bytes = (size_t)cap * sizeof(co_slot_t);
+  size_t map_bytes = (size_t)cap * 2 * sizeof(int);
+  luaL_checkstack(L, 3, "coroutine anchor set");
+  co_set_push_env(L);
+  char *block = (char *)lua_newuserdata(L, slots_bytes + map_bytes);
+
+  co_slot_t *slots = (co_slot_t *)block;
+  if (set->cap) memcpy(slots, set->slots, (size_t)set->cap * sizeof(co_slot_t));
+  for (int i = set->cap; i < cap; i++) {
+    slots[i].co = NULL;
+    slots[i].next_free = -1;
+  }
+  int *old_map = set->map;
+  int old_len = set->cap * 2;
+  set->slots = slots;
+  set->map = (int *)(block + slots_bytes);
+  set->cap = cap;
+  memset(set->map, 0, map_bytes);
+  for (int j = 0; j < old_len; j++) {
+    if (old_map[j]) co_map_insert(set, old_map[j] - 1);
+  }
+  /* The old block stays referenced until here */
+  lua_rawseti(L, -2, 0);
+  lua_pop(L, 1);
+}
+
+static co_set_t *co_set_get(lua_State *L) {
+  const void *registry = lua_topointer(L, LUA_REGISTRYINDEX);
+  if (t_co_set && t_co_set_registry == registry) return t_co_set;
+
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_CO_SET_KEY);
+  co_set_t *set = (co_set_t *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  if (!set) {
+    int pool_max = co_pool_size();
+    set = (co_set_t *)lua_newuserdata(L, sizeof(co_set_t) + (size_t)pool_max * sizeof(int));
+    memset(set, 0, sizeof(*set));
+    set->free_head = -1;
+    set->pool_max = pool_max;
+    set->pool = (int *)(set + 1);
+    lua_createtable(L, LUNET_CO_MIN_CAP, 1);
+    lua_setfenv(L, -2);
+    lua_createtable(L, 0, 1);
+    lua_pushcfunction(L, co_set_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, LUNET_CO_SET_KEY);
+  }
+  t_co_set = set;
+  t_co_set_registry = registry;
+  return set;
+}
+
+/* Remove co from the map; returns its slot or -1 if it is not anchored */
+static int co_map_remove(co_set_t *set, const lua_State *co) {
+  if (!set->cap) return -1;
+  unsigned mask = (unsigned)set->cap * 2 - 1;
+  unsigned h = co_hash(set, co);
+  while (set->map[h] && set->slots[set->map[h] - 1].co != co) h = (h + 1) & mask;
+  if (!set->map[h]) return -1;
+  int slot = set->map[h] - 1;
+
+  /* Backward-shift deletion keeps probe chains intact without tombstones */
+  unsigned hole = h;
+  for (unsigned j = (h + 1) & mask; set->map[j]; j = (j + 1) & mask) {
+    unsigned home = co_hash(set, set->slots[set->map[j] - 1].co);
+    if (((j - home) & mask) >= ((j - hole) & mask)) {
+      set->map[hole] = set->map[j];
+      hole = j;
+    }
   }
+  set->map[hole] = 0;
+  return slot;
+}
+
+/* Take a free slot for the thread on top of L's stack and reference it */
+static int co_slot_take(lua_State *L, co_set_t *set, lua_State *co) {
+  int slot = set->free_head;
+  if (slot >= 0) {
+    set->free_head = set->slots[slot].next_free;
+  } else {
+    if (set->next_unused == set->cap) co_set_grow(L, set);
+    slot = set->next_unused++;
+  }
+  set->slots[slot].co = co;
+  co_set_push_env(L);
+  lua_pushvalue(L, -2);
+  lua_rawseti(L, -2, slot + 1);
+  lua_pop(L, 1);
+  return slot;
+}
+
+static void co_slot_drop(lua_State *L, co_set_t *set, int slot) {
+  co_set_push_env(L);
+  lua_pushnil(L);
+  lua_rawseti(L, -2, slot + 1);
+  lua_pop(L, 1);
+  set->slots[slot].co = NULL;
+  set->slots[slot].next_free = set->free_head;
+  set->free_head = slot;
+}
+
+/*
+ * Anchor a coroutine thread (prevent GC). A fresh thread (slot < 0) must be
+ * on top of L's stack; a pooled one already holds its slot.
+ */
+static int lunet_co_anchor(lua_State *L, co_set_t *set, lua_State *co, int slot) {
+  if (slot < 0) slot = co_slot_take(L, set, co);
+  co_map_insert(set, slot);
+  set->anchored++;
+#ifdef LUNET_TRACE
+  if (set->anchored > co_trace_anchored_peak) co_trace_anchored_peak = set->anchored;
+#endif
+  return slot;
 }
 
-/* Anchor a coroutine thread (prevent GC). Thread must be on top of L's stack. */
-static void lunet_co_anchor(lua_State *L) {
-  lunet_co_get_anchor_table(L);     /* stack: ... thread anchortbl */
-  lua_pushvalue(L, -2);             /* stack: ... thread anchortbl thread */
-  lua_pushboolean(L, 1);            /* stack: ... thread anchortbl thread true */
-  lua_rawset(L, -3);                /* anchortbl[thread] = true */
-  lua_pop(L, 1);                    /* pop anchortbl */
+/* Finished thread: pool it with a reset stack if it returned normally */
+static void co_slot_finish(lua_State *L, co_set_t *set, int slot, lua_State *co, int status) {
+  if (status == LUA_OK && set->pool_count < set->pool_max) {
+    lua_settop(co, 0);
+    set->pool[set->pool_count++] = slot;
+#ifdef LUNET_TRACE
+    co_trace_pooled++;
+#endif
+    return;
+  }
+  co_slot_drop(L, set, slot);
 }
 
 /* Release a coroutine anchor. co is the coroutine's lua_State. */
 void lunet_co_unanchor(lua_State *co) {
-  lunet_co_get_anchor_table(co);    /* stack: anchortbl */
-  lua_pushthread(co);               /* stack: anchortbl thread */
-  lua_pushnil(co);                  /* stack: anchortbl thread nil */
-  lua_rawset(co, -3);               /* anchortbl[thread] = nil */
-  lua_pop(co, 1);                   /* pop anchortbl */
+  co_set_t *set = co_set_get(co);
+  int slot = co_map_remove(set, co);
+  if (slot < 0) return;
+  set->anchored--;
+  co_slot_drop(co, set, slot);
 }
 
 int lunet_spawn(lua_State *L) {
   luaL_checktype(L, 1, LUA_TFUNCTION);
-  // create new coroutine
-  lua_State *co = lua_newthread(L);
+  co_set_t *set = co_set_get(L);
+#ifdef LUNET_TRACE
+  co_trace_spawn++;
+#endif
+
+  // reuse a finished coroutine, or create a new one
+  lua_State *co;
+  int slot = -1;
+  int fresh = 0;
+  if (set->pool_count > 0) {
+    slot = set->pool[--set->pool_count];
+    co = set->slots[slot].co;
+    /* globals as a fresh thread from L would have them */
+    lua_pushvalue(L, LUA_GLOBALSINDEX);
+    lua_xmove(L, co, 1);
+    lua_replace(co, LUA_GLOBALSINDEX);
+#ifdef LUNET_TRACE
+    co_trace_reused++;
+#endif
+  } else {
+    co = lua_newthread(L);
+    fresh = 1;
+  }
 
   // copy function to new coroutine
   lua_pushvalue(L, 1);
@@ -73,17 +305,25 @@ int lunet_spawn(lua_State *L) {
 
   // start coroutine
   int status = lua_resume(co, 0);
+  lunet_metrics_spawn();
+  lunet_metrics_resume(status);
   if (status == LUA_YIELD) {
     /* Coroutine yielded — anchor it to prevent GC.
-     * Thread is still on top of L's stack from lua_newthread. */
-    lunet_co_anchor(L);
-  } else if (status != LUA_OK) {
-    fprintf(stderr, "Coroutine error: %s\n", lua_tostring(co, -1));
+     * A fresh thread is still on top of L's stack from lua_newthread. */
+    slot = lunet_co_anchor(L, set, co, slot);
+  } else {
+    if (status != LUA_OK) {
+      fprintf(stderr, "Coroutine error: %s\n", lua_tostring(co, -1));
+    }
+    /* A fresh thread that finished synchronously is pooled only if it fits */
+    if (slot < 0 && status == LUA_OK && set->pool_count < set->pool_max) {
+      slot = co_slot_take(L, set, co);
+    }
+    if (slot >= 0) co_slot_finish(L, set, slot, co, status);
   }
-  /* else: LUA_OK means coroutine finished synchronously, no anchor needed */
 
-  // pop the coroutine thread from parent's stack
-  lua_pop(L, 1);
+  // pop a fresh coroutine thread from parent's stack
+  if (fresh) lua_pop(L, 1);
 
   return 0;
 }
@@ -97,6 +337,7 @@ int lunet_co_resume(lua_State *co, int nargs) {
           co_trace_resume_seq, (void *)co, nargs, lua_gettop(co));
 #endif
   int status = lua_resume(co, nargs);
+  lunet_metrics_resume(status);
 #ifdef LUNET_TRACE
   if (status == LUA_YIELD) {
     co_trace_resume_yield++;
@@ -117,14 +358,20 @@ int lunet_co_resume(lua_State *co, int nargs) {
           co_trace_resume_yield, co_trace_resume_ok, co_trace_resume_err);
 #endif
   if (status != LUA_YIELD) {
-    /* Coroutine finished (LUA_OK) or errored — unanchor so GC can collect it */
-    lunet_co_unanchor(co);
     if (status != LUA_OK) {
       const char *err = lua_tostring(co, -1);
       if (err) {
         fprintf(stderr, "[lunet] coroutine error: %s\n", err);
       }
     }
+    /* Coroutine finished (LUA_OK) or errored — pool or unanchor it. Threads
+     * not started by lunet_spawn are not in the set and are left alone. */
+    co_set_t *set = co_set_get(co);
+    int slot = co_map_remove(set, co);
+    if (slot >= 0) {
+      set->anchored--;
+      co_slot_finish(co, set, slot, co, status);
+    }
   }
   return status;
 }
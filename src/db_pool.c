@@ -0,0 +1,370 @@
+#include "db_pool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "executor.h"
+#include "lunet_mem.h"
+#include "rt.h"
+
+enum {
+  SLOT_FREE = 0,
+  SLOT_OPENING,
+  SLOT_IDLE,
+  SLOT_BUSY,
+};
+
+static void pool_schedule(db_pool_t* pool);
+
+static void pool_free(db_pool_t* pool) {
+  if (pool->ops->destroy) pool->ops->destroy(pool);
+  lunet_free(pool->slots);
+  lunet_free(pool->idle);
+  lunet_free_nonnull(pool);
+}
+
+static void pool_maybe_free(db_pool_t* pool) {
+  if (pool->orphaned && pool->nbusy == 0 && pool->nopening == 0) pool_free(pool);
+}
+
+void db_pool_parse_opts(lua_State* L, int idx, int* min, int* max, int* check_ms) {
+  *min = 0;
+  *max = DB_POOL_DEFAULT_MAX;
+  *check_ms = DB_POOL_DEFAULT_CHECK_MS;
+  if (!lua_istable(L, idx)) return;
+  lua_getfield(L, idx, "min");
+  *min = (int)luaL_optinteger(L, -1, *min);
+  lua_getfield(L, idx, "max");
+  *max = (int)luaL_optinteger(L, -1, *max);
+  lua_getfield(L, idx, "check_ms");
+  *check_ms = (int)luaL_optinteger(L, -1, *check_ms);
+  lua_pop(L, 3);
+}
+
+db_pool_t* db_pool_create(lua_State* L, int min, int max, int check_ms, const db_pool_ops_t* ops, void* ud) {
+  if (max < 1) max = 1;
+  if (max > DB_POOL_MAX_CONNS) max = DB_POOL_MAX_CONNS;
+  if (min < 0) min = 0;
+  if (min > max) min = max;
+
+  db_pool_t* pool = lunet_calloc(1, sizeof(db_pool_t));
+  if (!pool) return NULL;
+  pool->slots = lunet_calloc((size_t)max, sizeof(db_pool_slot_t));
+  pool->idle = lunet_calloc((size_t)max, sizeof(int));
+  if (!pool->slots || !pool->idle) {
+    lunet_free(pool->slots);
+    lunet_free(pool->idle);
+    lunet_free_nonnull(pool);
+    return NULL;
+  }
+  pool->ops = ops;
+  pool->ud = ud;
+  pool->L = L;
+  pool->min = min;
+  pool->max = max;
+  // check_ms < 0 disables the idle ping, 0 pings on every checkout
+  pool->check_ns = check_ms < 0 ? UINT64_MAX : (uint64_t)check_ms * 1000000ULL;
+  return pool;
+}
+
+static int pool_grow(db_pool_t* pool) {
+  for (int i = 0; i < pool->max; i++) {
+    db_pool_slot_t* s = &pool->slots[i];
+    if (s->state != SLOT_FREE) continue;
+    s->state = SLOT_OPENING;
+    pool->nopening++;
+    if (pool->ops->open(pool, i) != 0) {
+      s->state = SLOT_FREE;
+      pool->nopening--;
+      pool->open_failures++;
+      return -1;
+    }
+    return 0;
+  }
+  return -1;
+}
+
+void db_pool_fill(db_pool_t* pool) {
+  while (!pool->closed && pool->nopen + pool->nopening < pool->min) {
+    if (pool_grow(pool) != 0) break;
+  }
+}
+
+static db_pool_waiter_t* pool_pop_waiter(db_pool_t* pool) {
+  db_pool_waiter_t* w = pool->wait_head;
+  if (!w) return NULL;
+  pool->wait_head = w->next;
+  if (!pool->wait_head) pool->wait_tail = NULL;
+  w->next = NULL;
+  pool->nwaiting--;
+  return w;
+}
+
+static void pool_push_waiter(db_pool_t* pool, db_pool_waiter_t* w, int front) {
+  w->next = NULL;
+  if (!pool->wait_head) {
+    pool->wait_head = pool->wait_tail = w;
+  } else if (front) {
+    w->next = pool->wait_head;
+    pool->wait_head = w;
+  } else {
+    pool->wait_tail->next = w;
+    pool->wait_tail = w;
+  }
+  pool->nwaiting++;
+}
+
+// Complete a request that never got a connection; its after_cb resumes the
+// coroutine with the error
+static void pool_fail_waiter(db_pool_waiter_t* w, const char* msg) {
+  snprintf(w->err, w->errsize, "%s", msg);
+  w->status = DB_POOL_FAILED;
+  w->conn = NULL;
+  w->slot = -1;
+  w->after_cb(w->req, UV_ECANCELED);
+}
+
+static void pool_fail_all(db_pool_t* pool, const char* msg) {
+  // Detach first: resumed coroutines may submit again while we iterate
+  db_pool_waiter_t* w = pool->wait_head;
+  pool->wait_head = pool->wait_tail = NULL;
+  pool->nwaiting = 0;
+  while (w) {
+    db_pool_waiter_t* next = w->next;
+    pool_fail_waiter(w, msg);
+    w = next;
+  }
+}
+
+static int pool_dispatch(db_pool_t* pool, int slot, db_pool_waiter_t* w) {
+  db_pool_slot_t* s = &pool->slots[slot];
+  uint64_t now = uv_hrtime();
+  w->conn = s->conn;
+  w->slot = slot;
+  w->idle_ns = now - s->last_used_ns;
+  int rc = lunet_exec_queue(LUNET_EXEC_DB, w->req, w->work_cb, w->after_cb);
+  if (rc < 0) return rc;
+  s->state = SLOT_BUSY;
+  pool->nbusy++;
+  uint64_t wait = now - w->enqueued_ns;
+  pool->acquired++;
+  pool->wait_ns_total += wait;
+  if (wait > pool->wait_ns_max) pool->wait_ns_max = wait;
+  return 0;
+}
+
+// Give a ready connection to the oldest waiter, or park it as idle
+static void pool_hand_off(db_pool_t* pool, int slot) {
+  db_pool_waiter_t* w;
+  while ((w = pool_pop_waiter(pool)) != NULL) {
+    int rc = pool_dispatch(pool, slot, w);
+    if (rc == 0) return;
+    pool_fail_waiter(w, lunet_exec_strerror(LUNET_EXEC_DB, rc));
+  }
+  pool->slots[slot].state = SLOT_IDLE;
+  pool->idle[pool->nidle++] = slot;
+}
+
+static void pool_drop(db_pool_t* pool, int slot) {
+  db_pool_slot_t* s = &pool->slots[slot];
+  pool->ops->discard(pool, s->conn, s->ref);
+  s->conn = NULL;
+  s->state = SLOT_FREE;
+  pool->nopen--;
+}
+
+static void pool_schedule(db_pool_t* pool) {
+  if (pool->closed) return;
+  while (pool->nwaiting > pool->nopening && pool->nopen + pool->nopening < pool->max) {
+    if (pool_grow(pool) != 0) break;
+  }
+  db_pool_fill(pool);
+  if (pool->nwaiting > 0 && pool->nopen == 0 && pool->nopening == 0) {
+    pool_fail_all(pool, pool->last_error[0] ? pool->last_error : "no database connection available");
+  }
+}
+
+int db_pool_queue_work(db_pool_t* pool, db_pool_waiter_t* w, uv_work_t* req,
+                       uv_work_cb work_cb, uv_after_work_cb after_cb, char* err, size_t errsize) {
+  if (!pool) return lunet_exec_queue(LUNET_EXEC_DB, req, work_cb, after_cb);
+  if (pool->closed) return UV_ECANCELED;
+
+  w->pool = pool;
+  w->req = req;
+  w->work_cb = work_cb;
+  w->after_cb = after_cb;
+  w->err = err;
+  w->errsize = errsize;
+  w->status = DB_POOL_OK;
+  w->enqueued_ns = uv_hrtime();
+
+  if (pool->nidle > 0 && pool->nwaiting == 0) {
+    int slot = pool->idle[--pool->nidle];
+    int rc = pool_dispatch(pool, slot, w);
+    if (rc < 0) pool->idle[pool->nidle++] = slot;
+    return rc;
+  }
+
+  pool_push_waiter(pool, w, 0);
+  pool->waited++;
+  while (pool->nwaiting > pool->nopening && pool->nopen + pool->nopening < pool->max) {
+    if (pool_grow(pool) != 0) break;
+  }
+  if (pool->nopen == 0 && pool->nopening == 0) {
+    // Nothing will ever wake this request; fail it synchronously instead
+    pool->wait_head = w->next;
+    if (pool->wait_tail == w) pool->wait_tail = NULL;
+    pool->nwaiting--;
+    pool->waited--;
+    return UV_ENOTCONN;
+  }
+  return 0;
+}
+
+const char* db_pool_strerror(const db_pool_t* pool, int rc) {
+  if (pool && rc == UV_ECANCELED) return "pool is closed";
+  if (pool && rc == UV_ENOTCONN && pool->last_error[0]) return pool->last_error;
+  return lunet_exec_strerror(LUNET_EXEC_DB, rc);
+}
+
+int db_pool_release(db_pool_waiter_t* w) {
+  db_pool_t* pool = w->pool;
+  if (!pool || w->status == DB_POOL_FAILED) return 0;
+
+  int slot = w->slot;
+  pool->nbusy--;
+  pool->slots[slot].last_used_ns = uv_hrtime();
+
+  if (w->status == DB_POOL_STALE || w->status == DB_POOL_LOST) {
+    pool_drop(pool, slot);
+    pool->dropped++;
+    if (w->status == DB_POOL_STALE && !w->retried && !pool->closed) {
+      // The request never reached the server; run it on another connection
+      w->retried = 1;
+      w->status = DB_POOL_OK;
+      w->err[0] = '\0';
+      w->enqueued_ns = uv_hrtime();
+      pool_push_waiter(pool, w, 1);
+      if (pool->nidle > 0) {
+        pool_hand_off(pool, pool->idle[--pool->nidle]);
+      }
+      pool_schedule(pool);
+      return 1;
+    }
+    pool_schedule(pool);
+    pool_maybe_free(pool);
+    return 0;
+  }
+
+  if (pool->closed) {
+    pool_drop(pool, slot);
+    pool_maybe_free(pool);
+    return 0;
+  }
+  pool_hand_off(pool, slot);
+  return 0;
+}
+
+void db_pool_opened(db_pool_t* pool, int slot, void* conn, int ref, const char* err) {
+  db_pool_slot_t* s = &pool->slots[slot];
+  pool->nopening--;
+  if (conn) {
+    s->conn = conn;
+    s->ref = ref;
+    s->last_used_ns = uv_hrtime();
+    pool->nopen++;
+    pool->opened++;
+    if (pool->closed) {
+      pool_drop(pool, slot);
+      pool_maybe_free(pool);
+      return;
+    }
+    pool_hand_off(pool, slot);
+  } else {
+    s->state = SLOT_FREE;
+    pool->open_failures++;
+    snprintf(pool->last_error, sizeof(pool->last_error), "%s", err ? err : "connect failed");
+    if (pool->closed) {
+      pool_maybe_free(pool);
+      return;
+    }
+    // Don't redial straight away (that would spin against a down server);
+    // the next request or release retries. Waiters with nothing left to wake
+    // them get the connect error.
+    if (pool->nwaiting > 0 && pool->nopen == 0 && pool->nopening == 0) {
+      pool_fail_all(pool, pool->last_error);
+    }
+    return;
+  }
+  pool_schedule(pool);
+}
+
+void db_pool_close(db_pool_t* pool) {
+  if (pool->closed) return;
+  pool->closed = 1;
+  pool_fail_all(pool, "pool is closed");
+  while (pool->nidle > 0) {
+    pool_drop(pool, pool->idle[--pool->nidle]);
+  }
+}
+
+static int pool_gc(lua_State* L) {
+  db_pool_t** ud = (db_pool_t**)lua_touserdata(L, 1);
+  if (ud && *ud) {
+    db_pool_t* pool = *ud;
+    *ud = NULL;
+    db_pool_close(pool);
+    pool->orphaned = 1;
+    pool_maybe_free(pool);
+  }
+  return 0;
+}
+
+void db_pool_push(lua_State* L, db_pool_t* pool, const char* mt) {
+  db_pool_t** ud = (db_pool_t**)lua_newuserdata(L, sizeof(db_pool_t*));
+  *ud = pool;
+  if (luaL_newmetatable(L, mt)) {
+    lua_pushcfunction(L, pool_gc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+}
+
+db_pool_t* db_pool_test(lua_State* L, int idx, const char* mt) {
+  db_pool_t** ud = (db_pool_t**)luaL_testudata(L, idx, mt);
+  return ud ? *ud : NULL;
+}
+
+void db_pool_push_stats(lua_State* L, const db_pool_t* pool) {
+  lua_createtable(L, 0, 16);
+  lua_pushinteger(L, pool->min);
+  lua_setfield(L, -2, "min");
+  lua_pushinteger(L, pool->max);
+  lua_setfield(L, -2, "max");
+  lua_pushinteger(L, pool->nopen);
+  lua_setfield(L, -2, "size");
+  lua_pushinteger(L, pool->nopening);
+  lua_setfield(L, -2, "opening");
+  lua_pushinteger(L, pool->nidle);
+  lua_setfield(L, -2, "idle");
+  lua_pushinteger(L, pool->nbusy);
+  lua_setfield(L, -2, "in_use");
+  lua_pushinteger(L, pool->nwaiting);
+  lua_setfield(L, -2, "waiting");
+  lua_pushnumber(L, (lua_Number)pool->acquired);
+  lua_setfield(L, -2, "acquired");
+  lua_pushnumber(L, (lua_Number)pool->waited);
+  lua_setfield(L, -2, "waited");
+  lua_pushnumber(L, (lua_Number)pool->wait_ns_total / 1e6);
+  lua_setfield(L, -2, "wait_ms_total");
+  lua_pushnumber(L, (lua_Number)pool->wait_ns_max / 1e6);
+  lua_setfield(L, -2, "wait_ms_max");
+  lua_pushnumber(L, (lua_Number)pool->opened);
+  lua_setfield(L, -2, "opened");
+  lua_pushnumber(L, (lua_Number)pool->open_failures);
+  lua_setfield(L, -2, "open_failures");
+  lua_pushnumber(L, (lua_Number)pool->dropped);
+  lua_setfield(L, -2, "dropped");
+  lua_pushboolean(L, pool->closed);
+  lua_setfield(L, -2, "closed");
+}
@@ -0,0 +1,203 @@
+#include "db_result.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char* db_result_parse_opts(lua_State* L, int first, db_result_opts_t* opts) {
+  opts->shape = DB_SHAPE_ROWS;
+  opts->ffi = 0;
+  int top = lua_gettop(L);
+  if (top < first || !lua_istable(L, top)) return NULL;
+
+  const char* err = NULL;
+  lua_getfield(L, top, "shape");
+  if (lua_isstring(L, -1)) {
+    const char* shape = lua_tostring(L, -1);
+    if (strcmp(shape, "rows") == 0) {
+      opts->shape = DB_SHAPE_ROWS;
+    } else if (strcmp(shape, "arrays") == 0) {
+      opts->shape = DB_SHAPE_ARRAYS;
+    } else if (strcmp(shape, "columns") == 0) {
+      opts->shape = DB_SHAPE_COLUMNS;
+    } else {
+      err = "shape must be \"rows\", \"arrays\" or \"columns\"";
+    }
+  } else if (!lua_isnil(L, -1)) {
+    err = "shape must be a string";
+  }
+  lua_getfield(L, top, "ffi");
+  opts->ffi = lua_toboolean(L, -1);
+  lua_settop(L, top - 1);
+  return err;
+}
+
+static void push_cell(lua_State* co, db_col_kind_t kind, const char* val) {
+  if (val == NULL) {
+    lua_pushnil(co);
+    return;
+  }
+  switch (kind) {
+    case DB_COL_INT:
+      lua_pushinteger(co, strtoll(val, NULL, 10));
+      break;
+    case DB_COL_FLOAT:
+      lua_pushnumber(co, strtod(val, NULL));
+      break;
+    case DB_COL_BOOL:
+      lua_pushboolean(co, val[0] == 't' || val[0] == 'T');
+      break;
+    default:
+      lua_pushstring(co, val);
+      break;
+  }
+}
+
+static void push_names(lua_State* co, const db_result_t* r) {
+  lua_createtable(co, r->ncols, 0);
+  for (int j = 0; j < r->ncols; j++) {
+    lua_pushstring(co, r->name(r->ud, j));
+    lua_rawseti(co, -2, j + 1);
+  }
+}
+
+static void push_row_tables(lua_State* co, const db_result_t* r) {
+  lua_createtable(co, r->nrows, 0);
+  int base = lua_gettop(co);
+  // Intern each column name once and reuse the string for every row
+  int keep = lua_checkstack(co, r->ncols + 4);
+  if (keep) {
+    for (int j = 0; j < r->ncols; j++) lua_pushstring(co, r->name(r->ud, j));
+  }
+  for (int i = 0; i < r->nrows; i++) {
+    lua_createtable(co, 0, r->ncols);
+    for (int j = 0; j < r->ncols; j++) {
+      if (keep) {
+        lua_pushvalue(co, base + 1 + j);
+      } else {
+        lua_pushstring(co, r->name(r->ud, j));
+      }
+      push_cell(co, r->kind(r->ud, j), r->value(r->ud, i, j));
+      lua_rawset(co, -3);
+    }
+    lua_rawseti(co, -2, i + 1);
+  }
+  lua_settop(co, base);
+}
+
+static void push_row_arrays(lua_State* co, const db_result_t* r) {
+  lua_createtable(co, r->nrows, 0);
+  for (int i = 0; i < r->nrows; i++) {
+    lua_createtable(co, r->ncols, 0);
+    for (int j = 0; j < r->ncols; j++) {
+      const char* val = r->value(r->ud, i, j);
+      if (val == NULL) continue;  // leave a hole rather than store nil
+      push_cell(co, r->kind(r->ud, j), val);
+      lua_rawseti(co, -2, j + 1);
+    }
+    lua_rawseti(co, -2, i + 1);
+  }
+}
+
+// Pushes ffi.new(ctype, nrows) and returns its payload, or NULL (nothing
+// pushed) on failure. T is a scratch thread: co is suspended and cannot call.
+static void* push_ffi_array(lua_State* co, lua_State* T, const char* ctype, int nrows) {
+  lua_pushvalue(T, 1);
+  lua_pushstring(T, ctype);
+  lua_pushinteger(T, nrows);
+  if (lua_pcall(T, 2, 1, 0) != 0) {
+    lua_pop(T, 1);
+    return NULL;
+  }
+  // LuaJIT 2.1 returns the cdata payload for cdata objects
+  void* p = (void*)lua_topointer(T, -1);
+  lua_xmove(T, co, 1);
+  return p;
+}
+
+// Integers exact in a double (|v| <= 2^53) go in double[?] too: indexing an
+// int64_t[?] returns a boxed int64 cdata per cell
+#define FFI_EXACT_INT_MAX 9007199254740992LL
+
+static int push_ffi_column(lua_State* co, lua_State* T, const db_result_t* r, int col) {
+  db_col_kind_t kind = r->kind(r->ud, col);
+  if (kind != DB_COL_INT && kind != DB_COL_FLOAT) return 0;
+  int wide = 0;
+  for (int i = 0; i < r->nrows; i++) {
+    const char* val = r->value(r->ud, i, col);
+    if (val == NULL) return 0;
+    if (kind == DB_COL_INT && !wide) {
+      long long v = strtoll(val, NULL, 10);
+      wide = v > FFI_EXACT_INT_MAX || v < -FFI_EXACT_INT_MAX;
+    }
+  }
+  if (kind == DB_COL_INT && !wide) {
+    double* out = push_ffi_array(co, T, "double[?]", r->nrows);
+    if (!out) return 0;
+    for (int i = 0; i < r->nrows; i++) out[i] = (double)strtoll(r->value(r->ud, i, col), NULL, 10);
+  } else if (kind == DB_COL_INT) {
+    int64_t* out = push_ffi_array(co, T, "int64_t[?]", r->nrows);
+    if (!out) return 0;
+    for (int i = 0; i < r->nrows; i++) out[i] = strtoll(r->value(r->ud, i, col), NULL, 10);
+  } else {
+    double* out = push_ffi_array(co, T, "double[?]", r->nrows);
+    if (!out) return 0;
+    for (int i = 0; i < r->nrows; i++) out[i] = strtod(r->value(r->ud, i, col), NULL);
+  }
+  return 1;
+}
+
+static void push_column_arrays(lua_State* co, const db_result_t* r, int ffi) {
+  lua_State* T = NULL;
+  if (ffi) {
+    // Kept on co's stack under the values table until the columns are built
+    T = lua_newthread(co);
+    lua_getglobal(T, "require");
+    lua_pushstring(T, "ffi");
+    if (lua_pcall(T, 1, 1, 0) == 0 && lua_istable(T, -1)) {
+      lua_getfield(T, -1, "new");
+      lua_replace(T, 1);
+      lua_settop(T, 1);
+    } else {
+      lua_settop(T, 0);
+      T = NULL;
+    }
+  }
+  lua_createtable(co, r->ncols, 0);
+  for (int j = 0; j < r->ncols; j++) {
+    if (T && push_ffi_column(co, T, r, j)) {
+      lua_rawseti(co, -2, j + 1);
+      continue;
+    }
+    db_col_kind_t kind = r->kind(r->ud, j);
+    lua_createtable(co, r->nrows, 0);
+    for (int i = 0; i < r->nrows; i++) {
+      const char* val = r->value(r->ud, i, j);
+      if (val == NULL) continue;
+      push_cell(co, kind, val);
+      lua_rawseti(co, -2, i + 1);
+    }
+    lua_rawseti(co, -2, j + 1);
+  }
+  if (ffi) lua_remove(co, -2);
+}
+
+void db_result_push(lua_State* co, const db_result_t* r, const db_result_opts_t* opts) {
+  db_shape_t shape = opts ? opts->shape : DB_SHAPE_ROWS;
+  if (shape == DB_SHAPE_ROWS) {
+    push_row_tables(co, r);
+    return;
+  }
+  lua_createtable(co, 0, 3);
+  push_names(co, r);
+  lua_setfield(co, -2, "columns");
+  lua_pushinteger(co, r->nrows);
+  lua_setfield(co, -2, "nrows");
+  if (shape == DB_SHAPE_ARRAYS) {
+    push_row_arrays(co, r);
+    lua_setfield(co, -2, "rows");
+  } else {
+    push_column_arrays(co, r, opts->ffi);
+    lua_setfield(co, -2, "values");
+  }
+}
@@ -25,7 +25,7 @@
 #define PATH_MAX 4096
 #endif
 
-#define LUNET_EMBED_MAGIC "LUNETPK1"
+#define LUNET_EMBED_MAGIC "LUNETPK2"
 #define LUNET_EMBED_MAGIC_LEN 8
 
 static void lunet_embed_set_error(char *err, size_t err_len, const char *fmt, ...) {
@@ -244,98 +244,299 @@ static unsigned long long lunet_embed_read_u64_le(const unsigned char *p) {
          ((unsigned long long)p[7] << 56);
 }
 
-static int lunet_embed_decompress_gzip(const unsigned char *in_data,
-                                       size_t in_len,
-                                       unsigned char **out_data,
-                                       size_t *out_len,
-                                       char *err,
-                                       size_t err_len) {
+/*
+ * Pack layout (bin/generate_embed_scripts.lua), all integers little endian:
+ *
+ *   "LUNETPK2" u32 count
+ *   count x { u32 path_len, u32 flags, u64 raw_len, u64 stored_len,
+ *             path, stored bytes }
+ *
+ * Entries are compressed one by one (gzip members), so a module is only
+ * inflated when it is required. The index points into the const blob, is
+ * sorted by path for lookups and is built once per process.
+ */
+#define LUNET_EMBED_F_BYTECODE 0x1u
+#define LUNET_EMBED_F_GZIP 0x2u
+
+typedef struct {
+  const char *path;  /* not NUL-terminated */
+  size_t path_len;
+  unsigned int flags;
+  size_t raw_len;
+  const unsigned char *data;
+  size_t data_len;
+} lunet_embed_entry_t;
+
+static lunet_embed_entry_t *g_embed_entries = NULL;
+static unsigned int g_embed_count = 0;
+static unsigned int g_embed_other = 0;  /* entries the searcher cannot serve */
+static int g_embed_extract = 0;  /* on-disk mode, see lunet_embed_scripts_prepare */
+
+static int lunet_embed_path_cmp(const lunet_embed_entry_t *e, const char *path, size_t len) {
+  size_t n = e->path_len < len ? e->path_len : len;
+  int c = memcmp(e->path, path, n);
+  if (c != 0) {
+    return c;
+  }
+  return e->path_len < len ? -1 : (e->path_len > len ? 1 : 0);
+}
+
+static int lunet_embed_entry_cmp(const void *a, const void *b) {
+  const lunet_embed_entry_t *eb = (const lunet_embed_entry_t *)b;
+  return lunet_embed_path_cmp((const lunet_embed_entry_t *)a, eb->path, eb->path_len);
+}
+
+/* Built by worker 0 before the other workers start; read-only afterwards */
+static int lunet_embed_build_index(char *err, size_t err_len) {
+  const unsigned char *pack = lunet_embedded_scripts_pack;
+  size_t pack_len = lunet_embedded_scripts_pack_len;
+  size_t off = 0;
+  unsigned int count;
+  unsigned int other = 0;
+
+  if (g_embed_entries) {
+    return 0;
+  }
+  if (!pack || pack_len < (LUNET_EMBED_MAGIC_LEN + 4)) {
+    lunet_embed_set_error(err, err_len, "embedded payload is too small");
+    return -1;
+  }
+  if (memcmp(pack, LUNET_EMBED_MAGIC, LUNET_EMBED_MAGIC_LEN) != 0) {
+    lunet_embed_set_error(err, err_len, "invalid embedded payload header");
+    return -1;
+  }
+  off += LUNET_EMBED_MAGIC_LEN;
+  count = lunet_embed_read_u32_le(pack + off);
+  off += 4;
+  if (count > (pack_len - off) / 24) {
+    lunet_embed_set_error(err, err_len, "invalid embedded entry count");
+    return -1;
+  }
+
+  lunet_embed_entry_t *entries =
+      (lunet_embed_entry_t *)malloc((count ? count : 1) * sizeof(*entries));
+  if (!entries) {
+    lunet_embed_set_error(err, err_len, "out of memory");
+    return -1;
+  }
+
+  for (unsigned int i = 0; i < count; i++) {
+    lunet_embed_entry_t *e = &entries[i];
+    unsigned int path_len;
+    unsigned long long raw_len;
+    unsigned long long stored_len;
+
+    if (off + 24 > pack_len) {
+      lunet_embed_set_error(err, err_len, "truncated entry header");
+      goto fail;
+    }
+    path_len = lunet_embed_read_u32_le(pack + off);
+    e->flags = lunet_embed_read_u32_le(pack + off + 4);
+    raw_len = lunet_embed_read_u64_le(pack + off + 8);
+    stored_len = lunet_embed_read_u64_le(pack + off + 16);
+    off += 24;
+
+    if (path_len == 0 || path_len >= PATH_MAX || off + path_len > pack_len) {
+      lunet_embed_set_error(err, err_len, "invalid embedded path length");
+      goto fail;
+    }
+    if (stored_len > (unsigned long long)(pack_len - off - path_len) ||
+        raw_len > (unsigned long long)SIZE_MAX) {
+      lunet_embed_set_error(err, err_len, "truncated embedded file data");
+      goto fail;
+    }
+    if (!(e->flags & LUNET_EMBED_F_GZIP) && raw_len != stored_len) {
+      lunet_embed_set_error(err, err_len, "invalid embedded file length");
+      goto fail;
+    }
+    e->path = (const char *)pack + off;
+    e->path_len = path_len;
+    if (memchr(e->path, '\0', path_len) != NULL) {
+      lunet_embed_set_error(err, err_len, "invalid embedded path");
+      goto fail;
+    }
+    off += path_len;
+    e->raw_len = (size_t)raw_len;
+    e->data = pack + off;
+    e->data_len = (size_t)stored_len;
+    off += e->data_len;
+    /* native modules and data files only resolve from an extracted tree */
+    if (path_len < 4 || memcmp(e->path + path_len - 4, ".lua", 4) != 0) {
+      other++;
+    }
+  }
+
+  if (off != pack_len) {
+    lunet_embed_set_error(err, err_len, "unexpected trailing data in embedded payload");
+    goto fail;
+  }
+  qsort(entries, count, sizeof(*entries), lunet_embed_entry_cmp);
+  g_embed_entries = entries;
+  g_embed_count = count;
+  g_embed_other = other;
+  return 0;
+
+fail:
+  free(entries);
+  return -1;
+}
+
+static const lunet_embed_entry_t *lunet_embed_find(const char *path) {
+  size_t len = strlen(path);
+  unsigned int lo = 0;
+  unsigned int hi = g_embed_count;
+  while (lo < hi) {
+    unsigned int mid = lo + (hi - lo) / 2;
+    int c = lunet_embed_path_cmp(&g_embed_entries[mid], path, len);
+    if (c == 0) {
+      return &g_embed_entries[mid];
+    }
+    if (c < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Inflate one entry into a malloc'd buffer of exactly raw_len bytes; stored
+ * entries are returned in place (*owned = 0).
+ */
+static int lunet_embed_inflate_entry(const lunet_embed_entry_t *e,
+                                     const unsigned char **out_data,
+                                     int *owned,
+                                     char *err,
+                                     size_t err_len) {
   z_stream zs;
-  unsigned char *buffer = NULL;
-  size_t capacity;
-  size_t used = 0;
+  unsigned char *buffer;
   int rc;
 
-  if (!in_data || in_len == 0 || !out_data || !out_len) {
-    lunet_embed_set_error(err, err_len, "invalid gzip input");
+  if (!(e->flags & LUNET_EMBED_F_GZIP)) {
+    *out_data = e->data;
+    *owned = 0;
+    return 0;
+  }
+
+  buffer = (unsigned char *)malloc(e->raw_len ? e->raw_len : 1);
+  if (!buffer) {
+    lunet_embed_set_error(err, err_len, "out of memory");
     return -1;
   }
 
   memset(&zs, 0, sizeof(zs));
   rc = inflateInit2(&zs, 16 + MAX_WBITS);
   if (rc != Z_OK) {
+    free(buffer);
     lunet_embed_set_error(err, err_len, "inflateInit2 failed: %d", rc);
     return -1;
   }
-
-  capacity = in_len * 4;
-  if (capacity < 65536) {
-    capacity = 65536;
-  }
-  buffer = (unsigned char *)malloc(capacity);
-  if (!buffer) {
-    inflateEnd(&zs);
-    lunet_embed_set_error(err, err_len, "out of memory");
+  zs.next_in = (Bytef *)e->data;
+  zs.avail_in = (uInt)e->data_len;
+  zs.next_out = buffer;
+  zs.avail_out = (uInt)e->raw_len;
+  rc = inflate(&zs, Z_FINISH);
+  inflateEnd(&zs);
+  if (rc != Z_STREAM_END || zs.total_out != e->raw_len) {
+    free(buffer);
+    lunet_embed_set_error(err, err_len, "inflate failed for '%.*s': %d",
+                          (int)e->path_len, e->path, rc);
     return -1;
   }
 
-  zs.next_in = (Bytef *)in_data;
-  zs.avail_in = (uInt)in_len;
+  *out_data = buffer;
+  *owned = 1;
+  return 0;
+}
 
-  for (;;) {
-    if (used == capacity) {
-      unsigned char *grown;
-      size_t next = capacity * 2;
-      if (next <= capacity) {
-        free(buffer);
-        inflateEnd(&zs);
-        lunet_embed_set_error(err, err_len, "decompressed data too large");
-        return -1;
-      }
-      grown = (unsigned char *)realloc(buffer, next);
-      if (!grown) {
-        free(buffer);
-        inflateEnd(&zs);
-        lunet_embed_set_error(err, err_len, "out of memory");
-        return -1;
-      }
-      buffer = grown;
-      capacity = next;
-    }
+/* Load an entry as a chunk named "@path"; pushes the function or an error
+ * message and returns non-zero */
+static int lunet_embed_load_entry(lua_State *L, const lunet_embed_entry_t *e) {
+  const unsigned char *data;
+  int owned;
+  char err[256];
+  char chunkname[PATH_MAX + 2];
 
-    zs.next_out = buffer + used;
-    zs.avail_out = (uInt)(capacity - used);
-    rc = inflate(&zs, Z_NO_FLUSH);
-    used = capacity - zs.avail_out;
+  if (lunet_embed_inflate_entry(e, &data, &owned, err, sizeof(err)) != 0) {
+    lua_pushstring(L, err);
+    return -1;
+  }
+  snprintf(chunkname, sizeof(chunkname), "@%.*s", (int)e->path_len, e->path);
+  /* luaL_loadbuffer detects LuaJIT bytecode by its header */
+  int rc = luaL_loadbuffer(L, (const char *)data, e->raw_len, chunkname);
+  if (owned) {
+    free((void *)data);
+  }
+  return rc;
+}
 
-    if (rc == Z_STREAM_END) {
-      break;
-    }
-    if (rc == Z_OK) {
-      if (zs.avail_out == 0) {
-        continue;
-      }
-      if (zs.avail_in == 0) {
-        free(buffer);
-        inflateEnd(&zs);
-        lunet_embed_set_error(err, err_len, "truncated gzip payload");
-        return -1;
-      }
+/*
+ * package.loaders entry: serves "a.b" from a/b.lua or a/b/init.lua in the
+ * pack, inflating the module only now.
+ */
+static int lunet_embed_searcher(lua_State *L) {
+  static const char *const patterns[] = {"%s.lua", "%s/init.lua"};
+  const char *name = luaL_checkstring(L, 1);
+  char base[PATH_MAX];
+  char path[PATH_MAX];
+  size_t len = strlen(name);
+
+  if (len + 10 >= sizeof(base)) {
+    lua_pushfstring(L, "\n\tembedded module name too long '%s'", name);
+    return 1;
+  }
+  for (size_t i = 0; i <= len; i++) {
+    base[i] = name[i] == '.' ? '/' : name[i];
+  }
+
+  luaL_Buffer msg;
+  luaL_buffinit(L, &msg);
+  for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+    snprintf(path, sizeof(path), patterns[i], base);
+    const lunet_embed_entry_t *e = lunet_embed_find(path);
+    if (!e) {
+      lua_pushfstring(L, "\n\tno embedded file '%s'", path);
+      luaL_addvalue(&msg);
       continue;
     }
-    if (rc == Z_BUF_ERROR && zs.avail_out == 0) {
-      continue;
+    if (lunet_embed_load_entry(L, e) != 0) {
+      return luaL_error(L, "error loading module '%s' from embedded file '%s':\n\t%s",
+                        name, path, lua_tostring(L, -1));
     }
+    return 1;
+  }
+  luaL_pushresult(&msg);
+  return 1;
+}
 
-    free(buffer);
-    inflateEnd(&zs);
-    lunet_embed_set_error(err, err_len, "inflate failed: %d", rc);
+/* Insert the searcher right after package.preload's */
+static int lunet_embed_install_searcher(lua_State *L, char *err, size_t err_len) {
+  lua_getglobal(L, "package");
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);
+    lunet_embed_set_error(err, err_len, "lua package table not found");
+    return -1;
+  }
+  lua_getfield(L, -1, "loaders");
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);
+    lua_getfield(L, -1, "searchers");
+  }
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 2);
+    lunet_embed_set_error(err, err_len, "package.loaders not found");
     return -1;
   }
 
-  inflateEnd(&zs);
-  *out_data = buffer;
-  *out_len = used;
+  int n = (int)lua_objlen(L, -1);
+  for (int i = n; i >= 2; i--) {
+    lua_rawgeti(L, -1, i);
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_pushcfunction(L, lunet_embed_searcher);
+  lua_rawseti(L, -2, n >= 1 ? 2 : 1);
+  lua_pop(L, 2);
   return 0;
 }
 
@@ -367,108 +568,38 @@ static int lunet_embed_write_file(const char *path,
   return 0;
 }
 
-static int lunet_embed_extract_payload(const unsigned char *payload,
-                                       size_t payload_len,
-                                       const char *target_dir,
-                                       char *err,
-                                       size_t err_len) {
-  size_t off = 0;
-  unsigned int file_count;
-
-  if (!payload || payload_len < (LUNET_EMBED_MAGIC_LEN + 4)) {
-    lunet_embed_set_error(err, err_len, "embedded payload is too small");
-    return -1;
-  }
-  if (memcmp(payload, LUNET_EMBED_MAGIC, LUNET_EMBED_MAGIC_LEN) != 0) {
-    lunet_embed_set_error(err, err_len, "invalid embedded payload header");
-    return -1;
-  }
-
-  off += LUNET_EMBED_MAGIC_LEN;
-  file_count = lunet_embed_read_u32_le(payload + off);
-  off += 4;
-
-  for (unsigned int i = 0; i < file_count; i++) {
-    unsigned int rel_len;
-    unsigned long long file_len_u64;
-    size_t file_len;
-    char *rel = NULL;
+static int lunet_embed_extract_all(const char *target_dir, char *err, size_t err_len) {
+  for (unsigned int i = 0; i < g_embed_count; i++) {
+    const lunet_embed_entry_t *e = &g_embed_entries[i];
+    char rel[PATH_MAX];
     char fullpath[PATH_MAX];
+    const unsigned char *data;
+    int owned;
 
-    if (off + 12 > payload_len) {
-      lunet_embed_set_error(err, err_len, "truncated entry header");
-      return -1;
-    }
-
-    rel_len = lunet_embed_read_u32_le(payload + off);
-    off += 4;
-    file_len_u64 = lunet_embed_read_u64_le(payload + off);
-    off += 8;
-
-    if (rel_len == 0 || rel_len >= PATH_MAX) {
-      lunet_embed_set_error(err, err_len, "invalid embedded path length");
-      return -1;
-    }
-    if (off + rel_len > payload_len) {
-      lunet_embed_set_error(err, err_len, "truncated embedded path");
-      return -1;
-    }
-    if (file_len_u64 > (unsigned long long)(payload_len - off - rel_len)) {
-      lunet_embed_set_error(err, err_len, "truncated embedded file data");
-      return -1;
-    }
-
-    rel = (char *)malloc((size_t)rel_len + 1);
-    if (!rel) {
-      lunet_embed_set_error(err, err_len, "out of memory");
-      return -1;
-    }
-    memcpy(rel, payload + off, rel_len);
-    rel[rel_len] = '\0';
-    off += rel_len;
-
-    for (unsigned int j = 0; j < rel_len; j++) {
-      if (rel[j] == '\0') {
-        free(rel);
-        lunet_embed_set_error(err, err_len, "invalid embedded path");
-        return -1;
-      }
-    }
-
+    memcpy(rel, e->path, e->path_len);
+    rel[e->path_len] = '\0';
     if (!lunet_embed_is_safe_relative_path(rel)) {
       lunet_embed_set_error(err, err_len, "unsafe embedded path '%s'", rel);
-      free(rel);
       return -1;
     }
     if (lunet_embed_join_path(target_dir, rel, fullpath, sizeof(fullpath)) != 0) {
-      free(rel);
       lunet_embed_set_error(err, err_len, "output path too long for '%s'", rel);
       return -1;
     }
     if (lunet_embed_ensure_parent_dirs(fullpath, err, err_len) != 0) {
-      free(rel);
       return -1;
     }
-
-    if (file_len_u64 > (unsigned long long)SIZE_MAX) {
-      free(rel);
-      lunet_embed_set_error(err, err_len, "embedded file too large");
+    if (lunet_embed_inflate_entry(e, &data, &owned, err, err_len) != 0) {
       return -1;
     }
-    file_len = (size_t)file_len_u64;
-    if (lunet_embed_write_file(fullpath, payload + off, file_len, err, err_len) != 0) {
-      free(rel);
+    int rc = lunet_embed_write_file(fullpath, data, e->raw_len, err, err_len);
+    if (owned) {
+      free((void *)data);
+    }
+    if (rc != 0) {
       return -1;
     }
-    off += file_len;
-    free(rel);
-  }
-
-  if (off != payload_len) {
-    lunet_embed_set_error(err, err_len, "unexpected trailing data in embedded payload");
-    return -1;
   }
-
   return 0;
 }
 
@@ -663,36 +794,41 @@ int lunet_embed_scripts_prepare(lua_State *L,
                                 char *err,
                                 size_t err_len) {
 #ifdef LUNET_EMBED_SCRIPTS
-  unsigned char *payload = NULL;
-  size_t payload_len = 0;
+  const char *extract;
 
   if (!L || !out_dir || out_dir_len == 0) {
     lunet_embed_set_error(err, err_len, "invalid arguments");
     return -1;
   }
+  out_dir[0] = '\0';
 
-  if (lunet_embedded_scripts_gzip_len == 0) {
+  if (lunet_embedded_scripts_pack_len == 0) {
     lunet_embed_set_error(err, err_len, "embedded script blob is empty");
     return -1;
   }
-
-  if (lunet_embed_make_temp_dir(out_dir, out_dir_len, err, err_len) != 0) {
+  if (lunet_embed_build_index(err, err_len) != 0) {
     return -1;
   }
-  if (lunet_embed_decompress_gzip(lunet_embedded_scripts_gzip,
-                                  lunet_embedded_scripts_gzip_len,
-                                  &payload,
-                                  &payload_len,
-                                  err,
-                                  err_len) != 0) {
+
+  /* Served from memory unless the pack holds anything besides .lua files
+   * (a .so would silently stop resolving); LUNET_EMBED_EXTRACT=1/0 forces
+   * either mode. */
+  extract = getenv("LUNET_EMBED_EXTRACT");
+  if (extract && extract[0] != '\0') {
+    g_embed_extract = extract[0] == '1';
+  } else {
+    g_embed_extract = g_embed_other > 0;
+  }
+  if (!g_embed_extract) {
+    return lunet_embed_install_searcher(L, err, err_len);
+  }
+
+  if (lunet_embed_make_temp_dir(out_dir, out_dir_len, err, err_len) != 0) {
     return -1;
   }
-  if (lunet_embed_extract_payload(payload, payload_len, out_dir, err, err_len) != 0) {
-    free(payload);
+  if (lunet_embed_extract_all(out_dir, err, err_len) != 0) {
     return -1;
   }
-  free(payload);
-
   if (lunet_embed_patch_package_paths(L, out_dir, err, err_len) != 0) {
     return -1;
   }
@@ -707,14 +843,41 @@ int lunet_embed_scripts_prepare(lua_State *L,
 #endif
 }
 
-int lunet_embed_scripts_resolve_script(const char *embed_dir,
-                                       const char *script_arg,
-                                       char *out_script,
-                                       size_t out_script_len,
-                                       char *err,
-                                       size_t err_len) {
+int lunet_embed_scripts_attach(lua_State *L,
+                               const char *embed_dir,
+                               char *err,
+                               size_t err_len) {
 #ifdef LUNET_EMBED_SCRIPTS
-  if (!embed_dir || !script_arg || !out_script || out_script_len == 0) {
+  if (!L || !g_embed_entries) {
+    lunet_embed_set_error(err, err_len, "invalid arguments");
+    return -1;
+  }
+  if (!g_embed_extract) {
+    return lunet_embed_install_searcher(L, err, err_len);
+  }
+  if (!embed_dir || !embed_dir[0]) {
+    lunet_embed_set_error(err, err_len, "invalid arguments");
+    return -1;
+  }
+  return lunet_embed_patch_package_paths(L, embed_dir, err, err_len);
+#else
+  (void)L;
+  (void)embed_dir;
+  (void)err;
+  (void)err_len;
+  return 0;
+#endif
+}
+
+int lunet_embed_scripts_load_script(lua_State *L,
+                                    const char *embed_dir,
+                                    const char *script_arg,
+                                    char *err,
+                                    size_t err_len) {
+#ifdef LUNET_EMBED_SCRIPTS
+  char path[LUNET_EMBED_PATH_MAX];
+
+  if (!L || !script_arg) {
     lunet_embed_set_error(err, err_len, "invalid arguments");
     return -1;
   }
@@ -725,19 +888,64 @@ int lunet_embed_scripts_resolve_script(const char *embed_dir,
     lunet_embed_set_error(err, err_len, "unsafe script path '%s'", script_arg);
     return -1;
   }
-  if (lunet_embed_join_path(embed_dir, script_arg, out_script, out_script_len) != 0) {
-    lunet_embed_set_error(err, err_len, "resolved script path too long");
-    return -1;
+
+  if (g_embed_extract) {
+    if (!embed_dir ||
+        lunet_embed_join_path(embed_dir, script_arg, path, sizeof(path)) != 0) {
+      lunet_embed_set_error(err, err_len, "resolved script path too long");
+      return -1;
+    }
+    if (!lunet_embed_file_exists(path)) {
+      return 0;
+    }
+    if (luaL_loadfile(L, path) != 0) {
+      lunet_embed_set_error(err, err_len, "%s", lua_tostring(L, -1));
+      lua_pop(L, 1);
+      return -1;
+    }
+    return 1;
+  }
+
+  /* Pack paths use '/' and have no "./" segments */
+  size_t len = 0;
+  const char *p = script_arg;
+  while (*p != '\0') {
+    while (p[0] == '.' && (p[1] == '/' || p[1] == '\\')) {
+      p += 2;
+    }
+    while (*p == '/' || *p == '\\') {
+      p++;
+    }
+    while (*p != '\0' && *p != '/' && *p != '\\') {
+      if (len + 2 >= sizeof(path)) {
+        lunet_embed_set_error(err, err_len, "resolved script path too long");
+        return -1;
+      }
+      path[len++] = *p++;
+    }
+    if (*p != '\0') {
+      path[len++] = '/';
+    }
   }
-  if (!lunet_embed_file_exists(out_script)) {
+  while (len > 0 && path[len - 1] == '/') {
+    len--;
+  }
+  path[len] = '\0';
+
+  const lunet_embed_entry_t *e = lunet_embed_find(path);
+  if (!e) {
     return 0;
   }
+  if (lunet_embed_load_entry(L, e) != 0) {
+    lunet_embed_set_error(err, err_len, "%s", lua_tostring(L, -1));
+    lua_pop(L, 1);
+    return -1;
+  }
   return 1;
 #else
+  (void)L;
   (void)embed_dir;
   (void)script_arg;
-  (void)out_script;
-  (void)out_script_len;
   (void)err;
   (void)err_len;
   return 0;
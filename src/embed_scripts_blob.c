@@ -3,6 +3,6 @@
 #ifdef LUNET_EMBED_SCRIPTS
 #include "lunet_embed_scripts_blob.h"
 #else
-const unsigned char lunet_embedded_scripts_gzip[] = {0};
-const size_t lunet_embedded_scripts_gzip_len = 0;
+const unsigned char lunet_embedded_scripts_pack[] = {0};
+const size_t lunet_embedded_scripts_pack_len = 0;
 #endif
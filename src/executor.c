@@ -0,0 +1,375 @@
+#include "executor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lunet_mem.h"
+#include "metrics.h"
+#include "rt.h"
+
+typedef struct lunet_exec_port lunet_exec_port_t;
+
+typedef struct lunet_exec_job {
+  struct lunet_exec_job *next;
+  uv_work_t *req;
+  uv_work_cb work_cb;
+  uv_after_work_cb after_cb;
+  lunet_exec_port_t *port;
+  uint64_t enqueued_ns;
+  uint64_t wait_ns;
+  uint64_t run_ns;
+} lunet_exec_job_t;
+
+/*
+ * Completion side, one per (loop thread, executor). The async handle only
+ * exists while the thread has work in flight, so nothing is left open on the
+ * loop at shutdown and an idle port never keeps the loop alive.
+ */
+struct lunet_exec_port {
+  uv_async_t async;
+  uv_mutex_t mutex;
+  lunet_exec_job_t *head;
+  lunet_exec_job_t *tail;
+  int kind;
+  int inflight;  /* loop thread only */
+};
+
+typedef struct {
+  const char *name;
+  const char *full_msg;
+  int nthreads;
+  size_t max_queue;
+
+  uv_mutex_t mutex;
+  uv_cond_t cond;
+  lunet_exec_job_t *head;
+  lunet_exec_job_t *tail;
+  size_t queued;
+  int running;
+  int started;
+  int stopping;
+  uv_thread_t threads[LUNET_EXEC_MAX_THREADS];
+
+  uint64_t submitted;
+  uint64_t completed;
+  uint64_t rejected;
+  uint64_t wait_ns_total;
+  uint64_t wait_ns_max;
+  uint64_t run_ns_total;
+} lunet_executor_t;
+
+static lunet_executor_t g_executors[LUNET_EXEC_COUNT] = {
+  [LUNET_EXEC_DB] = {.name = "db", .full_msg = "db executor queue is full"},
+  [LUNET_EXEC_CPU] = {.name = "cpu", .full_msg = "cpu executor queue is full"},
+};
+static uv_once_t g_exec_once = UV_ONCE_INIT;
+static uv_mutex_t g_exec_states_mutex;
+static int g_exec_states;  /* Lua states attached to this copy of the executors */
+static LUNET_THREAD_LOCAL lunet_exec_port_t *t_ports[LUNET_EXEC_COUNT];
+
+static int exec_env_int(const char *name, int def, int lo, int hi) {
+  const char *v = getenv(name);
+  if (!v || !*v) return def;
+  char *end = NULL;
+  long n = strtol(v, &end, 10);
+  if (*end != '\0') return def;
+  if (n < lo) return lo;
+  if (n > hi) return hi;
+  return (int)n;
+}
+
+static void exec_init_once(void) {
+  int ncpu = LUNET_EXEC_DEFAULT_THREADS;
+#if UV_VERSION_HEX >= ((1 << 16) | (44 << 8) | 0)
+  ncpu = (int)uv_available_parallelism();
+#endif
+  if (ncpu > LUNET_EXEC_MAX_THREADS) ncpu = LUNET_EXEC_MAX_THREADS;
+
+  static const char *const env[LUNET_EXEC_COUNT][2] = {
+    [LUNET_EXEC_DB] = {"LUNET_DB_THREADS", "LUNET_DB_QUEUE"},
+    [LUNET_EXEC_CPU] = {"LUNET_CPU_THREADS", "LUNET_CPU_QUEUE"},
+  };
+  for (int k = 0; k < LUNET_EXEC_COUNT; k++) {
+    lunet_executor_t *ex = &g_executors[k];
+    int def = k == LUNET_EXEC_CPU ? ncpu : LUNET_EXEC_DEFAULT_THREADS;
+    ex->nthreads = exec_env_int(env[k][0], def, 1, LUNET_EXEC_MAX_THREADS);
+    ex->max_queue = (size_t)exec_env_int(env[k][1], LUNET_EXEC_DEFAULT_QUEUE, 1, 1 << 20);
+    uv_mutex_init(&ex->mutex);
+    uv_cond_init(&ex->cond);
+  }
+  uv_mutex_init(&g_exec_states_mutex);
+}
+
+static void exec_thread(void *arg) {
+  lunet_executor_t *ex = (lunet_executor_t *)arg;
+  for (;;) {
+    uv_mutex_lock(&ex->mutex);
+    while (!ex->head && !ex->stopping) uv_cond_wait(&ex->cond, &ex->mutex);
+    if (ex->stopping) {
+      uv_mutex_unlock(&ex->mutex);
+      return;
+    }
+    lunet_exec_job_t *job = ex->head;
+    ex->head = job->next;
+    if (!ex->head) ex->tail = NULL;
+    ex->queued--;
+    ex->running++;
+    uint64_t start = uv_hrtime();
+    job->wait_ns = start - job->enqueued_ns;
+    ex->wait_ns_total += job->wait_ns;
+    if (job->wait_ns > ex->wait_ns_max) ex->wait_ns_max = job->wait_ns;
+    uv_mutex_unlock(&ex->mutex);
+
+    job->work_cb(job->req);
+    job->run_ns = uv_hrtime() - start;
+
+    uv_mutex_lock(&ex->mutex);
+    ex->running--;
+    ex->completed++;
+    ex->run_ns_total += job->run_ns;
+    /* After shutdown the loop that queued the job is gone: drop it. Checked
+     * under ex->mutex so lunet_exec_shutdown() never races a send */
+    if (ex->stopping) {
+      uv_mutex_unlock(&ex->mutex);
+      lunet_free_nonnull(job);
+      continue;
+    }
+
+    /* Send with the port lock held: once the loop pops this job the port may
+     * be closed, so the worker must be done with it by then */
+    lunet_exec_port_t *port = job->port;
+    job->next = NULL;
+    uv_mutex_lock(&port->mutex);
+    if (port->tail) port->tail->next = job;
+    else port->head = job;
+    port->tail = job;
+    uv_async_send(&port->async);
+    uv_mutex_unlock(&port->mutex);
+    uv_mutex_unlock(&ex->mutex);
+  }
+}
+
+/* Caller holds ex->mutex */
+static int exec_start(lunet_executor_t *ex) {
+  for (int i = ex->started; i < ex->nthreads; i++) {
+    int rc = uv_thread_create(&ex->threads[i], exec_thread, ex);
+    if (rc < 0) {
+      if (ex->started == 0) return rc;
+      fprintf(stderr, "[LUNET] %s executor: started %d of %d threads: %s\n",
+              ex->name, ex->started, ex->nthreads, uv_strerror(rc));
+      ex->nthreads = ex->started;
+      return 0;
+    }
+    ex->started++;
+  }
+  return 0;
+}
+
+void lunet_exec_shutdown(void) {
+  uv_once(&g_exec_once, exec_init_once);
+  for (int k = 0; k < LUNET_EXEC_COUNT; k++) {
+    lunet_executor_t *ex = &g_executors[k];
+    uv_mutex_lock(&ex->mutex);
+    ex->stopping = 1;
+    lunet_exec_job_t *job = ex->head;
+    ex->head = ex->tail = NULL;
+    ex->queued = 0;
+    int started = ex->started;
+    ex->started = 0;
+    uv_cond_broadcast(&ex->cond);
+    uv_mutex_unlock(&ex->mutex);
+
+    /* Cancelled: their after_cb would resume coroutines in a closed state */
+    while (job) {
+      lunet_exec_job_t *next = job->next;
+      lunet_free_nonnull(job);
+      job = next;
+    }
+    for (int i = 0; i < started; i++) uv_thread_join(&ex->threads[i]);
+  }
+}
+
+/* Runs from lua_close, before the _LOADLIB finalizer that dlcloses the
+ * module: it was created after the library handle, so it is finalized first */
+static int exec_state_gc(lua_State *L) {
+  (void)L;
+  uv_mutex_lock(&g_exec_states_mutex);
+  int last = --g_exec_states == 0;
+  uv_mutex_unlock(&g_exec_states_mutex);
+  if (last) lunet_exec_shutdown();
+  return 0;
+}
+
+void lunet_exec_attach(lua_State *L) {
+  uv_once(&g_exec_once, exec_init_once);
+  /* Keyed by this copy's counter: each driver module links its own executors
+   * unless symbols are interposed */
+  lua_pushlightuserdata(L, (void *)&g_exec_states);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  int attached = !lua_isnil(L, -1);
+  lua_pop(L, 1);
+  if (attached) return;
+
+  lua_pushlightuserdata(L, (void *)&g_exec_states);
+  lua_newuserdata(L, 1);
+  lua_createtable(L, 0, 1);
+  lua_pushcfunction(L, exec_state_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_setmetatable(L, -2);
+  lua_rawset(L, LUA_REGISTRYINDEX);
+
+  uv_mutex_lock(&g_exec_states_mutex);
+  g_exec_states++;
+  uv_mutex_unlock(&g_exec_states_mutex);
+}
+
+static void exec_port_close_cb(uv_handle_t *handle) {
+  lunet_exec_port_t *port = (lunet_exec_port_t *)handle->data;
+  uv_mutex_destroy(&port->mutex);
+  lunet_free_nonnull(port);
+}
+
+static void exec_port_async_cb(uv_async_t *handle) {
+  lunet_exec_port_t *port = (lunet_exec_port_t *)handle->data;
+
+  uv_mutex_lock(&port->mutex);
+  lunet_exec_job_t *job = port->head;
+  port->head = port->tail = NULL;
+  uv_mutex_unlock(&port->mutex);
+
+  while (job) {
+    lunet_exec_job_t *next = job->next;
+    uv_work_t *req = job->req;
+    uv_after_work_cb after_cb = job->after_cb;
+#ifdef LUNET_TRACE_VERBOSE
+    fprintf(stderr, "[EXEC_TRACE] DONE %s req=%p wait=%.3fms run=%.3fms\n",
+            g_executors[port->kind].name, (void *)req, (double)job->wait_ns / 1e6,
+            (double)job->run_ns / 1e6);
+#endif
+    int db = port->kind == LUNET_EXEC_DB;
+    lunet_metrics_record(db ? LUNET_METRIC_DB_QUEUE : LUNET_METRIC_CPU_QUEUE, job->wait_ns);
+    lunet_metrics_record(db ? LUNET_METRIC_DB_EXEC : LUNET_METRIC_CPU_EXEC, job->run_ns);
+    lunet_free_nonnull(job);
+    port->inflight--;
+    /* May queue more work on this port */
+    after_cb(req, 0);
+    job = next;
+  }
+
+  if (port->inflight == 0 && t_ports[port->kind] == port) {
+    t_ports[port->kind] = NULL;
+    uv_close((uv_handle_t *)&port->async, exec_port_close_cb);
+  }
+}
+
+static lunet_exec_port_t *exec_port_get(lunet_exec_kind_t kind) {
+  lunet_exec_port_t *port = t_ports[kind];
+  if (port) return port;
+  port = lunet_calloc(1, sizeof(*port));
+  if (!port) return NULL;
+  if (uv_async_init(lunet_loop(), &port->async, exec_port_async_cb) < 0) {
+    lunet_free(port);
+    return NULL;
+  }
+  uv_mutex_init(&port->mutex);
+  port->async.data = port;
+  port->kind = (int)kind;
+  t_ports[kind] = port;
+  return port;
+}
+
+int lunet_exec_queue(lunet_exec_kind_t kind, uv_work_t *req, uv_work_cb work_cb,
+                     uv_after_work_cb after_cb) {
+  if ((int)kind < 0 || kind >= LUNET_EXEC_COUNT) return UV_EINVAL;
+  uv_once(&g_exec_once, exec_init_once);
+  lunet_executor_t *ex = &g_executors[kind];
+
+  lunet_exec_job_t *job = lunet_alloc(sizeof(*job));
+  if (!job) return UV_ENOMEM;
+  lunet_exec_port_t *port = exec_port_get(kind);
+  if (!port) {
+    lunet_free(job);
+    return UV_ENOMEM;
+  }
+  job->next = NULL;
+  job->req = req;
+  job->work_cb = work_cb;
+  job->after_cb = after_cb;
+  job->port = port;
+  job->enqueued_ns = uv_hrtime();
+
+  uv_mutex_lock(&ex->mutex);
+  int rc = ex->stopping ? UV_ECANCELED : ex->started ? 0 : exec_start(ex);
+  if (rc == 0 && ex->queued >= ex->max_queue) rc = UV_EAGAIN;
+  if (rc < 0) {
+    ex->rejected++;
+    uv_mutex_unlock(&ex->mutex);
+    lunet_free(job);
+    if (port->inflight == 0) {
+      t_ports[kind] = NULL;
+      uv_close((uv_handle_t *)&port->async, exec_port_close_cb);
+    }
+    return rc;
+  }
+  if (ex->tail) ex->tail->next = job;
+  else ex->head = job;
+  ex->tail = job;
+  ex->queued++;
+  ex->submitted++;
+  uv_cond_signal(&ex->cond);
+  uv_mutex_unlock(&ex->mutex);
+
+  port->inflight++;
+  return 0;
+}
+
+const char *lunet_exec_strerror(lunet_exec_kind_t kind, int rc) {
+  if (rc == UV_EAGAIN && (int)kind >= 0 && kind < LUNET_EXEC_COUNT) {
+    return g_executors[kind].full_msg;
+  }
+  if (rc == UV_ECANCELED) return "executor is shut down";
+  return uv_strerror(rc);
+}
+
+void lunet_exec_push_stats(lua_State *L, lunet_exec_kind_t kind) {
+  uv_once(&g_exec_once, exec_init_once);
+  lunet_executor_t *ex = &g_executors[kind];
+
+  uv_mutex_lock(&ex->mutex);
+  int nthreads = ex->nthreads;
+  size_t max_queue = ex->max_queue;
+  size_t queued = ex->queued;
+  int running = ex->running;
+  uint64_t submitted = ex->submitted;
+  uint64_t completed = ex->completed;
+  uint64_t rejected = ex->rejected;
+  uint64_t wait_total = ex->wait_ns_total;
+  uint64_t wait_max = ex->wait_ns_max;
+  uint64_t run_total = ex->run_ns_total;
+  uv_mutex_unlock(&ex->mutex);
+
+  lua_createtable(L, 0, 11);
+  lua_pushstring(L, ex->name);
+  lua_setfield(L, -2, "name");
+  lua_pushinteger(L, nthreads);
+  lua_setfield(L, -2, "threads");
+  lua_pushinteger(L, (lua_Integer)max_queue);
+  lua_setfield(L, -2, "queue_max");
+  lua_pushinteger(L, (lua_Integer)queued);
+  lua_setfield(L, -2, "queued");
+  lua_pushinteger(L, running);
+  lua_setfield(L, -2, "running");
+  lua_pushnumber(L, (lua_Number)submitted);
+  lua_setfield(L, -2, "submitted");
+  lua_pushnumber(L, (lua_Number)completed);
+  lua_setfield(L, -2, "completed");
+  lua_pushnumber(L, (lua_Number)rejected);
+  lua_setfield(L, -2, "rejected");
+  lua_pushnumber(L, (lua_Number)wait_total / 1e6);
+  lua_setfield(L, -2, "wait_ms_total");
+  lua_pushnumber(L, (lua_Number)wait_max / 1e6);
+  lua_setfield(L, -2, "wait_ms_max");
+  lua_pushnumber(L, (lua_Number)run_total / 1e6);
+  lua_setfield(L, -2, "run_ms_total");
+}
@@ -1,13 +1,25 @@
 #include "fs.h"
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <uv.h>
 
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "buffer.h"
 #include "co.h"
 #include "trace.h"
 #include "lunet_mem.h"
+#include "metrics.h"
+#include "rt.h"
 
 /*
  * FS domain tracing
@@ -56,10 +68,12 @@ typedef struct {
   uv_fs_t req;
   lua_State *L;
   int co_ref;
+  uint64_t start_ns;
 } fs_ctx_t;
 
 static void lunet_fs_open_cb(uv_fs_t *req) {
   fs_ctx_t *ctx = (fs_ctx_t *)req->data;
+  lunet_metrics_since(LUNET_METRIC_FS, ctx->start_ns);
   lua_State *L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -171,7 +185,8 @@ int lunet_fs_open(lua_State *L) {
 
   FS_TRACE_OPEN(path);
 
-  int rc = uv_fs_open(uv_default_loop(), &ctx->req, path, flags, 0644, lunet_fs_open_cb);
+  ctx->start_ns = uv_hrtime();
+  int rc = uv_fs_open(lunet_loop(), &ctx->req, path, flags, 0644, lunet_fs_open_cb);
   if (rc < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free(ctx);
@@ -187,10 +202,12 @@ typedef struct {
   uv_fs_t req;
   lua_State *L;
   int co_ref;
+  uint64_t start_ns;
 } fs_close_ctx_t;
 
 static void lunet_fs_close_cb(uv_fs_t *req) {
   fs_close_ctx_t *ctx = (fs_close_ctx_t *)req->data;
+  lunet_metrics_since(LUNET_METRIC_FS, ctx->start_ns);
   lua_State *L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -241,7 +258,8 @@ int lunet_fs_close(lua_State *L) {
 
   FS_TRACE_CLOSE(fd);
 
-  int rc = uv_fs_close(uv_default_loop(), &ctx->req, fd, lunet_fs_close_cb);
+  ctx->start_ns = uv_hrtime();
+  int rc = uv_fs_close(lunet_loop(), &ctx->req, fd, lunet_fs_close_cb);
   if (rc < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free(ctx);
@@ -256,10 +274,12 @@ typedef struct {
   uv_fs_t req;
   lua_State *L;
   int co_ref;
+  uint64_t start_ns;
 } fs_stat_ctx_t;
 
 static void lunet_fs_stat_cb(uv_fs_t *req) {
   fs_stat_ctx_t *ctx = (fs_stat_ctx_t *)req->data;
+  lunet_metrics_since(LUNET_METRIC_FS, ctx->start_ns);
   lua_State *L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -348,7 +368,8 @@ int lunet_fs_stat(lua_State *L) {
 
   FS_TRACE_STAT(path);
 
-  int rc = uv_fs_stat(uv_default_loop(), &ctx->req, path, lunet_fs_stat_cb);
+  ctx->start_ns = uv_hrtime();
+  int rc = uv_fs_stat(lunet_loop(), &ctx->req, path, lunet_fs_stat_cb);
   if (rc < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free(ctx);
@@ -364,12 +385,14 @@ typedef struct {
   uv_fs_t req;
   lua_State *L;
   int co_ref;
+  uint64_t start_ns;
   size_t len;
   char *buf;
 } fs_read_ctx_t;
 
 static void lunet_fs_read_cb(uv_fs_t *req) {
   fs_read_ctx_t *ctx = (fs_read_ctx_t *)req->data;
+  lunet_metrics_since(LUNET_METRIC_FS, ctx->start_ns);
   lua_State *L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -436,7 +459,8 @@ int lunet_fs_read(lua_State *L) {
   FS_TRACE_READ(fd, len);
 
   uv_buf_t buf = uv_buf_init(ctx->buf, len);
-  int rc = uv_fs_read(uv_default_loop(), &ctx->req, fd, &buf, 1, 0, lunet_fs_read_cb);
+  ctx->start_ns = uv_hrtime();
+  int rc = uv_fs_read(lunet_loop(), &ctx->req, fd, &buf, 1, 0, lunet_fs_read_cb);
   if (rc < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->buf);
@@ -453,12 +477,14 @@ typedef struct {
   uv_fs_t req;
   lua_State *L;
   int co_ref;
+  uint64_t start_ns;
   size_t len;
   char *buf;
 } fs_write_ctx_t;
 
 static void lunet_fs_write_cb(uv_fs_t *req) {
   fs_write_ctx_t *ctx = (fs_write_ctx_t *)req->data;
+  lunet_metrics_since(LUNET_METRIC_FS, ctx->start_ns);
   lua_State *L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -527,7 +553,8 @@ int lunet_fs_write(lua_State *L) {
   FS_TRACE_WRITE(fd, len);
 
   uv_buf_t buf = uv_buf_init(ctx->buf, len);
-  int rc = uv_fs_write(uv_default_loop(), &ctx->req, fd, &buf, 1, 0, lunet_fs_write_cb);
+  ctx->start_ns = uv_hrtime();
+  int rc = uv_fs_write(lunet_loop(), &ctx->req, fd, &buf, 1, 0, lunet_fs_write_cb);
   if (rc < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free_nonnull(ctx->buf);
@@ -540,10 +567,343 @@ int lunet_fs_write(lua_State *L) {
   return lua_yield(L, 0);
 }
 
+/*
+ * Positional and vectored I/O. Every call names its own offset, so coroutines
+ * sharing one fd never race on the file position. Write data is pinned in the
+ * registry instead of copied, and fs.pread can fill a caller-owned buffer
+ * (lunet.buffer, FFI array cdata or lightuserdata) so hot readers do not
+ * allocate per call.
+ */
+#define FS_IO_MAX_BUFS 1024
+/* uv_buf_t lengths are unsigned int and results come back as an int count */
+#define FS_IO_MAX_LEN ((size_t)INT_MAX)
+/* Every offset below 2^53 is exact as a lua_Number */
+#define FS_IO_MAX_OFFSET 9007199254740992.0
+
+typedef enum {
+  FS_IO_READ = 0,   /* result is a string */
+  FS_IO_READ_INTO,  /* result is a byte count, data is in the caller's buffer */
+  FS_IO_READV,      /* result is a table of strings */
+  FS_IO_WRITE,      /* result is a byte count */
+} fs_io_kind_t;
+
 typedef struct {
   uv_fs_t req;
   lua_State *L;
   int co_ref;
+  uint64_t start_ns;
+  int pin_ref;      /* caller's strings or buffer, LUA_NOREF if none */
+  fs_io_kind_t kind;
+  unsigned int nbufs;
+  uv_buf_t *bufs;   /* &one unless nbufs > 1 */
+  uv_buf_t one;
+  char *mem;        /* read storage owned by the request */
+} fs_io_ctx_t;
+
+static fs_io_ctx_t *fs_io_ctx_new(fs_io_kind_t kind, unsigned int nbufs) {
+  fs_io_ctx_t *ctx = lunet_calloc(1, sizeof(fs_io_ctx_t));
+  if (!ctx) return NULL;
+  ctx->pin_ref = LUA_NOREF;
+  ctx->kind = kind;
+  ctx->nbufs = nbufs;
+  ctx->bufs = &ctx->one;
+  if (nbufs > 1) {
+    ctx->bufs = lunet_alloc(sizeof(uv_buf_t) * nbufs);
+    if (!ctx->bufs) {
+      lunet_free(ctx);
+      return NULL;
+    }
+  }
+  return ctx;
+}
+
+static void fs_io_ctx_free(fs_io_ctx_t *ctx) {
+  if (ctx->bufs != &ctx->one) lunet_free(ctx->bufs);
+  lunet_free(ctx->mem);
+  lunet_free_nonnull(ctx);
+}
+
+/* Pins the value at idx until the request completes */
+static void fs_io_pin(lua_State *L, fs_io_ctx_t *ctx, int idx) {
+  lua_pushvalue(L, idx);
+  lunet_coref_create_raw(L, ctx->pin_ref);
+}
+
+static void fs_io_push_chunks(lua_State *co, fs_io_ctx_t *ctx, size_t n) {
+  lua_createtable(co, (int)ctx->nbufs, 0);
+  for (unsigned int i = 0; i < ctx->nbufs && n > 0; i++) {
+    size_t take = ctx->bufs[i].len < n ? ctx->bufs[i].len : n;
+    lua_pushlstring(co, ctx->bufs[i].base, take);
+    lua_rawseti(co, -2, (int)i + 1);
+    n -= take;
+  }
+}
+
+static void lunet_fs_io_cb(uv_fs_t *req) {
+  fs_io_ctx_t *ctx = (fs_io_ctx_t *)req->data;
+  lunet_metrics_since(LUNET_METRIC_FS, ctx->start_ns);
+  lua_State *L = ctx->L;
+
+  if (ctx->pin_ref != LUA_NOREF) lunet_coref_release(L, ctx->pin_ref);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
+  lunet_coref_release(L, ctx->co_ref);
+
+  if (!lua_isthread(L, -1)) {
+    lua_pop(L, 1);
+    fprintf(stderr, "invalid coroutine in fs positional I/O\n");
+    goto cleanup;
+  }
+
+  lua_State *co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+
+  if (req->result < 0) {
+    lua_pushnil(co);
+    lua_pushstring(co, uv_strerror((int)req->result));
+  } else {
+    switch (ctx->kind) {
+      case FS_IO_READ:
+        lua_pushlstring(co, ctx->mem, (size_t)req->result);
+        break;
+      case FS_IO_READV:
+        fs_io_push_chunks(co, ctx, (size_t)req->result);
+        break;
+      default:
+        lua_pushinteger(co, (lua_Integer)req->result);
+        break;
+    }
+    lua_pushnil(co);
+  }
+
+  lunet_co_resume(co, 2);
+
+cleanup:
+  uv_fs_req_cleanup(req);
+  fs_io_ctx_free(ctx);
+}
+
+static inline size_t fs_io_total(const fs_io_ctx_t *ctx) {
+  size_t n = 0;
+  for (unsigned int i = 0; i < ctx->nbufs; i++) n += ctx->bufs[i].len;
+  return n;
+}
+
+static int fs_io_submit(lua_State *L, fs_io_ctx_t *ctx, uv_file fd, int64_t offset) {
+  ctx->L = L;
+  ctx->req.data = ctx;
+  lunet_coref_create(L, ctx->co_ref);
+  ctx->start_ns = uv_hrtime();
+
+  int rc;
+  if (ctx->kind == FS_IO_WRITE) {
+    FS_TRACE_WRITE(fd, fs_io_total(ctx));
+    rc = uv_fs_write(lunet_loop(), &ctx->req, fd, ctx->bufs, ctx->nbufs, offset, lunet_fs_io_cb);
+  } else {
+    FS_TRACE_READ(fd, fs_io_total(ctx));
+    rc = uv_fs_read(lunet_loop(), &ctx->req, fd, ctx->bufs, ctx->nbufs, offset, lunet_fs_io_cb);
+  }
+  if (rc < 0) {
+    lunet_coref_release(L, ctx->co_ref);
+    if (ctx->pin_ref != LUA_NOREF) lunet_coref_release(L, ctx->pin_ref);
+    fs_io_ctx_free(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, uv_strerror(rc));
+    return 2;
+  }
+
+  return lua_yield(L, 0);
+}
+
+static int fs_io_error(lua_State *L, const char *msg) {
+  lua_pushnil(L);
+  lua_pushstring(L, msg);
+  return 2;
+}
+
+/* Offsets are explicit: a negative one would silently mean "current position" */
+static int fs_io_check_offset(lua_State *L, int idx, int64_t *offset) {
+  if (!lua_isnumber(L, idx)) return 0;
+  lua_Number n = lua_tonumber(L, idx);
+  if (!(n >= 0) || n >= FS_IO_MAX_OFFSET) return 0;  /* NaN too */
+  *offset = (int64_t)n;
+  return 1;
+}
+
+/* A length at idx in [0, FS_IO_MAX_LEN] */
+static int fs_io_check_len(lua_State *L, int idx, size_t *len) {
+  if (!lua_isnumber(L, idx)) return 0;
+  lua_Number n = lua_tonumber(L, idx);
+  if (!(n >= 0) || n > (lua_Number)FS_IO_MAX_LEN) return 0;
+  *len = (size_t)n;
+  return 1;
+}
+
+int lunet_fs_pread(lua_State *L) {
+  if (lunet_ensure_coroutine(L, "fs.pread") != 0) {
+    return lua_error(L);
+  }
+  int64_t offset;
+  size_t len;
+  if (!lua_isnumber(L, 1) || !fs_io_check_len(L, 2, &len) ||
+      !fs_io_check_offset(L, 3, &offset)) {
+    return fs_io_error(L, "fs.pread requires fd, length and offset");
+  }
+  uv_file fd = (uv_file)lua_tointeger(L, 1);
+
+  /* Only a lunet.buffer carries its length; raw pointers could be overrun */
+  char *dst = NULL;
+  if (!lua_isnoneornil(L, 4)) {
+    lunet_buffer_t *b = lunet_buffer_test(L, 4);
+    if (!b) {
+      return fs_io_error(L, "fs.pread buffer must be a lunet.buffer");
+    }
+    dst = b->data;
+    if (len > b->len) len = b->len;
+  }
+
+  fs_io_ctx_t *ctx = fs_io_ctx_new(dst ? FS_IO_READ_INTO : FS_IO_READ, 1);
+  if (!ctx) {
+    return fs_io_error(L, "fs.pread out of memory");
+  }
+  if (dst) {
+    fs_io_pin(L, ctx, 4);
+  } else {
+    ctx->mem = lunet_alloc(len ? len : 1);
+    if (!ctx->mem) {
+      fs_io_ctx_free(ctx);
+      return fs_io_error(L, "fs.pread out of memory");
+    }
+    dst = ctx->mem;
+  }
+  ctx->one = uv_buf_init(dst, (unsigned int)len);
+
+  return fs_io_submit(L, ctx, fd, offset);
+}
+
+int lunet_fs_pwrite(lua_State *L) {
+  if (lunet_ensure_coroutine(L, "fs.pwrite") != 0) {
+    return lua_error(L);
+  }
+  int64_t offset;
+  if (!lua_isnumber(L, 1) ||
+      (lua_type(L, 2) != LUA_TSTRING && !lunet_buffer_test(L, 2)) ||
+      !fs_io_check_offset(L, 3, &offset)) {
+    return fs_io_error(L, "fs.pwrite requires fd, data and offset");
+  }
+  uv_file fd = (uv_file)lua_tointeger(L, 1);
+  size_t len;
+  const char *data = lunet_buffer_tobytes(L, 2, &len);
+
+  fs_io_ctx_t *ctx = fs_io_ctx_new(FS_IO_WRITE, 1);
+  if (!ctx) {
+    return fs_io_error(L, "fs.pwrite out of memory");
+  }
+  fs_io_pin(L, ctx, 2);
+  ctx->one = uv_buf_init((char *)data, (unsigned int)len);
+
+  return fs_io_submit(L, ctx, fd, offset);
+}
+
+int lunet_fs_preadv(lua_State *L) {
+  if (lunet_ensure_coroutine(L, "fs.preadv") != 0) {
+    return lua_error(L);
+  }
+  int64_t offset;
+  if (!lua_isnumber(L, 1) || !lua_istable(L, 2) || !fs_io_check_offset(L, 3, &offset)) {
+    return fs_io_error(L, "fs.preadv requires fd, a table of lengths and offset");
+  }
+  uv_file fd = (uv_file)lua_tointeger(L, 1);
+  size_t nbufs = lua_objlen(L, 2);
+  if (nbufs == 0 || nbufs > FS_IO_MAX_BUFS) {
+    return fs_io_error(L, "fs.preadv takes 1 to 1024 lengths");
+  }
+
+  size_t total = 0;
+  for (size_t i = 1; i <= nbufs; i++) {
+    lua_rawgeti(L, 2, (int)i);
+    size_t n;
+    int ok = fs_io_check_len(L, -1, &n);
+    lua_pop(L, 1);
+    if (!ok) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "fs.preadv length %d must be a non-negative number", (int)i);
+      return 2;
+    }
+    if (n > FS_IO_MAX_LEN - total) {
+      return fs_io_error(L, "fs.preadv lengths add up to more than 2 GiB");
+    }
+    total += n;
+  }
+
+  fs_io_ctx_t *ctx = fs_io_ctx_new(FS_IO_READV, (unsigned int)nbufs);
+  if (!ctx) {
+    return fs_io_error(L, "fs.preadv out of memory");
+  }
+  /* One block for all chunks */
+  ctx->mem = lunet_alloc(total ? total : 1);
+  if (!ctx->mem) {
+    fs_io_ctx_free(ctx);
+    return fs_io_error(L, "fs.preadv out of memory");
+  }
+  char *p = ctx->mem;
+  for (size_t i = 0; i < nbufs; i++) {
+    lua_rawgeti(L, 2, (int)i + 1);
+    size_t len = (size_t)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    ctx->bufs[i] = uv_buf_init(p, (unsigned int)len);
+    p += len;
+  }
+
+  return fs_io_submit(L, ctx, fd, offset);
+}
+
+int lunet_fs_pwritev(lua_State *L) {
+  if (lunet_ensure_coroutine(L, "fs.pwritev") != 0) {
+    return lua_error(L);
+  }
+  int64_t offset;
+  if (!lua_isnumber(L, 1) || !lua_istable(L, 2) || !fs_io_check_offset(L, 3, &offset)) {
+    return fs_io_error(L, "fs.pwritev requires fd, a table of strings or buffers and offset");
+  }
+  uv_file fd = (uv_file)lua_tointeger(L, 1);
+  size_t nbufs = lua_objlen(L, 2);
+  if (nbufs == 0 || nbufs > FS_IO_MAX_BUFS) {
+    return fs_io_error(L, "fs.pwritev takes 1 to 1024 chunks");
+  }
+  for (size_t i = 1; i <= nbufs; i++) {
+    lua_rawgeti(L, 2, (int)i);
+    int ok = lua_type(L, -1) == LUA_TSTRING || lunet_buffer_test(L, -1);
+    lua_pop(L, 1);
+    if (!ok) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "fs.pwritev chunk %d must be a string or lunet.buffer", (int)i);
+      return 2;
+    }
+  }
+
+  fs_io_ctx_t *ctx = fs_io_ctx_new(FS_IO_WRITE, (unsigned int)nbufs);
+  if (!ctx) {
+    return fs_io_error(L, "fs.pwritev out of memory");
+  }
+  /* Pin a private copy of the table so callers may reuse theirs meanwhile */
+  lua_createtable(L, (int)nbufs, 0);
+  for (size_t i = 0; i < nbufs; i++) {
+    lua_rawgeti(L, 2, (int)i + 1);
+    size_t len;
+    const char *data = lunet_buffer_tobytes(L, -1, &len);
+    ctx->bufs[i] = uv_buf_init((char *)data, (unsigned int)len);
+    lua_rawseti(L, -2, (int)i + 1);
+  }
+  lunet_coref_create_raw(L, ctx->pin_ref);
+
+  return fs_io_submit(L, ctx, fd, offset);
+}
+
+typedef struct {
+  uv_fs_t req;
+  lua_State *L;
+  int co_ref;
+  uint64_t start_ns;
 } fs_scandir_ctx_t;
 
 const char *dirent_type_to_string(uv_dirent_type_t type) {
@@ -561,6 +921,7 @@ const char *dirent_type_to_string(uv_dirent_type_t type) {
 
 static void lunet_fs_scandir_cb(uv_fs_t *req) {
   fs_scandir_ctx_t *ctx = (fs_scandir_ctx_t *)req->data;
+  lunet_metrics_since(LUNET_METRIC_FS, ctx->start_ns);
   lua_State *L = ctx->L;
 
   lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
@@ -627,7 +988,8 @@ int lunet_fs_scandir(lua_State *L) {
 
   FS_TRACE_SCANDIR(path);
 
-  int rc = uv_fs_scandir(uv_default_loop(), &ctx->req, path, 0, lunet_fs_scandir_cb);
+  ctx->start_ns = uv_hrtime();
+  int rc = uv_fs_scandir(lunet_loop(), &ctx->req, path, 0, lunet_fs_scandir_cb);
   if (rc < 0) {
     lunet_coref_release(L, ctx->co_ref);
     lunet_free(ctx);
@@ -638,3 +1000,753 @@ int lunet_fs_scandir(lua_State *L) {
 
   return lua_yield(L, 0);
 }
+
+/*
+ * fs.mmap: read-only MAP_SHARED file mappings. The pages live in the page
+ * cache, so every process mapping the same file shares one copy and nothing
+ * is duplicated into Lua strings. open + fstat + mmap run on the libuv pool.
+ * The mapping is released by m:close() or __gc, whichever comes first.
+ */
+#define LUNET_FS_MMAP_MT "lunet.fs.mmap"
+
+typedef struct {
+  void *addr;   /* NULL for an empty file or once closed */
+  size_t len;
+  int closed;
+} fs_mmap_t;
+
+#ifndef _WIN32
+typedef struct {
+  uv_work_t req;
+  lua_State *L;
+  int co_ref;
+  uint64_t start_ns;
+  int advice;
+  char *path;
+  void *addr;
+  size_t len;
+  int err;      /* errno, 0 on success */
+} fs_mmap_ctx_t;
+
+static int fs_mmap_advice(const char *hint, int *advice) {
+  static const struct {
+    const char *name;
+    int advice;
+  } hints[] = {
+    {"normal", MADV_NORMAL},
+    {"sequential", MADV_SEQUENTIAL},
+    {"random", MADV_RANDOM},
+    {"willneed", MADV_WILLNEED},
+    {"dontneed", MADV_DONTNEED},
+  };
+  for (size_t i = 0; i < sizeof(hints) / sizeof(hints[0]); i++) {
+    if (strcmp(hint, hints[i].name) == 0) {
+      *advice = hints[i].advice;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void fs_mmap_work(uv_work_t *req) {
+  fs_mmap_ctx_t *ctx = (fs_mmap_ctx_t *)req->data;
+  int fd = open(ctx->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    ctx->err = errno;
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ctx->err = errno;
+  } else if (!S_ISREG(st.st_mode)) {
+    ctx->err = EINVAL;
+  } else if (st.st_size > 0) {
+    ctx->len = (size_t)st.st_size;
+    void *addr = mmap(NULL, ctx->len, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      ctx->err = errno;
+    } else {
+      ctx->addr = addr;
+      if (ctx->advice >= 0) madvise(addr, ctx->len, ctx->advice);
+    }
+  }
+  /* The mapping keeps its own reference to the file */
+  close(fd);
+}
+
+static void fs_mmap_after(uv_work_t *req, int status) {
+  fs_mmap_ctx_t *ctx = (fs_mmap_ctx_t *)req->data;
+  lunet_metrics_since(LUNET_METRIC_FS, ctx->start_ns);
+  lua_State *L = ctx->L;
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
+  lunet_coref_release(L, ctx->co_ref);
+
+  if (!lua_isthread(L, -1)) {
+    lua_pop(L, 1);
+    fprintf(stderr, "invalid coroutine in fs.mmap\n");
+    if (ctx->addr) munmap(ctx->addr, ctx->len);
+    goto cleanup;
+  }
+
+  lua_State *co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+
+  if (status < 0 || ctx->err != 0) {
+    lua_pushnil(co);
+    lua_pushstring(co, status < 0 ? uv_strerror(status) : uv_strerror(uv_translate_sys_error(ctx->err)));
+  } else {
+    fs_mmap_t *m = (fs_mmap_t *)lua_newuserdata(co, sizeof(fs_mmap_t));
+    m->addr = ctx->addr;
+    m->len = ctx->addr ? ctx->len : 0;
+    m->closed = 0;
+    luaL_getmetatable(co, LUNET_FS_MMAP_MT);
+    lua_setmetatable(co, -2);
+    lua_pushnil(co);
+  }
+
+  lunet_co_resume(co, 2);
+
+cleanup:
+  lunet_free(ctx->path);
+  lunet_free_nonnull(ctx);
+}
+
+static void fs_mmap_unmap(fs_mmap_t *m) {
+  if (m->addr) munmap(m->addr, m->len);
+  m->addr = NULL;
+  m->len = 0;
+  m->closed = 1;
+}
+#else
+static void fs_mmap_unmap(fs_mmap_t *m) {
+  m->addr = NULL;
+  m->len = 0;
+  m->closed = 1;
+}
+#endif
+
+static fs_mmap_t *fs_mmap_check(lua_State *L) {
+  fs_mmap_t *m = (fs_mmap_t *)luaL_checkudata(L, 1, LUNET_FS_MMAP_MT);
+  if (m->closed) luaL_error(L, "mapping is closed");
+  return m;
+}
+
+static int fs_mmap_gc(lua_State *L) {
+  fs_mmap_t *m = (fs_mmap_t *)luaL_checkudata(L, 1, LUNET_FS_MMAP_MT);
+  if (!m->closed) fs_mmap_unmap(m);
+  return 0;
+}
+
+// m:len() / #m
+static int fs_mmap_len(lua_State *L) {
+  fs_mmap_t *m = fs_mmap_check(L);
+  lua_pushinteger(L, (lua_Integer)m->len);
+  return 1;
+}
+
+// m:sub(offset, len) -> string. offset is 0-based; the slice is clamped to the mapping.
+static int fs_mmap_sub(lua_State *L) {
+  fs_mmap_t *m = fs_mmap_check(L);
+  lua_Number off = luaL_checknumber(L, 2);
+  lua_Number n = luaL_optnumber(L, 3, (lua_Number)m->len);
+  if (off < 0 || n <= 0 || off >= (lua_Number)m->len) {
+    lua_pushliteral(L, "");
+    return 1;
+  }
+  size_t start = (size_t)off;
+  size_t count = (size_t)n;
+  if (count > m->len - start) count = m->len - start;
+  lua_pushlstring(L, (const char *)m->addr + start, count);
+  return 1;
+}
+
+// m:ptr() -> lightuserdata for ffi.cast("const uint8_t *", m:ptr()). Valid while m is.
+static int fs_mmap_ptr(lua_State *L) {
+  fs_mmap_t *m = fs_mmap_check(L);
+  lua_pushlightuserdata(L, m->addr);
+  return 1;
+}
+
+// m:advise(hint [, offset, len]) -> true | nil, err
+static int fs_mmap_advise(lua_State *L) {
+  fs_mmap_t *m = fs_mmap_check(L);
+  const char *hint = luaL_checkstring(L, 2);
+#ifndef _WIN32
+  int advice;
+  if (!fs_mmap_advice(hint, &advice)) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "unknown advice \"%s\"", hint);
+    return 2;
+  }
+  if (!m->addr) {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  /* madvise needs a page-aligned start */
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t off = (size_t)luaL_optnumber(L, 3, 0);
+  size_t len = (size_t)luaL_optnumber(L, 4, (lua_Number)m->len);
+  if (off >= m->len) {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  if (len > m->len - off) len = m->len - off;
+  size_t aligned = off - off % page;
+  if (madvise((char *)m->addr + aligned, len + (off - aligned), advice) != 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, uv_strerror(uv_translate_sys_error(errno)));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+#else
+  (void)m;
+  (void)hint;
+  lua_pushnil(L);
+  lua_pushstring(L, "fs.mmap is not supported on Windows");
+  return 2;
+#endif
+}
+
+// m:close(). Slices already taken with m:sub() stay valid; pointers from m:ptr() do not.
+static int fs_mmap_close(lua_State *L) {
+  fs_mmap_t *m = (fs_mmap_t *)luaL_checkudata(L, 1, LUNET_FS_MMAP_MT);
+  if (!m->closed) fs_mmap_unmap(m);
+  return 0;
+}
+
+static void fs_register_mmap_metatable(lua_State *L) {
+  if (luaL_newmetatable(L, LUNET_FS_MMAP_MT)) {
+    lua_pushcfunction(L, fs_mmap_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcfunction(L, fs_mmap_len);
+    lua_setfield(L, -2, "__len");
+    lua_createtable(L, 0, 5);
+    lua_pushcfunction(L, fs_mmap_len);
+    lua_setfield(L, -2, "len");
+    lua_pushcfunction(L, fs_mmap_sub);
+    lua_setfield(L, -2, "sub");
+    lua_pushcfunction(L, fs_mmap_ptr);
+    lua_setfield(L, -2, "ptr");
+    lua_pushcfunction(L, fs_mmap_advise);
+    lua_setfield(L, -2, "advise");
+    lua_pushcfunction(L, fs_mmap_close);
+    lua_setfield(L, -2, "close");
+    lua_setfield(L, -2, "__index");
+  }
+  lua_pop(L, 1);
+}
+
+int lunet_fs_mmap(lua_State *L) {
+  if (lunet_ensure_coroutine(L, "fs.mmap") != 0) {
+    return lua_error(L);
+  }
+  if (lua_type(L, 1) != LUA_TSTRING) {
+    lua_pushnil(L);
+    lua_pushstring(L, "fs.mmap requires path");
+    return 2;
+  }
+#ifndef _WIN32
+  size_t path_len;
+  const char *path = lua_tolstring(L, 1, &path_len);
+  int advice = -1;
+  if (!lua_isnoneornil(L, 2)) {
+    const char *hint = luaL_checkstring(L, 2);
+    if (!fs_mmap_advice(hint, &advice)) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "unknown advice \"%s\"", hint);
+      return 2;
+    }
+  }
+
+  fs_register_mmap_metatable(L);
+
+  fs_mmap_ctx_t *ctx = lunet_calloc(1, sizeof(fs_mmap_ctx_t));
+  if (!ctx) {
+    lua_pushnil(L);
+    lua_pushstring(L, "fs.mmap out of memory");
+    return 2;
+  }
+  ctx->path = lunet_alloc(path_len + 1);
+  if (!ctx->path) {
+    lunet_free(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, "fs.mmap out of memory");
+    return 2;
+  }
+  memcpy(ctx->path, path, path_len + 1);
+  ctx->advice = advice;
+  ctx->L = L;
+  ctx->req.data = ctx;
+  lunet_coref_create(L, ctx->co_ref);
+
+  FS_TRACE_OPEN(path);
+
+  ctx->start_ns = uv_hrtime();
+  int rc = uv_queue_work(lunet_loop(), &ctx->req, fs_mmap_work, fs_mmap_after);
+  if (rc < 0) {
+    lunet_coref_release(L, ctx->co_ref);
+    lunet_free(ctx->path);
+    lunet_free(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, uv_strerror(rc));
+    return 2;
+  }
+
+  return lua_yield(L, 0);
+#else
+  lua_pushnil(L);
+  lua_pushstring(L, "fs.mmap is not supported on Windows");
+  return 2;
+#endif
+}
+
+/*
+ * Batched helpers: each call is one job on the libuv pool running the
+ * synchronous uv_fs_* calls back to back, instead of one pool hop and one
+ * coroutine resume per step.
+ */
+#define FS_READFILE_CHUNK 65536
+
+typedef enum {
+  FS_BATCH_READFILE = 0,
+  FS_BATCH_WRITEFILE,
+  FS_BATCH_WALK,
+} fs_batch_kind_t;
+
+typedef struct {
+  size_t path;        /* offset of the NUL-terminated path in the arena */
+  size_t name;        /* offset of the last component */
+  uv_dirent_type_t type;
+} fs_walk_ent_t;
+
+typedef struct {
+  uv_work_t req;
+  lua_State *L;
+  int co_ref;
+  uint64_t start_ns;
+  int pin_ref;        /* writefile data, LUA_NOREF otherwise */
+  fs_batch_kind_t kind;
+  int err;            /* libuv error code, 0 on success */
+  char *path;
+
+  /* readfile result / writefile input */
+  char *buf;
+  const char *data;
+  size_t len;
+  int atomic;
+
+  /* walk */
+  int max_depth;      /* 0 means unlimited */
+  fs_walk_ent_t *ents;
+  size_t nents;
+  size_t ents_cap;
+  char *arena;
+  size_t arena_len;
+  size_t arena_cap;
+} fs_batch_ctx_t;
+
+static void fs_readfile_work(fs_batch_ctx_t *ctx) {
+  uv_fs_t r;
+  int fd = uv_fs_open(NULL, &r, ctx->path, O_RDONLY, 0, NULL);
+  uv_fs_req_cleanup(&r);
+  if (fd < 0) {
+    ctx->err = fd;
+    return;
+  }
+
+  int rc = uv_fs_fstat(NULL, &r, fd, NULL);
+  uint64_t size = r.statbuf.st_size;
+  int is_dir = (r.statbuf.st_mode & S_IFMT) == S_IFDIR;
+  uv_fs_req_cleanup(&r);
+  if (rc < 0 || is_dir) {
+    ctx->err = rc < 0 ? rc : UV_EISDIR;
+    goto done;
+  }
+
+  /* Size from fstat, then keep reading until EOF: procfs reports 0 and the
+   * file may grow in between */
+  size_t cap = size > 0 ? (size_t)size : FS_READFILE_CHUNK;
+  ctx->buf = lunet_alloc(cap);
+  if (!ctx->buf) {
+    ctx->err = UV_ENOMEM;
+    goto done;
+  }
+  for (;;) {
+    if (ctx->len == cap) {
+      char probe[1];
+      uv_buf_t pb = uv_buf_init(probe, 1);
+      rc = uv_fs_read(NULL, &r, fd, &pb, 1, (int64_t)ctx->len, NULL);
+      uv_fs_req_cleanup(&r);
+      if (rc <= 0) break;
+      size_t ncap = cap * 2;
+      char *nbuf = lunet_realloc(ctx->buf, ncap);
+      if (!nbuf) {
+        rc = UV_ENOMEM;
+        break;
+      }
+      ctx->buf = nbuf;
+      cap = ncap;
+      ctx->buf[ctx->len++] = probe[0];
+      continue;
+    }
+    uv_buf_t b = uv_buf_init(ctx->buf + ctx->len, (unsigned int)(cap - ctx->len));
+    rc = uv_fs_read(NULL, &r, fd, &b, 1, (int64_t)ctx->len, NULL);
+    uv_fs_req_cleanup(&r);
+    if (rc <= 0) break;
+    ctx->len += (size_t)rc;
+  }
+  if (rc < 0) ctx->err = rc;
+
+done:
+  uv_fs_close(NULL, &r, fd, NULL);
+  uv_fs_req_cleanup(&r);
+}
+
+static int fs_write_all(uv_file fd, const char *data, size_t len) {
+  uv_fs_t r;
+  size_t off = 0;
+  while (off < len) {
+    size_t n = len - off;
+    if (n > ((size_t)1 << 30)) n = (size_t)1 << 30;
+    uv_buf_t b = uv_buf_init((char *)data + off, (unsigned int)n);
+    int rc = uv_fs_write(NULL, &r, fd, &b, 1, (int64_t)off, NULL);
+    uv_fs_req_cleanup(&r);
+    if (rc < 0) return rc;
+    off += (size_t)rc;
+  }
+  return 0;
+}
+
+/* atomic: write a sibling temp file, fsync it, then rename it over path so
+ * readers see either the old or the new contents, never a partial file */
+static void fs_writefile_work(fs_batch_ctx_t *ctx) {
+  uv_fs_t r;
+  if (!ctx->atomic) {
+    int fd = uv_fs_open(NULL, &r, ctx->path, O_WRONLY | O_CREAT | O_TRUNC, 0666, NULL);
+    uv_fs_req_cleanup(&r);
+    if (fd < 0) {
+      ctx->err = fd;
+      return;
+    }
+    ctx->err = fs_write_all(fd, ctx->data, ctx->len);
+    int rc = uv_fs_close(NULL, &r, fd, NULL);
+    uv_fs_req_cleanup(&r);
+    if (ctx->err == 0) ctx->err = rc;
+    return;
+  }
+
+  size_t plen = strlen(ctx->path);
+  char *tmpl = lunet_alloc(plen + sizeof(".XXXXXX"));
+  if (!tmpl) {
+    ctx->err = UV_ENOMEM;
+    return;
+  }
+  memcpy(tmpl, ctx->path, plen);
+  memcpy(tmpl + plen, ".XXXXXX", sizeof(".XXXXXX"));
+
+  /* Keep the mode of the file being replaced; mkstemp creates 0600 */
+  int mode = 0644;
+  if (uv_fs_stat(NULL, &r, ctx->path, NULL) == 0) mode = (int)(r.statbuf.st_mode & 07777);
+  uv_fs_req_cleanup(&r);
+
+  int fd = uv_fs_mkstemp(NULL, &r, tmpl, NULL);
+  if (fd >= 0) memcpy(tmpl, r.path, plen + sizeof(".XXXXXX"));
+  uv_fs_req_cleanup(&r);
+  if (fd < 0) {
+    ctx->err = fd;
+    lunet_free(tmpl);
+    return;
+  }
+
+  int rc = fs_write_all(fd, ctx->data, ctx->len);
+  if (rc == 0) {
+    rc = uv_fs_fchmod(NULL, &r, fd, mode, NULL);
+    uv_fs_req_cleanup(&r);
+  }
+  if (rc == 0) {
+    rc = uv_fs_fsync(NULL, &r, fd, NULL);
+    uv_fs_req_cleanup(&r);
+  }
+  int crc = uv_fs_close(NULL, &r, fd, NULL);
+  uv_fs_req_cleanup(&r);
+  if (rc == 0) rc = crc;
+  if (rc == 0) {
+    rc = uv_fs_rename(NULL, &r, tmpl, ctx->path, NULL);
+    uv_fs_req_cleanup(&r);
+  }
+  if (rc < 0) {
+    uv_fs_unlink(NULL, &r, tmpl, NULL);
+    uv_fs_req_cleanup(&r);
+  }
+  ctx->err = rc;
+  lunet_free(tmpl);
+}
+
+static int fs_walk_reserve(char **buf, size_t *cap, size_t need) {
+  if (need <= *cap) return 0;
+  size_t ncap = *cap ? *cap : 4096;
+  while (ncap < need) ncap *= 2;
+  char *nbuf = lunet_realloc(*buf, ncap);
+  if (!nbuf) return UV_ENOMEM;
+  *buf = nbuf;
+  *cap = ncap;
+  return 0;
+}
+
+static int fs_walk_add(fs_batch_ctx_t *ctx, const char *path, size_t len, size_t name,
+                       uv_dirent_type_t type) {
+  if (ctx->nents == ctx->ents_cap) {
+    size_t ncap = ctx->ents_cap ? ctx->ents_cap * 2 : 256;
+    fs_walk_ent_t *n = lunet_realloc(ctx->ents, ncap * sizeof(fs_walk_ent_t));
+    if (!n) return UV_ENOMEM;
+    ctx->ents = n;
+    ctx->ents_cap = ncap;
+  }
+  if (fs_walk_reserve(&ctx->arena, &ctx->arena_cap, ctx->arena_len + len + 1) != 0) {
+    return UV_ENOMEM;
+  }
+  fs_walk_ent_t *e = &ctx->ents[ctx->nents++];
+  e->path = ctx->arena_len;
+  e->name = ctx->arena_len + name;
+  e->type = type;
+  memcpy(ctx->arena + ctx->arena_len, path, len + 1);
+  ctx->arena_len += len + 1;
+  return 0;
+}
+
+/* *dir holds the directory path (dlen bytes, NUL-terminated) and is reused
+ * as the scratch buffer for child paths. Unreadable subdirectories are
+ * skipped; only failing to list the root is an error. */
+static int fs_walk_dir(fs_batch_ctx_t *ctx, char **dir, size_t *dcap, size_t dlen, int depth) {
+  uv_fs_t r;
+  int rc = uv_fs_scandir(NULL, &r, *dir, 0, NULL);
+  if (rc < 0) {
+    uv_fs_req_cleanup(&r);
+    return depth == 1 ? rc : 0;
+  }
+
+  int sep = dlen > 0 && (*dir)[dlen - 1] != '/';
+  uv_dirent_t ent;
+  rc = 0;
+  while (rc == 0 && uv_fs_scandir_next(&r, &ent) != UV_EOF) {
+    size_t nlen = strlen(ent.name);
+    size_t clen = dlen + sep + nlen;
+    if ((rc = fs_walk_reserve(dir, dcap, clen + 1)) != 0) break;
+    char *p = *dir;
+    if (sep) p[dlen] = '/';
+    memcpy(p + dlen + sep, ent.name, nlen + 1);
+
+    uv_dirent_type_t type = ent.type;
+    if (type == UV_DIRENT_UNKNOWN) {
+      uv_fs_t st;
+      if (uv_fs_lstat(NULL, &st, p, NULL) == 0) {
+        switch (st.statbuf.st_mode & S_IFMT) {
+          case S_IFREG: type = UV_DIRENT_FILE; break;
+          case S_IFDIR: type = UV_DIRENT_DIR; break;
+#ifdef S_IFLNK
+          case S_IFLNK: type = UV_DIRENT_LINK; break;
+#endif
+          default: break;
+        }
+      }
+      uv_fs_req_cleanup(&st);
+    }
+
+    if ((rc = fs_walk_add(ctx, p, clen, dlen + sep, type)) != 0) break;
+    /* Symlinks are listed but not followed, so cycles cannot occur */
+    if (type == UV_DIRENT_DIR && (ctx->max_depth <= 0 || depth < ctx->max_depth)) {
+      rc = fs_walk_dir(ctx, dir, dcap, clen, depth + 1);
+    }
+    (*dir)[dlen] = '\0';
+  }
+  uv_fs_req_cleanup(&r);
+  return rc;
+}
+
+static void fs_walk_work(fs_batch_ctx_t *ctx) {
+  size_t len = strlen(ctx->path);
+  size_t cap = 0;
+  char *dir = NULL;
+  if ((ctx->err = fs_walk_reserve(&dir, &cap, len + 1)) != 0) return;
+  memcpy(dir, ctx->path, len + 1);
+  ctx->err = fs_walk_dir(ctx, &dir, &cap, len, 1);
+  lunet_free(dir);
+}
+
+static void fs_batch_work(uv_work_t *req) {
+  fs_batch_ctx_t *ctx = (fs_batch_ctx_t *)req->data;
+  switch (ctx->kind) {
+    case FS_BATCH_READFILE: fs_readfile_work(ctx); break;
+    case FS_BATCH_WRITEFILE: fs_writefile_work(ctx); break;
+    case FS_BATCH_WALK: fs_walk_work(ctx); break;
+  }
+}
+
+static void fs_batch_free(fs_batch_ctx_t *ctx) {
+  lunet_free(ctx->path);
+  lunet_free(ctx->buf);
+  lunet_free(ctx->ents);
+  lunet_free(ctx->arena);
+  lunet_free_nonnull(ctx);
+}
+
+static void fs_batch_after(uv_work_t *req, int status) {
+  fs_batch_ctx_t *ctx = (fs_batch_ctx_t *)req->data;
+  lunet_metrics_since(LUNET_METRIC_FS, ctx->start_ns);
+  lua_State *L = ctx->L;
+
+  if (ctx->pin_ref != LUA_NOREF) lunet_coref_release(L, ctx->pin_ref);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
+  lunet_coref_release(L, ctx->co_ref);
+
+  if (!lua_isthread(L, -1)) {
+    lua_pop(L, 1);
+    fprintf(stderr, "invalid coroutine in fs batch call\n");
+    goto cleanup;
+  }
+
+  lua_State *co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+
+  int err = status < 0 ? status : ctx->err;
+  if (err < 0) {
+    lua_pushnil(co);
+    lua_pushstring(co, uv_strerror(err));
+  } else {
+    switch (ctx->kind) {
+      case FS_BATCH_READFILE:
+        lua_pushlstring(co, ctx->buf ? ctx->buf : "", ctx->len);
+        break;
+      case FS_BATCH_WRITEFILE:
+        lua_pushinteger(co, (lua_Integer)ctx->len);
+        break;
+      case FS_BATCH_WALK:
+        lua_createtable(co, (int)ctx->nents, 0);
+        for (size_t i = 0; i < ctx->nents; i++) {
+          const fs_walk_ent_t *e = &ctx->ents[i];
+          lua_createtable(co, 0, 3);
+          lua_pushstring(co, ctx->arena + e->path);
+          lua_setfield(co, -2, "path");
+          lua_pushstring(co, ctx->arena + e->name);
+          lua_setfield(co, -2, "name");
+          lua_pushstring(co, dirent_type_to_string(e->type));
+          lua_setfield(co, -2, "type");
+          lua_rawseti(co, -2, (int)i + 1);
+        }
+        break;
+    }
+    lua_pushnil(co);
+  }
+
+  lunet_co_resume(co, 2);
+
+cleanup:
+  fs_batch_free(ctx);
+}
+
+static fs_batch_ctx_t *fs_batch_new(lua_State *L, fs_batch_kind_t kind, const char *name) {
+  size_t path_len;
+  const char *path = lua_tolstring(L, 1, &path_len);
+  fs_batch_ctx_t *ctx = lunet_calloc(1, sizeof(fs_batch_ctx_t));
+  if (ctx) ctx->path = lunet_alloc(path_len + 1);
+  if (!ctx || !ctx->path) {
+    if (ctx) lunet_free(ctx);
+    lua_pushnil(L);
+    lua_pushfstring(L, "%s out of memory", name);
+    return NULL;
+  }
+  memcpy(ctx->path, path, path_len + 1);
+  ctx->kind = kind;
+  ctx->pin_ref = LUA_NOREF;
+  return ctx;
+}
+
+static int fs_batch_submit(lua_State *L, fs_batch_ctx_t *ctx) {
+  ctx->L = L;
+  ctx->req.data = ctx;
+  lunet_coref_create(L, ctx->co_ref);
+
+  ctx->start_ns = uv_hrtime();
+  int rc = uv_queue_work(lunet_loop(), &ctx->req, fs_batch_work, fs_batch_after);
+  if (rc < 0) {
+    lunet_coref_release(L, ctx->co_ref);
+    if (ctx->pin_ref != LUA_NOREF) lunet_coref_release(L, ctx->pin_ref);
+    fs_batch_free(ctx);
+    lua_pushnil(L);
+    lua_pushstring(L, uv_strerror(rc));
+    return 2;
+  }
+
+  return lua_yield(L, 0);
+}
+
+int lunet_fs_readfile(lua_State *L) {
+  if (lunet_ensure_coroutine(L, "fs.readfile") != 0) {
+    return lua_error(L);
+  }
+  if (lua_type(L, 1) != LUA_TSTRING) {
+    lua_pushnil(L);
+    lua_pushstring(L, "fs.readfile requires path");
+    return 2;
+  }
+  fs_batch_ctx_t *ctx = fs_batch_new(L, FS_BATCH_READFILE, "fs.readfile");
+  if (!ctx) return 2;
+
+  FS_TRACE_OPEN(ctx->path);
+
+  return fs_batch_submit(L, ctx);
+}
+
+int lunet_fs_writefile(lua_State *L) {
+  if (lunet_ensure_coroutine(L, "fs.writefile") != 0) {
+    return lua_error(L);
+  }
+  if (lua_type(L, 1) != LUA_TSTRING || lua_type(L, 2) != LUA_TSTRING) {
+    lua_pushnil(L);
+    lua_pushstring(L, "fs.writefile requires path and data");
+    return 2;
+  }
+  int atomic = 0;
+  if (lua_istable(L, 3)) {
+    lua_getfield(L, 3, "atomic");
+    atomic = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+  }
+  fs_batch_ctx_t *ctx = fs_batch_new(L, FS_BATCH_WRITEFILE, "fs.writefile");
+  if (!ctx) return 2;
+  ctx->atomic = atomic;
+  ctx->data = lua_tolstring(L, 2, &ctx->len);
+  /* Pinned, not copied: the worker reads the Lua string directly */
+  lua_pushvalue(L, 2);
+  lunet_coref_create_raw(L, ctx->pin_ref);
+
+  FS_TRACE_OPEN(ctx->path);
+
+  return fs_batch_submit(L, ctx);
+}
+
+int lunet_fs_walk(lua_State *L) {
+  if (lunet_ensure_coroutine(L, "fs.walk") != 0) {
+    return lua_error(L);
+  }
+  if (lua_type(L, 1) != LUA_TSTRING) {
+    lua_pushnil(L);
+    lua_pushstring(L, "fs.walk requires path");
+    return 2;
+  }
+  int depth = 0;
+  if (lua_istable(L, 2)) {
+    lua_getfield(L, 2, "depth");
+    if (lua_isnumber(L, -1)) depth = (int)lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  fs_batch_ctx_t *ctx = fs_batch_new(L, FS_BATCH_WALK, "fs.walk");
+  if (!ctx) return 2;
+  ctx->max_depth = depth > 0 ? depth : 0;
+
+  FS_TRACE_SCANDIR(ctx->path);
+
+  return fs_batch_submit(L, ctx);
+}
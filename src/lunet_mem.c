@@ -272,3 +272,193 @@ void lunet_mem_assert_balanced(const char *context) {
 }
 
 #endif /* LUNET_TRACE || LUNET_EASY_MEMORY */
+
+/*
+ * Arena allocator. Blocks come from lunet_alloc, so trace builds still see
+ * (and balance) them. Counters are shared by every thread of this module and
+ * only touched per block, never per chunk.
+ */
+#include <uv.h>
+
+struct lunet_arena_block {
+    lunet_arena_block_t *next;
+    char *data;   /* aligned start; lunet_alloc only guarantees 8 in trace builds */
+    size_t size;  /* usable bytes at data */
+};
+
+#define ARENA_HDR (sizeof(lunet_arena_block_t) + LUNET_ARENA_ALIGN - 1)
+
+static lunet_arena_stats_t g_arena_stats;
+static uv_mutex_t g_arena_mutex;
+static uv_once_t g_arena_once = UV_ONCE_INIT;
+
+static void arena_init_once(void) {
+    uv_mutex_init(&g_arena_mutex);
+}
+
+static inline size_t arena_align(size_t n) {
+    return (n + (LUNET_ARENA_ALIGN - 1)) & ~(size_t)(LUNET_ARENA_ALIGN - 1);
+}
+
+static lunet_arena_block_t *arena_block_new(size_t size, int oversize) {
+    if (size > SIZE_MAX - ARENA_HDR) return NULL;
+    lunet_arena_block_t *b = lunet_alloc(ARENA_HDR + size);
+    if (!b) return NULL;
+    b->next = NULL;
+    b->data = (char *)(((uintptr_t)(b + 1) + LUNET_ARENA_ALIGN - 1) &
+                       ~(uintptr_t)(LUNET_ARENA_ALIGN - 1));
+    b->size = size;
+    uv_mutex_lock(&g_arena_mutex);
+    g_arena_stats.blocks++;
+    if (oversize) g_arena_stats.oversize++;
+    g_arena_stats.reserved_bytes += size;
+    if (g_arena_stats.reserved_bytes > g_arena_stats.peak_reserved_bytes) {
+        g_arena_stats.peak_reserved_bytes = g_arena_stats.reserved_bytes;
+    }
+    uv_mutex_unlock(&g_arena_mutex);
+    return b;
+}
+
+void lunet_arena_init_buf(lunet_arena_t *a, void *buf, size_t len, size_t block_size) {
+    uv_once(&g_arena_once, arena_init_once);
+    memset(a, 0, sizeof(*a));
+    a->block_size = arena_align(block_size ? block_size : LUNET_ARENA_DEFAULT_BLOCK);
+    if (buf && len >= LUNET_ARENA_ALIGN) {
+        /* Trim the caller's storage to aligned bounds */
+        uintptr_t start = ((uintptr_t)buf + LUNET_ARENA_ALIGN - 1) & ~(uintptr_t)(LUNET_ARENA_ALIGN - 1);
+        uintptr_t stop = ((uintptr_t)buf + len) & ~(uintptr_t)(LUNET_ARENA_ALIGN - 1);
+        if (stop > start) {
+            a->buf = (char *)start;
+            a->buf_len = (size_t)(stop - start);
+        }
+    }
+    a->ptr = a->buf;
+    a->end = a->buf ? a->buf + a->buf_len : NULL;
+    a->capacity = a->buf_len;
+    uv_mutex_lock(&g_arena_mutex);
+    g_arena_stats.arenas++;
+    g_arena_stats.active++;
+    uv_mutex_unlock(&g_arena_mutex);
+}
+
+void lunet_arena_init(lunet_arena_t *a, size_t block_size) {
+    lunet_arena_init_buf(a, NULL, 0, block_size);
+}
+
+void *lunet_arena_alloc_slow(lunet_arena_t *a, size_t size) {
+    size_t need = arena_align(size ? size : 1);
+    if (need < size) return NULL;
+
+    /* A large chunk gets a block of its own so the current one stays usable */
+    if (need > a->block_size / 4) {
+        lunet_arena_block_t *b = arena_block_new(need, 1);
+        if (!b) return NULL;
+        b->next = a->head;
+        a->head = b;
+        a->capacity += need;
+        a->used += need;
+        a->last = NULL;
+        return b->data;
+    }
+
+    lunet_arena_block_t *b = a->spare;
+    if (b) {
+        a->spare = NULL;
+    } else {
+        b = arena_block_new(a->block_size, 0);
+        if (!b) return NULL;
+    }
+    b->next = a->head;
+    a->head = b;
+    a->capacity += b->size;
+    void *p = b->data;
+    a->ptr = (char *)p + need;
+    a->end = (char *)p + b->size;
+    a->used += need;
+    a->last = p;
+    return p;
+}
+
+void *lunet_arena_calloc(lunet_arena_t *a, size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) return NULL;
+    void *p = lunet_arena_alloc(a, count * size);
+    if (p) memset(p, 0, count * size);
+    return p;
+}
+
+void *lunet_arena_realloc(lunet_arena_t *a, void *ptr, size_t old_size, size_t new_size) {
+    if (!ptr) return lunet_arena_alloc(a, new_size);
+    if (ptr == a->last) {
+        size_t old_need = arena_align(old_size ? old_size : 1);
+        size_t new_need = arena_align(new_size ? new_size : 1);
+        if (new_need >= new_size && (size_t)(a->end - (char *)ptr) >= new_need) {
+            a->ptr = (char *)ptr + new_need;
+            a->used = a->used - old_need + new_need;
+            return ptr;
+        }
+    }
+    if (new_size <= old_size) return ptr;
+    void *p = lunet_arena_alloc(a, new_size);
+    if (p) memcpy(p, ptr, old_size);
+    return p;
+}
+
+char *lunet_arena_strdup(lunet_arena_t *a, const char *s) {
+    if (!s) return NULL;
+    size_t len = strlen(s);
+    char *out = lunet_arena_alloc(a, len + 1);
+    if (out) memcpy(out, s, len + 1);
+    return out;
+}
+
+/* Frees the owned blocks (keeping one standard block when keep_spare) and
+ * folds this arena's usage into the counters */
+static void arena_release(lunet_arena_t *a, int keep_spare) {
+    uint64_t freed = 0;
+    lunet_arena_block_t *b = a->head;
+    while (b) {
+        lunet_arena_block_t *next = b->next;
+        if (keep_spare && !a->spare && b->size == a->block_size) {
+            a->spare = b;
+        } else {
+            freed += b->size;
+            lunet_free_nonnull(b);
+        }
+        b = next;
+    }
+    if (!keep_spare && a->spare) {
+        freed += a->spare->size;
+        lunet_free_nonnull(a->spare);
+        a->spare = NULL;
+    }
+
+    uv_mutex_lock(&g_arena_mutex);
+    g_arena_stats.reserved_bytes -= freed;
+    g_arena_stats.used_bytes += a->used;
+    g_arena_stats.capacity_bytes += a->capacity;
+    if (a->used > g_arena_stats.peak_arena_bytes) g_arena_stats.peak_arena_bytes = a->used;
+    if (!keep_spare) g_arena_stats.active--;
+    uv_mutex_unlock(&g_arena_mutex);
+
+    a->head = NULL;
+    a->last = NULL;
+    a->ptr = a->buf;
+    a->end = a->buf ? a->buf + a->buf_len : NULL;
+    a->used = 0;
+    a->capacity = a->buf_len;
+}
+
+void lunet_arena_reset(lunet_arena_t *a) {
+    arena_release(a, 1);
+}
+
+void lunet_arena_destroy(lunet_arena_t *a) {
+    arena_release(a, 0);
+}
+
+void lunet_arena_stats(lunet_arena_stats_t *out) {
+    uv_once(&g_arena_once, arena_init_once);
+    uv_mutex_lock(&g_arena_mutex);
+    *out = g_arena_stats;
+    uv_mutex_unlock(&g_arena_mutex);
+}
@@ -1,16 +1,17 @@
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#if !defined(_WIN32) && !defined(__CYGWIN__)
-#include <pthread.h>
-#endif
 #include <uv.h>
 
 #include "lunet_lua.h"
 #include "lunet_exports.h"
+#include "buffer.h"
 #include "co.h"
+#include "executor.h"
 #include "fs.h"
 #include "lunet_signal.h"
+#include "metrics.h"
 #include "rt.h"
 #include "socket.h"
 #include "timer.h"
@@ -19,6 +20,7 @@
 #include "runtime.h"
 #include "lunet_mem.h"
 #include "embed_scripts.h"
+#include "worker.h"
 #ifdef LUNET_PAXE
 #include "paxe.h"
 #endif
@@ -37,9 +39,21 @@ static char *lunet_resolve_executable_path(const char *argv0) {
 
 lunet_runtime_config_t g_lunet_config = {0};
 
+int lunet_open_worker(lua_State *L) {
+  luaL_Reg funcs[] = {{"id", lunet_worker_lua_id},
+                      {"count", lunet_worker_lua_count},
+                      {"send", lunet_worker_send},
+                      {"recv", lunet_worker_recv},
+                      {NULL, NULL}};
+  luaL_newlib(L, funcs);
+  return 1;
+}
+
 // register core module
 int lunet_open_core(lua_State *L) {
-  luaL_Reg funcs[] = {{"spawn", lunet_spawn}, {"sleep", lunet_sleep}, {NULL, NULL}};
+  luaL_Reg funcs[] = {{"spawn", lunet_spawn}, {"sleep", lunet_sleep},
+                      {"metrics", lunet_metrics}, {"hrtime", lunet_hrtime},
+                      {NULL, NULL}};
   luaL_newlib(L, funcs);
   return 1;
 }
@@ -47,12 +61,23 @@ int lunet_open_core(lua_State *L) {
 int lunet_open_socket(lua_State *L) {
   luaL_Reg funcs[] = {{"listen", lunet_socket_listen},
                       {"accept", lunet_socket_accept},
+                      {"accept_many", lunet_socket_accept_many},
                       {"getpeername", lunet_socket_getpeername},
                       {"close", lunet_socket_close},
                       {"read", lunet_socket_read},
+                      {"read_stream", lunet_socket_read_stream},
+                      {"read_until", lunet_socket_read_until},
+                      {"read_exact", lunet_socket_read_exact},
+                      {"read_into", lunet_socket_read_into},
                       {"write", lunet_socket_write},
+                      {"writev", lunet_socket_writev},
+                      {"sendfile", lunet_socket_sendfile},
                       {"connect", lunet_socket_connect},
+                      {"setopt", lunet_socket_setopt},
                       {"set_read_buffer_size", lunet_socket_set_read_buffer_size},
+                      {"set_write_high_water", lunet_socket_set_write_high_water},
+                      {"set_close_timeout", lunet_socket_set_close_timeout},
+                      {"read_pool_stats", lunet_socket_read_pool_stats},
                       {NULL, NULL}};
   luaL_newlib(L, funcs);
   return 1;
@@ -61,8 +86,13 @@ int lunet_open_socket(lua_State *L) {
 int lunet_open_udp(lua_State *L) {
   luaL_Reg funcs[] = {{"bind", lunet_udp_bind},
                       {"send", lunet_udp_send},
+                      {"send_batch", lunet_udp_send_batch},
+                      {"send_fanout", lunet_udp_send_fanout},
                       {"recv", lunet_udp_recv},
+                      {"recv_batch", lunet_udp_recv_batch},
                       {"close", lunet_udp_close},
+                      {"addr_string", lunet_udp_addr_string},
+                      {"dropped", lunet_udp_dropped},
                       {NULL, NULL}};
   luaL_newlib(L, funcs);
   return 1;
@@ -79,8 +109,16 @@ int lunet_open_fs(lua_State *L) {
                       {"close", lunet_fs_close},
                       {"read", lunet_fs_read},
                       {"write", lunet_fs_write},
+                      {"pread", lunet_fs_pread},
+                      {"pwrite", lunet_fs_pwrite},
+                      {"preadv", lunet_fs_preadv},
+                      {"pwritev", lunet_fs_pwritev},
                       {"stat", lunet_fs_stat},
                       {"scandir", lunet_fs_scandir},
+                      {"mmap", lunet_fs_mmap},
+                      {"readfile", lunet_fs_readfile},
+                      {"writefile", lunet_fs_writefile},
+                      {"walk", lunet_fs_walk},
                       {NULL, NULL}};
   luaL_newlib(L, funcs);
   return 1;
@@ -100,6 +138,12 @@ int lunet_db_exec(lua_State* L);
 int lunet_db_escape(lua_State* L);
 int lunet_db_query_params(lua_State* L);
 int lunet_db_exec_params(lua_State* L);
+int lunet_db_stmt_cache_stats(lua_State* L);
+int lunet_db_pool(lua_State* L);
+int lunet_db_pool_stats(lua_State* L);
+int lunet_db_executor_stats(lua_State* L);
+int lunet_db_cursor(lua_State* L);
+int lunet_db_exec_batch(lua_State* L);
 
 static int lunet_open_db(lua_State *L) {
   luaL_Reg funcs[] = {{"open", lunet_db_open},
@@ -109,6 +153,12 @@ static int lunet_open_db(lua_State *L) {
                       {"escape", lunet_db_escape},
                       {"query_params", lunet_db_query_params},
                       {"exec_params", lunet_db_exec_params},
+                      {"stmt_cache_stats", lunet_db_stmt_cache_stats},
+                      {"pool", lunet_db_pool},
+                      {"pool_stats", lunet_db_pool_stats},
+                      {"executor_stats", lunet_db_executor_stats},
+                      {"cursor", lunet_db_cursor},
+                      {"exec_batch", lunet_db_exec_batch},
                       {NULL, NULL}};
   luaL_newlib(L, funcs);
   return 1;
@@ -132,7 +182,9 @@ static void lunet_init_once(void) {
 #if defined(LUNET_DB_SQLITE3)
 LUNET_API int luaopen_lunet_sqlite3(lua_State *L) {
   lunet_init_once();
-  set_default_luaL(L);
+  lunet_rt_bind(L);
+  lunet_metrics_attach(L);
+  lunet_exec_attach(L);
   return lunet_open_db(L);
 }
 #endif
@@ -140,7 +192,9 @@ LUNET_API int luaopen_lunet_sqlite3(lua_State *L) {
 #if defined(LUNET_DB_MYSQL)
 LUNET_API int luaopen_lunet_mysql(lua_State *L) {
   lunet_init_once();
-  set_default_luaL(L);
+  lunet_rt_bind(L);
+  lunet_metrics_attach(L);
+  lunet_exec_attach(L);
   return lunet_open_db(L);
 }
 #endif
@@ -148,7 +202,9 @@ LUNET_API int luaopen_lunet_mysql(lua_State *L) {
 #if defined(LUNET_DB_POSTGRES)
 LUNET_API int luaopen_lunet_postgres(lua_State *L) {
   lunet_init_once();
-  set_default_luaL(L);
+  lunet_rt_bind(L);
+  lunet_metrics_attach(L);
+  lunet_exec_attach(L);
   return lunet_open_db(L);
 }
 #endif
@@ -156,7 +212,9 @@ LUNET_API int luaopen_lunet_postgres(lua_State *L) {
 #if defined(LUNET_PAXE)
 LUNET_API int luaopen_lunet_paxe(lua_State *L) {
   lunet_init_once();
-  set_default_luaL(L);
+  lunet_rt_bind(L);
+  lunet_metrics_attach(L);
+  lunet_exec_attach(L);
   lua_newtable(L);
   return lunet_open_paxe(L);
 }
@@ -165,7 +223,8 @@ LUNET_API int luaopen_lunet_paxe(lua_State *L) {
 #if defined(LUNET_HTTPC)
 LUNET_API int luaopen_lunet_httpc(lua_State *L) {
   lunet_init_once();
-  set_default_luaL(L);
+  lunet_rt_bind(L);
+  lunet_metrics_attach(L);
   return lunet_open_httpc(L);
 }
 #endif
@@ -196,12 +255,24 @@ void lunet_open(lua_State *L) {
   lua_pushcfunction(L, lunet_open_signal);
   lua_setfield(L, -2, "lunet.signal");
   lua_pop(L, 2);
+  // register buffer module
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+  lua_pushcfunction(L, lunet_open_buffer);
+  lua_setfield(L, -2, "lunet.buffer");
+  lua_pop(L, 2);
   // register fs module
   lua_getglobal(L, "package");
   lua_getfield(L, -1, "preload");
   lua_pushcfunction(L, lunet_open_fs);
   lua_setfield(L, -2, "lunet.fs");
   lua_pop(L, 2);
+  // register worker module
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "preload");
+  lua_pushcfunction(L, lunet_open_worker);
+  lua_setfield(L, -2, "lunet.worker");
+  lua_pop(L, 2);
 
   // Database drivers register themselves via luaopen_lunet_<driver>
   // No generic lunet.db registration here - each driver is a separate module
@@ -220,7 +291,9 @@ void lunet_open(lua_State *L) {
  */
 LUNET_API int luaopen_lunet(lua_State *L) {
   lunet_init_once();
-  set_default_luaL(L);
+  lunet_rt_bind(L);
+  lunet_metrics_attach(L);
+  lunet_rt_publish(L);
   lunet_open(L);  // Register submodules in package.preload
   return lunet_open_core(L);  // Return core module table
 }
@@ -235,6 +308,7 @@ static void lunet_trace_shutdown(void) {
     lunet_timer_trace_summary();
     lunet_signal_trace_summary();
     lunet_fs_trace_summary();
+    lunet_co_trace_summary();
     lunet_trace_dump();
     lunet_trace_assert_balanced("shutdown");
 #endif
@@ -244,6 +318,186 @@ static void lunet_trace_shutdown(void) {
 }
 
 #ifndef LUNET_NO_MAIN
+/*
+ * One worker = one thread, one uv loop, one lua_State running the script.
+ * Worker 0 runs on the main thread with uv_default_loop(); --workers N adds
+ * N-1 threads, each with a private loop.
+ */
+typedef struct {
+  int id;
+  const char *argv0;
+  const char *script;
+  const char *embedded_root;  /* LUNET_EMBED_EXTRACT dir of worker 0, shared by the rest */
+  uv_loop_t loop_storage;
+  uv_loop_t *loop;
+  uv_thread_t thread;
+  lua_State *L;
+  int exit_code;              /* __lunet_exit_code, -1 if unset */
+  int failed;                 /* setup or script load failed */
+} lunet_worker_t;
+
+static lunet_worker_t *g_workers = NULL;
+static int g_nworkers = 1;
+
+static void lunet_add_binary_cpath(lua_State *L, const char *argv0) {
+  // Add binary's directory to cpath for finding driver .so files
+  // Drivers are in same dir as binary, named like sqlite3.so, mysql.so
+  // They're loaded as lunet.sqlite3, so we need lunet/?.so pattern
+  // Create symlink-style lookup: binarydir/lunet/?.so -> binarydir/?.so
+  char *exe_path = lunet_resolve_executable_path(argv0);
+  if (!exe_path) {
+    return;
+  }
+
+  char *last_slash = strrchr(exe_path, '/');
+  char *last_backslash = strrchr(exe_path, '\\');
+  char *last_sep = last_slash;
+  if (!last_sep || (last_backslash && last_backslash > last_sep)) {
+    last_sep = last_backslash;
+  }
+  if (!last_sep) {
+    free(exe_path);
+    return;
+  }
+
+  *last_sep = '\0';
+
+  lua_getglobal(L, "package");
+  lua_getfield(L, -1, "cpath");
+  const char *old_cpath = lua_tostring(L, -1);
+  lua_pop(L, 1);
+
+  char new_cpath[4096];
+#if defined(_WIN32)
+  snprintf(new_cpath, sizeof(new_cpath), "%s\\lunet\\?.dll;%s\\?.dll;%s",
+           exe_path, exe_path, old_cpath ? old_cpath : "");
+#else
+  snprintf(new_cpath, sizeof(new_cpath), "%s/lunet/?.so;%s/?.so;%s",
+           exe_path, exe_path, old_cpath ? old_cpath : "");
+#endif
+  lua_pushstring(L, new_cpath);
+  lua_setfield(L, -2, "cpath");
+  lua_pop(L, 1);
+
+  free(exe_path);
+}
+
+/* Build the worker's loop and Lua state, then load and run the script body. */
+static int lunet_worker_start(lunet_worker_t *w) {
+  if (w->id == 0) {
+    w->loop = uv_default_loop();
+  } else {
+    if (uv_loop_init(&w->loop_storage) != 0) {
+      fprintf(stderr, "Error: worker %d: uv_loop_init failed\n", w->id);
+      return -1;
+    }
+    w->loop = &w->loop_storage;
+  }
+  lunet_rt_set_loop(w->loop);
+  lunet_rt_set_worker_id(w->id);
+
+  lua_State *L = luaL_newstate();
+  w->L = L;
+  luaL_openlibs(L);
+  set_default_luaL(L);
+  lunet_rt_publish(L);
+  lunet_metrics_attach(L);
+  lunet_open(L);
+  lunet_add_binary_cpath(L, w->argv0);
+  lunet_worker_attach(w->id, w->loop, L);
+  lunet_metrics_loop_start(w->loop);
+
+  int loaded = 0;
+#ifdef LUNET_EMBED_SCRIPTS
+  static char embedded_root[LUNET_EMBED_PATH_MAX] = {0};
+  char embed_error[512] = {0};
+
+  if (w->id == 0) {
+    if (lunet_embed_scripts_prepare(L,
+                                    embedded_root,
+                                    sizeof(embedded_root),
+                                    embed_error,
+                                    sizeof(embed_error)) != 0) {
+      fprintf(stderr, "Error: failed to prepare embedded scripts: %s\n", embed_error);
+      return -1;
+    }
+    w->embedded_root = embedded_root;
+  } else if (lunet_embed_scripts_attach(L, w->embedded_root,
+                                        embed_error, sizeof(embed_error)) != 0) {
+    fprintf(stderr, "Error: failed to attach embedded scripts: %s\n", embed_error);
+    return -1;
+  }
+
+  loaded = lunet_embed_scripts_load_script(L, w->embedded_root, w->script,
+                                           embed_error, sizeof(embed_error));
+  if (loaded < 0) {
+    fprintf(stderr, "Error: failed to load embedded script: %s\n", embed_error);
+    return -1;
+  }
+#endif
+
+  // run lua file (or the embedded chunk loaded above)
+  int status = loaded > 0 ? lua_pcall(L, 0, LUA_MULTRET, 0) : luaL_dofile(L, w->script);
+  if (status != LUA_OK) {
+    const char *error = lua_tostring(L, -1);
+    if (g_nworkers > 1) {
+      fprintf(stderr, "Error: worker %d: %s\n", w->id, error);
+    } else {
+      fprintf(stderr, "Error: %s\n", error);
+    }
+    lua_pop(L, 1);
+    return -1;
+  }
+  return 0;
+}
+
+/* Run the loop to completion and collect the script's exit code. */
+static int lunet_worker_loop(lunet_worker_t *w) {
+  int ret = uv_run(w->loop, UV_RUN_DEFAULT);
+  lunet_metrics_loop_stop(w->loop);
+
+  /* Optional: allow Lua script to control process exit status.
+   * Used by stress tests so we can exit without os.exit() (which skips trace shutdown).
+   */
+  w->exit_code = -1;
+  lua_getglobal(w->L, "__lunet_exit_code");
+  if (lua_isnumber(w->L, -1)) {
+    w->exit_code = (int)lua_tointeger(w->L, -1);
+  }
+  lua_pop(w->L, 1);
+
+  lunet_worker_detach(w->id);
+
+  /* Pooled read buffers are still allocated; return them before accounting */
+  lunet_socket_pool_shutdown();
+  lunet_udp_pool_shutdown();
+  return ret;
+}
+
+static void lunet_worker_close(lunet_worker_t *w) {
+  if (w->L) {
+    lua_close(w->L);
+    w->L = NULL;
+  }
+  if (w->loop && w->id != 0) {
+    int loop_close_status = uv_loop_close(w->loop);
+    if (loop_close_status != 0) {
+      fprintf(stderr, "[LUNET] worker %d: uv_loop_close failed at shutdown: %s\n",
+              w->id, uv_strerror(loop_close_status));
+    }
+  }
+}
+
+static void lunet_worker_thread(void *arg) {
+  lunet_worker_t *w = (lunet_worker_t *)arg;
+  if (lunet_worker_start(w) != 0) {
+    w->failed = 1;
+  } else {
+    lunet_worker_loop(w);
+  }
+  lunet_worker_close(w);
+}
+
 int main(int argc, char **argv) {
   if (argc < 2) {
     fprintf(stderr, "Usage: %s [OPTIONS] <lua_file>\n", argv[0]);
@@ -251,6 +505,9 @@ int main(int argc, char **argv) {
     fprintf(stderr, "  --dangerously-skip-loopback-restriction\n");
     fprintf(stderr, "      Allow binding to any network interface. By default, binding is restricted\n");
     fprintf(stderr, "      to loopback (127.0.0.1, ::1) or Unix sockets.\n");
+    fprintf(stderr, "  --workers N\n");
+    fprintf(stderr, "      Run the script in N threads, each with its own event loop and Lua state.\n");
+    fprintf(stderr, "      TCP listeners default to reuseport so workers share ports.\n");
     fprintf(stderr, "  --verbose-trace\n");
     fprintf(stderr, "      Enable verbose per-event tracing (debug builds only)\n");
     return 1;
@@ -261,6 +518,12 @@ int main(int argc, char **argv) {
     if (strcmp(argv[i], "--dangerously-skip-loopback-restriction") == 0) {
       g_lunet_config.dangerously_skip_loopback_restriction = 1;
       fprintf(stderr, "WARNING: Loopback restriction disabled. Binding to public interfaces allowed.\n");
+    } else if (strcmp(argv[i], "--workers") == 0) {
+      if (i + 1 >= argc || atoi(argv[i + 1]) < 1) {
+        fprintf(stderr, "Error: --workers requires a positive count\n");
+        return 1;
+      }
+      g_nworkers = atoi(argv[++i]);
     } else if (strcmp(argv[i], "--verbose-trace") == 0) {
       // Handled at compile time currently via LUNET_TRACE_VERBOSE
       // Could be runtime flag in future
@@ -278,119 +541,77 @@ int main(int argc, char **argv) {
     return 1;
   }
 
-#ifdef LUNET_EMBED_SCRIPTS
-  char embedded_root[LUNET_EMBED_PATH_MAX] = {0};
-  char embedded_script[LUNET_EMBED_PATH_MAX] = {0};
-  char embed_error[512] = {0};
-#endif
-
   /* Initialize tracing */
   lunet_init_once();
 
-  lua_State *L = luaL_newstate();
-  luaL_openlibs(L);
-  set_default_luaL(L);
-  lunet_open(L);
-
-  // Add binary's directory to cpath for finding driver .so files
-  // Drivers are in same dir as binary, named like sqlite3.so, mysql.so
-  // They're loaded as lunet.sqlite3, so we need lunet/?.so pattern
-  // Create symlink-style lookup: binarydir/lunet/?.so -> binarydir/?.so
-  {
-    char *exe_path = lunet_resolve_executable_path(argv[0]);
-    if (!exe_path) {
-      goto cpath_done;
-    }
-
-    char *last_slash = strrchr(exe_path, '/');
-    char *last_backslash = strrchr(exe_path, '\\');
-    char *last_sep = last_slash;
-    if (!last_sep || (last_backslash && last_backslash > last_sep)) {
-      last_sep = last_backslash;
-    }
-    if (!last_sep) {
-      free(exe_path);
-      goto cpath_done;
-    }
-
-    *last_sep = '\0';
-
-    lua_getglobal(L, "package");
-    lua_getfield(L, -1, "cpath");
-    const char *old_cpath = lua_tostring(L, -1);
-    lua_pop(L, 1);
+#ifndef _WIN32
+  /* A peer that goes away must fail the write (EPIPE), not kill the process;
+   * sendfile(2) has no MSG_NOSIGNAL */
+  signal(SIGPIPE, SIG_IGN);
+#endif
 
-    char new_cpath[4096];
-#if defined(_WIN32)
-    snprintf(new_cpath, sizeof(new_cpath), "%s\\lunet\\?.dll;%s\\?.dll;%s",
-             exe_path, exe_path, old_cpath ? old_cpath : "");
-#else
-    snprintf(new_cpath, sizeof(new_cpath), "%s/lunet/?.so;%s/?.so;%s",
-             exe_path, exe_path, old_cpath ? old_cpath : "");
+#ifdef LUNET_TRACE
+  if (g_nworkers > 1) {
+    fprintf(stderr, "WARNING: trace counters are not synchronised across --workers threads\n");
+  }
 #endif
-    lua_pushstring(L, new_cpath);
-    lua_setfield(L, -2, "cpath");
-    lua_pop(L, 1);
 
-    free(exe_path);
-  cpath_done:;
+  g_lunet_config.workers = g_nworkers;
+  g_workers = calloc((size_t)g_nworkers, sizeof(lunet_worker_t));
+  if (!g_workers || lunet_workers_init(g_nworkers) != 0) {
+    fprintf(stderr, "Error: out of memory\n");
+    return 1;
+  }
+  for (int i = 0; i < g_nworkers; i++) {
+    g_workers[i].id = i;
+    g_workers[i].argv0 = argv[0];
+    g_workers[i].script = argv[script_index];
+    g_workers[i].exit_code = -1;
   }
 
-  const char *script_to_run = argv[script_index];
-#ifdef LUNET_EMBED_SCRIPTS
-  if (lunet_embed_scripts_prepare(L,
-                                  embedded_root,
-                                  sizeof(embedded_root),
-                                  embed_error,
-                                  sizeof(embed_error)) != 0) {
-    fprintf(stderr, "Error: failed to prepare embedded scripts: %s\n", embed_error);
-    lua_close(L);
+  lunet_worker_t *main_worker = &g_workers[0];
+  if (lunet_worker_start(main_worker) != 0) {
+    lunet_worker_detach(0);
+    lunet_exec_shutdown();
+    lunet_worker_close(main_worker);
     return 1;
   }
 
-  {
-    int resolved = lunet_embed_scripts_resolve_script(embedded_root,
-                                                      script_to_run,
-                                                      embedded_script,
-                                                      sizeof(embedded_script),
-                                                      embed_error,
-                                                      sizeof(embed_error));
-    if (resolved < 0) {
-      fprintf(stderr, "Error: failed to resolve embedded script path: %s\n", embed_error);
-      lua_close(L);
-      return 1;
-    }
-    if (resolved > 0) {
-      script_to_run = embedded_script;
+  /* Start the other workers once worker 0 has set up shared state */
+  int started = 1;
+  for (int i = 1; i < g_nworkers; i++) {
+    g_workers[i].embedded_root = main_worker->embedded_root;
+    if (uv_thread_create(&g_workers[i].thread, lunet_worker_thread, &g_workers[i]) != 0) {
+      fprintf(stderr, "Error: failed to start worker %d\n", i);
+      break;
     }
+    started++;
   }
-#endif
 
-  // run lua file
-  if (luaL_dofile(L, script_to_run) != LUA_OK) {
-    const char *error = lua_tostring(L, -1);
-    fprintf(stderr, "Error: %s\n", error);
-    lua_pop(L, 1);
-    lua_close(L);
-    return 1;
+  int ret = lunet_worker_loop(main_worker);
+
+  int lua_exit_code = main_worker->exit_code;
+  for (int i = 1; i < started; i++) {
+    uv_thread_join(&g_workers[i].thread);
+    if (g_workers[i].failed) {
+      lua_exit_code = 1;
+    } else if (g_workers[i].exit_code > 0 && lua_exit_code <= 0) {
+      lua_exit_code = g_workers[i].exit_code;
+    }
+  }
+  if (started < g_nworkers) {
+    lua_exit_code = 1;
   }
 
-  int ret = uv_run(uv_default_loop(), UV_RUN_DEFAULT);
+  /* Every loop has finished: stop the executors before closing main's state */
+  lunet_exec_shutdown();
 
-  /* Optional: allow Lua script to control process exit status.
-   * Used by stress tests so we can exit without os.exit() (which skips trace shutdown).
-   */
-  int lua_exit_code = -1;
-  lua_getglobal(L, "__lunet_exit_code");
-  if (lua_isnumber(L, -1)) {
-    lua_exit_code = (int)lua_tointeger(L, -1);
-  }
-  lua_pop(L, 1);
-  
   /* Dump trace statistics and assert balance */
   lunet_trace_shutdown();
-  
-  lua_close(L);
+
+  lunet_worker_close(main_worker);
+  lunet_workers_shutdown();
+  free(g_workers);
 
   {
     int loop_close_status = uv_loop_close(uv_default_loop());
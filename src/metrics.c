@@ -0,0 +1,446 @@
+#include "metrics.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lunet_mem.h"
+#include "rt.h"
+
+#define LUNET_METRICS_KEY "lunet.metrics.sources"
+#define LUNET_METRICS_MAGIC 0x4D455452U  /* "METR" */
+
+/*
+ * Bucket layout: values below 8 us get one bucket each; above that, every
+ * power of two is split into 8 equal sub-buckets. 30 groups reach 2^32 us;
+ * larger values land in the last bucket.
+ */
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP 31
+#define HIST_BUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 2) * HIST_SUB)
+
+typedef struct {
+  uint64_t count;
+  uint64_t sum_us;
+  uint64_t max_us;
+  uint64_t buckets[HIST_BUCKETS];
+} lunet_hist_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t size;
+  lunet_hist_t hist[LUNET_METRIC_COUNT];
+  uint64_t spawns;
+  uint64_t resumes;
+  uint64_t resume_yields;
+  uint64_t resume_errors;
+  uint64_t loop_iterations;
+  uint64_t loop_busy_ns;
+  uint64_t loop_idle_ns;
+  const void *mem;  /* this module's lunet_mem_state in trace/EasyMem builds */
+  void (*arena_stats)(lunet_arena_stats_t *out);
+} lunet_metrics_block_t;
+
+static LUNET_THREAD_LOCAL lunet_metrics_block_t t_metrics;
+
+#if UV_VERSION_HEX >= ((1 << 16) | (39 << 8) | 0)
+#define LUNET_METRICS_IDLE_TIME 1
+#endif
+
+typedef struct {
+  uv_prepare_t prepare;
+  uv_check_t check;
+  uv_loop_t *loop;
+  uint64_t last_check_ns;
+  uint64_t last_idle_ns;
+} lunet_loop_probe_t;
+
+static LUNET_THREAD_LOCAL lunet_loop_probe_t t_probe;
+
+static inline int hist_log2(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+  return 63 - __builtin_clzll(v);
+#else
+  int e = 0;
+  while (v >>= 1) e++;
+  return e;
+#endif
+}
+
+static inline int hist_index(uint64_t us) {
+  if (us < HIST_SUB) return (int)us;
+  int e = hist_log2(us);
+  if (e > HIST_MAX_EXP) return HIST_BUCKETS - 1;
+  int sub = (int)((us >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+  return (e - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+/* Highest value (us) that maps to bucket idx */
+static uint64_t hist_upper(int idx) {
+  if (idx < HIST_SUB) return (uint64_t)idx;
+  int e = idx / HIST_SUB + HIST_SUB_BITS - 1;
+  uint64_t sub = (uint64_t)(idx % HIST_SUB);
+  uint64_t width = (uint64_t)1 << (e - HIST_SUB_BITS);
+  return ((HIST_SUB + sub) << (e - HIST_SUB_BITS)) + width - 1;
+}
+
+void lunet_metrics_record(lunet_metric_t metric, uint64_t ns) {
+  lunet_hist_t *h = &t_metrics.hist[metric];
+  uint64_t us = ns / 1000;
+  h->count++;
+  h->sum_us += us;
+  if (us > h->max_us) h->max_us = us;
+  h->buckets[hist_index(us)]++;
+}
+
+void lunet_metrics_resume(int status) {
+  t_metrics.resumes++;
+  if (status == LUA_YIELD) {
+    t_metrics.resume_yields++;
+  } else if (status != 0) {
+    t_metrics.resume_errors++;
+  }
+}
+
+void lunet_metrics_spawn(void) { t_metrics.spawns++; }
+
+void lunet_metrics_attach(lua_State *L) {
+  t_metrics.magic = LUNET_METRICS_MAGIC;
+  t_metrics.size = (uint32_t)sizeof(t_metrics);
+#if defined(LUNET_TRACE) || defined(LUNET_EASY_MEMORY)
+  t_metrics.mem = &lunet_mem_state;
+#endif
+  t_metrics.arena_stats = lunet_arena_stats;
+
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_METRICS_KEY);
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, LUNET_METRICS_KEY);
+  }
+  int n = (int)lua_objlen(L, -1);
+  for (int i = 1; i <= n; i++) {
+    lua_rawgeti(L, -1, i);
+    int same = lua_touserdata(L, -1) == (void *)&t_metrics;
+    lua_pop(L, 1);
+    if (same) {
+      lua_pop(L, 1);
+      return;
+    }
+  }
+  lua_pushlightuserdata(L, &t_metrics);
+  lua_rawseti(L, -2, n + 1);
+  lua_pop(L, 1);
+}
+
+/*
+ * Loop lag. With libuv's idle-time metric, each check callback records the
+ * time since the previous one minus the time spent blocked in poll, i.e.
+ * everything the loop thread did in that iteration (I/O callbacks included).
+ * Older libuv only allows the check-to-prepare interval, which misses the
+ * I/O callbacks that run inside poll.
+ */
+static void probe_check_cb(uv_check_t *handle) {
+  (void)handle;
+  uint64_t now = uv_hrtime();
+  t_metrics.loop_iterations++;
+#ifdef LUNET_METRICS_IDLE_TIME
+  uint64_t idle = uv_metrics_idle_time(t_probe.loop);
+  if (t_probe.last_check_ns) {
+    uint64_t idle_delta = idle - t_probe.last_idle_ns;
+    uint64_t elapsed = now - t_probe.last_check_ns;
+    uint64_t busy = elapsed > idle_delta ? elapsed - idle_delta : 0;
+    lunet_metrics_record(LUNET_METRIC_LOOP_LAG, busy);
+    t_metrics.loop_busy_ns += busy;
+    t_metrics.loop_idle_ns += idle_delta;
+  }
+  t_probe.last_idle_ns = idle;
+#endif
+  t_probe.last_check_ns = now;
+}
+
+static void probe_prepare_cb(uv_prepare_t *handle) {
+  (void)handle;
+#ifndef LUNET_METRICS_IDLE_TIME
+  if (t_probe.last_check_ns) {
+    uint64_t busy = uv_hrtime() - t_probe.last_check_ns;
+    lunet_metrics_record(LUNET_METRIC_LOOP_LAG, busy);
+    t_metrics.loop_busy_ns += busy;
+  }
+#endif
+}
+
+int lunet_metrics_loop_start(uv_loop_t *loop) {
+  if (t_probe.loop) return 0;
+#ifdef LUNET_METRICS_IDLE_TIME
+  /* Only takes effect before the loop first runs; harmless otherwise */
+  uv_loop_configure(loop, UV_METRICS_IDLE_TIME);
+#endif
+  int rc = uv_prepare_init(loop, &t_probe.prepare);
+  if (rc < 0) return rc;
+  rc = uv_check_init(loop, &t_probe.check);
+  if (rc < 0) {
+    uv_close((uv_handle_t *)&t_probe.prepare, NULL);
+    return rc;
+  }
+  t_probe.loop = loop;
+  t_probe.last_check_ns = 0;
+  t_probe.last_idle_ns = 0;
+  uv_prepare_start(&t_probe.prepare, probe_prepare_cb);
+  uv_check_start(&t_probe.check, probe_check_cb);
+  /* Probes must never keep the loop alive */
+  uv_unref((uv_handle_t *)&t_probe.prepare);
+  uv_unref((uv_handle_t *)&t_probe.check);
+  return 0;
+}
+
+void lunet_metrics_loop_stop(uv_loop_t *loop) {
+  if (t_probe.loop != loop) return;
+  uv_close((uv_handle_t *)&t_probe.prepare, NULL);
+  uv_close((uv_handle_t *)&t_probe.check, NULL);
+  uv_run(loop, UV_RUN_NOWAIT);
+  t_probe.loop = NULL;
+}
+
+static void merge_block(lunet_metrics_block_t *dst, const lunet_metrics_block_t *src) {
+  for (int m = 0; m < LUNET_METRIC_COUNT; m++) {
+    lunet_hist_t *d = &dst->hist[m];
+    const lunet_hist_t *s = &src->hist[m];
+    if (s->count == 0) continue;
+    d->count += s->count;
+    d->sum_us += s->sum_us;
+    if (s->max_us > d->max_us) d->max_us = s->max_us;
+    for (int i = 0; i < HIST_BUCKETS; i++) d->buckets[i] += s->buckets[i];
+  }
+  dst->spawns += src->spawns;
+  dst->resumes += src->resumes;
+  dst->resume_yields += src->resume_yields;
+  dst->resume_errors += src->resume_errors;
+  dst->loop_iterations += src->loop_iterations;
+  dst->loop_busy_ns += src->loop_busy_ns;
+  dst->loop_idle_ns += src->loop_idle_ns;
+}
+
+/* Value (ms) at quantile q: the top of the bucket holding that rank */
+static double hist_quantile(const lunet_hist_t *h, double q) {
+  if (h->count == 0) return 0;
+  uint64_t rank = (uint64_t)(q * (double)h->count + 0.999999);
+  if (rank == 0) rank = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      uint64_t us = hist_upper(i);
+      return (double)(us < h->max_us ? us : h->max_us) / 1e3;
+    }
+  }
+  return (double)h->max_us / 1e3;
+}
+
+static void push_hist(lua_State *L, const lunet_hist_t *h, int with_buckets) {
+  lua_createtable(L, 0, with_buckets ? 9 : 8);
+  lua_pushnumber(L, (lua_Number)h->count);
+  lua_setfield(L, -2, "count");
+  lua_pushnumber(L, (lua_Number)h->sum_us / 1e3);
+  lua_setfield(L, -2, "sum_ms");
+  lua_pushnumber(L, (lua_Number)h->max_us / 1e3);
+  lua_setfield(L, -2, "max_ms");
+  lua_pushnumber(L, h->count ? (lua_Number)h->sum_us / 1e3 / (lua_Number)h->count : 0);
+  lua_setfield(L, -2, "mean_ms");
+  lua_pushnumber(L, hist_quantile(h, 0.50));
+  lua_setfield(L, -2, "p50");
+  lua_pushnumber(L, hist_quantile(h, 0.90));
+  lua_setfield(L, -2, "p90");
+  lua_pushnumber(L, hist_quantile(h, 0.99));
+  lua_setfield(L, -2, "p99");
+  lua_pushnumber(L, hist_quantile(h, 0.999));
+  lua_setfield(L, -2, "p999");
+  if (!with_buckets) return;
+
+  /* Non-empty buckets as {le_ms, cumulative count}, ready for Prometheus */
+  lua_newtable(L);
+  uint64_t seen = 0;
+  int n = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    if (h->buckets[i] == 0) continue;
+    seen += h->buckets[i];
+    lua_createtable(L, 2, 0);
+    lua_pushnumber(L, (lua_Number)(hist_upper(i) + 1) / 1e3);
+    lua_rawseti(L, -2, 1);
+    lua_pushnumber(L, (lua_Number)seen);
+    lua_rawseti(L, -2, 2);
+    lua_rawseti(L, -2, ++n);
+  }
+  lua_setfield(L, -2, "buckets");
+}
+
+static void push_hist_pair(lua_State *L, const lunet_metrics_block_t *b, lunet_metric_t a,
+                           const char *a_name, lunet_metric_t c, const char *c_name,
+                           int with_buckets) {
+  lua_createtable(L, 0, 2);
+  push_hist(L, &b->hist[a], with_buckets);
+  lua_setfield(L, -2, a_name);
+  push_hist(L, &b->hist[c], with_buckets);
+  lua_setfield(L, -2, c_name);
+}
+
+/* Allocator counters summed over every distinct module */
+static void push_mem(lua_State *L, const void *const *mems, int nmems) {
+  lua_createtable(L, 0, 4);
+#if defined(LUNET_TRACE) || defined(LUNET_EASY_MEMORY)
+  lua_Number allocs = 0, frees = 0, current = 0, peak = 0;
+  for (int i = 0; i < nmems; i++) {
+    const lunet_mem_state_t *m = (const lunet_mem_state_t *)mems[i];
+    allocs += m->alloc_count;
+    frees += m->free_count;
+    current += (lua_Number)m->current_bytes;
+    peak += (lua_Number)m->peak_bytes;
+  }
+  lua_pushnumber(L, allocs);
+  lua_setfield(L, -2, "allocs");
+  lua_pushnumber(L, frees);
+  lua_setfield(L, -2, "frees");
+  lua_pushnumber(L, current);
+  lua_setfield(L, -2, "current_bytes");
+  lua_pushnumber(L, peak);
+  lua_setfield(L, -2, "peak_bytes");
+#else
+  (void)mems;
+  (void)nmems;
+#endif
+}
+
+/* Arena counters summed over every distinct module */
+static void push_arena(lua_State *L, void (*const *fns)(lunet_arena_stats_t *), int nfns) {
+  lunet_arena_stats_t sum = {0};
+  for (int i = 0; i < nfns; i++) {
+    lunet_arena_stats_t st;
+    fns[i](&st);
+    sum.arenas += st.arenas;
+    sum.active += st.active;
+    sum.blocks += st.blocks;
+    sum.oversize += st.oversize;
+    sum.reserved_bytes += st.reserved_bytes;
+    sum.peak_reserved_bytes += st.peak_reserved_bytes;
+    if (st.peak_arena_bytes > sum.peak_arena_bytes) sum.peak_arena_bytes = st.peak_arena_bytes;
+    sum.used_bytes += st.used_bytes;
+    sum.capacity_bytes += st.capacity_bytes;
+  }
+  lua_createtable(L, 0, 9);
+  lua_pushnumber(L, (lua_Number)sum.arenas);
+  lua_setfield(L, -2, "arenas");
+  lua_pushnumber(L, (lua_Number)sum.active);
+  lua_setfield(L, -2, "active");
+  lua_pushnumber(L, (lua_Number)sum.blocks);
+  lua_setfield(L, -2, "blocks");
+  lua_pushnumber(L, (lua_Number)sum.oversize);
+  lua_setfield(L, -2, "oversize");
+  lua_pushnumber(L, (lua_Number)sum.reserved_bytes);
+  lua_setfield(L, -2, "reserved_bytes");
+  lua_pushnumber(L, (lua_Number)sum.peak_reserved_bytes);
+  lua_setfield(L, -2, "peak_reserved_bytes");
+  lua_pushnumber(L, (lua_Number)sum.peak_arena_bytes);
+  lua_setfield(L, -2, "peak_arena_bytes");
+  /* Share of arena space actually handed out; the rest is block tails */
+  lua_pushnumber(L, sum.capacity_bytes
+                        ? (lua_Number)sum.used_bytes / (lua_Number)sum.capacity_bytes
+                        : 1);
+  lua_setfield(L, -2, "fill_ratio");
+}
+
+int lunet_hrtime(lua_State *L) {
+  lua_pushnumber(L, (lua_Number)uv_hrtime());
+  return 1;
+}
+
+int lunet_metrics(lua_State *L) {
+  int with_buckets = 0;
+  if (lua_istable(L, 1)) {
+    lua_getfield(L, 1, "buckets");
+    with_buckets = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+  }
+
+  lunet_metrics_block_t *sum = lunet_calloc(1, sizeof(*sum));
+  if (!sum) {
+    lua_pushnil(L);
+    lua_pushstring(L, "out of memory");
+    return 2;
+  }
+  lunet_metrics_attach(L);
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_METRICS_KEY);
+  const void *mems[16];
+  int nmems = 0;
+  void (*arena_fns[16])(lunet_arena_stats_t *);
+  int nfns = 0;
+  int n = (int)lua_objlen(L, -1);
+  for (int i = 1; i <= n; i++) {
+    lua_rawgeti(L, -1, i);
+    const lunet_metrics_block_t *src = (const lunet_metrics_block_t *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    /* A block from a module built from other sources is skipped */
+    if (!src || src->magic != LUNET_METRICS_MAGIC || src->size != sizeof(*src)) continue;
+    merge_block(sum, src);
+    /* Modules may share one allocator state when symbols are interposed */
+    int seen = src->mem == NULL;
+    for (int j = 0; j < nmems && !seen; j++) seen = mems[j] == src->mem;
+    if (!seen && nmems < (int)(sizeof(mems) / sizeof(mems[0]))) mems[nmems++] = src->mem;
+    seen = src->arena_stats == NULL;
+    for (int j = 0; j < nfns && !seen; j++) seen = arena_fns[j] == src->arena_stats;
+    if (!seen && nfns < (int)(sizeof(arena_fns) / sizeof(arena_fns[0]))) {
+      arena_fns[nfns++] = src->arena_stats;
+    }
+  }
+  lua_pop(L, 1);
+
+  lua_createtable(L, 0, 8);
+
+  lua_createtable(L, 0, 5);
+  lua_pushnumber(L, (lua_Number)sum->loop_iterations);
+  lua_setfield(L, -2, "iterations");
+  lua_pushnumber(L, (lua_Number)sum->loop_busy_ns / 1e6);
+  lua_setfield(L, -2, "busy_ms");
+  lua_pushnumber(L, (lua_Number)sum->loop_idle_ns / 1e6);
+  lua_setfield(L, -2, "idle_ms");
+  uint64_t total = sum->loop_busy_ns + sum->loop_idle_ns;
+  lua_pushnumber(L, total ? (lua_Number)sum->loop_busy_ns / (lua_Number)total : 0);
+  lua_setfield(L, -2, "utilization");
+  push_hist(L, &sum->hist[LUNET_METRIC_LOOP_LAG], with_buckets);
+  lua_setfield(L, -2, "lag");
+  lua_setfield(L, -2, "loop");
+
+  lua_createtable(L, 0, 4);
+  lua_pushnumber(L, (lua_Number)sum->spawns);
+  lua_setfield(L, -2, "spawned");
+  lua_pushnumber(L, (lua_Number)sum->resumes);
+  lua_setfield(L, -2, "resumes");
+  lua_pushnumber(L, (lua_Number)sum->resume_yields);
+  lua_setfield(L, -2, "yields");
+  lua_pushnumber(L, (lua_Number)sum->resume_errors);
+  lua_setfield(L, -2, "errors");
+  lua_setfield(L, -2, "coroutines");
+
+  push_hist_pair(L, sum, LUNET_METRIC_SOCKET_READ, "read", LUNET_METRIC_SOCKET_WRITE, "write",
+                 with_buckets);
+  lua_setfield(L, -2, "socket");
+  push_hist(L, &sum->hist[LUNET_METRIC_FS], with_buckets);
+  lua_setfield(L, -2, "fs");
+  push_hist_pair(L, sum, LUNET_METRIC_DB_QUEUE, "queue", LUNET_METRIC_DB_EXEC, "exec",
+                 with_buckets);
+  lua_setfield(L, -2, "db");
+  push_hist_pair(L, sum, LUNET_METRIC_CPU_QUEUE, "queue", LUNET_METRIC_CPU_EXEC, "exec",
+                 with_buckets);
+  lua_setfield(L, -2, "cpu");
+  push_hist(L, &sum->hist[LUNET_METRIC_HTTPC], with_buckets);
+  lua_setfield(L, -2, "httpc");
+  if (nmems > 0) {
+    push_mem(L, mems, nmems);
+    lua_setfield(L, -2, "mem");
+  }
+  push_arena(L, arena_fns, nfns);
+  lua_setfield(L, -2, "arena");
+
+  lunet_free(sum);
+  return 1;
+}
@@ -3,7 +3,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdatomic.h>
+#include <uv.h>
+#include "executor.h"
 #include "lunet_mem.h"
+#include "rt.h"
 
 /* Constants */
 #define HEADER_LEN 8
@@ -27,18 +31,125 @@
 /* Globals */
 static int g_paxe_enabled = 0;
 static paxe_fail_policy_t g_fail_policy = PAXE_DROP;
-static paxe_stats_t g_stats = {0};
-static uint32_t g_log_once_mask = 0;
+static _Atomic uint32_t g_log_once_mask = 0;
+
+/* Key Store: RCU-style open-addressing table
+ *
+ * Readers load the current generation with one atomic acquire and never
+ * lock. Writers (serialised by g_keystore_mutex) build a complete new
+ * generation, publish it with an atomic swap and retire the old one. A
+ * retired generation is wiped and freed once every reader that could still
+ * see it has left, tracked with per-thread epoch slots.
+ *
+ * Each entry carries the expanded AES-GCM key schedule so standard-mode
+ * packets skip crypto_aead_aes256gcm_beforenm on every call, and is padded
+ * to whole cache lines so probes never straddle a neighbour's key.
+ */
+#define PAXE_CACHELINE 64
+#if defined(_MSC_VER)
+#define PAXE_CACHE_ALIGN __declspec(align(PAXE_CACHELINE))
+#else
+#define PAXE_CACHE_ALIGN __attribute__((aligned(PAXE_CACHELINE)))
+#endif
+
+#define KEYSTORE_DEFAULT_CAPACITY 256
+#define KEYSTORE_MAX_READERS 64
 
-/* Key Store: Simple Open Addressing Hash Table */
-#define KEYSTORE_SIZE 256
 typedef struct {
+    PAXE_CACHE_ALIGN crypto_aead_aes256gcm_state gcm;
     uint32_t key_id;
-    uint8_t key[32];
     int valid;
+    uint8_t key[32];
 } keystore_entry_t;
 
-static keystore_entry_t g_keystore[KEYSTORE_SIZE];
+typedef struct keystore_table_s {
+    size_t cap;                        /* power of two, load factor <= 1/2 */
+    size_t count;
+    uint64_t retire_epoch;
+    struct keystore_table_s *next_retired;
+    keystore_entry_t *entries;         /* cache-line aligned, inside this block */
+} keystore_table_t;
+
+typedef struct {
+    PAXE_CACHE_ALIGN _Atomic uint64_t epoch;  /* 0 = not reading */
+} keystore_reader_t;
+
+static _Atomic(keystore_table_t *) g_keystore = NULL;
+static _Atomic uint64_t g_keystore_epoch = 1;
+static keystore_reader_t g_keystore_readers[KEYSTORE_MAX_READERS];
+static _Atomic int g_keystore_reader_count = 0;
+static _Atomic int g_keystore_overflow_readers = 0;
+static LUNET_THREAD_LOCAL int t_reader_slot = -1;
+
+/* Statistics: one cache-line aligned shard per reader slot, so threads bump
+ * their own counters without sharing lines. Threads past the slot limit
+ * share the last shard; all adds are relaxed atomics. Readers aggregate. */
+enum {
+    ST_RX_TOTAL,
+    ST_RX_OK,
+    ST_RX_SHORT,
+    ST_RX_LEN_MISMATCH,
+    ST_RX_NO_KEY,
+    ST_RX_AUTH_FAIL,
+    ST_RX_RESERVED_NONZERO,
+    ST_COUNT
+};
+
+typedef struct {
+    PAXE_CACHE_ALIGN _Atomic uint64_t counters[ST_COUNT];
+    _Atomic uint64_t latency[PAXE_LAT_BUCKETS];
+} paxe_stats_shard_t;
+
+static paxe_stats_shard_t g_stats_shards[KEYSTORE_MAX_READERS + 1];
+
+static uv_once_t g_keystore_once = UV_ONCE_INIT;
+static uv_mutex_t g_keystore_mutex;
+static keystore_table_t *g_keystore_retired = NULL;  /* guarded by the mutex */
+static size_t g_keystore_min_cap = KEYSTORE_DEFAULT_CAPACITY;
+
+static void keystore_reclaim(int force);
+/*
+ * Mutable copy of Lua string input for the decrypt bindings. Per thread:
+ * every --workers loop decrypts into its own. The plaintext is wiped as soon
+ * as it has been copied out, and the buffer is freed when the thread's Lua
+ * state closes.
+ */
+#define PAXE_SCRATCH_KEY "lunet.paxe.scratch"
+
+static LUNET_THREAD_LOCAL uint8_t *t_scratch = NULL;
+static LUNET_THREAD_LOCAL size_t t_scratch_cap = 0;
+
+static uint8_t *scratch_reserve(size_t len) {
+    if (len > t_scratch_cap) {
+        size_t cap = t_scratch_cap ? t_scratch_cap : 2048;
+        while (cap < len) cap *= 2;
+        uint8_t *p = lunet_alloc(cap);
+        if (!p) return NULL;
+        if (t_scratch) {
+            sodium_memzero(t_scratch, t_scratch_cap);
+            lunet_free_nonnull(t_scratch);
+        }
+        t_scratch = p;
+        t_scratch_cap = cap;
+    }
+    return t_scratch;
+}
+
+static void scratch_release(void) {
+    if (t_scratch) {
+        sodium_memzero(t_scratch, t_scratch_cap);
+        lunet_free_nonnull(t_scratch);
+        t_scratch = NULL;
+        t_scratch_cap = 0;
+    }
+}
+
+/* __gc of a registry sentinel: the state's thread is done with its scratch */
+static int scratch_gc(lua_State *L) {
+    (void)L;
+    scratch_release();
+    return 0;
+}
 
 /* Helper: Read Big-Endian integers */
 static uint16_t read_u16be(const uint8_t *p) {
@@ -60,14 +171,20 @@ int paxe_init(void) {
                       Actually sodium_init usually sets things up, 
                       but checking aes256gcm availability is required by design. */
     }
-    memset(&g_stats, 0, sizeof(g_stats));
-    memset(g_keystore, 0, sizeof(g_keystore));
-    g_log_once_mask = 0;
+    paxe_stats_reset();
+    paxe_keystore_clear();
+    atomic_store(&g_log_once_mask, 0);
     return 0;
 }
 
 void paxe_shutdown(void) {
     paxe_keystore_clear();
+    /* Callers guarantee no decrypt is in flight at shutdown */
+    uv_mutex_lock(&g_keystore_mutex);
+    keystore_reclaim(1);
+    uv_mutex_unlock(&g_keystore_mutex);
+    /* Other threads release theirs when their Lua state closes */
+    scratch_release();
 }
 
 int paxe_is_enabled(void) {
@@ -79,67 +196,288 @@ void paxe_set_enabled(int enabled) {
 }
 
 /* Keystore Implementation */
-int paxe_keystore_set(uint32_t key_id, const uint8_t key[32]) {
-    /* Simple linear probe */
-    uint32_t idx = key_id % KEYSTORE_SIZE;
-    int start_idx = idx;
-
-    /* First pass: look for update */
-    do {
-        if (g_keystore[idx].valid && g_keystore[idx].key_id == key_id) {
-            memcpy(g_keystore[idx].key, key, 32);
-            return 0;
+static void keystore_once_init(void) {
+    uv_mutex_init(&g_keystore_mutex);
+}
+
+static uint32_t keystore_hash(uint32_t key_id) {
+    return key_id * 0x9E3779B1u;
+}
+
+static size_t keystore_cap_for(size_t count) {
+    size_t cap = g_keystore_min_cap;
+    while (cap < count * 2) cap *= 2;
+    return cap;
+}
+
+static keystore_table_t *keystore_table_new(size_t cap) {
+    size_t bytes = sizeof(keystore_table_t) + PAXE_CACHELINE + cap * sizeof(keystore_entry_t);
+    keystore_table_t *t = lunet_alloc(bytes);
+    if (!t) return NULL;
+    memset(t, 0, bytes);
+    uintptr_t base = (uintptr_t)(t + 1);
+    base = (base + PAXE_CACHELINE - 1) & ~(uintptr_t)(PAXE_CACHELINE - 1);
+    t->entries = (keystore_entry_t *)base;
+    t->cap = cap;
+    return t;
+}
+
+static void keystore_table_free(keystore_table_t *t) {
+    sodium_memzero(t->entries, t->cap * sizeof(keystore_entry_t));
+    lunet_free(t);
+}
+
+static keystore_entry_t *keystore_slot(keystore_table_t *t, uint32_t key_id) {
+    size_t mask = t->cap - 1;
+    size_t idx = keystore_hash(key_id) & mask;
+    while (t->entries[idx].valid && t->entries[idx].key_id != key_id) {
+        idx = (idx + 1) & mask;
+    }
+    return &t->entries[idx];
+}
+
+static void keystore_put(keystore_table_t *t, uint32_t key_id, const uint8_t key[32],
+                         const crypto_aead_aes256gcm_state *gcm) {
+    keystore_entry_t *e = keystore_slot(t, key_id);
+    if (!e->valid) t->count++;
+    e->key_id = key_id;
+    memcpy(e->key, key, 32);
+    if (gcm) {
+        memcpy(&e->gcm, gcm, sizeof(e->gcm));
+    } else {
+        crypto_aead_aes256gcm_beforenm(&e->gcm, key);
+    }
+    e->valid = 1;
+}
+
+/* Copy every live entry of src except skip_id into a table of cap slots */
+static keystore_table_t *keystore_clone(const keystore_table_t *src, size_t cap,
+                                        int has_skip, uint32_t skip_id) {
+    keystore_table_t *t = keystore_table_new(cap);
+    if (!t || !src) return t;
+    for (size_t i = 0; i < src->cap; i++) {
+        const keystore_entry_t *e = &src->entries[i];
+        if (!e->valid || (has_skip && e->key_id == skip_id)) continue;
+        keystore_put(t, e->key_id, e->key, &e->gcm);
+    }
+    return t;
+}
+
+/* Free retired generations that no reader can still hold. Mutex held. */
+static void keystore_reclaim(int force) {
+    uint64_t oldest = UINT64_MAX;
+    if (!force) {
+        if (atomic_load(&g_keystore_overflow_readers) > 0) return;
+        int n = atomic_load(&g_keystore_reader_count);
+        if (n > KEYSTORE_MAX_READERS) n = KEYSTORE_MAX_READERS;
+        for (int i = 0; i < n; i++) {
+            uint64_t e = atomic_load(&g_keystore_readers[i].epoch);
+            if (e != 0 && e < oldest) oldest = e;
         }
-        idx = (idx + 1) % KEYSTORE_SIZE;
-    } while (idx != start_idx);
-
-    /* Second pass: look for empty slot */
-    idx = start_idx;
-    do {
-        if (!g_keystore[idx].valid) {
-            g_keystore[idx].key_id = key_id;
-            memcpy(g_keystore[idx].key, key, 32);
-            g_keystore[idx].valid = 1;
-            return 0;
+    }
+    keystore_table_t **pp = &g_keystore_retired;
+    while (*pp) {
+        keystore_table_t *t = *pp;
+        if (force || t->retire_epoch <= oldest) {
+            *pp = t->next_retired;
+            keystore_table_free(t);
+        } else {
+            pp = &t->next_retired;
         }
-        idx = (idx + 1) % KEYSTORE_SIZE;
-    } while (idx != start_idx);
+    }
+}
 
-    return -1; /* Full */
+/* Swap in a new generation and retire the previous one. Mutex held. */
+static void keystore_publish(keystore_table_t *next) {
+    keystore_table_t *prev = atomic_exchange(&g_keystore, next);
+    if (prev) {
+        prev->retire_epoch = atomic_fetch_add(&g_keystore_epoch, 1) + 1;
+        prev->next_retired = g_keystore_retired;
+        g_keystore_retired = prev;
+    }
+    keystore_reclaim(0);
 }
 
-int paxe_keystore_clear(void) {
-    for (int i = 0; i < KEYSTORE_SIZE; i++) {
-        if (g_keystore[i].valid) {
-            sodium_memzero(g_keystore[i].key, 32);
-            g_keystore[i].valid = 0;
-        }
+/* Reader side: bracket every use of an entry returned by keystore_get */
+/* Per-thread slot shared by keystore readers and stats shards;
+ * KEYSTORE_MAX_READERS marks the shared overflow slot. */
+static int paxe_thread_slot(void) {
+    if (t_reader_slot == -1) {
+        int slot = atomic_fetch_add(&g_keystore_reader_count, 1);
+        t_reader_slot = slot < KEYSTORE_MAX_READERS ? slot : KEYSTORE_MAX_READERS;
+    }
+    return t_reader_slot;
+}
+
+static keystore_table_t *keystore_read_begin(void) {
+    paxe_thread_slot();
+    if (t_reader_slot < KEYSTORE_MAX_READERS) {
+        atomic_store(&g_keystore_readers[t_reader_slot].epoch,
+                     atomic_load(&g_keystore_epoch));
+    } else {
+        atomic_fetch_add(&g_keystore_overflow_readers, 1);
+    }
+    return atomic_load(&g_keystore);
+}
+
+static void keystore_read_end(void) {
+    if (t_reader_slot < KEYSTORE_MAX_READERS) {
+        atomic_store_explicit(&g_keystore_readers[t_reader_slot].epoch, 0,
+                              memory_order_release);
+    } else {
+        atomic_fetch_sub(&g_keystore_overflow_readers, 1);
+    }
+}
+
+static const keystore_entry_t* keystore_get(keystore_table_t *t, uint32_t key_id) {
+    if (!t) return NULL;
+    const keystore_entry_t *e = keystore_slot(t, key_id);
+    return e->valid ? e : NULL;
+}
+
+int paxe_keystore_set(uint32_t key_id, const uint8_t key[32]) {
+    return paxe_keystore_set_many(&key_id, (const uint8_t (*)[32])key, 1);
+}
+
+int paxe_keystore_set_many(const uint32_t *key_ids, const uint8_t (*keys)[32], size_t n) {
+    uv_once(&g_keystore_once, keystore_once_init);
+    uv_mutex_lock(&g_keystore_mutex);
+    keystore_table_t *cur = atomic_load(&g_keystore);
+    size_t count = (cur ? cur->count : 0) + n;
+    keystore_table_t *next = keystore_clone(cur, keystore_cap_for(count), 0, 0);
+    if (!next) {
+        uv_mutex_unlock(&g_keystore_mutex);
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        keystore_put(next, key_ids[i], keys[i], NULL);
+    }
+    keystore_publish(next);
+    uv_mutex_unlock(&g_keystore_mutex);
+    return 0;
+}
+
+int paxe_keystore_remove(uint32_t key_id) {
+    uv_once(&g_keystore_once, keystore_once_init);
+    uv_mutex_lock(&g_keystore_mutex);
+    keystore_table_t *cur = atomic_load(&g_keystore);
+    if (!keystore_get(cur, key_id)) {
+        uv_mutex_unlock(&g_keystore_mutex);
+        return -1;
+    }
+    keystore_table_t *next = keystore_clone(cur, cur->cap, 1, key_id);
+    if (!next) {
+        uv_mutex_unlock(&g_keystore_mutex);
+        return -1;
     }
+    keystore_publish(next);
+    uv_mutex_unlock(&g_keystore_mutex);
     return 0;
 }
 
-static const uint8_t* keystore_get(uint32_t key_id) {
-    uint32_t idx = key_id % KEYSTORE_SIZE;
-    int start_idx = idx;
-    do {
-        if (g_keystore[idx].valid && g_keystore[idx].key_id == key_id) {
-            return g_keystore[idx].key;
+int paxe_keystore_reserve(size_t capacity) {
+    uv_once(&g_keystore_once, keystore_once_init);
+    uv_mutex_lock(&g_keystore_mutex);
+    size_t cap = KEYSTORE_DEFAULT_CAPACITY;
+    while (cap < capacity * 2) cap *= 2;
+    g_keystore_min_cap = cap;
+    keystore_table_t *cur = atomic_load(&g_keystore);
+    int ret = 0;
+    if (cur && cur->cap < cap) {
+        keystore_table_t *next = keystore_clone(cur, keystore_cap_for(cur->count), 0, 0);
+        if (next) {
+            keystore_publish(next);
+        } else {
+            ret = -1;
         }
-        if (!g_keystore[idx].valid) break; /* Stop at hole? No, could be collision chain. 
-                                              But for this simple impl, we stop at empty if we assume no deletes.
-                                              If deletes were supported, we'd need tombstones.
-                                              We don't support delete yet, only clear. */
-        idx = (idx + 1) % KEYSTORE_SIZE;
-    } while (idx != start_idx);
-    return NULL;
+    }
+    uv_mutex_unlock(&g_keystore_mutex);
+    return ret;
+}
+
+int paxe_keystore_clear(void) {
+    uv_once(&g_keystore_once, keystore_once_init);
+    uv_mutex_lock(&g_keystore_mutex);
+    keystore_table_t *prev = atomic_exchange(&g_keystore, NULL);
+    if (prev) {
+        prev->retire_epoch = atomic_fetch_add(&g_keystore_epoch, 1) + 1;
+        prev->next_retired = g_keystore_retired;
+        g_keystore_retired = prev;
+    }
+    keystore_reclaim(0);
+    uv_mutex_unlock(&g_keystore_mutex);
+    return 0;
+}
+
+int paxe_keystore_has(uint32_t key_id) {
+    keystore_table_t *t = keystore_read_begin();
+    int found = keystore_get(t, key_id) != NULL;
+    keystore_read_end();
+    return found;
+}
+
+size_t paxe_keystore_count(void) {
+    keystore_table_t *t = keystore_read_begin();
+    size_t n = t ? t->count : 0;
+    keystore_read_end();
+    return n;
 }
 
 void paxe_set_fail_policy(paxe_fail_policy_t policy) {
     g_fail_policy = policy;
 }
 
+static void stats_add(int counter) {
+    paxe_stats_shard_t *shard = &g_stats_shards[paxe_thread_slot()];
+    atomic_fetch_add_explicit(&shard->counters[counter], 1, memory_order_relaxed);
+}
+
+static void stats_latency(uint64_t ns) {
+    int bucket = 0;
+    while ((ns >>= 1) != 0 && bucket < PAXE_LAT_BUCKETS - 1) bucket++;
+    paxe_stats_shard_t *shard = &g_stats_shards[paxe_thread_slot()];
+    atomic_fetch_add_explicit(&shard->latency[bucket], 1, memory_order_relaxed);
+}
+
+void paxe_stats_reset(void) {
+    for (int i = 0; i <= KEYSTORE_MAX_READERS; i++) {
+        for (int c = 0; c < ST_COUNT; c++) {
+            atomic_store_explicit(&g_stats_shards[i].counters[c], 0, memory_order_relaxed);
+        }
+        for (int b = 0; b < PAXE_LAT_BUCKETS; b++) {
+            atomic_store_explicit(&g_stats_shards[i].latency[b], 0, memory_order_relaxed);
+        }
+    }
+}
+
+void paxe_stats_snapshot(paxe_stats_snapshot_t *out) {
+    uint64_t sum[ST_COUNT] = {0};
+    memset(out, 0, sizeof(*out));
+    int n = atomic_load(&g_keystore_reader_count);
+    if (n > KEYSTORE_MAX_READERS) n = KEYSTORE_MAX_READERS + 1;
+    for (int i = 0; i < n; i++) {
+        const paxe_stats_shard_t *shard = &g_stats_shards[i];
+        for (int c = 0; c < ST_COUNT; c++) {
+            sum[c] += atomic_load_explicit(&shard->counters[c], memory_order_relaxed);
+        }
+        for (int b = 0; b < PAXE_LAT_BUCKETS; b++) {
+            out->latency[b] += atomic_load_explicit(&shard->latency[b], memory_order_relaxed);
+        }
+    }
+    out->counters.rx_total = sum[ST_RX_TOTAL];
+    out->counters.rx_ok = sum[ST_RX_OK];
+    out->counters.rx_short = sum[ST_RX_SHORT];
+    out->counters.rx_len_mismatch = sum[ST_RX_LEN_MISMATCH];
+    out->counters.rx_no_key = sum[ST_RX_NO_KEY];
+    out->counters.rx_auth_fail = sum[ST_RX_AUTH_FAIL];
+    out->counters.rx_reserved_nonzero = sum[ST_RX_RESERVED_NONZERO];
+    out->timestamp_ns = uv_hrtime();
+}
+
 void paxe_stats_get(paxe_stats_t *out) {
-    *out = g_stats;
+    paxe_stats_snapshot_t snap;
+    paxe_stats_snapshot(&snap);
+    *out = snap.counters;
 }
 
 static uint32_t log_once_bit_for_reason(const char *reason) {
@@ -155,8 +493,8 @@ static uint32_t log_once_bit_for_reason(const char *reason) {
 }
 
 /* Helper to handle failure recording and policy */
-static ssize_t handle_failure(const char *reason, uint64_t *counter) {
-    if (counter) (*counter)++;
+static ssize_t handle_failure(const char *reason, int counter) {
+    stats_add(counter);
     PAXE_TRACE_DECRYPT_FAIL(reason);
     
     if (g_fail_policy == PAXE_DROP) {
@@ -188,21 +526,21 @@ static ssize_t handle_failure(const char *reason, uint64_t *counter) {
     } else if (g_fail_policy == PAXE_LOG_ONCE) {
         uint32_t bit = log_once_bit_for_reason(reason);
         if (bit == 0) bit = 1u << 31; /* unknown reason bucket */
-        if ((g_log_once_mask & bit) == 0) {
+        if ((atomic_fetch_or(&g_log_once_mask, bit) & bit) == 0) {
             fprintf(stderr, "[PAXE] Drop (first occurrence): %s\n", reason);
-            g_log_once_mask |= bit;
         }
     }
     
     return -1;
 }
 
-ssize_t paxe_try_decrypt(uint8_t *buf, size_t len, uint32_t *out_key_id, uint8_t *out_flags) {
-    g_stats.rx_total++;
+static ssize_t paxe_decrypt_with(keystore_table_t *keys, uint8_t *buf, size_t len,
+                                 uint32_t *out_key_id, uint8_t *out_flags) {
+    stats_add(ST_RX_TOTAL);
 
     /* 1. Basic length check */
     if (len < HEADER_LEN + NONCE_LEN + TAG_LEN) {
-        return handle_failure("packet too short", &g_stats.rx_short);
+        return handle_failure("packet too short", ST_RX_SHORT);
     }
 
     /* 2. Parse Header */
@@ -212,7 +550,7 @@ ssize_t paxe_try_decrypt(uint8_t *buf, size_t len, uint32_t *out_key_id, uint8_t
     uint32_t key_id = read_u32be(buf + 4);
 
     if (reserved != 0) {
-        return handle_failure("reserved byte nonzero", &g_stats.rx_reserved_nonzero);
+        return handle_failure("reserved byte nonzero", ST_RX_RESERVED_NONZERO);
     }
 
     if (out_key_id) *out_key_id = key_id;
@@ -223,14 +561,15 @@ ssize_t paxe_try_decrypt(uint8_t *buf, size_t len, uint32_t *out_key_id, uint8_t
     size_t overhead = is_dek ? OVERHEAD_DEK : OVERHEAD_STD;
     
     if (len != declared_len + overhead) {
-        return handle_failure("length mismatch", &g_stats.rx_len_mismatch);
+        return handle_failure("length mismatch", ST_RX_LEN_MISMATCH);
     }
 
     /* 4. Get Key (KEK) */
-    const uint8_t *kek = keystore_get(key_id);
-    if (!kek) {
-        return handle_failure("key not found", &g_stats.rx_no_key);
+    const keystore_entry_t *entry = keystore_get(keys, key_id);
+    if (!entry) {
+        return handle_failure("key not found", ST_RX_NO_KEY);
     }
+    const uint8_t *kek = entry->key;
 
     /* 5. Decrypt */
     unsigned long long plaintext_len;
@@ -246,17 +585,17 @@ ssize_t paxe_try_decrypt(uint8_t *buf, size_t len, uint32_t *out_key_id, uint8_t
         unsigned long long ciphertext_len = declared_len + TAG_LEN;
 
         /* In-place decrypt: ciphertext overwrites itself with plaintext */
-        ret = crypto_aead_aes256gcm_decrypt(
+        ret = crypto_aead_aes256gcm_decrypt_afternm(
             ciphertext, &plaintext_len,
             NULL,
             ciphertext, ciphertext_len,
             buf, HEADER_LEN, /* AAD is Header */
-            nonce, kek
+            nonce, &entry->gcm
         );
         
         if (ret == 0) {
             if (plaintext_len != (unsigned long long)declared_len) {
-                return handle_failure("length mismatch", &g_stats.rx_len_mismatch);
+                return handle_failure("length mismatch", ST_RX_LEN_MISMATCH);
             }
             /* Move plaintext to start of buf */
             memmove(buf, ciphertext, plaintext_len);
@@ -294,7 +633,7 @@ ssize_t paxe_try_decrypt(uint8_t *buf, size_t len, uint32_t *out_key_id, uint8_t
 
         uint8_t dek[DEK_KEY_LEN];
         if (dek_len_field != declared_len) {
-            return handle_failure("dek length mismatch", &g_stats.rx_len_mismatch);
+            return handle_failure("dek length mismatch", ST_RX_LEN_MISMATCH);
         }
         
         /* Decrypt DEK using KEK and KEK_Nonce via ChaCha20 stream XOR 
@@ -302,7 +641,7 @@ ssize_t paxe_try_decrypt(uint8_t *buf, size_t len, uint32_t *out_key_id, uint8_t
         */
         if (crypto_stream_chacha20_ietf_xor(dek, enc_dek, ENC_DEK_LEN, kek_nonce, kek) != 0) {
              /* Should not fail unless params wrong */
-             return handle_failure("dek decrypt error", &g_stats.rx_auth_fail);
+             return handle_failure("dek decrypt error", ST_RX_AUTH_FAIL);
         }
         
         /* Decrypt Payload using DEK and DEK_Nonce */
@@ -318,26 +657,84 @@ ssize_t paxe_try_decrypt(uint8_t *buf, size_t len, uint32_t *out_key_id, uint8_t
         
         if (ret == 0) {
             if (plaintext_len != (unsigned long long)declared_len) {
-                return handle_failure("length mismatch", &g_stats.rx_len_mismatch);
+                return handle_failure("length mismatch", ST_RX_LEN_MISMATCH);
             }
             memmove(buf, ciphertext, plaintext_len);
         }
     }
 
     if (ret != 0) {
-        return handle_failure("auth failed", &g_stats.rx_auth_fail);
+        return handle_failure("auth failed", ST_RX_AUTH_FAIL);
     }
 
-    g_stats.rx_ok++;
+    stats_add(ST_RX_OK);
     PAXE_TRACE_DECRYPT_OK(key_id, plaintext_len);
     return (ssize_t)plaintext_len;
 }
 
+ssize_t paxe_try_decrypt(uint8_t *buf, size_t len, uint32_t *out_key_id, uint8_t *out_flags) {
+    uint64_t start = uv_hrtime();
+    keystore_table_t *keys = keystore_read_begin();
+    ssize_t ret = paxe_decrypt_with(keys, buf, len, out_key_id, out_flags);
+    keystore_read_end();
+    stats_latency(uv_hrtime() - start);
+    return ret;
+}
+
+ssize_t paxe_encrypt(uint32_t key_id, const uint8_t *in, size_t len,
+                     uint8_t *out, size_t out_cap) {
+    if (len > 0xFFFF || out_cap < len + OVERHEAD_STD) {
+        return -1;
+    }
+    keystore_table_t *keys = keystore_read_begin();
+    const keystore_entry_t *entry = keystore_get(keys, key_id);
+    if (!entry) {
+        keystore_read_end();
+        return -1;
+    }
+
+    /* Header: Length(2) | Flags(1) | Reserved(1) | KeyID(4) */
+    out[0] = (len >> 8) & 0xFF;
+    out[1] = len & 0xFF;
+    out[2] = 0;                              /* Flags (standard mode) */
+    out[3] = 0;                              /* Reserved */
+    out[4] = (key_id >> 24) & 0xFF;
+    out[5] = (key_id >> 16) & 0xFF;
+    out[6] = (key_id >> 8) & 0xFF;
+    out[7] = key_id & 0xFF;
+
+    uint8_t *nonce = out + HEADER_LEN;
+    randombytes_buf(nonce, NONCE_LEN);
+
+    unsigned long long ciphertext_len;
+    int ret = crypto_aead_aes256gcm_encrypt_afternm(
+        out + HEADER_LEN + NONCE_LEN, &ciphertext_len,
+        in, len,
+        out, HEADER_LEN,  /* AAD is header */
+        NULL,
+        nonce, &entry->gcm
+    );
+    keystore_read_end();
+    if (ret != 0) {
+        return -1;
+    }
+    return (ssize_t)(len + OVERHEAD_STD);
+}
+
+static const paxe_udp_hooks_t g_udp_hooks = {
+    paxe_try_decrypt,
+    paxe_encrypt,
+    OVERHEAD_STD
+};
+
 /* ============================================================================
  * Lua Bindings
  * ============================================================================ */
 
 #include "lunet_lua.h"
+#include "buffer.h"
+#include "co.h"
+#include "trace.h"
 
 /* paxe.init() -> boolean, string|nil */
 static int l_paxe_init(lua_State *L) {
@@ -394,11 +791,87 @@ static int l_paxe_keystore_set(lua_State *L) {
         return 1;
     } else {
         lua_pushboolean(L, 0);
-        lua_pushstring(L, "keystore full");
+        lua_pushstring(L, "out of memory");
         return 2;
     }
 }
 
+/* paxe.keystore_set_many({[key_id] = key_string, ...}) -> boolean, string|nil
+ * Installs every key in a single keystore generation. */
+static int l_paxe_keystore_set_many(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    size_t n = 0;
+    lua_pushnil(L);
+    while (lua_next(L, 1) != 0) {
+        size_t key_len = 0;
+        if (!lua_isnumber(L, -2) || !lua_isstring(L, -1) ||
+            (lua_tolstring(L, -1, &key_len), key_len != 32)) {
+            lua_pop(L, 2);
+            lua_pushboolean(L, 0);
+            lua_pushstring(L, "expected {[key_id] = 32-byte key}");
+            return 2;
+        }
+        n++;
+        lua_pop(L, 1);
+    }
+    if (n == 0) {
+        lua_pushboolean(L, 1);
+        return 1;
+    }
+
+    uint32_t *ids = lunet_alloc(n * sizeof(uint32_t));
+    uint8_t (*keys)[32] = lunet_alloc(n * 32);
+    if (!ids || !keys) {
+        if (ids) lunet_free(ids);
+        if (keys) lunet_free(keys);
+        lua_pushboolean(L, 0);
+        lua_pushstring(L, "out of memory");
+        return 2;
+    }
+    size_t i = 0;
+    lua_pushnil(L);
+    while (lua_next(L, 1) != 0) {
+        ids[i] = (uint32_t)lua_tointeger(L, -2);
+        memcpy(keys[i], lua_tostring(L, -1), 32);
+        i++;
+        lua_pop(L, 1);
+    }
+
+    int ret = paxe_keystore_set_many(ids, (const uint8_t (*)[32])keys, n);
+    sodium_memzero(keys, n * 32);
+    lunet_free(keys);
+    lunet_free(ids);
+    if (ret != 0) {
+        lua_pushboolean(L, 0);
+        lua_pushstring(L, "out of memory");
+        return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+/* paxe.keystore_remove(key_id) -> boolean */
+static int l_paxe_keystore_remove(lua_State *L) {
+    lua_Integer key_id = luaL_checkinteger(L, 1);
+    lua_pushboolean(L, paxe_keystore_remove((uint32_t)key_id) == 0);
+    return 1;
+}
+
+/* paxe.keystore_reserve(capacity) -> boolean
+ * Size the keystore for at least capacity keys up front. */
+static int l_paxe_keystore_reserve(lua_State *L) {
+    lua_Integer capacity = luaL_checkinteger(L, 1);
+    if (capacity < 0) capacity = 0;
+    lua_pushboolean(L, paxe_keystore_reserve((size_t)capacity) == 0);
+    return 1;
+}
+
+/* paxe.keystore_count() -> integer */
+static int l_paxe_keystore_count(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)paxe_keystore_count());
+    return 1;
+}
+
 /* paxe.keystore_clear() */
 static int l_paxe_keystore_clear(lua_State *L) {
     (void)L;
@@ -458,13 +931,102 @@ static int l_paxe_stats(lua_State *L) {
     return 1;
 }
 
-/* paxe.try_decrypt(buffer_string) -> plaintext_string, key_id, flags | nil, error_string */
+/* paxe.stats_into(t) -> t
+ * Refreshes t in place for scrapers that poll: the same counters as
+ * paxe.stats() plus ts (seconds), rx_pps / ok_pps since the previous call
+ * with the same table, and t.latency[i] = decrypts that took
+ * [2^(i-1), 2^i) ns (the last bucket is open-ended). Nothing is allocated
+ * after the first call.
+ */
+static void stats_field(lua_State *L, const char *name, uint64_t value, double *prev) {
+    if (prev) {
+        lua_getfield(L, 1, name);
+        *prev = lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
+    lua_pushnumber(L, (lua_Number)value);
+    lua_setfield(L, 1, name);
+}
+
+static int l_paxe_stats_into(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    paxe_stats_snapshot_t snap;
+    paxe_stats_snapshot(&snap);
+
+    lua_getfield(L, 1, "ts");
+    double prev_ts = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    double now = (double)snap.timestamp_ns / 1e9;
+
+    double prev_total = 0, prev_ok = 0;
+    stats_field(L, "rx_total", snap.counters.rx_total, &prev_total);
+    stats_field(L, "rx_ok", snap.counters.rx_ok, &prev_ok);
+    stats_field(L, "rx_short", snap.counters.rx_short, NULL);
+    stats_field(L, "rx_len_mismatch", snap.counters.rx_len_mismatch, NULL);
+    stats_field(L, "rx_no_key", snap.counters.rx_no_key, NULL);
+    stats_field(L, "rx_auth_fail", snap.counters.rx_auth_fail, NULL);
+    stats_field(L, "rx_reserved_nonzero", snap.counters.rx_reserved_nonzero, NULL);
+
+    double dt = prev_ts > 0 ? now - prev_ts : 0;
+    lua_pushnumber(L, dt > 0 ? ((double)snap.counters.rx_total - prev_total) / dt : 0);
+    lua_setfield(L, 1, "rx_pps");
+    lua_pushnumber(L, dt > 0 ? ((double)snap.counters.rx_ok - prev_ok) / dt : 0);
+    lua_setfield(L, 1, "ok_pps");
+    lua_pushnumber(L, now);
+    lua_setfield(L, 1, "ts");
+
+    lua_getfield(L, 1, "latency");
+    if (!lua_istable(L, -1)) {
+        lua_pop(L, 1);
+        lua_createtable(L, PAXE_LAT_BUCKETS, 0);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, 1, "latency");
+    }
+    for (int b = 0; b < PAXE_LAT_BUCKETS; b++) {
+        lua_pushnumber(L, (lua_Number)snap.latency[b]);
+        lua_rawseti(L, -2, b + 1);
+    }
+    lua_pop(L, 1);
+
+    lua_settop(L, 1);
+    return 1;
+}
+
+/* Decrypt a lunet.buffer in place and push a view of its plaintext.
+ * On failure nothing is pushed and the bytes are undefined. */
+static ssize_t paxe_decrypt_view(lua_State *L, lunet_buffer_t *b, uint32_t *key_id,
+                                 uint8_t *flags) {
+    ssize_t n = paxe_try_decrypt((uint8_t *)b->data, b->len, key_id, flags);
+    if (n >= 0) {
+        b->store->refs++;
+        lunet_buffer_push(L, b->store, b->data, (size_t)n);
+    }
+    return n;
+}
+
+/* paxe.try_decrypt(packet) -> plaintext, key_id, flags | nil, error_string
+ * A string packet yields a string copy; a lunet.buffer is decrypted in place
+ * and the plaintext comes back as a view of the same bytes. */
 static int l_paxe_try_decrypt(lua_State *L) {
+    lunet_buffer_t *view = lunet_buffer_test(L, 1);
+    if (view) {
+        uint32_t key_id = 0;
+        uint8_t flags = 0;
+        if (paxe_decrypt_view(L, view, &key_id, &flags) < 0) {
+            lua_pushnil(L);
+            lua_pushstring(L, "decryption failed");
+            return 2;
+        }
+        lua_pushinteger(L, (lua_Integer)key_id);
+        lua_pushinteger(L, (lua_Integer)flags);
+        return 3;
+    }
+
     size_t len;
     const char *input = luaL_checklstring(L, 1, &len);
 
     /* Make a mutable copy since paxe_try_decrypt modifies in-place */
-    uint8_t *buf = lunet_alloc(len);
+    uint8_t *buf = scratch_reserve(len);
     if (!buf) {
         lua_pushnil(L);
         lua_pushstring(L, "out of memory");
@@ -477,38 +1039,137 @@ static int l_paxe_try_decrypt(lua_State *L) {
     ssize_t plaintext_len = paxe_try_decrypt(buf, len, &key_id, &flags);
 
     if (plaintext_len < 0) {
-        lunet_free_nonnull(buf);
         lua_pushnil(L);
         lua_pushstring(L, "decryption failed");
         return 2;
     }
 
     lua_pushlstring(L, (const char *)buf, (size_t)plaintext_len);
+    sodium_memzero(buf, len);
     lua_pushinteger(L, (lua_Integer)key_id);
     lua_pushinteger(L, (lua_Integer)flags);
-    lunet_free_nonnull(buf);
     return 3;
 }
 
-/* paxe.encrypt(plaintext, key_id) -> ciphertext | nil, error
- * Standard mode encryption for testing/demos
+/* paxe.decrypt_batch(msgs) -> ok_count, dropped_count
+ * msgs is an array of {data, ...} such as udp.recv_batch returns. Each
+ * entry that decrypts has data replaced by the plaintext and key_id stored
+ * at [4]; entries that fail are removed and the array is compacted.
+ * Buffer payloads ({buffers = true} sockets) are decrypted in place.
+ */
+static int l_paxe_decrypt_batch(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    int n = (int)lua_objlen(L, 1);
+    int w = 1;
+    int dropped = 0;
+
+    for (int i = 1; i <= n; i++) {
+        lua_rawgeti(L, 1, i);
+        if (!lua_istable(L, -1)) {
+            lua_pop(L, 1);
+            dropped++;
+            continue;
+        }
+
+        lua_rawgeti(L, -1, 1);
+        ssize_t plaintext_len = -1;
+        uint32_t key_id = 0;
+        lunet_buffer_t *view = lunet_buffer_test(L, -1);
+        if (view) {
+            plaintext_len = paxe_decrypt_view(L, view, &key_id, NULL);
+            if (plaintext_len >= 0) lua_replace(L, -2);
+        } else {
+            size_t len = 0;
+            const char *input = lua_tolstring(L, -1, &len);
+            uint8_t *buf = input ? scratch_reserve(len) : NULL;
+            if (buf) {
+                memcpy(buf, input, len);
+                plaintext_len = paxe_try_decrypt(buf, len, &key_id, NULL);
+            }
+            lua_pop(L, 1);
+            if (plaintext_len >= 0) lua_pushlstring(L, (const char *)buf, (size_t)plaintext_len);
+            if (buf) sodium_memzero(buf, len);
+        }
+
+        if (plaintext_len < 0) {
+            if (view) lua_pop(L, 1);
+            lua_pop(L, 1);
+            dropped++;
+            continue;
+        }
+
+        lua_rawseti(L, -2, 1);
+        lua_pushinteger(L, (lua_Integer)key_id);
+        lua_rawseti(L, -2, 4);
+        if (w != i) {
+            lua_rawseti(L, 1, w);
+        } else {
+            lua_pop(L, 1);
+        }
+        w++;
+    }
+
+    for (int i = w; i <= n; i++) {
+        lua_pushnil(L);
+        lua_rawseti(L, 1, i);
+    }
+
+    lua_pushinteger(L, w - 1);
+    lua_pushinteger(L, dropped);
+    return 2;
+}
+
+/* paxe.encrypt(plaintext, key_id [, out]) -> ciphertext | nil, error
+ * Standard mode encryption. plaintext is a string or lunet.buffer; with a
+ * lunet.buffer out (at least #plaintext + 36 bytes, not overlapping the
+ * plaintext) the packet is written there and returned as a view of out.
  */
 static int l_paxe_encrypt(lua_State *L) {
-    size_t plaintext_len;
-    const char *plaintext = luaL_checklstring(L, 1, &plaintext_len);
+    size_t plaintext_len = 0;
+    const char *plaintext = lunet_buffer_tobytes(L, 1, &plaintext_len);
+    if (!plaintext) luaL_typerror(L, 1, "string or lunet.buffer");
     lua_Integer key_id = luaL_checkinteger(L, 2);
+    lunet_buffer_t *out = NULL;
+    if (!lua_isnoneornil(L, 3)) {
+        out = lunet_buffer_test(L, 3);
+        if (!out) luaL_typerror(L, 3, LUNET_BUFFER_MT);
+    }
 
-    /* Get key from keystore */
-    const uint8_t *key = keystore_get((uint32_t)key_id);
-    if (!key) {
+    if (!paxe_keystore_has((uint32_t)key_id)) {
         lua_pushnil(L);
         lua_pushstring(L, "key not found");
         return 2;
     }
+    if (plaintext_len > 0xFFFF) {
+        lua_pushnil(L);
+        lua_pushstring(L, "plaintext too large");
+        return 2;
+    }
+
+    /* Output: Header(8) + Nonce(12) + Ciphertext + Tag(16) */
+    size_t total_len = plaintext_len + OVERHEAD_STD;
+    if (out) {
+        if (out->len < total_len) {
+            lua_pushnil(L);
+            lua_pushstring(L, "output buffer too small");
+            return 2;
+        }
+        if (out->data < plaintext + plaintext_len && plaintext < out->data + total_len) {
+            lua_pushnil(L);
+            lua_pushstring(L, "output buffer overlaps the plaintext");
+            return 2;
+        }
+        if (paxe_encrypt((uint32_t)key_id, (const uint8_t *)plaintext, plaintext_len,
+                         (uint8_t *)out->data, total_len) < 0) {
+            lua_pushnil(L);
+            lua_pushstring(L, "encryption failed");
+            return 2;
+        }
+        out->store->refs++;
+        lunet_buffer_push(L, out->store, out->data, total_len);
+        return 1;
+    }
 
-    /* Allocate output buffer: Header(8) + Nonce(12) + Ciphertext + Tag(16) */
-    size_t ciphertext_len = plaintext_len + TAG_LEN;
-    size_t total_len = HEADER_LEN + NONCE_LEN + ciphertext_len;
     uint8_t *buf = lunet_alloc(total_len);
     if (!buf) {
         lua_pushnil(L);
@@ -516,33 +1177,8 @@ static int l_paxe_encrypt(lua_State *L) {
         return 2;
     }
 
-    /* Build header */
-    buf[0] = (plaintext_len >> 8) & 0xFF;  /* Length high byte */
-    buf[1] = plaintext_len & 0xFF;          /* Length low byte */
-    buf[2] = 0;                              /* Flags (standard mode) */
-    buf[3] = 0;                              /* Reserved */
-    buf[4] = (key_id >> 24) & 0xFF;
-    buf[5] = (key_id >> 16) & 0xFF;
-    buf[6] = (key_id >> 8) & 0xFF;
-    buf[7] = key_id & 0xFF;
-
-    /* Generate random nonce */
-    uint8_t *nonce = buf + HEADER_LEN;
-    randombytes_buf(nonce, NONCE_LEN);
-
-    /* Encrypt */
-    uint8_t *ciphertext = buf + HEADER_LEN + NONCE_LEN;
-    unsigned long long actual_ciphertext_len;
-
-    int ret = crypto_aead_aes256gcm_encrypt(
-        ciphertext, &actual_ciphertext_len,
-        (const uint8_t *)plaintext, plaintext_len,
-        buf, HEADER_LEN,  /* AAD is header */
-        NULL,
-        nonce, key
-    );
-
-    if (ret != 0) {
+    if (paxe_encrypt((uint32_t)key_id, (const uint8_t *)plaintext, plaintext_len,
+                     buf, total_len) < 0) {
         lunet_free_nonnull(buf);
         lua_pushnil(L);
         lua_pushstring(L, "encryption failed");
@@ -554,6 +1190,273 @@ static int l_paxe_encrypt(lua_State *L) {
     return 1;
 }
 
+/* ============================================================================
+ * Thread-pool offload
+ *
+ * AES-GCM over a large payload would stall the event loop, so payloads at
+ * or above g_async_threshold are processed on the libuv thread pool while
+ * the caller's coroutine is suspended. An array of packets is split across
+ * up to PAXE_ASYNC_MAX_CHUNKS work requests that run in parallel. Work
+ * callbacks only touch C buffers and the (lock-free) keystore.
+ * ============================================================================ */
+
+#define PAXE_ASYNC_DEFAULT_THRESHOLD (16 * 1024)
+#define PAXE_ASYNC_MAX_CHUNKS 4
+
+static size_t g_async_threshold = PAXE_ASYNC_DEFAULT_THRESHOLD;
+
+typedef struct {
+    uint8_t *buf;       /* owned copy of the input, large enough for the output */
+    size_t len;
+    ssize_t result;     /* output length or -1 */
+    uint32_t key_id;
+    uint8_t flags;
+} paxe_async_item_t;
+
+typedef struct {
+    lua_State *L;
+    int co_ref;
+    int encrypt;        /* 0 = decrypt */
+    int is_array;       /* resume with an array instead of one result */
+    int pending;        /* outstanding work requests (loop thread only) */
+    int failed;         /* a request failed to queue */
+    uint32_t key_id;    /* encryption key */
+    size_t nitems;
+    paxe_async_item_t *items;
+} paxe_async_group_t;
+
+typedef struct {
+    uv_work_t req;
+    paxe_async_group_t *group;
+    size_t first;
+    size_t count;
+} paxe_async_job_t;
+
+static void paxe_async_item_run(paxe_async_group_t *g, paxe_async_item_t *it) {
+    if (g->encrypt) {
+        /* Encrypt out of place: the plaintext sits past the output area */
+        uint8_t *plain = it->buf + it->len + OVERHEAD_STD;
+        it->result = paxe_encrypt(g->key_id, plain, it->len, it->buf, it->len + OVERHEAD_STD);
+    } else {
+        it->result = paxe_try_decrypt(it->buf, it->len, &it->key_id, &it->flags);
+    }
+}
+
+static void paxe_async_group_free(paxe_async_group_t *g) {
+    for (size_t i = 0; i < g->nitems; i++) {
+        paxe_async_item_t *it = &g->items[i];
+        if (it->buf) {
+            size_t cap = g->encrypt ? it->len * 2 + OVERHEAD_STD : it->len;
+            sodium_memzero(it->buf, cap);
+            lunet_free(it->buf);
+        }
+    }
+    lunet_free(g->items);
+    lunet_free(g);
+}
+
+static void paxe_async_push_item(lua_State *co, paxe_async_item_t *it) {
+    if (it->result < 0) {
+        lua_pushboolean(co, 0);
+    } else {
+        lua_pushlstring(co, (const char *)it->buf, (size_t)it->result);
+    }
+}
+
+/* Push the results of a finished group onto co; returns the count pushed */
+static int paxe_async_push_results(lua_State *co, paxe_async_group_t *g) {
+    if (g->failed) {
+        lua_pushnil(co);
+        lua_pushstring(co, "failed to queue crypto work");
+        return 2;
+    }
+    if (g->is_array) {
+        lua_createtable(co, (int)g->nitems, 0);
+        for (size_t i = 0; i < g->nitems; i++) {
+            paxe_async_push_item(co, &g->items[i]);
+            lua_rawseti(co, -2, (int)i + 1);
+        }
+        lua_pushnil(co);
+        return 2;
+    }
+    paxe_async_item_t *it = &g->items[0];
+    if (it->result < 0) {
+        lua_pushnil(co);
+        lua_pushstring(co, g->encrypt ? "encryption failed" : "decryption failed");
+        return 2;
+    }
+    lua_pushlstring(co, (const char *)it->buf, (size_t)it->result);
+    if (g->encrypt) return 1;
+    lua_pushinteger(co, (lua_Integer)it->key_id);
+    lua_pushinteger(co, (lua_Integer)it->flags);
+    return 3;
+}
+
+static void paxe_async_work_cb(uv_work_t *req) {
+    paxe_async_job_t *job = (paxe_async_job_t *)req->data;
+    for (size_t i = job->first; i < job->first + job->count; i++) {
+        paxe_async_item_run(job->group, &job->group->items[i]);
+    }
+}
+
+static void paxe_async_after_cb(uv_work_t *req, int status) {
+    (void)status;
+    paxe_async_job_t *job = (paxe_async_job_t *)req->data;
+    paxe_async_group_t *g = job->group;
+    lunet_free(job);
+    if (--g->pending > 0) return;
+
+    lua_State *L = g->L;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, g->co_ref);
+    lunet_coref_release(L, g->co_ref);
+    if (!lua_isthread(L, -1)) {
+        lua_pop(L, 1);
+        fprintf(stderr, "invalid coroutine in paxe async\n");
+        paxe_async_group_free(g);
+        return;
+    }
+    lua_State *co = lua_tothread(L, -1);
+    lua_pop(L, 1);
+
+    int nret = paxe_async_push_results(co, g);
+    paxe_async_group_free(g);
+    int rc = lunet_co_resume(co, nret);
+    if (rc != 0 && rc != LUA_YIELD) {
+        const char *err = lua_tostring(co, -1);
+        if (err) fprintf(stderr, "lua_resume error in paxe async: %s\n", err);
+        lua_pop(co, 1);
+    }
+}
+
+/* Copy the string at idx into a new item buffer */
+static int paxe_async_item_load(lua_State *L, int idx, int encrypt, paxe_async_item_t *it) {
+    size_t len = 0;
+    const char *data = lua_tolstring(L, idx, &len);
+    if (!data) return -1;
+    /* Encryption keeps the plaintext after a ciphertext-sized area */
+    size_t cap = encrypt ? len * 2 + OVERHEAD_STD : len;
+    it->buf = lunet_alloc(cap ? cap : 1);
+    if (!it->buf) return -1;
+    memcpy(encrypt ? it->buf + len + OVERHEAD_STD : it->buf, data, len);
+    it->len = len;
+    it->result = -1;
+    return 0;
+}
+
+/* Common body of decrypt_async / encrypt_async; input is at index 1 */
+static int paxe_async_start(lua_State *L, int encrypt, uint32_t key_id) {
+    int is_array = lua_istable(L, 1);
+    size_t n = is_array ? lua_objlen(L, 1) : 1;
+    if (!is_array) luaL_checkstring(L, 1);
+
+    paxe_async_group_t *g = lunet_calloc(1, sizeof(*g));
+    paxe_async_item_t *items = n ? lunet_calloc(n, sizeof(*items)) : NULL;
+    if (!g || (n && !items)) {
+        if (g) lunet_free(g);
+        if (items) lunet_free(items);
+        lua_pushnil(L);
+        lua_pushstring(L, "out of memory");
+        return 2;
+    }
+    g->L = L;
+    g->encrypt = encrypt;
+    g->is_array = is_array;
+    g->key_id = key_id;
+    g->nitems = n;
+    g->items = items;
+
+    size_t total = 0;
+    for (size_t i = 0; i < n; i++) {
+        int ok;
+        if (is_array) {
+            lua_rawgeti(L, 1, (int)i + 1);
+            ok = paxe_async_item_load(L, -1, encrypt, &items[i]);
+            lua_pop(L, 1);
+        } else {
+            ok = paxe_async_item_load(L, 1, encrypt, &items[i]);
+        }
+        if (ok != 0) {
+            paxe_async_group_free(g);
+            lua_pushnil(L);
+            lua_pushstring(L, is_array ? "expected an array of strings" : "out of memory");
+            return 2;
+        }
+        total += items[i].len;
+    }
+
+    /* Small work stays on the loop thread */
+    if (total < g_async_threshold) {
+        for (size_t i = 0; i < n; i++) paxe_async_item_run(g, &items[i]);
+        int nret = paxe_async_push_results(L, g);
+        paxe_async_group_free(g);
+        return nret;
+    }
+
+    size_t chunks = n < PAXE_ASYNC_MAX_CHUNKS ? n : PAXE_ASYNC_MAX_CHUNKS;
+    size_t per = (n + chunks - 1) / chunks;
+    lunet_coref_create(L, g->co_ref);
+    for (size_t first = 0; first < n; first += per) {
+        paxe_async_job_t *job = lunet_alloc(sizeof(*job));
+        if (!job) {
+            g->failed = 1;
+            break;
+        }
+        job->req.data = job;
+        job->group = g;
+        job->first = first;
+        job->count = (n - first) < per ? (n - first) : per;
+        if (lunet_exec_queue(LUNET_EXEC_CPU, &job->req, paxe_async_work_cb,
+                          paxe_async_after_cb) < 0) {
+            lunet_free(job);
+            g->failed = 1;
+            break;
+        }
+        g->pending++;
+    }
+
+    if (g->pending == 0) {
+        lunet_coref_release(L, g->co_ref);
+        paxe_async_group_free(g);
+        lua_pushnil(L);
+        lua_pushstring(L, "failed to queue crypto work");
+        return 2;
+    }
+    return lua_yield(L, 0);
+}
+
+/* paxe.decrypt_async(packet | {packet, ...})
+ *   -> plaintext, key_id, flags | nil, error
+ *   -> {plaintext|false, ...}, nil  (array input)
+ * Yields while large payloads are decrypted on the thread pool.
+ */
+static int l_paxe_decrypt_async(lua_State *L) {
+    if (lunet_ensure_coroutine(L, "paxe.decrypt_async")) {
+        return lua_error(L);
+    }
+    return paxe_async_start(L, 0, 0);
+}
+
+/* paxe.encrypt_async(plaintext | {plaintext, ...}, key_id)
+ *   -> ciphertext | nil, error
+ *   -> {ciphertext|false, ...}, nil  (array input)
+ */
+static int l_paxe_encrypt_async(lua_State *L) {
+    if (lunet_ensure_coroutine(L, "paxe.encrypt_async")) {
+        return lua_error(L);
+    }
+    lua_Integer key_id = luaL_checkinteger(L, 2);
+    return paxe_async_start(L, 1, (uint32_t)key_id);
+}
+
+/* paxe.set_async_threshold(bytes) -> previous
+ * Total input size from which *_async calls leave the loop thread. */
+static int l_paxe_set_async_threshold(lua_State *L) {
+    lua_Integer bytes = luaL_checkinteger(L, 1);
+    lua_pushinteger(L, (lua_Integer)g_async_threshold);
+    g_async_threshold = bytes < 0 ? 0 : (size_t)bytes;
+    return 1;
+}
+
 /* Module function table */
 static const luaL_Reg paxe_funcs[] = {
     {"init", l_paxe_init},
@@ -562,10 +1465,19 @@ static const luaL_Reg paxe_funcs[] = {
     {"set_enabled", l_paxe_set_enabled},
     {"keystore_set", l_paxe_keystore_set},
     {"keystore_clear", l_paxe_keystore_clear},
+    {"keystore_set_many", l_paxe_keystore_set_many},
+    {"keystore_remove", l_paxe_keystore_remove},
+    {"keystore_reserve", l_paxe_keystore_reserve},
+    {"keystore_count", l_paxe_keystore_count},
     {"set_fail_policy", l_paxe_set_fail_policy},
     {"stats", l_paxe_stats},
+    {"stats_into", l_paxe_stats_into},
     {"try_decrypt", l_paxe_try_decrypt},
+    {"decrypt_batch", l_paxe_decrypt_batch},
     {"encrypt", l_paxe_encrypt},
+    {"decrypt_async", l_paxe_decrypt_async},
+    {"encrypt_async", l_paxe_encrypt_async},
+    {"set_async_threshold", l_paxe_set_async_threshold},
     {NULL, NULL}
 };
 
@@ -573,6 +1485,22 @@ static const luaL_Reg paxe_funcs[] = {
 int lunet_open_paxe(lua_State *L) {
     luaL_register(L, NULL, paxe_funcs);
 
+    /* Let udp.bind(..., {paxe = true}) reach this library */
+    lua_pushlightuserdata(L, (void *)&g_udp_hooks);
+    lua_setfield(L, LUA_REGISTRYINDEX, PAXE_UDP_HOOKS_KEY);
+
+    /* Frees this thread's decrypt scratch when the state closes */
+    lua_getfield(L, LUA_REGISTRYINDEX, PAXE_SCRATCH_KEY);
+    if (lua_isnil(L, -1)) {
+        lua_newuserdata(L, 1);
+        lua_createtable(L, 0, 1);
+        lua_pushcfunction(L, scratch_gc);
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+        lua_setfield(L, LUA_REGISTRYINDEX, PAXE_SCRATCH_KEY);
+    }
+    lua_pop(L, 1);
+
     /* Add constants */
     lua_pushinteger(L, OVERHEAD_STD);
     lua_setfield(L, -2, "OVERHEAD_STANDARD");
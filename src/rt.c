@@ -1,7 +1,41 @@
 #include "rt.h"
 
-static lua_State *g_luaL = NULL;
+static LUNET_THREAD_LOCAL lua_State *g_luaL = NULL;
+static LUNET_THREAD_LOCAL uv_loop_t *g_loop = NULL;
+static LUNET_THREAD_LOCAL int g_worker_id = 0;
 
 void set_default_luaL(lua_State *L) { g_luaL = L; }
 
-lua_State *default_luaL(void) { return g_luaL; }
\ No newline at end of file
+lua_State *default_luaL(void) { return g_luaL; }
+
+void lunet_rt_set_loop(uv_loop_t *loop) { g_loop = loop; }
+
+uv_loop_t *lunet_loop(void) { return g_loop ? g_loop : uv_default_loop(); }
+
+void lunet_rt_set_worker_id(int id) { g_worker_id = id; }
+
+int lunet_worker_id(void) { return g_worker_id; }
+
+#define LUNET_RT_LOOP_KEY "lunet.rt.loop"
+#define LUNET_RT_WORKER_KEY "lunet.rt.worker_id"
+
+void lunet_rt_publish(lua_State *L) {
+  lua_pushlightuserdata(L, lunet_loop());
+  lua_setfield(L, LUA_REGISTRYINDEX, LUNET_RT_LOOP_KEY);
+  lua_pushinteger(L, g_worker_id);
+  lua_setfield(L, LUA_REGISTRYINDEX, LUNET_RT_WORKER_KEY);
+}
+
+void lunet_rt_bind(lua_State *L) {
+  set_default_luaL(L);
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_RT_LOOP_KEY);
+  if (lua_islightuserdata(L, -1)) {
+    g_loop = (uv_loop_t *)lua_touserdata(L, -1);
+  }
+  lua_pop(L, 1);
+  lua_getfield(L, LUA_REGISTRYINDEX, LUNET_RT_WORKER_KEY);
+  if (lua_isnumber(L, -1)) {
+    g_worker_id = (int)lua_tointeger(L, -1);
+  }
+  lua_pop(L, 1);
+}
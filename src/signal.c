@@ -8,6 +8,7 @@
 #include "co.h"
 #include "trace.h"
 #include "lunet_mem.h"
+#include "rt.h"
 
 /*
  * Signal domain tracing
@@ -128,7 +129,7 @@ int lunet_signal_wait(lua_State *L) {
   ctx->L = L;
   lunet_coref_create(L, ctx->co_ref);
 
-  uv_signal_init(uv_default_loop(), &ctx->handle);
+  uv_signal_init(lunet_loop(), &ctx->handle);
   ctx->handle.data = ctx;
   uv_signal_start(&ctx->handle, lunet_signal_cb, signo);
 
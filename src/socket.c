@@ -6,23 +6,59 @@
 #else
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
-#include <unistd.h> // for unlink
+#include <errno.h>
+#include <unistd.h> // for unlink, dup, close
 #endif
 
+#include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <uv.h>
 
+#include "buffer.h"
 #include "co.h"
 #include "rt.h"
 #include "stl.h"
+#include "timer.h"
 #include "trace.h"
 #include "lunet_mem.h"
+#include "metrics.h"
 #include "runtime.h"
 
-static size_t read_buffer_size = 4096;
+/* Per worker, like the rest of the loop state: each worker's script sets its own */
+static LUNET_THREAD_LOCAL size_t read_buffer_size = 4096;
+
+/*
+ * Read buffer pool.
+ *
+ * Every read used to pay a lunet_alloc in alloc_buffer and a lunet_free in
+ * lunet_read_cb. Each loop is single-threaded, so keep (per worker thread) a
+ * handful of size classes (one per size handed to set_read_buffer_size) with
+ * an intrusive free list threaded through the idle buffers themselves.
+ */
+#define READ_POOL_CLASSES 4
+#define READ_POOL_MAX_FREE 64
+
+typedef struct read_pool_node {
+  struct read_pool_node *next;
+} read_pool_node_t;
+
+typedef struct {
+  size_t size;
+  read_pool_node_t *free_list;
+  int free_count;
+} read_pool_class_t;
+
+static LUNET_THREAD_LOCAL read_pool_class_t read_pool[READ_POOL_CLASSES];
+static LUNET_THREAD_LOCAL int read_pool_evict_next = 0;
+/* For socket.read_pool_stats(); evictions counts size classes recycled */
+static LUNET_THREAD_LOCAL uint64_t read_pool_hits = 0;
+static LUNET_THREAD_LOCAL uint64_t read_pool_misses = 0;
+static LUNET_THREAD_LOCAL uint64_t read_pool_evictions = 0;
 
 static int is_loopback_address(const char *host) {
   return strcmp(host, "127.0.0.1") == 0 ||
@@ -30,6 +66,47 @@ static int is_loopback_address(const char *host) {
          strcmp(host, "localhost") == 0;
 }
 
+#define RX_MAX_DELIM 32
+
+typedef enum {
+  RX_WANT_ANY,
+  RX_WANT_UNTIL,
+  RX_WANT_EXACT
+} rx_want_t;
+
+/* Inbound buffer for streaming reads (socket.read_stream) */
+typedef struct {
+  char *data;
+  size_t cap;
+  size_t base_cap; /* size set by read_stream; frames above it grow the buffer temporarily */
+  size_t start;   /* first unread byte */
+  size_t end;     /* one past the last buffered byte */
+  int paused;     /* uv_read_stop'd because the buffer is full (or EOF/error) */
+  int eof;
+  int status;     /* sticky read error */
+  /* What the waiting reader asked for (socket.read / read_until / read_exact) */
+  int want;
+  size_t want_n;  /* read_exact: frame size, read_until: max bytes */
+  char delim[RX_MAX_DELIM];
+  size_t delim_len;
+  size_t scanned; /* read_until: bytes after start known not to hold delim */
+} socket_rx_t;
+
+#define RX_DEFAULT_CAPACITY (64 * 1024)
+#define RX_MIN_CAPACITY 1024
+
+/*
+ * Outbound chunk: a Lua string pinned in the registry so its bytes can be
+ * handed to libuv without copying.
+ */
+typedef struct {
+  const char *base;
+  size_t len;
+  int ref;
+} write_chunk_t;
+
+typedef struct sendfile_req sendfile_req_t;
+
 typedef enum {
   SOCKET_DOMAIN_TCP,
   SOCKET_DOMAIN_UNIX
@@ -40,6 +117,23 @@ typedef enum {
   SOCKET_CLIENT,
 } socket_type_t;
 
+/*
+ * TCP tuning from socket.listen / socket.connect / socket.setopt. -1 leaves
+ * the OS default alone.
+ */
+typedef struct {
+  int nodelay;
+  int keepalive;  /* 0 off, else idle seconds before the first probe */
+  int sndbuf;
+  int rcvbuf;
+  int fastopen;   /* listener: pending TFO queue length; client: 0/1 */
+  int backlog;    /* listener only */
+} socket_opts_t;
+
+#define SOCKET_DEFAULT_BACKLOG 128
+#define SOCKET_KEEPALIVE_DEFAULT_DELAY 60
+#define SOCKET_FASTOPEN_DEFAULT_QLEN 256
+
 /* Canary value for socket contexts - ASCII "SOCK" */
 #define SOCKET_CTX_CANARY 0x534F434BU
 /* Tail canary to detect writes past libuv handle memory - ASCII "UVTL" */
@@ -70,10 +164,32 @@ typedef struct {
     struct {
       int accept_ref;
       queue_t *pending_accepts;
+      int accept_max;         /* >0 when the waiter came from accept_many */
+      lunet_timer_t accept_deadline;
+      socket_opts_t accept_opts; /* applied to every accepted connection */
     } server;
     struct {
       int read_ref;
-      int write_ref;
+      int write_ref;          /* writer blocked on the high-water mark */
+      int write_mark;         /* wq index of that writer's first chunk, -1 once handed to libuv */
+      write_chunk_t *wq;      /* queued, not yet handed to libuv */
+      int wq_len;
+      int wq_cap;
+      size_t wq_bytes;
+      size_t inflight_bytes;
+      int write_inflight;
+      int write_status;       /* sticky error from a failed write */
+      int close_after_flush;
+      socket_rx_t *rx;        /* non-NULL once socket.read_stream is on */
+      sendfile_req_t *sendfile; /* socket.sendfile running or waiting for the queue */
+      lunet_timer_t read_deadline;   /* armed while a read with a timeout waits */
+      lunet_timer_t write_deadline;  /* armed while a writer with a timeout waits */
+      uint64_t read_wait_ns;  /* when the parked reader started waiting */
+      uint64_t write_wait_ns;
+      lunet_timer_t close_deadline;  /* bounds the drain after socket.close */
+      char *into_base;        /* socket.read_into: caller's buffer, read in place */
+      size_t into_len;
+      int into_ref;           /* pins that buffer while the read waits */
     } client;
   };
 
@@ -95,13 +211,31 @@ typedef struct {
 
 } socket_ctx_t;
 
-// write request structure
+// write request structure: owns the batch of chunks handed to one uv_write
 typedef struct {
   uv_write_t req;
   socket_ctx_t *ctx;
-  char *data;
+  write_chunk_t *chunks;
+  int nchunks;
+  size_t nbytes;
 } write_req_t;
 
+/* Chunk count up to which a flush keeps its uv_buf_t[] on the C stack */
+#define WRITE_STACK_BUFS 16
+
+/*
+ * Bytes (queued + in flight) a socket may hold before writers block.
+ * 0 makes every write wait for its own completion. Per worker thread.
+ */
+static LUNET_THREAD_LOCAL size_t write_high_water = 64 * 1024;
+
+/*
+ * How long socket.close waits for queued writes (and a running sendfile) to
+ * drain before it drops them and closes anyway. 0 waits for as long as the
+ * peer takes. Per worker thread.
+ */
+static LUNET_THREAD_LOCAL uint64_t close_drain_ms = 30 * 1000;
+
 /*
  * Socket domain tracing
  * Tier 1 (LUNET_TRACE): counters + canary checks
@@ -115,6 +249,8 @@ static int socket_trace_connect_count = 0;
 static int socket_trace_read_count = 0;
 static int socket_trace_write_count = 0;
 static int socket_trace_close_count = 0;
+static int socket_trace_pool_hit_count = 0;
+static int socket_trace_pool_miss_count = 0;
 
 static void socket_ctx_init_canary(socket_ctx_t *ctx) {
     ctx->canary = SOCKET_CTX_CANARY;
@@ -291,6 +427,15 @@ static void socket_bk_cancel(socket_ctx_t *ctx, const char *op) {
 #define SOCKET_TRACE_FREE(ctx) \
     fprintf(stderr, "[SOCKET_TRACE] FREE ctx=%p\n", (void*)(ctx))
 
+#define SOCKET_TRACE_POOL_HIT() \
+    do { socket_trace_pool_hit_count++; } while(0)
+
+#define SOCKET_TRACE_POOL_MISS(size) \
+    do { socket_trace_pool_miss_count++; \
+         fprintf(stderr, "[SOCKET_TRACE] READ_POOL_MISS #%d size=%zu\n", \
+                 socket_trace_pool_miss_count, (size_t)(size)); \
+    } while(0)
+
 #define SOCKET_TRACE_REF(ctx, op) ((void)0)
 #define SOCKET_BK_WAIT(ctx, op) socket_bk_wait((ctx), (op))
 #define SOCKET_BK_RESUME(ctx, op) socket_bk_resume((ctx), (op))
@@ -320,6 +465,13 @@ static void socket_bk_cancel(socket_ctx_t *ctx, const char *op) {
     do { socket_trace_close_count++; } while(0)
 
 #define SOCKET_TRACE_FREE(ctx) ((void)0)
+
+#define SOCKET_TRACE_POOL_HIT() \
+    do { socket_trace_pool_hit_count++; } while(0)
+
+#define SOCKET_TRACE_POOL_MISS(size) \
+    do { socket_trace_pool_miss_count++; } while(0)
+
 #define SOCKET_TRACE_REF(ctx, op) ((void)0)
 #define SOCKET_BK_WAIT(ctx, op) socket_bk_wait((ctx), (op))
 #define SOCKET_BK_RESUME(ctx, op) socket_bk_resume((ctx), (op))
@@ -333,6 +485,8 @@ void lunet_socket_trace_summary(void) {
             socket_trace_listen_count, socket_trace_accept_count,
             socket_trace_connect_count, socket_trace_read_count,
             socket_trace_write_count, socket_trace_close_count);
+    fprintf(stderr, "[SOCKET_TRACE] READ_POOL: hit=%d miss=%d\n",
+            socket_trace_pool_hit_count, socket_trace_pool_miss_count);
 }
 
 #else /* !LUNET_TRACE */
@@ -347,6 +501,8 @@ void lunet_socket_trace_summary(void) {
 #define SOCKET_TRACE_WRITE_CB(ctx, status) ((void)0)
 #define SOCKET_TRACE_CLOSE(ctx) ((void)0)
 #define SOCKET_TRACE_FREE(ctx) ((void)0)
+#define SOCKET_TRACE_POOL_HIT() ((void)0)
+#define SOCKET_TRACE_POOL_MISS(size) ((void)0)
 #define SOCKET_TRACE_REF(ctx, op) ((void)0)
 #define SOCKET_BK_WAIT(ctx, op) ((void)0)
 #define SOCKET_BK_RESUME(ctx, op) ((void)0)
@@ -356,6 +512,320 @@ void lunet_socket_trace_summary(void) {
 
 #endif /* LUNET_TRACE */
 
+static void read_pool_class_drain(read_pool_class_t *cls) {
+  while (cls->free_list) {
+    read_pool_node_t *node = cls->free_list;
+    cls->free_list = node->next;
+    lunet_free_nonnull(node);
+  }
+  cls->free_count = 0;
+  cls->size = 0;
+}
+
+static read_pool_class_t *read_pool_class_for(size_t size, int create) {
+  if (size < sizeof(read_pool_node_t)) return NULL;
+  read_pool_class_t *empty = NULL;
+  for (int i = 0; i < READ_POOL_CLASSES; i++) {
+    if (read_pool[i].size == size) return &read_pool[i];
+    if (!empty && read_pool[i].size == 0) empty = &read_pool[i];
+  }
+  if (!create) return NULL;
+  if (!empty) {
+    /* All classes taken by earlier sizes: recycle one round-robin. */
+    empty = &read_pool[read_pool_evict_next];
+    read_pool_evict_next = (read_pool_evict_next + 1) % READ_POOL_CLASSES;
+    read_pool_class_drain(empty);
+    read_pool_evictions++;
+  }
+  empty->size = size;
+  return empty;
+}
+
+static char *read_pool_get(size_t size) {
+  read_pool_class_t *cls = read_pool_class_for(size, 1);
+  if (cls && cls->free_list) {
+    read_pool_node_t *node = cls->free_list;
+    cls->free_list = node->next;
+    cls->free_count--;
+    read_pool_hits++;
+    SOCKET_TRACE_POOL_HIT();
+    return (char *)node;
+  }
+  read_pool_misses++;
+  SOCKET_TRACE_POOL_MISS(size);
+  return lunet_alloc(size);
+}
+
+static void read_pool_put(const uv_buf_t *buf) {
+  if (!buf || !buf->base) return;
+  read_pool_class_t *cls = read_pool_class_for(buf->len, 0);
+  if (!cls || cls->free_count >= READ_POOL_MAX_FREE) {
+    lunet_free_nonnull(buf->base);  /* must match lunet_alloc backend (libc or EasyMem) */
+    return;
+  }
+  read_pool_node_t *node = (read_pool_node_t *)buf->base;
+  node->next = cls->free_list;
+  cls->free_list = node;
+  cls->free_count++;
+}
+
+void lunet_socket_pool_shutdown(void) {
+  for (int i = 0; i < READ_POOL_CLASSES; i++) {
+    read_pool_class_drain(&read_pool[i]);
+  }
+  read_pool_evict_next = 0;
+}
+
+static void write_chunks_release(lua_State *L, write_chunk_t *chunks, int nchunks) {
+  if (!chunks) return;
+  if (L) {
+    for (int i = 0; i < nchunks; i++) {
+      lunet_coref_release(L, chunks[i].ref);
+    }
+  }
+  lunet_free_nonnull(chunks);
+}
+
+/*
+ * Operation deadlines. A timeout argument arms a timer-wheel entry embedded
+ * in the ctx; on expiry the waiter is resumed with "timeout" and the socket
+ * stays usable. Completions stop the entry, and the expiry callbacks ignore
+ * a waiter that is already gone.
+ */
+static void socket_read_timeout_cb(lunet_timer_t *timer);
+static void socket_write_timeout_cb(lunet_timer_t *timer);
+static void socket_accept_timeout_cb(lunet_timer_t *timer);
+static void socket_close_timeout_cb(lunet_timer_t *timer);
+
+/* Longest timeout honoured (~142k years); keeps now + timeout far from wrapping */
+#define SOCKET_TIMEOUT_MAX_MS ((uint64_t)1 << 52)
+
+/*
+ * Optional timeout in ms at idx; nil, a non-number, 0, negative or NaN means
+ * wait forever and larger values clamp to SOCKET_TIMEOUT_MAX_MS. Never
+ * raises; callers still read it before any side effect.
+ */
+static uint64_t socket_timeout_arg(lua_State *L, int idx) {
+  lua_Number ms = lua_isnumber(L, idx) ? lua_tonumber(L, idx) : 0;
+  if (!(ms > 0)) return 0;
+  if (ms >= (lua_Number)SOCKET_TIMEOUT_MAX_MS) return SOCKET_TIMEOUT_MAX_MS;
+  return (uint64_t)ms;
+}
+
+static void socket_deadline_arm(lunet_timer_t *timer, uint64_t timeout_ms) {
+  if (timeout_ms > 0) {
+    lunet_timer_start(timer, timeout_ms);
+  } else {
+    lunet_timer_stop(timer);
+  }
+}
+
+static void socket_resume_timeout(lua_State *L, int ref, int nret, const char *where) {
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+  lunet_coref_release(L, ref);
+  if (!lua_isthread(L, -1)) {
+    lua_pop(L, 1);
+    return;
+  }
+  lua_State *waiting_co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  if (nret == 2) lua_pushnil(waiting_co);
+  lua_pushstring(waiting_co, "timeout");
+  int resume_status = lunet_co_resume(waiting_co, nret);
+  if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
+    const char *err = lua_tostring(waiting_co, -1);
+    if (err) {
+      fprintf(stderr, "[lunet] resume error in %s: %s\n", where, err);
+    }
+  }
+}
+
+/* Resume a timed-out writer whose bytes are already on their way */
+static void write_resume_pending(lua_State *L, int ref) {
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+  lunet_coref_release(L, ref);
+  if (!lua_isthread(L, -1)) {
+    lua_pop(L, 1);
+    return;
+  }
+  lua_State *waiting_co = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  lua_pushstring(waiting_co, "write pending");
+  int resume_status = lunet_co_resume(waiting_co, 1);
+  if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
+    const char *err = lua_tostring(waiting_co, -1);
+    if (err) {
+      fprintf(stderr, "[lunet] resume error in write timeout: %s\n", err);
+    }
+  }
+}
+
+static void socket_client_init_io(socket_ctx_t *ctx) {
+  ctx->client.wq = NULL;
+  ctx->client.wq_len = 0;
+  ctx->client.wq_cap = 0;
+  ctx->client.wq_bytes = 0;
+  ctx->client.inflight_bytes = 0;
+  ctx->client.write_inflight = 0;
+  ctx->client.write_status = 0;
+  ctx->client.write_mark = -1;
+  ctx->client.close_after_flush = 0;
+  ctx->client.rx = NULL;
+  ctx->client.sendfile = NULL;
+  ctx->client.into_base = NULL;
+  ctx->client.into_len = 0;
+  ctx->client.into_ref = LUA_NOREF;
+  lunet_timer_init(&ctx->client.read_deadline, socket_read_timeout_cb, ctx);
+  lunet_timer_init(&ctx->client.write_deadline, socket_write_timeout_cb, ctx);
+  lunet_timer_init(&ctx->client.close_deadline, socket_close_timeout_cb, ctx);
+}
+
+/* The read_into target is no longer needed: unpin it */
+static void socket_into_clear(socket_ctx_t *ctx) {
+  if (ctx->client.into_ref != LUA_NOREF) {
+    lunet_coref_release(ctx->co, ctx->client.into_ref);
+    ctx->client.into_ref = LUA_NOREF;
+  }
+  ctx->client.into_base = NULL;
+  ctx->client.into_len = 0;
+}
+
+static void socket_opts_init(socket_opts_t *opts) {
+  opts->nodelay = -1;
+  opts->keepalive = -1;
+  opts->sndbuf = -1;
+  opts->rcvbuf = -1;
+  opts->fastopen = -1;
+  opts->backlog = -1;
+}
+
+/* Positive integer field; a boolean true maps to dflt. NULL on success. */
+static const char *socket_opt_int(lua_State *L, int idx, const char *name, int dflt, int *out) {
+  lua_getfield(L, idx, name);
+  const char *err = NULL;
+  if (lua_isboolean(L, -1) && dflt >= 0) {
+    *out = lua_toboolean(L, -1) ? dflt : 0;
+  } else if (lua_isnumber(L, -1)) {
+    lua_Number v = lua_tonumber(L, -1);
+    if (v >= (dflt >= 0 ? 0 : 1) && v <= INT_MAX) {
+      *out = (int)v;
+    } else {
+      err = name;
+    }
+  } else if (!lua_isnil(L, -1)) {
+    err = name;
+  }
+  lua_pop(L, 1);
+  return err;
+}
+
+/*
+ * Read the tuning fields of the options table at idx into opts (fields that
+ * are absent keep their value). Returns the name of a bad field, or NULL.
+ */
+static const char *socket_opts_parse(lua_State *L, int idx, socket_opts_t *opts) {
+  const char *bad;
+  lua_getfield(L, idx, "nodelay");
+  if (lua_isboolean(L, -1)) {
+    opts->nodelay = lua_toboolean(L, -1);
+  } else if (!lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    return "nodelay";
+  }
+  lua_pop(L, 1);
+  if ((bad = socket_opt_int(L, idx, "keepalive", SOCKET_KEEPALIVE_DEFAULT_DELAY, &opts->keepalive)) ||
+      (bad = socket_opt_int(L, idx, "sndbuf", -1, &opts->sndbuf)) ||
+      (bad = socket_opt_int(L, idx, "rcvbuf", -1, &opts->rcvbuf)) ||
+      (bad = socket_opt_int(L, idx, "fastopen", SOCKET_FASTOPEN_DEFAULT_QLEN, &opts->fastopen)) ||
+      (bad = socket_opt_int(L, idx, "backlog", -1, &opts->backlog))) {
+    return bad;
+  }
+  return NULL;
+}
+
+static int socket_opts_tcp_only(const socket_opts_t *opts) {
+  return opts->nodelay >= 0 || opts->keepalive >= 0 || opts->sndbuf > 0 ||
+         opts->rcvbuf > 0 || opts->fastopen >= 0;
+}
+
+/*
+ * TCP Fast Open: a listener takes a queue length (TCP_FASTOPEN, after bind),
+ * a client opts in before connect (TCP_FASTOPEN_CONNECT, Linux 4.11+) so its
+ * first write rides on the SYN.
+ */
+static int socket_fastopen_apply(socket_ctx_t *ctx, int value) {
+#ifndef _WIN32
+  uv_os_fd_t fd;
+  int ret = uv_fileno(&ctx->u.handle, &fd);
+  if (ret < 0) return ret;
+  if (ctx->type == SOCKET_SERVER) {
+#ifdef TCP_FASTOPEN
+    if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &value, sizeof(value)) != 0) {
+      return uv_translate_sys_error(errno);
+    }
+    return 0;
+#endif
+  } else {
+#ifdef TCP_FASTOPEN_CONNECT
+    int on = 1;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on)) != 0) {
+      return uv_translate_sys_error(errno);
+    }
+    return 0;
+#endif
+  }
+#endif
+  (void)ctx;
+  (void)value;
+  return UV_ENOTSUP;
+}
+
+/*
+ * Settings on a TCP handle. Buffer sizes and fastopen need the fd, so a
+ * connecting handle must come from uv_tcp_init_ex. On failure *what names the
+ * option.
+ */
+static int socket_opts_apply(socket_ctx_t *ctx, const socket_opts_t *opts, const char **what) {
+  int ret = 0;
+  if (opts->nodelay >= 0 && (ret = uv_tcp_nodelay(&ctx->u.tcp, opts->nodelay)) < 0) {
+    *what = "nodelay";
+    return ret;
+  }
+  if (opts->keepalive >= 0 &&
+      (ret = uv_tcp_keepalive(&ctx->u.tcp, opts->keepalive > 0, (unsigned int)opts->keepalive)) < 0) {
+    *what = "keepalive";
+    return ret;
+  }
+  if (opts->sndbuf > 0) {
+    int value = opts->sndbuf;
+    if ((ret = uv_send_buffer_size(&ctx->u.handle, &value)) < 0) {
+      *what = "sndbuf";
+      return ret;
+    }
+  }
+  if (opts->rcvbuf > 0) {
+    int value = opts->rcvbuf;
+    if ((ret = uv_recv_buffer_size(&ctx->u.handle, &value)) < 0) {
+      *what = "rcvbuf";
+      return ret;
+    }
+  }
+  if (opts->fastopen > 0 && (ret = socket_fastopen_apply(ctx, opts->fastopen)) < 0) {
+    *what = "fastopen";
+    return ret;
+  }
+  return 0;
+}
+
+/* Drop everything still queued (error or teardown) */
+static void write_queue_discard(socket_ctx_t *ctx) {
+  write_chunks_release(ctx->co, ctx->client.wq, ctx->client.wq_len);
+  ctx->client.wq = NULL;
+  ctx->client.wq_len = 0;
+  ctx->client.wq_cap = 0;
+  ctx->client.wq_bytes = 0;
+}
+
 static void socket_ctx_retain(socket_ctx_t *ctx) {
   if (!ctx) return;
   ctx->ref_count++;
@@ -367,7 +837,18 @@ static void socket_ctx_release(socket_ctx_t *ctx) {
   if (ctx->ref_count == 0) {
     SOCKET_TRACE_FREE(ctx);
     if (ctx->type == SOCKET_SERVER) {
+      lunet_timer_stop(&ctx->server.accept_deadline);
       queue_destroy(ctx->server.pending_accepts);
+    } else {
+      lunet_timer_stop(&ctx->client.read_deadline);
+      lunet_timer_stop(&ctx->client.write_deadline);
+      lunet_timer_stop(&ctx->client.close_deadline);
+      write_queue_discard(ctx);
+      socket_into_clear(ctx);
+      if (ctx->client.rx) {
+        lunet_free(ctx->client.rx->data);
+        lunet_free(ctx->client.rx);
+      }
     }
     lunet_free(ctx);
   }
@@ -383,6 +864,161 @@ static void lunet_close_cb(uv_handle_t *handle) {
   }
 }
 
+/* Pin the string at idx and append it to the outbound queue */
+static int write_queue_push(lua_State *co, socket_ctx_t *ctx, int idx) {
+  size_t len = 0;
+  const char *data = lunet_buffer_tobytes(co, idx, &len);
+  if (len == 0) return 0;
+
+  if (ctx->client.wq_len == ctx->client.wq_cap) {
+    int cap = ctx->client.wq_cap ? ctx->client.wq_cap * 2 : 8;
+    write_chunk_t *grown = lunet_realloc(ctx->client.wq, sizeof(write_chunk_t) * cap);
+    if (!grown) return UV_ENOMEM;
+    ctx->client.wq = grown;
+    ctx->client.wq_cap = cap;
+  }
+
+  write_chunk_t *chunk = &ctx->client.wq[ctx->client.wq_len++];
+  chunk->base = data;
+  chunk->len = len;
+  lua_pushvalue(co, idx);
+  lunet_coref_create_raw(co, chunk->ref);
+  ctx->client.wq_bytes += len;
+  return 0;
+}
+
+/* Drop the chunks queued from index mark on, i.e. one call's worth */
+static void write_queue_truncate(socket_ctx_t *ctx, int mark) {
+  if (mark >= ctx->client.wq_len) return;
+  for (int i = mark; i < ctx->client.wq_len; i++) {
+    lunet_coref_release(ctx->co, ctx->client.wq[i].ref);
+    ctx->client.wq_bytes -= ctx->client.wq[i].len;
+  }
+  ctx->client.wq_len = mark;
+}
+
+static int write_queue_over_budget(socket_ctx_t *ctx) {
+  return ctx->client.wq_bytes + ctx->client.inflight_bytes > write_high_water;
+}
+
+static void lunet_write_cb(uv_write_t *req, int status);
+static void sendfile_resume_after_flush(socket_ctx_t *ctx);
+
+/*
+ * Hand the whole queue to libuv as one uv_write. Only one write is in flight
+ * per socket; chunks queued meanwhile go out together when it completes.
+ */
+static int write_queue_flush(socket_ctx_t *ctx) {
+  if (ctx->client.write_inflight || ctx->client.wq_len == 0) return 0;
+
+  write_req_t *write_req = lunet_alloc(sizeof(write_req_t));
+  if (!write_req) {
+    write_queue_discard(ctx);
+    return UV_ENOMEM;
+  }
+
+  int nchunks = ctx->client.wq_len;
+  uv_buf_t stack_bufs[WRITE_STACK_BUFS];
+  uv_buf_t *bufs = stack_bufs;
+  if (nchunks > WRITE_STACK_BUFS) {
+    bufs = lunet_alloc(sizeof(uv_buf_t) * nchunks);
+    if (!bufs) {
+      lunet_free(write_req);
+      write_queue_discard(ctx);
+      return UV_ENOMEM;
+    }
+  }
+  for (int i = 0; i < nchunks; i++) {
+    bufs[i] = uv_buf_init((char *)ctx->client.wq[i].base, ctx->client.wq[i].len);
+  }
+
+  write_req->ctx = ctx;
+  write_req->chunks = ctx->client.wq;
+  write_req->nchunks = nchunks;
+  write_req->nbytes = ctx->client.wq_bytes;
+  ctx->client.wq = NULL;
+  ctx->client.wq_len = 0;
+  ctx->client.wq_cap = 0;
+  ctx->client.wq_bytes = 0;
+  ctx->client.write_mark = -1;
+
+  SOCKET_TRACE_WRITE_START(ctx, write_req->nbytes);
+
+  /* Hold ctx alive until write callback fires */
+  socket_ctx_retain(ctx);
+
+  /* uv_write copies the buf array, so it only has to outlive the call */
+  int ret = uv_write(&write_req->req, &ctx->u.stream, bufs, nchunks, lunet_write_cb);
+  if (bufs != stack_bufs) {
+    lunet_free(bufs);
+  }
+  if (ret < 0) {
+    SOCKET_TRACE_WRITE_CB(ctx, ret);
+    write_chunks_release(ctx->co, write_req->chunks, write_req->nchunks);
+    lunet_free(write_req);
+    socket_ctx_release(ctx);
+    return ret;
+  }
+
+  ctx->client.write_inflight = 1;
+  ctx->client.inflight_bytes = write_req->nbytes;
+  return 0;
+}
+
+/* Resume the writer blocked on the high-water mark, if any */
+static void write_wake_blocked(socket_ctx_t *ctx) {
+  if (ctx->client.write_ref == LUA_NOREF) return;
+
+  lua_State *co = ctx->co;
+  int write_ref = ctx->client.write_ref;
+  ctx->client.write_ref = LUA_NOREF;
+  lunet_timer_stop(&ctx->client.write_deadline);
+
+  lua_rawgeti(co, LUA_REGISTRYINDEX, write_ref);
+  lunet_coref_release(co, write_ref);
+  SOCKET_BK_RESUME(ctx, "write");
+  lunet_metrics_since(LUNET_METRIC_SOCKET_WRITE, ctx->client.write_wait_ns);
+
+  if (lua_isthread(co, -1)) {
+    lua_State *waiting_co = lua_tothread(co, -1);
+    lua_pop(co, 1);
+
+    if (ctx->client.write_status == 0) {
+      lua_pushnil(waiting_co);
+    } else {
+      lua_pushstring(waiting_co, uv_strerror(ctx->client.write_status));
+    }
+
+    int resume_status = lunet_co_resume(waiting_co, 1);
+    if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
+      const char *err = lua_tostring(waiting_co, -1);
+      if (err) {
+        fprintf(stderr, "[lunet] resume error in lunet_write_cb: %s\n", err);
+      }
+    }
+  } else {
+    lua_pop(co, 1);  /* pop the non-thread value */
+  }
+}
+
+static void socket_close_now(socket_ctx_t *ctx) {
+  ctx->closing = 1;
+  if (ctx->type == SOCKET_CLIENT) {
+    /* Stop reading immediately so libuv won't fire read_cb after close */
+    uv_read_stop(&ctx->u.stream);
+    lunet_timer_stop(&ctx->client.close_deadline);
+    socket_into_clear(ctx);
+    /* A streaming reader has no read_cb retain to unwind: drop its ref */
+    if (ctx->client.rx && ctx->client.read_ref != LUA_NOREF) {
+      lunet_coref_release(ctx->co, ctx->client.read_ref);
+      ctx->client.read_ref = LUA_NOREF;
+      lunet_timer_stop(&ctx->client.read_deadline);
+      SOCKET_BK_CANCEL(ctx, "read");
+    }
+  }
+  uv_close(&ctx->u.handle, lunet_close_cb);
+}
+
 // write complete callback
 static void lunet_write_cb(uv_write_t *req, int status) {
   write_req_t *write_req = (write_req_t *)req;
@@ -398,80 +1034,70 @@ static void lunet_write_cb(uv_write_t *req, int status) {
    * may be stale. With refcount, ctx stays alive until we release. But if
    * something went very wrong, guard against NULL. */
   if (!ctx) {
-    if (write_req->data) {
-      lunet_free_nonnull(write_req->data);
-    }
+    write_chunks_release(default_luaL(), write_req->chunks, write_req->nchunks);
     lunet_free_nonnull(write_req);
     return;
   }
 
 #ifdef LUNET_TRACE
   if (socket_ctx_check_canary(ctx, "lunet_write_cb") != 0) {
-    if (write_req->data) {
-      lunet_free(write_req->data);
-    }
+    write_chunks_release(default_luaL(), write_req->chunks, write_req->nchunks);
     lunet_free_nonnull(write_req);
     return;
   }
   SOCKET_TRACE_WRITE_CB(ctx, status);
 #endif
 
-  /* Handle is closing — free resources, release coref, release retain, skip Lua resume */
+  ctx->client.write_inflight = 0;
+  ctx->client.inflight_bytes = 0;
+  write_chunks_release(ctx->co, write_req->chunks, write_req->nchunks);
+  lunet_free_nonnull(write_req);
+
+  /* Handle is closing — drop the queue, release coref, release retain, skip Lua resume */
   if (ctx->closing) {
+    write_queue_discard(ctx);
     if (ctx->client.write_ref != LUA_NOREF) {
       lunet_coref_release(ctx->co, ctx->client.write_ref);
       ctx->client.write_ref = LUA_NOREF;
+      lunet_timer_stop(&ctx->client.write_deadline);
       SOCKET_BK_CANCEL(ctx, "write");
     }
-    if (write_req->data) {
-      lunet_free(write_req->data);
-    }
-    lunet_free_nonnull(write_req);
     socket_ctx_release(ctx);
     return;
   }
 
-  if (ctx->client.write_ref != LUA_NOREF) {
-    lua_State *co = ctx->co;
-    int write_ref = ctx->client.write_ref;
-    ctx->client.write_ref = LUA_NOREF;
-
-    lua_rawgeti(co, LUA_REGISTRYINDEX, write_ref);
-    lunet_coref_release(co, write_ref);
-    SOCKET_BK_RESUME(ctx, "write");
-
-    if (lua_isthread(co, -1)) {
-      lua_State *waiting_co = lua_tothread(co, -1);
-      lua_pop(co, 1);
+  /* A failed write poisons the stream: later writes report the same error */
+  if (status < 0) {
+    ctx->client.write_status = status;
+    write_queue_discard(ctx);
+  } else {
+    int ret = write_queue_flush(ctx);
+    if (ret < 0) {
+      ctx->client.write_status = ret;
+    }
+  }
 
-      if (status == 0) {
-        lua_pushnil(waiting_co);
-      } else {
-        lua_pushstring(waiting_co, uv_strerror(status));
-      }
+  /* Queued bytes are on the wire: a waiting sendfile may start */
+  if (!ctx->client.write_inflight && ctx->client.sendfile) {
+    sendfile_resume_after_flush(ctx);
+  }
 
-      int resume_status = lunet_co_resume(waiting_co, 1);
-      if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
-        const char *err = lua_tostring(waiting_co, -1);
-        if (err) {
-          fprintf(stderr, "[lunet] resume error in lunet_write_cb: %s\n", err);
-        }
+  if (ctx->client.close_after_flush) {
+    if (!ctx->client.write_inflight && !ctx->client.sendfile) {
+      write_wake_blocked(ctx);
+      if (!ctx->closing) {
+        socket_close_now(ctx);
       }
-    } else {
-      lua_pop(co, 1);  /* pop the non-thread value */
     }
+  } else if (ctx->client.write_status != 0 || !write_queue_over_budget(ctx)) {
+    write_wake_blocked(ctx);
   }
 
-  // release write request and data
-  if (write_req->data) {
-    lunet_free(write_req->data);
-  }
-  lunet_free_nonnull(write_req);
-
   /* Release the write operation's reference */
   socket_ctx_release(ctx);
 }
 
+
 static void alloc_buffer(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
   /* If handle is closing or ctx was already freed, return empty buffer.
    * libuv will then call read_cb with nread=UV_ENOBUFS which we handle. */
@@ -480,8 +1106,14 @@ static void alloc_buffer(uv_handle_t *handle, size_t suggested_size, uv_buf_t *b
     buf->len = 0;
     return;
   }
-  buf->base = lunet_alloc(read_buffer_size);
-  buf->len = read_buffer_size;
+  socket_ctx_t *ctx = (socket_ctx_t *)handle->data;
+  if (ctx->client.into_base) {
+    buf->base = ctx->client.into_base;
+    buf->len = ctx->client.into_len;
+    return;
+  }
+  buf->base = read_pool_get(read_buffer_size);
+  buf->len = buf->base ? read_buffer_size : 0;
 }
 
 static void lunet_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
@@ -490,34 +1122,33 @@ static void lunet_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *bu
   uv_read_stop(stream);
 
   /* ---- UAF guard (Issue #50) ----
-   * If close_cb already ran, handle->data is NULL. Free the buffer and bail.
+   * If close_cb already ran, handle->data is NULL. Recycle the buffer and bail.
    * No socket_ctx_release here because the ctx is already gone. */
   if (!ctx) {
-    if (buf && buf->base) {
-      lunet_free_nonnull(buf->base);  /* must match lunet_alloc backend (libc or EasyMem) */
-    }
+    read_pool_put(buf);
     return;
   }
 
 #ifdef LUNET_TRACE
   if (socket_ctx_check_canary(ctx, "lunet_read_cb") != 0) {
-    if (buf && buf->base) {
-      lunet_free_nonnull(buf->base);
-    }
+    read_pool_put(buf);
     /* Canary failed — ctx is garbage. Don't touch it further. */
     return;
   }
 #endif
 
-  /* Handle is closing — free buffer, release our retain, skip Lua resume */
+  /* read_into: the bytes are already in the caller's buffer */
+  int into = ctx->client.into_base != NULL && buf->base == ctx->client.into_base;
+  socket_into_clear(ctx);
+
+  /* Handle is closing — recycle buffer, release our retain, skip Lua resume */
   if (ctx->closing || uv_is_closing((uv_handle_t *)stream)) {
-    if (buf && buf->base) {
-      lunet_free_nonnull(buf->base);
-    }
+    if (!into) read_pool_put(buf);
     /* Release the read_ref if still held, so the coref count balances */
     if (ctx->type == SOCKET_CLIENT && ctx->client.read_ref != LUA_NOREF) {
       lunet_coref_release(ctx->co, ctx->client.read_ref);
       ctx->client.read_ref = LUA_NOREF;
+      lunet_timer_stop(&ctx->client.read_deadline);
       SOCKET_BK_CANCEL(ctx, "read");
     }
     socket_ctx_release(ctx);
@@ -530,6 +1161,7 @@ static void lunet_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *bu
     lua_State *co = ctx->co;
     int read_ref = ctx->client.read_ref;
     ctx->client.read_ref = LUA_NOREF;
+    lunet_timer_stop(&ctx->client.read_deadline);
 
 #ifdef LUNET_TRACE_VERBOSE
     fprintf(stderr, "[SOCKET_TRACE] READ_CB_RESOLVE ctx=%p co=%p read_ref=%d\n",
@@ -539,6 +1171,7 @@ static void lunet_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *bu
     lua_rawgeti(co, LUA_REGISTRYINDEX, read_ref);
     lunet_coref_release(co, read_ref);
     SOCKET_BK_RESUME(ctx, "read");
+    lunet_metrics_since(LUNET_METRIC_SOCKET_READ, ctx->client.read_wait_ns);
 
 #ifdef LUNET_TRACE_VERBOSE
     fprintf(stderr, "[SOCKET_TRACE] READ_CB_GOT_REF type=%s\n",
@@ -555,7 +1188,11 @@ static void lunet_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *bu
 #endif
 
       if (nread > 0) {
-        lua_pushlstring(waiting_co, buf->base, nread);
+        if (into) {
+          lua_pushinteger(waiting_co, (lua_Integer)nread);
+        } else {
+          lua_pushlstring(waiting_co, buf->base, nread);
+        }
         lua_pushnil(waiting_co);
       } else if (nread == UV_EOF) {
         lua_pushnil(waiting_co);
@@ -582,31 +1219,533 @@ static void lunet_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *bu
     }
   }
 
-  if (buf && buf->base) {
-    lunet_free_nonnull(buf->base);
-  }
+  if (!into) read_pool_put(buf);
 
   /* Release the read operation's reference */
   socket_ctx_release(ctx);
 }
 
-static void lunet_listen_cb(uv_stream_t *server, int status) {
-  socket_ctx_t *ctx = (socket_ctx_t *)server->data;
+/*
+ * Streaming reads (socket.read_stream).
+ *
+ * Reading stays armed and libuv reads straight into a bounded per-connection
+ * buffer. socket.read is then served from the buffer without touching the
+ * kernel; the stream is paused only while the buffer is full.
+ */
+static void rx_alloc_cb(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf);
+static void rx_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf);
+
+static void rx_resume_if_paused(socket_ctx_t *ctx) {
+  socket_rx_t *rx = ctx->client.rx;
+  if (!rx->paused || rx->eof || rx->status != 0 || ctx->closing) return;
+  if (rx->start == 0 && rx->end == rx->cap) return;  /* still full */
+  int ret = uv_read_start(&ctx->u.stream, rx_alloc_cb, rx_read_cb);
+  if (ret < 0) {
+    rx->status = ret;
+    return;
+  }
+  rx->paused = 0;
+}
 
-  if (status < 0) {
-    // there is a coroutine waiting for accept
-    if (ctx->server.accept_ref != LUA_NOREF) {
-      lua_State *co = ctx->co;
-      lua_rawgeti(co, LUA_REGISTRYINDEX, ctx->server.accept_ref);
-      lunet_coref_release(co, ctx->server.accept_ref);
-      ctx->server.accept_ref = LUA_NOREF;
-      SOCKET_BK_RESUME(ctx, "accept");
+/*
+ * The buffer is full and the waiting read_until/read_exact wants more: double
+ * it, up to the frame size. A large frame (often sized by the peer's header)
+ * only costs memory as its bytes actually arrive.
+ */
+static int rx_grow(socket_rx_t *rx) {
+  if (rx->start != 0 || rx->end != rx->cap) return 0;  /* room after alloc_cb slides */
+  if (rx->want != RX_WANT_UNTIL && rx->want != RX_WANT_EXACT) return 0;
+  if (rx->want_n <= rx->cap) return 0;
+  size_t cap = rx->cap * 2;
+  if (cap > rx->want_n || cap < rx->cap) cap = rx->want_n;
+  char *grown = lunet_realloc(rx->data, cap);
+  if (!grown) return UV_ENOMEM;
+  rx->data = grown;
+  rx->cap = cap;
+  return 0;
+}
 
-      if (lua_isthread(co, -1)) {
-        lua_State *waiting_co = lua_tothread(co, -1);
-        lua_pop(co, 1);
+/* Back to the read_stream size once what is left fits again */
+static void rx_shrink(socket_rx_t *rx) {
+  size_t avail = rx->end - rx->start;
+  if (rx->cap <= rx->base_cap || avail > rx->base_cap) return;
+  if (rx->start > 0) {
+    memmove(rx->data, rx->data + rx->start, avail);
+    rx->start = 0;
+    rx->end = avail;
+  }
+  char *shrunk = lunet_realloc(rx->data, rx->base_cap);
+  if (!shrunk) return;  /* keep the larger block */
+  rx->data = shrunk;
+  rx->cap = rx->base_cap;
+}
 
-        lua_pushnil(waiting_co);
+/*
+ * Locate delim in the first want_n unread bytes (a frame and its delimiter
+ * must end within max), resuming where the last scan stopped
+ */
+static const char *rx_find_delim(socket_rx_t *rx) {
+  const char *base = rx->data + rx->start;
+  size_t avail = rx->end - rx->start;
+  if (avail > rx->want_n) avail = rx->want_n;
+  size_t from = rx->scanned >= rx->delim_len ? rx->scanned - rx->delim_len + 1 : 0;
+  while (from + rx->delim_len <= avail) {
+    const char *hit = memchr(base + from, rx->delim[0], avail - from - rx->delim_len + 1);
+    if (!hit) break;
+    if (memcmp(hit, rx->delim, rx->delim_len) == 0) return hit;
+    from = (size_t)(hit - base) + 1;
+  }
+  rx->scanned = avail;
+  return NULL;
+}
+
+static void rx_consume(socket_ctx_t *ctx, size_t n) {
+  socket_rx_t *rx = ctx->client.rx;
+  rx->start += n;
+  if (rx->start == rx->end) {
+    rx->start = rx->end = 0;
+  }
+  rx->want = RX_WANT_ANY;
+  rx->scanned = 0;
+  rx_shrink(rx);
+  rx_resume_if_paused(ctx);
+}
+
+/*
+ * Push (data, nil), (nil, nil) on EOF or (nil, err) onto L if the pending
+ * request can be satisfied from the buffer. Returns 1 if values were pushed,
+ * 0 if the reader has to wait for more data.
+ */
+static int rx_deliver(lua_State *L, socket_ctx_t *ctx) {
+  socket_rx_t *rx = ctx->client.rx;
+  size_t avail = rx->end - rx->start;
+
+  if (rx->want == RX_WANT_UNTIL && avail > 0) {
+    const char *hit = rx_find_delim(rx);
+    if (hit) {
+      size_t frame = (size_t)(hit - (rx->data + rx->start));
+      lua_pushlstring(L, rx->data + rx->start, frame);
+      lua_pushnil(L);
+      rx_consume(ctx, frame + rx->delim_len);
+      return 1;
+    }
+    if (avail >= rx->want_n) {
+      /* Leave the bytes buffered; socket.read can still drain them */
+      rx->want = RX_WANT_ANY;
+      rx->scanned = 0;
+      lua_pushnil(L);
+      lua_pushstring(L, "delimiter not found within max bytes");
+      return 1;
+    }
+  } else if (rx->want == RX_WANT_EXACT && avail >= rx->want_n) {
+    lua_pushlstring(L, rx->data + rx->start, rx->want_n);
+    lua_pushnil(L);
+    rx_consume(ctx, rx->want_n);
+    return 1;
+  } else if (rx->want == RX_WANT_ANY && avail > 0) {
+    lua_pushlstring(L, rx->data + rx->start, avail);
+    lua_pushnil(L);
+    rx_consume(ctx, avail);
+    return 1;
+  }
+
+  /* Not satisfiable yet: report a stream end instead of waiting forever */
+  if (rx->status != 0 || rx->eof) {
+    rx->want = RX_WANT_ANY;
+    rx->scanned = 0;
+    lua_pushnil(L);
+    if (rx->status != 0) {
+      lua_pushstring(L, uv_strerror(rx->status));
+    } else {
+      lua_pushnil(L);
+    }
+    return 1;
+  }
+  return 0;
+}
+
+static void rx_wake_reader(socket_ctx_t *ctx) {
+  if (ctx->client.read_ref == LUA_NOREF) return;
+
+  lua_State *co = ctx->co;
+  lua_rawgeti(co, LUA_REGISTRYINDEX, ctx->client.read_ref);
+  if (!lua_isthread(co, -1)) {
+    lua_pop(co, 1);
+    lunet_coref_release(co, ctx->client.read_ref);
+    ctx->client.read_ref = LUA_NOREF;
+    lunet_timer_stop(&ctx->client.read_deadline);
+    SOCKET_BK_CANCEL(ctx, "read");
+    return;
+  }
+  lua_State *waiting_co = lua_tothread(co, -1);
+  lua_pop(co, 1);
+
+  if (!rx_deliver(waiting_co, ctx)) {
+    /* Keep waiting, with room for the rest of the frame */
+    int ret = rx_grow(ctx->client.rx);
+    if (ret == 0) {
+      rx_resume_if_paused(ctx);
+      return;
+    }
+    ctx->client.rx->status = ret;
+    rx_deliver(waiting_co, ctx);
+  }
+
+  lunet_coref_release(co, ctx->client.read_ref);
+  ctx->client.read_ref = LUA_NOREF;
+  lunet_timer_stop(&ctx->client.read_deadline);
+  SOCKET_BK_RESUME(ctx, "read");
+  lunet_metrics_since(LUNET_METRIC_SOCKET_READ, ctx->client.read_wait_ns);
+
+  int resume_status = lunet_co_resume(waiting_co, 2);
+  if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
+    const char *err = lua_tostring(waiting_co, -1);
+    if (err) {
+      fprintf(stderr, "[lunet] resume error in on_read: %s\n", err);
+    }
+  }
+}
+
+static void rx_alloc_cb(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
+  socket_ctx_t *ctx = (socket_ctx_t *)handle->data;
+  if (!ctx || uv_is_closing(handle)) {
+    buf->base = NULL;
+    buf->len = 0;
+    return;
+  }
+  socket_rx_t *rx = ctx->client.rx;
+  if (rx->start == rx->end) {
+    rx->start = rx->end = 0;
+  } else if (rx->end == rx->cap && rx->start > 0) {
+    /* Slide unread bytes to the front to make room */
+    memmove(rx->data, rx->data + rx->start, rx->end - rx->start);
+    rx->end -= rx->start;
+    rx->start = 0;
+  }
+  buf->base = rx->data + rx->end;
+  buf->len = rx->cap - rx->end;
+}
+
+static void rx_read_cb(uv_stream_t *stream, ssize_t nread, const uv_buf_t *buf) {
+  socket_ctx_t *ctx = (socket_ctx_t *)stream->data;
+  (void)buf;
+  if (!ctx) return;
+
+#ifdef LUNET_TRACE
+  if (socket_ctx_check_canary(ctx, "rx_read_cb") != 0) {
+    return;
+  }
+#endif
+
+  if (ctx->closing || uv_is_closing((uv_handle_t *)stream)) return;
+
+  socket_rx_t *rx = ctx->client.rx;
+  if (nread == 0) return;
+
+  SOCKET_TRACE_READ(ctx, nread);
+
+  if (nread > 0) {
+    rx->end += (size_t)nread;
+    if (rx->start == 0 && rx->end == rx->cap) {
+      uv_read_stop(stream);
+      rx->paused = 1;
+    }
+  } else if (nread == UV_ENOBUFS) {
+    uv_read_stop(stream);
+    rx->paused = 1;
+    return;
+  } else {
+    uv_read_stop(stream);
+    rx->paused = 1;
+    if (nread == UV_EOF) {
+      rx->eof = 1;
+    } else {
+      rx->status = (int)nread;
+    }
+  }
+
+  rx_wake_reader(ctx);
+}
+
+static int rx_enable(socket_ctx_t *ctx, size_t cap) {
+  socket_rx_t *rx = lunet_alloc(sizeof(socket_rx_t));
+  if (!rx) return UV_ENOMEM;
+  rx->data = lunet_alloc(cap);
+  if (!rx->data) {
+    lunet_free(rx);
+    return UV_ENOMEM;
+  }
+  rx->cap = cap;
+  rx->base_cap = cap;
+  rx->start = 0;
+  rx->end = 0;
+  rx->paused = 0;
+  rx->eof = 0;
+  rx->status = 0;
+  rx->want = RX_WANT_ANY;
+  rx->want_n = 0;
+  rx->delim_len = 0;
+  rx->scanned = 0;
+  ctx->client.rx = rx;
+
+  int ret = uv_read_start(&ctx->u.stream, rx_alloc_cb, rx_read_cb);
+  if (ret < 0) {
+    rx->paused = 1;
+    rx->status = ret;
+  }
+  return ret;
+}
+
+/* Common checks for the streaming readers; returns NULL with an error pushed */
+static socket_ctx_t *rx_reader_ctx(lua_State *L, int nret) {
+  const char *err = NULL;
+  socket_ctx_t *ctx = NULL;
+  if (!lua_islightuserdata(L, 1)) {
+    err = "invalid socket handle";
+  } else {
+    ctx = (socket_ctx_t *)lua_touserdata(L, 1);
+    if (!ctx || ctx->type != SOCKET_CLIENT) {
+      err = "invalid client socket handle";
+    } else if (ctx->client.read_ref != LUA_NOREF) {
+      err = "another read already in progress";
+    }
+  }
+  if (err) {
+    if (nret == 2) lua_pushnil(L);
+    lua_pushstring(L, err);
+    return NULL;
+  }
+  return ctx;
+}
+
+int lunet_socket_read_stream(lua_State *L) {
+  socket_ctx_t *ctx = rx_reader_ctx(L, 1);
+  if (!ctx) {
+    return 1;
+  }
+
+  if (ctx->client.rx) {
+    lua_pushnil(L);  /* already streaming */
+    return 1;
+  }
+
+  lua_Integer cap = luaL_optinteger(L, 2, RX_DEFAULT_CAPACITY);
+  if (cap < RX_MIN_CAPACITY) {
+    cap = RX_MIN_CAPACITY;
+  }
+
+  int ret = rx_enable(ctx, (size_t)cap);
+  if (ret == UV_ENOMEM) {
+    lua_pushstring(L, "out of memory");
+    return 1;
+  }
+  if (ret < 0) {
+    lua_pushfstring(L, "failed to start reading: %s", uv_strerror(ret));
+    return 1;
+  }
+
+  lua_pushnil(L);
+  return 1;
+}
+
+/* Serve the pending request now or park the coroutine until it can be */
+static int rx_read_or_wait(lua_State *co, socket_ctx_t *ctx, uint64_t timeout_ms) {
+  if (rx_deliver(co, ctx)) {
+    return 2;
+  }
+  if (rx_grow(ctx->client.rx) != 0) {
+    ctx->client.rx->want = RX_WANT_ANY;
+    lua_pushnil(co);
+    lua_pushstring(co, "out of memory");
+    return 2;
+  }
+  rx_resume_if_paused(ctx);
+  lunet_coref_create(co, ctx->client.read_ref);
+  SOCKET_BK_WAIT(ctx, "read");
+  ctx->client.read_wait_ns = uv_hrtime();
+  socket_deadline_arm(&ctx->client.read_deadline, timeout_ms);
+  return lua_yield(co, 0);
+}
+
+int lunet_socket_read_until(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "socket.read_until") != 0) {
+    return lua_error(co);
+  }
+
+  socket_ctx_t *ctx = rx_reader_ctx(co, 2);
+  if (!ctx) {
+    return 2;
+  }
+
+  size_t delim_len;
+  const char *delim = luaL_checklstring(co, 2, &delim_len);
+  if (delim_len == 0 || delim_len > RX_MAX_DELIM) {
+    lua_pushnil(co);
+    lua_pushfstring(co, "delimiter must be 1-%d bytes", RX_MAX_DELIM);
+    return 2;
+  }
+  lua_Integer max = luaL_optinteger(co, 3, RX_DEFAULT_CAPACITY);
+  uint64_t timeout_ms = socket_timeout_arg(co, 4);
+  if (max < (lua_Integer)delim_len) {
+    lua_pushnil(co);
+    lua_pushstring(co, "max must be at least the delimiter length");
+    return 2;
+  }
+
+  if (!ctx->client.rx) {
+    int ret = rx_enable(ctx, RX_DEFAULT_CAPACITY);
+    if (ret == UV_ENOMEM) {
+      lua_pushnil(co);
+      lua_pushstring(co, "out of memory");
+      return 2;
+    }
+  }
+
+  socket_rx_t *rx = ctx->client.rx;
+  rx->want = RX_WANT_UNTIL;
+  rx->want_n = (size_t)max;
+  memcpy(rx->delim, delim, delim_len);
+  rx->delim_len = delim_len;
+  rx->scanned = 0;
+  rx_resume_if_paused(ctx);
+
+  return rx_read_or_wait(co, ctx, timeout_ms);
+}
+
+int lunet_socket_read_exact(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "socket.read_exact") != 0) {
+    return lua_error(co);
+  }
+
+  socket_ctx_t *ctx = rx_reader_ctx(co, 2);
+  if (!ctx) {
+    return 2;
+  }
+
+  lua_Integer n = luaL_checkinteger(co, 2);
+  if (n <= 0) {
+    lua_pushnil(co);
+    lua_pushstring(co, "n must be positive");
+    return 2;
+  }
+  uint64_t timeout_ms = socket_timeout_arg(co, 3);
+
+  if (!ctx->client.rx) {
+    int ret = rx_enable(ctx, RX_DEFAULT_CAPACITY);
+    if (ret == UV_ENOMEM) {
+      lua_pushnil(co);
+      lua_pushstring(co, "out of memory");
+      return 2;
+    }
+  }
+
+  socket_rx_t *rx = ctx->client.rx;
+  rx->want = RX_WANT_EXACT;
+  rx->want_n = (size_t)n;
+  rx_resume_if_paused(ctx);
+
+  return rx_read_or_wait(co, ctx, timeout_ms);
+}
+
+static void socket_read_timeout_cb(lunet_timer_t *timer) {
+  socket_ctx_t *ctx = (socket_ctx_t *)timer->data;
+  if (ctx->client.read_ref == LUA_NOREF) return;
+
+  int read_ref = ctx->client.read_ref;
+  ctx->client.read_ref = LUA_NOREF;
+  SOCKET_BK_RESUME(ctx, "read");
+  lunet_metrics_since(LUNET_METRIC_SOCKET_READ, ctx->client.read_wait_ns);
+
+  /* Streaming reads stay armed and keep buffering; a one-shot read is
+   * stopped, so read_cb will not run to drop its retain */
+  int retained = 0;
+  if (ctx->client.rx) {
+    ctx->client.rx->want = RX_WANT_ANY;
+    ctx->client.rx->scanned = 0;
+  } else {
+    uv_read_stop(&ctx->u.stream);
+    socket_into_clear(ctx);
+    retained = 1;
+  }
+
+  socket_resume_timeout(ctx->co, read_ref, 2, "read timeout");
+  if (retained) socket_ctx_release(ctx);
+}
+
+/*
+ * A writer's chunks are either all still queued or all handed to libuv (a
+ * flush takes the whole queue, and nothing is queued behind a blocked
+ * writer). Queued ones are dropped, so "timeout" means none of the call's
+ * bytes were sent and a retry is safe. Bytes libuv already has cannot be
+ * taken back: they are still sent, and the writer gets "write pending".
+ */
+static void socket_write_timeout_cb(lunet_timer_t *timer) {
+  socket_ctx_t *ctx = (socket_ctx_t *)timer->data;
+  if (ctx->client.write_ref == LUA_NOREF) return;
+
+  int write_ref = ctx->client.write_ref;
+  ctx->client.write_ref = LUA_NOREF;
+  SOCKET_BK_RESUME(ctx, "write");
+  lunet_metrics_since(LUNET_METRIC_SOCKET_WRITE, ctx->client.write_wait_ns);
+  if (ctx->client.write_mark < 0) {
+    write_resume_pending(ctx->co, write_ref);
+    return;
+  }
+  write_queue_truncate(ctx, ctx->client.write_mark);
+  ctx->client.write_mark = -1;
+  socket_resume_timeout(ctx->co, write_ref, 1, "write timeout");
+}
+
+static void socket_accept_timeout_cb(lunet_timer_t *timer) {
+  socket_ctx_t *ctx = (socket_ctx_t *)timer->data;
+  if (ctx->server.accept_ref == LUA_NOREF) return;
+
+  int accept_ref = ctx->server.accept_ref;
+  ctx->server.accept_ref = LUA_NOREF;
+  ctx->server.accept_max = 0;
+  SOCKET_BK_RESUME(ctx, "accept");
+  socket_resume_timeout(ctx->co, accept_ref, 2, "accept timeout");
+}
+
+static void sendfile_abort(socket_ctx_t *ctx);
+
+/*
+ * The peer did not take the queued bytes in time: fail the blocked writer,
+ * drop what is left and close. libuv cancels the write in flight.
+ */
+static void socket_close_timeout_cb(lunet_timer_t *timer) {
+  socket_ctx_t *ctx = (socket_ctx_t *)timer->data;
+  if (ctx->closing || !ctx->client.close_after_flush) return;
+
+  if (ctx->client.write_status == 0) {
+    ctx->client.write_status = UV_ETIMEDOUT;
+  }
+  write_wake_blocked(ctx);
+  if (ctx->closing) return;
+  if (ctx->client.sendfile) sendfile_abort(ctx);
+  /* A sendfile chunk still on the fs pool closes the socket when it returns */
+  if (!ctx->closing && !ctx->client.sendfile) socket_close_now(ctx);
+}
+
+static void lunet_listen_cb(uv_stream_t *server, int status) {
+  socket_ctx_t *ctx = (socket_ctx_t *)server->data;
+
+  if (status < 0) {
+    // there is a coroutine waiting for accept
+    if (ctx->server.accept_ref != LUA_NOREF) {
+      lua_State *co = ctx->co;
+      lua_rawgeti(co, LUA_REGISTRYINDEX, ctx->server.accept_ref);
+      lunet_coref_release(co, ctx->server.accept_ref);
+      ctx->server.accept_ref = LUA_NOREF;
+      ctx->server.accept_max = 0;
+      lunet_timer_stop(&ctx->server.accept_deadline);
+      SOCKET_BK_RESUME(ctx, "accept");
+
+      if (lua_isthread(co, -1)) {
+        lua_State *waiting_co = lua_tothread(co, -1);
+        lua_pop(co, 1);
+
+        lua_pushnil(waiting_co);
         lua_pushstring(waiting_co, uv_strerror(status));
 
         int resume_status = lunet_co_resume(waiting_co, 2);
@@ -634,15 +1773,16 @@ static void lunet_listen_cb(uv_stream_t *server, int status) {
   client_ctx->ref_count = 1;
   client_ctx->client.read_ref = LUA_NOREF;
   client_ctx->client.write_ref = LUA_NOREF;
+  socket_client_init_io(client_ctx);
   socket_ctx_init_canary(client_ctx);
 
   SOCKET_TRACE_ACCEPT(client_ctx);
 
   int ret = 0;
   if (ctx->domain == SOCKET_DOMAIN_TCP) {
-      ret = uv_tcp_init(uv_default_loop(), &client_ctx->u.tcp);
+      ret = uv_tcp_init(lunet_loop(), &client_ctx->u.tcp);
   } else {
-      ret = uv_pipe_init(uv_default_loop(), &client_ctx->u.pipe, 0);
+      ret = uv_pipe_init(lunet_loop(), &client_ctx->u.pipe, 0);
   }
 
   if (ret < 0) {
@@ -657,19 +1797,34 @@ static void lunet_listen_cb(uv_stream_t *server, int status) {
     return;
   }
 
+  if (ctx->domain == SOCKET_DOMAIN_TCP) {
+    /* Best effort: a connection that refuses an option is still usable */
+    const char *what = NULL;
+    socket_opts_apply(client_ctx, &ctx->server.accept_opts, &what);
+  }
+
   if (ctx->server.accept_ref != LUA_NOREF) {
     // there is a coroutine waiting for accept, wake it up
     lua_State *co = ctx->co;
     lua_rawgeti(co, LUA_REGISTRYINDEX, ctx->server.accept_ref);
     lunet_coref_release(co, ctx->server.accept_ref);
     ctx->server.accept_ref = LUA_NOREF;
+    lunet_timer_stop(&ctx->server.accept_deadline);
     SOCKET_BK_RESUME(ctx, "accept");
 
     if (lua_isthread(co, -1)) {
       lua_State *waiting_co = lua_tothread(co, -1);
       lua_pop(co, 1);
 
-      lua_pushlightuserdata(waiting_co, client_ctx);
+      if (ctx->server.accept_max > 0) {
+        /* accept_many waiter: hand back a one-element batch */
+        ctx->server.accept_max = 0;
+        lua_createtable(waiting_co, 1, 0);
+        lua_pushlightuserdata(waiting_co, client_ctx);
+        lua_rawseti(waiting_co, -2, 1);
+      } else {
+        lua_pushlightuserdata(waiting_co, client_ctx);
+      }
       lua_pushnil(waiting_co);
 
       int resume_status = lunet_co_resume(waiting_co, 2);
@@ -697,6 +1852,24 @@ int lunet_socket_listen(lua_State *co) {
   const char *host = luaL_checkstring(co, 2);
   int port = luaL_checkinteger(co, 3);
 
+  /* Workers share ports through the kernel unless the script opts out */
+  int reuseport = g_lunet_config.workers > 1 && strcmp(protocol, "tcp") == 0;
+  socket_opts_t opts;
+  socket_opts_init(&opts);
+  if (lua_istable(co, 4)) {
+    lua_getfield(co, 4, "reuseport");
+    if (!lua_isnil(co, -1)) {
+      reuseport = lua_toboolean(co, -1);
+    }
+    lua_pop(co, 1);
+    const char *bad = socket_opts_parse(co, 4, &opts);
+    if (bad) {
+      lua_pushnil(co);
+      lua_pushfstring(co, "invalid %s option", bad);
+      return 2;
+    }
+  }
+
   socket_domain_t domain;
   if (strcmp(protocol, "tcp") == 0) {
       domain = SOCKET_DOMAIN_TCP;
@@ -713,12 +1886,30 @@ int lunet_socket_listen(lua_State *co) {
       }
   } else if (strcmp(protocol, "unix") == 0) {
       domain = SOCKET_DOMAIN_UNIX;
+      if (reuseport) {
+        lua_pushnil(co);
+        lua_pushstring(co, "reuseport is only supported for tcp");
+        return 2;
+      }
+      if (socket_opts_tcp_only(&opts)) {
+        lua_pushnil(co);
+        lua_pushstring(co, "nodelay, keepalive, sndbuf, rcvbuf and fastopen are only supported for tcp");
+        return 2;
+      }
   } else {
       lua_pushnil(co);
       lua_pushstring(co, "only tcp and unix are supported");
       return 2;
   }
 
+#ifndef SO_REUSEPORT
+  if (reuseport) {
+    lua_pushnil(co);
+    lua_pushstring(co, "reuseport is not supported on this platform");
+    return 2;
+  }
+#endif
+
   socket_ctx_t *ctx = lunet_alloc(sizeof(socket_ctx_t));
   if (!ctx) {
     lua_pushnil(co);
@@ -735,6 +1926,11 @@ int lunet_socket_listen(lua_State *co) {
   ctx->ref_count = 1;
   ctx->server.accept_ref = LUA_NOREF;
   ctx->server.pending_accepts = queue_init();
+  ctx->server.accept_max = 0;
+  ctx->server.accept_opts = opts;
+  ctx->server.accept_opts.fastopen = -1;  /* listener-only */
+  ctx->server.accept_opts.backlog = -1;
+  lunet_timer_init(&ctx->server.accept_deadline, socket_accept_timeout_cb, ctx);
   socket_ctx_init_canary(ctx);
   if (!ctx->server.pending_accepts) {
     lunet_free(ctx);
@@ -745,7 +1941,13 @@ int lunet_socket_listen(lua_State *co) {
 
   int ret = 0;
   if (domain == SOCKET_DOMAIN_TCP) {
-      if ((ret = uv_tcp_init(uv_default_loop(), &ctx->u.tcp)) < 0) {
+      /* reuseport needs the fd before bind: have libuv create it eagerly */
+      if (reuseport) {
+        ret = uv_tcp_init_ex(lunet_loop(), &ctx->u.tcp, AF_INET);
+      } else {
+        ret = uv_tcp_init(lunet_loop(), &ctx->u.tcp);
+      }
+      if (ret < 0) {
         queue_destroy(ctx->server.pending_accepts);
         lunet_free(ctx);
         lua_pushnil(co);
@@ -753,7 +1955,7 @@ int lunet_socket_listen(lua_State *co) {
         return 2;
       }
   } else {
-      if ((ret = uv_pipe_init(uv_default_loop(), &ctx->u.pipe, 0)) < 0) {
+      if ((ret = uv_pipe_init(lunet_loop(), &ctx->u.pipe, 0)) < 0) {
         queue_destroy(ctx->server.pending_accepts);
         lunet_free(ctx);
         lua_pushnil(co);
@@ -772,12 +1974,39 @@ int lunet_socket_listen(lua_State *co) {
         lua_pushstring(co, "invalid host or port");
         return 2;
       }
+#ifdef SO_REUSEPORT
+      if (reuseport) {
+        uv_os_fd_t fd;
+        int on = 1;
+        if ((ret = uv_fileno(&ctx->u.handle, &fd)) < 0 ||
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0) {
+          uv_close(&ctx->u.handle, lunet_close_cb);
+          lua_pushnil(co);
+          lua_pushstring(co, "failed to enable reuseport");
+          return 2;
+        }
+      }
+#endif
       if ((ret = uv_tcp_bind(&ctx->u.tcp, (const struct sockaddr *)&addr, 0)) < 0) {
         uv_close(&ctx->u.handle, lunet_close_cb);
         lua_pushnil(co);
         lua_pushfstring(co, "failed to bind: %s", uv_strerror(ret));
         return 2;
       }
+      /* Buffer sizes set on the listener are inherited by accepted sockets
+       * before the handshake, so the window scale matches them */
+      socket_opts_t listener_opts;
+      socket_opts_init(&listener_opts);
+      listener_opts.sndbuf = opts.sndbuf;
+      listener_opts.rcvbuf = opts.rcvbuf;
+      listener_opts.fastopen = opts.fastopen;
+      const char *what = NULL;
+      if ((ret = socket_opts_apply(ctx, &listener_opts, &what)) < 0) {
+        uv_close(&ctx->u.handle, lunet_close_cb);
+        lua_pushnil(co);
+        lua_pushfstring(co, "failed to set %s: %s", what, uv_strerror(ret));
+        return 2;
+      }
   } else {
       // Unix socket: remove file if exists
       #ifndef _WIN32
@@ -791,7 +2020,8 @@ int lunet_socket_listen(lua_State *co) {
       }
   }
 
-  if ((ret = uv_listen(&ctx->u.stream, 128, lunet_listen_cb)) < 0) {
+  int backlog = opts.backlog > 0 ? opts.backlog : SOCKET_DEFAULT_BACKLOG;
+  if ((ret = uv_listen(&ctx->u.stream, backlog, lunet_listen_cb)) < 0) {
     uv_close(&ctx->u.handle, lunet_close_cb);
     lua_pushnil(co);
     lua_pushfstring(co, "failed to listen: %s", uv_strerror(ret));
@@ -830,6 +2060,8 @@ int lunet_socket_accept(lua_State *co) {
     return 2;
   }
 
+  uint64_t timeout_ms = socket_timeout_arg(co, 2);
+
   // there is a connection in the queue
   if (!queue_is_empty(listener_ctx->server.pending_accepts)) {
     socket_ctx_t *client_ctx = (socket_ctx_t *)queue_dequeue(listener_ctx->server.pending_accepts);
@@ -844,36 +2076,94 @@ int lunet_socket_accept(lua_State *co) {
   // save the current coroutine reference
   lunet_coref_create(co, listener_ctx->server.accept_ref);
   SOCKET_BK_WAIT(listener_ctx, "accept");
+  socket_deadline_arm(&listener_ctx->server.accept_deadline, timeout_ms);
 
   // yield to wait for new connection
   return lua_yield(co, 0);
 }
 
-int lunet_socket_getpeername(lua_State *L) {
-  if (lunet_ensure_coroutine(L, "socket.getpeername") != 0) {
-    return lua_error(L);
+int lunet_socket_accept_many(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "socket.accept_many") != 0) {
+    return lua_error(co);
   }
 
-  if (!lua_islightuserdata(L, 1)) {
-    lua_pushnil(L);
-    lua_pushstring(L, "invalid socket handle");
+  if (!lua_islightuserdata(co, 1)) {
+    lua_pushnil(co);
+    lua_pushstring(co, "invalid listener handle");
     return 2;
   }
 
-  socket_ctx_t *ctx = (socket_ctx_t *)lua_touserdata(L, 1);
-  if (!ctx) {
-    lua_pushnil(L);
-    lua_pushstring(L, "invalid socket handle");
+  socket_ctx_t *listener_ctx = (socket_ctx_t *)lua_touserdata(co, 1);
+  if (!listener_ctx || listener_ctx->type != SOCKET_SERVER) {
+    lua_pushnil(co);
+    lua_pushstring(co, "invalid listener handle");
     return 2;
   }
 
-  if (ctx->domain == SOCKET_DOMAIN_TCP) {
-      struct sockaddr_in addr;
-      int addr_len = sizeof(addr);
-      int ret = uv_tcp_getpeername(&ctx->u.tcp, (struct sockaddr *)&addr, &addr_len);
-      if (ret < 0) {
-        lua_pushnil(L);
-        lua_pushfstring(L, "failed to get peer name: %s", uv_strerror(ret));
+  int max = (int)luaL_optinteger(co, 2, 64);
+  if (max < 1) {
+    lua_pushnil(co);
+    lua_pushstring(co, "max must be positive");
+    return 2;
+  }
+
+  if (listener_ctx->server.accept_ref != LUA_NOREF) {
+    lua_pushnil(co);
+    lua_pushstring(co, "another accept already in progress");
+    return 2;
+  }
+
+  uint64_t timeout_ms = socket_timeout_arg(co, 3);
+
+  // drain whatever is already queued in one go
+  if (!queue_is_empty(listener_ctx->server.pending_accepts)) {
+    int n = (int)queue_size(listener_ctx->server.pending_accepts);
+    if (n > max) n = max;
+    lua_createtable(co, n, 0);
+    for (int i = 1; i <= n; i++) {
+      socket_ctx_t *client_ctx = (socket_ctx_t *)queue_dequeue(listener_ctx->server.pending_accepts);
+      if (!client_ctx) break;
+      lua_pushlightuserdata(co, client_ctx);
+      lua_rawseti(co, -2, i);
+    }
+    lua_pushnil(co);
+    return 2;
+  }
+
+  // nothing queued: wait for the next connection
+  listener_ctx->server.accept_max = max;
+  lunet_coref_create(co, listener_ctx->server.accept_ref);
+  SOCKET_BK_WAIT(listener_ctx, "accept");
+  socket_deadline_arm(&listener_ctx->server.accept_deadline, timeout_ms);
+
+  return lua_yield(co, 0);
+}
+
+int lunet_socket_getpeername(lua_State *L) {
+  if (lunet_ensure_coroutine(L, "socket.getpeername") != 0) {
+    return lua_error(L);
+  }
+
+  if (!lua_islightuserdata(L, 1)) {
+    lua_pushnil(L);
+    lua_pushstring(L, "invalid socket handle");
+    return 2;
+  }
+
+  socket_ctx_t *ctx = (socket_ctx_t *)lua_touserdata(L, 1);
+  if (!ctx) {
+    lua_pushnil(L);
+    lua_pushstring(L, "invalid socket handle");
+    return 2;
+  }
+
+  if (ctx->domain == SOCKET_DOMAIN_TCP) {
+      struct sockaddr_in addr;
+      int addr_len = sizeof(addr);
+      int ret = uv_tcp_getpeername(&ctx->u.tcp, (struct sockaddr *)&addr, &addr_len);
+      if (ret < 0) {
+        lua_pushnil(L);
+        lua_pushfstring(L, "failed to get peer name: %s", uv_strerror(ret));
         return 2;
       }
 
@@ -911,14 +2201,21 @@ int lunet_socket_close(lua_State *L) {
   SOCKET_TRACE_CLOSE(ctx);
 
   if (!ctx->closing) {
-      ctx->closing = 1;
-
-      /* Stop reading immediately so libuv won't fire read_cb after close */
-      if (ctx->type == SOCKET_CLIENT) {
-        uv_read_stop(&ctx->u.stream);
+      if (ctx->type == SOCKET_CLIENT &&
+          (ctx->client.write_inflight || ctx->client.sendfile) &&
+          ctx->client.write_status == 0) {
+        /* Writes return before they hit the wire: let the queue drain first,
+         * lunet_write_cb closes the handle once nothing is in flight. A
+         * sendfile stops at its next chunk and closes it instead: the worker
+         * thread must not write to a closed fd. */
+        if (!ctx->client.close_after_flush) {
+          ctx->client.close_after_flush = 1;
+          uv_read_stop(&ctx->u.stream);
+          socket_deadline_arm(&ctx->client.close_deadline, close_drain_ms);
+        }
+      } else {
+        socket_close_now(ctx);
       }
-
-      uv_close(&ctx->u.handle, lunet_close_cb);
   }
 
   lua_pushnil(L);
@@ -950,9 +2247,18 @@ int lunet_socket_read(lua_State *co) {
     return 2;
   }
 
+  uint64_t timeout_ms = socket_timeout_arg(co, 2);
+
+  // streaming mode: serve from the buffer, wait only when it is empty
+  if (ctx->client.rx) {
+    ctx->client.rx->want = RX_WANT_ANY;
+    return rx_read_or_wait(co, ctx, timeout_ms);
+  }
+
   // save the coroutine reference
   lunet_coref_create(co, ctx->client.read_ref);
   SOCKET_BK_WAIT(ctx, "read");
+  ctx->client.read_wait_ns = uv_hrtime();
 
   // start reading
   socket_ctx_retain(ctx);
@@ -969,87 +2275,466 @@ int lunet_socket_read(lua_State *co) {
     return 2;
   }
 
+  socket_deadline_arm(&ctx->client.read_deadline, timeout_ms);
   return lua_yield(co, 0);
 }
 
-int lunet_socket_write(lua_State *co) {
-  if (lunet_ensure_coroutine(co, "socket.write") != 0) {
+/*
+ * socket.read_into(conn, buf [, timeout]): like socket.read, but libuv reads
+ * straight into a lunet.buffer and the byte count is returned. The waiting
+ * coroutine keeps buf alive. Streaming mode already owns the read buffer, so
+ * the two do not mix.
+ */
+int lunet_socket_read_into(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "socket.read_into") != 0) {
     return lua_error(co);
   }
 
   if (!lua_islightuserdata(co, 1)) {
+    lua_pushnil(co);
     lua_pushstring(co, "invalid socket handle");
+    return 2;
+  }
+
+  socket_ctx_t *ctx = (socket_ctx_t *)lua_touserdata(co, 1);
+  if (!ctx || ctx->type != SOCKET_CLIENT) {
+    lua_pushnil(co);
+    lua_pushstring(co, "invalid client socket handle");
+    return 2;
+  }
+
+  lunet_buffer_t *b = lunet_buffer_test(co, 2);
+  if (!b || b->len == 0) {
+    lua_pushnil(co);
+    lua_pushstring(co, "socket.read_into requires a non-empty lunet.buffer");
+    return 2;
+  }
+
+  if (ctx->client.read_ref != LUA_NOREF) {
+    lua_pushnil(co);
+    lua_pushstring(co, "another read already in progress");
+    return 2;
+  }
+
+  if (ctx->client.rx) {
+    lua_pushnil(co);
+    lua_pushstring(co, "socket.read_into is not available after socket.read_stream");
+    return 2;
+  }
+
+  uint64_t timeout_ms = socket_timeout_arg(co, 3);
+
+  lunet_coref_create(co, ctx->client.read_ref);
+  SOCKET_BK_WAIT(ctx, "read");
+  ctx->client.read_wait_ns = uv_hrtime();
+  ctx->client.into_base = b->data;
+  ctx->client.into_len = b->len;
+  lua_pushvalue(co, 2);
+  lunet_coref_create_raw(co, ctx->client.into_ref);
+
+  socket_ctx_retain(ctx);
+  int ret = uv_read_start(&ctx->u.stream, alloc_buffer, lunet_read_cb);
+  if (ret < 0) {
+    socket_ctx_release(ctx);
+    socket_into_clear(ctx);
+    lunet_coref_release(co, ctx->client.read_ref);
+    ctx->client.read_ref = LUA_NOREF;
+    SOCKET_BK_CANCEL(ctx, "read");
+
+    lua_pushnil(co);
+    lua_pushfstring(co, "failed to start reading: %s", uv_strerror(ret));
+    return 2;
+  }
+
+  socket_deadline_arm(&ctx->client.read_deadline, timeout_ms);
+  return lua_yield(co, 0);
+}
+
+/*
+ * Shared tail of write/writev: start a flush if nothing is in flight and
+ * block the caller only while the socket is over its high-water mark.
+ */
+static int socket_write_commit(lua_State *co, socket_ctx_t *ctx, int mark, uint64_t timeout_ms) {
+  ctx->client.write_mark = mark;
+  int ret = write_queue_flush(ctx);
+  if (ret < 0) {
+    ctx->client.write_status = ret;
+    lua_pushfstring(co, "failed to start writing: %s", uv_strerror(ret));
     return 1;
   }
 
-  if (!lua_isstring(co, 2)) {
-    lua_pushstring(co, "data must be a string");
+  if (!write_queue_over_budget(ctx)) {
+    lua_pushnil(co);
     return 1;
   }
 
+  // over budget: wait for the queue to drain
+  lunet_coref_create(co, ctx->client.write_ref);
+  SOCKET_BK_WAIT(ctx, "write");
+  ctx->client.write_wait_ns = uv_hrtime();
+  socket_deadline_arm(&ctx->client.write_deadline, timeout_ms);
+  return lua_yield(co, 0);
+}
+
+/* Common argument checks; returns NULL with an error string pushed */
+static socket_ctx_t *socket_write_ctx(lua_State *co) {
+  if (!lua_islightuserdata(co, 1)) {
+    lua_pushstring(co, "invalid socket handle");
+    return NULL;
+  }
+
   socket_ctx_t *ctx = (socket_ctx_t *)lua_touserdata(co, 1);
   if (!ctx || ctx->type != SOCKET_CLIENT) {
     lua_pushstring(co, "invalid client socket handle");
-    return 1;
+    return NULL;
+  }
+
+  if (ctx->closing || ctx->client.close_after_flush) {
+    lua_pushstring(co, "socket is closing");
+    return NULL;
+  }
+
+  if (ctx->client.write_status != 0) {
+    lua_pushstring(co, uv_strerror(ctx->client.write_status));
+    return NULL;
   }
 
-  // check if there is a write already in progress
-  if (ctx->client.write_ref != LUA_NOREF) {
+  // a writer is already blocked on the high-water mark, or a sendfile owns
+  // the stream
+  if (ctx->client.write_ref != LUA_NOREF || ctx->client.sendfile) {
     lua_pushstring(co, "another write already in progress");
+    return NULL;
+  }
+
+  return ctx;
+}
+
+int lunet_socket_write(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "socket.write") != 0) {
+    return lua_error(co);
+  }
+
+  if (!lua_isstring(co, 2) && !lunet_buffer_test(co, 2)) {
+    lua_pushstring(co, "data must be a string or lunet.buffer");
     return 1;
   }
 
-  // get the data
-  size_t data_len;
-  const char *data = lua_tolstring(co, 2, &data_len);
+  socket_ctx_t *ctx = socket_write_ctx(co);
+  if (!ctx) {
+    return 1;
+  }
+  uint64_t timeout_ms = socket_timeout_arg(co, 3);
 
-  // allocate write request
-  write_req_t *write_req = lunet_alloc(sizeof(write_req_t));
-  if (!write_req) {
+  int mark = ctx->client.wq_len;
+  if (write_queue_push(co, ctx, 2) != 0) {
     lua_pushstring(co, "out of memory");
     return 1;
   }
 
-  // copy data to heap memory
-  write_req->data = lunet_alloc(data_len);
-  if (!write_req->data) {
-    lunet_free(write_req);
-    lua_pushstring(co, "out of memory");
+  return socket_write_commit(co, ctx, mark, timeout_ms);
+}
+
+int lunet_socket_writev(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "socket.writev") != 0) {
+    return lua_error(co);
+  }
+
+  if (!lua_istable(co, 2)) {
+    lua_pushstring(co, "chunks must be a table of strings or lunet.buffers");
     return 1;
   }
-  memcpy(write_req->data, data, data_len);
 
-  write_req->ctx = ctx;
+  socket_ctx_t *ctx = socket_write_ctx(co);
+  if (!ctx) {
+    return 1;
+  }
+  uint64_t timeout_ms = socket_timeout_arg(co, 3);
+
+  int nchunks = (int)lua_objlen(co, 2);
+  for (int i = 1; i <= nchunks; i++) {
+    lua_rawgeti(co, 2, i);
+    int ok = lua_isstring(co, -1) || lunet_buffer_test(co, -1);
+    lua_pop(co, 1);
+    if (!ok) {
+      lua_pushfstring(co, "chunk %d must be a string or lunet.buffer", i);
+      return 1;
+    }
+  }
 
-  // set the buffer
-  uv_buf_t buf = uv_buf_init(write_req->data, data_len);
+  /* Pin each string or buffer in the registry: the bytes stay valid until write_cb */
+  int mark = ctx->client.wq_len;
+  for (int i = 1; i <= nchunks; i++) {
+    lua_rawgeti(co, 2, i);
+    int ret = write_queue_push(co, ctx, lua_gettop(co));
+    lua_pop(co, 1);
+    if (ret != 0) {
+      write_queue_truncate(ctx, mark);
+      lua_pushstring(co, "out of memory");
+      return 1;
+    }
+  }
 
-  // save the coroutine reference
-  lunet_coref_create(co, ctx->client.write_ref);
-  SOCKET_BK_WAIT(ctx, "write");
+  return socket_write_commit(co, ctx, mark, timeout_ms);
+}
 
-  SOCKET_TRACE_WRITE_START(ctx, data_len);
+/*
+ * socket.sendfile: file bytes go from the page cache to the socket through
+ * uv_fs_sendfile on the fs thread pool, with no copy through Lua. The socket
+ * is non-blocking, so a chunk may come back short or EAGAIN. The loop then
+ * waits for writability on a dup of the socket fd, because libuv allows only
+ * one watcher per fd and the stream already owns it. Queued socket.write data
+ * always goes out before the file bytes.
+ */
+#define SENDFILE_MAX_CHUNK ((size_t)1 << 30)
 
-  /* Hold ctx alive until write callback fires */
-  socket_ctx_retain(ctx);
+struct sendfile_req {
+  uv_fs_t req;
+  uv_poll_t poll;
+  socket_ctx_t *ctx;
+  int co_ref;
+  uv_file in_fd;
+  uv_file out_fd;
+  int64_t offset;
+  size_t remaining;
+  size_t sent;
+  int started;
+  int poll_fd;          /* dup of out_fd, -1 until the first short write */
+};
+
+static void sendfile_fs_cb(uv_fs_t *req);
+
+static int sendfile_issue(sendfile_req_t *sf) {
+  size_t chunk = sf->remaining < SENDFILE_MAX_CHUNK ? sf->remaining : SENDFILE_MAX_CHUNK;
+  sf->started = 1;
+  sf->req.data = sf;
+  return uv_fs_sendfile(lunet_loop(), &sf->req, sf->out_fd, sf->in_fd, sf->offset, chunk,
+                        sendfile_fs_cb);
+}
 
-  // start writing
-  int ret = uv_write(&write_req->req, &ctx->u.stream, &buf, 1, lunet_write_cb);
-  if (ret < 0) {
-    socket_ctx_release(ctx);
-    // failed to start writing, clean up the resource
-    lunet_coref_release(co, ctx->client.write_ref);
-    ctx->client.write_ref = LUA_NOREF;
-    SOCKET_BK_CANCEL(ctx, "write");
-    lunet_free(write_req->data);
-    lunet_free(write_req);
+static void sendfile_poll_close_cb(uv_handle_t *handle) {
+  sendfile_req_t *sf = (sendfile_req_t *)handle->data;
+#ifndef _WIN32
+  close(sf->poll_fd);
+#endif
+  lunet_free_nonnull(sf);
+}
 
-    lua_pushfstring(co, "failed to start writing: %s", uv_strerror(ret));
-    return 1;
+/* Resume the caller with (sent, nil) or (nil, err) and release the socket */
+static void sendfile_finish(sendfile_req_t *sf, int status) {
+  socket_ctx_t *ctx = sf->ctx;
+  lua_State *co = ctx->co;
+  size_t sent = sf->sent;
+  int co_ref = sf->co_ref;
+
+  ctx->client.sendfile = NULL;
+  if (sf->poll_fd >= 0) {
+    uv_close((uv_handle_t *)&sf->poll, sendfile_poll_close_cb);
+  } else {
+    lunet_free_nonnull(sf);
+  }
+
+  lua_rawgeti(co, LUA_REGISTRYINDEX, co_ref);
+  lunet_coref_release(co, co_ref);
+  if (lua_isthread(co, -1)) {
+    lua_State *waiting_co = lua_tothread(co, -1);
+    lua_pop(co, 1);
+    if (status < 0) {
+      lua_pushnil(waiting_co);
+      lua_pushstring(waiting_co, uv_strerror(status));
+    } else {
+      lua_pushinteger(waiting_co, (lua_Integer)sent);
+      lua_pushnil(waiting_co);
+    }
+    lunet_co_resume(waiting_co, 2);
+  } else {
+    lua_pop(co, 1);
+  }
+
+  if (ctx->client.close_after_flush && !ctx->client.write_inflight && !ctx->closing) {
+    socket_close_now(ctx);
+  }
+  socket_ctx_release(ctx);
+}
+
+/* Send the next chunk unless the socket is going away */
+static void sendfile_continue(sendfile_req_t *sf) {
+  socket_ctx_t *ctx = sf->ctx;
+  if (ctx->closing || ctx->client.close_after_flush) {
+    sendfile_finish(sf, UV_ECANCELED);
+    return;
+  }
+  if (sf->remaining == 0) {
+    sendfile_finish(sf, 0);
+    return;
+  }
+  int rc = sendfile_issue(sf);
+  if (rc < 0) sendfile_finish(sf, rc);
+}
+
+static void sendfile_poll_cb(uv_poll_t *handle, int status, int events) {
+  (void)events;
+  sendfile_req_t *sf = (sendfile_req_t *)handle->data;
+  uv_poll_stop(handle);
+  if (status < 0) {
+    sendfile_finish(sf, status);
+    return;
+  }
+  sendfile_continue(sf);
+}
+
+static int sendfile_wait_writable(sendfile_req_t *sf) {
+#ifdef _WIN32
+  return UV_ENOTSUP;
+#else
+  if (sf->poll_fd < 0) {
+    int fd = dup(sf->out_fd);
+    if (fd < 0) return uv_translate_sys_error(errno);
+    int rc = uv_poll_init_socket(lunet_loop(), &sf->poll, fd);
+    if (rc < 0) {
+      close(fd);
+      return rc;
+    }
+    sf->poll.data = sf;
+    sf->poll_fd = fd;
+  }
+  return uv_poll_start(&sf->poll, UV_WRITABLE, sendfile_poll_cb);
+#endif
+}
+
+static void sendfile_fs_cb(uv_fs_t *req) {
+  sendfile_req_t *sf = (sendfile_req_t *)req->data;
+  ssize_t n = req->result;
+  uv_fs_req_cleanup(req);
+
+  if (n < 0 && n != UV_EAGAIN) {
+    sendfile_finish(sf, (int)n);
+    return;
+  }
+  if (n == 0) {
+    /* Short file: report what was sent */
+    sendfile_finish(sf, 0);
+    return;
+  }
+  if (n > 0) {
+    sf->sent += (size_t)n;
+    sf->offset += n;
+    sf->remaining -= (size_t)n;
+    if (sf->remaining == 0) {
+      sendfile_finish(sf, 0);
+      return;
+    }
+  }
+  if (sf->ctx->client.close_after_flush) {
+    sendfile_finish(sf, UV_ECANCELED);
+    return;
+  }
+  /* Socket buffer full */
+  int rc = sendfile_wait_writable(sf);
+  if (rc < 0) sendfile_finish(sf, rc);
+}
+
+/*
+ * socket.close gave up waiting. A chunk on the fs pool finishes on its own
+ * and sendfile_fs_cb then stops; a wait for writability is ended here.
+ */
+static void sendfile_abort(socket_ctx_t *ctx) {
+  sendfile_req_t *sf = ctx->client.sendfile;
+  if (!sf->started) {
+    sendfile_finish(sf, UV_ECANCELED);
+  } else if (sf->poll_fd >= 0 && uv_is_active((uv_handle_t *)&sf->poll)) {
+    uv_poll_stop(&sf->poll);
+    sendfile_finish(sf, UV_ECANCELED);
+  }
+}
+
+static void sendfile_resume_after_flush(socket_ctx_t *ctx) {
+  sendfile_req_t *sf = ctx->client.sendfile;
+  if (sf->started) return;
+  if (ctx->client.write_status != 0) {
+    sendfile_finish(sf, ctx->client.write_status);
+    return;
+  }
+  sendfile_continue(sf);
+}
+
+int lunet_socket_sendfile(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "socket.sendfile") != 0) {
+    return lua_error(co);
+  }
+
+  socket_ctx_t *ctx = socket_write_ctx(co);
+  if (!ctx) {
+    lua_pushnil(co);
+    lua_insert(co, -2);
+    return 2;
+  }
+
+  if (!lua_isnumber(co, 2) || !lua_isnumber(co, 3) || !lua_isnumber(co, 4)) {
+    lua_pushnil(co);
+    lua_pushstring(co, "socket.sendfile requires sock, fd, offset and len");
+    return 2;
+  }
+  lua_Number offset = lua_tonumber(co, 3);
+  lua_Number len = lua_tonumber(co, 4);
+  if (!(offset >= 0) || !(len >= 0)) {  /* NaN too */
+    lua_pushnil(co);
+    lua_pushstring(co, "offset and len must not be negative");
+    return 2;
+  }
+  /* Both fit a double exactly up to 2^53; past that no file is that large */
+  if (offset >= 9007199254740992.0 || len >= 9007199254740992.0) {
+    lua_pushnil(co);
+    lua_pushstring(co, "offset or len too large");
+    return 2;
+  }
+  if (len == 0) {
+    lua_pushinteger(co, 0);
+    lua_pushnil(co);
+    return 2;
+  }
+
+#ifdef _WIN32
+  lua_pushnil(co);
+  lua_pushstring(co, "socket.sendfile is not supported on Windows");
+  return 2;
+#else
+  uv_os_fd_t out_fd;
+  int rc = uv_fileno(&ctx->u.handle, &out_fd);
+  if (rc < 0) {
+    lua_pushnil(co);
+    lua_pushstring(co, uv_strerror(rc));
+    return 2;
   }
 
-  // yield to wait for write to complete
+  sendfile_req_t *sf = lunet_calloc(1, sizeof(sendfile_req_t));
+  if (!sf) {
+    lua_pushnil(co);
+    lua_pushstring(co, "out of memory");
+    return 2;
+  }
+  sf->ctx = ctx;
+  sf->in_fd = (uv_file)lua_tointeger(co, 2);
+  sf->out_fd = (uv_file)out_fd;
+  sf->offset = (int64_t)offset;
+  sf->remaining = (size_t)len;
+  sf->poll_fd = -1;
+
+  /* Behind queued writes: lunet_write_cb starts it once they are sent */
+  if (!ctx->client.write_inflight) {
+    rc = sendfile_issue(sf);
+    if (rc < 0) {
+      lunet_free(sf);
+      lua_pushnil(co);
+      lua_pushstring(co, uv_strerror(rc));
+      return 2;
+    }
+  }
+
+  ctx->client.sendfile = sf;
+  socket_ctx_retain(ctx);
+  lunet_coref_create(co, sf->co_ref);
   return lua_yield(co, 0);
+#endif
 }
 
 typedef struct {
@@ -1057,13 +2742,33 @@ typedef struct {
   socket_ctx_t *ctx;
   lua_State *co;
   int co_ref;
+  lunet_timer_t deadline;
   char err[256];
 } connect_ctx_t;
 
+/* A connect cannot be cancelled on its own: resume the caller, then close
+ * the half-open socket, which makes connect_cb run with UV_ECANCELED */
+static void lunet_connect_timeout_cb(lunet_timer_t *timer) {
+  connect_ctx_t *ctx = (connect_ctx_t *)timer->data;
+  if (ctx->co_ref == LUA_NOREF) return;
+
+  int co_ref = ctx->co_ref;
+  ctx->co_ref = LUA_NOREF;
+  socket_close_now(ctx->ctx);
+  socket_resume_timeout(ctx->co, co_ref, 2, "connect timeout");
+}
+
 static void lunet_connect_cb(uv_connect_t *req, int status) {
   connect_ctx_t *ctx = (connect_ctx_t *)req->data;
   lua_State *co = ctx->co;
 
+  lunet_timer_stop(&ctx->deadline);
+  if (ctx->co_ref == LUA_NOREF) {
+    /* Timed out: the caller was resumed and the socket is closing */
+    lunet_free_nonnull(ctx);
+    return;
+  }
+
   // resume coroutine
   lua_rawgeti(co, LUA_REGISTRYINDEX, ctx->co_ref);
   lunet_coref_release(co, ctx->co_ref);
@@ -1095,10 +2800,26 @@ int lunet_socket_connect(lua_State *L) {
 
   const char *host = luaL_checkstring(L, 1);
   int port = luaL_checkinteger(L, 2);
+  uint64_t timeout_ms = socket_timeout_arg(L, 3);
+  socket_opts_t opts;
+  socket_opts_init(&opts);
+  if (lua_istable(L, 4)) {
+    const char *bad = socket_opts_parse(L, 4, &opts);
+    if (bad) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "invalid %s option", bad);
+      return 2;
+    }
+  }
 
   socket_domain_t domain = SOCKET_DOMAIN_TCP;
   if (strchr(host, '/') != NULL) {
       domain = SOCKET_DOMAIN_UNIX;
+      if (socket_opts_tcp_only(&opts)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "nodelay, keepalive, sndbuf, rcvbuf and fastopen are only supported for tcp");
+        return 2;
+      }
   } else {
       if (port < 1 || port > 65535) {
         lua_pushnil(L);
@@ -1124,13 +2845,19 @@ int lunet_socket_connect(lua_State *L) {
   ctx->ref_count = 1;
   ctx->client.read_ref = LUA_NOREF;
   ctx->client.write_ref = LUA_NOREF;
+  socket_client_init_io(ctx);
   socket_ctx_init_canary(ctx);
 
   int ret = 0;
   if (domain == SOCKET_DOMAIN_TCP) {
-      ret = uv_tcp_init(uv_default_loop(), &ctx->u.tcp);
+      /* Options go on before connect (SYN window, TFO), which needs the fd */
+      if (socket_opts_tcp_only(&opts)) {
+        ret = uv_tcp_init_ex(lunet_loop(), &ctx->u.tcp, AF_INET);
+      } else {
+        ret = uv_tcp_init(lunet_loop(), &ctx->u.tcp);
+      }
   } else {
-      ret = uv_pipe_init(uv_default_loop(), &ctx->u.pipe, 0);
+      ret = uv_pipe_init(lunet_loop(), &ctx->u.pipe, 0);
   }
 
   if (ret < 0) {
@@ -1142,6 +2869,16 @@ int lunet_socket_connect(lua_State *L) {
 
   ctx->u.handle.data = ctx;
 
+  if (domain == SOCKET_DOMAIN_TCP) {
+      const char *what = NULL;
+      if ((ret = socket_opts_apply(ctx, &opts, &what)) < 0) {
+        uv_close(&ctx->u.handle, lunet_close_cb);
+        lua_pushnil(L);
+        lua_pushfstring(L, "failed to set %s: %s", what, uv_strerror(ret));
+        return 2;
+      }
+  }
+
   connect_ctx_t *connect_ctx = lunet_alloc(sizeof(connect_ctx_t));
   if (!connect_ctx) {
     uv_close(&ctx->u.handle, lunet_close_cb);
@@ -1154,6 +2891,7 @@ int lunet_socket_connect(lua_State *L) {
   connect_ctx->co = L;
   connect_ctx->co_ref = LUA_NOREF;
   connect_ctx->req.data = connect_ctx;
+  lunet_timer_init(&connect_ctx->deadline, lunet_connect_timeout_cb, connect_ctx);
 
   // save coroutine reference, for resume in connect_cb
   lunet_coref_create(L, connect_ctx->co_ref);
@@ -1188,14 +2926,109 @@ int lunet_socket_connect(lua_State *L) {
     return 2;
   }
 
+  socket_deadline_arm(&connect_ctx->deadline, timeout_ms);
+
   // yield to wait for connection to complete
   return lua_yield(L, 0);
 }
 
-int lunet_socket_set_read_buffer_size(lua_State *L) {
-  if (lua_isnumber(L, 1)) {
-    read_buffer_size = lua_tointeger(L, 1);
+/*
+ * socket.setopt(handle, opts): tune a connection, or change what a listener
+ * applies to connections it accepts from now on. Returns nil or an error.
+ */
+int lunet_socket_setopt(lua_State *L) {
+  if (!lua_islightuserdata(L, 1)) {
+    lua_pushstring(L, "invalid socket handle");
+    return 1;
+  }
+  socket_ctx_t *ctx = (socket_ctx_t *)lua_touserdata(L, 1);
+  if (!ctx || ctx->closing) {
+    lua_pushstring(L, "invalid socket handle");
+    return 1;
+  }
+  luaL_checktype(L, 2, LUA_TTABLE);
+  if (ctx->domain != SOCKET_DOMAIN_TCP) {
+    lua_pushstring(L, "socket options are only supported for tcp");
+    return 1;
   }
+
+  socket_opts_t opts;
+  socket_opts_init(&opts);
+  const char *bad = socket_opts_parse(L, 2, &opts);
+  if (bad) {
+    lua_pushfstring(L, "invalid %s option", bad);
+    return 1;
+  }
+  if (opts.backlog >= 0 || opts.fastopen >= 0) {
+    lua_pushstring(L, "backlog and fastopen can only be set by socket.listen/socket.connect");
+    return 1;
+  }
+
+  if (ctx->type == SOCKET_SERVER) {
+    socket_opts_t *cur = &ctx->server.accept_opts;
+    if (opts.nodelay >= 0) cur->nodelay = opts.nodelay;
+    if (opts.keepalive >= 0) cur->keepalive = opts.keepalive;
+    if (opts.sndbuf > 0) cur->sndbuf = opts.sndbuf;
+    if (opts.rcvbuf > 0) cur->rcvbuf = opts.rcvbuf;
+    lua_pushnil(L);
+    return 1;
+  }
+
+  const char *what = NULL;
+  int ret = socket_opts_apply(ctx, &opts, &what);
+  if (ret < 0) {
+    lua_pushfstring(L, "failed to set %s: %s", what, uv_strerror(ret));
+    return 1;
+  }
+  lua_pushnil(L);
+  return 1;
+}
+
+int lunet_socket_set_write_high_water(lua_State *L) {
+  lua_Number n = luaL_checknumber(L, 1);
+  if (!(n >= 0)) return luaL_argerror(L, 1, "high water must not be negative");
+  write_high_water = n >= (lua_Number)(SIZE_MAX / 2) ? SIZE_MAX / 2 : (size_t)n;
+  lua_pushnil(L);
+  return 1;
+}
+
+int lunet_socket_set_close_timeout(lua_State *L) {
+  lua_Number ms = luaL_checknumber(L, 1);
+  if (!(ms >= 0)) return luaL_argerror(L, 1, "timeout must not be negative");
+  close_drain_ms = ms >= (lua_Number)SOCKET_TIMEOUT_MAX_MS ? SOCKET_TIMEOUT_MAX_MS : (uint64_t)ms;
+  lua_pushnil(L);
+  return 1;
+}
+
+int lunet_socket_set_read_buffer_size(lua_State *L) {
+  lua_Number n = luaL_checknumber(L, 1);
+  if (!(n >= 1)) return luaL_argerror(L, 1, "size must be positive");
+  /* libuv reports a read's length as an int on some platforms */
+  read_buffer_size = n >= (lua_Number)INT_MAX ? (size_t)INT_MAX : (size_t)n;
   lua_pushnil(L);
   return 1;
 }
+
+// socket.read_pool_stats() -> {hits, misses, evictions, classes = {{size, free}, ...}}
+int lunet_socket_read_pool_stats(lua_State *L) {
+  lua_createtable(L, 0, 4);
+  lua_pushnumber(L, (lua_Number)read_pool_hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushnumber(L, (lua_Number)read_pool_misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushnumber(L, (lua_Number)read_pool_evictions);
+  lua_setfield(L, -2, "evictions");
+  lua_createtable(L, READ_POOL_CLASSES, 0);
+  int n = 0;
+  for (int i = 0; i < READ_POOL_CLASSES; i++) {
+    if (read_pool[i].size == 0) continue;
+    lua_createtable(L, 0, 2);
+    lua_pushinteger(L, (lua_Integer)read_pool[i].size);
+    lua_setfield(L, -2, "size");
+    lua_pushinteger(L, read_pool[i].free_count);
+    lua_setfield(L, -2, "free");
+    lua_rawseti(L, -2, ++n);
+  }
+  lua_setfield(L, -2, "classes");
+  return 1;
+}
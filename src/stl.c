@@ -3,44 +3,65 @@
 #include <stdlib.h>
 #include "lunet_mem.h"
 
+#define QUEUE_MIN_CAP 16
+
 // Initialize queue
 queue_t* queue_init(void) {
   queue_t* queue = (queue_t*)lunet_alloc(sizeof(queue_t));
   if (!queue) return NULL;
-  queue->head = NULL;
-  queue->tail = NULL;
+  queue->items = NULL;
+  queue->cap = 0;
+  queue->head = 0;
   queue->size = 0;
+  queue->limit = 0;
+  queue->dropped = 0;
   return queue;
 }
 
 // Destroy queue (does not free user data)
 void queue_destroy(queue_t* queue) {
   if (!queue) return;
+  if (queue->items) lunet_free(queue->items);
+  lunet_free(queue);
+}
+
+void queue_set_limit(queue_t* queue, size_t limit) {
+  if (queue) queue->limit = limit;
+}
+
+size_t queue_dropped(queue_t* queue) { return queue ? queue->dropped : 0; }
+
+// Move the elements into a ring of new_cap slots, unwrapping at index 0
+static int queue_resize(queue_t* queue, size_t new_cap) {
+  void** items = (void**)lunet_alloc(new_cap * sizeof(void*));
+  if (!items) return -1;
 
-  while (!queue_is_empty(queue)) {
-    queue_dequeue(queue);
+  size_t mask = queue->cap - 1;
+  for (size_t i = 0; i < queue->size; i++) {
+    items[i] = queue->items[(queue->head + i) & mask];
   }
-  lunet_free(queue);
+  if (queue->items) lunet_free(queue->items);
+  queue->items = items;
+  queue->cap = new_cap;
+  queue->head = 0;
+  return 0;
 }
 
 // Enqueue (add to tail)
 int queue_enqueue(queue_t* queue, void* data) {
   if (!queue) return -1;
 
-  queue_node_t* node = (queue_node_t*)lunet_alloc(sizeof(queue_node_t));
-  if (!node) return -1;  // memory allocation failed
-
-  node->data = data;
-  node->next = NULL;
+  if (queue->limit && queue->size >= queue->limit) {
+    queue->dropped++;
+    return -1;
+  }
 
-  if (queue->tail) {
-    queue->tail->next = node;
-  } else {
-    // queue is empty, new node is both head and tail
-    queue->head = node;
+  if (queue->size == queue->cap) {
+    size_t new_cap = queue->cap ? queue->cap * 2 : QUEUE_MIN_CAP;
+    if (queue_resize(queue, new_cap) != 0) return -1;  // memory allocation failed
   }
 
-  queue->tail = node;
+  queue->items[(queue->head + queue->size) & (queue->cap - 1)] = data;
   queue->size++;
   return 0;
 }
@@ -51,17 +72,14 @@ void* queue_dequeue(queue_t* queue) {
     return NULL;
   }
 
-  queue_node_t* node = queue->head;
-  void* data = node->data;
+  void* data = queue->items[queue->head];
+  queue->head = (queue->head + 1) & (queue->cap - 1);
+  queue->size--;
 
-  queue->head = node->next;
-  if (!queue->head) {
-    // queue becomes empty, tail pointer should also be null
-    queue->tail = NULL;
+  // Give memory back after a burst; a failed shrink just keeps the larger ring
+  if (queue->cap > QUEUE_MIN_CAP && queue->size < queue->cap / 4) {
+    queue_resize(queue, queue->cap / 2);
   }
-
-  lunet_free_nonnull(node);
-  queue->size--;
   return data;
 }
 
@@ -71,11 +89,11 @@ void* queue_peek(queue_t* queue) {
     return NULL;
   }
 
-  return queue->head->data;
+  return queue->items[queue->head];
 }
 
 // Check if queue is empty
-bool queue_is_empty(queue_t* queue) { return !queue || queue->head == NULL; }
+bool queue_is_empty(queue_t* queue) { return !queue || queue->size == 0; }
 
 // Get queue size
 size_t queue_size(queue_t* queue) { return queue ? queue->size : 0; }
@@ -0,0 +1,117 @@
+#include "stmt_cache.h"
+
+#include <string.h>
+#include "lunet_mem.h"
+
+// FNV-1a; statements are short and hot, so a cheap hash is enough to skip
+// almost every string compare during the list walk
+static uint64_t stmt_cache_hash(const char* sql, size_t len) {
+  uint64_t h = 1469598103934665603ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)sql[i];
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static void stmt_cache_unlink(stmt_cache_t* cache, stmt_cache_entry_t* e) {
+  if (e->prev) e->prev->next = e->next;
+  else cache->head = e->next;
+  if (e->next) e->next->prev = e->prev;
+  else cache->tail = e->prev;
+  e->prev = e->next = NULL;
+}
+
+static void stmt_cache_push_front(stmt_cache_t* cache, stmt_cache_entry_t* e) {
+  e->prev = NULL;
+  e->next = cache->head;
+  if (cache->head) cache->head->prev = e;
+  cache->head = e;
+  if (!cache->tail) cache->tail = e;
+}
+
+static stmt_cache_entry_t* stmt_cache_find(stmt_cache_t* cache, const char* sql, size_t len, uint64_t h) {
+  for (stmt_cache_entry_t* e = cache->head; e; e = e->next) {
+    if (e->hash == h && e->sql_len == len && memcmp(e->sql, sql, len) == 0) return e;
+  }
+  return NULL;
+}
+
+static void stmt_cache_release(stmt_cache_t* cache, stmt_cache_entry_t* e) {
+  if (cache->free_fn) cache->free_fn(e->stmt, cache->ud);
+  cache->count--;
+  lunet_free_nonnull(e);
+}
+
+void stmt_cache_init(stmt_cache_t* cache, size_t cap, stmt_cache_free_fn free_fn, void* ud) {
+  memset(cache, 0, sizeof(*cache));
+  cache->cap = cap > STMT_CACHE_MAX_CAP ? STMT_CACHE_MAX_CAP : cap;
+  cache->free_fn = free_fn;
+  cache->ud = ud;
+}
+
+void* stmt_cache_get(stmt_cache_t* cache, const char* sql, size_t sql_len) {
+  if (cache->cap == 0) return NULL;
+  stmt_cache_entry_t* e = stmt_cache_find(cache, sql, sql_len, stmt_cache_hash(sql, sql_len));
+  if (!e) {
+    cache->misses++;
+    return NULL;
+  }
+  cache->hits++;
+  if (e != cache->head) {
+    stmt_cache_unlink(cache, e);
+    stmt_cache_push_front(cache, e);
+  }
+  return e->stmt;
+}
+
+int stmt_cache_put(stmt_cache_t* cache, const char* sql, size_t sql_len, void* stmt) {
+  if (cache->cap == 0) return -1;
+  stmt_cache_entry_t* e = lunet_alloc(sizeof(stmt_cache_entry_t) + sql_len + 1);
+  if (!e) return -1;
+  e->hash = stmt_cache_hash(sql, sql_len);
+  e->sql_len = sql_len;
+  e->stmt = stmt;
+  memcpy(e->sql, sql, sql_len);
+  e->sql[sql_len] = '\0';
+
+  while (cache->count >= cache->cap && cache->tail) {
+    stmt_cache_entry_t* victim = cache->tail;
+    stmt_cache_unlink(cache, victim);
+    stmt_cache_release(cache, victim);
+    cache->evictions++;
+  }
+  stmt_cache_push_front(cache, e);
+  cache->count++;
+  return 0;
+}
+
+void stmt_cache_evict(stmt_cache_t* cache, const char* sql, size_t sql_len) {
+  stmt_cache_entry_t* e = stmt_cache_find(cache, sql, sql_len, stmt_cache_hash(sql, sql_len));
+  if (!e) return;
+  stmt_cache_unlink(cache, e);
+  stmt_cache_release(cache, e);
+  cache->evictions++;
+}
+
+void stmt_cache_clear(stmt_cache_t* cache) {
+  while (cache->head) {
+    stmt_cache_entry_t* e = cache->head;
+    stmt_cache_unlink(cache, e);
+    stmt_cache_release(cache, e);
+  }
+}
+
+void stmt_cache_push_stats(lua_State* L, const stmt_cache_t* cache) {
+  lua_createtable(L, 0, 5);
+  lua_pushinteger(L, (lua_Integer)cache->count);
+  lua_setfield(L, -2, "size");
+  lua_pushinteger(L, (lua_Integer)cache->cap);
+  lua_setfield(L, -2, "capacity");
+  lua_pushnumber(L, (lua_Number)cache->hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushnumber(L, (lua_Number)cache->misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushnumber(L, (lua_Number)cache->evictions);
+  lua_setfield(L, -2, "evictions");
+}
@@ -1,5 +1,7 @@
 #include "timer.h"
 
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <uv.h>
 
@@ -14,6 +16,7 @@
 #ifdef LUNET_TRACE
 static int timer_trace_sleep_count = 0;
 static int timer_trace_wake_count = 0;
+static int timer_trace_pool_hit_count = 0;
 
 #ifdef LUNET_TRACE_VERBOSE
 #define TIMER_TRACE_SLEEP(ctx, ms) \
@@ -30,38 +33,343 @@ static int timer_trace_wake_count = 0;
 #define TIMER_TRACE_SLEEP(ctx, ms) do { timer_trace_sleep_count++; } while(0)
 #define TIMER_TRACE_WAKE(ctx) do { timer_trace_wake_count++; } while(0)
 #endif
+#define TIMER_TRACE_POOL_HIT() do { timer_trace_pool_hit_count++; } while(0)
 
 void lunet_timer_trace_summary(void) {
-    fprintf(stderr, "[TIMER_TRACE] SUMMARY: sleep=%d wake=%d\n",
-            timer_trace_sleep_count, timer_trace_wake_count);
+    fprintf(stderr, "[TIMER_TRACE] SUMMARY: sleep=%d wake=%d pool_hits=%d\n",
+            timer_trace_sleep_count, timer_trace_wake_count, timer_trace_pool_hit_count);
 }
 
 #else /* !LUNET_TRACE */
 #define TIMER_TRACE_SLEEP(ctx, ms) ((void)0)
 #define TIMER_TRACE_WAKE(ctx) ((void)0)
+#define TIMER_TRACE_POOL_HIT() ((void)0)
 /* lunet_timer_trace_summary provided by timer.h as static inline */
 #endif
 
+/*
+ * Hierarchical wheel (Varghese & Lauck). Level 0 has one slot per 1 ms tick
+ * for the next 256 ms; each higher level has 64 slots, each spanning a whole
+ * turn of the level below. When level 0 wraps, the next slot of level 1 is
+ * cascaded: its entries are re-placed by their exact due time. Timers already
+ * due when started go on a pending list that runs on the next pass, so a
+ * callback re-arming with 0 cannot starve the loop.
+ */
+#define WHEEL_LEVELS 4
+#define WHEEL_L0_BITS 8
+#define WHEEL_LN_BITS 6
+#define WHEEL_L0_SLOTS (1 << WHEEL_L0_BITS)
+#define WHEEL_LN_SLOTS (1 << WHEEL_LN_BITS)
+#define WHEEL_SLOTS (WHEEL_L0_SLOTS + (WHEEL_LEVELS - 1) * WHEEL_LN_SLOTS)
+#define WHEEL_PENDING WHEEL_SLOTS
+#define WHEEL_MAX_DELTA (((uint64_t)1 << (WHEEL_L0_BITS + (WHEEL_LEVELS - 1) * WHEEL_LN_BITS)) - 1)
+
 typedef struct {
-  uv_timer_t timer;
+  uv_timer_t handle;
+  int inited;
+  int handle_open;      /* initialized and not closing */
+  int closing;
+  int running;          /* inside wheel_run: reschedule once at the end */
+  uint64_t current;     /* next tick to process */
+  uint64_t scheduled;   /* due time the handle is armed for */
+  int counts[WHEEL_LEVELS + 1];  /* last entry counts the pending list */
+  int total;
+  lunet_timer_link_t slots[WHEEL_SLOTS + 1];
+} timer_wheel_t;
+
+static LUNET_THREAD_LOCAL timer_wheel_t t_wheel;
+
+static void wheel_schedule(timer_wheel_t *w);
+static void sleep_pool_drain(void);
+
+static inline int wheel_shift(int level) {
+  return level == 0 ? 0 : WHEEL_L0_BITS + (level - 1) * WHEEL_LN_BITS;
+}
+
+static inline int wheel_slot(int level, uint64_t tick) {
+  if (level == 0) return (int)(tick & (WHEEL_L0_SLOTS - 1));
+  return WHEEL_L0_SLOTS + (level - 1) * WHEEL_LN_SLOTS +
+         (int)((tick >> wheel_shift(level)) & (WHEEL_LN_SLOTS - 1));
+}
+
+static inline int wheel_level_of(int slot) {
+  if (slot == WHEEL_PENDING) return WHEEL_LEVELS;
+  if (slot < WHEEL_L0_SLOTS) return 0;
+  return 1 + (slot - WHEEL_L0_SLOTS) / WHEEL_LN_SLOTS;
+}
+
+static inline int list_empty(const lunet_timer_link_t *head) { return head->next == head; }
+
+static inline void list_init(lunet_timer_link_t *head) { head->next = head->prev = head; }
+
+static inline void list_push(lunet_timer_link_t *head, lunet_timer_link_t *link) {
+  link->prev = head->prev;
+  link->next = head;
+  head->prev->next = link;
+  head->prev = link;
+}
+
+static inline void list_unlink(lunet_timer_link_t *link) {
+  link->prev->next = link->next;
+  link->next->prev = link->prev;
+  link->next = link->prev = link;
+}
+
+/* Moves every entry of src onto the empty list dst */
+static void list_move(lunet_timer_link_t *src, lunet_timer_link_t *dst) {
+  list_init(dst);
+  if (list_empty(src)) return;
+  dst->next = src->next;
+  dst->prev = src->prev;
+  dst->next->prev = dst;
+  dst->prev->next = dst;
+  list_init(src);
+}
+
+static timer_wheel_t *wheel_get(void) {
+  timer_wheel_t *w = &t_wheel;
+  if (!w->inited) {
+    for (int i = 0; i <= WHEEL_SLOTS; i++) list_init(&w->slots[i]);
+    w->inited = 1;
+  }
+  return w;
+}
+
+static void wheel_place(timer_wheel_t *w, lunet_timer_t *t) {
+  int slot;
+  if (t->due < w->current) {
+    slot = WHEEL_PENDING;
+  } else {
+    uint64_t delta = t->due - w->current;
+    uint64_t at = t->due;
+    if (delta > WHEEL_MAX_DELTA) at = w->current + WHEEL_MAX_DELTA;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 &&
+           (at - w->current) >> wheel_shift(level + 1) != 0) {
+      level++;
+    }
+    slot = wheel_slot(level, at);
+  }
+  t->slot = slot;
+  list_push(&w->slots[slot], &t->link);
+  w->counts[wheel_level_of(slot)]++;
+  w->total++;
+}
+
+static void wheel_remove(timer_wheel_t *w, lunet_timer_t *t) {
+  list_unlink(&t->link);
+  w->counts[wheel_level_of(t->slot)]--;
+  w->total--;
+  t->slot = -1;
+}
+
+static void wheel_cascade(timer_wheel_t *w, int level, uint64_t tick) {
+  lunet_timer_link_t tmp;
+  list_move(&w->slots[wheel_slot(level, tick)], &tmp);
+  while (!list_empty(&tmp)) {
+    lunet_timer_t *t = (lunet_timer_t *)tmp.next;
+    wheel_remove(w, t);
+    wheel_place(w, t);
+  }
+}
+
+/* Runs the entries of one list. Detached first: callbacks may stop entries
+ * that are still waiting here, and re-arm into the slot being drained. */
+static void wheel_fire(timer_wheel_t *w, lunet_timer_link_t *head) {
+  lunet_timer_link_t tmp;
+  list_move(head, &tmp);
+  while (!list_empty(&tmp)) {
+    lunet_timer_t *t = (lunet_timer_t *)tmp.next;
+    wheel_remove(w, t);
+    t->cb(t);
+  }
+}
+
+static void wheel_advance(timer_wheel_t *w, uint64_t now) {
+  while (w->current <= now && w->total > w->counts[WHEEL_LEVELS]) {
+    /* Skip whole turns of empty lower levels */
+    int lowest = 0;
+    while (lowest < WHEEL_LEVELS && w->counts[lowest] == 0) lowest++;
+    if (lowest > 0) {
+      uint64_t span = (uint64_t)1 << wheel_shift(lowest);
+      uint64_t next = (w->current + span - 1) & ~(span - 1);
+      if (next > now) {
+        w->current = now + 1;
+        return;
+      }
+      w->current = next;
+    }
+
+    uint64_t tick = w->current;
+    for (int level = 1; level < WHEEL_LEVELS; level++) {
+      if (tick & (((uint64_t)1 << wheel_shift(level)) - 1)) break;
+      wheel_cascade(w, level, tick);
+    }
+    w->current = tick + 1;
+    wheel_fire(w, &w->slots[wheel_slot(0, tick)]);
+  }
+  if (w->current <= now) w->current = now + 1;
+}
+
+/* Earliest tick at which something fires or cascades; an upper level can
+ * cascade before the first non-empty level-0 slot */
+static uint64_t wheel_next_due(timer_wheel_t *w) {
+  if (w->counts[WHEEL_LEVELS] > 0) return 0;
+  uint64_t best = UINT64_MAX;
+  if (w->counts[0] > 0) {
+    for (uint64_t i = 0; i < WHEEL_L0_SLOTS; i++) {
+      if (!list_empty(&w->slots[wheel_slot(0, w->current + i)])) {
+        best = w->current + i;
+        break;
+      }
+    }
+  }
+  for (int level = 1; level < WHEEL_LEVELS; level++) {
+    if (w->counts[level] == 0) continue;
+    uint64_t span = (uint64_t)1 << wheel_shift(level);
+    uint64_t tick = (w->current + span - 1) & ~(span - 1);
+    for (int i = 0; i < WHEEL_LN_SLOTS && tick < best; i++, tick += span) {
+      if (!list_empty(&w->slots[wheel_slot(level, tick)])) {
+        best = tick;
+        break;
+      }
+    }
+  }
+  return best;
+}
+
+static void wheel_handle_close_cb(uv_handle_t *handle) {
+  timer_wheel_t *w = (timer_wheel_t *)handle->data;
+  w->closing = 0;
+  if (w->total > 0) {
+    wheel_schedule(w);
+  } else {
+    /* Nothing is sleeping: give the pooled entries back so the loop ends
+     * with no allocations outstanding */
+    sleep_pool_drain();
+  }
+}
+
+static void wheel_handle_cb(uv_timer_t *handle) {
+  timer_wheel_t *w = (timer_wheel_t *)handle->data;
+  w->running = 1;
+  wheel_fire(w, &w->slots[WHEEL_PENDING]);
+  wheel_advance(w, uv_now(handle->loop));
+  w->running = 0;
+  w->scheduled = UINT64_MAX;
+  wheel_schedule(w);
+}
+
+static void wheel_schedule(timer_wheel_t *w) {
+  if (w->running || w->closing) return;
+  if (w->total == 0) {
+    if (w->handle_open) {
+      w->handle_open = 0;
+      w->closing = 1;
+      uv_close((uv_handle_t *)&w->handle, wheel_handle_close_cb);
+    }
+    return;
+  }
+  if (!w->handle_open) {
+    uv_timer_init(lunet_loop(), &w->handle);
+    w->handle.data = w;
+    w->handle_open = 1;
+    w->scheduled = UINT64_MAX;
+  }
+  uint64_t due = wheel_next_due(w);
+  if (due >= w->scheduled && uv_is_active((uv_handle_t *)&w->handle)) return;
+  uint64_t now = uv_now(lunet_loop());
+  w->scheduled = due;
+  uv_timer_start(&w->handle, wheel_handle_cb, due > now ? due - now : 0, 0);
+}
+
+void lunet_timer_init(lunet_timer_t *timer, lunet_timer_cb cb, void *data) {
+  timer->link.next = timer->link.prev = &timer->link;
+  timer->due = 0;
+  timer->cb = cb;
+  timer->data = data;
+  timer->slot = -1;
+}
+
+int lunet_timer_start(lunet_timer_t *timer, uint64_t timeout_ms) {
+  timer_wheel_t *w = wheel_get();
+  if (timer->slot >= 0) wheel_remove(w, timer);
+  uint64_t now = uv_now(lunet_loop());
+  /* An empty wheel restarts from now instead of walking the idle gap */
+  if (w->total == 0 && !w->running) w->current = now;
+  timer->due = now + timeout_ms;
+  wheel_place(w, timer);
+  wheel_schedule(w);
+  return 0;
+}
+
+void lunet_timer_stop(lunet_timer_t *timer) {
+  if (timer->slot < 0) return;
+  timer_wheel_t *w = wheel_get();
+  wheel_remove(w, timer);
+  /* Leave the handle armed; an early wake-up re-arms or closes it */
+  if (w->total == 0) wheel_schedule(w);
+}
+
+/*
+ * lunet.sleep entries are pooled per thread: a steady sleep rate allocates
+ * nothing once the pool is warm.
+ */
+#define SLEEP_POOL_MAX 1024
+
+typedef struct sleep_ctx {
+  lunet_timer_t timer;
   lua_State *L;
   int co_ref;
+  struct sleep_ctx *next_free;
 } sleep_ctx_t;
 
-static void lunet_sleep_close_cb(uv_handle_t *handle) {
-  /* handle->data is sleep_ctx_t* */
-  lunet_free_nonnull(handle->data);
+static LUNET_THREAD_LOCAL sleep_ctx_t *t_sleep_free;
+static LUNET_THREAD_LOCAL int t_sleep_nfree;
+
+static sleep_ctx_t *sleep_ctx_get(void) {
+  sleep_ctx_t *ctx = t_sleep_free;
+  if (ctx) {
+    t_sleep_free = ctx->next_free;
+    t_sleep_nfree--;
+    TIMER_TRACE_POOL_HIT();
+    return ctx;
+  }
+  return lunet_alloc(sizeof(sleep_ctx_t));
+}
+
+static void sleep_ctx_put(sleep_ctx_t *ctx) {
+  if (t_sleep_nfree >= SLEEP_POOL_MAX) {
+    lunet_free_nonnull(ctx);
+    return;
+  }
+  ctx->next_free = t_sleep_free;
+  t_sleep_free = ctx;
+  t_sleep_nfree++;
 }
 
-static void lunet_sleep_cb(uv_timer_t *timer) {
+static void sleep_pool_drain(void) {
+  while (t_sleep_free) {
+    sleep_ctx_t *ctx = t_sleep_free;
+    t_sleep_free = ctx->next_free;
+    lunet_free_nonnull(ctx);
+  }
+  t_sleep_nfree = 0;
+}
+
+static void lunet_sleep_cb(lunet_timer_t *timer) {
   sleep_ctx_t *ctx = (sleep_ctx_t *)timer->data;
   lua_State *L = ctx->L;
+  int co_ref = ctx->co_ref;
 
   TIMER_TRACE_WAKE(ctx);
 
+  /* Back to the pool first so the resumed coroutine's next sleep reuses it */
+  sleep_ctx_put(ctx);
+
   // get coroutine reference from registry
-  lua_rawgeti(L, LUA_REGISTRYINDEX, ctx->co_ref);
-  lunet_coref_release(L, ctx->co_ref);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, co_ref);
+  lunet_coref_release(L, co_ref);
 
   if (lua_isthread(L, -1) == 0) {
     lua_pop(L, 1);  // pop invalid coroutine
@@ -73,10 +381,6 @@ static void lunet_sleep_cb(uv_timer_t *timer) {
   lua_pop(L, 1);
 
   lunet_co_resume(co, 0);
-
-  /* Stop + close the timer handle, free ctx in close cb. */
-  uv_timer_stop(&ctx->timer);
-  uv_close((uv_handle_t *)&ctx->timer, lunet_sleep_close_cb);
 }
 // sleep for ms milliseconds
 int lunet_sleep(lua_State *co) {
@@ -90,7 +394,7 @@ int lunet_sleep(lua_State *co) {
     return lua_error(co);
   }
 
-  sleep_ctx_t *ctx = lunet_alloc(sizeof(sleep_ctx_t));
+  sleep_ctx_t *ctx = sleep_ctx_get();
   if (!ctx) {
     lua_pushstring(co, "lunet.sleep: out of memory");
     return lua_error(co);
@@ -102,10 +406,8 @@ int lunet_sleep(lua_State *co) {
   // Thread already on stack from xmove, use raw variant
   lunet_coref_create_raw(ctx->L, ctx->co_ref);
 
-  // init timer
-  uv_timer_init(uv_default_loop(), &ctx->timer);
-  ctx->timer.data = ctx;
-  uv_timer_start(&ctx->timer, lunet_sleep_cb, ms, 0);
+  lunet_timer_init(&ctx->timer, lunet_sleep_cb, ctx);
+  lunet_timer_start(&ctx->timer, (uint64_t)ms);
 
   TIMER_TRACE_SLEEP(ctx, ms);
 
@@ -9,16 +9,20 @@
 #include <sys/socket.h>
 #endif
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <uv.h>
 
+#include "buffer.h"
 #include "co.h"
 #include "rt.h"
 #include "stl.h"
+#include "timer.h"
 #include "trace.h"
 #include "lunet_mem.h"
+#include "paxe.h"
 
 /*
  * UDP Context Structure
@@ -29,6 +33,18 @@ typedef struct {
   queue_t *pending;
   lua_State *co;
   int recv_ref;
+  int recv_batch_max;   /* >0 when the waiter came from recv_batch */
+  lunet_timer_t recv_deadline;  /* armed while a recv with a timeout waits */
+  int raw_addr;         /* report peers as binary address tokens */
+  int buffers;          /* deliver payloads as lunet.buffer instead of strings */
+  /* Set by {paxe = true}: datagrams are decrypted/encrypted in C */
+  const paxe_udp_hooks_t *paxe;
+  uint32_t paxe_key;
+  int paxe_has_key;
+  /* Receive slab reused by every recv; holds several datagrams with recvmmsg */
+  char *slab;
+  size_t slab_len;
+  int slab_busy;
 #ifdef LUNET_TRACE
   int trace_tx;
   int trace_rx;
@@ -84,6 +100,9 @@ static void udp_bk_cancel(udp_ctx_t *ctx) {
 
 #ifdef LUNET_TRACE_VERBOSE
 
+/* Raw-address tokens start with a non-printable tag byte */
+#define UDP_TRACE_HOST(h) ((unsigned char)(h)[0] < 0x20 ? "<raw>" : (h))
+
 static void udp_trace_bind_actual(uv_udp_t *handle) {
     struct sockaddr_storage addr;
     int namelen = sizeof(addr);
@@ -117,7 +136,7 @@ static void udp_trace_bind_actual(uv_udp_t *handle) {
         udp_trace_tx_count++; \
         (ctx)->trace_tx++; \
         fprintf(stderr, "[UDP_TRACE] TX #%d -> %s:%d (%zu bytes)\n", \
-                udp_trace_tx_count, (dest_host), (dest_port), (size_t)(len)); \
+                udp_trace_tx_count, UDP_TRACE_HOST(dest_host), (dest_port), (size_t)(len)); \
     } while(0)
 
 #define UDP_TRACE_RX(ctx, src_host, src_port, len) \
@@ -125,7 +144,7 @@ static void udp_trace_bind_actual(uv_udp_t *handle) {
         udp_trace_rx_count++; \
         (ctx)->trace_rx++; \
         fprintf(stderr, "[UDP_TRACE] RX #%d <- %s:%d (%zu bytes)\n", \
-                udp_trace_rx_count, (src_host), (src_port), (size_t)(len)); \
+                udp_trace_rx_count, UDP_TRACE_HOST(src_host), (src_port), (size_t)(len)); \
     } while(0)
 
 #define UDP_TRACE_RECV_WAIT() \
@@ -133,11 +152,11 @@ static void udp_trace_bind_actual(uv_udp_t *handle) {
 
 #define UDP_TRACE_RECV_RESUME(host, port, len) \
     fprintf(stderr, "[UDP_TRACE] RECV_RESUME <- %s:%d (%zu bytes)\n", \
-            (host), (port), (size_t)(len))
+            UDP_TRACE_HOST(host), (port), (size_t)(len))
 
 #define UDP_TRACE_RECV_DELIVER(host, port, len) \
     fprintf(stderr, "[UDP_TRACE] RECV_DELIVER (immediate) <- %s:%d (%zu bytes)\n", \
-            (host), (port), (size_t)(len))
+            UDP_TRACE_HOST(host), (port), (size_t)(len))
 
 #define UDP_TRACE_CLOSE(ctx) \
     fprintf(stderr, "[UDP_TRACE] CLOSE (local: tx=%d rx=%d) (global: tx=%d rx=%d)\n", \
@@ -182,116 +201,474 @@ void lunet_udp_trace_summary(void) {
 
 #endif /* LUNET_TRACE */
 
-typedef struct {
+/* A send that could not complete synchronously; the payload string stays
+ * pinned in the registry until libuv is done with it. */
+typedef struct udp_send_ctx_s {
   uv_udp_send_t req;
   uv_buf_t buf;
-  char *data;
+  udp_ctx_t *udp;
+  int data_ref;
+  char *owned;          /* copy of a buffer that can't be pinned (ciphertext) */
+  struct udp_send_ctx_s *next_free;
 } udp_send_ctx_t;
 
+#define UDP_SEND_POOL_MAX 128
+/* Datagrams handed to the kernel per try_send sweep */
+#define UDP_SEND_SWEEP 64
+
+#if UV_VERSION_HEX >= ((1 << 16) | (50 << 8) | 0)
+#define UDP_HAVE_TRY_SEND2 1
+#endif
+
+static LUNET_THREAD_LOCAL udp_send_ctx_t *udp_send_pool = NULL;
+static LUNET_THREAD_LOCAL int udp_send_pool_len = 0;
+
+/* Ciphertext staging for PAXE sockets; reused because try_send is synchronous */
+static LUNET_THREAD_LOCAL char *udp_crypt_buf = NULL;
+static LUNET_THREAD_LOCAL size_t udp_crypt_cap = 0;
+
+static char *udp_crypt_reserve(size_t len) {
+  if (len > udp_crypt_cap) {
+    char *p = (char *)lunet_realloc(udp_crypt_buf, len);
+    if (p == NULL) return NULL;
+    udp_crypt_buf = p;
+    udp_crypt_cap = len;
+  }
+  return udp_crypt_buf;
+}
+
+static udp_send_ctx_t *udp_send_ctx_get(void) {
+  udp_send_ctx_t *send_ctx = udp_send_pool;
+  if (send_ctx) {
+    udp_send_pool = send_ctx->next_free;
+    udp_send_pool_len--;
+  } else {
+    send_ctx = (udp_send_ctx_t *)lunet_alloc(sizeof(udp_send_ctx_t));
+    if (send_ctx == NULL) return NULL;
+  }
+  memset(send_ctx, 0, sizeof(*send_ctx));
+  send_ctx->data_ref = LUA_NOREF;
+  return send_ctx;
+}
+
+static void udp_send_ctx_put(udp_send_ctx_t *send_ctx) {
+  if (udp_send_pool_len >= UDP_SEND_POOL_MAX) {
+    lunet_free_nonnull(send_ctx);
+    return;
+  }
+  send_ctx->next_free = udp_send_pool;
+  udp_send_pool = send_ctx;
+  udp_send_pool_len++;
+}
+
+void lunet_udp_pool_shutdown(void) {
+  while (udp_send_pool) {
+    udp_send_ctx_t *next = udp_send_pool->next_free;
+    lunet_free_nonnull(udp_send_pool);
+    udp_send_pool = next;
+  }
+  udp_send_pool_len = 0;
+  if (udp_crypt_buf) {
+    lunet_free(udp_crypt_buf);
+    udp_crypt_buf = NULL;
+    udp_crypt_cap = 0;
+  }
+}
+
+/* A queued datagram; the payload lives in the same allocation */
 typedef struct {
-  char *data;
   size_t len;
-  char host[INET6_ADDRSTRLEN];
+  char host[INET6_ADDRSTRLEN];  /* dotted/colon text, or a raw address token */
+  unsigned char host_len;
   int port;
+  char data[];
 } udp_msg_t;
 
-static void udp_on_close(uv_handle_t *handle) { lunet_free_nonnull(handle->data); }
+/*
+ * Raw address tokens: a tag byte, the port in network order, then the
+ * address bytes (plus scope id for IPv6). They are short binary strings,
+ * so identical peers intern to the same Lua string and need no formatting.
+ */
+#define UDP_ADDR_TAG_V4 0x04
+#define UDP_ADDR_TAG_V6 0x06
+#define UDP_ADDR_TOKEN_V4_LEN (1 + 2 + 4)
+#define UDP_ADDR_TOKEN_V6_LEN (1 + 2 + 16 + 4)
 
-static void udp_alloc_cb(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
-  (void)handle;
-  char *data = (char *)lunet_alloc(suggested_size);
-  buf->base = data;
-  buf->len = suggested_size;
+static int udp_addr_encode(const struct sockaddr *addr, char *out) {
+  if (addr->sa_family == AF_INET) {
+    const struct sockaddr_in *a4 = (const struct sockaddr_in *)addr;
+    out[0] = UDP_ADDR_TAG_V4;
+    memcpy(out + 1, &a4->sin_port, 2);
+    memcpy(out + 3, &a4->sin_addr, 4);
+    return UDP_ADDR_TOKEN_V4_LEN;
+  }
+  if (addr->sa_family == AF_INET6) {
+    const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)addr;
+    uint32_t scope = a6->sin6_scope_id;
+    out[0] = UDP_ADDR_TAG_V6;
+    memcpy(out + 1, &a6->sin6_port, 2);
+    memcpy(out + 3, &a6->sin6_addr, 16);
+    memcpy(out + 19, &scope, 4);
+    return UDP_ADDR_TOKEN_V6_LEN;
+  }
+  return 0;
 }
 
-static void udp_recv_cb(uv_udp_t *handle, ssize_t nread, const uv_buf_t *buf,
-                        const struct sockaddr *addr, unsigned flags) {
-  (void)flags;
+static int udp_addr_decode(const char *tok, size_t len, struct sockaddr_storage *addr) {
+  memset(addr, 0, sizeof(*addr));
+  if (len == UDP_ADDR_TOKEN_V4_LEN && tok[0] == UDP_ADDR_TAG_V4) {
+    struct sockaddr_in *a4 = (struct sockaddr_in *)addr;
+    a4->sin_family = AF_INET;
+    memcpy(&a4->sin_port, tok + 1, 2);
+    memcpy(&a4->sin_addr, tok + 3, 4);
+    return 0;
+  }
+  if (len == UDP_ADDR_TOKEN_V6_LEN && tok[0] == UDP_ADDR_TAG_V6) {
+    struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)addr;
+    uint32_t scope;
+    a6->sin6_family = AF_INET6;
+    memcpy(&a6->sin6_port, tok + 1, 2);
+    memcpy(&a6->sin6_addr, tok + 3, 16);
+    memcpy(&scope, tok + 19, 4);
+    a6->sin6_scope_id = scope;
+    return 0;
+  }
+  return UV_EINVAL;
+}
+
+static int udp_is_token(const char *host, size_t len) {
+  return len > 0 && (host[0] == UDP_ADDR_TAG_V4 || host[0] == UDP_ADDR_TAG_V6);
+}
+
+/* Largest datagram libuv hands out per recvmmsg slot */
+#define UDP_SLOT_SIZE (64 * 1024)
+#define UDP_MAX_BATCH_SLOTS 64
+
+#if UV_VERSION_HEX >= ((1 << 16) | (37 << 8) | 0)
+#define UDP_HAVE_RECVMMSG 1
+#endif
+
+static void udp_on_close(uv_handle_t *handle) {
   udp_ctx_t *ctx = (udp_ctx_t *)handle->data;
+  if (ctx) {
+    if (ctx->slab) lunet_free(ctx->slab);
+    lunet_free_nonnull(ctx);
+  }
+}
 
-  if (nread <= 0 || addr == NULL) {
-    lunet_free_nonnull(buf->base);
+static void udp_alloc_cb(uv_handle_t *handle, size_t suggested_size, uv_buf_t *buf) {
+  (void)suggested_size;
+  udp_ctx_t *ctx = (udp_ctx_t *)handle->data;
+  /* libuv finishes one receive (or one recvmmsg batch) before asking again */
+  if (!ctx || !ctx->slab || ctx->slab_busy) {
+    buf->base = NULL;
+    buf->len = 0;
     return;
   }
+  ctx->slab_busy = 1;
+  buf->base = ctx->slab;
+  buf->len = ctx->slab_len;
+}
 
-#ifdef LUNET_TRACE
-  lua_State *expected = default_luaL();
-  if (expected && ctx && ctx->co != expected) {
-    fprintf(stderr,
-            "[UDP_TRACE] BAD_LUA_STATE ctx=%p (ctx->co=%p expected=%p)\n",
-            (void *)ctx, (void *)ctx->co, (void *)expected);
+/*
+ * With {buffers = true} each datagram is queued inside a lunet.buffer store,
+ * so delivering it wraps the bytes instead of copying them into a string.
+ */
+static udp_msg_t *udp_msg_new(udp_ctx_t *ctx, size_t len) {
+  if (ctx->buffers) {
+    lunet_buffer_store_t *store = lunet_buffer_store_new(sizeof(udp_msg_t) + len);
+    return store ? (udp_msg_t *)lunet_buffer_store_data(store) : NULL;
   }
-#endif
+  return (udp_msg_t *)lunet_alloc(sizeof(udp_msg_t) + len);
+}
 
-  udp_msg_t *msg = (udp_msg_t *)lunet_alloc(sizeof(udp_msg_t));
-  if (msg == NULL) {
-    lunet_free_nonnull(buf->base);
+static lunet_buffer_store_t *udp_msg_store(udp_msg_t *msg) {
+  return (lunet_buffer_store_t *)msg - 1;
+}
+
+static void udp_msg_free(udp_ctx_t *ctx, udp_msg_t *msg) {
+  if (ctx->buffers) {
+    lunet_buffer_store_release(udp_msg_store(msg));
+  } else {
+    lunet_free_nonnull(msg);
+  }
+}
+
+/* Push the payload and consume msg */
+static void udp_push_data(lua_State *L, udp_ctx_t *ctx, udp_msg_t *msg) {
+  if (ctx->buffers) {
+    lunet_buffer_push(L, udp_msg_store(msg), msg->data, msg->len);
+  } else {
+    lua_pushlstring(L, msg->data, msg->len);
+    lunet_free_nonnull(msg);
+  }
+}
+
+static void udp_push_msg(lua_State *L, udp_ctx_t *ctx, udp_msg_t *msg) {
+  lua_pushlstring(L, msg->host, msg->host_len);
+  lua_pushinteger(L, msg->port);
+  udp_push_data(L, ctx, msg);
+  lua_insert(L, -3);
+}
+
+/* Pop up to max queued datagrams into an array of {data, host, port} */
+static void udp_push_batch(lua_State *L, udp_ctx_t *ctx, int max) {
+  int n = (int)queue_size(ctx->pending);
+  if (n > max) n = max;
+  lua_createtable(L, n, 0);
+  for (int i = 1; i <= n; i++) {
+    udp_msg_t *msg = (udp_msg_t *)queue_dequeue(ctx->pending);
+    if (!msg) break;
+    lua_createtable(L, 3, 0);
+    lua_pushlstring(L, msg->host, msg->host_len);
+    lua_rawseti(L, -2, 2);
+    lua_pushinteger(L, msg->port);
+    lua_rawseti(L, -2, 3);
+    udp_push_data(L, ctx, msg);
+    lua_rawseti(L, -2, 1);
+    lua_rawseti(L, -2, i);
+  }
+}
+
+static void udp_wake_receiver(udp_ctx_t *ctx) {
+  lua_rawgeti(ctx->co, LUA_REGISTRYINDEX, ctx->recv_ref);
+  lunet_coref_release(ctx->co, ctx->recv_ref);
+  ctx->recv_ref = LUA_NOREF;
+  lunet_timer_stop(&ctx->recv_deadline);
+  int batch_max = ctx->recv_batch_max;
+  ctx->recv_batch_max = 0;
+  udp_bk_resume(ctx);
+
+  if (!lua_isthread(ctx->co, -1)) {
+    lua_pop(ctx->co, 1);
+    udp_bk_cancel(ctx);
     return;
   }
 
-  msg->data = buf->base;
-  msg->len = (size_t)nread;
-  msg->port = 0;
-  msg->host[0] = '\0';
+  lua_State *waiting_co = lua_tothread(ctx->co, -1);
+  lua_pop(ctx->co, 1);
 
-  if (addr->sa_family == AF_INET) {
-    const struct sockaddr_in *a4 = (const struct sockaddr_in *)addr;
-    uv_ip4_name(a4, msg->host, sizeof(msg->host));
-    msg->port = ntohs(a4->sin_port);
-  } else if (addr->sa_family == AF_INET6) {
-    const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)addr;
-    uv_ip6_name(a6, msg->host, sizeof(msg->host));
-    msg->port = ntohs(a6->sin6_port);
+  int nret = 0;
+  if (batch_max > 0) {
+    udp_push_batch(waiting_co, ctx, batch_max);
+    lua_pushnil(waiting_co);
+    nret = 2;
+  } else {
+    udp_msg_t *to_deliver = (udp_msg_t *)queue_dequeue(ctx->pending);
+    if (to_deliver != NULL) {
+      UDP_TRACE_RECV_RESUME(to_deliver->host, to_deliver->port, to_deliver->len);
+      udp_push_msg(waiting_co, ctx, to_deliver);
+      nret = 3;
+    }
+  }
+  int resume_status = lunet_co_resume(waiting_co, nret);
+  if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
+    fprintf(stderr, "udp recv resume error: %s\n", lua_tostring(waiting_co, -1));
   }
+}
+
+/* Resume the waiting receiver with "timeout"; the socket keeps receiving */
+static void udp_recv_timeout_cb(lunet_timer_t *timer) {
+  udp_ctx_t *ctx = (udp_ctx_t *)timer->data;
+  if (ctx->recv_ref == LUA_NOREF) return;
 
-  UDP_TRACE_RX(ctx, msg->host, msg->port, msg->len);
+  lua_rawgeti(ctx->co, LUA_REGISTRYINDEX, ctx->recv_ref);
+  lunet_coref_release(ctx->co, ctx->recv_ref);
+  ctx->recv_ref = LUA_NOREF;
+  int batch = ctx->recv_batch_max > 0;
+  ctx->recv_batch_max = 0;
+  udp_bk_resume(ctx);
 
-  if (queue_enqueue(ctx->pending, msg) != 0) {
-    lunet_free_nonnull(msg->data);
-    lunet_free(msg);
+  if (!lua_isthread(ctx->co, -1)) {
+    lua_pop(ctx->co, 1);
     return;
   }
+  lua_State *waiting_co = lua_tothread(ctx->co, -1);
+  lua_pop(ctx->co, 1);
+  lua_pushnil(waiting_co);
+  if (!batch) lua_pushnil(waiting_co);
+  lua_pushstring(waiting_co, "timeout");
+  int resume_status = lunet_co_resume(waiting_co, batch ? 2 : 3);
+  if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
+    fprintf(stderr, "udp recv resume error: %s\n", lua_tostring(waiting_co, -1));
+  }
+}
 
-  if (ctx->recv_ref != LUA_NOREF) {
-    lua_rawgeti(ctx->co, LUA_REGISTRYINDEX, ctx->recv_ref);
-    lunet_coref_release(ctx->co, ctx->recv_ref);
-    ctx->recv_ref = LUA_NOREF;
-    udp_bk_resume(ctx);
+/* Longest timeout honoured (~142k years); keeps now + timeout far from wrapping */
+#define UDP_TIMEOUT_MAX_MS ((uint64_t)1 << 52)
 
-    if (!lua_isthread(ctx->co, -1)) {
-      lua_pop(ctx->co, 1);
-      udp_bk_cancel(ctx);
+/* Optional timeout in ms at idx; nil, a non-number, 0, negative or NaN means wait forever */
+static uint64_t udp_timeout_arg(lua_State *L, int idx) {
+  lua_Number ms = lua_isnumber(L, idx) ? lua_tonumber(L, idx) : 0;
+  if (!(ms > 0)) return 0;
+  if (ms >= (lua_Number)UDP_TIMEOUT_MAX_MS) return UDP_TIMEOUT_MAX_MS;
+  return (uint64_t)ms;
+}
+
+static void udp_recv_cb(uv_udp_t *handle, ssize_t nread, const uv_buf_t *buf,
+                        const struct sockaddr *addr, unsigned flags) {
+  udp_ctx_t *ctx = (udp_ctx_t *)handle->data;
+  if (!ctx) return;
+
+  /* Chunks of a recvmmsg batch share the slab; the batch ends with a
+   * callback that carries no chunk flag (nread == 0 with addr == NULL). */
+  int more_chunks = 0;
+#ifdef UDP_HAVE_RECVMMSG
+  more_chunks = (flags & UV_UDP_MMSG_CHUNK) != 0;
+#else
+  (void)flags;
+#endif
+  if (!more_chunks && buf && buf->base == ctx->slab) {
+    ctx->slab_busy = 0;
+  }
+
+  if (nread > 0 && addr != NULL) {
+#ifdef LUNET_TRACE
+    lua_State *expected = default_luaL();
+    if (expected && ctx->co != expected) {
+      fprintf(stderr,
+              "[UDP_TRACE] BAD_LUA_STATE ctx=%p (ctx->co=%p expected=%p)\n",
+              (void *)ctx, (void *)ctx->co, (void *)expected);
+    }
+#endif
+
+    /* PAXE sockets decrypt in place in the receive slab; packets that fail
+     * are dropped here (and counted by paxe) so only plaintext reaches Lua. */
+    if (ctx->paxe) {
+      nread = ctx->paxe->decrypt((uint8_t *)buf->base, (size_t)nread, NULL, NULL);
+      if (nread < 0) goto wake;
+    }
+
+    udp_msg_t *msg = udp_msg_new(ctx, (size_t)nread);
+    if (msg == NULL) {
       return;
     }
 
-    lua_State *waiting_co = lua_tothread(ctx->co, -1);
-    lua_pop(ctx->co, 1);
-    udp_msg_t *to_deliver = (udp_msg_t *)queue_dequeue(ctx->pending);
-    if (to_deliver != NULL) {
-      UDP_TRACE_RECV_RESUME(to_deliver->host, to_deliver->port, to_deliver->len);
-      lua_pushlstring(waiting_co, to_deliver->data, to_deliver->len);
-      lua_pushstring(waiting_co, to_deliver->host);
-      lua_pushinteger(waiting_co, to_deliver->port);
-      lunet_free_nonnull(to_deliver->data);
-      lunet_free(to_deliver);
-      int resume_status = lunet_co_resume(waiting_co, 3);
-      if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
-        fprintf(stderr, "udp recv resume error: %s\n", lua_tostring(waiting_co, -1));
-      }
+    memcpy(msg->data, buf->base, (size_t)nread);
+    msg->len = (size_t)nread;
+    msg->port = 0;
+    msg->host[0] = '\0';
+
+    if (addr->sa_family == AF_INET) {
+      const struct sockaddr_in *a4 = (const struct sockaddr_in *)addr;
+      if (!ctx->raw_addr) uv_ip4_name(a4, msg->host, sizeof(msg->host));
+      msg->port = ntohs(a4->sin_port);
+    } else if (addr->sa_family == AF_INET6) {
+      const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)addr;
+      if (!ctx->raw_addr) uv_ip6_name(a6, msg->host, sizeof(msg->host));
+      msg->port = ntohs(a6->sin6_port);
+    }
+    if (ctx->raw_addr) {
+      msg->host_len = (unsigned char)udp_addr_encode(addr, msg->host);
     } else {
-      int resume_status = lunet_co_resume(waiting_co, 0);
-      if (resume_status != LUA_OK && resume_status != LUA_YIELD) {
-        fprintf(stderr, "udp recv resume error: %s\n", lua_tostring(waiting_co, -1));
-      }
+      msg->host_len = (unsigned char)strlen(msg->host);
+    }
+
+    UDP_TRACE_RX(ctx, msg->host, msg->port, msg->len);
+
+    if (queue_enqueue(ctx->pending, msg) != 0) {
+      udp_msg_free(ctx, msg);
+      return;
     }
   }
+
+wake:
+  if (ctx->recv_ref == LUA_NOREF || queue_is_empty(ctx->pending)) {
+    return;
+  }
+  /* A batch receiver waits for the end of the recvmmsg sweep */
+  if (ctx->recv_batch_max > 0 && more_chunks &&
+      (int)queue_size(ctx->pending) < ctx->recv_batch_max) {
+    return;
+  }
+  udp_wake_receiver(ctx);
 }
 
 static void udp_send_cb(uv_udp_send_t *req, int status) {
   (void)status;
   udp_send_ctx_t *send_ctx = (udp_send_ctx_t *)req->data;
-  lunet_free_nonnull(send_ctx->data);
-  lunet_free_nonnull(send_ctx);
+  if (send_ctx->data_ref != LUA_NOREF) {
+    lunet_coref_release(send_ctx->udp->co, send_ctx->data_ref);
+  }
+  if (send_ctx->owned) lunet_free(send_ctx->owned);
+  udp_send_ctx_put(send_ctx);
+}
+
+/* Accepts a textual host plus port, or a raw address token (port ignored) */
+static int udp_parse_addr(const char *host, size_t host_len, int port,
+                          struct sockaddr_storage *addr) {
+  if (udp_is_token(host, host_len)) {
+    return udp_addr_decode(host, host_len, addr);
+  }
+  memset(addr, 0, sizeof(*addr));
+  if (strchr(host, ':') != NULL) {
+    return uv_ip6_addr(host, port, (struct sockaddr_in6 *)addr);
+  }
+  return uv_ip4_addr(host, port, (struct sockaddr_in *)addr);
+}
+
+/*
+ * Send buf straight to the kernel with uv_udp_try_send. Only when libuv has
+ * a backlog (EAGAIN) is a pooled request queued: the Lua string at pin_idx
+ * is pinned until the send completes, or, with pin_idx == 0, buf is copied.
+ */
+static int udp_submit_buf(lua_State *co, udp_ctx_t *ctx, uv_buf_t buf,
+                          const struct sockaddr *addr, int pin_idx) {
+  int ret = uv_udp_try_send(&ctx->handle, &buf, 1, addr);
+  if (ret >= 0) return 0;
+  if (ret != UV_EAGAIN && ret != UV_ENOSYS) return ret;
+
+  udp_send_ctx_t *send_ctx = udp_send_ctx_get();
+  if (send_ctx == NULL) return UV_ENOMEM;
+  send_ctx->udp = ctx;
+  send_ctx->req.data = send_ctx;
+  if (pin_idx != 0) {
+    lua_pushvalue(co, pin_idx);
+    lunet_coref_create_raw(co, send_ctx->data_ref);
+  } else {
+    send_ctx->owned = (char *)lunet_alloc(buf.len ? buf.len : 1);
+    if (send_ctx->owned == NULL) {
+      udp_send_ctx_put(send_ctx);
+      return UV_ENOMEM;
+    }
+    memcpy(send_ctx->owned, buf.base, buf.len);
+    buf.base = send_ctx->owned;
+  }
+  send_ctx->buf = buf;
+
+  ret = uv_udp_send(&send_ctx->req, &ctx->handle, &send_ctx->buf, 1, addr, udp_send_cb);
+  if (ret < 0) {
+    if (send_ctx->data_ref != LUA_NOREF) lunet_coref_release(co, send_ctx->data_ref);
+    if (send_ctx->owned) lunet_free(send_ctx->owned);
+    udp_send_ctx_put(send_ctx);
+  }
+  return ret;
+}
+
+/* Encrypt len bytes into the staging buffer of a PAXE socket */
+static int udp_paxe_seal(udp_ctx_t *ctx, const char *data, size_t len, uv_buf_t *out) {
+  if (!ctx->paxe_has_key) return UV_EINVAL;
+  char *dst = udp_crypt_reserve(len + ctx->paxe->overhead);
+  if (dst == NULL) return UV_ENOMEM;
+  ssize_t n = ctx->paxe->encrypt(ctx->paxe_key, (const uint8_t *)data, len,
+                                 (uint8_t *)dst, len + ctx->paxe->overhead);
+  if (n < 0) return UV_EINVAL;
+  *out = uv_buf_init(dst, (unsigned int)n);
+  return 0;
+}
+
+/* Send the string or buffer at data_idx, encrypting first on PAXE sockets */
+static int udp_submit(lua_State *co, udp_ctx_t *ctx, int data_idx,
+                      const struct sockaddr *addr) {
+  size_t len = 0;
+  const char *data = lunet_buffer_tobytes(co, data_idx, &len);
+  if (ctx->paxe) {
+    uv_buf_t sealed;
+    int ret = udp_paxe_seal(ctx, data, len, &sealed);
+    if (ret < 0) return ret;
+    return udp_submit_buf(co, ctx, sealed, addr, 0);
+  }
+  return udp_submit_buf(co, ctx, uv_buf_init((char *)data, (unsigned int)len), addr, data_idx);
 }
 
 int lunet_udp_bind(lua_State *co) {
@@ -300,6 +677,58 @@ int lunet_udp_bind(lua_State *co) {
   const char *host = luaL_checkstring(co, 1);
   int port = (int)luaL_checkinteger(co, 2);
 
+  int slots = 1;
+  int raw_addr = 0;
+  int buffers = 0;
+  size_t max_pending = 0;
+  int use_paxe = 0;
+  uint32_t paxe_key = 0;
+  int paxe_has_key = 0;
+  if (lua_istable(co, 3)) {
+    lua_getfield(co, 3, "batch");
+    if (lua_isnumber(co, -1)) {
+      slots = (int)lua_tointeger(co, -1);
+    }
+    lua_pop(co, 1);
+    lua_getfield(co, 3, "raw_addr");
+    raw_addr = lua_toboolean(co, -1);
+    lua_pop(co, 1);
+    lua_getfield(co, 3, "buffers");
+    buffers = lua_toboolean(co, -1);
+    lua_pop(co, 1);
+    lua_getfield(co, 3, "paxe");
+    use_paxe = lua_toboolean(co, -1);
+    lua_pop(co, 1);
+    lua_getfield(co, 3, "paxe_key");
+    if (lua_isnumber(co, -1)) {
+      paxe_key = (uint32_t)lua_tointeger(co, -1);
+      paxe_has_key = 1;
+    }
+    lua_pop(co, 1);
+    lua_getfield(co, 3, "max_pending");
+    if (lua_isnumber(co, -1) && lua_tointeger(co, -1) > 0) {
+      max_pending = (size_t)lua_tointeger(co, -1);
+    }
+    lua_pop(co, 1);
+  }
+  if (slots < 1) slots = 1;
+  if (slots > UDP_MAX_BATCH_SLOTS) slots = UDP_MAX_BATCH_SLOTS;
+#ifndef UDP_HAVE_RECVMMSG
+  slots = 1;
+#endif
+
+  const paxe_udp_hooks_t *paxe = NULL;
+  if (use_paxe) {
+    lua_getfield(co, LUA_REGISTRYINDEX, PAXE_UDP_HOOKS_KEY);
+    paxe = (const paxe_udp_hooks_t *)lua_touserdata(co, -1);
+    lua_pop(co, 1);
+    if (paxe == NULL) {
+      lua_pushnil(co);
+      lua_pushstring(co, "paxe option requires require(\"lunet.paxe\")");
+      return 2;
+    }
+  }
+
   udp_ctx_t *ctx = (udp_ctx_t *)lunet_calloc(1, sizeof(udp_ctx_t));
   if (ctx == NULL) {
     lua_pushnil(co);
@@ -314,9 +743,29 @@ int lunet_udp_bind(lua_State *co) {
     return 2;
   }
 
-  uv_loop_t *loop = uv_default_loop();
-  int ret = uv_udp_init(loop, &ctx->handle);
+  ctx->slab_len = (size_t)slots * UDP_SLOT_SIZE;
+  ctx->slab = (char *)lunet_alloc(ctx->slab_len);
+  if (ctx->slab == NULL) {
+    queue_destroy(ctx->pending);
+    lunet_free(ctx);
+    lua_pushnil(co);
+    lua_pushstring(co, "out of memory");
+    return 2;
+  }
+
+  uv_loop_t *loop = lunet_loop();
+  int ret;
+#ifdef UDP_HAVE_RECVMMSG
+  if (slots > 1) {
+    ret = uv_udp_init_ex(loop, &ctx->handle, AF_UNSPEC | UV_UDP_RECVMMSG);
+  } else {
+    ret = uv_udp_init(loop, &ctx->handle);
+  }
+#else
+  ret = uv_udp_init(loop, &ctx->handle);
+#endif
   if (ret < 0) {
+    lunet_free(ctx->slab);
     queue_destroy(ctx->pending);
     lunet_free(ctx);
     lua_pushnil(co);
@@ -329,6 +778,13 @@ int lunet_udp_bind(lua_State *co) {
   lua_State *mainL = default_luaL();
   ctx->co = mainL ? mainL : co;
   ctx->recv_ref = LUA_NOREF;
+  lunet_timer_init(&ctx->recv_deadline, udp_recv_timeout_cb, ctx);
+  ctx->raw_addr = raw_addr;
+  ctx->buffers = buffers;
+  ctx->paxe = paxe;
+  ctx->paxe_key = paxe_key;
+  ctx->paxe_has_key = paxe_has_key;
+  queue_set_limit(ctx->pending, max_pending);
 #ifdef LUNET_TRACE
   ctx->trace_tx = 0;
   ctx->trace_rx = 0;
@@ -395,59 +851,29 @@ int lunet_udp_send(lua_State *co) {
     return 2;
   }
 
-  const char *host = luaL_checkstring(co, 2);
-  int port = (int)luaL_checkinteger(co, 3);
+  size_t host_len = 0;
+  const char *host = luaL_checklstring(co, 2, &host_len);
+  int port = udp_is_token(host, host_len) ? (int)luaL_optinteger(co, 3, 0)
+                                          : (int)luaL_checkinteger(co, 3);
 
   size_t len = 0;
-  const char *data = luaL_checklstring(co, 4, &len);
-
-  struct sockaddr_storage addr;
-  memset(&addr, 0, sizeof(addr));
-  int ret = 0;
-  if (strchr(host, ':') != NULL) {
-    struct sockaddr_in6 a6;
-    ret = uv_ip6_addr(host, port, &a6);
-    if (ret < 0) {
-      lua_pushnil(co);
-      lua_pushstring(co, "invalid host or port");
-      return 2;
-    }
-    memcpy(&addr, &a6, sizeof(a6));
-  } else {
-    struct sockaddr_in a4;
-    ret = uv_ip4_addr(host, port, &a4);
-    if (ret < 0) {
-      lua_pushnil(co);
-      lua_pushstring(co, "invalid host or port");
-      return 2;
-    }
-    memcpy(&addr, &a4, sizeof(a4));
-  }
+  if (!lunet_buffer_tobytes(co, 4, &len)) luaL_typerror(co, 4, "string or lunet.buffer");
 
-  udp_send_ctx_t *send_ctx = (udp_send_ctx_t *)lunet_alloc(sizeof(udp_send_ctx_t));
-  if (send_ctx == NULL) {
+  if (ctx->paxe && !ctx->paxe_has_key) {
     lua_pushnil(co);
-    lua_pushstring(co, "out of memory");
+    lua_pushstring(co, "paxe socket has no paxe_key for sending");
     return 2;
   }
-  memset(send_ctx, 0, sizeof(*send_ctx));
 
-  send_ctx->data = (char *)lunet_alloc(len);
-  if (send_ctx->data == NULL) {
-    lunet_free(send_ctx);
+  struct sockaddr_storage addr;
+  if (udp_parse_addr(host, host_len, port, &addr) < 0) {
     lua_pushnil(co);
-    lua_pushstring(co, "out of memory");
+    lua_pushstring(co, "invalid host or port");
     return 2;
   }
-  memcpy(send_ctx->data, data, len);
-  send_ctx->buf = uv_buf_init(send_ctx->data, (unsigned int)len);
-  send_ctx->req.data = send_ctx;
 
-  ret = uv_udp_send(&send_ctx->req, &ctx->handle, &send_ctx->buf, 1,
-                    (const struct sockaddr *)&addr, udp_send_cb);
+  int ret = udp_submit(co, ctx, 4, (const struct sockaddr *)&addr);
   if (ret < 0) {
-    lunet_free_nonnull(send_ctx->data);
-    lunet_free(send_ctx);
     lua_pushnil(co);
     lua_pushfstring(co, "failed to send: %s", uv_strerror(ret));
     return 2;
@@ -460,6 +886,252 @@ int lunet_udp_send(lua_State *co) {
   return 2;
 }
 
+/*
+ * Send one sweep of up to UDP_SEND_SWEEP datagrams. Each entry's payload
+ * must stay valid for the duration of the call; payload_at() pushes entry
+ * k's payload string so the fallback path can pin it, or is NULL when the
+ * buffers are C memory that the fallback must copy.
+ */
+typedef void (*udp_payload_fn)(lua_State *co, int k, void *ud);
+
+static int udp_send_sweep(lua_State *co, udp_ctx_t *ctx, int count, uv_buf_t *bufs,
+                          struct sockaddr_storage *addrs, udp_payload_fn payload_at,
+                          void *ud) {
+  int sent = 0;
+#ifdef UDP_HAVE_TRY_SEND2
+  uv_buf_t *bufp[UDP_SEND_SWEEP];
+  unsigned int nbufs[UDP_SEND_SWEEP];
+  struct sockaddr *addrp[UDP_SEND_SWEEP];
+  for (int k = 0; k < count; k++) {
+    bufp[k] = &bufs[k];
+    nbufs[k] = 1;
+    addrp[k] = (struct sockaddr *)&addrs[k];
+  }
+  sent = uv_udp_try_send2(&ctx->handle, (unsigned int)count, bufp, nbufs, addrp, 0);
+  if (sent < 0) {
+    if (sent != UV_EAGAIN && sent != UV_ENOSYS) return sent;
+    sent = 0;
+  }
+#else
+  (void)bufs;
+#endif
+  for (int k = sent; k < count; k++) {
+    int pin_idx = 0;
+    if (payload_at) {
+      payload_at(co, k, ud);
+      pin_idx = lua_gettop(co);
+    }
+    int ret = udp_submit_buf(co, ctx, bufs[k], (const struct sockaddr *)&addrs[k], pin_idx);
+    if (payload_at) lua_pop(co, 1);
+    if (ret < 0) return ret;
+  }
+  return 0;
+}
+
+typedef struct {
+  int table_idx;
+  int base;
+} udp_batch_ud_t;
+
+static void udp_batch_payload(lua_State *co, int k, void *ud) {
+  udp_batch_ud_t *b = (udp_batch_ud_t *)ud;
+  lua_rawgeti(co, b->table_idx, b->base + k);
+  lua_rawgeti(co, -1, 1);
+  lua_remove(co, -2);
+}
+
+static void udp_fanout_payload(lua_State *co, int k, void *ud) {
+  (void)k;
+  lua_pushvalue(co, *(int *)ud);
+}
+
+/* Read {host, port} from entry -1 of the peers/messages table; host may be a token */
+static int udp_entry_addr(lua_State *co, int host_i, struct sockaddr_storage *addr,
+                          const char **host_out, int *port_out) {
+  lua_rawgeti(co, -1, host_i);
+  lua_rawgeti(co, -2, host_i + 1);
+  size_t host_len = 0;
+  const char *host = lua_tolstring(co, -2, &host_len);
+  int port = (int)lua_tointeger(co, -1);
+  int ok = host != NULL && (lua_isnumber(co, -1) || udp_is_token(host, host_len)) &&
+           udp_parse_addr(host, host_len, port, addr) >= 0;
+  lua_pop(co, 2);
+  if (!ok) return -1;
+  *host_out = host;
+  *port_out = port;
+  return 0;
+}
+
+int lunet_udp_send_batch(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "udp.send_batch") != 0) return 2;
+
+  udp_ctx_t *ctx = (udp_ctx_t *)lua_touserdata(co, 1);
+  if (ctx == NULL) {
+    lua_pushnil(co);
+    lua_pushstring(co, "invalid udp handle");
+    return 2;
+  }
+  luaL_checktype(co, 2, LUA_TTABLE);
+
+  int n = (int)lua_objlen(co, 2);
+  uv_buf_t bufs[UDP_SEND_SWEEP];
+  struct sockaddr_storage addrs[UDP_SEND_SWEEP];
+
+  for (int base = 1; base <= n; base += UDP_SEND_SWEEP) {
+    int count = n - base + 1;
+    if (count > UDP_SEND_SWEEP) count = UDP_SEND_SWEEP;
+
+    for (int k = 0; k < count; k++) {
+      lua_rawgeti(co, 2, base + k);
+      const char *host = NULL;
+      int port = 0;
+      size_t len = 0;
+      const char *data = NULL;
+      if (lua_istable(co, -1)) {
+        lua_rawgeti(co, -1, 1);
+        /* Not numbers: lua_tolstring would convert only this stack copy,
+         * and the string would be gone once it is popped */
+        if (lua_type(co, -1) == LUA_TSTRING || lunet_buffer_test(co, -1)) {
+          data = lunet_buffer_tobytes(co, -1, &len);
+        }
+        lua_pop(co, 1);
+      }
+      if (data == NULL || udp_entry_addr(co, 2, &addrs[k], &host, &port) < 0) {
+        lua_pop(co, 1);
+        lua_pushnil(co);
+        lua_pushfstring(co, "invalid message at index %d", base + k);
+        return 2;
+      }
+      UDP_TRACE_TX(ctx, host, port, len);
+      lua_pop(co, 1);
+      /* The string or buffer stays referenced by the messages table */
+      bufs[k] = uv_buf_init((char *)data, (unsigned int)len);
+    }
+
+    int ret = 0;
+    if (ctx->paxe) {
+      /* Every datagram gets its own nonce, so seal and send one at a time */
+      udp_batch_ud_t ud = {2, base};
+      for (int k = 0; k < count && ret == 0; k++) {
+        udp_batch_payload(co, k, &ud);
+        ret = udp_submit(co, ctx, lua_gettop(co), (const struct sockaddr *)&addrs[k]);
+        lua_pop(co, 1);
+      }
+    } else {
+      udp_batch_ud_t ud = {2, base};
+      ret = udp_send_sweep(co, ctx, count, bufs, addrs, udp_batch_payload, &ud);
+    }
+    if (ret < 0) {
+      lua_pushnil(co);
+      lua_pushfstring(co, "failed to send: %s", uv_strerror(ret));
+      return 2;
+    }
+  }
+
+  lua_pushinteger(co, n);
+  lua_pushnil(co);
+  return 2;
+}
+
+int lunet_udp_send_fanout(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "udp.send_fanout") != 0) return 2;
+
+  udp_ctx_t *ctx = (udp_ctx_t *)lua_touserdata(co, 1);
+  if (ctx == NULL) {
+    lua_pushnil(co);
+    lua_pushstring(co, "invalid udp handle");
+    return 2;
+  }
+  size_t len = 0;
+  const char *data = lunet_buffer_tobytes(co, 2, &len);
+  if (!data) luaL_typerror(co, 2, "string or lunet.buffer");
+  luaL_checktype(co, 3, LUA_TTABLE);
+
+  int n = (int)lua_objlen(co, 3);
+  int data_idx = 2;
+  uv_buf_t bufs[UDP_SEND_SWEEP];
+  struct sockaddr_storage addrs[UDP_SEND_SWEEP];
+
+  /* One ciphertext serves every peer on a PAXE socket */
+  uv_buf_t payload = uv_buf_init((char *)data, (unsigned int)len);
+  if (ctx->paxe) {
+    int ret = udp_paxe_seal(ctx, data, len, &payload);
+    if (ret < 0) {
+      lua_pushnil(co);
+      lua_pushfstring(co, "failed to send: %s", uv_strerror(ret));
+      return 2;
+    }
+  }
+
+  for (int base = 1; base <= n; base += UDP_SEND_SWEEP) {
+    int count = n - base + 1;
+    if (count > UDP_SEND_SWEEP) count = UDP_SEND_SWEEP;
+
+    for (int k = 0; k < count; k++) {
+      lua_rawgeti(co, 3, base + k);
+      const char *host = NULL;
+      int port = 0;
+      if (!lua_istable(co, -1) || udp_entry_addr(co, 1, &addrs[k], &host, &port) < 0) {
+        lua_pop(co, 1);
+        lua_pushnil(co);
+        lua_pushfstring(co, "invalid peer at index %d", base + k);
+        return 2;
+      }
+      UDP_TRACE_TX(ctx, host, port, len);
+      lua_pop(co, 1);
+      bufs[k] = payload;
+    }
+
+    int ret = udp_send_sweep(co, ctx, count, bufs, addrs,
+                             ctx->paxe ? NULL : udp_fanout_payload, &data_idx);
+    if (ret < 0) {
+      lua_pushnil(co);
+      lua_pushfstring(co, "failed to send: %s", uv_strerror(ret));
+      return 2;
+    }
+  }
+
+  lua_pushinteger(co, n);
+  lua_pushnil(co);
+  return 2;
+}
+
+int lunet_udp_dropped(lua_State *L) {
+  udp_ctx_t *ctx = (udp_ctx_t *)lua_touserdata(L, 1);
+  if (ctx == NULL || ctx->pending == NULL) {
+    lua_pushnil(L);
+    lua_pushstring(L, "invalid udp handle");
+    return 2;
+  }
+  lua_pushinteger(L, (lua_Integer)queue_dropped(ctx->pending));
+  return 1;
+}
+
+int lunet_udp_addr_string(lua_State *L) {
+  size_t len = 0;
+  const char *tok = luaL_checklstring(L, 1, &len);
+  struct sockaddr_storage addr;
+  if (udp_addr_decode(tok, len, &addr) < 0) {
+    lua_pushnil(L);
+    lua_pushstring(L, "invalid address token");
+    return 2;
+  }
+  char host[INET6_ADDRSTRLEN];
+  int port;
+  if (addr.ss_family == AF_INET) {
+    const struct sockaddr_in *a4 = (const struct sockaddr_in *)&addr;
+    uv_ip4_name(a4, host, sizeof(host));
+    port = ntohs(a4->sin_port);
+  } else {
+    const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *)&addr;
+    uv_ip6_name(a6, host, sizeof(host));
+    port = ntohs(a6->sin6_port);
+  }
+  lua_pushstring(L, host);
+  lua_pushinteger(L, port);
+  return 2;
+}
+
 int lunet_udp_recv(lua_State *co) {
   if (lunet_ensure_coroutine(co, "udp.recv") != 0) return 3;
 
@@ -479,9 +1151,11 @@ int lunet_udp_recv(lua_State *co) {
       return 3;
     }
 
+    uint64_t timeout_ms = udp_timeout_arg(co, 2);
     lunet_coref_create(co, ctx->recv_ref);
     udp_bk_wait(ctx);
     UDP_TRACE_RECV_WAIT();
+    if (timeout_ms > 0) lunet_timer_start(&ctx->recv_deadline, timeout_ms);
     return lua_yield(co, 0);
   }
 
@@ -495,14 +1169,48 @@ int lunet_udp_recv(lua_State *co) {
 
   UDP_TRACE_RECV_DELIVER(msg->host, msg->port, msg->len);
 
-  lua_pushlstring(co, msg->data, msg->len);
-  lua_pushstring(co, msg->host);
-  lua_pushinteger(co, msg->port);
-  lunet_free_nonnull(msg->data);
-  lunet_free(msg);
+  udp_push_msg(co, ctx, msg);
   return 3;
 }
 
+int lunet_udp_recv_batch(lua_State *co) {
+  if (lunet_ensure_coroutine(co, "udp.recv_batch") != 0) return 2;
+
+  udp_ctx_t *ctx = (udp_ctx_t *)lua_touserdata(co, 1);
+  if (ctx == NULL || ctx->pending == NULL) {
+    lua_pushnil(co);
+    lua_pushstring(co, "invalid udp handle");
+    return 2;
+  }
+
+  int max = (int)luaL_optinteger(co, 2, 64);
+  if (max < 1) {
+    lua_pushnil(co);
+    lua_pushstring(co, "max must be positive");
+    return 2;
+  }
+
+  if (!queue_is_empty(ctx->pending)) {
+    udp_push_batch(co, ctx, max);
+    lua_pushnil(co);
+    return 2;
+  }
+
+  if (ctx->recv_ref != LUA_NOREF) {
+    lua_pushnil(co);
+    lua_pushstring(co, "recv already pending");
+    return 2;
+  }
+
+  uint64_t timeout_ms = udp_timeout_arg(co, 3);
+  ctx->recv_batch_max = max;
+  lunet_coref_create(co, ctx->recv_ref);
+  udp_bk_wait(ctx);
+  UDP_TRACE_RECV_WAIT();
+  if (timeout_ms > 0) lunet_timer_start(&ctx->recv_deadline, timeout_ms);
+  return lua_yield(co, 0);
+}
+
 int lunet_udp_close(lua_State *L) {
   if (lunet_ensure_coroutine(L, "udp.close") != 0) return 2;
 
@@ -514,12 +1222,12 @@ int lunet_udp_close(lua_State *L) {
   }
 
   uv_udp_recv_stop(&ctx->handle);
+  lunet_timer_stop(&ctx->recv_deadline);
 
   while (!queue_is_empty(ctx->pending)) {
     udp_msg_t *msg = (udp_msg_t *)queue_dequeue(ctx->pending);
     if (msg) {
-      lunet_free_nonnull(msg->data);
-      lunet_free(msg);
+      udp_msg_free(ctx, msg);
     }
   }
   queue_destroy(ctx->pending);
@@ -533,10 +1241,12 @@ int lunet_udp_close(lua_State *L) {
     if (lua_isthread(ctx->co, -1)) {
       lua_State *waiting_co = lua_tothread(ctx->co, -1);
       lua_pop(ctx->co, 1);
+      int batch = ctx->recv_batch_max > 0;
+      ctx->recv_batch_max = 0;
       lua_pushnil(waiting_co);
-      lua_pushnil(waiting_co);
+      if (!batch) lua_pushnil(waiting_co);
       lua_pushstring(waiting_co, "udp closed");
-      lunet_co_resume(waiting_co, 3);
+      lunet_co_resume(waiting_co, batch ? 2 : 3);
     } else {
       lua_pop(ctx->co, 1);
       udp_bk_cancel(ctx);
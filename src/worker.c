@@ -0,0 +1,217 @@
+#include "worker.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "co.h"
+#include "rt.h"
+#include "trace.h"
+#include "lunet_mem.h"
+
+typedef struct worker_msg {
+  struct worker_msg *next;
+  size_t len;
+  char data[];
+} worker_msg_t;
+
+typedef struct {
+  uv_mutex_t mutex;
+  worker_msg_t *head;
+  worker_msg_t *tail;
+  int attached;        /* async is live on the owner's loop (guarded by mutex) */
+
+  /* Owner-thread only */
+  uv_async_t async;
+  lua_State *L;
+  int recv_ref;
+} worker_mailbox_t;
+
+static worker_mailbox_t *g_mailboxes = NULL;
+static int g_worker_count = 0;
+
+static worker_msg_t *mailbox_pop(worker_mailbox_t *mb) {
+  uv_mutex_lock(&mb->mutex);
+  worker_msg_t *msg = mb->head;
+  if (msg) {
+    mb->head = msg->next;
+    if (!mb->head) mb->tail = NULL;
+  }
+  uv_mutex_unlock(&mb->mutex);
+  return msg;
+}
+
+static void mailbox_async_cb(uv_async_t *handle) {
+  worker_mailbox_t *mb = (worker_mailbox_t *)handle->data;
+
+  /* uv_async_send coalesces: deliver as long as someone is waiting */
+  while (mb->recv_ref != LUA_NOREF) {
+    worker_msg_t *msg = mailbox_pop(mb);
+    if (!msg) return;
+
+    lua_State *L = mb->L;
+    int ref = mb->recv_ref;
+    mb->recv_ref = LUA_NOREF;
+    uv_unref((uv_handle_t *)&mb->async);
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    lunet_coref_release(L, ref);
+    if (!lua_isthread(L, -1)) {
+      lua_pop(L, 1);
+      lunet_free_nonnull(msg);
+      continue;
+    }
+    lua_State *co = lua_tothread(L, -1);
+    lua_pop(L, 1);
+
+    lua_pushlstring(co, msg->data, msg->len);
+    lua_pushnil(co);
+    lunet_free_nonnull(msg);
+    int rc = lunet_co_resume(co, 2);
+    if (rc != LUA_OK && rc != LUA_YIELD) {
+      const char *err = lua_tostring(co, -1);
+      if (err) fprintf(stderr, "[lunet] resume error in worker.recv: %s\n", err);
+    }
+  }
+}
+
+int lunet_workers_init(int n) {
+  if (g_mailboxes || n < 1) return -1;
+  g_mailboxes = lunet_calloc((size_t)n, sizeof(worker_mailbox_t));
+  if (!g_mailboxes) return -1;
+  for (int i = 0; i < n; i++) {
+    uv_mutex_init(&g_mailboxes[i].mutex);
+    g_mailboxes[i].recv_ref = LUA_NOREF;
+  }
+  g_worker_count = n;
+  return 0;
+}
+
+int lunet_worker_attach(int id, uv_loop_t *loop, lua_State *L) {
+  if (!g_mailboxes || id < 0 || id >= g_worker_count) return -1;
+  worker_mailbox_t *mb = &g_mailboxes[id];
+  int ret = uv_async_init(loop, &mb->async, mailbox_async_cb);
+  if (ret < 0) return ret;
+  mb->async.data = mb;
+  /* Only an outstanding recv keeps the loop alive */
+  uv_unref((uv_handle_t *)&mb->async);
+  mb->L = L;
+
+  uv_mutex_lock(&mb->mutex);
+  mb->attached = 1;
+  if (mb->head) uv_async_send(&mb->async);
+  uv_mutex_unlock(&mb->mutex);
+  return 0;
+}
+
+void lunet_worker_detach(int id) {
+  if (!g_mailboxes || id < 0 || id >= g_worker_count) return;
+  worker_mailbox_t *mb = &g_mailboxes[id];
+
+  uv_mutex_lock(&mb->mutex);
+  int attached = mb->attached;
+  mb->attached = 0;
+  uv_mutex_unlock(&mb->mutex);
+  if (!attached) return;
+
+  if (mb->recv_ref != LUA_NOREF) {
+    lunet_coref_release(mb->L, mb->recv_ref);
+    mb->recv_ref = LUA_NOREF;
+  }
+  uv_close((uv_handle_t *)&mb->async, NULL);
+  uv_run(mb->async.loop, UV_RUN_NOWAIT);
+  mb->L = NULL;
+}
+
+void lunet_workers_shutdown(void) {
+  if (!g_mailboxes) return;
+  for (int i = 0; i < g_worker_count; i++) {
+    worker_msg_t *msg;
+    while ((msg = mailbox_pop(&g_mailboxes[i])) != NULL) {
+      lunet_free_nonnull(msg);
+    }
+    uv_mutex_destroy(&g_mailboxes[i].mutex);
+  }
+  lunet_free(g_mailboxes);
+  g_mailboxes = NULL;
+  g_worker_count = 0;
+}
+
+int lunet_worker_lua_id(lua_State *L) {
+  lua_pushinteger(L, lunet_worker_id());
+  return 1;
+}
+
+int lunet_worker_lua_count(lua_State *L) {
+  lua_pushinteger(L, g_worker_count > 0 ? g_worker_count : 1);
+  return 1;
+}
+
+int lunet_worker_send(lua_State *L) {
+  int id = (int)luaL_checkinteger(L, 1);
+  size_t len;
+  const char *data = luaL_checklstring(L, 2, &len);
+
+  if (!g_mailboxes) {
+    lua_pushstring(L, "worker channel not available");
+    return 1;
+  }
+  if (id < 0 || id >= g_worker_count) {
+    lua_pushstring(L, "invalid worker id");
+    return 1;
+  }
+
+  worker_msg_t *msg = lunet_alloc(sizeof(worker_msg_t) + len);
+  if (!msg) {
+    lua_pushstring(L, "out of memory");
+    return 1;
+  }
+  msg->next = NULL;
+  msg->len = len;
+  memcpy(msg->data, data, len);
+
+  worker_mailbox_t *mb = &g_mailboxes[id];
+  uv_mutex_lock(&mb->mutex);
+  if (mb->tail) {
+    mb->tail->next = msg;
+  } else {
+    mb->head = msg;
+  }
+  mb->tail = msg;
+  if (mb->attached) uv_async_send(&mb->async);
+  uv_mutex_unlock(&mb->mutex);
+
+  lua_pushnil(L);
+  return 1;
+}
+
+int lunet_worker_recv(lua_State *L) {
+  if (lunet_ensure_coroutine(L, "worker.recv") != 0) {
+    return lua_error(L);
+  }
+
+  int id = lunet_worker_id();
+  if (!g_mailboxes || id >= g_worker_count || !g_mailboxes[id].L) {
+    lua_pushnil(L);
+    lua_pushstring(L, "worker channel not available");
+    return 2;
+  }
+
+  worker_mailbox_t *mb = &g_mailboxes[id];
+  if (mb->recv_ref != LUA_NOREF) {
+    lua_pushnil(L);
+    lua_pushstring(L, "another recv already in progress");
+    return 2;
+  }
+
+  worker_msg_t *msg = mailbox_pop(mb);
+  if (msg) {
+    lua_pushlstring(L, msg->data, msg->len);
+    lunet_free_nonnull(msg);
+    lua_pushnil(L);
+    return 2;
+  }
+
+  lunet_coref_create(L, mb->recv_ref);
+  uv_ref((uv_handle_t *)&mb->async);
+  return lua_yield(L, 0);
+}
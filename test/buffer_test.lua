@@ -0,0 +1,144 @@
+--[[
+  lunet.buffer: views made with sub() share bytes with their parent and keep
+  the store alive after it is collected, ranges clamp instead of failing,
+  NaN and oversized arguments are refused, socket.read_into reads in place
+  and socket.write sends buffers, and udp.bind(..., {buffers = true})
+  delivers datagrams as buffers. Uses a unix socket and 127.0.0.1:20017.
+]]
+
+local lunet = require("lunet")
+local buffer = require("lunet.buffer")
+local socket = require("lunet.socket")
+local udp = require("lunet.udp")
+
+local SOCKET_PATH = ".tmp/buffer_test.sock"
+pcall(os.remove, SOCKET_PATH)
+
+local function fail(msg)
+  io.stderr:write("[BUFFER] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %q, got %q", what, tostring(want), tostring(got)))
+  end
+end
+
+local function test_views()
+  local b = buffer.new(6, string.byte("a"))
+  expect("new", b:tostring(), "aaaaaa")
+  expect("len", #b, 6)
+  expect("is", buffer.is(b), true)
+  expect("is string", buffer.is("aaaaaa"), false)
+
+  local v = b:sub(2, 3)
+  expect("set through view", v:set(0, "XYZ"), 3)
+  expect("parent sees view write", b:tostring(), "aaXYZa")
+  expect("set clamps", v:set(1, "1234"), 2)
+  expect("clamped write stays in view", b:tostring(), "aaX12a")
+
+  local c = b:clone()
+  c:fill(string.byte("-"))
+  expect("clone is separate", b:tostring(), "aaX12a")
+
+  -- overlapping views of one store
+  b:set(1, b:sub(0, 4))
+  expect("overlapping set", b:tostring(), "aaaX1a")
+
+  expect("sub past end", #b:sub(100), 0)
+  expect("sub negative offset", b:sub(-3, 2):tostring(), "aa")
+  expect("tostring range", b:tostring(3, 100), "X1a")
+  expect("tostring NaN offset", b:tostring(0 / 0, 2), "aa")
+  expect("tostring NaN length", b:tostring(0, 0 / 0), "")
+  expect("fill range", b:fill(string.byte("z"), 4, 1):tostring(), "aaaXza")
+
+  -- a view keeps the store alive after the parent is gone
+  local keep = buffer.from("keep me"):sub(5)
+  collectgarbage("collect")
+  collectgarbage("collect")
+  expect("view outlives parent", keep:tostring(), "me")
+
+  expect("from buffer copies", buffer.from(keep):tostring(), "me")
+  expect("__tostring", tostring(buffer.from("str")), "str")
+
+  local ok = pcall(buffer.new, 0 / 0)
+  expect("new NaN", ok, false)
+  ok = pcall(buffer.new, -1)
+  expect("new negative", ok, false)
+  local none, err = buffer.new(2 ^ 80)
+  expect("new huge", none, nil)
+  expect("new huge error", err, "out of memory")
+  ok = pcall(b.set, b, 0 / 0, "x")
+  expect("set NaN offset", ok, false)
+  ok = pcall(b.set, b, 7, "x")
+  expect("set past end", ok, false)
+end
+
+local function test_socket()
+  local listener, err = socket.listen("unix", SOCKET_PATH, 0)
+  if not listener then
+    return fail("listen: " .. tostring(err))
+  end
+  lunet.spawn(function()
+    local client, cerr = socket.connect(SOCKET_PATH, 0)
+    if not client then
+      return fail("connect: " .. tostring(cerr))
+    end
+    local out = buffer.from("0123456789")
+    socket.write(client, out:sub(0, 4))
+    lunet.sleep(10)
+    socket.writev(client, {out:sub(4), "!"})
+    socket.close(client)
+  end)
+  local conn = socket.accept(listener)
+
+  local n, rerr = socket.read_into(conn, buffer.new(0))
+  expect("read_into empty buffer", n, nil)
+  if not tostring(rerr):find("non-empty", 1, true) then
+    fail("read_into empty buffer error: " .. tostring(rerr))
+  end
+
+  local into = buffer.new(16, string.byte("."))
+  local got = 0
+  local view = into
+  while got < 11 do
+    local k, kerr = socket.read_into(conn, view)
+    if not k then
+      return fail("read_into after " .. got .. " bytes: " .. tostring(kerr))
+    end
+    got = got + k
+    view = into:sub(got)
+  end
+  expect("read_into contents", into:tostring(), "0123456789!.....")
+
+  socket.close(conn)
+  socket.close(listener)
+  pcall(os.remove, SOCKET_PATH)
+end
+
+local function test_udp()
+  local rx, err = udp.bind("127.0.0.1", 20017, {buffers = true})
+  if not rx then
+    return fail("udp bind: " .. tostring(err))
+  end
+  local tx = udp.bind("127.0.0.1", 0)
+  udp.send(tx, "127.0.0.1", 20017, buffer.from("datagram"))
+  local data, _, rerr = udp.recv(rx, 1000)
+  if not buffer.is(data) then
+    fail("udp payload is not a buffer: " .. tostring(data) .. " " .. tostring(rerr))
+  else
+    expect("udp payload", data:tostring(), "datagram")
+    data:set(0, "D")
+    expect("udp payload is writable", data:tostring(), "Datagram")
+  end
+  udp.close(tx)
+  udp.close(rx)
+end
+
+lunet.spawn(function()
+  test_views()
+  test_socket()
+  test_udp()
+  print("PASS: buffer")
+end)
@@ -0,0 +1,109 @@
+--[[
+  Coroutine pool reuse: a spawn that changed its thread's globals with
+  setfenv(0, ...) leaves nothing behind for the next spawn, whether it
+  finished synchronously or after yielding. Debug hooks are VM-wide in
+  LuaJIT, so a hook installed before or during a spawn (say a profiler set
+  from another coroutine) is never cleared when the spawn ends. Thread
+  identity is only reused when the pool is on. Run it both ways:
+
+    ./build/lunet test/co_pool_test.lua
+    LUNET_CO_POOL=0 ./build/lunet test/co_pool_test.lua
+]]
+
+local lunet = require("lunet")
+
+local function fail(msg)
+  io.stderr:write("[CO_POOL] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(what .. ": got " .. tostring(got) .. ", want " .. tostring(want))
+  end
+end
+
+local pool_on = os.getenv("LUNET_CO_POOL") ~= "0"
+
+local function noop_hook() end
+
+local function dirty()
+  setfenv(0, { marker = true })
+end
+
+local function check_clean(what)
+  local state = {}
+  lunet.spawn(function()
+    state.env = getfenv(0)
+    state.thread = coroutine.running()
+  end)
+  expect(what .. " globals", state.env, _G)
+  return state.thread
+end
+
+local function test_sync()
+  local first
+  lunet.spawn(function()
+    first = coroutine.running()
+    dirty()
+  end)
+  local second = check_clean("after sync spawn")
+  expect("sync thread reused", first == second, pool_on)
+end
+
+local function test_yielding()
+  local done = false
+  lunet.spawn(function()
+    lunet.sleep(1)
+    dirty()
+    done = true
+  end)
+  while not done do lunet.sleep(1) end
+  check_clean("after yielding spawn")
+end
+
+local function test_errored()
+  lunet.spawn(function()
+    dirty()
+    error("boom")
+  end)
+  check_clean("after errored spawn")
+end
+
+local function test_hooks_kept()
+  debug.sethook(noop_hook, "", 1000000)
+  lunet.spawn(function() end)
+  local done = false
+  lunet.spawn(function()
+    lunet.sleep(1)
+    done = true
+  end)
+  while not done do lunet.sleep(1) end
+  expect("outer hook kept", debug.gethook(), noop_hook)
+  debug.sethook()
+
+  -- installed by another coroutine while a spawn is suspended
+  done = false
+  lunet.spawn(function()
+    lunet.sleep(5)
+    done = true
+  end)
+  lunet.spawn(function()
+    debug.sethook(noop_hook, "", 1000000)
+  end)
+  while not done do lunet.sleep(1) end
+  expect("hook set mid-spawn kept", debug.gethook(), noop_hook)
+
+  -- nor by a spawn that started after it was set
+  lunet.spawn(function() end)
+  expect("hook kept after a later spawn ends", debug.gethook(), noop_hook)
+  debug.sethook()
+end
+
+lunet.spawn(function()
+  test_sync()
+  test_yielding()
+  test_errored()
+  test_hooks_kept()
+  print("PASS: co pool (" .. (pool_on and "pool on" or "pool off") .. ")")
+end)
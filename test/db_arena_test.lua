@@ -0,0 +1,93 @@
+--[[
+  SQLite result rows built in a per-request arena: results that fit the
+  inline buffer, spill into standard blocks, or carry cells large enough for
+  a dedicated block all come back intact, every arena is destroyed once the
+  query returns, and an empty result has deterministic column types.
+]]
+
+local lunet = require("lunet")
+local db = require("lunet.sqlite3")
+
+local function fail(msg)
+  io.stderr:write("[DB_ARENA] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+local function arena()
+  return lunet.metrics().arena
+end
+
+local function check_rows(what, rows, n, wide)
+  expect(what .. " count", rows and #rows, n)
+  if not rows then return end
+  for i = 1, n do
+    local r = rows[i]
+    if r.id ~= i or r.name ~= "name-" .. i then
+      return fail(string.format("%s row %d: id %s name %s", what, i, tostring(r.id), tostring(r.name)))
+    end
+    if wide and r.blob ~= wide then
+      return fail(string.format("%s row %d: wide cell of %d bytes", what, i, r.blob and #r.blob or -1))
+    end
+  end
+end
+
+lunet.spawn(function()
+  local conn, err = db.open({path = ":memory:"})
+  if not conn then
+    return fail("open: " .. tostring(err))
+  end
+  db.exec(conn, "CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT, blob TEXT)")
+  local rows = {}
+  for i = 1, 2000 do rows[i] = {i, "name-" .. i} end
+  assert(db.exec_batch(conn, "INSERT INTO t (id, name) VALUES (?, ?)", rows))
+
+  local before = arena()
+
+  -- fits the inline buffer
+  check_rows("inline", db.query(conn, "SELECT id, name FROM t WHERE id <= 2 ORDER BY id"), 2)
+  local after_inline = arena()
+  expect("inline arenas", after_inline.arenas - before.arenas, 1)
+  expect("inline blocks", after_inline.blocks - before.blocks, 0)
+
+  -- spills into standard blocks and grows the row index
+  check_rows("spill", db.query(conn, "SELECT id, name FROM t ORDER BY id"), 2000)
+  local after_spill = arena()
+  if after_spill.blocks == after_inline.blocks then
+    fail("2000 rows did not allocate any arena block")
+  end
+
+  -- cells larger than a quarter block get blocks of their own
+  local wide = string.rep("w", 8192)
+  assert(db.exec_params(conn, "UPDATE t SET blob = ? WHERE id <= 3", wide))
+  check_rows("oversize", db.query(conn, "SELECT id, name, blob FROM t WHERE id <= 3 ORDER BY id"), 3, wide)
+  local after_wide = arena()
+  if after_wide.oversize - after_spill.oversize < 3 then
+    fail(string.format("3 wide cells made %d oversize blocks", after_wide.oversize - after_spill.oversize))
+  end
+
+  expect("active arenas after queries", after_wide.active, before.active)
+  expect("reserved bytes after queries", after_wide.reserved_bytes, before.reserved_bytes)
+  if after_wide.fill_ratio <= 0 or after_wide.fill_ratio > 1 then
+    fail("fill_ratio out of range: " .. tostring(after_wide.fill_ratio))
+  end
+
+  -- no row ever sets the column types; they must read as text, not garbage
+  for _ = 1, 20 do
+    local empty = db.query(conn, "SELECT id, name FROM t WHERE id < 0", {shape = "columns", ffi = true})
+    expect("empty nrows", empty and empty.nrows, 0)
+    if empty then
+      for j = 1, 2 do
+        expect("empty column " .. j .. " type", type(empty.values[j]), "table")
+      end
+    end
+  end
+
+  db.close(conn)
+  print("PASS: db arena")
+end)
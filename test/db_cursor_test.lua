@@ -0,0 +1,99 @@
+--[[
+  db.cursor (SQLite): rows arrive in batches of at most n, in order, an
+  exhausted cursor keeps returning an empty table, close() discards the
+  unread rows, and an open cursor does not block other queries.
+]]
+
+local lunet = require("lunet")
+local db = require("lunet.sqlite3")
+
+local function fail(msg)
+  io.stderr:write("[DB_CURSOR] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+local ROWS = 250
+
+lunet.spawn(function()
+  local conn, err = db.open({path = ":memory:"})
+  if not conn then
+    return fail("open: " .. tostring(err))
+  end
+  db.exec(conn, "CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT)")
+  local _, ierr = db.exec(conn, "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < " ..
+                                ROWS .. ") INSERT INTO t SELECT x, 'n' || x FROM c")
+  if ierr then
+    return fail("insert: " .. ierr)
+  end
+
+  -- 250 rows in batches of 100: 100, 100, 50, then empty for good
+  local cur, cerr = db.cursor(conn, "SELECT id, name FROM t WHERE id > ? ORDER BY id", 0)
+  if not cur then
+    return fail("cursor: " .. tostring(cerr))
+  end
+  local sizes, seen = {}, 0
+  while true do
+    local rows, nerr = cur:next(100)
+    if not rows then
+      return fail("next: " .. tostring(nerr))
+    end
+    if #rows == 0 then break end
+    sizes[#sizes + 1] = #rows
+    for _, row in ipairs(rows) do
+      seen = seen + 1
+      if row.id ~= seen or row.name ~= "n" .. seen then
+        return fail(string.format("row %d came back as %s/%s", seen, tostring(row.id), tostring(row.name)))
+      end
+    end
+  end
+  expect("batches", table.concat(sizes, ","), "100,100,50")
+  expect("rows read", seen, ROWS)
+  local again = cur:next(100)
+  expect("next after exhaustion", again and #again, 0)
+  expect("close after exhaustion", cur:close(), nil)
+
+  -- The batch size is clamped to at least one row
+  cur = db.cursor(conn, "SELECT id FROM t ORDER BY id")
+  local one = cur:next(0)
+  expect("next(0)", one and #one, 1)
+
+  -- Other statements run while the cursor is open
+  local n = db.query(conn, "SELECT count(*) AS n FROM t")
+  expect("query beside an open cursor", n and n[1].n, ROWS)
+  local two = cur:next(2)
+  expect("cursor resumes after the query", two and two[1].id, 2)
+
+  -- close() drops the rest; the cursor is unusable afterwards
+  expect("close", cur:close(), nil)
+  local rows, nerr = cur:next(10)
+  if rows ~= nil or nerr ~= "cursor is closed" then
+    fail("next after close: " .. tostring(nerr))
+  end
+
+  -- An empty result is an empty first batch
+  cur = db.cursor(conn, "SELECT id FROM t WHERE id > ?", ROWS)
+  local empty = cur:next()
+  expect("empty result", empty and #empty, 0)
+
+  -- A bad statement is reported by the first fetch
+  cur = db.cursor(conn, "SELECT nope FROM t")
+  rows, nerr = cur:next()
+  if rows ~= nil or not tostring(nerr):find("nope", 1, true) then
+    fail("bad statement: " .. tostring(nerr))
+  end
+
+  -- Closing the connection finalizes a cursor left open
+  cur = db.cursor(conn, "SELECT id FROM t")
+  expect("first batch", #cur:next(10), 10)
+  db.close(conn)
+  rows = cur:next(10)
+  expect("next after db.close", rows, nil)
+
+  print("PASS: db cursor")
+end)
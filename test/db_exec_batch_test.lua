@@ -0,0 +1,90 @@
+--[[
+  db.exec_batch (SQLite): per-tuple counts, last_insert_id, short tuples
+  padded with NULL, the whole batch rolled back when one tuple fails (with
+  the failing "row N: ..." reported), and an open transaction left to the
+  caller.
+]]
+
+local lunet = require("lunet")
+local db = require("lunet.sqlite3")
+
+local function fail(msg)
+  io.stderr:write("[DB_EXEC_BATCH] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+local function count(conn)
+  local rows = db.query(conn, "SELECT count(*) AS n FROM t")
+  return rows and rows[1].n
+end
+
+lunet.spawn(function()
+  local conn, err = db.open({path = ":memory:"})
+  if not conn then
+    return fail("open: " .. tostring(err))
+  end
+  db.exec(conn, "CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT UNIQUE, note TEXT)")
+
+  local tuples = {}
+  for i = 1, 500 do
+    tuples[i] = {i, "n" .. i, "note" .. i}
+  end
+  local res, berr = db.exec_batch(conn, "INSERT INTO t (id, name, note) VALUES (?, ?, ?)", tuples)
+  if not res then
+    return fail("insert batch: " .. tostring(berr))
+  end
+  expect("affected_rows", res.affected_rows, 500)
+  expect("last_insert_id", res.last_insert_id, 500)
+  expect("counts", #res.counts, 500)
+  expect("counts[1]", res.counts[1], 1)
+  expect("rows", count(conn), 500)
+
+  -- Each tuple's own change count
+  res = db.exec_batch(conn, "UPDATE t SET note = ? WHERE id <= ?", {{"a", 10}, {"b", 0}, {"c", 3}})
+  expect("update counts", res and table.concat(res.counts, ","), "10,0,3")
+  expect("update affected_rows", res and res.affected_rows, 13)
+
+  -- A short tuple binds NULL for the missing parameters
+  res = db.exec_batch(conn, "INSERT INTO t (id, name, note) VALUES (?, ?, ?)", {{501, "n501"}})
+  expect("short tuple", res and res.affected_rows, 1)
+  local row = db.query_params(conn, "SELECT note FROM t WHERE id = ?", 501)
+  expect("padded NULL", row and row[1] and row[1].note, nil)
+
+  -- Row 3 collides on name: nothing from the batch survives
+  res, berr = db.exec_batch(conn, "INSERT INTO t (id, name) VALUES (?, ?)",
+                            {{600, "x600"}, {601, "x601"}, {602, "n1"}, {603, "x603"}})
+  expect("failing batch result", res, nil)
+  if not tostring(berr):match("^row 3: ") then
+    fail("failing batch error: " .. tostring(berr))
+  end
+  expect("rows after rollback", count(conn), 501)
+
+  -- Inside the caller's transaction the batch neither commits nor rolls back
+  db.exec(conn, "BEGIN")
+  res = db.exec_batch(conn, "INSERT INTO t (id, name) VALUES (?, ?)", {{700, "x700"}})
+  expect("batch in transaction", res and res.affected_rows, 1)
+  res, berr = db.exec_batch(conn, "INSERT INTO t (id, name) VALUES (?, ?)", {{701, "n2"}})
+  expect("failing batch in transaction", res, nil)
+  expect("rows inside transaction", count(conn), 502)
+  db.exec(conn, "ROLLBACK")
+  expect("rows after caller rollback", count(conn), 501)
+
+  res = db.exec_batch(conn, "DELETE FROM t WHERE id = ?", {})
+  expect("empty batch", res and res.affected_rows, 0)
+  expect("empty batch counts", res and #res.counts, 0)
+
+  res, berr = db.exec_batch(conn, "DELETE FROM t WHERE id = ?", {1, 2})
+  expect("non-table tuple", res, nil)
+  if not tostring(berr):find("parameter arrays", 1, true) then
+    fail("non-table tuple error: " .. tostring(berr))
+  end
+
+  db.close(conn)
+  print("PASS: db exec_batch")
+end)
@@ -0,0 +1,88 @@
+--[[
+  DB executor: DB jobs run on their own threads, so fs calls are not stuck
+  behind slow queries; db.executor_stats accounts for every job; and a full
+  queue rejects with "db executor queue is full" instead of blocking.
+
+  The rejection part needs a small queue:
+    LUNET_DB_THREADS=1 LUNET_DB_QUEUE=2 ./build/lunet test/db_executor_test.lua
+]]
+
+local lunet = require("lunet")
+local db = require("lunet.sqlite3")
+local fs = require("lunet.fs")
+
+local function fail(msg)
+  io.stderr:write("[DB_EXECUTOR] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local SLOW = "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < 1000000) " ..
+             "SELECT count(*) AS n FROM c"
+
+lunet.spawn(function()
+  local conns = {}
+  local before = db.executor_stats()
+  local small_queue = before.queue_max <= 16
+  local jobs = before.threads + (small_queue and before.queue_max + 3 or 2)
+
+  -- one connection per job: a connection runs one statement at a time
+  for i = 1, jobs do
+    conns[i] = db.open({path = ":memory:"})
+  end
+  before = db.executor_stats()
+
+  local done, ok, full = 0, 0, 0
+  for i = 1, jobs do
+    lunet.spawn(function()
+      local rows, err = db.query(conns[i], SLOW)
+      if rows and rows[1].n == 1000000 then
+        ok = ok + 1
+      elseif err == "db executor queue is full" then
+        full = full + 1
+      else
+        fail("slow query: " .. tostring(err))
+      end
+      done = done + 1
+    end)
+  end
+
+  -- the fs pool is separate: this returns while the DB threads are busy
+  local st = fs.stat(".")
+  if not st then
+    fail("fs.stat")
+  end
+  if ok > 0 then
+    fail("fs.stat waited for " .. ok .. " DB jobs")
+  end
+
+  for _ = 1, 1000 do
+    if done == jobs then break end
+    lunet.sleep(10)
+  end
+  if done ~= jobs then
+    return fail(string.format("%d of %d queries finished", done, jobs))
+  end
+
+  local after = db.executor_stats()
+  if after.submitted - before.submitted ~= ok or after.completed - before.completed ~= ok then
+    fail(string.format("submitted +%d, completed +%d, expected %d", after.submitted - before.submitted,
+                       after.completed - before.completed, ok))
+  end
+  if after.rejected - before.rejected ~= full then
+    fail(string.format("rejected +%d, but %d calls saw a full queue", after.rejected - before.rejected, full))
+  end
+  if after.queued ~= 0 or after.running ~= 0 then
+    fail(string.format("idle executor reports queued=%d running=%d", after.queued, after.running))
+  end
+  if small_queue and full == 0 then
+    fail("no request was rejected with LUNET_DB_QUEUE=" .. before.queue_max)
+  end
+  if after.run_ms_total <= before.run_ms_total then
+    fail("run_ms_total did not grow")
+  end
+
+  for i = 1, jobs do
+    db.close(conns[i])
+  end
+  print(string.format("PASS: db executor (%d threads, %d ok, %d rejected)", after.threads, ok, full))
+end)
@@ -0,0 +1,94 @@
+--[[
+  String parameters are bound in place from the Lua string (SQLite): bytes
+  after an embedded NUL survive, multi-megabyte strings round-trip, and
+  strings nobody else references stay valid while the query is in flight
+  and the collector runs.
+]]
+
+local lunet = require("lunet")
+local db = require("lunet.sqlite3")
+
+local function fail(msg)
+  io.stderr:write("[DB_PARAMS] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+local function tohex(s)
+  return (s:gsub(".", function(c) return string.format("%02X", c:byte()) end))
+end
+
+lunet.spawn(function()
+  local conn, err = db.open({path = ":memory:"})
+  if not conn then
+    return fail("open: " .. tostring(err))
+  end
+  db.exec(conn, "CREATE TABLE t (id INTEGER PRIMARY KEY, v TEXT)")
+
+  -- The bound length comes from the Lua string, not strlen()
+  local nul = "a\0b\0\0c"
+  local r = db.query_params(conn, "SELECT hex(?) AS h, length(CAST(? AS BLOB)) AS n", nul, nul)
+  expect("hex with NULs", r and r[1].h, tohex(nul))
+  expect("byte length with NULs", r and r[1].n, #nul)
+
+  -- 3 MB through exec_params and back through a query
+  local big = string.rep("xyz", 1024 * 1024)
+  local res, eerr = db.exec_params(conn, "INSERT INTO t (id, v) VALUES (?, ?)", 1, big)
+  if not res then
+    return fail("insert big: " .. tostring(eerr))
+  end
+  r = db.query_params(conn, "SELECT length(v) AS n, substr(v, -3) AS tail FROM t WHERE id = ?", 1)
+  expect("big length", r and r[1].n, #big)
+  expect("big tail", r and r[1].tail, "xyz")
+  r = db.query_params(conn, "SELECT v FROM t WHERE id = ?", 1)
+  expect("big round-trip", r and r[1].v == big, true)
+
+  -- Temporaries referenced only by the suspended call survive a full GC
+  local collecting = true
+  lunet.spawn(function()
+    while collecting do
+      collectgarbage("collect")
+      lunet.sleep(1)
+    end
+  end)
+  for i = 1, 50 do
+    local q = db.query_params(conn, "SELECT ? AS s", string.rep("p", 4096) .. i)
+    if not q or q[1].s ~= string.rep("p", 4096) .. i then
+      fail("temporary parameter " .. i .. " changed in flight")
+      break
+    end
+  end
+
+  -- exec_batch pins its strings on its own, so rewriting the tuples after
+  -- the call is queued does not change what gets inserted
+  local tuples = {}
+  for i = 1, 100 do
+    tuples[i] = {100 + i, string.rep("b", 1000) .. i}
+  end
+  local done
+  lunet.spawn(function()
+    done = db.exec_batch(conn, "INSERT INTO t (id, v) VALUES (?, ?)", tuples) or false
+  end)
+  for i = 1, 100 do
+    tuples[i][2] = "changed"
+  end
+  tuples = nil
+  collectgarbage("collect")
+  while done == nil do
+    lunet.sleep(1)
+  end
+  collecting = false
+  expect("batch", done and done.affected_rows, 100)
+  r = db.query(conn, "SELECT count(*) AS n FROM t WHERE id > 100 AND length(v) > 1000")
+  expect("batch strings intact", r and r[1].n, 100)
+  r = db.query_params(conn, "SELECT v FROM t WHERE id = ?", 150)
+  expect("batch row 50", r and r[1].v, string.rep("b", 1000) .. 50)
+
+  db.close(conn)
+  print("PASS: db string params")
+end)
@@ -0,0 +1,118 @@
+--[[
+  db.pool: requests wait in FIFO order when every connection is busy,
+  db.close(pool) fails what is still queued, and (PostgreSQL, when a server
+  is reachable on 127.0.0.1:5432) a connection that fails its health check
+  is dropped and the request is retried once on a fresh connection.
+]]
+
+local lunet = require("lunet")
+local sqlite = require("lunet.sqlite3")
+
+local function fail(msg)
+  io.stderr:write("[DB_POOL] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+-- Start n requests in submission order; returns the completion log
+local function submit(pool, n)
+  local log = {}
+  for i = 1, n do
+    lunet.spawn(function()
+      local rows, err = sqlite.query(pool, "SELECT ? AS v", i)
+      log[#log + 1] = rows and rows[1].v or err
+    end)
+  end
+  return log
+end
+
+local function wait_for(log, n)
+  for _ = 1, 300 do
+    if #log >= n then return true end
+    lunet.sleep(10)
+  end
+  return false
+end
+
+local function fifo()
+  local pool = sqlite.pool({path = ":memory:"}, {min = 1, max = 1})
+  local log = submit(pool, 6)
+  if not wait_for(log, 6) then
+    return fail("fifo: only " .. #log .. " of 6 requests finished")
+  end
+  for i = 1, 6 do
+    if log[i] ~= i then
+      return fail(string.format("fifo: completion %d was %s", i, tostring(log[i])))
+    end
+  end
+  local st = sqlite.pool_stats(pool)
+  if st.size ~= 1 or st.acquired ~= 6 or st.waited < 5 then
+    fail(string.format("fifo stats: size=%d acquired=%d waited=%d", st.size, st.acquired, st.waited))
+  end
+  sqlite.close(pool)
+end
+
+local function close_fails_queue()
+  local pool = sqlite.pool({path = ":memory:"}, {min = 1, max = 1})
+  sqlite.query(pool, "SELECT 1")  -- connection open and idle
+  local log = submit(pool, 4)
+  sqlite.close(pool)
+  if not wait_for(log, 4) then
+    return fail("close: only " .. #log .. " of 4 requests finished")
+  end
+  local closed = 0
+  for i = 1, 4 do
+    if log[i] == "pool is closed" then closed = closed + 1 end
+  end
+  -- the first request already holds the connection and still finishes
+  if log[1] ~= 1 or closed ~= 3 then
+    fail(string.format("close: %d requests failed with \"pool is closed\", first got %s", closed, tostring(log[1])))
+  end
+  local rows, err = sqlite.query(pool, "SELECT 1")
+  if rows or err ~= "pool is closed" then
+    fail("query on a closed pool: " .. tostring(err))
+  end
+end
+
+local function stale_retry()
+  local ok, pg = pcall(require, "lunet.postgres")
+  if not ok then
+    return print("SKIP: stale retry (lunet.postgres not built)")
+  end
+  local params = {host = "127.0.0.1", port = 5432, user = os.getenv("USER") or "postgres",
+                  password = "", database = "postgres"}
+  local admin = pg.open(params)
+  if not admin then
+    return print("SKIP: stale retry (PostgreSQL not reachable)")
+  end
+
+  -- check_ms = 0 pings on every checkout
+  local pool = pg.pool(params, {min = 1, max = 1, check_ms = 0})
+  local rows, err = pg.query(pool, "SELECT pg_backend_pid() AS pid")
+  if not rows then
+    pg.close(admin)
+    return fail("pool query: " .. tostring(err))
+  end
+  local pid = tostring(rows[1].pid)
+  pg.query(admin, "SELECT pg_terminate_backend($1)", tonumber(pid))
+  lunet.sleep(50)
+
+  rows, err = pg.query(pool, "SELECT pg_backend_pid() AS pid")
+  if not rows then
+    fail("request on a killed connection was not retried: " .. tostring(err))
+  elseif tostring(rows[1].pid) == pid then
+    fail("retry ran on the killed connection")
+  end
+  local st = pg.pool_stats(pool)
+  if st.dropped ~= 1 or st.opened ~= 2 then
+    fail(string.format("stale stats: dropped=%d opened=%d", st.dropped, st.opened))
+  end
+  pg.close(pool)
+  pg.close(admin)
+end
+
+lunet.spawn(function()
+  fifo()
+  close_fails_queue()
+  stale_retry()
+  print("PASS: db pool")
+end)
@@ -0,0 +1,106 @@
+--[[
+  db.query result shapes (SQLite): {shape = "arrays"} and {shape = "columns"}
+  carry the same cells as the default rows, with NULLs left as holes, and
+  {ffi = true} turns NULL-free numeric columns into 0-based cdata arrays:
+  double[?] unless an integer is too large to be exact in a double.
+]]
+
+local lunet = require("lunet")
+local db = require("lunet.sqlite3")
+
+local function fail(msg)
+  io.stderr:write("[DB_SHAPE] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+local SQL = "SELECT id, score, name, note FROM t ORDER BY id"
+
+lunet.spawn(function()
+  local conn, err = db.open({path = ":memory:"})
+  if not conn then
+    return fail("open: " .. tostring(err))
+  end
+  db.exec(conn, "CREATE TABLE t (id INTEGER, score REAL, name TEXT, note TEXT)")
+  db.exec(conn, "INSERT INTO t VALUES (1, 1.5, 'a', NULL), (2, 2.5, 'b', 'x'), (3, 3.5, NULL, NULL)")
+
+  local rows = db.query(conn, SQL, {shape = "rows"})
+  expect("rows", rows and #rows, 3)
+  expect("rows[2].note", rows[2].note, "x")
+
+  local arr, aerr = db.query(conn, SQL, {shape = "arrays"})
+  if not arr then
+    return fail("arrays: " .. tostring(aerr))
+  end
+  expect("arrays columns", table.concat(arr.columns, ","), "id,score,name,note")
+  expect("arrays nrows", arr.nrows, 3)
+  expect("arrays rows", #arr.rows, 3)
+  expect("arrays [1][1]", arr.rows[1][1], 1)
+  expect("arrays [1][2]", arr.rows[1][2], 1.5)
+  expect("arrays [1][3]", arr.rows[1][3], "a")
+  expect("arrays [1][4] hole", arr.rows[1][4], nil)
+  expect("arrays [2][4]", arr.rows[2][4], "x")
+  expect("arrays [3][3] hole", arr.rows[3][3], nil)
+
+  local col, cerr = db.query(conn, SQL, {shape = "columns"})
+  if not col then
+    return fail("columns: " .. tostring(cerr))
+  end
+  expect("columns nrows", col.nrows, 3)
+  expect("columns values", #col.values, 4)
+  expect("columns id", table.concat(col.values[1], ","), "1,2,3")
+  expect("columns score[3]", col.values[2][3], 3.5)
+  expect("columns name[3] hole", col.values[3][3], nil)
+  expect("columns note[1] hole", col.values[4][1], nil)
+  expect("columns note[2]", col.values[4][2], "x")
+
+  local ok_ffi = pcall(require, "ffi")
+  if ok_ffi then
+    local f = db.query(conn, SQL, {shape = "columns", ffi = true})
+    expect("ffi id type", type(f.values[1]), "cdata")
+    expect("ffi score type", type(f.values[2]), "cdata")
+    expect("ffi id[0]", tonumber(f.values[1][0]), 1)
+    expect("ffi id[2]", tonumber(f.values[1][2]), 3)
+    expect("ffi score[1]", tonumber(f.values[2][1]), 2.5)
+    -- Integers that fit in a double index as plain numbers, not boxed int64
+    expect("ffi id cell type", type(f.values[1][0]), "number")
+
+    local big = db.query(conn, "SELECT 9007199254740993 AS v UNION ALL SELECT 1 ORDER BY v DESC",
+                         {shape = "columns", ffi = true})
+    local ffi = require("ffi")
+    expect("ffi wide int type", tostring(ffi.typeof(big.values[1])):match("int64_t") ~= nil, true)
+    expect("ffi wide int exact", tostring(big.values[1][0]), "9007199254740993LL")
+    -- Text and NULL-holding columns stay tables
+    expect("ffi name type", type(f.values[3]), "table")
+    expect("ffi note type", type(f.values[4]), "table")
+
+    local nul = db.query(conn, "SELECT CASE WHEN id = 2 THEN NULL ELSE id END AS v FROM t ORDER BY id",
+                         {shape = "columns", ffi = true})
+    expect("ffi with NULL", type(nul.values[1]), "table")
+    expect("ffi with NULL hole", nul.values[1][2], nil)
+  end
+
+  -- Options follow the bound parameters
+  local p = db.query_params(conn, "SELECT id FROM t WHERE id > ? ORDER BY id", 1, {shape = "arrays"})
+  expect("query_params arrays nrows", p and p.nrows, 2)
+  expect("query_params arrays [1][1]", p and p.rows[1][1], 2)
+
+  local empty = db.query(conn, "SELECT id, name FROM t WHERE id > 10", {shape = "arrays"})
+  expect("empty nrows", empty and empty.nrows, 0)
+  expect("empty rows", empty and #empty.rows, 0)
+  expect("empty columns", empty and #empty.columns, 2)
+
+  local bad, berr = db.query(conn, SQL, {shape = "grid"})
+  expect("bad shape result", bad, nil)
+  if not tostring(berr):find("shape must be", 1, true) then
+    fail("bad shape error: " .. tostring(berr))
+  end
+
+  db.close(conn)
+  print("PASS: db result shapes")
+end)
@@ -0,0 +1,78 @@
+--[[
+  Per-connection prepared statement cache (SQLite): LRU hits, misses and
+  evictions as reported by db.stmt_cache_stats, stmt_cache = 0 disabling
+  it, and cached statements staying correct across a schema change.
+]]
+
+local lunet = require("lunet")
+local db = require("lunet.sqlite3")
+
+local function fail(msg)
+  io.stderr:write("[DB_STMT_CACHE] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local Q1 = "SELECT id FROM t WHERE id = ?"
+local Q2 = "SELECT name FROM t WHERE id = ?"
+local Q3 = "SELECT count(*) AS n FROM t WHERE id > ?"
+
+local function delta(conn, base)
+  local st = db.stmt_cache_stats(conn)
+  return {
+    size = st.size,
+    capacity = st.capacity,
+    hits = st.hits - base.hits,
+    misses = st.misses - base.misses,
+    evictions = st.evictions - base.evictions,
+  }
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+lunet.spawn(function()
+  local conn, err = db.open({path = ":memory:", stmt_cache = 2})
+  if not conn then
+    return fail("open: " .. tostring(err))
+  end
+  db.exec(conn, "CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT)")
+  db.exec(conn, "INSERT INTO t (id, name) VALUES (?, ?)", 1, "one")
+  local base = db.stmt_cache_stats(conn)
+
+  -- the INSERT holds one of the two slots
+  db.query(conn, Q1, 1)  -- miss
+  db.query(conn, Q1, 1)  -- hit
+  db.query(conn, Q2, 1)  -- miss, evicts the INSERT
+  db.query(conn, Q3, 0)  -- miss, evicts Q1 (least recently used)
+  db.query(conn, Q2, 1)  -- hit
+  local rows = db.query(conn, Q1, 1)  -- miss again, evicts Q3
+  expect("Q1 result", rows and rows[1] and rows[1].id, 1)
+
+  local st = delta(conn, base)
+  expect("hits", st.hits, 2)
+  expect("misses", st.misses, 4)
+  expect("evictions", st.evictions, 3)
+  expect("size", st.size, 2)
+  expect("capacity", st.capacity, 2)
+
+  -- a cached statement is re-prepared by SQLite after the schema changes
+  db.exec(conn, "ALTER TABLE t ADD COLUMN extra TEXT")
+  db.exec(conn, "UPDATE t SET name = ? WHERE id = ?", "uno", 1)
+  rows = db.query(conn, Q2, 1)
+  expect("Q2 after ALTER", rows and rows[1] and rows[1].name, "uno")
+  db.close(conn)
+
+  local off = db.open({path = ":memory:", stmt_cache = 0})
+  db.query(off, "SELECT ? AS v", 1)
+  db.query(off, "SELECT ? AS v", 1)
+  st = db.stmt_cache_stats(off)
+  expect("disabled size", st.size, 0)
+  expect("disabled capacity", st.capacity, 0)
+  expect("disabled hits", st.hits, 0)
+  db.close(off)
+
+  print("PASS: db stmt cache")
+end)
@@ -0,0 +1,127 @@
+--[[
+  fs.readfile / fs.writefile / fs.walk: whole-file round trips (binary,
+  larger than one read chunk, and files whose size stat reports as 0),
+  atomic replacement leaving no temporary behind, and depth-first walks
+  that list symlinks without following them and honour {depth = n}.
+]]
+
+local lunet = require("lunet")
+local fs = require("lunet.fs")
+
+local function fail(msg)
+  io.stderr:write("[FS_BATCH] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %q, got %q", what, tostring(want), tostring(got)))
+  end
+end
+
+local ROOT = ".tmp/fs_batch"
+
+local function test_files()
+  local parts = {}
+  for i = 0, 200 * 1024 do
+    parts[#parts + 1] = string.char(i % 256)
+  end
+  local data = table.concat(parts)
+  local path = ROOT .. "/data.bin"
+
+  expect("writefile bytes", fs.writefile(path, data), #data)
+  local back, err = fs.readfile(path)
+  if back ~= data then
+    fail("readfile round trip: " .. tostring(err or (back and #back)))
+  end
+  expect("writefile empty", fs.writefile(path, ""), 0)
+  expect("readfile empty", fs.readfile(path), "")
+
+  -- procfs reports size 0; readfile reads to EOF anyway
+  if fs.stat("/proc/self/status") then
+    local status = fs.readfile("/proc/self/status")
+    if not status or not status:find("Name:", 1, true) then
+      fail("readfile /proc/self/status returned " .. tostring(status and #status))
+    end
+  end
+
+  local none, rerr = fs.readfile(ROOT .. "/missing")
+  expect("readfile missing", none, nil)
+  if not rerr then fail("readfile of a missing file returned no error") end
+  none, rerr = fs.readfile(ROOT)
+  expect("readfile directory", none, nil)
+  if not rerr then fail("readfile of a directory returned no error") end
+
+  -- Atomic replacement: new contents, and the temp sibling is gone
+  local target = ROOT .. "/config.json"
+  fs.writefile(target, "old")
+  expect("atomic bytes", fs.writefile(target, '{"new":true}', {atomic = true}), 12)
+  expect("atomic contents", fs.readfile(target), '{"new":true}')
+  expect("atomic new file", fs.writefile(ROOT .. "/fresh.json", "x", {atomic = true}), 1)
+  for _, e in ipairs(fs.scandir(ROOT) or {}) do
+    local name = type(e) == "table" and e.name or e
+    if tostring(name):match("%.json%.") then
+      fail("atomic write left " .. tostring(name) .. " behind")
+    end
+  end
+
+  none, rerr = fs.writefile(ROOT .. "/no/such/dir/file", "x")
+  expect("writefile into missing dir", none, nil)
+  if not rerr then fail("writefile into a missing directory returned no error") end
+  none, rerr = fs.writefile(ROOT .. "/no/such/dir/file", "x", {atomic = true})
+  expect("atomic writefile into missing dir", none, nil)
+end
+
+local function test_walk()
+  local tree = ROOT .. "/tree"
+  os.execute("mkdir -p " .. tree .. "/sub/deep && ln -sfn sub " .. tree .. "/link")
+  fs.writefile(tree .. "/a.txt", "a")
+  fs.writefile(tree .. "/sub/b.txt", "b")
+  fs.writefile(tree .. "/sub/deep/c.txt", "c")
+
+  local ents, err = fs.walk(tree)
+  if not ents then
+    return fail("walk: " .. tostring(err))
+  end
+  local by, order = {}, {}
+  for i, e in ipairs(ents) do
+    by[e.path] = e
+    order[e.path] = i
+  end
+  expect("walk entries", #ents, 6)
+  expect("a.txt", by[tree .. "/a.txt"] and by[tree .. "/a.txt"].type, "file")
+  expect("sub", by[tree .. "/sub"] and by[tree .. "/sub"].type, "dir")
+  expect("deep c.txt", by[tree .. "/sub/deep/c.txt"] and by[tree .. "/sub/deep/c.txt"].name, "c.txt")
+  expect("link", by[tree .. "/link"] and by[tree .. "/link"].type, "link")
+  expect("link not followed", by[tree .. "/link/b.txt"], nil)
+  -- Depth-first: a directory's children follow it before its next sibling
+  local sub, deep = order[tree .. "/sub"], order[tree .. "/sub/deep"]
+  if not (sub and deep and sub < order[tree .. "/sub/b.txt"] and deep < order[tree .. "/sub/deep/c.txt"]) then
+    fail("walk is not depth-first")
+  end
+
+  local top = fs.walk(tree, {depth = 1})
+  expect("depth 1", top and #top, 3)
+  local two = fs.walk(tree, {depth = 2})
+  expect("depth 2", two and #two, 5)
+
+  -- A trailing slash on the root is not doubled
+  local slash = fs.walk(tree .. "/", {depth = 1})
+  for _, e in ipairs(slash or {}) do
+    if e.path:find("//", 1, true) then
+      fail("walk joined " .. e.path)
+    end
+  end
+
+  local none, werr = fs.walk(ROOT .. "/missing")
+  expect("walk missing root", none, nil)
+  if not werr then fail("walk of a missing root returned no error") end
+end
+
+lunet.spawn(function()
+  os.execute("rm -rf " .. ROOT .. " && mkdir -p " .. ROOT)
+  test_files()
+  test_walk()
+  os.execute("rm -rf " .. ROOT)
+  print("PASS: fs readfile/writefile/walk")
+end)
@@ -0,0 +1,109 @@
+--[[
+  fs.mmap: the mapping reads back the file through sub() and ptr(), slices
+  are clamped, writes to the file show through the shared mapping, advise()
+  accepts the documented hints, and the mapping is unusable once closed
+  while strings already taken from it stay valid.
+]]
+
+local lunet = require("lunet")
+local fs = require("lunet.fs")
+
+local function fail(msg)
+  io.stderr:write("[FS_MMAP] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %q, got %q", what, tostring(want), tostring(got)))
+  end
+end
+
+local PATH = ".tmp/fs_mmap_test.bin"
+local EMPTY = ".tmp/fs_mmap_empty.bin"
+
+lunet.spawn(function()
+  if package.config:sub(1, 1) == "\\" then
+    return print("SKIP: fs.mmap (not supported on Windows)")
+  end
+
+  local parts = {}
+  for i = 0, 3 * 4096 + 99 do
+    parts[#parts + 1] = string.char(i % 251)
+  end
+  local data = table.concat(parts)
+  local _, werr = fs.writefile(PATH, data)
+  if werr then
+    return fail("writefile: " .. werr)
+  end
+
+  local m, err = fs.mmap(PATH, "sequential")
+  if not m then
+    return fail("mmap: " .. tostring(err))
+  end
+  expect("len", m:len(), #data)
+  expect("#m", #m, #data)
+  expect("whole file", m:sub(0) == data, true)
+  expect("head", m:sub(0, 4), data:sub(1, 4))
+  expect("page boundary", m:sub(4095, 3), data:sub(4096, 4098))
+  expect("clamped tail", m:sub(#data - 2, 100), data:sub(-2))
+  expect("offset at end", m:sub(#data), "")
+  expect("negative offset", m:sub(-1, 4), "")
+  expect("zero length", m:sub(0, 0), "")
+
+  local ok_ffi, ffi = pcall(require, "ffi")
+  if ok_ffi then
+    local p = ffi.cast("const uint8_t *", m:ptr())
+    expect("ptr[0]", p[0], data:byte(1))
+    expect("ptr[last]", p[#data - 1], data:byte(-1))
+    expect("ffi.string", ffi.string(p + 8192, 16), data:sub(8193, 8208))
+  end
+
+  for _, hint in ipairs({"normal", "sequential", "random", "willneed", "dontneed"}) do
+    local ok, aerr = m:advise(hint)
+    if not ok then fail("advise " .. hint .. ": " .. tostring(aerr)) end
+  end
+  expect("advise unaligned range", m:advise("willneed", 5000, 100), true)
+  expect("advise past end", m:advise("willneed", #data + 10), true)
+  local ok, aerr = m:advise("bogus")
+  expect("unknown advice", ok, nil)
+  expect("unknown advice error", aerr, 'unknown advice "bogus"')
+
+  -- MAP_SHARED: a write to the file is visible through the mapping
+  local fd = fs.open(PATH, "r+")
+  fs.pwrite(fd, "ZZ", 10)
+  fs.close(fd)
+  expect("write shows through", m:sub(10, 2), "ZZ")
+
+  -- A second mapping of the same file sees the same bytes
+  local m2 = fs.mmap(PATH)
+  expect("second mapping", m2 and m2:sub(8, 6), m:sub(8, 6))
+
+  local kept = m:sub(100, 50)
+  m:close()
+  m:close()
+  expect("slice after close", kept, (data:sub(1, 10) .. "ZZ" .. data:sub(13)):sub(101, 150))
+  local lok, lerr = pcall(m.len, m)
+  if lok or not tostring(lerr):find("mapping is closed", 1, true) then
+    fail("len after close: " .. tostring(lerr))
+  end
+  m2:close()
+
+  fs.writefile(EMPTY, "")
+  local e = fs.mmap(EMPTY)
+  expect("empty mapping", e and #e, 0)
+  expect("empty sub", e and e:sub(0), "")
+  if e then e:close() end
+
+  local none, merr = fs.mmap(".tmp")
+  expect("directory", none, nil)
+  if not merr then fail("mapping a directory returned no error") end
+  none, merr = fs.mmap(".tmp/fs_mmap_missing.bin")
+  expect("missing file", none, nil)
+  if not merr then fail("mapping a missing file returned no error") end
+  none, merr = fs.mmap(PATH, "bogus")
+  expect("bad open hint", none, nil)
+  expect("bad open hint error", merr, 'unknown advice "bogus"')
+
+  print("PASS: fs mmap")
+end)
@@ -0,0 +1,117 @@
+--[[
+  Positional file I/O: pwrite/pwritev land at their offsets, pread/preadv
+  return short chunks at end of file, pread fills a lunet.buffer in place
+  (and refuses unbounded cdata or lightuserdata destinations), NaN and
+  out-of-range sizes or offsets are errors, and concurrent preads on one fd
+  each get their own region.
+]]
+
+local lunet = require("lunet")
+local fs = require("lunet.fs")
+local buffer = require("lunet.buffer")
+
+local function fail(msg)
+  io.stderr:write("[FS_PIO] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %q, got %q", what, tostring(want), tostring(got)))
+  end
+end
+
+local PATH = ".tmp/fs_pio_test.bin"
+
+lunet.spawn(function()
+  local fd, err = fs.open(PATH, "w+")
+  if not fd then
+    return fail("open: " .. tostring(err))
+  end
+
+  expect("pwritev", fs.pwritev(fd, {"hello ", "world", buffer.from("!!")}, 0), 13)
+  expect("pwrite", fs.pwrite(fd, "HELLO", 0), 5)
+  expect("pwrite buffer", fs.pwrite(fd, buffer.from("W"), 6), 1)
+
+  expect("pread", fs.pread(fd, 5, 0), "HELLO")
+  expect("pread short at eof", fs.pread(fd, 100, 6), "World!!")
+  expect("pread past eof", fs.pread(fd, 10, 1000), "")
+
+  local parts = fs.preadv(fd, {5, 1, 5, 10}, 0)
+  expect("preadv count", parts and #parts, 4)
+  expect("preadv joined", parts and table.concat(parts, "|"), "HELLO| |World|!!")
+
+  -- Into a lunet.buffer: size is capped at #buf, the tail is left alone
+  local buf = buffer.new(8, string.byte("."))
+  expect("pread into buffer", fs.pread(fd, 100, 6, buf), 7)
+  expect("buffer contents", buf:tostring(), "World!!.")
+  local view = buf:sub(2, 3)
+  expect("pread into view", fs.pread(fd, 3, 0, view), 3)
+  expect("view wrote through", buf:tostring(), "WoHEL!!.")
+
+  -- Destinations without a length are refused: nothing to bound the read
+  local raw = buffer.new(5)
+  local n, perr = fs.pread(fd, 5, 6, raw:ptr())
+  expect("lightuserdata buffer", n, nil)
+  expect("lightuserdata buffer error", perr, "fs.pread buffer must be a lunet.buffer")
+  local ok_ffi, ffi = pcall(require, "ffi")
+  if ok_ffi then
+    local arr = ffi.new("uint8_t[?]", 5)
+    n, perr = fs.pread(fd, 5, 0, ffi.cast("uint8_t *", arr))
+    expect("pointer cdata buffer", n, nil)
+    expect("pointer cdata buffer error", perr, "fs.pread buffer must be a lunet.buffer")
+  end
+
+  -- Bad arguments are errors, not reads at the current position
+  n, perr = fs.pread(fd, 5, -1)
+  expect("negative offset", n, nil)
+  if not perr then fail("negative offset returned no error") end
+  n, perr = fs.pread(fd, 5, 0, {})
+  expect("table as buffer", n, nil)
+  expect("table as buffer error", perr, "fs.pread buffer must be a lunet.buffer")
+  local bad_reads = {
+    {"NaN size", 0 / 0, 0}, {"NaN offset", 5, 0 / 0}, {"negative size", -1, 0},
+    {"huge size", 2 ^ 40, 0}, {"huge offset", 5, 2 ^ 64}, {"infinite offset", 5, math.huge},
+  }
+  for _, case in ipairs(bad_reads) do
+    n, perr = fs.pread(fd, case[2], case[3])
+    expect(case[1], n, nil)
+    expect(case[1] .. " error", perr, "fs.pread requires fd, length and offset")
+  end
+  n, perr = fs.preadv(fd, {5, 0 / 0}, 0)
+  expect("preadv NaN length", n, nil)
+  expect("preadv NaN length error", perr, "fs.preadv length 2 must be a non-negative number")
+  n, perr = fs.preadv(fd, {2 ^ 30, 2 ^ 30, 2 ^ 30}, 0)
+  expect("preadv total overflow", n, nil)
+  expect("preadv total overflow error", perr, "fs.preadv lengths add up to more than 2 GiB")
+  n, perr = fs.pwrite(fd, "x", 0 / 0)
+  expect("pwrite NaN offset", n, nil)
+  n, perr = fs.preadv(fd, {}, 0)
+  expect("empty preadv", n, nil)
+  expect("empty preadv error", perr, "fs.preadv takes 1 to 1024 lengths")
+
+  -- 32 coroutines read 32 regions of one fd at once
+  local block = 4096
+  local chunks = {}
+  for i = 1, 32 do
+    chunks[i] = string.rep(string.char(64 + i), block)
+  end
+  expect("pwritev blocks", fs.pwritev(fd, chunks, 0), 32 * block)
+  local done = 0
+  for i = 1, 32 do
+    lunet.spawn(function()
+      local dst = buffer.new(block)
+      local got = fs.pread(fd, block, (i - 1) * block, dst)
+      if got ~= block or dst:tostring() ~= chunks[i] then
+        fail("concurrent pread " .. i .. " read the wrong region")
+      end
+      done = done + 1
+    end)
+  end
+  while done < 32 do
+    lunet.sleep(1)
+  end
+
+  fs.close(fd)
+  print("PASS: fs positional I/O")
+end)
@@ -0,0 +1,381 @@
+--[[
+  lunet.httpc against a plain HTTP/1.1 server on 127.0.0.1 written with
+  lunet.socket: concurrent requests are multiplexed on the loop thread
+  rather than queued behind a thread pool, timeouts and failures are
+  reported per request, and keep-alive connections are reused across
+  requests (counted both by httpc.stats and by the server's accepts).
+  httpc.stream reads a large body with backpressure, stops early on
+  close(), and uploads from an fs fd and from a producer coroutine.
+  Skips if lunet.httpc is not built.
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+local fs = require("lunet.fs")
+
+local ok_httpc, httpc = pcall(require, "lunet.httpc")
+
+local function fail(msg)
+  io.stderr:write("[HTTPC] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+local HOST, PORT = "127.0.0.1", 20031
+local BASE = "http://" .. HOST .. ":" .. PORT
+
+local server = {accepts = 0, conns = {}, big_sent = 0}
+
+local BIG = string.rep("0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ!?", 512 * 1024)  -- 32 MiB
+local UPLOAD_PATH = ".tmp/httpc_upload.bin"
+
+local function respond(conn, status, body, extra)
+  return socket.write(conn, string.format("HTTP/1.1 %s\r\nContent-Length: %d\r\n%s\r\n%s", status, #body,
+                                          extra or "", body))
+end
+
+-- Request body: Content-Length or chunked. Returns nil if the peer went away.
+local function read_body(conn, head)
+  local lower = head:lower()
+  if lower:find("\r\nexpect: *100%-continue") then
+    socket.write(conn, "HTTP/1.1 100 Continue\r\n\r\n")
+  end
+  local len = tonumber(lower:match("\r\ncontent%-length: *(%d+)"))
+  if len == 0 then return "" end
+  if len then return socket.read_exact(conn, len) end
+  if not lower:find("\r\ntransfer%-encoding: *chunked") then
+    return ""
+  end
+  local parts = {}
+  while true do
+    local line = socket.read_until(conn, "\r\n", 1024)
+    local size = line and tonumber(line:match("^%x+"), 16)
+    if not size then return nil end
+    if size == 0 then
+      -- no trailers are sent, just the empty line
+      return socket.read_until(conn, "\r\n", 1024) and table.concat(parts)
+    end
+    local data = socket.read_exact(conn, size)
+    if not data or not socket.read_exact(conn, 2) then return nil end
+    parts[#parts + 1] = data
+  end
+end
+
+-- The 32 MiB body in 64 KiB writes; big_sent shows how far the reader let us get
+local function send_big(conn)
+  server.big_sent = 0
+  if socket.write(conn, string.format("HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n", #BIG)) then
+    return false
+  end
+  for off = 1, #BIG, 65536 do
+    if not server.conns[conn] or socket.write(conn, BIG:sub(off, off + 65535)) then
+      return false
+    end
+    server.big_sent = off + 65535
+  end
+  return true
+end
+
+-- One keep-alive connection: parse request heads and answer until EOF.
+-- A connection closed by stop_server() is not touched again.
+local function serve(conn)
+  server.conns[conn] = true
+  while true do
+    local head = socket.read_until(conn, "\r\n\r\n", 65536)
+    if not head or not server.conns[conn] then break end
+    local path = head:match("^%u+ (%S+) HTTP/1%.1")
+    local body = read_body(conn, head)
+    if not body or not server.conns[conn] then break end
+
+    local ms = path and tonumber(path:match("^/slow%?ms=(%d+)"))
+    if ms then
+      lunet.sleep(ms)
+      if not server.conns[conn] then return end
+      respond(conn, "200 OK", path)
+    elseif path == "/echo" then
+      respond(conn, "200 OK", body)
+    elseif path == "/big" then
+      if not send_big(conn) then break end
+    elseif path == "/close" then
+      respond(conn, "200 OK", "bye", "Connection: close\r\n")
+      break
+    elseif path == "/hello" then
+      respond(conn, "200 OK", "hello", "X-Test: a\r\nX-Test: b\r\n")
+    else
+      respond(conn, "404 Not Found", "")
+    end
+  end
+  if server.conns[conn] then
+    server.conns[conn] = nil
+    socket.close(conn)
+  end
+end
+
+local function start_server()
+  local listener, err = socket.listen("tcp", HOST, PORT)
+  if not listener then return nil, err end
+  server.listener = listener
+  lunet.spawn(function()
+    while true do
+      local conn = socket.accept(listener)
+      if not conn then break end
+      server.accepts = server.accepts + 1
+      lunet.spawn(function() serve(conn) end)
+    end
+  end)
+  return true
+end
+
+-- libcurl keeps its connections cached, so close our ends to let the loop exit
+local function stop_server()
+  socket.close(server.listener)
+  for conn in pairs(server.conns) do
+    server.conns[conn] = nil
+    socket.close(conn)
+  end
+end
+
+local function delta(base)
+  local st = httpc.stats()
+  local d = {}
+  for k, v in pairs(st) do
+    d[k] = type(v) == "number" and base[k] and v - base[k] or v
+  end
+  return d
+end
+
+local function test_multiplexed()
+  local base = httpc.stats()
+  local N, done = 50, 0
+  local t0 = lunet.hrtime()
+  for i = 1, N do
+    lunet.spawn(function()
+      local resp, err = httpc.request({url = BASE .. "/slow?ms=200&i=" .. i})
+      if not resp then
+        fail("request " .. i .. ": " .. tostring(err))
+      elseif resp.status ~= 200 or resp.body ~= "/slow?ms=200&i=" .. i then
+        fail(string.format("request %d got %s %q", i, tostring(resp.status), tostring(resp.body)))
+      end
+      done = done + 1
+    end)
+  end
+  if httpc.stats().in_flight ~= N then
+    fail("in_flight is " .. httpc.stats().in_flight .. " with " .. N .. " requests started")
+  end
+  while done < N do
+    lunet.sleep(5)
+  end
+  -- A pool of worker threads would serialize these into rounds of 200ms
+  local elapsed_ms = (lunet.hrtime() - t0) / 1e6
+  if elapsed_ms > 1500 then
+    fail(string.format("%d concurrent 200ms requests took %.0fms", N, elapsed_ms))
+  end
+  local d = delta(base)
+  expect("requests", d.requests, N)
+  expect("completed", d.completed, N)
+  expect("failed", d.failed, 0)
+  expect("in_flight after", d.in_flight, 0)
+
+  local resp = httpc.request({url = BASE .. "/hello"})
+  expect("hello body", resp and resp.body, "hello")
+  local seen = {}
+  for _, h in ipairs(resp and resp.headers or {}) do
+    if h.name == "X-Test" then seen[#seen + 1] = h.value end
+  end
+  expect("duplicate headers", table.concat(seen, ","), "a,b")
+  resp = httpc.request({url = BASE .. "/missing"})
+  expect("404 is a response", resp and resp.status, 404)
+end
+
+local function test_failures()
+  local base = httpc.stats()
+  local resp, err = httpc.request({url = BASE .. "/slow?ms=1000", timeout_ms = 100})
+  expect("timed out response", resp, nil)
+  if not tostring(err):lower():find("time", 1, true) then
+    fail("timeout error: " .. tostring(err))
+  end
+  -- Nothing listens on PORT + 1
+  resp, err = httpc.request({url = "http://127.0.0.1:" .. (PORT + 1) .. "/", timeout_ms = 2000})
+  expect("refused response", resp, nil)
+  if not err then
+    fail("refused connection returned no error")
+  end
+  local d = delta(base)
+  expect("failed", d.failed, 2)
+  expect("in_flight after failures", d.in_flight, 0)
+end
+
+local function test_reuse()
+  local base = httpc.stats()
+  local accepts = server.accepts
+  local N = 20
+  for i = 1, N do
+    local resp, err = httpc.request({url = BASE .. "/hello"})
+    if not resp or resp.body ~= "hello" then
+      return fail("sequential request " .. i .. ": " .. tostring(err))
+    end
+  end
+  -- At most the first request connects; the rest ride the cached connection
+  local d = delta(base)
+  local opened = server.accepts - accepts
+  if opened > 1 then
+    fail(string.format("%d sequential requests opened %d connections", N, opened))
+  end
+  expect("connects match accepts", d.connects, opened)
+  expect("reused", d.reused, N - opened)
+  if httpc.stats().reuse_rate <= 0 then
+    fail("reuse_rate is " .. tostring(httpc.stats().reuse_rate))
+  end
+
+  -- A connection the server closed is dropped, not handed to the next request
+  base, accepts = httpc.stats(), server.accepts
+  for i = 1, 3 do
+    local resp, err = httpc.request({url = BASE .. "/close"})
+    expect("close body " .. i, resp and resp.body, "bye")
+    if err then fail("close request " .. i .. ": " .. err) end
+  end
+  local resp = httpc.request({url = BASE .. "/hello"})
+  expect("hello after close", resp and resp.body, "hello")
+  expect("connects after close", delta(base).connects, server.accepts - accepts)
+end
+
+-- Reads a stream to the end; returns the body, or nil and the error
+local function drain(stream)
+  local parts = {}
+  while true do
+    local chunk, err = stream:read()
+    if not chunk then
+      if err then return nil, err end
+      return table.concat(parts)
+    end
+    parts[#parts + 1] = chunk
+  end
+end
+
+local function test_stream_download()
+  local resp, err = httpc.stream({url = BASE .. "/big"})
+  if not resp then
+    return fail("stream: " .. tostring(err))
+  end
+  expect("stream status", resp.status, 200)
+
+  -- Nobody reads for a while: the transfer pauses instead of buffering 32 MiB
+  lunet.sleep(300)
+  if server.big_sent >= #BIG then
+    fail("server sent the whole body to a reader that was not reading")
+  end
+
+  local pos, chunks = 0, 0
+  while true do
+    local chunk, rerr = resp.body:read()
+    if not chunk then
+      if rerr then fail("stream read: " .. rerr) end
+      break
+    end
+    chunks = chunks + 1
+    if chunk ~= BIG:sub(pos + 1, pos + #chunk) then
+      return fail(string.format("stream chunk %d at offset %d differs", chunks, pos))
+    end
+    pos = pos + #chunk
+  end
+  expect("stream bytes", pos, #BIG)
+  if chunks < 2 then
+    fail("32 MiB arrived in " .. chunks .. " chunk")
+  end
+  local again, aerr = resp.body:read()
+  if again ~= nil or aerr ~= nil then
+    fail("read after end: " .. tostring(again) .. ", " .. tostring(aerr))
+  end
+
+  -- close() mid-body cancels the transfer; later reads say so
+  local base = httpc.stats()
+  resp = httpc.stream({url = BASE .. "/big"})
+  local first = resp and resp.body:read()
+  if not first then
+    return fail("second stream returned no data")
+  end
+  resp.body:close()
+  local after, cerr = resp.body:read()
+  expect("read after close", after, nil)
+  expect("read after close error", cerr, "stream closed")
+  local d = delta(base)
+  expect("closed stream in_flight", d.in_flight, 0)
+  expect("closed stream failed", d.failed, 1)
+end
+
+local function test_stream_upload()
+  local data = string.rep("u", 1024 * 1024 + 17)
+  fs.writefile(UPLOAD_PATH, data)
+  local fd, ferr = fs.open(UPLOAD_PATH, "r")
+  if not fd then
+    return fail("open upload file: " .. tostring(ferr))
+  end
+  local resp, err = httpc.stream({url = BASE .. "/echo", upload = fd, upload_size = #data})
+  fs.close(fd)
+  local echoed = resp and drain(resp.body)
+  if not resp or echoed ~= data then
+    fail(string.format("fd upload: %s, echoed %s bytes", tostring(err), tostring(echoed and #echoed)))
+  end
+
+  -- 1.6 MiB from a producer; write() yields whenever 64 KiB is waiting
+  local parts = {}
+  for i = 1, 200 do
+    parts[i] = string.rep(string.char(64 + i % 26), 8192)
+  end
+  resp, err = httpc.stream({
+    url = BASE .. "/echo",
+    method = "POST",
+    upload = function(write)
+      for i = 1, #parts do
+        local ok, werr = write(parts[i])
+        if not ok then error(werr) end
+      end
+    end,
+  })
+  echoed = resp and drain(resp.body)
+  if not resp or echoed ~= table.concat(parts) then
+    fail(string.format("producer upload: %s, echoed %s bytes", tostring(err), tostring(echoed and #echoed)))
+  end
+  -- upload and body are exclusive, and request() has no upload path
+  resp, err = httpc.stream({url = BASE .. "/echo", body = "x", upload = function() end})
+  expect("body with upload", resp, nil)
+  resp, err = httpc.request({url = BASE .. "/echo", upload = function() end})
+  expect("request with upload", err, "upload requires httpc.stream")
+
+  -- A producer that raises aborts the request
+  resp, err = httpc.stream({
+    url = BASE .. "/echo",
+    upload = function(write)
+      write("partial")
+      error("producer gave up")
+    end,
+  })
+  expect("failed producer", resp, nil)
+  if not err then
+    fail("failed producer returned no error")
+  end
+end
+
+lunet.spawn(function()
+  if not ok_httpc then
+    return print("SKIP: httpc (lunet.httpc not built)")
+  end
+  local ok, err = start_server()
+  if not ok then
+    return fail("listen: " .. tostring(err))
+  end
+
+  test_multiplexed()
+  test_failures()
+  test_reuse()
+  test_stream_download()
+  test_stream_upload()
+
+  stop_server()
+  print("PASS: httpc")
+end)
@@ -0,0 +1,134 @@
+--[[
+  lunet.metrics: counters and histograms move with the work that feeds them.
+  fs calls, spawns and resumes are counted exactly, a socket read that had
+  to wait is timed (one served from the buffer is not), the loop probes see
+  iterations, and the exported buckets are cumulative and end at count.
+]]
+
+local lunet = require("lunet")
+local fs = require("lunet.fs")
+local socket = require("lunet.socket")
+
+local SOCKET_PATH = ".tmp/metrics_test.sock"
+pcall(os.remove, SOCKET_PATH)
+
+local function fail(msg)
+  io.stderr:write("[METRICS] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+local function check_hist(name, h)
+  if not (h.p50 <= h.p90 and h.p90 <= h.p99 and h.p99 <= h.p999 and h.p999 <= h.max_ms) then
+    fail(string.format("%s quantiles out of order: %g %g %g %g max %g", name, h.p50, h.p90,
+                       h.p99, h.p999, h.max_ms))
+  end
+  if h.count > 0 and h.mean_ms > h.max_ms then
+    fail(string.format("%s mean %g above max %g", name, h.mean_ms, h.max_ms))
+  end
+  if not h.buckets then return end
+  local last_le, last_n = 0, 0
+  for i, b in ipairs(h.buckets) do
+    if b[1] <= last_le or b[2] <= last_n then
+      return fail(string.format("%s bucket %d not increasing: le %g n %d", name, i, b[1], b[2]))
+    end
+    last_le, last_n = b[1], b[2]
+  end
+  expect(name .. " last cumulative bucket", last_n, h.count)
+end
+
+local function test_fs()
+  local before = lunet.metrics().fs.count
+  for _ = 1, 5 do
+    fs.stat(".")
+  end
+  expect("fs count after 5 stats", lunet.metrics().fs.count - before, 5)
+end
+
+local function test_coroutines()
+  local before = lunet.metrics().coroutines
+  local done = 0
+  for _ = 1, 10 do
+    lunet.spawn(function()
+      lunet.sleep(1)
+      done = done + 1
+    end)
+  end
+  lunet.spawn(function()
+    error("expected error from metrics_test")
+  end)
+  while done < 10 do
+    lunet.sleep(5)
+  end
+  local after = lunet.metrics().coroutines
+  expect("spawned", after.spawned - before.spawned, 11)
+  expect("errors", after.errors - before.errors, 1)
+  -- 11 spawns, 10 wake-ups, plus this coroutine's own sleeps
+  if after.resumes - before.resumes < 21 then
+    fail(string.format("only %d resumes for 11 spawns", after.resumes - before.resumes))
+  end
+end
+
+local function test_socket()
+  local listener, err = socket.listen("unix", SOCKET_PATH, 0)
+  if not listener then
+    return fail("listen: " .. tostring(err))
+  end
+  lunet.spawn(function()
+    local client, cerr = socket.connect(SOCKET_PATH, 0)
+    if not client then
+      return fail("connect: " .. tostring(cerr))
+    end
+    lunet.sleep(30)
+    socket.write(client, "ab")
+    socket.close(client)
+  end)
+  local conn = socket.accept(listener)
+
+  local before = lunet.metrics().socket.read
+  expect("waited read", socket.read_exact(conn, 1), "a")
+  local mid = lunet.metrics().socket.read
+  expect("waited read count", mid.count - before.count, 1)
+  if mid.max_ms < 20 then
+    fail(string.format("read waited ~30ms but max_ms is %g", mid.max_ms))
+  end
+
+  expect("buffered read", socket.read_exact(conn, 1), "b")
+  expect("buffered read count", lunet.metrics().socket.read.count, mid.count)
+
+  socket.close(conn)
+  socket.close(listener)
+  pcall(os.remove, SOCKET_PATH)
+end
+
+local function test_shape()
+  lunet.sleep(10)
+  local m = lunet.metrics({buckets = true})
+  if m.loop.iterations == 0 or m.loop.lag.count == 0 then
+    fail(string.format("loop probes idle: %d iterations, %d lag samples", m.loop.iterations,
+                       m.loop.lag.count))
+  end
+  if m.loop.utilization < 0 or m.loop.utilization > 1 then
+    fail("utilization out of range: " .. m.loop.utilization)
+  end
+  check_hist("loop.lag", m.loop.lag)
+  check_hist("fs", m.fs)
+  check_hist("socket.read", m.socket.read)
+  check_hist("socket.write", m.socket.write)
+  if lunet.metrics().fs.buckets then
+    fail("buckets returned without {buckets = true}")
+  end
+end
+
+lunet.spawn(function()
+  test_fs()
+  test_coroutines()
+  test_socket()
+  test_shape()
+  print("PASS: metrics")
+end)
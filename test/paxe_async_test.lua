@@ -0,0 +1,93 @@
+--[[
+  paxe.decrypt_async / paxe.encrypt_async: results match the synchronous
+  calls whether the work stays on the loop (below the threshold) or goes to
+  the CPU executor, array inputs keep their order with false for failures,
+  and several coroutines can have offloaded work in flight at once.
+
+  Requires the lunet-paxe module (xmake build lunet-paxe).
+]]
+
+local lunet = require("lunet")
+local paxe = require("lunet.paxe")
+
+local function fail(msg)
+  io.stderr:write("[PAXE_ASYNC] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function plaintexts(tag, n)
+  local out = {}
+  for i = 1, n do
+    out[i] = tag .. ":" .. string.rep(string.char(97 + i % 26), i * 300)
+  end
+  return out
+end
+
+local function check_arrays(label)
+  local pts = plaintexts(label, 24)
+  local cts, err = paxe.encrypt_async(pts, 3)
+  if not cts then
+    return fail(label .. " encrypt_async: " .. tostring(err))
+  end
+  for i = 1, #pts do
+    if paxe.try_decrypt(cts[i]) ~= pts[i] then
+      return fail(label .. " encrypt_async entry " .. i)
+    end
+  end
+
+  table.insert(cts, 5, "not a packet")
+  local res = paxe.decrypt_async(cts)
+  if #res ~= #pts + 1 or res[5] ~= false then
+    return fail(label .. " decrypt_async: bad entry not reported as false")
+  end
+  table.remove(res, 5)
+  for i = 1, #pts do
+    if res[i] ~= pts[i] then
+      return fail(label .. " decrypt_async entry " .. i)
+    end
+  end
+
+  local one = string.rep("z", 100000)
+  local pt, kid = paxe.decrypt_async(paxe.encrypt_async(one, 3))
+  if pt ~= one or kid ~= 3 then
+    fail(label .. " single packet")
+  end
+end
+
+lunet.spawn(function()
+  local ok, err = paxe.init()
+  if not ok then
+    return fail("init: " .. tostring(err))
+  end
+  paxe.keystore_set(3, string.rep("a", 32))
+
+  local prev = paxe.set_async_threshold(1 << 30)
+  check_arrays("inline")
+  paxe.set_async_threshold(0)
+  check_arrays("offload")
+
+  local done = 0
+  for c = 1, 8 do
+    lunet.spawn(function()
+      local pts = plaintexts("co" .. c, 8)
+      local res = paxe.decrypt_async(paxe.encrypt_async(pts, 3))
+      for i = 1, #pts do
+        if res[i] ~= pts[i] then
+          fail("concurrent coroutine " .. c .. " entry " .. i)
+          break
+        end
+      end
+      done = done + 1
+    end)
+  end
+  for _ = 1, 200 do
+    if done == 8 then break end
+    lunet.sleep(10)
+  end
+  if done ~= 8 then
+    fail("only " .. done .. " of 8 concurrent coroutines finished")
+  end
+
+  paxe.set_async_threshold(prev)
+  print("PASS: paxe async")
+end)
@@ -0,0 +1,97 @@
+--[[
+  paxe.try_decrypt / paxe.decrypt_batch round trips, including packets large
+  enough to grow the decrypt scratch buffer, batch compaction of entries that
+  fail, and key rotation invalidating the cached AES-GCM key schedule.
+
+  Run with --workers 4 as well: every worker decrypts concurrently through
+  its own scratch buffer (worker 0 sets up the shared keystore first).
+
+  Requires the lunet-paxe module (xmake build lunet-paxe).
+]]
+
+local lunet = require("lunet")
+local worker = require("lunet.worker")
+local paxe = require("lunet.paxe")
+
+local function fail(msg)
+  io.stderr:write(string.format("[PAXE_BATCH] worker %d FAIL: %s\n", worker.id(), msg))
+  _G.__lunet_exit_code = 1
+end
+
+local K1 = string.rep("\1", 32)
+local K2 = string.rep("\2", 32)
+local K3 = string.rep("\3", 32)
+
+local function payload(i)
+  -- distinct per worker and per packet; sizes up to ~8 KB
+  return string.rep(string.char(65 + (i + worker.id()) % 26), (i * 97) % 8192 + 1)
+end
+
+local function round_trips(rounds)
+  for i = 1, rounds do
+    local key_id = i % 2 + 1
+    local pt = payload(i)
+    local ct = paxe.encrypt(pt, key_id)
+    local got, kid = paxe.try_decrypt(ct)
+    if got ~= pt or kid ~= key_id then
+      return fail(string.format("round trip %d: %d bytes, key %s", i, got and #got or -1, tostring(kid)))
+    end
+    -- let the other workers run between packets
+    if i % 64 == 0 then lunet.sleep(0) end
+  end
+end
+
+local function batch()
+  local a, b = payload(1), payload(2)
+  local msgs = {
+    {paxe.encrypt(a, 1), "127.0.0.1", 1},
+    {"not a packet", "127.0.0.1", 2},
+    "not a table",
+    {paxe.encrypt(b, 2), "127.0.0.1", 3},
+  }
+  local ok, dropped = paxe.decrypt_batch(msgs)
+  if ok ~= 2 or dropped ~= 2 or #msgs ~= 2 then
+    return fail(string.format("decrypt_batch: ok=%s dropped=%s len=%d", tostring(ok), tostring(dropped), #msgs))
+  end
+  if msgs[1][1] ~= a or msgs[1][4] ~= 1 or msgs[1][3] ~= 1 then
+    fail("decrypt_batch: first entry")
+  end
+  if msgs[2][1] ~= b or msgs[2][4] ~= 2 or msgs[2][3] ~= 3 then
+    fail("decrypt_batch: compacted entry")
+  end
+end
+
+local function rotation()
+  local old = paxe.encrypt("before", 1)
+  paxe.keystore_set(1, K3)
+  if paxe.try_decrypt(old) ~= nil then
+    fail("ciphertext under the replaced key still decrypts")
+  end
+  if paxe.try_decrypt(paxe.encrypt("after", 1)) ~= "after" then
+    fail("rotated key does not round trip")
+  end
+end
+
+lunet.spawn(function()
+  if worker.id() == 0 then
+    local ok, err = paxe.init()
+    if not ok then
+      return fail("init: " .. tostring(err))
+    end
+    paxe.keystore_set(1, K1)
+    paxe.keystore_set(2, K2)
+    for id = 1, worker.count() - 1 do
+      worker.send(id, "go")
+    end
+  else
+    worker.recv()
+  end
+
+  round_trips(2000)
+  batch()
+  -- the keystore is shared, so only rotate keys when nobody else is decrypting
+  if worker.count() == 1 then
+    rotation()
+  end
+  print(string.format("PASS: paxe batch (worker %d)", worker.id()))
+end)
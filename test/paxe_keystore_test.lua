@@ -0,0 +1,94 @@
+--[[
+  PAXE keystore: keystore_set_many grows the copy-on-write table past its
+  default 256 slots in one generation, every key stays reachable for decrypt
+  after the resize, and remove/clear publish tables without the removed keys.
+
+  Requires the lunet-paxe module (xmake build lunet-paxe).
+]]
+
+local lunet = require("lunet")
+local paxe = require("lunet.paxe")
+
+local function fail(msg)
+  io.stderr:write("[PAXE_KEYSTORE] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function key(id)
+  return string.format("%032d", id)
+end
+
+local N = 1000
+
+lunet.spawn(function()
+  local ok, err = paxe.init()
+  if not ok then
+    return fail("init: " .. tostring(err))
+  end
+  if paxe.keystore_count() ~= 0 then
+    fail("init should leave an empty keystore")
+  end
+
+  local keys = {}
+  for id = 1, N do
+    keys[id] = key(id)
+  end
+  ok, err = paxe.keystore_set_many(keys)
+  if not ok then
+    return fail("set_many: " .. tostring(err))
+  end
+  if paxe.keystore_count() ~= N then
+    fail("count after set_many: " .. paxe.keystore_count())
+  end
+  if paxe.keystore_set_many({[1] = "short"}) then
+    fail("set_many accepted a short key")
+  end
+
+  -- every key decrypts its own packets after the table was resized
+  for id = 1, N, 37 do
+    local got, kid = paxe.try_decrypt(paxe.encrypt("id " .. id, id))
+    if got ~= "id " .. id or kid ~= id then
+      fail("decrypt with key " .. id)
+    end
+  end
+
+  local sealed = paxe.encrypt("gone", 500)
+  if not paxe.keystore_remove(500) then
+    fail("remove of a present key")
+  end
+  if paxe.keystore_remove(500) then
+    fail("remove of a missing key should return false")
+  end
+  if paxe.keystore_count() ~= N - 1 then
+    fail("count after remove: " .. paxe.keystore_count())
+  end
+  local before = paxe.stats().rx_no_key
+  if paxe.try_decrypt(sealed) ~= nil then
+    fail("packet for a removed key decrypts")
+  end
+  if paxe.stats().rx_no_key ~= before + 1 then
+    fail("rx_no_key not counted")
+  end
+  if paxe.try_decrypt(paxe.encrypt("kept", 501)) ~= "kept" then
+    fail("neighbour of the removed key")
+  end
+
+  -- a single set still works on the resized table, and replaces in place
+  paxe.keystore_set(N + 1, key(N + 1))
+  paxe.keystore_set(1, key(2))
+  if paxe.keystore_count() ~= N then
+    fail("count after set: " .. paxe.keystore_count())
+  end
+
+  if not paxe.keystore_reserve(4096) then
+    fail("reserve")
+  end
+  paxe.keystore_clear()
+  if paxe.keystore_count() ~= 0 then
+    fail("count after clear: " .. paxe.keystore_count())
+  end
+  if paxe.encrypt("x", 1) ~= nil then
+    fail("encrypt with a cleared key")
+  end
+  print("PASS: paxe keystore")
+end)
@@ -0,0 +1,90 @@
+--[[
+  PAXE statistics are sharded per thread: paxe.stats() and paxe.stats_into()
+  report the sum over every thread that decrypted, and stats_into refreshes
+  the same table (counters, rates and latency buckets) on each call.
+
+  Run with --workers 4 as well: worker 0 checks the counters of all workers.
+
+  Requires the lunet-paxe module (xmake build lunet-paxe).
+]]
+
+local lunet = require("lunet")
+local worker = require("lunet.worker")
+local paxe = require("lunet.paxe")
+
+local function fail(msg)
+  io.stderr:write(string.format("[PAXE_STATS] worker %d FAIL: %s\n", worker.id(), msg))
+  _G.__lunet_exit_code = 1
+end
+
+local GOOD, BAD = 300, 40
+
+local function decrypt_some()
+  local ct = paxe.encrypt("payload", 9)
+  local tampered = ct:sub(1, -2) .. string.char((ct:byte(-1) + 1) % 256)
+  for _ = 1, GOOD do
+    paxe.try_decrypt(ct)
+  end
+  for _ = 1, BAD do
+    paxe.try_decrypt(tampered)
+  end
+end
+
+local function sum(t)
+  local n = 0
+  for i = 1, #t do n = n + t[i] end
+  return n
+end
+
+lunet.spawn(function()
+  local workers = worker.count()
+  if worker.id() ~= 0 then
+    worker.recv()
+    decrypt_some()
+    worker.send(0, "done")
+    return
+  end
+
+  local ok, err = paxe.init()
+  if not ok then
+    return fail("init: " .. tostring(err))
+  end
+  paxe.keystore_set(9, string.rep("s", 32))
+
+  local view = {}
+  if paxe.stats_into(view) ~= view or view.rx_total ~= 0 or #view.latency == 0 then
+    return fail("stats_into on a fresh table")
+  end
+  local latency = view.latency
+
+  for id = 1, workers - 1 do
+    worker.send(id, "go")
+  end
+  decrypt_some()
+  for _ = 1, workers - 1 do
+    worker.recv()
+  end
+
+  local st = paxe.stats()
+  if st.rx_ok ~= GOOD * workers or st.rx_auth_fail ~= BAD * workers or
+     st.rx_total ~= (GOOD + BAD) * workers then
+    fail(string.format("stats: total=%d ok=%d auth_fail=%d over %d workers",
+                       st.rx_total, st.rx_ok, st.rx_auth_fail, workers))
+  end
+
+  lunet.sleep(10)
+  paxe.stats_into(view)
+  if view.latency ~= latency then
+    fail("stats_into replaced the latency table")
+  end
+  if view.rx_total ~= st.rx_total or view.rx_ok ~= st.rx_ok then
+    fail("stats_into disagrees with stats")
+  end
+  if sum(view.latency) ~= st.rx_total then
+    fail(string.format("latency buckets hold %d decrypts, expected %d", sum(view.latency), st.rx_total))
+  end
+  if not (view.rx_pps > 0 and view.ok_pps > 0 and view.ok_pps <= view.rx_pps) then
+    fail(string.format("rates: rx_pps=%s ok_pps=%s", tostring(view.rx_pps), tostring(view.ok_pps)))
+  end
+  print("PASS: paxe stats")
+end)
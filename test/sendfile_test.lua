@@ -0,0 +1,202 @@
+--[[
+  socket.sendfile over a unix socket: a whole file and an offset/length
+  range arrive byte for byte, a file much larger than the socket buffer
+  goes through the EAGAIN/poll path while the reader stalls, and a peer
+  that closes mid-transfer or a local socket.close during a stalled
+  transfer end the call with an error instead of hanging or killing the
+  process. NaN, negative and oversized offsets or lengths are refused.
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+local fs = require("lunet.fs")
+
+local SOCKET_PATH = ".tmp/sendfile_test.sock"
+local FILE_PATH = ".tmp/sendfile_test.bin"
+pcall(os.remove, SOCKET_PATH)
+
+local function fail(msg)
+  io.stderr:write("[SENDFILE] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+local function now_ms()
+  return lunet.hrtime() / 1e6
+end
+
+local function wait_for(pred, ms)
+  local t0 = now_ms()
+  while not pred() do
+    if now_ms() - t0 > ms then return false end
+    lunet.sleep(5)
+  end
+  return true
+end
+
+-- 8-byte records so a shifted or repeated range never matches
+local function make_content(nbytes)
+  local parts = {}
+  for i = 0, nbytes / 8 - 1 do
+    parts[#parts + 1] = string.format("%07x\n", i)
+  end
+  return table.concat(parts)
+end
+
+local listener
+
+-- Runs sender(conn) on the accepted side and reader(client) on the
+-- connecting side; returns once both are done or after timeout_ms
+local function pair(sender, reader, timeout_ms)
+  local done = 0
+  lunet.spawn(function()
+    local client, err = socket.connect(SOCKET_PATH, 0)
+    if not client then
+      fail("connect: " .. tostring(err))
+    else
+      reader(client)
+    end
+    done = done + 1
+  end)
+  local conn = socket.accept(listener)
+  if not conn then
+    return fail("accept failed")
+  end
+  lunet.spawn(function()
+    sender(conn)
+    done = done + 1
+  end)
+  if not wait_for(function() return done == 2 end, timeout_ms) then
+    fail("transfer did not finish within " .. timeout_ms .. "ms")
+  end
+end
+
+local function read_all(client, stall_ms)
+  if stall_ms then lunet.sleep(stall_ms) end
+  local parts = {}
+  while true do
+    local data = socket.read(client)
+    if not data then break end
+    parts[#parts + 1] = data
+  end
+  socket.close(client)
+  return table.concat(parts)
+end
+
+lunet.spawn(function()
+  local content = make_content(4 * 1024 * 1024)
+  assert(fs.writefile(FILE_PATH, content))
+  local fd, ferr = fs.open(FILE_PATH, "r")
+  if not fd then
+    return fail("open: " .. tostring(ferr))
+  end
+  local err
+  listener, err = socket.listen("unix", SOCKET_PATH, 0)
+  if not listener then
+    return fail("listen: " .. tostring(err))
+  end
+
+  -- whole small file, after a queued write
+  local small = 64 * 1024
+  local got
+  pair(function(conn)
+    socket.write(conn, "HEAD")
+    local sent, serr = socket.sendfile(conn, fd, 0, small)
+    expect("small sent", sent, small)
+    expect("small error", serr, nil)
+    socket.close(conn)
+  end, function(client)
+    got = read_all(client)
+  end, 5000)
+  expect("small bytes", got == "HEAD" .. content:sub(1, small), true)
+
+  -- offset/length range
+  pair(function(conn)
+    expect("range sent", socket.sendfile(conn, fd, 1000, 5000), 5000)
+    socket.close(conn)
+  end, function(client)
+    got = read_all(client)
+  end, 5000)
+  expect("range bytes", got == content:sub(1001, 6000), true)
+
+  -- past the end: short count, not an error
+  pair(function(conn)
+    expect("short sent", socket.sendfile(conn, fd, #content - 10, 100), 10)
+    socket.close(conn)
+  end, function(client)
+    got = read_all(client)
+  end, 5000)
+  expect("short bytes", got, content:sub(-10))
+
+  -- larger than the socket buffer with a stalled reader: EAGAIN, poll, resume
+  pair(function(conn)
+    local sent, serr = socket.sendfile(conn, fd, 0, #content)
+    expect("large sent", sent, #content)
+    expect("large error", serr, nil)
+    socket.close(conn)
+  end, function(client)
+    got = read_all(client, 200)
+  end, 20000)
+  expect("large length", got and #got, #content)
+  expect("large bytes", got == content, true)
+
+  -- peer reads a little and hangs up mid-transfer
+  local result
+  pair(function(conn)
+    local sent, serr = socket.sendfile(conn, fd, 0, #content)
+    result = {sent = sent, err = serr}
+    socket.close(conn)
+  end, function(client)
+    socket.read(client)
+    socket.close(client)
+  end, 10000)
+  if not result or result.sent ~= nil or result.err == nil then
+    fail(string.format("peer close: expected nil and an error, got %s, %s",
+                       tostring(result and result.sent), tostring(result and result.err)))
+  end
+
+  -- local close while the transfer is stalled on a full socket buffer
+  socket.set_close_timeout(200)
+  result = nil
+  pair(function(conn)
+    lunet.spawn(function()
+      lunet.sleep(100)
+      socket.close(conn)
+    end)
+    local sent, serr = socket.sendfile(conn, fd, 0, #content)
+    result = {sent = sent, err = serr}
+  end, function(client)
+    wait_for(function() return result ~= nil end, 5000)
+    socket.close(client)
+  end, 10000)
+  if not result or result.sent ~= nil or result.err == nil then
+    fail(string.format("local close: expected nil and an error, got %s, %s",
+                       tostring(result and result.sent), tostring(result and result.err)))
+  end
+
+  -- NaN and out-of-range arguments are refused before anything is sent
+  pair(function(conn)
+    local bad = {{0 / 0, 10}, {0, 0 / 0}, {-1, 10}, {0, 2 ^ 64}, {math.huge, 10}}
+    for _, args in ipairs(bad) do
+      local sent, serr = socket.sendfile(conn, fd, args[1], args[2])
+      if sent ~= nil or serr == nil then
+        fail(string.format("sendfile(%s, %s) accepted", tostring(args[1]), tostring(args[2])))
+      end
+    end
+    socket.close(conn)
+  end, function(client)
+    got = read_all(client)
+  end, 5000)
+  expect("bad arguments send nothing", got, "")
+
+  fs.close(fd)
+  socket.close(listener)
+  pcall(os.remove, SOCKET_PATH)
+  pcall(os.remove, FILE_PATH)
+  print("PASS: sendfile")
+end)
@@ -60,6 +60,19 @@ local function test_postgres()
     end
     print("   OK: Query returned expected data")
     
+    -- Test 4b: A cached statement dropped by the server is re-prepared
+    print("4b. Re-running a cached statement after DISCARD ALL...")
+    local q = "SELECT name FROM smoke_test WHERE name = $1"
+    db.query_params(conn, q, "hello")
+    db.exec(conn, "DISCARD ALL")
+    rows, err = db.query_params(conn, q, "hello")
+    if err or #rows ~= 1 then
+        print("FAIL: Stale statement was not re-prepared: " .. tostring(err))
+        __lunet_exit_code = 1
+        return
+    end
+    print("   OK: Statement re-prepared")
+    
     -- Test 5: Clean up
     print("5. Cleaning up...")
     db.exec(conn, "DROP TABLE smoke_test")
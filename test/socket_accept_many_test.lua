@@ -0,0 +1,117 @@
+--[[
+  socket.accept_many over a unix socket: ten connections queued on the
+  listener come back from one call, a call honours its max and leaves the
+  rest queued for the next, every connection is returned exactly once, a
+  waiting call gets a one-element batch and an idle one times out.
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local SOCKET_PATH = ".tmp/socket_accept_many_test.sock"
+pcall(os.remove, SOCKET_PATH)
+
+local NCONN = 10
+
+local function fail(msg)
+  io.stderr:write("[ACCEPT_MANY] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+local function now_ms()
+  return lunet.hrtime() / 1e6
+end
+
+local function wait_for(pred, ms)
+  local t0 = now_ms()
+  while not pred() do
+    if now_ms() - t0 > ms then return false end
+    lunet.sleep(5)
+  end
+  return true
+end
+
+-- Connects and announces itself with its index
+local function connect_n(n, first, clients)
+  local connected = 0
+  for i = first, first + n - 1 do
+    lunet.spawn(function()
+      local client, err = socket.connect(SOCKET_PATH, 0)
+      if not client then
+        return fail("connect " .. i .. ": " .. tostring(err))
+      end
+      socket.write(client, "client " .. i)
+      clients[#clients + 1] = client
+      connected = connected + 1
+    end)
+  end
+  return function() return connected == n end
+end
+
+lunet.spawn(function()
+  local listener, err = socket.listen("unix", SOCKET_PATH, 0)
+  if not listener then
+    return fail("listen: " .. tostring(err))
+  end
+
+  local clients = {}
+  if not wait_for(connect_n(NCONN, 1, clients), 2000) then
+    return fail("clients did not connect")
+  end
+  lunet.sleep(20)  -- let the listener queue every connection
+
+  local first = socket.accept_many(listener, 4)
+  expect("first batch honours max", first and #first, 4)
+  local rest = socket.accept_many(listener)
+  expect("second batch takes the rest", rest and #rest, NCONN - 4)
+
+  local seen = {}
+  for _, batch in ipairs({first or {}, rest or {}}) do
+    for _, conn in ipairs(batch) do
+      local data = socket.read(conn, 1000)
+      local i = tonumber(data and data:match("^client (%d+)$"))
+      if not i then
+        fail("unexpected greeting " .. tostring(data))
+      elseif seen[i] then
+        fail("connection " .. i .. " returned twice")
+      end
+      if i then seen[i] = true end
+      socket.close(conn)
+    end
+  end
+  for i = 1, NCONN do
+    if not seen[i] then fail("connection " .. i .. " never returned") end
+  end
+
+  -- nothing queued: wait for the next connection, returned as a batch of one
+  local ready = connect_n(1, NCONN + 1, clients)
+  local batch, berr = socket.accept_many(listener, 8, 2000)
+  expect("waiting batch size", batch and #batch, 1)
+  expect("waiting batch error", berr, nil)
+  wait_for(ready, 1000)
+  if batch then
+    expect("waiting batch greeting", socket.read(batch[1], 1000), "client " .. (NCONN + 1))
+    socket.close(batch[1])
+  end
+
+  batch, berr = socket.accept_many(listener, 8, 50)
+  expect("idle accept_many", batch, nil)
+  expect("idle accept_many error", berr, "timeout")
+
+  batch, berr = socket.accept_many(listener, 0)
+  expect("max 0", batch, nil)
+  expect("max 0 error", berr, "max must be positive")
+
+  for _, client in ipairs(clients) do
+    socket.close(client)
+  end
+  socket.close(listener)
+  pcall(os.remove, SOCKET_PATH)
+  print("PASS: socket accept_many")
+end)
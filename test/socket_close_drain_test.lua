@@ -0,0 +1,72 @@
+--[[
+  socket.close on a socket whose peer stops reading: the drain is bounded by
+  socket.set_close_timeout, the blocked writer is failed, and the peer sees
+  EOF once the handle is released, without having read everything.
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local SOCKET_PATH = ".tmp/socket_close_drain.sock"
+pcall(os.remove, SOCKET_PATH)
+
+local function fail(msg)
+  io.stderr:write("[SOCKET_CLOSE_DRAIN] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local TOTAL = 8 * 1024 * 1024
+
+lunet.spawn(function()
+  local listener, err = socket.listen("unix", SOCKET_PATH, 0)
+  if not listener then
+    return fail("listen: " .. tostring(err))
+  end
+
+  socket.set_close_timeout(200)
+  local writer_err
+  local closed = false
+
+  lunet.spawn(function()
+    local client, cerr = socket.connect(SOCKET_PATH, 0)
+    if not client then
+      socket.close(listener)
+      return fail("connect: " .. tostring(cerr))
+    end
+
+    lunet.spawn(function()
+      lunet.sleep(50)
+      closed = true
+      socket.close(client)
+    end)
+
+    -- far more than the kernel buffers hold: blocks until the close gives up
+    writer_err = socket.write(client, string.rep("x", TOTAL))
+  end)
+
+  local conn = socket.accept(listener)
+  -- do not read until well past the close timeout
+  lunet.sleep(600)
+
+  if writer_err ~= "connection timed out" then
+    fail("blocked writer: expected \"connection timed out\", got " .. tostring(writer_err))
+  end
+  if not closed then
+    fail("close never ran")
+  end
+
+  local got = 0
+  while true do
+    local data = socket.read(conn)
+    if not data then break end
+    got = got + #data
+  end
+  if got >= TOTAL then
+    fail("peer received everything; drain was not cut short")
+  end
+
+  socket.set_close_timeout(30000)
+  socket.close(conn)
+  socket.close(listener)
+  print("PASS: socket close drain")
+end)
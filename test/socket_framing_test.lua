@@ -0,0 +1,114 @@
+--[[
+  socket.read_until / socket.read_exact: frames are cut out of the
+  per-connection buffer regardless of how the bytes were split on the wire.
+  A large max or frame only grows the buffer as bytes arrive, and it shrinks
+  back once the frame is consumed (checked where lunet.metrics has mem).
+  A delimiter already buffered beyond max does not make a longer frame.
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local SOCKET_PATH = ".tmp/socket_framing.sock"
+pcall(os.remove, SOCKET_PATH)
+
+local function fail(msg)
+  io.stderr:write("[SOCKET_FRAMING] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %q, got %q", what, tostring(want), tostring(got)))
+  end
+end
+
+lunet.spawn(function()
+  local listener, err = socket.listen("unix", SOCKET_PATH, 0)
+  if not listener then
+    return fail("listen: " .. tostring(err))
+  end
+
+  local body = string.rep("b", 1000000)
+
+  lunet.spawn(function()
+    local client, cerr = socket.connect(SOCKET_PATH, 0)
+    if not client then
+      socket.close(listener)
+      return fail("connect: " .. tostring(cerr))
+    end
+    -- header split across writes, body larger than the default buffer
+    socket.write(client, "GET / HTTP/1.1\r\nContent-")
+    lunet.sleep(10)
+    socket.write(client, "Length: 1000000\r\n\r")
+    lunet.sleep(10)
+    socket.writev(client, {"\n", body, "tail"})
+    socket.write(client, string.rep("z", 64))
+    socket.close(client)
+  end)
+
+  local conn = socket.accept(listener)
+
+  local function mem_bytes()
+    local mem = lunet.metrics().mem
+    return mem and mem.current_bytes
+  end
+
+  local line = socket.read_until(conn, "\r\n")
+  expect("request line", line, "GET / HTTP/1.1")
+  local base = mem_bytes()
+
+  -- a generous max must not be allocated up front
+  local headers = socket.read_until(conn, "\r\n\r\n", 64 * 1024 * 1024)
+  expect("headers", headers, "Content-Length: 1000000")
+  if base and mem_bytes() - base > 256 * 1024 then
+    fail(string.format("read_until reserved %d bytes for its max", mem_bytes() - base))
+  end
+
+  local got = socket.read_exact(conn, 1000000)
+  expect("body length", got and #got, #body)
+  got = nil
+  if base and mem_bytes() - base > 256 * 1024 then
+    fail(string.format("buffer kept %d bytes after the large frame", mem_bytes() - base))
+  end
+
+  expect("tail", socket.read_exact(conn, 4), "tail")
+
+  local none, lerr = socket.read_until(conn, "\n", 16)
+  expect("over max", none, nil)
+  expect("over max error", lerr, "delimiter not found within max bytes")
+
+  -- bytes are still buffered after the failed read_until
+  expect("rest", socket.read_exact(conn, 64), string.rep("z", 64))
+
+  local eof, eerr = socket.read_exact(conn, 1)
+  if eof ~= nil or eerr ~= nil then
+    fail("expected EOF")
+  end
+
+  socket.close(conn)
+  socket.close(listener)
+
+  -- Already buffered bytes: a delimiter past max is not a frame
+  pcall(os.remove, SOCKET_PATH)
+  listener = socket.listen("unix", SOCKET_PATH, 0)
+  lunet.spawn(function()
+    local client = socket.connect(SOCKET_PATH, 0)
+    socket.write(client, string.rep("q", 4000) .. "\nok\n")
+    socket.close(client)
+  end)
+  conn = socket.accept(listener)
+  expect("first byte", socket.read_exact(conn, 1), "q")
+  lunet.sleep(50)  -- let the rest land in the buffer
+  local late, lerr2 = socket.read_until(conn, "\n", 100)
+  expect("late delimiter", late, nil)
+  expect("late delimiter error", lerr2, "delimiter not found within max bytes")
+  expect("late body", socket.read_exact(conn, 3999), string.rep("q", 3999))
+  expect("delimiter only, max 1", socket.read_until(conn, "\n", 1), "")
+  expect("frame ending at max", socket.read_until(conn, "\n", 3), "ok")
+  socket.close(conn)
+  socket.close(listener)
+  pcall(os.remove, SOCKET_PATH)
+
+  print("PASS: socket framing")
+end)
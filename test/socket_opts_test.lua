@@ -0,0 +1,115 @@
+--[[
+  TCP tuning options: socket.listen and socket.connect accept nodelay,
+  keepalive, sndbuf, rcvbuf and backlog on loopback, connections carry data
+  normally with them set, socket.setopt tunes clients and listeners, and bad
+  values or tcp-only options on unix sockets are refused with an error.
+  Uses 127.0.0.1:20016.
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local HOST, PORT = "127.0.0.1", 20016
+local UNIX_PATH = ".tmp/socket_opts.sock"
+pcall(os.remove, UNIX_PATH)
+
+local function fail(msg)
+  io.stderr:write("[SOCKET_OPTS] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+local function test_rejects()
+  local h, err = socket.listen("tcp", HOST, PORT, {nodelay = 1})
+  expect("listen nodelay=1", h, nil)
+  expect("listen nodelay=1 error", err, "invalid nodelay option")
+
+  h, err = socket.listen("tcp", HOST, PORT, {sndbuf = 0})
+  expect("listen sndbuf=0 error", err, "invalid sndbuf option")
+
+  h, err = socket.listen("tcp", HOST, PORT, {keepalive = -5})
+  expect("listen keepalive=-5 error", err, "invalid keepalive option")
+
+  h, err = socket.connect(HOST, PORT, nil, {rcvbuf = "big"})
+  expect("connect rcvbuf=string", h, nil)
+  expect("connect rcvbuf=string error", err, "invalid rcvbuf option")
+
+  h, err = socket.listen("unix", UNIX_PATH, 0, {nodelay = true})
+  expect("unix listen nodelay", h, nil)
+  if not tostring(err):find("only supported for tcp", 1, true) then
+    fail("unix listen nodelay error: " .. tostring(err))
+  end
+
+  h, err = socket.connect(UNIX_PATH, 0, nil, {keepalive = true})
+  expect("unix connect keepalive", h, nil)
+  if not tostring(err):find("only supported for tcp", 1, true) then
+    fail("unix connect keepalive error: " .. tostring(err))
+  end
+end
+
+local function test_tuned_echo()
+  local listener, err = socket.listen("tcp", HOST, PORT,
+                                      {nodelay = true, keepalive = 30, rcvbuf = 256 * 1024, backlog = 16})
+  if not listener then
+    return fail("tuned listen: " .. tostring(err))
+  end
+
+  expect("listener setopt", socket.setopt(listener, {keepalive = false, sndbuf = 128 * 1024}), nil)
+  expect("listener setopt backlog", socket.setopt(listener, {backlog = 8}),
+         "backlog and fastopen can only be set by socket.listen/socket.connect")
+
+  local payload = string.rep("t", 300000)
+  local echoed
+  lunet.spawn(function()
+    local client, cerr = socket.connect(HOST, PORT, nil, {nodelay = true, sndbuf = 64 * 1024, rcvbuf = 64 * 1024})
+    if not client then
+      return fail("tuned connect: " .. tostring(cerr))
+    end
+    expect("client setopt", socket.setopt(client, {nodelay = false, keepalive = true}), nil)
+    expect("client setopt bad", socket.setopt(client, {sndbuf = -1}), "invalid sndbuf option")
+    socket.write(client, payload)
+    echoed = socket.read_exact(client, #payload)
+    socket.close(client)
+  end)
+
+  local conn = socket.accept(listener)
+  if not conn then
+    socket.close(listener)
+    return fail("accept returned nil")
+  end
+  expect("accepted setopt", socket.setopt(conn, {nodelay = true, rcvbuf = 32 * 1024}), nil)
+  local got = socket.read_exact(conn, #payload)
+  expect("server received", got and #got, #payload)
+  socket.write(conn, got or "")
+
+  local t0 = lunet.hrtime()
+  while echoed == nil and lunet.hrtime() - t0 < 3e9 do
+    lunet.sleep(5)
+  end
+  expect("client echo", echoed == payload, true)
+
+  socket.close(conn)
+  socket.close(listener)
+end
+
+local function test_unix_setopt()
+  local listener, err = socket.listen("unix", UNIX_PATH, 0)
+  if not listener then
+    return fail("unix listen: " .. tostring(err))
+  end
+  expect("unix setopt", socket.setopt(listener, {nodelay = true}), "socket options are only supported for tcp")
+  socket.close(listener)
+  pcall(os.remove, UNIX_PATH)
+end
+
+lunet.spawn(function()
+  test_rejects()
+  test_tuned_echo()
+  test_unix_setopt()
+  print("PASS: socket options")
+end)
@@ -0,0 +1,190 @@
+--[[
+  Socket read buffer pool: repeated reads on one connection reuse a pooled
+  buffer, each size given to set_read_buffer_size gets its own class and
+  reads never exceed it, a fifth size recycles the oldest class, and 32
+  connections reading at once still share a single pooled buffer.
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local SOCKET_PATH = ".tmp/socket_read_pool_test.sock"
+pcall(os.remove, SOCKET_PATH)
+
+local function fail(msg)
+  io.stderr:write("[READ_POOL] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+local function now_ms()
+  return lunet.hrtime() / 1e6
+end
+
+local function wait_for(pred, ms)
+  local t0 = now_ms()
+  while not pred() do
+    if now_ms() - t0 > ms then return false end
+    lunet.sleep(5)
+  end
+  return true
+end
+
+local function class_of(stats, size)
+  for _, cls in ipairs(stats.classes) do
+    if cls.size == size then return cls end
+  end
+end
+
+local listener
+
+local function open_pair()
+  local client, cerr
+  lunet.spawn(function()
+    client, cerr = socket.connect(SOCKET_PATH, 0)
+  end)
+  local conn, aerr = socket.accept(listener)
+  wait_for(function() return client or cerr end, 1000)
+  if not conn or not client then
+    fail("pair: " .. tostring(aerr or cerr))
+  end
+  return client, conn
+end
+
+-- Reads n bytes from conn, failing if any single read exceeds max_chunk
+local function read_n(what, conn, n, max_chunk)
+  local parts, got = {}, 0
+  while got < n do
+    local data, err = socket.read(conn, 1000)
+    if not data then
+      fail(what .. ": read after " .. got .. " bytes: " .. tostring(err))
+      break
+    end
+    if #data > max_chunk then
+      fail(string.format("%s: read of %d bytes with a %d byte buffer", what, #data, max_chunk))
+    end
+    parts[#parts + 1] = data
+    got = got + #data
+  end
+  return table.concat(parts)
+end
+
+local function test_hits(client, conn)
+  socket.set_read_buffer_size(4096)
+  local before = socket.read_pool_stats()
+  for i = 1, 20 do
+    local msg = "ping " .. i
+    socket.write(client, msg)
+    expect("ping " .. i, read_n("ping", conn, #msg, 4096), msg)
+  end
+  local after = socket.read_pool_stats()
+  if after.misses - before.misses > 1 then
+    fail(string.format("%d misses for 20 reads of one size", after.misses - before.misses))
+  end
+  if after.hits - before.hits < 19 then
+    fail(string.format("only %d hits for 20 reads of one size", after.hits - before.hits))
+  end
+  local cls = class_of(after, 4096)
+  if not cls or cls.free < 1 then
+    fail("4096 class missing or holds no idle buffer")
+  end
+end
+
+local function test_size_classes(client, conn)
+  local payload = string.rep("0123456789", 300)
+
+  socket.set_read_buffer_size(1000)
+  socket.write(client, payload)
+  expect("1000 byte reads", read_n("size 1000", conn, #payload, 1000), payload)
+  local stats = socket.read_pool_stats()
+  if not class_of(stats, 1000) or not class_of(stats, 4096) then
+    fail("expected classes for 1000 and 4096")
+  end
+
+  -- back to 4096: its class is still warm
+  socket.set_read_buffer_size(4096)
+  local before = socket.read_pool_stats()
+  socket.write(client, payload)
+  expect("4096 byte reads", read_n("size 4096", conn, #payload, 4096), payload)
+  expect("misses on a warm class", socket.read_pool_stats().misses - before.misses, 0)
+end
+
+local function test_eviction(pairs_)
+  local before = socket.read_pool_stats()
+  -- 4096 and 1000 are taken; 512 and 768 fill the pool, 1536 recycles a class
+  for i, size in ipairs({512, 768, 1536}) do
+    local client, conn = pairs_[i][1], pairs_[i][2]
+    local msg = string.rep(string.char(96 + i), size * 2)
+    socket.set_read_buffer_size(size)
+    socket.write(client, msg)
+    expect("size " .. size .. " reads", read_n("size " .. size, conn, #msg, size), msg)
+  end
+  local stats = socket.read_pool_stats()
+  expect("evictions", stats.evictions - before.evictions, 1)
+  expect("class count", #stats.classes, 4)
+  if not class_of(stats, 1536) then
+    fail("1536 class missing after eviction")
+  end
+
+  -- 32 connections reading at once share one buffer of a fresh size
+  socket.set_read_buffer_size(2048)
+  before = socket.read_pool_stats()
+  for i, p in ipairs(pairs_) do
+    socket.write(p[1], "conn " .. i)
+  end
+  lunet.sleep(20)
+  local done = 0
+  for i, p in ipairs(pairs_) do
+    lunet.spawn(function()
+      local msg = "conn " .. i
+      expect(msg, read_n(msg, p[2], #msg, 2048), msg)
+      done = done + 1
+    end)
+  end
+  if not wait_for(function() return done == #pairs_ end, 5000) then
+    return fail("only " .. done .. " of " .. #pairs_ .. " concurrent reads finished")
+  end
+  stats = socket.read_pool_stats()
+  expect("evictions for a fresh size", stats.evictions - before.evictions, 1)
+  if stats.misses - before.misses > 1 then
+    fail(string.format("%d misses for %d concurrent reads", stats.misses - before.misses, #pairs_))
+  end
+  local cls = class_of(stats, 2048)
+  if not cls or cls.free < 1 or cls.free > 64 then
+    fail("2048 class idle count out of range: " .. tostring(cls and cls.free))
+  end
+end
+
+lunet.spawn(function()
+  local err
+  listener, err = socket.listen("unix", SOCKET_PATH, 0)
+  if not listener then
+    return fail("listen: " .. tostring(err))
+  end
+
+  local client, conn = open_pair()
+  test_hits(client, conn)
+  test_size_classes(client, conn)
+  socket.close(client)
+  socket.close(conn)
+
+  local pairs_ = {}
+  for i = 1, 32 do
+    local c, s = open_pair()
+    pairs_[i] = {c, s}
+  end
+  test_eviction(pairs_)
+  for _, p in ipairs(pairs_) do
+    socket.close(p[1])
+    socket.close(p[2])
+  end
+
+  socket.close(listener)
+  pcall(os.remove, SOCKET_PATH)
+  print("PASS: socket read pool")
+end)
@@ -0,0 +1,147 @@
+--[[
+  socket.read_stream backpressure over a unix socket: with a 4 KB stream
+  buffer and a reader that stalls, reading pauses at the high-water mark
+  (one read returns exactly the buffer size and the writer stays blocked),
+  then a slow reader still gets every byte in order. A read_exact frame
+  larger than the buffer grows it, and once the frame is consumed the
+  buffer is back to its read_stream size.
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local SOCKET_PATH = ".tmp/socket_read_stream_test.sock"
+pcall(os.remove, SOCKET_PATH)
+
+local CAP = 4096
+
+local function fail(msg)
+  io.stderr:write("[READ_STREAM] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+-- 8-byte records so a dropped or repeated chunk never matches
+local function make_content(nbytes)
+  local parts = {}
+  for i = 0, nbytes / 8 - 1 do
+    parts[#parts + 1] = string.format("%07x\n", i)
+  end
+  return table.concat(parts)
+end
+
+local listener
+
+-- Starts writer(client) on a connecting coroutine and returns the accepted side
+local function open_pair(writer)
+  lunet.spawn(function()
+    local client, err = socket.connect(SOCKET_PATH, 0)
+    if not client then
+      return fail("connect: " .. tostring(err))
+    end
+    writer(client)
+    socket.close(client)
+  end)
+  return socket.accept(listener)
+end
+
+local function write_chunked(client, data)
+  for i = 1, #data, 65536 do
+    local err = socket.write(client, data:sub(i, i + 65535))
+    if err then
+      return fail("write: " .. tostring(err))
+    end
+  end
+end
+
+local function test_slow_reader()
+  local content = make_content(4 * 1024 * 1024)
+  local writer_done = false
+  local conn = open_pair(function(client)
+    write_chunked(client, content)
+    writer_done = true
+  end)
+  if not conn then return fail("accept failed") end
+
+  expect("read_stream", socket.read_stream(conn, CAP), nil)
+  lunet.sleep(100)
+  expect("writer blocked while the reader stalls", writer_done, false)
+
+  local first = socket.read(conn)
+  expect("read at high water", first and #first, CAP)
+
+  local parts, got, reads = {first}, #first, 1
+  while true do
+    local data, err = socket.read(conn, 5000)
+    if not data then
+      if err then fail("read: " .. err) end
+      break
+    end
+    if #data > CAP then
+      fail(string.format("read of %d bytes from a %d byte stream buffer", #data, CAP))
+    end
+    parts[#parts + 1] = data
+    got = got + #data
+    reads = reads + 1
+    if reads % 64 == 0 then lunet.sleep(2) end
+  end
+  expect("writer finished", writer_done, true)
+  expect("total bytes", got, #content)
+  expect("bytes in order", table.concat(parts) == content, true)
+  socket.close(conn)
+end
+
+local function test_shrink()
+  local frame = string.rep("x", 5 * CAP)
+  local trailer = make_content(64 * 1024)
+  local conn = open_pair(function(client)
+    socket.write(client, "BIG\n")
+    write_chunked(client, frame)
+    write_chunked(client, trailer)
+  end)
+  if not conn then return fail("accept failed") end
+
+  expect("read_stream", socket.read_stream(conn, CAP), nil)
+  expect("header", socket.read_until(conn, "\n", 16, 5000), "BIG")
+  local got, err = socket.read_exact(conn, #frame, 5000)
+  expect("large frame", got == frame, true)
+  expect("large frame error", err, nil)
+
+  -- the trailer refills the buffer; a read sees at most the base size again
+  lunet.sleep(100)
+  local data = socket.read(conn)
+  expect("read after the frame", data and #data, CAP)
+
+  local parts = {data}
+  while true do
+    data, err = socket.read(conn, 5000)
+    if not data then
+      if err then fail("trailer read: " .. err) end
+      break
+    end
+    if #data > CAP then
+      fail(string.format("trailer read of %d bytes after shrinking to %d", #data, CAP))
+    end
+    parts[#parts + 1] = data
+  end
+  expect("trailer bytes", table.concat(parts) == trailer, true)
+  socket.close(conn)
+end
+
+lunet.spawn(function()
+  local err
+  listener, err = socket.listen("unix", SOCKET_PATH, 0)
+  if not listener then
+    return fail("listen: " .. tostring(err))
+  end
+  test_slow_reader()
+  test_shrink()
+  socket.close(listener)
+  pcall(os.remove, SOCKET_PATH)
+  print("PASS: socket read_stream")
+end)
@@ -0,0 +1,110 @@
+--[[
+  socket.write timeouts against a peer that stops reading: a write whose
+  bytes libuv already holds returns "write pending" and is still delivered
+  once, while a write still queued behind it returns "timeout" and is
+  dropped, so retrying it does not duplicate data on the wire. Also checks
+  that the socket setters refuse NaN and negative values and that huge or
+  NaN timeouts are clamped instead of overflowing, and a non-numeric
+  timeout neither raises nor duplicates the queued bytes.
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local SOCKET_PATH = ".tmp/socket_write_timeout.sock"
+pcall(os.remove, SOCKET_PATH)
+
+local function fail(msg)
+  io.stderr:write("[SOCKET_WRITE_TIMEOUT] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %q, got %q", what, tostring(want), tostring(got)))
+  end
+end
+
+local BIG = string.rep("b", 8 * 1024 * 1024)
+
+lunet.spawn(function()
+  local listener, err = socket.listen("unix", SOCKET_PATH, 0)
+  if not listener then
+    return fail("listen: " .. tostring(err))
+  end
+  socket.set_write_high_water(1024)
+
+  local client = socket.connect(SOCKET_PATH, 0)
+  local peer = socket.accept(listener)
+  if not client or not peer then
+    return fail("connect/accept")
+  end
+
+  -- Far more than the kernel buffers: libuv takes it and keeps sending
+  expect("big write", socket.write(client, BIG, 100), "write pending")
+  -- Queued behind the big write: dropped on timeout, so retrying is safe
+  expect("queued write", socket.write(client, "DUP", 100), "timeout")
+  expect("queued writev", socket.writev(client, {"D", "U", "P"}, 100), "timeout")
+
+  local done = false
+  lunet.spawn(function()
+    expect("retry", socket.write(client, "END"), nil)
+    done = true
+  end)
+
+  local got, parts = 0, {}
+  while got < #BIG + 3 do
+    local data, rerr = socket.read(peer, 2000)
+    if not data then
+      fail("peer read: " .. tostring(rerr))
+      break
+    end
+    got = got + #data
+    if got > #BIG - 16 then parts[#parts + 1] = data end
+  end
+  expect("bytes on the wire", got, #BIG + 3)
+  expect("tail", table.concat(parts):sub(-6), "bbbEND")
+  while not done do
+    lunet.sleep(1)
+  end
+
+  -- NaN, negative and non-numeric settings are refused; huge values clamp
+  for _, setter in ipairs({"set_write_high_water", "set_close_timeout", "set_read_buffer_size"}) do
+    for _, bad in ipairs({0 / 0, -1, "lots"}) do
+      if pcall(socket[setter], bad) then
+        fail(setter .. " accepted " .. tostring(bad))
+      end
+    end
+  end
+  expect("read buffer size 0", (pcall(socket.set_read_buffer_size, 0)), false)
+  socket.set_write_high_water(math.huge)
+  socket.set_close_timeout(1e300)
+  socket.set_read_buffer_size(2 ^ 62)
+  socket.set_read_buffer_size(4096)
+
+  -- huge and NaN timeouts wait (forever) instead of wrapping around
+  expect("write, huge timeout", socket.write(client, "H", math.huge), nil)
+  expect("read, huge timeout", socket.read(peer, math.huge), "H")
+  expect("write, NaN timeout", socket.write(client, "N", 0 / 0), nil)
+  expect("read, NaN timeout", socket.read(peer, 0 / 0), "N")
+  -- a non-numeric timeout waits forever instead of raising after queuing
+  local ok, werr = pcall(socket.write, client, "S", "soon")
+  expect("write, string timeout", ok, true)
+  expect("write, string timeout result", werr, nil)
+  ok = pcall(socket.writev, client, {"V"}, {})
+  expect("writev, table timeout", ok, true)
+  local sv = ""
+  while #sv < 2 do
+    local data = socket.read(peer, 1000)
+    if not data then break end
+    sv = sv .. data
+  end
+  expect("string timeout bytes sent once", sv, "SV")
+
+  socket.set_close_timeout(30000)
+  socket.set_write_high_water(65536)
+  socket.close(client)
+  socket.close(peer)
+  socket.close(listener)
+  print("PASS: socket write timeout")
+end)
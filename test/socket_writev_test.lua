@@ -0,0 +1,86 @@
+--[[
+  socket.write / socket.writev: queued chunks go out in order, byte-identical
+  to the concatenation, with a small high-water mark forcing writers to
+  block, and socket.close flushing what is still queued. The server side
+  reads through socket.read_stream with a deliberately small buffer.
+]]
+
+local lunet = require("lunet")
+local socket = require("lunet.socket")
+
+local SOCKET_PATH = ".tmp/socket_writev.sock"
+pcall(os.remove, SOCKET_PATH)
+
+local function fail(msg)
+  io.stderr:write("[SOCKET_WRITEV] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+lunet.spawn(function()
+  local listener, err = socket.listen("unix", SOCKET_PATH, 0)
+  if not listener then
+    return fail("listen: " .. tostring(err))
+  end
+
+  local chunks = {}
+  for i = 1, 40 do
+    chunks[i] = string.rep(string.char(64 + (i % 26)), i * 7)
+  end
+  local small = {}
+  for i = 1, 50 do
+    small[i] = string.format("%04d", i) .. string.rep("x", 96)
+  end
+  local expected = table.concat(chunks) .. table.concat(small)
+
+  lunet.spawn(function()
+    local client, cerr = socket.connect(SOCKET_PATH, 0)
+    if not client then
+      socket.close(listener)
+      return fail("connect: " .. tostring(cerr))
+    end
+
+    local werr = socket.writev(client, chunks)
+    if werr then
+      fail("writev: " .. werr)
+    end
+    if socket.writev(client, {}) ~= nil then
+      fail("empty writev should succeed")
+    end
+    if socket.writev(client, {"ok", {}}) == nil then
+      fail("non-string chunk should be rejected")
+    end
+
+    socket.set_write_high_water(1024)
+    for i = 1, #small do
+      local serr = socket.write(client, small[i])
+      if serr then
+        fail("write: " .. serr)
+        break
+      end
+    end
+    socket.set_write_high_water(64 * 1024)
+
+    -- close right away: the queue must still reach the peer
+    socket.close(client)
+  end)
+
+  local conn = socket.accept(listener)
+  -- small buffer so the stream has to pause and resume
+  local rerr = socket.read_stream(conn, 1024)
+  if rerr then
+    return fail("read_stream: " .. rerr)
+  end
+  local got = {}
+  while true do
+    local data = socket.read(conn)
+    if not data then break end
+    got[#got + 1] = data
+  end
+  socket.close(conn)
+  socket.close(listener)
+
+  if table.concat(got) ~= expected then
+    return fail("payload mismatch")
+  end
+  print("PASS: socket.writev")
+end)
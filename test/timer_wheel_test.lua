@@ -0,0 +1,156 @@
+--[[
+  Loop timer wheel through lunet.sleep: sleeps wake in deadline order across
+  the first level (< 256 ms) and the cascading levels above it, never early,
+  timers started later but due sooner overtake longer ones already in an
+  upper level, an upper-level timer is not delayed by a later level-0 one,
+  nothing wakes more than LATE_SLACK_MS late, and thousands of concurrent
+  sleeps all complete.
+]]
+
+local lunet = require("lunet")
+
+local function fail(msg)
+  io.stderr:write("[TIMER_WHEEL] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function now_ms()
+  return lunet.hrtime() / 1e6
+end
+
+-- Deadlines share one loop timestamp, which can trail the clock slightly
+local EARLY_SLACK_MS = 5
+-- Generous for a loaded CI box, far below a missed cascade (tens of ms)
+local LATE_SLACK_MS = 30
+
+local function wait_for(pred, ms)
+  local t0 = now_ms()
+  while not pred() do
+    if now_ms() - t0 > ms then return false end
+    lunet.sleep(5)
+  end
+  return true
+end
+
+local function test_order()
+  local durations = {0, 1, 2, 7, 63, 64, 65, 127, 255, 256, 257, 300, 383, 384, 511, 512, 513, 700, 1023, 1024,
+                     1025, 1300}
+  -- start them shuffled so insertion order does not give the answer away
+  local shuffled = {}
+  for i, ms in ipairs(durations) do
+    table.insert(shuffled, (i * 7) % (#shuffled + 1) + 1, ms)
+  end
+
+  local woke = {}
+  local t0 = now_ms()
+  for _, ms in ipairs(shuffled) do
+    lunet.spawn(function()
+      lunet.sleep(ms)
+      local elapsed = now_ms() - t0
+      if elapsed + EARLY_SLACK_MS < ms then
+        fail(string.format("sleep(%d) woke after %.1fms", ms, elapsed))
+      elseif elapsed - ms >= LATE_SLACK_MS then
+        fail(string.format("sleep(%d) woke late after %.1fms", ms, elapsed))
+      end
+      woke[#woke + 1] = ms
+    end)
+  end
+  if not wait_for(function() return #woke == #durations end, 5000) then
+    return fail(string.format("%d of %d sleeps woke", #woke, #durations))
+  end
+  for i = 2, #woke do
+    if woke[i] < woke[i - 1] then
+      return fail(string.format("sleep(%d) woke after sleep(%d): %s", woke[i], woke[i - 1],
+                                table.concat(woke, ",")))
+    end
+  end
+end
+
+-- A long timer sits in an upper level; shorter ones started later must
+-- still fire around it in deadline order
+local function test_overtake()
+  local woke = {}
+  local function sleeper(name, ms)
+    local t0 = now_ms()
+    lunet.spawn(function()
+      lunet.sleep(ms)
+      local late = now_ms() - t0 - ms
+      if late >= LATE_SLACK_MS then
+        fail(string.format("overtake: %s woke %.1fms late", name, late))
+      end
+      woke[#woke + 1] = name
+    end)
+  end
+  sleeper("a", 520)  -- due at 520
+  lunet.sleep(200)
+  sleeper("b", 300)  -- due at ~500
+  sleeper("c", 340)  -- due at ~540
+  if not wait_for(function() return #woke == 3 end, 2000) then
+    return fail("overtake: only " .. #woke .. " of 3 woke")
+  end
+  local order = table.concat(woke, ",")
+  if order ~= "b,a,c" then
+    fail("overtake order " .. order .. ", expected b,a,c")
+  end
+end
+
+-- A timer parked in level 1 must fire on time even when a woken coroutine
+-- re-arms a level-0 timer due after the level-1 one
+local function test_rearm_behind_upper()
+  local t0 = now_ms()
+  local long_elapsed
+  lunet.spawn(function()
+    lunet.sleep(260)  -- level 1, cascades at tick 256
+    long_elapsed = now_ms() - t0
+  end)
+  lunet.spawn(function()
+    lunet.sleep(100)
+    lunet.sleep(250)  -- due ~350, level 0
+  end)
+  if not wait_for(function() return long_elapsed ~= nil end, 2000) then
+    return fail("rearm: sleep(260) never woke")
+  end
+  if long_elapsed + EARLY_SLACK_MS < 260 or long_elapsed - 260 >= LATE_SLACK_MS then
+    fail(string.format("rearm: sleep(260) woke after %.1fms", long_elapsed))
+  end
+  lunet.sleep(150)  -- let the re-armed sleep finish before the next case
+end
+
+-- Sleeps started from a woken coroutine chain back to back
+local function test_chain()
+  local t0 = now_ms()
+  for _ = 1, 3 do
+    lunet.sleep(150)
+  end
+  local elapsed = now_ms() - t0
+  if elapsed + EARLY_SLACK_MS < 450 then
+    fail(string.format("three chained 150ms sleeps took %.1fms", elapsed))
+  end
+end
+
+local function test_many()
+  local N, done = 5000, 0
+  for i = 1, N do
+    lunet.spawn(function()
+      lunet.sleep(i % 300)
+      done = done + 1
+    end)
+  end
+  if not wait_for(function() return done == N end, 5000) then
+    fail(string.format("%d of %d concurrent sleeps woke", done, N))
+  end
+end
+
+lunet.spawn(function()
+  local ok, err = pcall(lunet.sleep, -1)
+  if ok or not tostring(err):find(">= 0", 1, true) then
+    fail("negative sleep: " .. tostring(err))
+  end
+
+  test_order()
+  test_overtake()
+  test_rearm_behind_upper()
+  test_chain()
+  test_many()
+  print("PASS: timer wheel")
+end)
@@ -0,0 +1,77 @@
+--[[
+  udp.bind(..., {paxe = true}): sends are sealed and receives decrypted in C,
+  so only plaintext reaches Lua. Packets that fail to decrypt are dropped in
+  the socket and counted by paxe.stats(). Uses ports 20013-20015.
+
+  Requires the lunet-paxe module (xmake build lunet-paxe).
+]]
+
+local lunet = require("lunet")
+local udp = require("lunet.udp")
+local paxe = require("lunet.paxe")
+
+local function fail(msg)
+  io.stderr:write("[UDP_PAXE] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect_recv(h, want, what)
+  local data, _, err = udp.recv(h, 1000)
+  if data ~= want then
+    fail(string.format("%s: expected %q, got %s (%s)", what, want, tostring(data), tostring(err)))
+  end
+end
+
+lunet.spawn(function()
+  local ok, err = paxe.init()
+  if not ok then
+    return fail("init: " .. tostring(err))
+  end
+  paxe.keystore_set(7, string.rep("k", 32))
+
+  local rx = udp.bind("127.0.0.1", 20013, {paxe = true})
+  local rx2 = udp.bind("127.0.0.1", 20014, {paxe = true})
+  local sniff = udp.bind("127.0.0.1", 20015)
+  local tx = udp.bind("127.0.0.1", 0, {paxe = true, paxe_key = 7})
+  local plain = udp.bind("127.0.0.1", 0)
+  if not (rx and rx2 and sniff and tx and plain) then
+    return fail("bind")
+  end
+
+  udp.send(tx, "127.0.0.1", 20013, "hello")
+  expect_recv(rx, "hello", "send")
+
+  udp.send_batch(tx, {{"one", "127.0.0.1", 20013}, {"two", "127.0.0.1", 20013}, {"three", "127.0.0.1", 20013}})
+  expect_recv(rx, "one", "send_batch 1")
+  expect_recv(rx, "two", "send_batch 2")
+  expect_recv(rx, "three", "send_batch 3")
+
+  udp.send_fanout(tx, "tick", {{"127.0.0.1", 20013}, {"127.0.0.1", 20014}})
+  expect_recv(rx, "tick", "fanout peer 1")
+  expect_recv(rx2, "tick", "fanout peer 2")
+
+  -- what goes on the wire is the sealed packet, not the plaintext
+  udp.send(tx, "127.0.0.1", 20015, "secret")
+  local wire = udp.recv(sniff, 1000)
+  if not wire or wire == "secret" or #wire ~= #"secret" + paxe.OVERHEAD_STANDARD then
+    fail("sealed packet: got " .. tostring(wire and #wire))
+  end
+
+  -- garbage is dropped inside the socket; the next good packet comes through
+  local before = paxe.stats()
+  udp.send(plain, "127.0.0.1", 20013, string.rep("x", 64))
+  udp.send(tx, "127.0.0.1", 20013, "after")
+  expect_recv(rx, "after", "after garbage")
+  local after = paxe.stats()
+  if after.rx_total - before.rx_total ~= 2 or after.rx_ok - before.rx_ok ~= 1 then
+    fail(string.format("stats: rx_total +%d, rx_ok +%d", after.rx_total - before.rx_total,
+                       after.rx_ok - before.rx_ok))
+  end
+
+  udp.close(rx)
+  udp.close(rx2)
+  udp.close(sniff)
+  udp.close(tx)
+  udp.close(plain)
+  print("PASS: udp paxe")
+end)
@@ -0,0 +1,72 @@
+--[[
+  UDP pending queue (queue_t ring): datagrams that arrive while nobody is
+  receiving are queued in order across ring growth and wrap-around, and
+  {max_pending = N} caps the queue, counting the rest in udp.dropped.
+]]
+
+local lunet = require("lunet")
+local udp = require("lunet.udp")
+
+local function fail(msg)
+  io.stderr:write("[UDP_QUEUE_RING] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function batch(from, to, port)
+  local msgs = {}
+  for i = from, to do
+    msgs[#msgs + 1] = {tostring(i), "127.0.0.1", port}
+  end
+  return msgs
+end
+
+-- Receive n datagrams and check they are first .. first + n - 1, in order
+local function expect_run(h, first, n)
+  for i = first, first + n - 1 do
+    local data, _, err = udp.recv(h, 1000)
+    if data ~= tostring(i) then
+      fail(string.format("expected datagram %d, got %s (%s)", i, tostring(data), tostring(err)))
+      return false
+    end
+  end
+  return true
+end
+
+lunet.spawn(function()
+  local rx, err = udp.bind("127.0.0.1", 20011)
+  if not rx then
+    return fail("bind: " .. tostring(err))
+  end
+  local tx = udp.bind("127.0.0.1", 0)
+
+  -- 200 queued before the first recv: the ring grows from 16 slots
+  udp.send_batch(tx, batch(1, 200, 20011))
+  lunet.sleep(100)
+  if expect_run(rx, 1, 100) then
+    -- half drained, then refilled: the tail wraps past the end of the array
+    udp.send_batch(tx, batch(201, 300, 20011))
+    lunet.sleep(100)
+    expect_run(rx, 101, 200)
+  end
+
+  local _, _, terr = udp.recv(rx, 50)
+  if terr ~= "timeout" then
+    fail("expected an empty queue, got " .. tostring(terr))
+  end
+  if udp.dropped(rx) ~= 0 then
+    fail("unbounded queue dropped " .. tostring(udp.dropped(rx)))
+  end
+  udp.close(rx)
+
+  local capped = udp.bind("127.0.0.1", 20012, {max_pending = 8})
+  udp.send_batch(tx, batch(1, 20, 20012))
+  lunet.sleep(100)
+  expect_run(capped, 1, 8)
+  if udp.dropped(capped) ~= 12 then
+    fail("max_pending = 8: expected 12 dropped, got " .. tostring(udp.dropped(capped)))
+  end
+
+  udp.close(capped)
+  udp.close(tx)
+  print("PASS: udp queue ring")
+end)
@@ -0,0 +1,106 @@
+--[[
+  udp raw_addr tokens over IPv4 and IPv6 loopback: a received token has the
+  right tag and length, formats back to the sender with addr_string, is the
+  same string for every datagram from one peer, and can be handed straight
+  to udp.send and udp.send_batch to reply. Malformed tokens are refused.
+  The IPv6 half is skipped when ::1 cannot be bound (ports 20020-20021).
+]]
+
+local lunet = require("lunet")
+local udp = require("lunet.udp")
+
+local function fail(msg)
+  io.stderr:write("[UDP_RAW_ADDR] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %q, got %q", what, tostring(want), tostring(got)))
+  end
+end
+
+local function recv(what, h)
+  local data, peer, port = udp.recv(h, 1000)
+  if not data then
+    fail(what .. ": " .. tostring(port))
+  end
+  return data, peer, port
+end
+
+local function round_trip(label, host, port, tag, token_len)
+  local rx, err = udp.bind(host, port, {raw_addr = true})
+  if not rx then
+    if tag == 6 then
+      print("SKIP: " .. label .. " (" .. tostring(err) .. ")")
+      return
+    end
+    return fail(label .. " bind: " .. tostring(err))
+  end
+  local tx = udp.bind(host, 0, {raw_addr = true})
+
+  udp.send(tx, host, port, "ping")
+  local data, tok, tx_port = recv(label .. " ping", rx)
+  expect(label .. " ping", data, "ping")
+  if type(tok) ~= "string" then
+    udp.close(tx)
+    udp.close(rx)
+    return fail(label .. " token is " .. type(tok))
+  end
+  expect(label .. " token length", #tok, token_len)
+  expect(label .. " token tag", tok:byte(1), tag)
+  local thost, tport = udp.addr_string(tok)
+  expect(label .. " addr_string host", thost, host)
+  expect(label .. " addr_string port", tport, tx_port)
+
+  udp.send(tx, host, port, "again")
+  local _, tok2 = recv(label .. " again", rx)
+  expect(label .. " same peer, same token", tok2 == tok, true)
+
+  -- reply through the token: port argument ignored or omitted
+  local ok, serr = udp.send(rx, tok, nil, "pong")
+  expect(label .. " send to token", ok, true)
+  expect(label .. " send to token error", serr, nil)
+  local reply, from = recv(label .. " pong", tx)
+  expect(label .. " pong", reply, "pong")
+  local fhost, fport = udp.addr_string(from)
+  expect(label .. " reply host", fhost, host)
+  expect(label .. " reply port", fport, port)
+
+  local sent = udp.send_batch(rx, {{"b1", tok}, {"b2", tok, 0}, {"b3", host, tx_port}})
+  expect(label .. " send_batch to token", sent, 3)
+  for i = 1, 3 do
+    expect(label .. " batch " .. i, (recv(label .. " batch", tx)), "b" .. i)
+  end
+
+  -- malformed tokens
+  local bad = {
+    {"truncated", tok:sub(1, -2)},
+    {"extended", tok .. "\0"},
+    {"tag only", string.char(tag)},
+  }
+  for _, case in ipairs(bad) do
+    local name, t = case[1], case[2]
+    local sok, e = udp.send(rx, t, nil, "x")
+    expect(label .. " send " .. name, sok, nil)
+    expect(label .. " send " .. name .. " error", e, "invalid host or port")
+    local n, be = udp.send_batch(rx, {{"x", t}})
+    expect(label .. " send_batch " .. name, n, nil)
+    expect(label .. " send_batch " .. name .. " error", be, "invalid message at index 1")
+    local h, ae = udp.addr_string(t)
+    expect(label .. " addr_string " .. name, h, nil)
+    expect(label .. " addr_string " .. name .. " error", ae, "invalid address token")
+  end
+
+  local stray = udp.recv(tx, 50)
+  expect(label .. " nothing sent for bad tokens", stray, nil)
+
+  udp.close(tx)
+  udp.close(rx)
+end
+
+lunet.spawn(function()
+  round_trip("ipv4", "127.0.0.1", 20020, 4, 7)
+  round_trip("ipv6", "::1", 20021, 6, 23)
+  print("PASS: udp raw_addr")
+end)
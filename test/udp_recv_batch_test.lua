@@ -0,0 +1,111 @@
+--[[
+  udp.recv_batch bursts: a full batch plus a partial one come back in
+  order with every payload intact and one peer, an empty queue times out,
+  and a waiting receiver collects a larger burst across several batches of
+  at most max. Runs with and without {batch = 16} on bind
+  (ports 20018-20019).
+]]
+
+local lunet = require("lunet")
+local udp = require("lunet.udp")
+
+local MAX = 16
+
+local function fail(msg)
+  io.stderr:write("[UDP_RECV_BATCH] FAIL: " .. msg .. "\n")
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+-- Sequence number plus a length that varies per datagram
+local function payload(i)
+  return string.format("%04d:", i) .. string.rep(string.char(65 + i % 26), (i * 37) % 1400)
+end
+
+local function send_burst(tx, port, from, to)
+  local msgs = {}
+  for i = from, to do
+    msgs[#msgs + 1] = {payload(i), "127.0.0.1", port}
+  end
+  local sent, err = udp.send_batch(tx, msgs)
+  expect("burst sent", sent, to - from + 1)
+  expect("burst error", err, nil)
+end
+
+-- Checks a batch holds payloads next .. next + #batch - 1 from one peer
+local function check_batch(what, batch, next_seq, peer)
+  if #batch > MAX then
+    fail(string.format("%s: %d datagrams with max %d", what, #batch, MAX))
+  end
+  for k, msg in ipairs(batch) do
+    local want = payload(next_seq + k - 1)
+    if msg[1] ~= want then
+      fail(string.format("%s: datagram %d: expected %s (%d bytes), got %s (%d bytes)", what,
+                         k, want:sub(1, 5), #want, tostring(msg[1]):sub(1, 5), #tostring(msg[1])))
+      return next_seq + #batch
+    end
+    expect(what .. " host", msg[2], "127.0.0.1")
+    peer.port = peer.port or msg[3]
+    expect(what .. " port", msg[3], peer.port)
+  end
+  return next_seq + #batch
+end
+
+local function run(port, opts)
+  local label = opts.batch and "batch" or "plain"
+  local rx, err = udp.bind("127.0.0.1", port, opts)
+  if not rx then
+    return fail(label .. " bind: " .. tostring(err))
+  end
+  local tx = udp.bind("127.0.0.1", 0)
+  local peer = {}
+
+  -- full batch plus a partial one, queued before anyone receives
+  send_burst(tx, port, 1, MAX + 5)
+  lunet.sleep(50)
+  local batch, berr = udp.recv_batch(rx, MAX, 1000)
+  expect(label .. " full batch size", batch and #batch, MAX)
+  expect(label .. " full batch error", berr, nil)
+  local next_seq = check_batch(label .. " full batch", batch or {}, 1, peer)
+  batch, berr = udp.recv_batch(rx, MAX, 1000)
+  expect(label .. " partial batch size", batch and #batch, 5)
+  expect(label .. " partial batch error", berr, nil)
+  next_seq = check_batch(label .. " partial batch", batch or {}, next_seq, peer)
+  expect(label .. " datagrams received", next_seq, MAX + 6)
+
+  batch, berr = udp.recv_batch(rx, MAX, 50)
+  expect(label .. " empty queue", batch, nil)
+  expect(label .. " empty queue error", berr, "timeout")
+
+  -- a receiver already waiting when a larger burst lands
+  local total = 3 * MAX + 7
+  lunet.spawn(function()
+    lunet.sleep(20)
+    send_burst(tx, port, 1, total)
+  end)
+  next_seq = 1
+  while next_seq <= total do
+    batch, berr = udp.recv_batch(rx, MAX, 1000)
+    if not batch then
+      fail(string.format("%s: waiting burst stopped at %d: %s", label, next_seq, tostring(berr)))
+      break
+    end
+    next_seq = check_batch(label .. " waiting burst", batch, next_seq, peer)
+  end
+  expect(label .. " waiting burst received", next_seq, total + 1)
+  expect(label .. " dropped", udp.dropped(rx), 0)
+
+  udp.close(tx)
+  udp.close(rx)
+end
+
+lunet.spawn(function()
+  run(20018, {batch = MAX})
+  run(20019, {})
+  print("PASS: udp recv_batch")
+end)
@@ -0,0 +1,71 @@
+--[[
+  lunet.worker mailboxes under --workers N: every worker posts a numbered
+  run of messages to worker 0, which checks that each sender's run arrives
+  complete and in order, then tells the others to finish. All workers
+  return from their scripts and the process exits cleanly. Out-of-range
+  ids are refused. Also runs without --workers (worker 0 mails itself).
+
+  ./build/lunet --workers 4 test/worker_test.lua
+]]
+
+local lunet = require("lunet")
+local worker = require("lunet.worker")
+
+local PER_WORKER = 200
+
+local id = worker.id()
+local count = worker.count()
+
+local function fail(msg)
+  io.stderr:write(string.format("[WORKER %d] FAIL: %s\n", id, msg))
+  _G.__lunet_exit_code = 1
+end
+
+local function expect(what, got, want)
+  if got ~= want then
+    fail(string.format("%s: expected %s, got %s", what, tostring(want), tostring(got)))
+  end
+end
+
+expect("send to worker count", worker.send(count, "x"), "invalid worker id")
+expect("send to -1", worker.send(-1, "x"), "invalid worker id")
+
+lunet.spawn(function()
+  for seq = 1, PER_WORKER do
+    local err = worker.send(0, id .. ":" .. seq)
+    if err then
+      return fail("send " .. seq .. ": " .. err)
+    end
+  end
+
+  if id == 0 then
+    local next_seq = {}
+    for w = 0, count - 1 do
+      next_seq[w] = 1
+    end
+    for _ = 1, count * PER_WORKER do
+      local msg, err = worker.recv()
+      if not msg then
+        return fail("recv: " .. tostring(err))
+      end
+      local from, seq = msg:match("^(%d+):(%d+)$")
+      from, seq = tonumber(from), tonumber(seq)
+      if not from or next_seq[from] == nil then
+        return fail("unexpected message " .. msg)
+      end
+      expect("seq from worker " .. from, seq, next_seq[from])
+      next_seq[from] = seq + 1
+    end
+    for w = 0, count - 1 do
+      expect("messages from worker " .. w, next_seq[w], PER_WORKER + 1)
+    end
+    for w = 1, count - 1 do
+      worker.send(w, "done")
+    end
+    print(string.format("PASS: worker (%d workers)", count))
+  else
+    local msg, err = worker.recv()
+    expect("reply", msg, "done")
+    expect("reply error", err, nil)
+  end
+end)
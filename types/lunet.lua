@@ -15,6 +15,13 @@ local lunet = {}
 function lunet.sleep(ms) end
 
 ---Spawn a new coroutine
+---Coroutines that returned normally are recycled for later spawns (pool size
+---from `LUNET_CO_POOL`, default 256, 0 disables), so do not resume a spawned
+---coroutine yourself after its function returned. The same thread can come
+---back from `coroutine.running()` in different spawns, so do not key state on
+---coroutine identity past the end of a spawn. A reused thread starts with the
+---spawner's globals. Debug hooks are VM-wide in LuaJIT, so one installed by a
+---coroutine stays set after it returns; remove it yourself when done.
 ---@param func function The function to run in the new coroutine
 ---@return nil
 ---@usage
@@ -28,4 +35,38 @@ function lunet.sleep(ms) end
 ---```
 function lunet.spawn(func) end
 
+---@class lunet.Histogram
+---@field count number Samples recorded
+---@field sum_ms number
+---@field max_ms number
+---@field mean_ms number
+---@field p50 number Milliseconds, within 12.5% of the true value
+---@field p90 number
+---@field p99 number
+---@field p999 number
+---@field buckets? number[][] `{le_ms, cumulative_count}` for each non-empty bucket (with `{buckets = true}`)
+
+---Runtime metrics of the calling worker, always on and cheap to record.
+---`loop.lag` is the busy time of each event loop iteration (how long a ready
+---callback could have waited), `loop.utilization` its share of wall time.
+---`socket.read`/`socket.write` time only calls that had to wait; `db` and
+---`cpu` split executor jobs into time queued and time running. Trace and
+---EasyMem builds add `mem` (`allocs`, `frees`, `current_bytes`, `peak_bytes`
+---of the C allocator, process-wide). `arena` reports the request-scoped
+---arenas used by drivers: live arenas, blocks and oversize chunks allocated,
+---bytes currently reserved and the peaks, and `fill_ratio`, the share of
+---arena space actually handed out (the rest is unused block tails).
+---@param opts? {buckets?: boolean}
+---@return {loop: {iterations: number, busy_ms: number, idle_ms: number, utilization: number, lag: lunet.Histogram}, coroutines: {spawned: number, resumes: number, yields: number, errors: number}, socket: {read: lunet.Histogram, write: lunet.Histogram}, fs: lunet.Histogram, db: {queue: lunet.Histogram, exec: lunet.Histogram}, cpu: {queue: lunet.Histogram, exec: lunet.Histogram}, httpc: lunet.Histogram, arena: {arenas: number, active: number, blocks: number, oversize: number, reserved_bytes: number, peak_reserved_bytes: number, peak_arena_bytes: number, fill_ratio: number}}
+---@usage
+---```lua
+---local m = lunet.metrics()
+---print(("loop lag p99 %.3fms, db queue p99 %.3fms"):format(m.loop.lag.p99, m.db.queue.p99))
+---```
+function lunet.metrics(opts) end
+
+---Monotonic clock for timing code.
+---@return number ns Nanoseconds since an arbitrary point
+function lunet.hrtime() end
+
 return lunet
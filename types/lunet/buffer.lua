@@ -0,0 +1,78 @@
+---@meta
+
+---@class buffer
+local buffer = {}
+
+---Mutable bytes that socket, udp, fs and paxe read into and write from
+---without going through Lua strings. A buffer is a view onto refcounted
+---storage: `sub` returns another view of the same bytes, and the storage is
+---freed when the last view is collected. Offsets are 0-based.
+---Bytes handed to a write are sent from the buffer itself, so do not change
+---them until the write has completed.
+---@class lunet.buffer
+local Buffer = {}
+
+---@return integer
+function Buffer:len() end
+
+---A view of `len` bytes starting at `offset`, sharing this buffer's storage
+---(clamped to the buffer; empty when offset is past the end).
+---@param offset integer
+---@param len? integer Defaults to the rest of the buffer
+---@return lunet.buffer
+function Buffer:sub(offset, len) end
+
+---Copy bytes out into a Lua string.
+---@param offset? integer
+---@param len? integer
+---@return string
+function Buffer:tostring(offset, len) end
+
+---Address of the first byte, for `ffi.cast("uint8_t *", buf:ptr())`. Valid
+---while the buffer is.
+---@return lightuserdata
+function Buffer:ptr() end
+
+---Copy a string or buffer in at offset; stops at the end of this buffer.
+---@param offset integer
+---@param data string|lunet.buffer
+---@return integer copied
+function Buffer:set(offset, data) end
+
+---@param byte integer
+---@param offset? integer
+---@param len? integer
+---@return lunet.buffer self
+function Buffer:fill(byte, offset, len) end
+
+---A buffer with its own copy of these bytes.
+---@return lunet.buffer|nil
+---@return string|nil error
+function Buffer:clone() end
+
+---@param size integer
+---@param byte? integer Initial value of every byte (default 0)
+---@return lunet.buffer|nil
+---@return string|nil error
+---@usage
+---```lua
+---local buffer = require('lunet.buffer')
+---local buf = buffer.new(16384)
+---local n, err = socket.read_into(client, buf)
+---if n then
+---    socket.write(upstream, buf:sub(0, n))
+---end
+---```
+function buffer.new(size, byte) end
+
+---A buffer holding a copy of a string or buffer.
+---@param data string|lunet.buffer
+---@return lunet.buffer|nil
+---@return string|nil error
+function buffer.from(data) end
+
+---@param v any
+---@return boolean
+function buffer.is(v) end
+
+return buffer
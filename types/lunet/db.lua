@@ -14,10 +14,12 @@ local db = {}
 --- - password: string (default: "")
 --- - database: string (default: "")
 --- - charset: string (MySQL only, default: "utf8mb4")
+--- - stmt_cache: integer (prepared statements kept per connection, default: 64, 0 disables)
 ---
 ---For SQLite3 backend:
 ---@param params table Connection parameters
 --- - path: string (default: ":memory:")
+--- - stmt_cache: integer (default: 64, 0 disables)
 ---
 ---@return lightuserdata|nil conn The connection handle or nil on error
 ---@return string|nil error Error message if failed
@@ -31,9 +33,12 @@ function db.close(conn) end
 ---Execute a SELECT query
 ---@param conn lightuserdata The connection to execute the query on
 ---@param sql string The SQL query to execute
+---@param opts? table Result shape options (last argument)
+--- - shape: "rows" (default), "arrays" ({columns, nrows, rows}) or "columns" ({columns, nrows, values})
+--- - ffi: boolean (with shape = "columns", return NULL-free numeric columns as double[?] cdata; integer columns beyond +-2^53 use int64_t[?], whose cells are boxed)
 ---@return table|nil result Array of rows (each row is a table with column names as keys), or nil on error
 ---@return string|nil error Error message if failed
-function db.query(conn, sql) end
+function db.query(conn, sql, opts) end
 
 ---Execute an INSERT, UPDATE, DELETE, or other non-SELECT statement
 ---@param conn lightuserdata The connection to execute the statement on
@@ -42,6 +47,16 @@ function db.query(conn, sql) end
 ---@return string|nil error Error message if failed
 function db.exec(conn, sql) end
 
+---Execute one statement for every parameter tuple, in one executor job.
+---Runs in its own transaction unless one is already open; the first failing
+---tuple rolls the batch back and is reported as "row N: ...".
+---@param conn userdata The connection or pool
+---@param sql string The SQL statement to execute
+---@param rows table[] Array of parameter arrays
+---@return table|nil result {affected_rows, last_insert_id, counts} where counts[i] is the affected rows of rows[i]
+---@return string|nil error Error message if failed
+function db.exec_batch(conn, sql, rows) end
+
 ---Escape a string for safe SQL literal inclusion.
 ---Use this when parameter binding is not available.
 ---Escapes backslashes and single quotes to prevent SQL injection.
@@ -49,4 +64,54 @@ function db.exec(conn, sql) end
 ---@return string escaped The escaped string safe for SQL literals
 function db.escape(s) end
 
+---Prepared-statement cache counters for a connection
+---@param conn lightuserdata The connection to inspect
+---@return table|nil stats {size, capacity, hits, misses, evictions}
+---@return string|nil error Error message if conn is invalid
+function db.stmt_cache_stats(conn) end
+
+---Create a connection pool. The handle can be passed to db.query/db.exec
+---(and their _params variants) in place of a connection; each call checks
+---out one connection for a single statement.
+---@param params table Connection parameters, as for db.open
+---@param opts? table Pool options
+--- - min: integer (connections opened up front, default: 0)
+--- - max: integer (upper bound, default: 8)
+--- - check_ms: integer (ping connections idle longer than this, default: 30000)
+---@return userdata pool The pool handle
+function db.pool(params, opts) end
+
+---Pool gauges and counters
+---@param pool userdata The pool to inspect
+---@return table|nil stats {min, max, size, opening, idle, in_use, waiting, acquired, waited, wait_ms_total, wait_ms_max, opened, open_failures, dropped, closed}
+---@return string|nil error Error message if pool is invalid
+function db.pool_stats(pool) end
+
+---DB executor load; all connections in the process share these threads
+---@return table stats {name, threads, queue_max, queued, running, submitted, completed, rejected, wait_ms_total, wait_ms_max, run_ms_total}
+function db.executor_stats() end
+
+---@class db.cursor
+local cursor = {}
+
+---Fetch the next batch of rows. Must be called from a coroutine.
+---@param n? integer Batch size (default: 100, max: 10000)
+---@return table[]|nil rows Row tables; empty once the result set is exhausted
+---@return string|nil error Error message if the fetch failed
+function cursor:next(n) end
+
+---Discard unread rows and release the connection. Must be called from a coroutine.
+---@return string|nil error Error message if closing failed
+function cursor:close() end
+
+---Stream a SELECT in batches instead of materializing the whole result.
+---The query runs on the first cursor:next(). MySQL and PostgreSQL cursors
+---hold the connection exclusively until exhausted or closed.
+---@param conn userdata Connection handle (pools are not accepted)
+---@param sql string The SQL query to execute
+---@param ... any Parameters bound as in db.query_params
+---@return db.cursor|nil cursor The cursor
+---@return string|nil error Error message if the cursor could not be created
+function db.cursor(conn, sql, ...) end
+
 return db
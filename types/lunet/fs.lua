@@ -74,10 +74,140 @@ function fs.read(fd, size) end
 ---```
 function fs.write(fd, data) end
 
+---Read from a file at an absolute offset, leaving the file position alone.
+---Concurrent coroutines may read different regions of one fd. With `buf`
+---(a lunet.buffer, which caps `size` at its length) the data lands in `buf`
+---and the byte count is returned, so a reused buffer costs no allocation per
+---call. FFI code can reach the bytes through `buf:ptr()`.
+---@param fd integer The file descriptor to read from
+---@param size integer The number of bytes to read (at most 2^31 - 1)
+---@param offset integer Byte offset in the file (>= 0)
+---@param buf? lunet.buffer Destination buffer
+---@return string|integer|nil data The data read (or the byte count with `buf`), short at end of file
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local buf = require('lunet.buffer').new(4096)
+---local n, err = fs.pread(file, 4096, pos, buf)
+---if n then
+---    pos = pos + n
+---end
+---```
+function fs.pread(fd, size, offset, buf) end
+
+---Write a string or lunet.buffer at an absolute offset, leaving the file
+---position alone. The data is pinned rather than copied until the write completes.
+---@param fd integer The file descriptor to write to
+---@param data string|lunet.buffer The data to write
+---@param offset integer Byte offset in the file (>= 0)
+---@return integer|nil bytes Bytes written or nil on error
+---@return string|nil error Error message if failed
+function fs.pwrite(fd, data, offset) end
+
+---Read consecutive chunks starting at offset in one call. Returns one string
+---per requested length; at end of file the last chunks are short or missing.
+---@param fd integer The file descriptor to read from
+---@param sizes integer[] Chunk lengths (1 to 1024 entries, 2 GiB in total at most)
+---@param offset integer Byte offset in the file (>= 0)
+---@return string[]|nil chunks The chunks read or nil on error
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local parts = fs.preadv(file, {16, 4096}, 0)
+---local header, body = parts[1], parts[2]
+---```
+function fs.preadv(fd, sizes, offset) end
+
+---Write several strings back to back starting at offset in one call.
+---@param fd integer The file descriptor to write to
+---@param chunks (string|lunet.buffer)[] Strings or buffers to write (1 to 1024 entries)
+---@param offset integer Byte offset in the file (>= 0)
+---@return integer|nil bytes Total bytes written or nil on error
+---@return string|nil error Error message if failed
+function fs.pwritev(fd, chunks, offset) end
+
 ---Scan a directory
 ---@param path string The path to the directory
 ---@return table|nil entries The entries in the directory or nil on error
 ---@return string|nil error Error message if failed
 function fs.scandir(path) end
 
+---Read a whole file in one thread-pool job (open, fstat, read, close).
+---@param path string The path to the file
+---@return string|nil data The file contents or nil on error
+---@return string|nil error Error message if failed
+function fs.readfile(path) end
+
+---Write a whole file in one thread-pool job. With `{atomic = true}` the data
+---goes to a temporary sibling that is fsynced and renamed over `path`, so
+---readers see the old or the new file, never a partial one. The replaced
+---file's permissions are kept; a new atomic file gets 0644.
+---@param path string The path to the file
+---@param data string The contents
+---@param opts? {atomic?: boolean}
+---@return integer|nil bytes Bytes written or nil on error
+---@return string|nil error Error message if failed
+function fs.writefile(path, data, opts) end
+
+---List a directory tree in one thread-pool job. Entries are depth-first,
+---`path` is joined onto the given root, and symlinks are listed but not
+---followed. Unreadable subdirectories are skipped.
+---@param path string The root directory
+---@param opts? {depth?: integer} Levels to descend (1 = like scandir; default unlimited)
+---@return {path: string, name: string, type: string}[]|nil entries
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---for _, e in ipairs(fs.walk('templates')) do
+---    if e.type == 'file' then cache[e.path] = fs.readfile(e.path) end
+---end
+---```
+function fs.walk(path, opts) end
+
+---@class fs.Mapping
+---A read-only view of a file mapped with `fs.mmap`. Offsets are 0-based.
+---Truncating the file while it is mapped makes access past the new end fault.
+local Mapping = {}
+
+---@return integer length Mapped length in bytes (also `#m`)
+function Mapping:len() end
+
+---Copy a slice into a Lua string; the slice is clamped to the mapping.
+---@param offset integer 0-based start
+---@param len? integer Bytes to copy (default: to the end)
+---@return string
+function Mapping:sub(offset, len) end
+
+---Pointer to the first byte for LuaJIT FFI access, e.g.
+---`ffi.cast('const uint8_t *', m:ptr())`. Valid only while `m` is open and referenced.
+---@return lightuserdata
+function Mapping:ptr() end
+
+---Pass an access-pattern hint to the kernel for all or part of the mapping.
+---@param hint "normal"|"sequential"|"random"|"willneed"|"dontneed"
+---@param offset? integer 0-based start (default 0)
+---@param len? integer Bytes covered (default: to the end)
+---@return boolean|nil ok
+---@return string|nil error
+function Mapping:advise(hint, offset, len) end
+
+---Unmap now instead of waiting for garbage collection. Strings from `sub` stay valid.
+function Mapping:close() end
+
+---Map a regular file read-only. The pages are shared through the page cache,
+---so processes mapping the same file share one copy and nothing is read into
+---Lua memory up front. Unmapped by `m:close()` or when `m` is collected.
+---@param path string The path to the file
+---@param hint? "normal"|"sequential"|"random"|"willneed"|"dontneed" Initial madvise hint
+---@return fs.Mapping|nil mapping The mapping or nil on error
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local db, err = fs.mmap('/var/lib/geoip.dat', 'random')
+---local header = db:sub(0, 16)
+---local ffi = require('ffi')
+---local p = ffi.cast('const uint8_t *', db:ptr())
+---```
+function fs.mmap(path, hint) end
+
 return fs
@@ -1,12 +1,34 @@
 ---@meta
 
+---Timeouts: a `timeout` argument is in milliseconds, and nil or 0 waits
+---forever. On expiry the call returns "timeout" and the socket stays usable.
+---A read that times out has consumed nothing. A write that times out has sent
+---none of its bytes, so it can be retried; if they had already been handed to
+---the kernel they are still sent, and the write returns "write pending"
+---instead, which must not be retried.
 ---@class socket
 local socket = {}
 
+---TCP tuning; fields left out keep the OS default
+---@class lunet.SocketOptions
+---@field nodelay? boolean Disable Nagle's algorithm so small writes go out at once
+---@field keepalive? boolean|integer Enable keepalive probes; a number is the idle time in seconds (true = 60, false disables)
+---@field sndbuf? integer SO_SNDBUF in bytes
+---@field rcvbuf? integer SO_RCVBUF in bytes
+
+---@class lunet.SocketConnectOptions: lunet.SocketOptions
+---@field fastopen? boolean TCP Fast Open (TCP_FASTOPEN_CONNECT, Linux 4.11+): the first write is sent with the SYN
+
+---@class lunet.SocketListenOptions: lunet.SocketOptions
+---@field reuseport? boolean
+---@field fastopen? boolean|integer Accept TCP Fast Open; a number is the pending TFO queue length (true = 256)
+---@field backlog? integer Accept queue length (default 128)
+
 ---Listen for incoming connections
 ---@param protocol string Protocol type, only "tcp" is supported
 ---@param host string Host address to bind to (e.g., "127.0.0.1", "0.0.0.0")
 ---@param port integer Port number to listen on (1-65535)
+---@param opts? lunet.SocketListenOptions Listener options. `reuseport` sets SO_REUSEPORT so several processes can share the port (tcp only); the tuning fields are applied to every accepted connection
 ---@return lightuserdata|nil listener The listener handle or nil on error
 ---@return string|nil error Error message if failed
 ---@usage
@@ -17,10 +39,11 @@ local socket = {}
 ---    error("Failed to listen: " .. err)
 ---end
 ---```
-function socket.listen(protocol, host, port) end
+function socket.listen(protocol, host, port, opts) end
 
 ---Accept an incoming connection (must be called from coroutine)
 ---@param listener lightuserdata The listener handle from socket.listen()
+---@param timeout? number Milliseconds to wait (nil or 0 waits forever)
 ---@return lightuserdata|nil client The client handle or nil on error
 ---@return string|nil error Error message if failed
 ---@usage
@@ -34,7 +57,28 @@ function socket.listen(protocol, host, port) end
 ---    -- Handle client connection
 ---end)
 ---```
-function socket.accept(listener) end
+function socket.accept(listener, timeout) end
+
+---Accept a batch of connections in one resume (must be called from coroutine)
+---Returns every queued connection (up to max) at once; if none is queued,
+---waits for the next one.
+---@param listener lightuserdata The listener handle from socket.listen()
+---@param max? integer Maximum connections to return (default 64)
+---@param timeout? number Milliseconds to wait (nil or 0 waits forever)
+---@return lightuserdata[]|nil clients Array of client handles or nil on error
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local socket = require('lunet.socket')
+---while true do
+---    local clients = socket.accept_many(listener, 128)
+---    if not clients then break end
+---    for _, c in ipairs(clients) do
+---        lunet.spawn(function() handle(c) end)
+---    end
+---end
+---```
+function socket.accept_many(listener, max, timeout) end
 
 ---Get the peer address of a connected socket
 ---@param client lightuserdata The client handle from socket.accept()
@@ -52,6 +96,7 @@ function socket.getpeername(client) end
 
 ---Read data from a socket (must be called from coroutine)
 ---@param client lightuserdata The client handle
+---@param timeout? number Milliseconds to wait (nil or 0 waits forever)
 ---@return string|nil data The received data or nil on error/EOF
 ---@return string|nil error Error message if failed
 ---@usage
@@ -68,11 +113,86 @@ function socket.getpeername(client) end
 ---    end
 ---end)
 ---```
-function socket.read(client) end
+function socket.read(client, timeout) end
+
+---Read into a lunet.buffer (must be called from coroutine)
+---Like `socket.read`, but the kernel writes straight into `buf` and no string
+---is created. Not available once `socket.read_stream` is on.
+---@param client lightuserdata The client handle
+---@param buf lunet.buffer Destination; at most `#buf` bytes are read
+---@param timeout? number Milliseconds to wait (nil or 0 waits forever)
+---@return integer|nil n Bytes read, or nil on error/EOF
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local buf = require('lunet.buffer').new(16384)
+---local n, err = socket.read_into(client, buf)
+---if n then socket.write(upstream, buf:sub(0, n)) end
+---```
+function socket.read_into(client, buf, timeout) end
+
+---Switch a client socket to streaming reads
+---Reading stays armed and incoming data is buffered in a bounded per-connection
+---buffer; `socket.read` then returns everything buffered without a syscall and
+---only waits when the buffer is empty. Reading pauses while the buffer is full.
+---@param client lightuserdata The client handle
+---@param capacity? integer Buffer size in bytes (default 65536, minimum 1024)
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local socket = require('lunet.socket')
+---socket.read_stream(client)
+---while true do
+---    local data, err = socket.read(client)
+---    if not data then break end
+---end
+---```
+function socket.read_stream(client, capacity) end
+
+---Read up to a delimiter (must be called from coroutine)
+---Bytes are accumulated in the connection's stream buffer (read_stream is
+---switched on implicitly) and exactly one frame is returned, without the
+---delimiter. Bytes after the delimiter stay buffered for the next read.
+---A frame larger than the stream buffer grows it only as its bytes arrive
+---(up to `max`), and the buffer shrinks back once the frame is consumed; the
+---same applies to `socket.read_exact`.
+---@param client lightuserdata The client handle
+---@param delim string Delimiter, 1-32 bytes (e.g. "\r\n\r\n")
+---@param max? integer Maximum bytes to buffer while searching (default 65536)
+---@param timeout? number Milliseconds to wait (nil or 0 waits forever)
+---@return string|nil frame The data before the delimiter, or nil on error/EOF
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local socket = require('lunet.socket')
+---local head, err = socket.read_until(client, "\r\n\r\n", 16384)
+---```
+function socket.read_until(client, delim, max, timeout) end
+
+---Read exactly n bytes (must be called from coroutine)
+---Returns nil, nil if the peer closes before n bytes arrived.
+---@param client lightuserdata The client handle
+---@param n integer Number of bytes to read
+---@param timeout? number Milliseconds to wait (nil or 0 waits forever)
+---@return string|nil data Exactly n bytes, or nil on error/EOF
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local socket = require('lunet.socket')
+---local body, err = socket.read_exact(client, content_length)
+---```
+function socket.read_exact(client, n, timeout) end
 
 ---Write data to a socket (must be called from coroutine)
+---The data is queued and the call returns immediately; it only blocks while
+---the socket holds more than the write high-water mark (see
+---`socket.set_write_high_water`). Queued data is flushed before `socket.close`
+---releases the connection (see `socket.set_close_timeout`). A failed write is
+---reported by the next write. `timeout` bounds only that blocking wait; see
+---the timeout notes at the top for "timeout" versus "write pending".
 ---@param client lightuserdata The client handle
----@param data string The data to send
+---@param data string|lunet.buffer The data to send; a buffer is sent without copying, so leave it unchanged until the write completes
+---@param timeout? number Milliseconds to wait (nil or 0 waits forever)
 ---@return string|nil error Error message if failed
 ---@usage
 ---```lua
@@ -84,9 +204,50 @@ function socket.read(client) end
 ---    end
 ---end)
 ---```
-function socket.write(client, data) end
+function socket.write(client, data, timeout) end
+
+---Write several chunks with a single vectored write (must be called from coroutine)
+---The strings and buffers are passed to the kernel as-is, without concatenation or copying.
+---Queues and applies backpressure like `socket.write`.
+---@param client lightuserdata The client handle
+---@param chunks (string|lunet.buffer)[] The chunks to send, in order
+---@param timeout? number Milliseconds to wait (nil or 0 waits forever)
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local socket = require('lunet.socket')
+---lunet.spawn(function()
+---    local err = socket.writev(client, {headers, body, "\r\n"})
+---    if err then
+---        print("Write error: " .. err)
+---    end
+---end)
+---```
+function socket.writev(client, chunks, timeout) end
+
+---Send part of a file to a socket without copying it through Lua (must be called from coroutine)
+---Uses sendfile(2) via `uv_fs_sendfile`. Data queued by `socket.write` goes out
+---first; other writes fail until the transfer ends. Not available on Windows.
+---@param client lightuserdata The client handle
+---@param fd integer File descriptor from `fs.open`
+---@param offset integer Byte offset in the file
+---@param len integer Number of bytes to send
+---@return integer|nil sent Bytes sent (less than len if the file is shorter)
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local socket = require('lunet.socket')
+---lunet.spawn(function()
+---    socket.write(client, headers)
+---    local sent, err = socket.sendfile(client, fd, 0, st.size)
+---end)
+---```
+function socket.sendfile(client, fd, offset, len) end
 
 ---Close a socket or listener
+---Queued writes are flushed first. If the peer has not taken them within the
+---close timeout (`socket.set_close_timeout`), they are dropped, a writer still
+---blocked gets "connection timed out" and the socket is closed anyway.
 ---@param handle lightuserdata The socket handle to close
 ---@usage
 ---```lua
@@ -97,7 +258,7 @@ function socket.write(client, data) end
 function socket.close(handle) end
 
 ---Set the read buffer size for a socket
----@param size integer The new read buffer size
+---@param size integer The new read buffer size (at least 1; raises on NaN or smaller values)
 ---@return nil
 ---@usage
 ---```lua
@@ -106,11 +267,58 @@ function socket.close(handle) end
 ---```
 function socket.set_read_buffer_size(size) end
 
+---Set how many bytes a socket may have queued or in flight before writers block
+---@param bytes integer High-water mark in bytes (default 65536; 0 waits for every write; raises if negative or NaN)
+---@return nil
+---@usage
+---```lua
+---local socket = require('lunet.socket')
+---socket.set_write_high_water(256 * 1024)
+---```
+function socket.set_write_high_water(bytes) end
+
+---Set how long `socket.close` waits for queued writes to drain
+---@param ms integer Milliseconds (default 30000; 0 waits for as long as the peer takes; raises if negative or NaN)
+---@return nil
+---@usage
+---```lua
+---local socket = require('lunet.socket')
+---socket.set_close_timeout(5000)
+---```
+function socket.set_close_timeout(ms) end
+
+---Read buffer pool counters for the calling worker. Each size passed to
+---set_read_buffer_size gets a size class (up to 4); a new size beyond that
+---recycles an existing class and counts as an eviction.
+---@return {hits: number, misses: number, evictions: number, classes: {size: integer, free: integer}[]}
+---@usage
+---```lua
+---local socket = require('lunet.socket')
+---local st = socket.read_pool_stats()
+---print(st.hits, st.misses, #st.classes)
+---```
+function socket.read_pool_stats() end
+
 ---Connect to a server
 ---@param host string The server host
 ---@param port integer The server port
+---@param timeout? number Milliseconds to wait (nil or 0 waits forever); on expiry the half-open socket is closed and "timeout" is returned
+---@param opts? lunet.SocketConnectOptions Applied before connecting (tcp only)
 ---@return lightuserdata|nil conn The connection handle or nil on error
 ---@return string|nil error Error message if failed
-function socket.connect(host, port) end
+function socket.connect(host, port, timeout, opts) end
+
+---Tune a TCP connection, e.g. one returned by socket.accept. On a listener
+---this changes the options applied to connections accepted from now on.
+---`backlog` and `fastopen` can only be given to socket.listen/socket.connect.
+---@param handle lightuserdata
+---@param opts lunet.SocketOptions
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local client = socket.accept(listener)
+---socket.setopt(client, {nodelay = true, keepalive = 15})
+---```
+function socket.setopt(handle, opts) end
 
 return socket
@@ -3,29 +3,78 @@
 ---@class udp
 local udp = {}
 
+---@class udp.BindOpts
+---@field batch? integer Datagrams per recvmmsg call (default 1, max 64; 64KiB of buffer each)
+---@field raw_addr? boolean Report peers as binary address tokens instead of host strings
+---@field paxe? boolean Decrypt received datagrams and encrypt sends with lunet.paxe (must be required first)
+---@field paxe_key? integer PAXE key id used to encrypt outgoing datagrams
+---@field max_pending? integer Drop datagrams once this many are queued unread (default unbounded)
+---@field buffers? boolean Deliver payloads as lunet.buffer instead of strings (no copy into a Lua string)
+
 ---Bind a UDP socket to host:port and start receiving datagrams.
 ---@param host string
 ---@param port integer
+---@param opts? udp.BindOpts
 ---@return lightuserdata|nil handle
 ---@return string|nil error
-function udp.bind(host, port) end
+function udp.bind(host, port, opts) end
 
 ---Send a datagram.
+---`host` may be an address token from a raw_addr socket; `port` is then ignored.
 ---@param handle lightuserdata
 ---@param host string
----@param port integer
----@param data string
+---@param port integer|nil
+---@param data string|lunet.buffer
 ---@return boolean|nil ok
 ---@return string|nil error
 function udp.send(handle, host, port, data) end
 
----Receive a datagram if one is available.
----Returns nils if none are queued (caller can yield/sleep).
+---Send several datagrams in one call.
+---Payloads are not copied; datagrams go out in sweeps of up to 64.
+---@param handle lightuserdata
+---@param msgs {[1]: string|lunet.buffer, [2]: string, [3]: integer}[] Array of {data, host, port}
+---@return integer|nil sent Number of datagrams submitted
+---@return string|nil error
+function udp.send_batch(handle, msgs) end
+
+---Send the same payload to many peers, sharing one buffer.
+---@param handle lightuserdata
+---@param data string|lunet.buffer
+---@param peers {[1]: string, [2]: integer}[] Array of {host, port}
+---@return integer|nil sent Number of datagrams submitted
+---@return string|nil error
+function udp.send_fanout(handle, data, peers) end
+
+---Receive a datagram (must be called from coroutine).
+---Yields until one is queued, or until the optional timeout expires.
 ---@param handle lightuserdata
----@return string|nil data
----@return string|nil peer_host
+---@param timeout? number Milliseconds to wait (nil or 0 waits forever); on expiry returns nil, nil, "timeout"
+---@return string|lunet.buffer|nil data A lunet.buffer on sockets bound with `buffers = true`
+---@return string|nil peer_host Host string, or an address token with raw_addr
 ---@return integer|nil peer_port
-function udp.recv(handle) end
+function udp.recv(handle, timeout) end
+
+---Receive every queued datagram (up to max) in one call.
+---Yields until at least one datagram arrives; with `batch` set on bind the
+---wake-up waits for the whole recvmmsg sweep.
+---@param handle lightuserdata
+---@param max? integer Maximum datagrams returned (default 64)
+---@param timeout? number Milliseconds to wait (nil or 0 waits forever); on expiry returns nil, "timeout"
+---@return {[1]: string|lunet.buffer, [2]: string, [3]: integer}[]|nil msgs Array of {data, host, port}
+---@return string|nil error
+function udp.recv_batch(handle, max, timeout) end
+
+---Format an address token from a raw_addr socket.
+---@param token string
+---@return string|nil host
+---@return integer|string port_or_error
+function udp.addr_string(token) end
+
+---Number of datagrams dropped because the receive queue hit max_pending.
+---@param handle lightuserdata
+---@return integer|nil dropped
+---@return string|nil error
+function udp.dropped(handle) end
 
 ---Close the UDP socket.
 ---@param handle lightuserdata
@@ -0,0 +1,41 @@
+---@meta
+
+---Cross-worker messaging for `lunet --workers N`
+---@class worker
+local worker = {}
+
+---Id of the calling worker (0-based; 0 runs on the main thread)
+---@return integer id
+function worker.id() end
+
+---Number of workers in this process (1 without --workers)
+---@return integer count
+function worker.count() end
+
+---Post a string to another worker's mailbox (never blocks)
+---@param id integer Target worker id
+---@param message string Payload, copied once
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local worker = require('lunet.worker')
+---worker.send(0, "ready")
+---```
+function worker.send(id, message) end
+
+---Receive the next message for this worker (must be called from coroutine)
+---@return string|nil message The message or nil on error
+---@return string|nil error Error message if failed
+---@usage
+---```lua
+---local worker = require('lunet.worker')
+---lunet.spawn(function()
+---    while true do
+---        local msg = worker.recv()
+---        print("got " .. msg)
+---    end
+---end)
+---```
+function worker.recv() end
+
+return worker
@@ -169,11 +169,18 @@ option("lunet_embed_scripts_dir")
     set_showmenu(true)
     set_description("Lua script directory to embed when lunet_embed_scripts is enabled")
 option_end()
+
+option("lunet_embed_bytecode")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Store embedded .lua files as LuaJIT bytecode (luajit -bg) instead of source")
+option_end()
 -- Common source files for core lunet
 local core_sources = {
     "src/main.c",
     "src/embed_scripts.c",
     "src/embed_scripts_blob.c",
+    "src/buffer.c",
     "src/co.c",
     "src/fs.c",
     "src/rt.c",
@@ -183,6 +190,9 @@ local core_sources = {
     "src/stl.c",
     "src/timer.c",
     "src/trace.c",
+    "src/worker.c",
+    "src/executor.c",
+    "src/metrics.c",
     "src/lunet_mem.c"  -- New memory wrapper implementation
 }
 
@@ -318,7 +328,7 @@ target("lunet-bin")
         add_packages("zlib")
         add_includedirs(".tmp/generated")
 
-        before_build(function ()
+        before_build(function (target)
             local root = os.projectdir()
             local generator = path.join(root, "bin", "generate_embed_scripts.lua")
             local source_dir = get_config("lunet_embed_scripts_dir") or "lua"
@@ -339,6 +349,26 @@ target("lunet-bin")
                 LUNET_EMBED_OUTPUT = output,
                 LUNET_EMBED_PROJECT_ROOT = root
             }
+            if has_config("lunet_embed_bytecode") then
+                -- Prefer the luajit the binary links against so the bytecode matches its VM
+                local luajit_pkg = target:pkg("luajit")
+                local luajit = luajit_pkg and luajit_pkg:installdir() and
+                               path.join(luajit_pkg:installdir(), "bin", is_host("windows") and "luajit.exe" or "luajit")
+                if not (luajit and os.isfile(luajit)) then
+                    -- system packages have no install dir; let the user name the matching luajit
+                    luajit = os.getenv("LUNET_EMBED_LUAJIT")
+                end
+                if not (luajit and os.isfile(luajit)) then
+                    raise("lunet_embed_bytecode needs the luajit binary matching the linked LuaJIT; " ..
+                          "set LUNET_EMBED_LUAJIT=/path/to/luajit")
+                end
+                table.insert(generator_args, "--bytecode")
+                table.insert(generator_args, "y")
+                generator_envs.LUNET_EMBED_BYTECODE = "y"
+                table.insert(generator_args, "--luajit")
+                table.insert(generator_args, luajit)
+                generator_envs.LUNET_EMBED_LUAJIT = luajit
+            end
             os.execv("xmake", generator_args, {curdir = root, envs = generator_envs})
         end)
     end
@@ -389,6 +419,9 @@ target("lunet-sqlite3")
     
     add_files(core_sources)
     add_files("ext/sqlite3/sqlite3.c")
+    add_files("src/stmt_cache.c")
+    add_files("src/db_pool.c")
+    add_files("src/db_result.c")
     add_includedirs("include", "ext/sqlite3", {public = true})
     add_packages("luajit", "libuv", "sqlite3")
     lunet_apply_asan_flags("shared")
@@ -433,6 +466,9 @@ target("lunet-mysql")
     
     add_files(core_sources)
     add_files("ext/mysql/mysql.c")
+    add_files("src/stmt_cache.c")
+    add_files("src/db_pool.c")
+    add_files("src/db_result.c")
     add_includedirs("include", "ext/mysql", {public = true})
     add_packages("luajit", "libuv", "mysql")
     lunet_apply_asan_flags("shared")
@@ -477,6 +513,9 @@ target("lunet-postgres")
     
     add_files(core_sources)
     add_files("ext/postgres/postgres.c")
+    add_files("src/stmt_cache.c")
+    add_files("src/db_pool.c")
+    add_files("src/db_result.c")
     add_includedirs("include", "ext/postgres", {public = true})
     add_packages("luajit", "libuv", "pq")
     lunet_apply_asan_flags("shared")
@@ -603,6 +642,22 @@ target("lunet-httpc")
     end
 target_end()
 
+-- Benchmark suite: xmake run lunet-bench (use a release build for numbers)
+-- Prints one JSON object per scenario; see bench/run.lua for the knobs.
+-- lunet.paxe is not a dependency (libsodium); build it first to include it.
+target("lunet-bench")
+    set_default(false)
+    set_kind("phony")
+    add_deps("lunet-bin", "lunet-sqlite3")
+    on_run(function (target)
+        if not is_mode("release") then
+            cprint("${yellow}lunet-bench: not a release build, numbers are not comparable${clear}")
+        end
+        local runner = target:dep("lunet-bin"):targetfile()
+        os.execv(runner, {"bench/run.lua"}, {curdir = os.projectdir()})
+    end)
+target_end()
+
 -- =============================================================================
 -- Developer Tasks (xmake-only workflow)
 -- =============================================================================